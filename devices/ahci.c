@@ -0,0 +1,722 @@
+#include "devices/ahci.h"
+#include <debug.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/disk.h"
+#include "devices/pci.h"
+#include "devices/timer.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Driver for SATA disks behind an AHCI host bus adapter [AHCI
+   1.3], such as the ICH9 that QEMU's q35 machine has built in, or
+   "-device ahci" on others.
+
+   Each port of the adapter has a list of up to 32 command slots in
+   memory.  A slot points to a command table holding the command,
+   as a register FIS, and a PRD table describing its data buffers,
+   scattered wherever they are in physical memory.  Setting a
+   slot's bit in the port's command issue register hands it to the
+   adapter, which moves the data by DMA and clears the bit.
+
+   Where the disk and the adapter support native command queuing,
+   commands are issued as READ/WRITE FPDMA QUEUED, tagged with
+   their slot: the disk takes as many as its queue depth at once,
+   serves them in whatever order suits it, and reports them done in
+   its SActive register.  Otherwise one DMA command is out at a
+   time.
+
+   Requests wait in a per-port queue for a free slot, requests in
+   the same direction that continue each other merged into one
+   command, and are reaped by the port's thread, as in
+   virtio-blk.c: the interrupt handler masks the port's interrupts
+   and wakes the thread, which unmasks them once nothing is left to
+   reap.
+
+   A disk on port N appears through disk_get() as hdN/2:N%2 if that
+   one is absent, as QEMU's "-drive index=N" on a q35 machine would
+   suggest, or else the first absent one. */
+
+/* HBA registers, relative to ABAR. */
+#define HBA_CAP 0x00                /* Capabilities. */
+#define HBA_GHC 0x04                /* Global host control. */
+#define HBA_IS 0x08                 /* Interrupt status, per port. */
+#define HBA_PI 0x0c                 /* Ports implemented. */
+#define HBA_PORT(N) (0x100 + (N) * 0x80)
+#define HBA_SIZE HBA_PORT (32)
+
+#define CAP_NCS(CAP) ((((CAP) >> 8) & 0x1f) + 1)   /* Command slots. */
+#define CAP_SNCQ (1u << 30)         /* Supports NCQ. */
+#define GHC_IE (1u << 1)            /* Interrupt enable. */
+#define GHC_AE (1u << 31)           /* AHCI enable. */
+
+/* Port registers, relative to HBA_PORT. */
+#define PX_CLB 0x00                 /* Command list base. */
+#define PX_CLBU 0x04
+#define PX_FB 0x08                  /* Received FIS base. */
+#define PX_FBU 0x0c
+#define PX_IS 0x10                  /* Interrupt status. */
+#define PX_IE 0x14                  /* Interrupt enable. */
+#define PX_CMD 0x18                 /* Command and status. */
+#define PX_TFD 0x20                 /* Task file data. */
+#define PX_SIG 0x24                 /* Signature. */
+#define PX_SSTS 0x28                /* SATA status. */
+#define PX_SERR 0x30                /* SATA error. */
+#define PX_SACT 0x34                /* SATA active (NCQ tags). */
+#define PX_CI 0x38                  /* Command issue. */
+
+#define CMD_ST (1u << 0)            /* Start. */
+#define CMD_FRE (1u << 4)           /* FIS receive enable. */
+#define CMD_FR (1u << 14)           /* FIS receive running. */
+#define CMD_CR (1u << 15)           /* Command list running. */
+
+#define IS_DHRS (1u << 0)           /* Register FIS from the device. */
+#define IS_PSS (1u << 1)            /* PIO setup FIS. */
+#define IS_SDBS (1u << 3)           /* Set device bits FIS (NCQ). */
+#define IS_IFS (1u << 27)           /* Interface fatal error. */
+#define IS_HBDS (1u << 28)          /* Host bus data error. */
+#define IS_HBFS (1u << 29)          /* Host bus fatal error. */
+#define IS_TFES (1u << 30)          /* Task file error. */
+#define IS_ERRORS (IS_IFS | IS_HBDS | IS_HBFS | IS_TFES)
+#define IE_MASK (IS_DHRS | IS_PSS | IS_SDBS | IS_ERRORS)
+
+#define SSTS_DET_PRESENT 3          /* Device present, link up. */
+#define SIG_ATA 0x00000101          /* An ATA disk, not ATAPI. */
+
+/* ATA commands. */
+#define ATA_IDENTIFY 0xec
+#define ATA_READ_DMA_EXT 0x25
+#define ATA_WRITE_DMA_EXT 0x35
+#define ATA_READ_FPDMA 0x60
+#define ATA_WRITE_FPDMA 0x61
+
+/* Command header, one per slot in the command list. */
+struct cmd_header {
+	uint16_t flags;             /* FIS length in dwords, write bit. */
+	uint16_t prdtl;             /* PRD table entries. */
+	uint32_t prdbc;             /* Bytes transferred. */
+	uint32_t ctba;              /* Command table address. */
+	uint32_t ctbau;
+	uint32_t reserved[4];
+};
+#define CH_WRITE (1u << 6)          /* Toward the device. */
+
+/* Physical region descriptor. */
+struct ahci_prd {
+	uint32_t dba;               /* Data address. */
+	uint32_t dbau;
+	uint32_t reserved;
+	uint32_t dbc;               /* Byte count - 1. */
+};
+
+/* Most PRDs per command.  A table is then 512 bytes, and all 32
+   fill four pages. */
+#define PRD_MAX 24
+
+/* Command table, one per slot. */
+struct cmd_table {
+	uint8_t cfis[64];           /* Command FIS. */
+	uint8_t acmd[16];           /* ATAPI command, unused. */
+	uint8_t reserved[48];
+	struct ahci_prd prdt[PRD_MAX];
+};
+#define TABLE_PAGES (32 * sizeof (struct cmd_table) / PGSIZE)
+
+/* Most sectors and merged requests in one command. */
+#define CMD_SECTORS 256
+#define BATCH_MAX 16
+
+/* Most ports driven. */
+#define PORT_MAX 6
+
+/* Part of a request that belongs to a command. */
+struct ahci_piece {
+	struct disk_req *req;       /* The request. */
+	size_t cnt;                 /* Sectors of it in the command. */
+};
+
+/* A command slot. */
+struct ahci_cmd {
+	bool write;                 /* Toward the device? */
+	disk_sector_t sec_no;       /* First sector. */
+	size_t cnt;                 /* Sectors. */
+	struct ahci_piece pieces[BATCH_MAX];
+	size_t piece_cnt;
+};
+
+/* A SATA disk on a port of the adapter. */
+struct ahci_port {
+	char name[8];               /* Name, e.g. "sda". */
+	struct disk *disk;          /* Disk it serves. */
+	int port_no;                /* Port on the adapter. */
+	volatile uint32_t *regs;    /* Port registers. */
+	uint8_t irq;                /* Interrupt vector. */
+	bool ncq;                   /* Native command queuing? */
+	size_t slot_cnt;            /* Slots used, 32 at most. */
+
+	/* Command list, received FISes and an IDENTIFY buffer in one
+	   page, then the command tables. */
+	volatile struct cmd_header *cmd_list;
+	volatile struct cmd_table *tables;
+	uint16_t *ident;
+
+	struct lock lock;           /* Protects the members below. */
+	struct list queue;          /* Requests not yet fully issued. */
+	struct ahci_cmd cmds[32];
+	uint32_t busy;              /* Slots out, by bit. */
+	size_t inflight;            /* Number of slots out. */
+	struct semaphore intr_sema; /* Up'd by the interrupt handler. */
+
+	/* Statistics. */
+	long long req_cnt;          /* Requests submitted. */
+	long long merge_cnt;        /* Requests merged into another's command. */
+	long long cmd_done_cnt;     /* Commands completed. */
+	long long prd_cnt;          /* PRDs in those commands. */
+	long long intr_cnt;         /* Interrupts taken. */
+	long long wakeup_cnt;       /* Wakeups of the thread that reaped some. */
+	size_t max_inflight;        /* Most commands out at once. */
+};
+
+static struct ahci_port ports[PORT_MAX];
+static size_t port_cnt;
+
+static volatile uint32_t *map_abar (uint32_t pa);
+static bool probe_port (struct ahci_port *, uint32_t cap);
+static bool stop_port (struct ahci_port *);
+static bool identify (struct ahci_port *);
+static void completion_thread (void *);
+static void ahci_submit (void *, struct disk_req *);
+static void interrupt_handler (struct intr_frame *);
+
+static const struct disk_driver ahci_driver = {
+	.name = "SATA",
+	.submit = ahci_submit,
+};
+
+/* Returns port register REG of P. */
+static inline volatile uint32_t *
+port_reg (struct ahci_port *p, int reg) {
+	return &p->regs[reg / sizeof *p->regs];
+}
+
+/* Looks on PCI bus 0 for AHCI adapters and makes a disk of each
+   SATA disk on them.  Called by disk_init() once the IDE disks
+   are found. */
+void
+ahci_init (void) {
+	int dev, func;
+
+	for (dev = 0; dev < 32; dev++)
+		for (func = 0; func < 8; func++) {
+			uint32_t id = pci_read_config (0, dev, func, 0x00);
+			uint32_t class, cmd, cap, pi;
+			volatile uint32_t *abar;
+			uint8_t line;
+			size_t first = port_cnt, i;
+			int n;
+
+			if ((id & 0xffff) == 0xffff)
+				continue;
+			class = pci_read_config (0, dev, func, 0x08) >> 8;
+			if (class != 0x010601)
+				continue;
+			line = pci_read_config (0, dev, func, 0x3c) & 0xff;
+			abar = map_abar (pci_read_config (0, dev, func, 0x24) & ~0xfu);
+			if (abar == NULL || line >= 16) {
+				printf ("ahci: cannot use adapter %02x.%x\n", dev, func);
+				continue;
+			}
+
+			/* Enable memory space and bus mastering, then AHCI mode,
+			   with interrupts off until the ports are ready. */
+			cmd = pci_read_config (0, dev, func, 0x04);
+			pci_write_config (0, dev, func, 0x04, cmd | 0x06);
+			abar[HBA_GHC / 4] = GHC_AE;
+			cap = abar[HBA_CAP / 4];
+			pi = abar[HBA_PI / 4];
+
+			for (n = 0; n < 32 && port_cnt < PORT_MAX; n++) {
+				struct ahci_port *p = &ports[port_cnt];
+
+				if (!(pi & (1u << n)))
+					continue;
+				p->regs = abar + HBA_PORT (n) / 4;
+				p->port_no = n;
+				p->irq = 0x20 + line;
+				if ((*port_reg (p, PX_SSTS) & 0xf) != SSTS_DET_PRESENT
+						|| *port_reg (p, PX_SIG) != SIG_ATA)
+					continue;
+				snprintf (p->name, sizeof p->name, "sd%c",
+						(int) ('a' + port_cnt));
+				if (probe_port (p, cap))
+					port_cnt++;
+			}
+			if (port_cnt == first)
+				continue;
+
+			/* Let the ports interrupt. */
+			pci_register_intr (line, interrupt_handler, "ahci");
+			abar[HBA_IS / 4] = abar[HBA_IS / 4];
+			abar[HBA_GHC / 4] = GHC_AE | GHC_IE;
+			for (i = first; i < port_cnt; i++) {
+				*port_reg (&ports[i], PX_IE) = IE_MASK;
+				if (thread_create (ports[i].name, PRI_MAX, completion_thread,
+							&ports[i]) == TID_ERROR)
+					PANIC ("%s: cannot start I/O thread", ports[i].name);
+			}
+		}
+}
+
+/* Maps the HBA_SIZE bytes of registers at physical address PA,
+   uncached, and returns their kernel virtual address, or a null
+   pointer if PA is unusable or memory is short. */
+static volatile uint32_t *
+map_abar (uint32_t pa) {
+	uint64_t ofs;
+
+	if (pa == 0 || pg_ofs (pa) != 0)
+		return NULL;
+	for (ofs = 0; ofs < HBA_SIZE; ofs += PGSIZE) {
+		uint64_t *pte = pml4e_walk (base_pml4, (uint64_t) ptov (pa + ofs), 1);
+		if (pte == NULL)
+			return NULL;
+		*pte = (pa + ofs) | PTE_P | PTE_W | PTE_PWT | PTE_PCD;
+	}
+	return ptov (pa);
+}
+
+/* Waits up to MS milliseconds for the bits in MASK of P's register
+   REG to be clear.  Returns true if they are. */
+static bool
+wait_clear (struct ahci_port *p, int reg, uint32_t mask, int ms) {
+	while (*port_reg (p, reg) & mask) {
+		if (ms-- <= 0)
+			return false;
+		timer_msleep (1);
+	}
+	return true;
+}
+
+/* Brings up the disk on port P of an adapter with capabilities
+   CAP and attaches it.  Returns true if successful. */
+static bool
+probe_port (struct ahci_port *p, uint32_t cap) {
+	uint8_t *page;
+	size_t slot;
+	uint64_t pa;
+	disk_sector_t capacity;
+	char hint[16];
+
+	if (!stop_port (p)) {
+		printf ("%s: port %d does not stop, ignored\n", p->name, p->port_no);
+		return false;
+	}
+
+	/* Command list at 0, received FISes at 1 kB, IDENTIFY data at
+	   2 kB, then the command tables. */
+	page = palloc_get_multiple (PAL_ZERO, 1 + TABLE_PAGES);
+	if (page == NULL) {
+		printf ("%s: out of memory\n", p->name);
+		return false;
+	}
+	p->cmd_list = (struct cmd_header *) page;
+	p->ident = (uint16_t *) (page + 2048);
+	p->tables = (struct cmd_table *) (page + PGSIZE);
+	for (slot = 0; slot < 32; slot++) {
+		pa = vtop (&p->tables[slot]);
+		p->cmd_list[slot].ctba = pa;
+		p->cmd_list[slot].ctbau = pa >> 32;
+	}
+	pa = vtop (page);
+	*port_reg (p, PX_CLB) = pa;
+	*port_reg (p, PX_CLBU) = pa >> 32;
+	*port_reg (p, PX_FB) = pa + 1024;
+	*port_reg (p, PX_FBU) = (pa + 1024) >> 32;
+	*port_reg (p, PX_SERR) = 0xffffffff;
+	*port_reg (p, PX_IS) = 0xffffffff;
+	*port_reg (p, PX_IE) = 0;
+	*port_reg (p, PX_CMD) |= CMD_FRE;
+	*port_reg (p, PX_CMD) |= CMD_ST;
+
+	if (!identify (p)) {
+		printf ("%s: IDENTIFY failed, ignored\n", p->name);
+		stop_port (p);
+		palloc_free_multiple (page, 1 + TABLE_PAGES);
+		return false;
+	}
+
+	/* Words 100-103 hold the LBA48 capacity, 60-61 the LBA28 one;
+	   75 the queue depth and 76 whether NCQ is supported. */
+	if (p->ident[83] & (1 << 10))
+		capacity = p->ident[102] || p->ident[103] ? UINT32_MAX
+			: p->ident[100] | ((uint32_t) p->ident[101] << 16);
+	else
+		capacity = p->ident[60] | ((uint32_t) p->ident[61] << 16);
+	p->ncq = (cap & CAP_SNCQ) && (p->ident[76] & (1 << 8));
+	p->slot_cnt = 1;
+	if (p->ncq) {
+		p->slot_cnt = (p->ident[75] & 0x1f) + 1;
+		if (p->slot_cnt > CAP_NCS (cap))
+			p->slot_cnt = CAP_NCS (cap);
+	}
+
+	lock_init (&p->lock);
+	list_init (&p->queue);
+	sema_init (&p->intr_sema, 0);
+	snprintf (hint, sizeof hint, "hd%d:%d", (p->port_no / 2) & 0xf,
+			p->port_no % 2);
+	p->disk = disk_attach (hint, capacity, &ahci_driver, p);
+	if (p->disk == NULL) {
+		printf ("%s: no disk slot left, ignored\n", p->name);
+		stop_port (p);
+		palloc_free_multiple (page, 1 + TABLE_PAGES);
+		return false;
+	}
+	printf ("%s: %s, %zu command slots\n", p->name,
+			p->ncq ? "NCQ" : "no NCQ", p->slot_cnt);
+	return true;
+}
+
+/* Stops port P's command list and FIS receive engines.  Returns
+   true if they stopped. */
+static bool
+stop_port (struct ahci_port *p) {
+	*port_reg (p, PX_CMD) &= ~CMD_ST;
+	if (!wait_clear (p, PX_CMD, CMD_CR, 500))
+		return false;
+	*port_reg (p, PX_CMD) &= ~CMD_FRE;
+	return wait_clear (p, PX_CMD, CMD_FR, 500);
+}
+
+/* Fills in the register FIS of slot SLOT of P for ATA command
+   COMMAND at sector SEC_NO, with COUNT in the count field and
+   FEATURE in the feature field. */
+static void
+build_fis (struct ahci_port *p, size_t slot, uint8_t command,
+		disk_sector_t sec_no, uint16_t count, uint16_t feature) {
+	volatile uint8_t *fis = p->tables[slot].cfis;
+
+	memset ((void *) fis, 0, 20);
+	fis[0] = 0x27;                  /* Register FIS, host to device. */
+	fis[1] = 0x80;                  /* Command, not control. */
+	fis[2] = command;
+	fis[3] = feature;
+	fis[4] = sec_no;
+	fis[5] = sec_no >> 8;
+	fis[6] = sec_no >> 16;
+	fis[7] = command == ATA_IDENTIFY ? 0 : 0x40;    /* LBA. */
+	fis[8] = sec_no >> 24;
+	fis[11] = feature >> 8;
+	fis[12] = count;
+	fis[13] = count >> 8;
+}
+
+/* Reads P's IDENTIFY DEVICE data into P->IDENT, polling, since
+   interrupts are still off.  Returns true if successful. */
+static bool
+identify (struct ahci_port *p) {
+	uint64_t pa = vtop (p->ident);
+
+	build_fis (p, 0, ATA_IDENTIFY, 0, 0, 0);
+	p->tables[0].prdt[0].dba = pa;
+	p->tables[0].prdt[0].dbau = pa >> 32;
+	p->tables[0].prdt[0].dbc = DISK_SECTOR_SIZE - 1;
+	p->cmd_list[0].flags = 5;
+	p->cmd_list[0].prdtl = 1;
+	p->cmd_list[0].prdbc = 0;
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+	*port_reg (p, PX_CI) = 1;
+
+	if (!wait_clear (p, PX_CI, 1, 1000)
+			|| (*port_reg (p, PX_IS) & IS_ERRORS))
+		return false;
+	*port_reg (p, PX_IS) = *port_reg (p, PX_IS);
+	return true;
+}
+
+/* Returns the first sector of REQ not yet given to the device. */
+static disk_sector_t
+req_issue_next (const struct disk_req *req) {
+	return req->sec_no + req->issued_cnt;
+}
+
+/* Returns a request in P's queue in direction WRITE that starts at
+   sector SEC_NO and has no part issued yet, or a null pointer if
+   there is none.  P's lock must be held. */
+static struct disk_req *
+find_adjacent (struct ahci_port *p, disk_sector_t sec_no, bool write) {
+	struct list_elem *e;
+
+	for (e = list_begin (&p->queue); e != list_end (&p->queue);
+			e = list_next (e)) {
+		struct disk_req *r = list_entry (e, struct disk_req, elem);
+		if (r->write == write && r->issued_cnt == 0 && r->sec_no == sec_no)
+			return r;
+	}
+	return NULL;
+}
+
+/* Appends the sector at BUFFER to the *CNT PRDs of PRDT, joining
+   physically contiguous ones.  Returns false, adding nothing, if
+   that would make more than PRD_MAX. */
+static bool
+add_sector (volatile struct ahci_prd *prdt, size_t *cnt,
+		const uint8_t *buffer) {
+	uint64_t pa[2], len[2], end;
+	size_t chunk_cnt, need, i;
+
+	/* A sector crosses a page boundary at most once. */
+	len[0] = PGSIZE - pg_ofs (buffer) < DISK_SECTOR_SIZE
+		? PGSIZE - pg_ofs (buffer) : DISK_SECTOR_SIZE;
+	pa[0] = pci_dma_addr (buffer);
+	chunk_cnt = 1;
+	if (len[0] < DISK_SECTOR_SIZE) {
+		len[1] = DISK_SECTOR_SIZE - len[0];
+		pa[1] = pci_dma_addr (buffer + len[0]);
+		chunk_cnt = 2;
+	}
+	ASSERT ((pa[0] & 1) == 0);
+
+	end = *cnt > 0 ? (prdt[*cnt - 1].dba | (uint64_t) prdt[*cnt - 1].dbau << 32)
+		+ prdt[*cnt - 1].dbc + 1 : UINT64_MAX;
+	for (i = need = 0; i < chunk_cnt; i++) {
+		if (pa[i] != end)
+			need++;
+		end = pa[i] + len[i];
+	}
+	if (*cnt + need > PRD_MAX)
+		return false;
+
+	end = *cnt > 0 ? (prdt[*cnt - 1].dba | (uint64_t) prdt[*cnt - 1].dbau << 32)
+		+ prdt[*cnt - 1].dbc + 1 : UINT64_MAX;
+	for (i = 0; i < chunk_cnt; i++) {
+		if (pa[i] == end)
+			prdt[*cnt - 1].dbc += len[i];
+		else {
+			prdt[*cnt].dba = pa[i];
+			prdt[*cnt].dbau = pa[i] >> 32;
+			prdt[*cnt].dbc = len[i] - 1;
+			(*cnt)++;
+		}
+		end = pa[i] + len[i];
+	}
+	return true;
+}
+
+/* Fills slot SLOT of P from the requests at the front of its queue.
+   P's queue must not be empty and its lock must be held. */
+static void
+build_command (struct ahci_port *p, size_t slot) {
+	struct ahci_cmd *cmd = &p->cmds[slot];
+	volatile struct ahci_prd *prdt = p->tables[slot].prdt;
+	size_t prd_cnt = 0;
+	struct disk_req *r = list_entry (list_front (&p->queue),
+			struct disk_req, elem);
+
+	cmd->write = r->write;
+	cmd->sec_no = req_issue_next (r);
+	cmd->cnt = 0;
+	cmd->piece_cnt = 0;
+	do {
+		struct ahci_piece *piece = &cmd->pieces[cmd->piece_cnt];
+		const uint8_t *b = (const uint8_t *) r->buffer
+			+ r->issued_cnt * DISK_SECTOR_SIZE;
+
+		/* Take sectors as long as the PRDs last. */
+		piece->req = r;
+		piece->cnt = 0;
+		while (r->issued_cnt < r->cnt && cmd->cnt < CMD_SECTORS
+				&& add_sector (prdt, &prd_cnt, b)) {
+			b += DISK_SECTOR_SIZE;
+			r->issued_cnt++;
+			piece->cnt++;
+			cmd->cnt++;
+		}
+		if (piece->cnt == 0)
+			break;
+		cmd->piece_cnt++;
+		if (cmd->piece_cnt > 1)
+			p->merge_cnt++;
+		if (r->issued_cnt == r->cnt)
+			list_remove (&r->elem);
+		else
+			break;
+	} while (cmd->cnt < CMD_SECTORS && cmd->piece_cnt < BATCH_MAX
+			&& (r = find_adjacent (p, cmd->sec_no + cmd->cnt,
+					cmd->write)) != NULL);
+	ASSERT (cmd->cnt > 0);
+
+	/* NCQ commands carry the count in the feature field and the
+	   tag in the count field. */
+	if (p->ncq)
+		build_fis (p, slot, cmd->write ? ATA_WRITE_FPDMA : ATA_READ_FPDMA,
+				cmd->sec_no, slot << 3, cmd->cnt);
+	else
+		build_fis (p, slot, cmd->write ? ATA_WRITE_DMA_EXT : ATA_READ_DMA_EXT,
+				cmd->sec_no, cmd->cnt, 0);
+	p->cmd_list[slot].flags = 5 | (cmd->write ? CH_WRITE : 0);
+	p->cmd_list[slot].prdtl = prd_cnt;
+	p->cmd_list[slot].prdbc = 0;
+	p->prd_cnt += prd_cnt;
+}
+
+/* Issues commands for P's queued requests while slots are free.
+   P's lock must be held. */
+static void
+issue_commands (struct ahci_port *p) {
+	uint32_t issue = 0, bits;
+	size_t slot;
+
+	for (slot = 0; slot < p->slot_cnt && !list_empty (&p->queue); slot++)
+		if (!(p->busy & (1u << slot))) {
+			build_command (p, slot);
+			issue |= 1u << slot;
+		}
+	if (issue == 0)
+		return;
+
+	p->busy |= issue;
+	for (bits = issue; bits != 0; bits &= bits - 1)
+		p->inflight++;
+	if (p->inflight > p->max_inflight)
+		p->max_inflight = p->inflight;
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+	if (p->ncq)
+		*port_reg (p, PX_SACT) = issue;
+	*port_reg (p, PX_CI) = issue;
+}
+
+/* Returns the slots of P that are done. */
+static uint32_t
+done_slots (struct ahci_port *p) {
+	uint32_t out = *port_reg (p, PX_CI);
+
+	if (p->ncq)
+		out |= *port_reg (p, PX_SACT);
+	return p->busy & ~out;
+}
+
+/* Completes the command in slot SLOT of P, moving the requests it
+   finishes to DONE.  P's lock must be held. */
+static void
+finish_command (struct ahci_port *p, size_t slot, struct list *done) {
+	struct ahci_cmd *cmd = &p->cmds[slot];
+	size_t i;
+
+	disk_account_cmd (p->disk, cmd->cnt, cmd->write);
+	p->cmd_done_cnt++;
+	for (i = 0; i < cmd->piece_cnt; i++) {
+		struct disk_req *r = cmd->pieces[i].req;
+		r->done_cnt += cmd->pieces[i].cnt;
+		if (r->done_cnt == r->cnt)
+			list_push_back (done, &r->elem);
+	}
+	p->busy &= ~(1u << slot);
+	p->inflight--;
+}
+
+/* Reaps P_'s completed commands whenever the interrupt handler
+   says there are some, refills the slots, and completes requests. */
+static void
+completion_thread (void *p_) {
+	struct ahci_port *p = p_;
+
+	for (;;) {
+		struct list done;
+		size_t reaped = 0;
+
+		sema_down (&p->intr_sema);
+		list_init (&done);
+		lock_acquire (&p->lock);
+		for (;;) {
+			uint32_t is = *port_reg (p, PX_IS), slots;
+
+			*port_reg (p, PX_IS) = is;
+			if (is & IS_ERRORS)
+				PANIC ("%s: command failed, status=%08x, task file=%04x",
+						p->name, is, *port_reg (p, PX_TFD) & 0xffff);
+			for (slots = done_slots (p); slots != 0; slots &= slots - 1) {
+				finish_command (p, __builtin_ctz (slots), &done);
+				reaped++;
+			}
+
+			/* Interrupt again, unless the disk got more done in the
+			   meantime. */
+			*port_reg (p, PX_IE) = IE_MASK;
+			if (done_slots (p) == 0)
+				break;
+			*port_reg (p, PX_IE) = 0;
+		}
+		if (reaped > 0)
+			p->wakeup_cnt++;
+		issue_commands (p);
+		lock_release (&p->lock);
+
+		while (!list_empty (&done))
+			disk_complete (list_entry (list_pop_front (&done),
+						struct disk_req, elem));
+	}
+}
+
+/* Queues REQ on P_ and issues it if a slot is free. */
+static void
+ahci_submit (void *p_, struct disk_req *req) {
+	struct ahci_port *p = p_;
+
+	lock_acquire (&p->lock);
+	list_push_back (&p->queue, &req->elem);
+	p->req_cnt++;
+	issue_commands (p);
+	lock_release (&p->lock);
+}
+
+/* AHCI interrupt handler.  Masks the interrupts of each port that
+   raised one, which lowers the line, and wakes its thread. */
+static void
+interrupt_handler (struct intr_frame *f) {
+	size_t i;
+
+	for (i = 0; i < port_cnt; i++) {
+		struct ahci_port *p = &ports[i];
+		volatile uint32_t *hba_is = p->regs - HBA_PORT (p->port_no) / 4
+			+ HBA_IS / 4;
+
+		if (p->irq == f->vec_no && (*hba_is & (1u << p->port_no))) {
+			*port_reg (p, PX_IE) = 0;
+			*hba_is = 1u << p->port_no;
+			p->intr_cnt++;
+			sema_up (&p->intr_sema);
+		}
+	}
+}
+
+/* Prints AHCI statistics. */
+void
+ahci_print_stats (void) {
+	size_t i;
+
+	for (i = 0; i < port_cnt; i++) {
+		struct ahci_port *p = &ports[i];
+		long long cmds = p->cmd_done_cnt > 0 ? p->cmd_done_cnt : 1;
+		long long wakeups = p->wakeup_cnt > 0 ? p->wakeup_cnt : 1;
+
+		if (p->req_cnt == 0)
+			continue;
+		printf ("%s: %lld requests, %lld merged, %lld commands "
+				"(%lld.%02lld PRDs each), %zu max in flight\n",
+				p->name, p->req_cnt, p->merge_cnt, p->cmd_done_cnt,
+				p->prd_cnt / cmds, p->prd_cnt * 100 / cmds % 100,
+				p->max_inflight);
+		printf ("%s: %lld interrupts, %lld.%02lld commands per wakeup\n",
+				p->name, p->intr_cnt, p->cmd_done_cnt / wakeups,
+				p->cmd_done_cnt * 100 / wakeups % 100);
+	}
+}
@@ -0,0 +1,24 @@
+#include "devices/debugcon.h"
+#include "threads/io.h"
+
+/* The Bochs and QEMU debug console: whatever is written to I/O
+   port 0xe9 goes straight to the emulator's log ("-debugcon" in
+   QEMU).  Unlike the 16550 UART, which takes an emulated register
+   write per byte and waits for its transmit buffer, a whole run of
+   output is a single "rep outsb", so it is far cheaper for tests
+   that print a lot.  There is no input side. */
+
+#define DEBUGCON_PORT 0xe9
+
+/* Returns true if the debug console exists.  Reading the port
+   returns 0xe9 if it does, and 0xff from an empty port. */
+bool
+debugcon_present (void) {
+	return inb (DEBUGCON_PORT) == DEBUGCON_PORT;
+}
+
+/* Writes the N characters in BUF to the debug console. */
+void
+debugcon_putbuf (const char *buf, size_t n) {
+	outsb (DEBUGCON_PORT, buf, n);
+}
@@ -1,15 +1,34 @@
 #include "devices/disk.h"
 #include <ctype.h>
 #include <debug.h>
+#include <intrinsic.h>
+#include <limits.h>
+#include <pcounter.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
+#include "devices/ahci.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
+#include "devices/virtio-blk.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/trace.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].
+
+   Transfers use bus-master DMA where a PCI IDE controller with
+   bus-master registers is found (such as the PIIX that QEMU and
+   Bochs emulate) and the buffer is directly mapped kernel memory
+   below 4 GB.  Otherwise they fall back to PIO.
+
+   A disk that is not on an IDE channel may be served by another
+   driver instead, such as ahci.c or virtio-blk.c, which registers
+   it with disk_attach(). */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -32,6 +51,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -47,6 +67,81 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_DMA 0xc8               /* READ DMA with retries. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA with retries. */
+#define CMD_READ_SECTOR_EXT 0x24        /* READ SECTOR EXT (LBA48). */
+#define CMD_WRITE_SECTOR_EXT 0x34       /* WRITE SECTOR EXT (LBA48). */
+#define CMD_READ_DMA_EXT 0x25           /* READ DMA EXT (LBA48). */
+#define CMD_WRITE_DMA_EXT 0x35          /* WRITE DMA EXT (LBA48). */
+#define CMD_WRITE_DMA_FUA_EXT 0x3d      /* WRITE DMA FUA EXT (LBA48). */
+#define CMD_FLUSH_CACHE 0xe7            /* FLUSH CACHE. */
+#define CMD_FLUSH_CACHE_EXT 0xea        /* FLUSH CACHE EXT (LBA48). */
+
+/* Most sectors moved by one command.  256 is the LBA28 limit, and
+   also fits in one PRD table. */
+#define MAX_CMD_SECTORS 256
+
+/* Bus-master IDE registers, relative to a channel's BM_BASE. */
+#define BM_COMMAND 0            /* Command. */
+#define BM_STATUS 2             /* Status. */
+#define BM_PRDT 4               /* Physical address of PRD table. */
+
+/* Bus-master command and status bits. */
+#define BMC_START 0x01          /* Start transfer. */
+#define BMC_READ 0x08           /* Transfer from device to memory. */
+#define BMS_ERR 0x02            /* Error (write 1 to clear). */
+#define BMS_IRQ 0x04            /* Interrupt (write 1 to clear). */
+
+/* Physical region descriptor: one contiguous piece of a DMA
+   buffer.  A region may not cross a 64 kB boundary. */
+struct prd {
+	uint32_t addr;              /* Physical address. */
+	uint16_t size;              /* Size in bytes, 0 means 64 kB. */
+	uint16_t flags;             /* PRD_EOT on the last region. */
+};
+#define PRD_EOT 0x8000          /* End of table. */
+#define PRD_CNT 32              /* Regions per channel table. */
+
+/* Most requests merged into one command. */
+#define BATCH_MAX 16
+
+/* Latency histogram buckets: bucket N counts requests that took
+   from 2**N to 2**(N+1) - 1 TSC cycles, the last bucket taking
+   everything slower. */
+#define LAT_BUCKETS 40
+
+/* Levels within the realtime and best-effort classes, each taking
+   an equal share of the thread priorities. */
+#define IOC_LEVELS 8
+
+/* A queued request climbs one rank for every AGE_TICKS it waits,
+   about 20 ms, so that a best-effort request at the default level
+   waits behind realtime ones for at most about 240 ms, and an idle
+   one behind anything for about 320 ms. */
+#define AGE_TICKS ((TIMER_FREQ + 49) / 50)
+
+/* Virtual time a sector takes from a share of weight 1. */
+#define SHARE_SECTOR_COST ((uint64_t) 1 << 16)
+
+/* The share of threads that have none of their own. */
+static struct disk_share default_share = { .weight = DISK_WEIGHT_DEFAULT };
+
+/* Names of enum disk_ioclass values. */
+static const char *ioclass_names[DISK_IOC_CNT] = {
+	"best-effort", "realtime", "idle",
+};
+
+/* Names of enum disk_src values. */
+static const char *src_names[DISK_SRC_CNT] = {
+	"other", "metadata", "data", "read-ahead", "writeback",
+	"swap-in", "swap-out",
+};
+
+/* Part of a request that belongs to a batch. */
+struct piece {
+	struct disk_req *req;       /* The request. */
+	size_t cnt;                 /* Sectors of it in this batch. */
+};
 
 /* An ATA device. */
 struct disk {
@@ -55,10 +150,31 @@ struct disk {
 	int dev_no;                 /* Device 0 or 1 for master or slave. */
 
 	bool is_ata;                /* 1=This device is an ATA disk. */
-	disk_sector_t capacity;     /* Capacity in sectors (if is_ata). */
-
-	long long read_cnt;         /* Number of sectors read. */
-	long long write_cnt;        /* Number of sectors written. */
+	const struct disk_driver *driver;   /* Driver, if not an ATA disk. */
+	void *driver_aux;           /* For use by DRIVER. */
+	bool dma;                   /* Device supports DMA? */
+	bool lba48;                 /* Device supports 48-bit LBA? */
+	bool write_cache;           /* Volatile write cache enabled? */
+	bool fua;                   /* Device supports WRITE DMA FUA EXT? */
+	disk_sector_t capacity;     /* Capacity in sectors (if present). */
+
+	/* Counted by whichever I/O or completion thread finishes a
+	   command, on any CPU. */
+	struct pcounter read_cnt;   /* Number of sectors read. */
+	struct pcounter write_cnt;  /* Number of sectors written. */
+	struct pcounter read_cmd_cnt;   /* Number of read commands. */
+	struct pcounter write_cmd_cnt;  /* Number of write commands. */
+	long long flush_cnt;        /* Cache flushes, by the I/O thread. */
+	long long fua_cnt;          /* Writes forced through the cache. */
+
+	/* Request latency, submission to completion, and per-source
+	   totals.  Updated by the channel's I/O thread only. */
+	long long lat_hist[LAT_BUCKETS];        /* Requests by log2 cycles. */
+	long long src_req_cnt[DISK_SRC_CNT];    /* Requests by source. */
+	long long src_sector_cnt[DISK_SRC_CNT]; /* Sectors by source. */
+	uint64_t src_tsc[DISK_SRC_CNT];         /* Total latency by source. */
+	long long ioc_req_cnt[DISK_IOC_CNT];    /* Requests by class. */
+	uint64_t ioc_tsc[DISK_IOC_CNT];         /* Total latency by class. */
 };
 
 /* An ATA channel (aka controller).
@@ -68,23 +184,50 @@ struct channel {
 	uint16_t reg_base;          /* Base I/O port. */
 	uint8_t irq;                /* Interrupt in use. */
 
-	struct lock lock;           /* Must acquire to access the controller. */
+	struct lock lock;           /* Protects QUEUE and HEAD. */
+	struct condition queue_cond;    /* Signaled when QUEUE gains a request. */
+	struct list queue;          /* Pending struct disk_reqs. */
+	uint64_t head;              /* Elevator position, as a req_key(). */
+	uint64_t vtime;             /* Virtual start time of the latest request
+	                               served, for shares of disk time. */
 	bool expecting_interrupt;   /* True if an interrupt is expected, false if
 								   any interrupt would be spurious. */
 	struct semaphore completion_wait;   /* Up'd by interrupt handler. */
+	uint16_t bm_base;           /* Bus-master registers, or 0 if none. */
+	struct prd *prdt;           /* PRD table for bus-master DMA. */
+
+	long long req_cnt;          /* Requests submitted. */
+	long long merge_cnt;        /* Requests merged into another's command. */
+	long long aged_cnt;         /* Requests served above their rank. */
+	uint64_t start_tsc;         /* TSC when the I/O thread started. */
+	uint64_t busy_tsc;          /* TSC cycles spent with a command out. */
+	size_t queue_len;           /* Requests now in QUEUE. */
+	size_t max_queue_len;       /* Highest QUEUE_LEN seen. */
+	long long queue_len_sum;    /* Sum of QUEUE_LEN seen by submitters. */
 
 	struct disk devices[2];     /* The devices on this channel. */
 };
 
 /* We support the two "legacy" ATA channels found in a standard PC. */
-#define CHANNEL_CNT 2
+#define CHANNEL_CNT DISK_CHANNEL_CNT
 static struct channel channels[CHANNEL_CNT];
 
+/* PRD tables.  Aligning each to its size keeps it from crossing
+   a 64 kB boundary, as the controller requires. */
+static struct prd prd_tables[CHANNEL_CNT][PRD_CNT]
+	__attribute__ ((aligned (PRD_CNT * sizeof (struct prd))));
+
 static void reset_channel (struct channel *);
 static bool check_device_type (struct disk *);
 static void identify_ata_device (struct disk *);
 
-static void select_sector (struct disk *, disk_sector_t);
+static uint16_t find_bus_master (void);
+static bool dma_transfer (struct disk *, disk_sector_t, size_t cnt,
+		const struct piece *, size_t piece_cnt, bool write, bool fua);
+
+static bool select_sector (struct disk *, disk_sector_t, size_t cnt,
+		bool ext);
+static void channel_thread (void *);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -99,6 +242,7 @@ static void interrupt_handler (struct intr_frame *);
 /* Initialize the disk subsystem and detect disks. */
 void
 disk_init (void) {
+	uint16_t bm_base = find_bus_master ();
 	size_t chan_no;
 
 	for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++) {
@@ -120,8 +264,17 @@ disk_init (void) {
 				NOT_REACHED ();
 		}
 		lock_init (&c->lock);
+		cond_init (&c->queue_cond);
+		list_init (&c->queue);
+		c->head = c->vtime = 0;
+		c->req_cnt = c->merge_cnt = c->aged_cnt = 0;
+		c->busy_tsc = 0;
+		c->queue_len = c->max_queue_len = 0;
+		c->queue_len_sum = 0;
 		c->expecting_interrupt = false;
 		sema_init (&c->completion_wait, 0);
+		c->bm_base = bm_base != 0 ? bm_base + chan_no * 8 : 0;
+		c->prdt = prd_tables[chan_no];
 
 		/* Initialize devices. */
 		for (dev_no = 0; dev_no < 2; dev_no++) {
@@ -131,9 +284,20 @@ disk_init (void) {
 			d->dev_no = dev_no;
 
 			d->is_ata = false;
+			d->driver = NULL;
+			d->driver_aux = NULL;
+			d->dma = false;
+			d->lba48 = false;
 			d->capacity = 0;
 
-			d->read_cnt = d->write_cnt = 0;
+			pcounter_init (&d->read_cnt);
+			pcounter_init (&d->write_cnt);
+			pcounter_init (&d->read_cmd_cnt);
+			pcounter_init (&d->write_cmd_cnt);
+			memset (d->lat_hist, 0, sizeof d->lat_hist);
+			memset (d->src_req_cnt, 0, sizeof d->src_req_cnt);
+			memset (d->src_sector_cnt, 0, sizeof d->src_sector_cnt);
+			memset (d->src_tsc, 0, sizeof d->src_tsc);
 		}
 
 		/* Register interrupt handler. */
@@ -150,27 +314,89 @@ disk_init (void) {
 		for (dev_no = 0; dev_no < 2; dev_no++)
 			if (c->devices[dev_no].is_ata)
 				identify_ata_device (&c->devices[dev_no]);
+
+		/* From here on only the channel's thread touches the
+		   controller. */
+		if (thread_create (c->name, PRI_MAX, channel_thread, c) == TID_ERROR)
+			PANIC ("%s: cannot start I/O thread", c->name);
 	}
 
+	/* Disks on other controllers take the places of absent IDE
+	   disks. */
+	ahci_init ();
+	virtio_blk_init ();
+
 	/* DO NOT MODIFY BELOW LINES. */
 	register_disk_inspect_intr ();
 }
 
+/* Prints latency and per-source statistics for disk D. */
+static void
+print_disk_detail (const struct disk *d) {
+	int i;
+	bool any = false;
+
+	for (i = 0; i < LAT_BUCKETS; i++)
+		if (d->lat_hist[i] > 0) {
+			if (!any)
+				printf ("%s: latency (log2 TSC cycles: count):", d->name);
+			printf (" %d:%lld", i, d->lat_hist[i]);
+			any = true;
+		}
+	if (any)
+		printf ("\n");
+
+	for (i = 0; i < DISK_SRC_CNT; i++)
+		if (d->src_req_cnt[i] > 0)
+			printf ("%s: %s: %lld requests, %lld sectors, "
+					"%llu cycles average latency\n", d->name, src_names[i],
+					d->src_req_cnt[i], d->src_sector_cnt[i],
+					d->src_tsc[i] / d->src_req_cnt[i]);
+
+	for (i = 0; i < DISK_IOC_CNT; i++)
+		if (d->ioc_req_cnt[i] > 0)
+			printf ("%s: %s: %lld requests, "
+					"%llu cycles average latency\n", d->name, ioclass_names[i],
+					d->ioc_req_cnt[i], d->ioc_tsc[i] / d->ioc_req_cnt[i]);
+}
+
 /* Prints disk statistics. */
 void
 disk_print_stats (void) {
 	int chan_no;
 
 	for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++) {
+		struct channel *c = &channels[chan_no];
 		int dev_no;
 
 		for (dev_no = 0; dev_no < 2; dev_no++) {
 			struct disk *d = disk_get (chan_no, dev_no);
-			if (d != NULL && d->is_ata)
-				printf ("%s: %lld reads, %lld writes\n",
-						d->name, d->read_cnt, d->write_cnt);
+			if (d != NULL) {
+				printf ("%s: %lld reads, %lld writes "
+						"(%lld read commands, %lld write commands)\n",
+						d->name, (long long) pcounter_read (&d->read_cnt),
+						(long long) pcounter_read (&d->write_cnt),
+						(long long) pcounter_read (&d->read_cmd_cnt),
+						(long long) pcounter_read (&d->write_cmd_cnt));
+				if (d->flush_cnt > 0 || d->fua_cnt > 0)
+					printf ("%s: %lld cache flushes, %lld FUA writes (%s)\n",
+							d->name, d->flush_cnt, d->fua_cnt,
+							d->fua ? "native" : "emulated");
+				print_disk_detail (d);
+			}
+		}
+		if (c->req_cnt > 0) {
+			uint64_t elapsed = rdtsc () - c->start_tsc;
+			printf ("%s: %lld requests, %lld merged, %lld aged, "
+					"queue depth %lld.%02lld average, %zu max, %llu%% busy\n",
+					c->name, c->req_cnt, c->merge_cnt, c->aged_cnt,
+					c->queue_len_sum / c->req_cnt,
+					c->queue_len_sum * 100 / c->req_cnt % 100, c->max_queue_len,
+					elapsed > 0 ? c->busy_tsc * 100 / elapsed : 0);
 		}
 	}
+	ahci_print_stats ();
+	virtio_blk_print_stats ();
 }
 
 /* Returns the disk numbered DEV_NO--either 0 or 1 for master or
@@ -188,12 +414,46 @@ disk_get (int chan_no, int dev_no) {
 
 	if (chan_no < (int) CHANNEL_CNT) {
 		struct disk *d = &channels[chan_no].devices[dev_no];
-		if (d->is_ata)
+		if (d->is_ata || d->driver != NULL)
 			return d;
 	}
 	return NULL;
 }
 
+/* Makes a disk of CAPACITY sectors served by DRIVER, with AUX for
+   DRIVER's use, one of those disk_get() returns: the one named
+   NAME, such as "hd0:1", if NAME is non-null and that one is absent,
+   otherwise the first absent one after hd0:0, the usual boot disk.
+   Returns the disk, or a null pointer if all are present. */
+struct disk *
+disk_attach (const char *name, disk_sector_t capacity,
+		const struct disk_driver *driver, void *aux) {
+	struct disk *d = NULL;
+	size_t i;
+
+	for (i = 0; i < CHANNEL_CNT * 2; i++) {
+		struct disk *slot = &channels[i / 2].devices[i % 2];
+
+		if (slot->is_ata || slot->driver != NULL)
+			continue;
+		if (name != NULL && !strcmp (name, slot->name)) {
+			d = slot;
+			break;
+		}
+		if (d == NULL && i > 0)
+			d = slot;
+	}
+	if (d == NULL)
+		return NULL;
+
+	d->driver = driver;
+	d->driver_aux = aux;
+	d->capacity = capacity;
+	printf ("%s: detected %'"PRDSNu" sector %s disk\n", d->name,
+			capacity, driver->name);
+	return d;
+}
+
 /* Returns the size of disk D, measured in DISK_SECTOR_SIZE-byte
    sectors. */
 disk_sector_t
@@ -209,21 +469,7 @@ disk_size (struct disk *d) {
    per-disk locking is unneeded. */
 void
 disk_read (struct disk *d, disk_sector_t sec_no, void *buffer) {
-	struct channel *c;
-
-	ASSERT (d != NULL);
-	ASSERT (buffer != NULL);
-
-	c = d->channel;
-	lock_acquire (&c->lock);
-	select_sector (d, sec_no);
-	issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-	sema_down (&c->completion_wait);
-	if (!wait_while_busy (d))
-		PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-	input_sector (c, buffer);
-	d->read_cnt++;
-	lock_release (&c->lock);
+	disk_read_multiple (d, sec_no, 1, buffer);
 }
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
@@ -233,23 +479,526 @@ disk_read (struct disk *d, disk_sector_t sec_no, void *buffer) {
    per-disk locking is unneeded. */
 void
 disk_write (struct disk *d, disk_sector_t sec_no, const void *buffer) {
-	struct channel *c;
+	disk_write_multiple (d, sec_no, 1, buffer);
+}
+
+/* Reads CNT consecutive sectors starting at SEC_NO from disk D
+   into BUFFER, which must have room for CNT * DISK_SECTOR_SIZE
+   bytes.  Uses as few commands as possible.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+void
+disk_read_multiple (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		void *buffer) {
+	disk_read_tagged (d, sec_no, cnt, buffer, DISK_SRC_OTHER);
+}
+
+/* Writes CNT consecutive sectors starting at SEC_NO to disk D
+   from BUFFER, which must contain CNT * DISK_SECTOR_SIZE bytes.
+   Returns after the disk has acknowledged receiving the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+void
+disk_write_multiple (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		const void *buffer) {
+	disk_write_tagged (d, sec_no, cnt, buffer, DISK_SRC_OTHER);
+}
+
+/* Reads like disk_read_multiple(), counting the transfer toward
+   source SRC in the disk statistics. */
+void
+disk_read_tagged (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		void *buffer, enum disk_src src) {
+	struct disk_req req = {
+		.disk = d, .sec_no = sec_no, .cnt = cnt, .buffer = buffer,
+		.write = false, .done = NULL, .src = src,
+	};
 
 	ASSERT (d != NULL);
 	ASSERT (buffer != NULL);
 
-	c = d->channel;
+	disk_submit (&req);
+	disk_wait (&req);
+}
+
+/* Writes like disk_write_multiple(), counting the transfer toward
+   source SRC in the disk statistics. */
+void
+disk_write_tagged (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		const void *buffer, enum disk_src src) {
+	disk_write_ordered (d, sec_no, cnt, buffer, src, 0);
+}
+
+/* Writes like disk_write_tagged(), with FLAGS, a combination of
+   DISK_REQ_* flags.  A commit record written with all three
+   returns only once everything written before it, and it, are on
+   the medium. */
+void
+disk_write_ordered (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		const void *buffer, enum disk_src src, unsigned flags) {
+	struct disk_req req = {
+		.disk = d, .sec_no = sec_no, .cnt = cnt, .buffer = (void *) buffer,
+		.write = true, .done = NULL, .src = src, .flags = flags,
+	};
+
+	ASSERT (d != NULL);
+	ASSERT (buffer != NULL);
+
+	disk_submit (&req);
+	disk_wait (&req);
+}
+
+/* Writes disk D's volatile write cache to the medium, after every
+   request submitted before, and returns once it is done. */
+void
+disk_flush_cache (struct disk *d) {
+	struct disk_req req = {
+		.disk = d, .cnt = 0, .buffer = NULL, .write = true,
+		.done = NULL, .src = DISK_SRC_OTHER,
+		.flags = DISK_REQ_FLUSH | DISK_REQ_BARRIER,
+	};
+
+	ASSERT (d != NULL);
+
+	disk_submit (&req);
+	disk_wait (&req);
+}
+
+/* Request queue.
+
+   Each channel has a queue of pending requests, served by a
+   kernel thread of its own.  The thread picks requests in C-LOOK
+   order: the first one at or after the last sector it reached,
+   in the order of (device, sector), wrapping around to the lowest
+   when none is left above.  Requests in the same direction for
+   sectors that follow on from each other are merged into a single
+   command, up to MAX_CMD_SECTORS sectors, so that for instance
+   writebacks of neighboring cache entries reach the disk
+   together.  A request larger than one command is done in pieces
+   and stays queued in between.
+
+   A request with DISK_REQ_BARRIER splits the queue: it is served
+   only once every request submitted before it has been, and none
+   submitted after it is served before it.  Only commit records and
+   explicit flushes carry the flag, so ordinary data writes stay
+   free to be sorted.  DISK_REQ_FLUSH flushes the disk's write cache
+   before a request's first sector, and DISK_REQ_FUA forces a write
+   through the cache, with WRITE DMA FUA EXT where the disk has it
+   and otherwise with a flush after the write.  Flagged requests
+   are never merged with others.  A request with DISK_REQ_FLUSH may
+   have a CNT of zero, to flush only.
+
+   Ahead of C-LOOK order comes each request's rank, from the I/O
+   class and priority of the thread that submitted it: the thread
+   picks the requests of the best rank in the queue and goes in
+   C-LOOK order among those only.  Realtime requests, such as the
+   reads of a page fault, thus overtake the writeback and read-ahead
+   queued in bulk by background threads, which are idle.  A request
+   climbs a rank for every AGE_TICKS it waits, so that a stream of
+   better requests cannot starve it.  Merging ignores ranks: a
+   request that continues the command being built joins it whatever
+   its rank, which costs the disk nothing.
+
+   Requests of the same rank from threads drawing on different
+   shares of disk time (struct disk_share) are served in
+   proportion to the shares' weights, by start-time fair queuing.
+   A request is tagged on submission with a virtual start time, the
+   later of the channel's virtual time and the time at which its
+   share's previous request will have had its share, and moves the
+   share's finish time on by its sectors over the share's weight.
+   The thread serves the share of the lowest start time among the
+   best-ranked requests, in C-LOOK order among that share's
+   requests, and advances the channel's virtual time to the start
+   time of the request it serves.  With one share busy, which is the
+   common case, this is plain C-LOOK. */
+
+/* Returns the number of disk D in traces: 2 * channel + device. */
+static inline int
+disk_no (const struct disk *d) {
+	return (d->channel - channels) * 2 + d->dev_no;
+}
+
+/* Sets the I/O class of the running thread's disk requests to
+   IOCLASS, and returns the class it had. */
+enum disk_ioclass
+disk_set_ioclass (enum disk_ioclass ioclass) {
+	struct thread *t = thread_current ();
+	enum disk_ioclass old = t->io_class;
+
+	ASSERT (ioclass < DISK_IOC_CNT);
+	t->io_class = ioclass;
+	return old;
+}
+
+/* Returns the rank of a request in class IOCLASS submitted by a
+   thread of priority PRIORITY.  Realtime ranks come first, then
+   best-effort ranks, then the single idle rank. */
+static unsigned
+ioclass_rank (enum disk_ioclass ioclass, int priority) {
+	unsigned level = (PRI_MAX - priority) * IOC_LEVELS
+		/ (PRI_MAX - PRI_MIN + 1);
+
+	switch (ioclass) {
+		case DISK_IOC_RT:
+			return level;
+		case DISK_IOC_BE:
+			return IOC_LEVELS + level;
+		default:
+			return 2 * IOC_LEVELS;
+	}
+}
+
+/* Queues REQ for its disk.  REQ's DISK, SEC_NO, CNT, BUFFER and
+   WRITE members say what to transfer.  Once the transfer is done,
+   REQ->DONE(REQ) is called, if DONE is non-null, from the
+   channel's (or other controller's) I/O thread, so it must not wait
+   for disk I/O on the same channel.  Otherwise, disk_wait() returns.  REQ must stay
+   valid until then. */
+void
+disk_submit (struct disk_req *req) {
+	struct channel *c;
+	uint64_t *finish;
+
+	ASSERT (req != NULL && req->disk != NULL);
+	ASSERT (req->cnt > 0 ? req->buffer != NULL : req->flags & DISK_REQ_FLUSH);
+	ASSERT (req->sec_no + req->cnt <= req->disk->capacity);
+	ASSERT (req->src < DISK_SRC_CNT);
+
+	req->done_cnt = 0;
+	req->submit_tsc = rdtsc ();
+	req->submit_tick = timer_ticks ();
+	req->ioclass = thread_current ()->io_class;
+	req->rank = ioclass_rank (req->ioclass, thread_get_priority ());
+	req->share = thread_current ()->io_share != NULL
+		? thread_current ()->io_share : &default_share;
+	sema_init (&req->sema, 0);
+	if (req->write) {
+		thread_current ()->ru.oublock += req->cnt;
+		__atomic_add_fetch (&req->share->write_cnt, (long long) req->cnt,
+				__ATOMIC_RELAXED);
+	} else {
+		thread_current ()->ru.inblock += req->cnt;
+		__atomic_add_fetch (&req->share->read_cnt, (long long) req->cnt,
+				__ATOMIC_RELAXED);
+	}
+
+	TRACE (DISK_SUBMIT, disk_no (req->disk), req->sec_no,
+			req->cnt | (uint64_t) req->write << 32);
+
+	if (req->disk->driver != NULL) {
+		/* Other drivers keep no volatile cache of their own, and
+		   complete a request only once it is done. */
+		if (req->cnt == 0) {
+			disk_complete (req);
+			return;
+		}
+		req->issued_cnt = 0;
+		req->disk->driver->submit (req->disk->driver_aux, req);
+		return;
+	}
+
+	c = req->disk->channel;
 	lock_acquire (&c->lock);
-	select_sector (d, sec_no);
-	issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-	if (!wait_while_busy (d))
-		PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-	output_sector (c, buffer);
-	sema_down (&c->completion_wait);
-	d->write_cnt++;
+	finish = &req->share->finish[c - channels];
+	req->vstart = *finish > c->vtime ? *finish : c->vtime;
+	*finish = req->vstart + (req->cnt > 0 ? req->cnt : 1) * SHARE_SECTOR_COST
+		/ req->share->weight;
+	list_push_back (&c->queue, &req->elem);
+	c->req_cnt++;
+	c->queue_len_sum += c->queue_len;
+	if (++c->queue_len > c->max_queue_len)
+		c->max_queue_len = c->queue_len;
+	cond_signal (&c->queue_cond, &c->lock);
 	lock_release (&c->lock);
 }
-
+
+/* Waits for REQ, which was submitted with a null DONE, to
+   complete. */
+void
+disk_wait (struct disk_req *req) {
+	ASSERT (req->done == NULL);
+	sema_down (&req->sema);
+}
+
+/* Returns the first sector of REQ still to be transferred. */
+static disk_sector_t
+req_next (const struct disk_req *req) {
+	return req->sec_no + req->done_cnt;
+}
+
+/* Returns REQ's position in elevator order. */
+static uint64_t
+req_key (const struct disk_req *req) {
+	return ((uint64_t) req->disk->dev_no << 32) | req_next (req);
+}
+
+/* Returns REQ's rank as of timer tick NOW, having climbed one for
+   every AGE_TICKS since it was submitted. */
+static unsigned
+req_rank (const struct disk_req *req, int64_t now) {
+	int64_t climbed = (now - req->submit_tick) / AGE_TICKS;
+
+	return climbed < req->rank ? req->rank - climbed : 0;
+}
+
+/* Removes from C's queue the request to serve next: of the
+   requests with the best rank, those of the share with the lowest
+   virtual start time, and of those the next in C-LOOK order.  C's
+   queue must not be empty and C's lock must be held. */
+static struct disk_req *
+pick_next (struct channel *c) {
+	struct disk_req *best = NULL, *lowest = NULL, *first = NULL;
+	unsigned best_rank = UINT_MAX;
+	int64_t now = timer_ticks ();
+	struct list_elem *e, *barrier;
+
+	/* Nothing after a barrier goes before it, and it goes once
+	   everything before it has. */
+	for (e = list_begin (&c->queue); e != list_end (&c->queue);
+			e = list_next (e)) {
+		struct disk_req *r = list_entry (e, struct disk_req, elem);
+		unsigned rank;
+
+		if (r->flags & DISK_REQ_BARRIER)
+			break;
+		rank = req_rank (r, now);
+		if (rank < best_rank
+				|| (rank == best_rank && r->vstart < first->vstart)) {
+			best_rank = rank;
+			first = r;
+		}
+	}
+	barrier = e;
+
+	if (first == NULL)
+		best = list_entry (barrier, struct disk_req, elem);
+	else {
+		for (e = list_begin (&c->queue); e != barrier; e = list_next (e)) {
+			struct disk_req *r = list_entry (e, struct disk_req, elem);
+			uint64_t key = req_key (r);
+
+			if (r->share != first->share || req_rank (r, now) != best_rank)
+				continue;
+			if (lowest == NULL || key < req_key (lowest))
+				lowest = r;
+			if (key >= c->head && (best == NULL || key < req_key (best)))
+				best = r;
+		}
+		if (best == NULL)
+			best = lowest;
+		if (best_rank < best->rank)
+			c->aged_cnt++;
+		if (best->vstart > c->vtime)
+			c->vtime = best->vstart;
+	}
+	list_remove (&best->elem);
+	c->queue_len--;
+	return best;
+}
+
+/* Removes from C's queue a request in direction WRITE for DISK
+   that continues at sector SEC_NO, and returns it, or returns a
+   null pointer if there is none.  Only requests ahead of any
+   barrier, and without flags, qualify.  C's lock must be held. */
+static struct disk_req *
+pick_adjacent (struct channel *c, struct disk *disk, disk_sector_t sec_no,
+		bool write) {
+	struct list_elem *e;
+
+	for (e = list_begin (&c->queue); e != list_end (&c->queue);
+			e = list_next (e)) {
+		struct disk_req *r = list_entry (e, struct disk_req, elem);
+
+		if (r->flags & DISK_REQ_BARRIER)
+			break;
+		if (r->disk == disk && r->write == write && req_next (r) == sec_no
+				&& r->flags == 0) {
+			list_remove (&r->elem);
+			c->queue_len--;
+			return r;
+		}
+	}
+	return NULL;
+}
+
+/* Flushes disk D's write cache, if it has one enabled. */
+static void
+flush_cache (struct disk *d) {
+	struct channel *c = d->channel;
+
+	if (!d->write_cache)
+		return;
+	select_device_wait (d);
+	issue_pio_command (c, d->lba48 ? CMD_FLUSH_CACHE_EXT : CMD_FLUSH_CACHE);
+	sema_down (&c->completion_wait);
+	wait_while_busy (d);
+	if (inb (reg_alt_status (c)) & STA_ERR)
+		PANIC ("%s: cache flush failed", d->name);
+	d->flush_cnt++;
+}
+
+/* Transfers the sectors of the PIECE_CNT pieces in BATCH, which
+   are consecutive on the same disk and go the same way, with a
+   single command.  A flagged request is alone in its batch. */
+static void
+run_batch (struct piece *batch, size_t piece_cnt) {
+	struct disk_req *first = batch[0].req;
+	struct disk *d = first->disk;
+	struct channel *c = d->channel;
+	disk_sector_t sec_no = req_next (first);
+	bool write = first->write;
+	bool fua = write && (first->flags & DISK_REQ_FUA) && d->write_cache;
+	size_t cnt = 0, i, j;
+
+	for (i = 0; i < piece_cnt; i++)
+		cnt += batch[i].cnt;
+
+	if ((first->flags & DISK_REQ_FLUSH) && first->done_cnt == 0)
+		flush_cache (d);
+	if (cnt == 0)
+		return;
+
+	if (!dma_transfer (d, sec_no, cnt, batch, piece_cnt, write, fua)) {
+		bool ext = select_sector (d, sec_no, cnt, false);
+
+		/* The device interrupts once per sector. */
+		issue_pio_command (c, write
+				? (ext ? CMD_WRITE_SECTOR_EXT : CMD_WRITE_SECTOR_RETRY)
+				: (ext ? CMD_READ_SECTOR_EXT : CMD_READ_SECTOR_RETRY));
+		for (i = 0; i < piece_cnt; i++) {
+			struct disk_req *r = batch[i].req;
+			uint8_t *p = (uint8_t *) r->buffer + r->done_cnt * DISK_SECTOR_SIZE;
+
+			for (j = 0; j < batch[i].cnt; j++, sec_no++) {
+				if (write) {
+					if (!wait_while_busy (d))
+						PANIC ("%s: disk write failed, sector=%"PRDSNu,
+								d->name, sec_no);
+					output_sector (c, p + j * DISK_SECTOR_SIZE);
+					sema_down (&c->completion_wait);
+				} else {
+					sema_down (&c->completion_wait);
+					if (!wait_while_busy (d))
+						PANIC ("%s: disk read failed, sector=%"PRDSNu,
+								d->name, sec_no);
+					input_sector (c, p + j * DISK_SECTOR_SIZE);
+				}
+			}
+		}
+		if (fua)
+			flush_cache (d);
+	} else if (fua && !d->fua)
+		flush_cache (d);
+	if (fua)
+		d->fua_cnt++;
+
+	disk_account_cmd (d, cnt, write);
+}
+
+/* Counts a command moving CNT sectors to or from disk D, toward D
+   if WRITE is true, in D's statistics. */
+void
+disk_account_cmd (struct disk *d, size_t cnt, bool write) {
+	if (write) {
+		pcounter_add (&d->write_cnt, cnt);
+		pcounter_inc (&d->write_cmd_cnt);
+	} else {
+		pcounter_add (&d->read_cnt, cnt);
+		pcounter_inc (&d->read_cmd_cnt);
+	}
+}
+
+/* Records the completion of REQ in its disk's statistics. */
+static void
+account_req (struct disk_req *req) {
+	struct disk *d = req->disk;
+	uint64_t latency = rdtsc () - req->submit_tsc;
+	int bucket = 0;
+
+	while (bucket < LAT_BUCKETS - 1 && (latency >> (bucket + 1)) != 0)
+		bucket++;
+	d->lat_hist[bucket]++;
+	d->src_req_cnt[req->src]++;
+	d->src_sector_cnt[req->src] += req->cnt;
+	d->src_tsc[req->src] += latency;
+	d->ioc_req_cnt[req->ioclass]++;
+	d->ioc_tsc[req->ioclass] += latency;
+}
+
+/* Finishes REQ, all of whose sectors have been transferred:
+   counts it, then calls its DONE or wakes its waiter. */
+void
+disk_complete (struct disk_req *req) {
+	account_req (req);
+	TRACE (DISK_DONE, disk_no (req->disk), req->sec_no,
+			req->cnt | (uint64_t) req->write << 32);
+	if (req->done != NULL)
+		req->done (req);
+	else
+		sema_up (&req->sema);
+}
+
+/* Serves channel C_'s request queue.  Each channel has its own
+   thread, so the two channels work in parallel: swap (on hd1)
+   need not wait behind the file system (on hd0). */
+static void
+channel_thread (void *c_) {
+	struct channel *c = c_;
+
+	c->start_tsc = rdtsc ();
+	for (;;) {
+		uint64_t tsc;
+		struct piece batch[BATCH_MAX];
+		struct disk_req *r;
+		size_t piece_cnt, total, i;
+		disk_sector_t end;
+
+		/* Pick the next request and whatever continues it. */
+		lock_acquire (&c->lock);
+		while (list_empty (&c->queue))
+			cond_wait (&c->queue_cond, &c->lock);
+		r = pick_next (c);
+		total = 0;
+		piece_cnt = 0;
+		do {
+			size_t left = r->cnt - r->done_cnt;
+			size_t n = left < MAX_CMD_SECTORS - total
+				? left : MAX_CMD_SECTORS - total;
+
+			batch[piece_cnt].req = r;
+			batch[piece_cnt].cnt = n;
+			piece_cnt++;
+			total += n;
+			end = req_next (r) + n;
+			if (piece_cnt > 1)
+				c->merge_cnt++;
+		} while (batch[0].req->flags == 0
+				&& total < MAX_CMD_SECTORS && piece_cnt < BATCH_MAX
+				&& (r = pick_adjacent (c, batch[0].req->disk, end,
+						batch[0].req->write)) != NULL);
+		c->head = ((uint64_t) batch[0].req->disk->dev_no << 32) | end;
+		lock_release (&c->lock);
+
+		tsc = rdtsc ();
+		run_batch (batch, piece_cnt);
+		c->busy_tsc += rdtsc () - tsc;
+
+		/* Complete finished requests and requeue the rest. */
+		for (i = 0; i < piece_cnt; i++) {
+			r = batch[i].req;
+			r->done_cnt += batch[i].cnt;
+			if (r->done_cnt < r->cnt) {
+				lock_acquire (&c->lock);
+				list_push_front (&c->queue, &r->elem);
+				c->queue_len++;
+				lock_release (&c->lock);
+				continue;
+			}
+			disk_complete (r);
+		}
+	}
+}
+
 /* Disk detection and identification. */
 
 static void print_ata_string (char *string, size_t size);
@@ -363,6 +1112,17 @@ identify_ata_device (struct disk *d) {
 
 	/* Calculate capacity. */
 	d->capacity = id[60] | ((uint32_t) id[61] << 16);
+	if (id[83] & (1 << 10)) {
+		/* 48-bit LBA.  disk_sector_t limits us to the low 32 bits. */
+		d->lba48 = true;
+		if (id[102] != 0 || id[103] != 0)
+			d->capacity = UINT32_MAX;
+		else
+			d->capacity = id[100] | ((uint32_t) id[101] << 16);
+	}
+	d->dma = (id[49] & (1 << 8)) != 0 && c->bm_base != 0;
+	d->write_cache = (id[85] & (1 << 5)) != 0;
+	d->fua = d->lba48 && d->dma && (id[84] & (1 << 6)) != 0;
 
 	/* Print identification message. */
 	printf ("%s: detected %'"PRDSNu" sector (", d->name, d->capacity);
@@ -379,7 +1139,7 @@ identify_ata_device (struct disk *d) {
 	print_ata_string ((char *) &id[27], 40);
 	printf ("\", serial \"");
 	print_ata_string ((char *) &id[10], 20);
-	printf ("\"\n");
+	printf ("\"%s\n", d->dma ? ", DMA" : "");
 }
 
 /* Prints STRING, which consists of SIZE bytes in a funky format:
@@ -402,22 +1162,43 @@ print_ata_string (char *string, size_t size) {
 }
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
-static void
-select_sector (struct disk *d, disk_sector_t sec_no) {
+   writes SEC_NO and CNT to the disk's sector selection and count
+   registers.  (We use LBA mode.)  Sectors past the 28-bit limit,
+   or any if EXT is true, are addressed with 48-bit LBA, in which
+   case this returns true and the caller must issue an EXT
+   command. */
+static bool
+select_sector (struct disk *d, disk_sector_t sec_no, size_t cnt, bool ext) {
 	struct channel *c = d->channel;
 
-	ASSERT (sec_no < d->capacity);
-	ASSERT (sec_no < (1UL << 28));
+	ASSERT (cnt >= 1 && cnt <= MAX_CMD_SECTORS);
+	ASSERT (sec_no + cnt <= d->capacity);
 
 	select_device_wait (d);
-	outb (reg_nsect (c), 1);
+	if (ext || (uint64_t) sec_no + cnt > (1UL << 28)) {
+		ASSERT (d->lba48);
+
+		/* High-order bytes first, then low-order. */
+		outb (reg_nsect (c), cnt >> 8);
+		outb (reg_lbal (c), sec_no >> 24);
+		outb (reg_lbam (c), 0);
+		outb (reg_lbah (c), 0);
+		outb (reg_nsect (c), cnt);
+		outb (reg_lbal (c), sec_no);
+		outb (reg_lbam (c), sec_no >> 8);
+		outb (reg_lbah (c), sec_no >> 16);
+		outb (reg_device (c),
+				DEV_MBS | DEV_LBA | (d->dev_no == 1 ? DEV_DEV : 0));
+		return true;
+	}
+
+	outb (reg_nsect (c), cnt);
 	outb (reg_lbal (c), sec_no);
 	outb (reg_lbam (c), sec_no >> 8);
 	outb (reg_lbah (c), (sec_no >> 16));
 	outb (reg_device (c),
 			DEV_MBS | DEV_LBA | (d->dev_no == 1 ? DEV_DEV : 0) | (sec_no >> 24));
+	return false;
 }
 
 /* Writes COMMAND to channel C and prepares for receiving a
@@ -446,6 +1227,126 @@ output_sector (struct channel *c, const void *sector) {
 	outsw (reg_data (c), sector, DISK_SECTOR_SIZE / 2);
 }
 
+/* Bus-master DMA. */
+
+/* Looks on PCI bus 0 for an IDE controller with bus-master
+   registers, enables bus mastering on it, and returns the I/O
+   port of its registers.  Returns 0 if there is none. */
+static uint16_t
+find_bus_master (void) {
+	int dev, func;
+
+	for (dev = 0; dev < 32; dev++)
+		for (func = 0; func < 8; func++) {
+			uint32_t id = pci_read_config (0, dev, func, 0x00);
+			uint32_t class, bar4;
+
+			if ((id & 0xffff) == 0xffff)
+				continue;
+			class = pci_read_config (0, dev, func, 0x08) >> 16;
+			bar4 = pci_read_config (0, dev, func, 0x20);
+			if (class == 0x0101 && (bar4 & 1) && (bar4 & 0xfffc) != 0) {
+				uint32_t cmd = pci_read_config (0, dev, func, 0x04);
+				pci_write_config (0, dev, func, 0x04, cmd | 0x05);
+				return bar4 & 0xfffc;
+			}
+		}
+	return 0;
+}
+
+/* Appends regions to channel C's PRD table, whose first *IDX
+   entries are in use, describing the SIZE bytes at BUFFER.
+   Returns false if BUFFER cannot be used for DMA or the table
+   fills up. */
+static bool
+add_prds (struct channel *c, size_t *idx, void *buffer, size_t size) {
+	uint64_t pa, end;
+
+	if (!is_kernel_vaddr (buffer))
+		return false;
+	pa = vtop (buffer);
+	end = pa + size;
+	if (end > (1ULL << 32) || (pa & 1) != 0)
+		return false;
+
+	while (pa < end) {
+		uint64_t boundary = (pa | 0xffff) + 1;
+		uint64_t next = boundary < end ? boundary : end;
+
+		if (*idx == PRD_CNT)
+			return false;
+		c->prdt[*idx].addr = pa;
+		c->prdt[*idx].size = (next - pa) & 0xffff;
+		c->prdt[*idx].flags = 0;
+		(*idx)++;
+		pa = next;
+	}
+	return true;
+}
+
+/* Fills in channel C's PRD table to describe the buffers of the
+   PIECE_CNT pieces in BATCH.  Returns false if they cannot be
+   used for DMA. */
+static bool
+build_prdt (struct channel *c, const struct piece *batch, size_t piece_cnt) {
+	size_t idx = 0, i;
+
+	for (i = 0; i < piece_cnt; i++) {
+		const struct disk_req *r = batch[i].req;
+		if (!add_prds (c, &idx, (uint8_t *) r->buffer
+					+ r->done_cnt * DISK_SECTOR_SIZE,
+					batch[i].cnt * DISK_SECTOR_SIZE))
+			return false;
+	}
+	ASSERT (idx > 0);
+	c->prdt[idx - 1].flags = PRD_EOT;
+	return true;
+}
+
+/* Transfers CNT sectors starting at SEC_NO between disk D and
+   the buffers of the PIECE_CNT pieces in BATCH by bus-master DMA,
+   toward the disk if WRITE is true, through its write cache to the
+   medium if FUA is also true.  Returns false, having done
+   nothing, if D or the buffers are unsuitable for DMA, in which
+   case the caller should use PIO.  Without native FUA, a flush
+   follows the write. */
+static bool
+dma_transfer (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		const struct piece *batch, size_t piece_cnt, bool write, bool fua) {
+	struct channel *c = d->channel;
+	uint8_t bm_status, status;
+	bool ext;
+
+	if (!d->dma || !build_prdt (c, batch, piece_cnt))
+		return false;
+
+	/* Load the PRD table, set the direction and clear stale
+	   status, then start the command and the engine. */
+	outl (c->bm_base + BM_PRDT, vtop (c->prdt));
+	outb (c->bm_base + BM_COMMAND, write ? 0 : BMC_READ);
+	outb (c->bm_base + BM_STATUS, BMS_ERR | BMS_IRQ);
+	ext = select_sector (d, sec_no, cnt, write && fua && d->fua);
+	if (write && fua && d->fua)
+		issue_pio_command (c, CMD_WRITE_DMA_FUA_EXT);
+	else if (write)
+		issue_pio_command (c, ext ? CMD_WRITE_DMA_EXT : CMD_WRITE_DMA);
+	else
+		issue_pio_command (c, ext ? CMD_READ_DMA_EXT : CMD_READ_DMA);
+	outb (c->bm_base + BM_COMMAND, (write ? 0 : BMC_READ) | BMC_START);
+	sema_down (&c->completion_wait);
+
+	/* Stop the engine and check for errors. */
+	outb (c->bm_base + BM_COMMAND, 0);
+	bm_status = inb (c->bm_base + BM_STATUS);
+	outb (c->bm_base + BM_STATUS, BMS_ERR | BMS_IRQ);
+	wait_while_busy (d);
+	status = inb (reg_alt_status (c));
+	if ((bm_status & BMS_ERR) || (status & STA_ERR))
+		PANIC ("%s: DMA %s failed, sector=%"PRDSNu, d->name,
+				write ? "write" : "read", sec_no);
+	return true;
+}
+
 /* Low-level ATA primitives. */
 
 /* Wait up to 10 seconds for the controller to become idle, that
@@ -532,13 +1433,13 @@ interrupt_handler (struct intr_frame *f) {
 static void
 inspect_read_cnt (struct intr_frame *f) {
 	struct disk * d = disk_get (f->R.rdx, f->R.rcx);
-	f->R.rax = d->read_cnt;
+	f->R.rax = pcounter_read (&d->read_cnt);
 }
 
 static void
 inspect_write_cnt (struct intr_frame *f) {
 	struct disk * d = disk_get (f->R.rdx, f->R.rcx);
-	f->R.rax = d->write_cnt;
+	f->R.rax = pcounter_read (&d->write_cnt);
 }
 
 /* Tool for testing disk r/w cnt. Calling this function via int 0x43 and int 0x44.
@@ -2,14 +2,20 @@
 #include <debug.h>
 #include "devices/intq.h"
 #include "devices/serial.h"
+#include "threads/interrupt.h"
+#include "threads/poll.h"
 
 /* Stores keys from the keyboard and serial port. */
 static struct intq buffer;
 
+/* Threads polling for a key. */
+static struct poll_queue pollq;
+
 /* Initializes the input buffer. */
 void
 input_init (void) {
 	intq_init (&buffer);
+	poll_queue_init (&pollq);
 }
 
 /* Adds a key to the input buffer.
@@ -21,6 +27,7 @@ input_putc (uint8_t key) {
 
 	intq_putc (&buffer, key);
 	serial_notify ();
+	poll_queue_wake (&pollq);
 }
 
 /* Retrieves a key from the input buffer.
@@ -46,3 +53,18 @@ input_full (void) {
 	ASSERT (intr_get_level () == INTR_OFF);
 	return intq_full (&buffer);
 }
+
+/* Returns true if a key is waiting in the input buffer.  If PT is
+   not null, also adds W to the queue of threads polling for one. */
+bool
+input_poll (struct poll_table *pt, struct poll_waiter *w) {
+	enum intr_level old_level;
+	bool ready;
+
+	if (pt != NULL)
+		poll_add (pt, &pollq, w);
+	old_level = intr_disable ();
+	ready = !intq_empty (&buffer);
+	intr_set_level (old_level);
+	return ready;
+}
@@ -1,31 +1,126 @@
 #include "devices/intq.h"
 #include <debug.h>
+#include <string.h>
+#include "threads/malloc.h"
 #include "threads/thread.h"
 
-static int next (int pos);
+static size_t used (const struct intq *q);
 static void wait (struct intq *q, struct thread **waiter);
 static void signal (struct intq *q, struct thread **waiter);
 
-/* Initializes interrupt queue Q. */
+/* Initializes interrupt queue Q with room for INTQ_BUFSIZE
+   bytes. */
 void
 intq_init (struct intq *q) {
 	lock_init (&q->lock);
 	q->not_full = q->not_empty = NULL;
+	q->buf = q->buf_inline;
+	q->capacity = INTQ_BUFSIZE;
 	q->head = q->tail = 0;
 }
 
+/* Initializes interrupt queue Q with room for CAPACITY bytes,
+   rounded up to a power of 2.  Returns false if memory for the
+   buffer is short.  A queue larger than INTQ_BUFSIZE must be
+   freed with intq_destroy(). */
+bool
+intq_init_capacity (struct intq *q, size_t capacity) {
+	size_t size = INTQ_BUFSIZE;
+
+	intq_init (q);
+	while (size < capacity)
+		size *= 2;
+	if (size > INTQ_BUFSIZE) {
+		q->buf = malloc (size);
+		if (q->buf == NULL)
+			return false;
+		q->capacity = size;
+	}
+	return true;
+}
+
+/* Frees Q's buffer.  No thread may be waiting on Q. */
+void
+intq_destroy (struct intq *q) {
+	ASSERT (q->not_full == NULL && q->not_empty == NULL);
+
+	if (q->buf != q->buf_inline)
+		free (q->buf);
+}
+
+/* Returns the number of bytes in Q, as seen from either side. */
+static size_t
+used (const struct intq *q) {
+	return __atomic_load_n (&q->head, __ATOMIC_ACQUIRE)
+		- __atomic_load_n (&q->tail, __ATOMIC_ACQUIRE);
+}
+
 /* Returns true if Q is empty, false otherwise. */
 bool
 intq_empty (const struct intq *q) {
-	ASSERT (intr_get_level () == INTR_OFF);
-	return q->head == q->tail;
+	return used (q) == 0;
 }
 
 /* Returns true if Q is full, false otherwise. */
 bool
 intq_full (const struct intq *q) {
-	ASSERT (intr_get_level () == INTR_OFF);
-	return next (q->head) == q->tail;
+	return used (q) == q->capacity;
+}
+
+/* Removes up to SIZE bytes from Q into BUF and returns the number
+   removed.  Q must not be empty if called from an interrupt
+   handler.  Otherwise, if Q is empty, first sleeps until a byte is
+   added, then takes whatever is there. */
+size_t
+intq_get_buf (struct intq *q, void *buf_, size_t size) {
+	uint8_t *buf = buf_;
+	size_t tail = q->tail, avail, ofs, chunk;
+
+	if (size == 0)
+		return 0;
+	while (intq_empty (q))
+		wait (q, &q->not_empty);
+
+	/* Copy in at most two runs, around the end of the ring. */
+	avail = __atomic_load_n (&q->head, __ATOMIC_ACQUIRE) - tail;
+	if (size > avail)
+		size = avail;
+	ofs = tail & (q->capacity - 1);
+	chunk = size < q->capacity - ofs ? size : q->capacity - ofs;
+	memcpy (buf, q->buf + ofs, chunk);
+	memcpy (buf + chunk, q->buf, size - chunk);
+	__atomic_store_n (&q->tail, tail + size, __ATOMIC_RELEASE);
+
+	signal (q, &q->not_full);
+	return size;
+}
+
+/* Adds the SIZE bytes in BUF to the end of Q.  Q must have room
+   for all of them if called from an interrupt handler.  Otherwise,
+   whenever Q is full, sleeps until bytes are removed. */
+void
+intq_put_buf (struct intq *q, const void *buf_, size_t size) {
+	const uint8_t *buf = buf_;
+
+	while (size > 0) {
+		size_t head = q->head, room, ofs, chunk, n;
+
+		while (intq_full (q))
+			wait (q, &q->not_full);
+
+		room = q->capacity - (head - __atomic_load_n (&q->tail,
+					__ATOMIC_ACQUIRE));
+		n = size < room ? size : room;
+		ofs = head & (q->capacity - 1);
+		chunk = n < q->capacity - ofs ? n : q->capacity - ofs;
+		memcpy (q->buf + ofs, buf, chunk);
+		memcpy (q->buf, buf + chunk, n - chunk);
+		__atomic_store_n (&q->head, head + n, __ATOMIC_RELEASE);
+		buf += n;
+		size -= n;
+
+		signal (q, &q->not_empty);
+	}
 }
 
 /* Removes a byte from Q and returns it.
@@ -36,17 +131,7 @@ uint8_t
 intq_getc (struct intq *q) {
 	uint8_t byte;
 
-	ASSERT (intr_get_level () == INTR_OFF);
-	while (intq_empty (q)) {
-		ASSERT (!intr_context ());
-		lock_acquire (&q->lock);
-		wait (q, &q->not_empty);
-		lock_release (&q->lock);
-	}
-
-	byte = q->buf[q->tail];
-	q->tail = next (q->tail);
-	signal (q, &q->not_full);
+	intq_get_buf (q, &byte, 1);
 	return byte;
 }
 
@@ -56,50 +141,59 @@ intq_getc (struct intq *q) {
    removed. */
 void
 intq_putc (struct intq *q, uint8_t byte) {
-	ASSERT (intr_get_level () == INTR_OFF);
-	while (intq_full (q)) {
-		ASSERT (!intr_context ());
-		lock_acquire (&q->lock);
-		wait (q, &q->not_full);
-		lock_release (&q->lock);
-	}
-
-	q->buf[q->head] = byte;
-	q->head = next (q->head);
-	signal (q, &q->not_empty);
+	intq_put_buf (q, &byte, 1);
 }
 
-/* Returns the position after POS within an intq. */
-static int
-next (int pos) {
-	return (pos + 1) % INTQ_BUFSIZE;
+/* Returns true if the condition that WAITER, the address of Q's
+   not_empty or not_full member, waits for holds. */
+static bool
+ready (const struct intq *q, struct thread **waiter) {
+	return waiter == &q->not_empty ? !intq_empty (q) : !intq_full (q);
 }
 
 /* WAITER must be the address of Q's not_empty or not_full
-   member.  Waits until the given condition is true. */
+   member.  Waits until the given condition is true.  The waiter
+   is published before the condition is checked for the last time,
+   and signal() checks for a waiter after publishing the change,
+   so one of them always sees the other. */
 static void
-wait (struct intq *q UNUSED, struct thread **waiter) {
+wait (struct intq *q, struct thread **waiter) {
+	enum intr_level old_level;
+
 	ASSERT (!intr_context ());
-	ASSERT (intr_get_level () == INTR_OFF);
-	ASSERT ((waiter == &q->not_empty && intq_empty (q))
-			|| (waiter == &q->not_full && intq_full (q)));
 
-	*waiter = thread_current ();
-	thread_block ();
+	lock_acquire (&q->lock);
+	old_level = intr_disable ();
+	while (!ready (q, waiter)) {
+		*waiter = thread_current ();
+		__atomic_thread_fence (__ATOMIC_SEQ_CST);
+		if (ready (q, waiter)) {
+			*waiter = NULL;
+			break;
+		}
+		thread_block ();
+	}
+	intr_set_level (old_level);
+	lock_release (&q->lock);
 }
 
 /* WAITER must be the address of Q's not_empty or not_full
-   member, and the associated condition must be true.  If a
-   thread is waiting for the condition, wakes it up and resets
-   the waiting thread. */
+   member, and the associated condition must have just become
+   true.  If a thread is waiting for the condition, wakes it up and
+   resets the waiting thread.  Interrupts are only turned off when
+   there is a waiter. */
 static void
 signal (struct intq *q UNUSED, struct thread **waiter) {
-	ASSERT (intr_get_level () == INTR_OFF);
-	ASSERT ((waiter == &q->not_empty && !intq_empty (q))
-			|| (waiter == &q->not_full && !intq_full (q)));
+	enum intr_level old_level;
+
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+	if (__atomic_load_n (waiter, __ATOMIC_RELAXED) == NULL)
+		return;
 
+	old_level = intr_disable ();
 	if (*waiter != NULL) {
 		thread_unblock (*waiter);
 		*waiter = NULL;
 	}
+	intr_set_level (old_level);
 }
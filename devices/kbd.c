@@ -4,8 +4,10 @@
 #include <stdio.h>
 #include <string.h>
 #include "devices/input.h"
+#include "threads/defer.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
+#include "threads/synch.h"
 
 /* Keyboard data register port. */
 #define DATA_REG 0x60
@@ -23,11 +25,24 @@ static bool caps_lock;
 /* Number of keys pressed. */
 static int64_t key_cnt;
 
+/* Scancodes read by the interrupt handler and not yet decoded.
+   Only the handler advances SCAN_HEAD and only the decoder
+   advances SCAN_TAIL, so neither needs a lock.  A scancode that
+   arrives to a full buffer is dropped. */
+#define SCAN_BUF 64
+static unsigned scan_buf[SCAN_BUF];
+static volatile unsigned scan_head, scan_tail;
+
+/* Decodes the buffered scancodes, as deferred work. */
+static struct defer scan_work;
+
 static intr_handler_func keyboard_interrupt;
+static defer_func decode_scancodes;
 
 /* Initializes the keyboard. */
 void
 kbd_init (void) {
+	defer_init (&scan_work, decode_scancodes, NULL);
 	intr_register_ext (0x21, keyboard_interrupt, "8042 Keyboard");
 }
 
@@ -83,28 +98,54 @@ static const struct keymap shifted_keymap[] = {
 };
 
 static bool map_key (const struct keymap[], unsigned scancode, uint8_t *);
+static void decode_scancode (unsigned code);
 
+/* Reads the scancode, which must be done before the interrupt is
+   acknowledged, and leaves decoding it to deferred work. */
 static void
 keyboard_interrupt (struct intr_frame *args UNUSED) {
+	unsigned code;
+
+	/* Read scancode, including second byte if prefix code. */
+	code = inb (DATA_REG);
+	if (code == 0xe0)
+		code = (code << 8) | inb (DATA_REG);
+
+	if (scan_head - scan_tail < SCAN_BUF) {
+		scan_buf[scan_head % SCAN_BUF] = code;
+		barrier ();
+		scan_head++;
+	}
+	defer_schedule (&scan_work);
+}
+
+/* Decodes the scancodes that keyboard_interrupt() buffered. */
+static void
+decode_scancodes (void *aux UNUSED) {
+	while (scan_tail != scan_head) {
+		unsigned code = scan_buf[scan_tail % SCAN_BUF];
+
+		barrier ();
+		scan_tail++;
+		decode_scancode (code);
+	}
+}
+
+/* Interprets scancode CODE, updating the shift state or adding a
+   character to the input buffer. */
+static void
+decode_scancode (unsigned code) {
 	/* Status of shift keys. */
 	bool shift = left_shift || right_shift;
 	bool alt = left_alt || right_alt;
 	bool ctrl = left_ctrl || right_ctrl;
 
-	/* Keyboard scancode. */
-	unsigned code;
-
 	/* False if key pressed, true if key released. */
 	bool release;
 
 	/* Character that corresponds to `code'. */
 	uint8_t c;
 
-	/* Read scancode, including second byte if prefix code. */
-	code = inb (DATA_REG);
-	if (code == 0xe0)
-		code = (code << 8) | inb (DATA_REG);
-
 	/* Bit 0x80 distinguishes key press from key release
 	   (even if there's a prefix). */
 	release = (code & 0x80) != 0;
@@ -135,10 +176,12 @@ keyboard_interrupt (struct intr_frame *args UNUSED) {
 				c += 0x80;
 
 			/* Append to keyboard buffer. */
+			enum intr_level old_level = intr_disable ();
 			if (!input_full ()) {
 				key_cnt++;
 				input_putc (c);
 			}
+			intr_set_level (old_level);
 		}
 	} else {
 		/* Maps a keycode into a shift state variable. */
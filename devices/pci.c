@@ -0,0 +1,94 @@
+#include "devices/pci.h"
+#include <debug.h>
+#include <stdio.h>
+#include "threads/init.h"
+#include "threads/io.h"
+#include "threads/kstack.h"
+#include "threads/vmalloc.h"
+#include "threads/mmu.h"
+#include "threads/pte.h"
+#include "threads/vaddr.h"
+
+/* Configuration mechanism #1: the address of a register goes to
+   CONFIG_ADDRESS, then its contents are read or written through
+   CONFIG_DATA. */
+#define CONFIG_ADDRESS 0xcf8
+#define CONFIG_DATA 0xcfc
+
+/* Returns the CONFIG_ADDRESS value that selects 32-bit register
+   REG of PCI function BUS:DEV.FUNC. */
+static uint32_t
+config_address (int bus, int dev, int func, int reg) {
+	return 0x80000000 | (bus << 16) | (dev << 11) | (func << 8) | (reg & 0xfc);
+}
+
+/* Reads 32-bit register REG of PCI function BUS:DEV.FUNC. */
+uint32_t
+pci_read_config (int bus, int dev, int func, int reg) {
+	outl (CONFIG_ADDRESS, config_address (bus, dev, func, reg));
+	return inl (CONFIG_DATA);
+}
+
+/* Writes VALUE to 32-bit register REG of PCI function
+   BUS:DEV.FUNC. */
+void
+pci_write_config (int bus, int dev, int func, int reg, uint32_t value) {
+	outl (CONFIG_ADDRESS, config_address (bus, dev, func, reg));
+	outl (CONFIG_DATA, value);
+}
+
+/* Interrupt lines of the 8259 PICs, and most handlers that can
+   share one. */
+#define LINE_CNT 16
+#define LINE_HANDLERS 4
+
+/* Handlers of devices on each line.  PCI devices share lines, but
+   intr_register_ext() takes one handler per vector. */
+static intr_handler_func *line_handlers[LINE_CNT][LINE_HANDLERS];
+
+/* Calls every handler on the line of interrupt F.  Each asks its
+   own devices whether they interrupted. */
+static void
+line_interrupt (struct intr_frame *f) {
+	intr_handler_func **h = line_handlers[f->vec_no - 0x20];
+	size_t i;
+
+	for (i = 0; i < LINE_HANDLERS && h[i] != NULL; i++)
+		h[i] (f);
+}
+
+/* Registers HANDLER, named NAME, for PIC interrupt line LINE, as
+   read from a device's interrupt line register, alongside the
+   other drivers of devices on it. */
+void
+pci_register_intr (uint8_t line, intr_handler_func *handler,
+		const char *name) {
+	intr_handler_func **h;
+	size_t i;
+
+	ASSERT (line < LINE_CNT);
+	h = line_handlers[line];
+	for (i = 0; i < LINE_HANDLERS && h[i] != NULL; i++)
+		if (h[i] == handler)
+			return;
+	if (i == LINE_HANDLERS)
+		PANIC ("%s: too many handlers on interrupt line %d", name, line);
+	if (i == 0)
+		intr_register_ext (0x20 + line, line_interrupt, name);
+	h[i] = handler;
+}
+
+/* Returns the physical address a device should use to reach
+   kernel virtual address VA.  Buffers on a kernel stack or from
+   vmalloc() lie outside the mapping of physical memory, so their
+   page tables say. */
+uint64_t
+pci_dma_addr (const void *va) {
+	uint64_t *pte;
+
+	if (!kstack_contains (va) && !vmalloc_contains (va))
+		return vtop (va);
+	pte = pml4e_walk (base_pml4, (uint64_t) va, 0);
+	ASSERT (pte != NULL && (*pte & PTE_P));
+	return PTE_ADDR (*pte) + pg_ofs (va);
+}
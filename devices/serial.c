@@ -1,12 +1,13 @@
 #include "devices/serial.h"
 #include <debug.h>
+#include <string.h>
 #include "devices/input.h"
-#include "devices/intq.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
 
 /* Register definitions for the 16550A UART used in PCs.
    The 16550A has a lot more going on than shown here, but this
@@ -30,7 +31,17 @@
 #define IIR_REG (IO_BASE + 2)   /* Interrupt Identification Reg. (read-only) */
 #define FCR_REG (IO_BASE + 2)   /* FIFO Control Reg. (write-only). */
 #define LCR_REG (IO_BASE + 3)   /* Line Control Register. */
-#define MCR_REG (IO_BASE + 4)   /* MODEM Control Register. */
+#define MCR_REG (IO_BASE + 4)   /* FIFO Control Register bits. */
+#define FCR_ENABLE 0x01         /* Enable the FIFOs. */
+#define FCR_CLEAR_RECV 0x02     /* Clear the receive FIFO. */
+#define FCR_CLEAR_XMIT 0x04     /* Clear the transmit FIFO. */
+
+/* Depth of the 16550A transmit FIFO, in bytes.  Once the
+   transmitter reports THR empty, this many bytes may be written
+   without checking again. */
+#define XMIT_FIFO_DEPTH 16
+
+/* MODEM Control Register. */
 #define LSR_REG (IO_BASE + 5)   /* Line Status Register (read-only). */
 
 /* Interrupt Enable Register bits. */
@@ -51,11 +62,24 @@
 /* Transmission mode. */
 static enum { UNINIT, POLL, QUEUE } mode;
 
-/* Data to be transmitted. */
-static struct intq txq;
+/* Data to be transmitted: a page-sized ring of bytes.  HEAD and
+   TAIL run freely and are reduced modulo TXQ_SIZE on use, so the
+   queue holds HEAD - TAIL bytes.  Interrupts must be off to touch
+   them. */
+#define TXQ_SIZE PGSIZE
+static uint8_t txq[TXQ_SIZE];
+static size_t txq_head;         /* Next byte is queued here. */
+static size_t txq_tail;         /* Next byte is transmitted from here. */
+
+/* A thread waiting for room in the transmit queue, and the lock
+   that allows only one thread to wait at once. */
+static struct thread *txq_waiter;
+static struct lock txq_lock;
 
 static void set_serial (int bps);
-static void putc_poll (uint8_t);
+static void xmit_poll (void);
+static void xmit_fifo (void);
+static void txq_wait (void);
 static void write_ier (void);
 static intr_handler_func serial_interrupt;
 
@@ -67,10 +91,11 @@ static void
 init_poll (void) {
 	ASSERT (mode == UNINIT);
 	outb (IER_REG, 0);                    /* Turn off all interrupts. */
-	outb (FCR_REG, 0);                    /* Disable FIFO. */
+	outb (FCR_REG, FCR_ENABLE | FCR_CLEAR_RECV | FCR_CLEAR_XMIT);
+	                                      /* Enable and clear FIFOs. */
 	set_serial (115200);                  /* 115.2 kbps, N-8-1. */
 	outb (MCR_REG, MCR_OUT2);             /* Required to enable interrupts. */
-	intq_init (&txq);
+	lock_init (&txq_lock);
 	mode = POLL;
 }
 
@@ -95,30 +120,69 @@ serial_init_queue (void) {
 /* Sends BYTE to the serial port. */
 void
 serial_putc (uint8_t byte) {
+	serial_putbuf ((const char *) &byte, 1);
+}
+
+/* Returns true if the transmit queue is empty. */
+static inline bool
+txq_empty (void) {
+	return txq_head == txq_tail;
+}
+
+/* Returns true if the transmit queue is full. */
+static inline bool
+txq_full (void) {
+	return txq_head - txq_tail == TXQ_SIZE;
+}
+
+/* Sends the N bytes in BUF to the serial port.  Interrupts are
+   disabled once for the whole run, and the interrupt enable
+   register, which is an I/O port write, is only updated when the
+   transmit queue fills up and at the end, not once per byte. */
+void
+serial_putbuf (const char *buf, size_t n) {
 	enum intr_level old_level = intr_disable ();
 
-	if (mode != QUEUE) {
-		/* If we're not set up for interrupt-driven I/O yet,
-		   use dumb polling to transmit a byte. */
-		if (mode == UNINIT)
-			init_poll ();
-		putc_poll (byte);
-	} else {
-		/* Otherwise, queue a byte and update the interrupt enable
-		   register. */
-		if (old_level == INTR_OFF && intq_full (&txq)) {
-			/* Interrupts are off and the transmit queue is full.
-			   If we wanted to wait for the queue to empty,
-			   we'd have to reenable interrupts.
-			   That's impolite, so we'll send a character via
-			   polling instead. */
-			putc_poll (intq_getc (&txq));
+	if (mode == UNINIT)
+		init_poll ();
+	while (n > 0) {
+		size_t room, chunk, ofs;
+
+		if (txq_full ()) {
+			if (mode != QUEUE || old_level == INTR_OFF) {
+				/* If we're not set up for interrupt-driven I/O yet,
+				   or if interrupts are off, waiting for the queue to
+				   drain would mean reenabling interrupts.  That's
+				   impolite, so we send by polling instead. */
+				xmit_poll ();
+			} else {
+				/* Make sure the transmit interrupt is enabled, then
+				   wait for it to make room. */
+				write_ier ();
+				txq_wait ();
+			}
+			continue;
 		}
 
-		intq_putc (&txq, byte);
-		write_ier ();
+		/* Copy as much as fits before the end of the ring. */
+		ofs = txq_head % TXQ_SIZE;
+		room = TXQ_SIZE - (txq_head - txq_tail);
+		chunk = n < room ? n : room;
+		if (chunk > TXQ_SIZE - ofs)
+			chunk = TXQ_SIZE - ofs;
+		memcpy (txq + ofs, buf, chunk);
+		txq_head += chunk;
+		buf += chunk;
+		n -= chunk;
 	}
 
+	/* In polling mode nothing else will drain the queue. */
+	if (mode != QUEUE)
+		while (!txq_empty ())
+			xmit_poll ();
+	else
+		write_ier ();
+
 	intr_set_level (old_level);
 }
 
@@ -127,8 +191,8 @@ serial_putc (uint8_t byte) {
 void
 serial_flush (void) {
 	enum intr_level old_level = intr_disable ();
-	while (!intq_empty (&txq))
-		putc_poll (intq_getc (&txq));
+	while (!txq_empty ())
+		xmit_poll ();
 	intr_set_level (old_level);
 }
 
@@ -171,7 +235,7 @@ write_ier (void) {
 
 	/* Enable transmit interrupt if we have any characters to
 	   transmit. */
-	if (!intq_empty (&txq))
+	if (!txq_empty ())
 		ier |= IER_XMIT;
 
 	/* Enable receive interrupt if we have room to store any
@@ -182,15 +246,49 @@ write_ier (void) {
 	outb (IER_REG, ier);
 }
 
-/* Polls the serial port until it's ready,
-   and then transmits BYTE. */
+/* Moves up to a FIFO's worth of bytes from the transmit queue
+   into the UART, whose transmitter must be empty.  Wakes a thread
+   waiting for room in the queue. */
+static void
+xmit_fifo (void) {
+	int i;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	for (i = 0; i < XMIT_FIFO_DEPTH && !txq_empty (); i++)
+		outb (THR_REG, txq[txq_tail++ % TXQ_SIZE]);
+	if (txq_waiter != NULL) {
+		thread_unblock (txq_waiter);
+		txq_waiter = NULL;
+	}
+}
+
+/* Polls the serial port until its transmitter is empty, and then
+   transmits up to a FIFO's worth of bytes from the queue, which
+   must not be empty. */
 static void
-putc_poll (uint8_t byte) {
+xmit_poll (void) {
 	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (!txq_empty ());
 
 	while ((inb (LSR_REG) & LSR_THRE) == 0)
 		continue;
-	outb (THR_REG, byte);
+	xmit_fifo ();
+}
+
+/* Waits until the transmit queue has room.  Must be called with
+   interrupts off, from a thread, in interrupt-driven mode. */
+static void
+txq_wait (void) {
+	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (!intr_context ());
+
+	lock_acquire (&txq_lock);
+	while (txq_full ()) {
+		txq_waiter = thread_current ();
+		thread_block ();
+	}
+	lock_release (&txq_lock);
 }
 
 /* Serial interrupt handler. */
@@ -205,10 +303,10 @@ serial_interrupt (struct intr_frame *f UNUSED) {
 	while (!input_full () && (inb (LSR_REG) & LSR_DR) != 0)
 		input_putc (inb (RBR_REG));
 
-	/* As long as we have a byte to transmit, and the hardware is
-	   ready to accept a byte for transmission, transmit a byte. */
-	while (!intq_empty (&txq) && (inb (LSR_REG) & LSR_THRE) != 0)
-		outb (THR_REG, intq_getc (&txq));
+	/* If we have bytes to transmit, and the transmitter is empty,
+	   refill its FIFO. */
+	if (!txq_empty () && (inb (LSR_REG) & LSR_THRE) != 0)
+		xmit_fifo ();
 
 	/* Update interrupt enable register based on queue status. */
 	write_ier ();
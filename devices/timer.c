@@ -3,13 +3,30 @@
 #include <inttypes.h>
 #include <round.h>
 #include <stdio.h>
+#include <timepage.h>
+#include "threads/cpu.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
+#include "threads/lapic.h"
+#include "threads/loader.h"
+#include "threads/palloc.h"
+#include "threads/profile.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
+#include "intrinsic.h"
 
 
-/* See [8254] for hardware details of the 8254 timer chip. */
+/* See [8254] for hardware details of the 8254 timer chip.
+
+   The 8254 ticks only until timer_calibrate() has timed the time
+   stamp counter (TSC) against it.  After that, if there is a local
+   APIC, each CPU's local APIC timer raises that CPU's ticks, in
+   TSC-deadline mode if the CPU has it and in one-shot mode
+   otherwise, rearmed at every interrupt.  Time is then read from
+   the TSC, tick N beginning at cycle tick_base_tsc + N *
+   tsc_per_tick, so timer_ticks() is exact between interrupts, and
+   a sleep can end between ticks: the timer of the CPU that puts a
+   thread to sleep is set to go off at its wakeup time. */
 
 #if TIMER_FREQ < 19
 #error 8254 timer requires TIMER_FREQ >= 19
@@ -18,17 +35,51 @@
 #error TIMER_FREQ <= 1000 recommended
 #endif
 
-/* Number of timer ticks since OS booted. */
-static int64_t ticks;
+/* Number of timer ticks since OS booted, counted by the 8254
+   interrupt, then copied from the TSC at the boot processor's
+   ticks. */
+static volatile int64_t ticks;
+
+/* 8254 input cycles per timer tick.  Initialized by timer_init(). */
+static uint16_t pit_tick_count;
+
+/* -tickless: Stop the periodic tick while the CPU is idle? */
+bool timer_tickless;
+
+/* Number of ticks covered by the one-shot count programmed by
+   timer_idle_enter(), or 0 while the timer runs periodically. */
+static int64_t idle_stretch;
 
-/* Number of loops per timer tick.
-   Initialized by timer_calibrate(). */
-static unsigned loops_per_tick;
+/* Local APIC time keeping, set up by timer_calibrate(). */
+static bool lapic_clock;        /* Local APIC timers in use? */
+static bool lapic_deadline;     /* In TSC-deadline mode? */
+static uint64_t tsc_per_tick;   /* TSC cycles per tick. */
+static uint64_t tsc_freq;       /* TSC cycles per second. */
+static uint64_t tick_base_tsc;  /* TSC at tick 0. */
+static uint64_t lapic_per_tick; /* Timer counts per tick, if one-shot. */
+
+/* Number of ticks timed to calibrate the TSC, if CPUID does not
+   give its frequency. */
+#define TSC_CALIBRATE_TICKS 2
+
+/* Sleeps shorter than 1 / SPIN_FRACTION seconds, 20 us, spin on
+   the TSC instead, since blocking would take about as long. */
+#define SPIN_FRACTION 50000
+
+/* Page mapped read-only into every process, mirroring TICKS. */
+static struct timepage *timepage;
 
 static intr_handler_func timer_interrupt;
-static bool too_many_loops (unsigned loops);
-static void busy_wait (int64_t loops);
+static intr_handler_func lapic_timer_interrupt;
+static void lapic_clock_start (void);
+static void lapic_timer_rearm (void);
+static uint64_t tsc_freq_cpuid (void);
+static uint64_t tsc_freq_measure (void);
+static void busy_wait (uint64_t cycles);
 static void real_time_sleep (int64_t num, int32_t denom);
+static void pit_set_periodic (void);
+static void timepage_update (void);
+static uint64_t timepage_read (int64_t *ticks, uint64_t *tick_tsc);
 
 /* Sets up the 8254 Programmable Interval Timer (PIT) to
    interrupt PIT_FREQ times per second, and registers the
@@ -37,50 +88,255 @@ void
 timer_init (void) {
 	/* 8254 input frequency divided by TIMER_FREQ, rounded to
 	   nearest. */
-	uint16_t count = (1193180 + TIMER_FREQ / 2) / TIMER_FREQ;
+	pit_tick_count = (1193180 + TIMER_FREQ / 2) / TIMER_FREQ;
+	pit_set_periodic ();
 
-	outb (0x43, 0x34);    /* CW: counter 0, LSB then MSB, mode 2, binary. */
-	outb (0x40, count & 0xff);
-	outb (0x40, count >> 8);
+	timepage = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+	timepage->freq = TIMER_FREQ;
+	timepage->boot_tsc = timepage->tick_tsc = rdtsc ();
 
 	intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
 
-/* Calibrates loops_per_tick, used to implement brief delays. */
+/* Calibrates the TSC cycles per tick, used for all time keeping
+   and brief delays, then hands the tick over to the local APIC
+   timers if there are any.  The frequency comes from CPUID if the
+   CPU reports it, and is otherwise timed against the 8254. */
 void
 timer_calibrate (void) {
-	unsigned high_bit, test_bit;
-
 	ASSERT (intr_get_level () == INTR_ON);
 	printf ("Calibrating timer...  ");
 
-	/* Approximate loops_per_tick as the largest power-of-two
-	   still less than one timer tick. */
-	loops_per_tick = 1u << 10;
-	while (!too_many_loops (loops_per_tick << 1)) {
-		loops_per_tick <<= 1;
-		ASSERT (loops_per_tick != 0);
+	tsc_freq = tsc_freq_cpuid ();
+	if (tsc_freq != 0)
+		printf ("%'"PRIu64" TSC Hz from CPUID.\n", tsc_freq);
+	else {
+		tsc_freq = tsc_freq_measure ();
+		printf ("%'"PRIu64" TSC Hz.\n", tsc_freq);
+	}
+	tsc_per_tick = tsc_freq / TIMER_FREQ;
+	timepage->tsc_per_tick = tsc_per_tick;
+
+	if (lapic_init ())
+		lapic_clock_start ();
+}
+
+/* Returns the TSC frequency in Hz as CPUID leaf 0x15 gives it,
+   from the core crystal clock and the TSC's ratio to it, or 0 if
+   the CPU does not say.  Some CPUs give the ratio but not the
+   crystal, which is then derived from the base frequency in leaf
+   0x16. */
+static uint64_t
+tsc_freq_cpuid (void) {
+	uint32_t regs[4];
+	uint32_t max_leaf, denom, numer;
+	uint64_t crystal;
+
+	cpuid (0, 0, regs);
+	max_leaf = regs[0];
+	if (max_leaf < 0x15)
+		return 0;
+
+	cpuid (0x15, 0, regs);
+	denom = regs[0];
+	numer = regs[1];
+	crystal = regs[2];
+	if (denom == 0 || numer == 0)
+		return 0;
+	if (crystal == 0 && max_leaf >= 0x16) {
+		cpuid (0x16, 0, regs);
+		crystal = (uint64_t) (regs[0] & 0xffff) * 1000000 * denom / numer;
+	}
+	return crystal * numer / denom;
+}
+
+/* Times TSC_CALIBRATE_TICKS 8254 ticks with the TSC and returns
+   its frequency in Hz. */
+static uint64_t
+tsc_freq_measure (void) {
+	int64_t start;
+	uint64_t tsc;
+
+	start = ticks;
+	while (ticks == start)
+		barrier ();
+	start = ticks;
+	tsc = rdtsc ();
+	while (ticks - start < TSC_CALIBRATE_TICKS)
+		barrier ();
+	return (rdtsc () - tsc) / TSC_CALIBRATE_TICKS * TIMER_FREQ;
+}
+
+/* Moves the tick from the 8254 to the boot processor's local APIC
+   timer, keeping the tick count. */
+static void
+lapic_clock_start (void) {
+	enum intr_level old_level;
+
+	lapic_deadline = lapic_timer_has_deadline ();
+	if (!lapic_deadline)
+		lapic_per_tick = lapic_timer_measure (tsc_per_tick);
+	intr_register_lapic (LAPIC_TIMER_VEC, lapic_timer_interrupt,
+			"Local APIC Timer");
+
+	old_level = intr_disable ();
+	ASSERT (thread_next_wakeup () == INT64_MAX);
+	ASSERT (idle_stretch == 0);
+
+	/* Tick TICKS began when the 8254 last interrupted. */
+	tick_base_tsc = timepage->tick_tsc - ticks * tsc_per_tick;
+	lapic_clock = true;
+
+	/* Stop the 8254: one count in mode 0, which does not reload,
+	   raises IRQ 0 once more. */
+	outb (0x43, 0x30);    /* CW: counter 0, LSB then MSB, mode 0, binary. */
+	outb (0x40, 0xff);
+	outb (0x40, 0xff);
+
+	timer_init_ap ();
+	intr_set_level (old_level);
+}
+
+/* Starts the running CPU's local APIC timer ticking, if the local
+   APIC timers keep time.  Called for the boot processor by
+   timer_calibrate() and by each other CPU as it starts, with
+   interrupts off. */
+void
+timer_init_ap (void) {
+	struct cpu *c = cpu_current ();
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	if (!lapic_clock)
+		return;
+
+	lapic_timer_init (LAPIC_TIMER_VEC, lapic_deadline);
+	c->tick_tsc = tick_base_tsc + (timer_ticks () + 1) * tsc_per_tick;
+	c->timer_tsc = UINT64_MAX;
+	c->timer_stretched = false;
+	lapic_timer_rearm ();
+}
+
+/* Sets the running CPU's local APIC timer to go off at TSC. */
+static void
+lapic_timer_set (uint64_t tsc) {
+	cpu_current ()->timer_tsc = tsc;
+	if (lapic_deadline)
+		lapic_timer_deadline (tsc);
+	else {
+		uint64_t now = rdtsc ();
+		uint64_t delta = tsc > now ? tsc - now : 0;
+		uint64_t count;
+
+		/* Keep the count in range, and the product below from
+		   overflowing; the timer simply fires early. */
+		if (delta > TIMER_FREQ * tsc_per_tick)
+			delta = TIMER_FREQ * tsc_per_tick;
+		count = delta * lapic_per_tick / tsc_per_tick;
+		if (count > UINT32_MAX)
+			count = UINT32_MAX;
+		lapic_timer_oneshot (count > 0 ? count : 1);
 	}
+}
 
-	/* Refine the next 8 bits of loops_per_tick. */
-	high_bit = loops_per_tick;
-	for (test_bit = high_bit >> 1; test_bit != high_bit >> 10; test_bit >>= 1)
-		if (!too_many_loops (high_bit | test_bit))
-			loops_per_tick |= test_bit;
+/* Sets the running CPU's local APIC timer for its next tick or
+   the earliest wakeup of a sleeping thread, whichever comes
+   first. */
+static void
+lapic_timer_rearm (void) {
+	struct cpu *c = cpu_current ();
+	uint64_t next = c->tick_tsc;
+	int64_t wakeup = thread_next_wakeup ();
+
+	if ((uint64_t) wakeup < next)
+		next = wakeup;
+	lapic_timer_set (next);
+}
+
+/* Makes sure that the running CPU's timer goes off by CLOCK, a
+   reading of timer_clock() at which a thread is to wake up.
+   Interrupts must be off. */
+void
+timer_arm (int64_t clock) {
+	ASSERT (intr_get_level () == INTR_OFF);
+	if (lapic_clock && (uint64_t) clock < cpu_current ()->timer_tsc)
+		lapic_timer_set (clock);
+}
 
-	printf ("%'"PRIu64" loops/s.\n", (uint64_t) loops_per_tick * TIMER_FREQ);
+/* Returns the clock that threads' wakeup times are read from: the
+   TSC once the local APIC timers keep time, otherwise the tick
+   count. */
+int64_t
+timer_clock (void) {
+	return lapic_clock ? (int64_t) rdtsc () : timer_ticks ();
+}
+
+/* Returns the timer_clock() reading at which tick TICK begins. */
+static int64_t
+tick_to_clock (int64_t tick) {
+	return lapic_clock ? (int64_t) (tick_base_tsc + tick * tsc_per_tick) : tick;
+}
+
+/* Returns the timer_clock() reading MS milliseconds from now,
+   rounded up to a whole tick, as a deadline for
+   thread_block_until(). */
+int64_t
+timer_deadline (int64_t ms) {
+	int64_t ticks = ms <= 0 ? 0 : DIV_ROUND_UP (ms * TIMER_FREQ, 1000);
+
+	return tick_to_clock (timer_ticks () + ticks);
 }
 
 /* Returns the number of timer ticks since the OS booted. */
 int64_t
 timer_ticks (void) {
-	enum intr_level old_level = intr_disable ();
-	int64_t t = ticks;
-	intr_set_level (old_level);
+	int64_t t;
+
+	if (lapic_clock) {
+		int64_t cycles = rdtsc () - tick_base_tsc;
+
+		return cycles > 0 ? cycles / (int64_t) tsc_per_tick : 0;
+	}
+	/* An aligned 64-bit load is atomic, so reading the count
+	   needs neither a lock nor interrupts off. */
+	t = ticks;
 	barrier ();
 	return t;
 }
 
+/* Returns nanoseconds since the OS booted.  Once the local APIC
+   timers keep time this is read straight from the TSC; with the
+   8254 it is the tick count, interpolated within the current tick
+   from a time page snapshot once the TSC is calibrated.  Either
+   way it never goes backward and takes no lock. */
+int64_t
+timer_ns (void) {
+	const int64_t ns_per_tick = 1000000000 / TIMER_FREQ;
+	int64_t t;
+	uint64_t tick_tsc, tsc;
+
+	if (lapic_clock) {
+		int64_t cycles = rdtsc () - tick_base_tsc;
+
+		if (cycles <= 0)
+			return 0;
+		/* Split to keep the product from overflowing. */
+		return cycles / tsc_freq * 1000000000
+			+ cycles % tsc_freq * 1000000000 / tsc_freq;
+	}
+
+	tsc = timepage_read (&t, &tick_tsc);
+	if (tsc_per_tick != 0) {
+		uint64_t delta = tsc - tick_tsc;
+
+		/* Stop at the tick's end, so that a late or stretched
+		   tick cannot make the clock run ahead of it. */
+		if (delta >= tsc_per_tick)
+			delta = tsc_per_tick - 1;
+		return t * ns_per_tick + delta * ns_per_tick / tsc_per_tick;
+	}
+	return t * ns_per_tick;
+}
+
 /* Returns the number of timer ticks elapsed since THEN, which
    should be a value once returned by timer_ticks(). */
 int64_t
@@ -95,7 +351,9 @@ timer_sleep (int64_t ticks) {
 	curr_thread = thread_current();
 
 	ASSERT(curr_thread -> status == THREAD_RUNNING);
-	curr_thread -> wakeup_this_tick = timer_ticks () + ticks;
+	if (ticks <= 0)
+		return;
+	curr_thread -> wakeup_time = tick_to_clock (timer_ticks () + ticks);
 	thread_sleep(curr_thread);
 		/*
 	while (timer_elapsed (start) < ticks)
@@ -121,53 +379,215 @@ timer_nsleep (int64_t ns) {
 	real_time_sleep (ns, 1000 * 1000 * 1000);
 }
 
+/* Called by the idle thread, with interrupts off, just before it
+   halts.  In tickless mode, replaces the periodic tick with a
+   single one-shot interrupt covering as many whole ticks as the
+   8254 allows, up to DEADLINE, the earliest tick at which some
+   thread needs to run. */
+void
+timer_idle_enter (int64_t deadline) {
+	int64_t stretch;
+	uint32_t count;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	if (!timer_tickless)
+		return;
+	if (lapic_clock) {
+		struct cpu *c = cpu_current ();
+		uint64_t limit = c->tick_tsc + TIMER_FREQ * tsc_per_tick;
+
+		/* Sleep through ticks until DEADLINE, or for a second. */
+		c->timer_stretched = true;
+		lapic_timer_set ((uint64_t) deadline < limit ? (uint64_t) deadline : limit);
+		return;
+	}
+	if (idle_stretch != 0)
+		return;
+
+	stretch = deadline - ticks;
+	if (stretch > UINT16_MAX / pit_tick_count)
+		stretch = UINT16_MAX / pit_tick_count;
+	if (stretch <= 1)
+		return;
+
+	count = stretch * pit_tick_count;
+	outb (0x43, 0x30);    /* CW: counter 0, LSB then MSB, mode 0, binary. */
+	outb (0x40, count & 0xff);
+	outb (0x40, count >> 8);
+	idle_stretch = stretch;
+}
+
+/* Called with interrupts off when the idle thread stops running.
+   If a one-shot count from timer_idle_enter() is still pending,
+   credits the whole ticks that have really elapsed and returns
+   the timer to periodic mode. */
+void
+timer_idle_exit (void) {
+	uint32_t remaining, elapsed;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	if (lapic_clock) {
+		struct cpu *c = cpu_current ();
+
+		/* The TSC kept time; just bring the tick back. */
+		if (c->timer_stretched) {
+			c->timer_stretched = false;
+			lapic_timer_rearm ();
+		}
+		return;
+	}
+	if (idle_stretch == 0)
+		return;
+
+	/* Read back counter 0's status.  If OUT is already high the
+	   count expired and its interrupt is pending, so leave the
+	   accounting to timer_interrupt(). */
+	outb (0x43, 0xe2);
+	if (inb (0x40) & 0x80)
+		return;
+
+	outb (0x43, 0x00);    /* CW: latch counter 0. */
+	remaining = inb (0x40);
+	remaining |= inb (0x40) << 8;
+	elapsed = idle_stretch * pit_tick_count - remaining;
+
+	ticks += elapsed / pit_tick_count;
+	idle_stretch = 0;
+	pit_set_periodic ();
+	timepage_update ();
+}
+
 /* Prints timer statistics. */
 void
 timer_print_stats (void) {
 	printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
 }
 
-/* Timer interrupt handler. */
+/* 8254 timer interrupt handler. */
 static void
-timer_interrupt (struct intr_frame *args UNUSED) {
-	ticks++;
-	thread_tick ();
+timer_interrupt (struct intr_frame *args) {
+	/* The last interrupt after lapic_clock_start() stopped it. */
+	if (lapic_clock)
+		return;
+
+	if (idle_stretch != 0) {
+		ticks += idle_stretch;
+		idle_stretch = 0;
+		pit_set_periodic ();
+	} else
+		ticks++;
+	timepage_update ();
+	if (profile_enabled)
+		profile_sample (args);
+	thread_tick (args->cs == SEL_UCSEG);
+	check_thread_woken_up (ticks);
 }
 
-/* Returns true if LOOPS iterations waits for more than one timer
-   tick, otherwise false. */
-static bool
-too_many_loops (unsigned loops) {
-	/* Wait for a timer tick. */
-	int64_t start = ticks;
-	while (ticks == start)
-		barrier ();
+/* Local APIC timer interrupt handler, on each CPU.  Runs the tick
+   if one is due, wakes the threads whose time has come, and sets
+   the timer again. */
+static void
+lapic_timer_interrupt (struct intr_frame *args) {
+	struct cpu *c = cpu_current ();
 
-	/* Run LOOPS loops. */
-	start = ticks;
-	busy_wait (loops);
+	if (rdtsc () >= c->tick_tsc) {
+		int64_t now = timer_ticks ();
+
+		c->tick_tsc = tick_base_tsc + (now + 1) * tsc_per_tick;
+		if (c->id == 0) {
+			ticks = now;
+			timepage_update ();
+			if (profile_enabled)
+				profile_sample (args);
+		}
+		thread_tick (args->cs == SEL_UCSEG);
+	}
+	check_thread_woken_up (timer_clock ());
+	thread_preempt ();
 
-	/* If the tick count changed, we iterated too long. */
+	/* An idle stretch ends with any interrupt of its own. */
+	c->timer_stretched = false;
+	lapic_timer_rearm ();
+}
+
+/* Returns the kernel virtual address of the time page, which each
+   process maps read-only at TIMEPAGE_ADDR. */
+void *
+timer_page (void) {
+	return timepage;
+}
+
+/* Publishes TICKS in the time page.  Interrupts must be off. */
+static void
+timepage_update (void) {
+	timepage->seq++;
 	barrier ();
-	return start != ticks;
+	timepage->ticks = ticks;
+	timepage->tick_tsc = rdtsc ();
+	barrier ();
+	timepage->seq++;
 }
 
-/* Iterates through a simple loop LOOPS times, for implementing
-   brief delays.
+/* Reads the tick count and the TSC at its start from the time
+   page into *TICKS and *TICK_TSC, retrying while an update is in
+   progress, as user programs read it.  Returns the TSC as of the
+   copy. */
+static uint64_t
+timepage_read (int64_t *ticks, uint64_t *tick_tsc) {
+	uint32_t seq;
+	uint64_t tsc;
 
-   Marked NO_INLINE because code alignment can significantly
-   affect timings, so that if this function was inlined
-   differently in different places the results would be difficult
-   to predict. */
-static void NO_INLINE
-busy_wait (int64_t loops) {
-	while (loops-- > 0)
+	do {
+		seq = timepage->seq;
+		barrier ();
+		*ticks = timepage->ticks;
+		*tick_tsc = timepage->tick_tsc;
+		tsc = rdtsc ();
 		barrier ();
+	} while ((seq & 1) != 0 || seq != timepage->seq);
+	return tsc;
+}
+
+/* Programs the 8254 to interrupt TIMER_FREQ times per second. */
+static void
+pit_set_periodic (void) {
+	outb (0x43, 0x34);    /* CW: counter 0, LSB then MSB, mode 2, binary. */
+	outb (0x40, pit_tick_count & 0xff);
+	outb (0x40, pit_tick_count >> 8);
+}
+
+/* Spins for CYCLES cycles of the TSC, for implementing brief
+   delays. */
+static void
+busy_wait (uint64_t cycles) {
+	uint64_t deadline = rdtsc () + cycles;
+
+	while (rdtsc () < deadline)
+		asm volatile ("pause");
 }
 
 /* Sleep for approximately NUM/DENOM seconds. */
 static void
 real_time_sleep (int64_t num, int32_t denom) {
+	uint64_t cycles = num / denom * tsc_freq + num % denom * tsc_freq / denom;
+
+	ASSERT (intr_get_level () == INTR_ON);
+	if (num <= 0)
+		return;
+
+	if (lapic_clock) {
+		/* Sleep until the TSC gets there, to the cycle. */
+		struct thread *t = thread_current ();
+
+		if (cycles < tsc_freq / SPIN_FRACTION) {
+			busy_wait (cycles);
+			return;
+		}
+		t->wakeup_time = rdtsc () + cycles;
+		thread_sleep (t);
+		return;
+	}
+
 	/* Convert NUM/DENOM seconds into timer ticks, rounding down.
 
 	   (NUM / DENOM) s
@@ -176,17 +596,14 @@ real_time_sleep (int64_t num, int32_t denom) {
 	   */
 	int64_t ticks = num * TIMER_FREQ / denom;
 
-	ASSERT (intr_get_level () == INTR_ON);
 	if (ticks > 0) {
 		/* We're waiting for at least one full timer tick.  Use
 		   timer_sleep() because it will yield the CPU to other
 		   processes. */
 		timer_sleep (ticks);
 	} else {
-		/* Otherwise, use a busy-wait loop for more accurate
-		   sub-tick timing.  We scale the numerator and denominator
-		   down by 1000 to avoid the possibility of overflow. */
-		ASSERT (denom % 1000 == 0);
-		busy_wait (loops_per_tick * num / 1000 * TIMER_FREQ / (denom / 1000));
+		/* Otherwise, spin on the TSC for accurate sub-tick
+		   timing. */
+		busy_wait (cycles);
 	}
 }
@@ -13,22 +13,35 @@
 #define COL_CNT 80
 #define ROW_CNT 25
 
+/* Number of rows that fit in the 32 kB of text-mode video memory
+   at 0xb8000. */
+#define MEM_ROW_CNT (0x8000 / (COL_CNT * 2))
+
 /* Current cursor position.  (0,0) is in the upper left corner of
    the display. */
 static size_t cx, cy;
 
+/* The display shows video memory rows TOP through TOP + ROW_CNT
+   - 1.  Scrolling advances TOP and moves the CRTC start address
+   with it, instead of copying the whole screen up a row; only
+   when the bottom of video memory is reached is the screen copied
+   back to the top.  HW_TOP is the row the CRTC was last told. */
+static size_t top, hw_top;
+
 /* Attribute value for gray text on a black background. */
 #define GRAY_ON_BLACK 0x07
 
 /* Framebuffer.  See [FREEVGA] under "VGA Text Mode Operation".
-   The character at (x,y) is fb[y][x][0].
-   The attribute at (x,y) is fb[y][x][1]. */
+   The character at (x,y) is fb[top + y][x][0].
+   The attribute at (x,y) is fb[top + y][x][1]. */
 static uint8_t (*fb)[COL_CNT][2];
 
+static void put_char (int c);
 static void clear_row (size_t y);
 static void cls (void);
 static void newline (void);
 static void move_cursor (void);
+static void set_start (size_t row);
 static void find_cursor (size_t *x, size_t *y);
 
 /* Initializes the VGA text display. */
@@ -39,6 +52,7 @@ init (void) {
 	if (!inited) {
 		fb = ptov (0xb8000);
 		find_cursor (&cx, &cy);
+		set_start (0);
 		inited = true;
 	}
 }
@@ -52,7 +66,34 @@ vga_putc (int c) {
 	enum intr_level old_level = intr_disable ();
 
 	init ();
+	put_char (c);
+
+	/* Update cursor position. */
+	move_cursor ();
+
+	intr_set_level (old_level);
+}
 
+/* Writes the N characters in BUF to the VGA text display, as
+   vga_putc() would, but moves the hardware cursor, which takes
+   I/O port writes, only once at the end. */
+void
+vga_putbuf (const char *buf, size_t n) {
+	enum intr_level old_level = intr_disable ();
+
+	init ();
+	while (n-- > 0)
+		put_char ((uint8_t) *buf++);
+	move_cursor ();
+
+	intr_set_level (old_level);
+}
+
+/* Writes C to the framebuffer at the cursor, interpreting control
+   characters, without moving the hardware cursor.  Must be
+   called with interrupts off. */
+static void
+put_char (int c) {
 	switch (c) {
 		case '\n':
 			newline ();
@@ -78,24 +119,20 @@ vga_putc (int c) {
 			break;
 
 		default:
-			fb[cy][cx][0] = c;
-			fb[cy][cx][1] = GRAY_ON_BLACK;
+			fb[top + cy][cx][0] = c;
+			fb[top + cy][cx][1] = GRAY_ON_BLACK;
 			if (++cx >= COL_CNT)
 				newline ();
 			break;
 	}
-
-	/* Update cursor position. */
-	move_cursor ();
-
-	intr_set_level (old_level);
 }
-
+
 /* Clears the screen and moves the cursor to the upper left. */
 static void
 cls (void) {
 	size_t y;
 
+	top = 0;
 	for (y = 0; y < ROW_CNT; y++)
 		clear_row (y);
 
@@ -103,15 +140,15 @@ cls (void) {
 	move_cursor ();
 }
 
-/* Clears row Y to spaces. */
+/* Clears screen row Y to spaces. */
 static void
 clear_row (size_t y) {
 	size_t x;
 
 	for (x = 0; x < COL_CNT; x++)
 	{
-		fb[y][x][0] = ' ';
-		fb[y][x][1] = GRAY_ON_BLACK;
+		fb[top + y][x][0] = ' ';
+		fb[top + y][x][1] = GRAY_ON_BLACK;
 	}
 }
 
@@ -125,20 +162,41 @@ newline (void) {
 	if (cy >= ROW_CNT)
 	{
 		cy = ROW_CNT - 1;
-		memmove (&fb[0], &fb[1], sizeof fb[0] * (ROW_CNT - 1));
+		if (top + ROW_CNT < MEM_ROW_CNT)
+			top++;
+		else {
+			memmove (&fb[0], &fb[top + 1], sizeof fb[0] * (ROW_CNT - 1));
+			top = 0;
+		}
 		clear_row (ROW_CNT - 1);
 	}
 }
 
-/* Moves the hardware cursor to (cx,cy). */
+/* Moves the hardware cursor to (cx,cy), first pointing the
+   display at the current top row if scrolling has moved it. */
 static void
 move_cursor (void) {
 	/* See [FREEVGA] under "Manipulating the Text-mode Cursor". */
-	uint16_t cp = cx + COL_CNT * cy;
+	uint16_t cp = cx + COL_CNT * (top + cy);
+
+	if (top != hw_top)
+		set_start (top);
 	outw (0x3d4, 0x0e | (cp & 0xff00));
 	outw (0x3d4, 0x0f | (cp << 8));
 }
 
+/* Points the CRTC start address, the video memory offset of the
+   upper left character on the display, at video memory row ROW. */
+static void
+set_start (size_t row) {
+	/* See [FREEVGA] under "CRTC Registers". */
+	uint16_t start = row * COL_CNT;
+
+	outw (0x3d4, 0x0c | (start & 0xff00));
+	outw (0x3d4, 0x0d | (start << 8));
+	hw_top = row;
+}
+
 /* Reads the current hardware cursor position into (*X,*Y). */
 static void
 find_cursor (size_t *x, size_t *y) {
@@ -0,0 +1,673 @@
+#include "devices/virtio-blk.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/disk.h"
+#include "devices/pci.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Driver for virtio block devices, as QEMU emulates with
+   "-device virtio-blk-pci", through the legacy virtio PCI
+   interface [virtio 0.9.5].
+
+   Unlike an IDE channel, which takes one command at a time, a
+   virtio device has a queue of requests in shared memory, the
+   virtqueue, that it serves in any order and as many at once as
+   it likes.  Each request is a chain of descriptors: a header
+   saying what to do, the data buffers, scattered wherever they
+   are in physical memory, and a status byte for the device to
+   fill in.  The driver puts the head of a chain in the "available"
+   ring and notifies the device, which in time puts it in the
+   "used" ring and interrupts.
+
+   Requests submitted to a virtio disk wait in its queue until a
+   command slot and its descriptors are free; requests in the same
+   direction that continue each other are merged into one command,
+   as on IDE.  Completed commands are reaped by the device's own
+   thread.  Its interrupt handler only wakes the thread and turns
+   further interrupts off, and the thread turns them back on once
+   it has emptied the used ring, so a burst of completions costs
+   one interrupt and one wakeup instead of one each.
+
+   A virtio disk appears through disk_get() in place of an IDE
+   disk: the one its serial number ("-device virtio-blk-pci,
+   serial=hd0:1", see utils/pintos) names, or else the first one
+   absent. */
+
+/* Legacy virtio PCI registers, relative to BAR 0. */
+#define VIRTIO_HOST_FEATURES 0x00   /* Features of the device (r/o). */
+#define VIRTIO_GUEST_FEATURES 0x04  /* Features the driver uses. */
+#define VIRTIO_QUEUE_PFN 0x08       /* Page number of selected queue. */
+#define VIRTIO_QUEUE_SIZE 0x0c      /* Size of selected queue (r/o). */
+#define VIRTIO_QUEUE_SEL 0x0e       /* Queue selector. */
+#define VIRTIO_QUEUE_NOTIFY 0x10    /* Queue notifier. */
+#define VIRTIO_STATUS 0x12          /* Device status. */
+#define VIRTIO_ISR 0x13             /* Interrupt status, cleared on read. */
+#define VIRTIO_CONFIG 0x14          /* Device configuration, no MSI-X. */
+
+/* Device status bits. */
+#define STATUS_ACKNOWLEDGE 0x01     /* Driver has seen the device. */
+#define STATUS_DRIVER 0x02          /* Driver knows how to drive it. */
+#define STATUS_DRIVER_OK 0x04       /* Driver is ready. */
+#define STATUS_FAILED 0x80          /* Driver gave up on the device. */
+
+/* Interrupt status bits. */
+#define ISR_QUEUE 0x01              /* Used ring was updated. */
+
+/* PCI identity of a legacy virtio block device. */
+#define VIRTIO_VENDOR 0x1af4
+#define VIRTIO_BLK_DEVICE 0x1001
+
+/* Request types and status values. */
+#define VIRTIO_BLK_T_IN 0           /* Read. */
+#define VIRTIO_BLK_T_OUT 1          /* Write. */
+#define VIRTIO_BLK_T_GET_ID 8       /* Read the serial number. */
+#define VIRTIO_BLK_S_OK 0           /* Success. */
+#define VIRTIO_BLK_ID_BYTES 20      /* Size of a serial number. */
+
+/* A virtqueue descriptor: one buffer of a request. */
+struct vring_desc {
+	uint64_t addr;              /* Physical address. */
+	uint32_t len;               /* Length in bytes. */
+	uint16_t flags;             /* VRING_DESC_F_*. */
+	uint16_t next;              /* Next descriptor, if VRING_DESC_F_NEXT. */
+};
+#define VRING_DESC_F_NEXT 1         /* Chain continues at NEXT. */
+#define VRING_DESC_F_WRITE 2        /* Device writes the buffer. */
+
+/* Ring of chains offered to the device. */
+struct vring_avail {
+	uint16_t flags;             /* VRING_AVAIL_F_*. */
+	uint16_t idx;               /* Where the driver puts the next entry. */
+	uint16_t ring[];            /* Heads of chains. */
+};
+#define VRING_AVAIL_F_NO_INTERRUPT 1    /* Do not interrupt on completion. */
+
+/* Ring of chains the device is done with. */
+struct vring_used_elem {
+	uint32_t id;                /* Head of the chain. */
+	uint32_t len;               /* Bytes the device wrote. */
+};
+struct vring_used {
+	uint16_t flags;             /* VRING_USED_F_*. */
+	uint16_t idx;               /* Where the device puts the next entry. */
+	struct vring_used_elem ring[];
+};
+#define VRING_USED_F_NO_NOTIFY 1    /* Device does not need notifying. */
+
+/* Header of a block request, read by the device. */
+struct virtio_blk_outhdr {
+	uint32_t type;              /* VIRTIO_BLK_T_*. */
+	uint32_t ioprio;            /* Priority, unused. */
+	uint64_t sector;            /* First sector. */
+};
+
+/* Most data buffers one command has, after joining physically
+   contiguous ones.  A command takes SEG_MAX + 2 descriptors at
+   most, with the header and status. */
+#define SEG_MAX 16
+#define CMD_DESCS (SEG_MAX + 2)
+
+/* Most commands out at once per device, and most sectors and
+   requests in one command. */
+#define CMD_MAX 32
+#define CMD_SECTORS 256
+#define BATCH_MAX 16
+
+/* Most devices driven. */
+#define VBLK_MAX 4
+
+/* Part of a request that belongs to a command. */
+struct vblk_piece {
+	struct disk_req *req;       /* The request. */
+	size_t cnt;                 /* Sectors of it in the command. */
+};
+
+/* A command slot.  Slot I always uses descriptors I * CMD_DESCS
+   onward, so the head of a used chain says which command is done. */
+struct vblk_cmd {
+	bool busy;                  /* Given to the device? */
+	bool write;                 /* Toward the device? */
+	disk_sector_t sec_no;       /* First sector. */
+	size_t cnt;                 /* Sectors. */
+	struct vblk_piece pieces[BATCH_MAX];
+	size_t piece_cnt;
+};
+
+/* Memory the device reads and writes besides the data: each
+   command slot's header and status, and the serial number. */
+struct vblk_shared {
+	struct {
+		struct virtio_blk_outhdr hdr;
+		uint8_t status;
+	} cmds[CMD_MAX];
+	char id[VIRTIO_BLK_ID_BYTES];
+};
+
+/* A virtio block device. */
+struct virtio_blk {
+	char name[8];               /* Name, e.g. "vda". */
+	struct disk *disk;          /* Disk it serves. */
+	uint16_t io_base;           /* BAR 0. */
+	uint8_t irq;                /* Interrupt vector. */
+
+	/* The virtqueue, in QUEUE_PAGES contiguous pages. */
+	uint16_t queue_size;        /* Descriptors. */
+	size_t queue_pages;
+	volatile struct vring_desc *desc;
+	volatile struct vring_avail *avail;
+	volatile struct vring_used *used;
+	uint16_t last_used;         /* Next used entry to reap. */
+	struct vblk_shared *shared; /* Headers and status, one page. */
+
+	struct lock lock;           /* Protects the members below. */
+	struct list queue;          /* Requests not yet fully issued. */
+	struct vblk_cmd cmds[CMD_MAX];
+	size_t cmd_cnt;             /* Command slots, CMD_MAX at most. */
+	size_t inflight;            /* Busy command slots. */
+	struct semaphore intr_sema; /* Up'd by the interrupt handler. */
+
+	/* Statistics. */
+	long long req_cnt;          /* Requests submitted. */
+	long long merge_cnt;        /* Requests merged into another's command. */
+	long long cmd_done_cnt;     /* Commands completed. */
+	long long seg_cnt;          /* Data buffers in those commands. */
+	long long notify_cnt;       /* Notifications sent to the device. */
+	long long intr_cnt;         /* Queue interrupts taken. */
+	long long wakeup_cnt;       /* Wakeups of the thread that reaped some. */
+	size_t max_inflight;        /* Most commands out at once. */
+};
+
+static struct virtio_blk devices[VBLK_MAX];
+static size_t device_cnt;
+
+static bool probe_device (struct virtio_blk *, int dev, int func);
+static bool setup_queue (struct virtio_blk *);
+static bool read_id (struct virtio_blk *);
+static void issue_commands (struct virtio_blk *);
+static void completion_thread (void *);
+static void virtio_blk_submit (void *, struct disk_req *);
+static void interrupt_handler (struct intr_frame *);
+
+static const struct disk_driver virtio_blk_driver = {
+	.name = "virtio",
+	.submit = virtio_blk_submit,
+};
+
+/* Looks on PCI bus 0 for virtio block devices and makes a disk of
+   each.  Called by disk_init() once the IDE disks are found. */
+void
+virtio_blk_init (void) {
+	int dev, func;
+
+	for (dev = 0; dev < 32; dev++)
+		for (func = 0; func < 8; func++) {
+			uint32_t id = pci_read_config (0, dev, func, 0x00);
+			struct virtio_blk *vb;
+
+			if ((id & 0xffff) != VIRTIO_VENDOR
+					|| (id >> 16) != VIRTIO_BLK_DEVICE)
+				continue;
+			if (device_cnt == VBLK_MAX) {
+				printf ("virtio-blk: too many devices, ignoring %02x.%x\n",
+						dev, func);
+				continue;
+			}
+			vb = &devices[device_cnt];
+			snprintf (vb->name, sizeof vb->name, "vd%c",
+					(int) ('a' + device_cnt));
+			if (!probe_device (vb, dev, func))
+				continue;
+			device_cnt++;
+
+			/* Then let the device interrupt. */
+			pci_register_intr (vb->irq - 0x20, interrupt_handler, "virtio-blk");
+			vb->avail->flags = 0;
+			if (thread_create (vb->name, PRI_MAX, completion_thread, vb)
+					== TID_ERROR)
+				PANIC ("%s: cannot start I/O thread", vb->name);
+		}
+}
+
+/* Brings up the virtio block device at PCI function 0:DEV.FUNC as
+   VB and attaches it as a disk, with interrupts still suppressed.
+   Returns true if successful. */
+static bool
+probe_device (struct virtio_blk *vb, int dev, int func) {
+	uint32_t bar0 = pci_read_config (0, dev, func, 0x10);
+	uint32_t cmd = pci_read_config (0, dev, func, 0x04);
+	uint8_t line = pci_read_config (0, dev, func, 0x3c) & 0xff;
+	uint64_t capacity;
+
+	if (!(bar0 & 1) || line >= 16) {
+		printf ("%s: no I/O ports or interrupt line, ignored\n", vb->name);
+		return false;
+	}
+	vb->io_base = bar0 & 0xfffc;
+	vb->irq = 0x20 + line;
+	pci_write_config (0, dev, func, 0x04, cmd | 0x05);
+
+	/* Reset, then say hello.  No optional features are needed:
+	   plain reads and writes are always available. */
+	outb (vb->io_base + VIRTIO_STATUS, 0);
+	outb (vb->io_base + VIRTIO_STATUS, STATUS_ACKNOWLEDGE);
+	outb (vb->io_base + VIRTIO_STATUS, STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+	inl (vb->io_base + VIRTIO_HOST_FEATURES);
+	outl (vb->io_base + VIRTIO_GUEST_FEATURES, 0);
+
+	lock_init (&vb->lock);
+	list_init (&vb->queue);
+	sema_init (&vb->intr_sema, 0);
+	if (!setup_queue (vb)) {
+		outb (vb->io_base + VIRTIO_STATUS, STATUS_FAILED);
+		return false;
+	}
+	outb (vb->io_base + VIRTIO_STATUS,
+			STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_DRIVER_OK);
+
+	capacity = inl (vb->io_base + VIRTIO_CONFIG)
+		| (uint64_t) inl (vb->io_base + VIRTIO_CONFIG + 4) << 32;
+	if (capacity > UINT32_MAX)
+		capacity = UINT32_MAX;
+	vb->disk = disk_attach (read_id (vb) ? vb->shared->id : NULL,
+			capacity, &virtio_blk_driver, vb);
+	if (vb->disk == NULL) {
+		printf ("%s: no disk slot left, ignored\n", vb->name);
+		outb (vb->io_base + VIRTIO_STATUS, STATUS_FAILED);
+		return false;
+	}
+
+	return true;
+}
+
+/* Allocates VB's virtqueue, in the layout the legacy interface
+   fixes, and gives it to the device.  Returns true if successful. */
+static bool
+setup_queue (struct virtio_blk *vb) {
+	size_t n, used_ofs;
+	uint8_t *base;
+
+	outw (vb->io_base + VIRTIO_QUEUE_SEL, 0);
+	n = inw (vb->io_base + VIRTIO_QUEUE_SIZE);
+	if (n < CMD_DESCS) {
+		printf ("%s: queue of %zu descriptors is too small\n", vb->name, n);
+		return false;
+	}
+
+	/* Descriptors, then the available ring, then the used ring on
+	   a page boundary. */
+	used_ofs = ROUND_UP (n * sizeof (struct vring_desc)
+			+ sizeof (struct vring_avail) + (n + 1) * sizeof (uint16_t), PGSIZE);
+	vb->queue_size = n;
+	vb->queue_pages = DIV_ROUND_UP (used_ofs + sizeof (struct vring_used)
+			+ n * sizeof (struct vring_used_elem) + sizeof (uint16_t), PGSIZE);
+	base = palloc_get_multiple (PAL_ZERO, vb->queue_pages);
+	vb->shared = palloc_get_page (PAL_ZERO);
+	if (base == NULL || vb->shared == NULL) {
+		printf ("%s: out of memory for the queue\n", vb->name);
+		if (base != NULL)
+			palloc_free_multiple (base, vb->queue_pages);
+		if (vb->shared != NULL)
+			palloc_free_page (vb->shared);
+		return false;
+	}
+	ASSERT (sizeof *vb->shared <= PGSIZE);
+
+	vb->desc = (struct vring_desc *) base;
+	vb->avail = (struct vring_avail *) (base + n * sizeof (struct vring_desc));
+	vb->used = (struct vring_used *) (base + used_ofs);
+	vb->last_used = 0;
+	vb->cmd_cnt = n / CMD_DESCS < CMD_MAX ? n / CMD_DESCS : CMD_MAX;
+
+	/* No interrupts until probing is done. */
+	vb->avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+	outl (vb->io_base + VIRTIO_QUEUE_PFN, vtop (base) >> PGBITS);
+	return true;
+}
+
+/* Descriptor I of VB. */
+static volatile struct vring_desc *
+desc_at (struct virtio_blk *vb, size_t i) {
+	return &vb->desc[i];
+}
+
+/* Appends the sector at BUFFER to the data buffers of the chain
+   whose first one is descriptor FIRST and which has *CNT of them,
+   joining physically contiguous ones.  Returns false, adding
+   nothing, if that would make more than SEG_MAX. */
+static bool
+add_sector (struct virtio_blk *vb, size_t first, size_t *cnt,
+		const uint8_t *buffer) {
+	uint64_t pa[2], len[2], end;
+	size_t chunk_cnt, need, i;
+
+	/* A sector crosses a page boundary at most once. */
+	len[0] = PGSIZE - pg_ofs (buffer) < DISK_SECTOR_SIZE
+		? PGSIZE - pg_ofs (buffer) : DISK_SECTOR_SIZE;
+	pa[0] = pci_dma_addr (buffer);
+	chunk_cnt = 1;
+	if (len[0] < DISK_SECTOR_SIZE) {
+		len[1] = DISK_SECTOR_SIZE - len[0];
+		pa[1] = pci_dma_addr (buffer + len[0]);
+		chunk_cnt = 2;
+	}
+
+	end = *cnt > 0 ? desc_at (vb, first + *cnt - 1)->addr
+		+ desc_at (vb, first + *cnt - 1)->len : UINT64_MAX;
+	for (i = need = 0; i < chunk_cnt; i++) {
+		if (pa[i] != end)
+			need++;
+		end = pa[i] + len[i];
+	}
+	if (*cnt + need > SEG_MAX)
+		return false;
+
+	for (i = 0; i < chunk_cnt; i++) {
+		volatile struct vring_desc *prev = *cnt > 0
+			? desc_at (vb, first + *cnt - 1) : NULL;
+
+		if (prev != NULL && prev->addr + prev->len == pa[i])
+			prev->len += len[i];
+		else {
+			desc_at (vb, first + *cnt)->addr = pa[i];
+			desc_at (vb, first + *cnt)->len = len[i];
+			(*cnt)++;
+		}
+	}
+	return true;
+}
+
+/* Returns the first sector of REQ not yet given to the device. */
+static disk_sector_t
+req_issue_next (const struct disk_req *req) {
+	return req->sec_no + req->issued_cnt;
+}
+
+/* Returns a request in VB's queue in direction WRITE that starts
+   at sector SEC_NO and has no part issued yet, or a null pointer
+   if there is none.  VB's lock must be held. */
+static struct disk_req *
+find_adjacent (struct virtio_blk *vb, disk_sector_t sec_no, bool write) {
+	struct list_elem *e;
+
+	for (e = list_begin (&vb->queue); e != list_end (&vb->queue);
+			e = list_next (e)) {
+		struct disk_req *r = list_entry (e, struct disk_req, elem);
+		if (r->write == write && r->issued_cnt == 0 && r->sec_no == sec_no)
+			return r;
+	}
+	return NULL;
+}
+
+/* Fills command slot SLOT of VB from the requests at the front of
+   its queue and links the slot's descriptors into a chain.  VB's
+   queue must not be empty and its lock must be held. */
+static void
+build_command (struct virtio_blk *vb, size_t slot) {
+	struct vblk_cmd *cmd = &vb->cmds[slot];
+	size_t first = slot * CMD_DESCS, seg_cnt = 0, i;
+	struct disk_req *r = list_entry (list_front (&vb->queue),
+			struct disk_req, elem);
+
+	cmd->write = r->write;
+	cmd->sec_no = req_issue_next (r);
+	cmd->cnt = 0;
+	cmd->piece_cnt = 0;
+	do {
+		struct vblk_piece *piece = &cmd->pieces[cmd->piece_cnt];
+		const uint8_t *p = (const uint8_t *) r->buffer
+			+ r->issued_cnt * DISK_SECTOR_SIZE;
+
+		/* Take sectors as long as the buffers fit. */
+		piece->req = r;
+		piece->cnt = 0;
+		while (r->issued_cnt < r->cnt && cmd->cnt < CMD_SECTORS
+				&& add_sector (vb, first + 1, &seg_cnt, p)) {
+			p += DISK_SECTOR_SIZE;
+			r->issued_cnt++;
+			piece->cnt++;
+			cmd->cnt++;
+		}
+		if (piece->cnt == 0)
+			break;
+		cmd->piece_cnt++;
+		if (cmd->piece_cnt > 1)
+			vb->merge_cnt++;
+		if (r->issued_cnt == r->cnt)
+			list_remove (&r->elem);
+		else
+			break;
+	} while (cmd->cnt < CMD_SECTORS && cmd->piece_cnt < BATCH_MAX
+			&& (r = find_adjacent (vb, cmd->sec_no + cmd->cnt,
+					cmd->write)) != NULL);
+	ASSERT (cmd->cnt > 0);
+
+	/* Header, data, status. */
+	vb->shared->cmds[slot].hdr.type = cmd->write
+		? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+	vb->shared->cmds[slot].hdr.ioprio = 0;
+	vb->shared->cmds[slot].hdr.sector = cmd->sec_no;
+	vb->shared->cmds[slot].status = 0xff;
+	desc_at (vb, first)->addr = vtop (&vb->shared->cmds[slot].hdr);
+	desc_at (vb, first)->len = sizeof (struct virtio_blk_outhdr);
+	for (i = 0; i <= seg_cnt; i++) {
+		desc_at (vb, first + i)->flags = VRING_DESC_F_NEXT
+			| (i > 0 && !cmd->write ? VRING_DESC_F_WRITE : 0);
+		desc_at (vb, first + i)->next = first + i + 1;
+	}
+	desc_at (vb, first + seg_cnt + 1)->addr
+		= vtop (&vb->shared->cmds[slot].status);
+	desc_at (vb, first + seg_cnt + 1)->len = 1;
+	desc_at (vb, first + seg_cnt + 1)->flags = VRING_DESC_F_WRITE;
+	vb->seg_cnt += seg_cnt;
+}
+
+/* Places the chain starting at descriptor HEAD in VB's available
+   ring. */
+static void
+offer_chain (struct virtio_blk *vb, size_t head) {
+	uint16_t idx = vb->avail->idx;
+
+	vb->avail->ring[idx % vb->queue_size] = head;
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+	vb->avail->idx = idx + 1;
+}
+
+/* Tells VB's device about new chains, unless it said it needs no
+   telling. */
+static void
+notify_device (struct virtio_blk *vb) {
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+	if (!(vb->used->flags & VRING_USED_F_NO_NOTIFY)) {
+		outw (vb->io_base + VIRTIO_QUEUE_NOTIFY, 0);
+		vb->notify_cnt++;
+	}
+}
+
+/* Issues commands for VB's queued requests while command slots
+   are free.  VB's lock must be held. */
+static void
+issue_commands (struct virtio_blk *vb) {
+	size_t slot, issued = 0;
+
+	for (slot = 0; slot < vb->cmd_cnt && !list_empty (&vb->queue); slot++)
+		if (!vb->cmds[slot].busy) {
+			build_command (vb, slot);
+			vb->cmds[slot].busy = true;
+			offer_chain (vb, slot * CMD_DESCS);
+			issued++;
+		}
+	if (issued > 0) {
+		vb->inflight += issued;
+		if (vb->inflight > vb->max_inflight)
+			vb->max_inflight = vb->inflight;
+		notify_device (vb);
+	}
+}
+
+/* Reads VB's serial number into VB->SHARED->ID, waiting for it by
+   polling, since interrupts are off.  Returns true if successful,
+   false if the device does not support it. */
+static bool
+read_id (struct virtio_blk *vb) {
+	volatile uint8_t *status = &vb->shared->cmds[0].status;
+	int i;
+
+	vb->shared->cmds[0].hdr.type = VIRTIO_BLK_T_GET_ID;
+	vb->shared->cmds[0].hdr.sector = 0;
+	*status = 0xff;
+	desc_at (vb, 0)->addr = vtop (&vb->shared->cmds[0].hdr);
+	desc_at (vb, 0)->len = sizeof (struct virtio_blk_outhdr);
+	desc_at (vb, 0)->flags = VRING_DESC_F_NEXT;
+	desc_at (vb, 0)->next = 1;
+	desc_at (vb, 1)->addr = vtop (vb->shared->id);
+	desc_at (vb, 1)->len = VIRTIO_BLK_ID_BYTES;
+	desc_at (vb, 1)->flags = VRING_DESC_F_NEXT | VRING_DESC_F_WRITE;
+	desc_at (vb, 1)->next = 2;
+	desc_at (vb, 2)->addr = vtop (status);
+	desc_at (vb, 2)->len = 1;
+	desc_at (vb, 2)->flags = VRING_DESC_F_WRITE;
+	offer_chain (vb, 0);
+	notify_device (vb);
+
+	for (i = 0; i < 1000 && vb->used->idx == vb->last_used; i++)
+		timer_usleep (100);
+	if (vb->used->idx == vb->last_used) {
+		printf ("%s: no reply to GET_ID\n", vb->name);
+		return false;
+	}
+	vb->last_used++;
+	inb (vb->io_base + VIRTIO_ISR);
+	vb->shared->id[VIRTIO_BLK_ID_BYTES - 1] = '\0';
+	return *status == VIRTIO_BLK_S_OK;
+}
+
+/* Completes command CMD of VB, moving the requests it finishes to
+   DONE.  VB's lock must be held. */
+static void
+finish_command (struct virtio_blk *vb, size_t slot, struct list *done) {
+	struct vblk_cmd *cmd = &vb->cmds[slot];
+	size_t i;
+
+	ASSERT (cmd->busy);
+	if (vb->shared->cmds[slot].status != VIRTIO_BLK_S_OK)
+		PANIC ("%s: virtio %s failed, sector=%"PRDSNu, vb->name,
+				cmd->write ? "write" : "read", cmd->sec_no);
+	disk_account_cmd (vb->disk, cmd->cnt, cmd->write);
+	vb->cmd_done_cnt++;
+	for (i = 0; i < cmd->piece_cnt; i++) {
+		struct disk_req *r = cmd->pieces[i].req;
+		r->done_cnt += cmd->pieces[i].cnt;
+		if (r->done_cnt == r->cnt)
+			list_push_back (done, &r->elem);
+	}
+	cmd->busy = false;
+	vb->inflight--;
+}
+
+/* Reaps VB_'s completed commands whenever the interrupt handler
+   says there are some, refills the queue, and completes requests. */
+static void
+completion_thread (void *vb_) {
+	struct virtio_blk *vb = vb_;
+
+	for (;;) {
+		struct list done;
+		size_t reaped = 0;
+
+		sema_down (&vb->intr_sema);
+		list_init (&done);
+		lock_acquire (&vb->lock);
+		for (;;) {
+			while (vb->last_used != vb->used->idx) {
+				volatile struct vring_used_elem *e;
+
+				__atomic_thread_fence (__ATOMIC_SEQ_CST);
+				e = &vb->used->ring[vb->last_used % vb->queue_size];
+				finish_command (vb, e->id / CMD_DESCS, &done);
+				vb->last_used++;
+				reaped++;
+			}
+
+			/* Interrupt again, unless the device got more done in
+			   the meantime. */
+			vb->avail->flags = 0;
+			__atomic_thread_fence (__ATOMIC_SEQ_CST);
+			if (vb->last_used == vb->used->idx)
+				break;
+			vb->avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+		}
+		if (reaped > 0)
+			vb->wakeup_cnt++;
+		issue_commands (vb);
+		lock_release (&vb->lock);
+
+		while (!list_empty (&done))
+			disk_complete (list_entry (list_pop_front (&done),
+						struct disk_req, elem));
+	}
+}
+
+/* Queues REQ on VB_ and issues it if a command slot is free. */
+static void
+virtio_blk_submit (void *vb_, struct disk_req *req) {
+	struct virtio_blk *vb = vb_;
+
+	lock_acquire (&vb->lock);
+	list_push_back (&vb->queue, &req->elem);
+	vb->req_cnt++;
+	issue_commands (vb);
+	lock_release (&vb->lock);
+}
+
+/* Virtio interrupt handler.  Reading the interrupt status also
+   lowers the line, so every device on it is asked; other drivers'
+   devices may be on it too (see pci_register_intr()). */
+static void
+interrupt_handler (struct intr_frame *f) {
+	size_t i;
+
+	for (i = 0; i < device_cnt; i++) {
+		struct virtio_blk *vb = &devices[i];
+
+		if (vb->irq == f->vec_no
+				&& (inb (vb->io_base + VIRTIO_ISR) & ISR_QUEUE)) {
+			vb->intr_cnt++;
+			vb->avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+			sema_up (&vb->intr_sema);
+		}
+	}
+}
+
+/* Prints virtio block device statistics. */
+void
+virtio_blk_print_stats (void) {
+	size_t i;
+
+	for (i = 0; i < device_cnt; i++) {
+		struct virtio_blk *vb = &devices[i];
+		long long cmds = vb->cmd_done_cnt > 0 ? vb->cmd_done_cnt : 1;
+		long long wakeups = vb->wakeup_cnt > 0 ? vb->wakeup_cnt : 1;
+
+		if (vb->req_cnt == 0)
+			continue;
+		printf ("%s: %lld requests, %lld merged, %lld commands "
+				"(%lld.%02lld buffers each), %zu max in flight\n",
+				vb->name, vb->req_cnt, vb->merge_cnt, vb->cmd_done_cnt,
+				vb->seg_cnt / cmds, vb->seg_cnt * 100 / cmds % 100,
+				vb->max_inflight);
+		printf ("%s: %lld notifications, %lld interrupts, "
+				"%lld.%02lld commands per wakeup\n", vb->name,
+				vb->notify_cnt, vb->intr_cnt,
+				vb->cmd_done_cnt / wakeups, vb->cmd_done_cnt * 100 / wakeups % 100);
+	}
+}
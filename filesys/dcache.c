@@ -0,0 +1,273 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <rculist.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/malloc.h"
+#include "threads/rcu.h"
+#include "threads/synch.h"
+
+/* Directory entry cache.
+
+   Maps (directory inode sector, name) to the sector of the named
+   file's inode, so that resolving a name that was resolved
+   recently needs no directory reads.  Names found not to exist
+   are cached too, as DCACHE_NEGATIVE, since failed lookups (for
+   instance while searching for an executable) are as common as
+   successful ones.
+
+   Lookups, which every path resolution makes, take no lock: they
+   walk a bucket under rcu_read_lock(), and writers, serialized by
+   DCACHE_LOCK, free the entries they unlink only after a grace
+   period (see threads/rcu.h).  So that lookups write nothing
+   shared but a flag, the cache holds a fixed number of entries
+   recycled in second-chance order rather than least recently used
+   order.  The directory code keeps it coherent by updating it on
+   every dir_add() and dir_remove().
+
+   A name found to be a symbolic link also gets a copy of the
+   link's target.  Targets never change, and an entry whose child
+   changes is replaced rather than updated, so a cached target
+   stays right for as long as the entry lives, and following a
+   link by a warm name opens no inode. */
+
+#define DCACHE_ENTRIES 256
+#define DCACHE_BUCKETS 256
+
+/* A cached name.  Only REFERENCED, and LINK from null to a target,
+   change once it is in a bucket. */
+struct dentry {
+	struct rculist_elem elem;           /* Element in a bucket. */
+	struct list_elem lru_elem;          /* Element in LRU. */
+	struct rcu_head rcu;                /* For freeing after readers. */
+	disk_sector_t parent;               /* Directory's inode sector. */
+	disk_sector_t child;                /* File's inode, or negative. */
+	char *link;                         /* Symbolic link's target, or null. */
+	volatile bool referenced;           /* Looked up since last passed over? */
+	char name[NAME_MAX + 1];            /* Null terminated file name. */
+};
+
+static struct rculist buckets[DCACHE_BUCKETS];
+static struct list lru;                 /* Oldest first, for writers. */
+static size_t dentry_cnt;               /* Number of entries in LRU. */
+static struct lock dcache_lock;         /* Serializes writers. */
+
+/* Statistics. */
+static long long dcache_hits;
+static long long dcache_negative_hits;
+static long long dcache_misses;
+static long long dcache_link_hits;
+
+/* Returns the bucket for NAME in PARENT. */
+static struct rculist *
+bucket_of (disk_sector_t parent, const char *name) {
+	return &buckets[(hash_string (name) ^ hash_int (parent)) % DCACHE_BUCKETS];
+}
+
+/* Initializes the directory entry cache. */
+void
+dcache_init (void) {
+	size_t i;
+
+	lock_init (&dcache_lock);
+	for (i = 0; i < DCACHE_BUCKETS; i++)
+		rculist_init (&buckets[i]);
+	list_init (&lru);
+}
+
+/* Returns the cached entry for NAME in PARENT, or a null pointer.
+   Must be called with DCACHE_LOCK held or within an RCU read-side
+   critical section. */
+static struct dentry *
+find (disk_sector_t parent, const char *name) {
+	struct rculist_elem *e;
+
+	for (e = rculist_first (bucket_of (parent, name)); e != NULL;
+			e = rculist_next (e)) {
+		struct dentry *d = rculist_entry (e, struct dentry, elem);
+
+		if (d->parent == parent && !strcmp (d->name, name))
+			return d;
+	}
+	return NULL;
+}
+
+static void
+dentry_free (struct rcu_head *rcu) {
+	struct dentry *d = (struct dentry *) ((uint8_t *) rcu
+			- offsetof (struct dentry, rcu));
+
+	free (d->link);
+	free (d);
+}
+
+/* Unlinks D and frees it once no lookup can see it.  Must be called
+   with DCACHE_LOCK held. */
+static void
+dentry_remove (struct dentry *d) {
+	rculist_remove (&d->elem);
+	list_remove (&d->lru_elem);
+	dentry_cnt--;
+	call_rcu (&d->rcu, dentry_free);
+}
+
+/* Removes the oldest entry not looked up since it was last passed
+   over.  Must be called with DCACHE_LOCK held. */
+static void
+evict (void) {
+	for (;;) {
+		struct dentry *d = list_entry (list_front (&lru), struct dentry,
+				lru_elem);
+
+		if (!d->referenced) {
+			dentry_remove (d);
+			return;
+		}
+		d->referenced = false;
+		list_remove (&d->lru_elem);
+		list_push_back (&lru, &d->lru_elem);
+	}
+}
+
+/* Looks up NAME in the directory whose inode is at PARENT.  If
+   the answer is cached, stores the file's inode sector, or
+   DCACHE_NEGATIVE if there is no such file, in *CHILD and returns
+   true.  Otherwise returns false. */
+bool
+dcache_lookup (disk_sector_t parent, const char *name,
+		disk_sector_t *child) {
+	struct dentry *d;
+
+	if (strlen (name) > NAME_MAX)
+		return false;
+
+	rcu_read_lock ();
+	d = find (parent, name);
+	if (d != NULL) {
+		*child = d->child;
+		if (!d->referenced)
+			d->referenced = true;
+		if (*child == DCACHE_NEGATIVE)
+			dcache_negative_hits++;
+		else
+			dcache_hits++;
+	} else
+		dcache_misses++;
+	rcu_read_unlock ();
+	return d != NULL;
+}
+
+/* Records that NAME in the directory at PARENT refers to the
+   inode at CHILD, or does not exist if CHILD is
+   DCACHE_NEGATIVE. */
+void
+dcache_insert (disk_sector_t parent, const char *name,
+		disk_sector_t child) {
+	struct dentry *d;
+
+	if (strlen (name) > NAME_MAX)
+		return;
+
+	lock_acquire (&dcache_lock);
+	d = find (parent, name);
+	if (d != NULL && d->child == child)
+		d->referenced = true;
+	else {
+		/* A new child takes a new entry, so that no lookup sees the
+		   old child's link target with the new child. */
+		if (d != NULL)
+			dentry_remove (d);
+		if (dentry_cnt >= DCACHE_ENTRIES)
+			evict ();
+		d = malloc (sizeof *d);
+		if (d != NULL) {
+			d->parent = parent;
+			d->child = child;
+			d->link = NULL;
+			d->referenced = false;
+			strlcpy (d->name, name, sizeof d->name);
+			list_push_back (&lru, &d->lru_elem);
+			dentry_cnt++;
+			rculist_push_front (bucket_of (parent, name), &d->elem);
+		}
+	}
+	lock_release (&dcache_lock);
+}
+
+/* If NAME in the directory at PARENT is cached as a symbolic link
+   whose target is known, copies the target into TARGET, which has
+   room for SIZE bytes, and returns true.  Otherwise returns
+   false. */
+bool
+dcache_lookup_link (disk_sector_t parent, const char *name, char *target,
+		size_t size) {
+	struct dentry *d;
+	const char *link = NULL;
+
+	if (strlen (name) > NAME_MAX)
+		return false;
+
+	rcu_read_lock ();
+	d = find (parent, name);
+	if (d != NULL)
+		link = __atomic_load_n (&d->link, __ATOMIC_ACQUIRE);
+	if (link != NULL) {
+		strlcpy (target, link, size);
+		if (!d->referenced)
+			d->referenced = true;
+		dcache_link_hits++;
+	}
+	rcu_read_unlock ();
+	return link != NULL;
+}
+
+/* Records that NAME in the directory at PARENT is a symbolic link,
+   at CHILD, to TARGET. */
+void
+dcache_insert_link (disk_sector_t parent, const char *name,
+		disk_sector_t child, const char *target) {
+	struct dentry *d;
+	char *link;
+
+	if (strlen (name) > NAME_MAX)
+		return;
+
+	lock_acquire (&dcache_lock);
+	d = find (parent, name);
+	if (d != NULL && d->child == child && d->link == NULL) {
+		link = malloc (strlen (target) + 1);
+		if (link != NULL) {
+			strlcpy (link, target, strlen (target) + 1);
+			__atomic_store_n (&d->link, link, __ATOMIC_RELEASE);
+		}
+	}
+	lock_release (&dcache_lock);
+}
+
+/* Forgets anything cached about NAME in the directory at
+   PARENT. */
+void
+dcache_invalidate (disk_sector_t parent, const char *name) {
+	struct dentry *d;
+
+	if (strlen (name) > NAME_MAX)
+		return;
+
+	lock_acquire (&dcache_lock);
+	d = find (parent, name);
+	if (d != NULL)
+		dentry_remove (d);
+	lock_release (&dcache_lock);
+}
+
+/* Prints directory entry cache statistics. */
+void
+dcache_print_stats (void) {
+	printf ("Dentry cache: %lld hits, %lld negative hits, %lld misses, "
+			"%lld link hits\n",
+			dcache_hits, dcache_negative_hits, dcache_misses, dcache_link_hits);
+}
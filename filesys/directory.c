@@ -1,10 +1,16 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include <round.h>
+#include <dirent.h>
+#include <crc32c.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A directory. */
 struct dir {
@@ -19,18 +25,133 @@ struct dir_entry {
 	bool in_use;                        /* In use or free? */
 };
 
+/* Directory layout.
+ *
+ * A directory is an open-addressed hash table of buckets, one
+ * disk sector each, holding DIR_BUCKET_SLOTS entries apiece.  A
+ * name lives in bucket hash(name) % bucket count if there is
+ * room, and otherwise in the next bucket along that has room, so
+ * a lookup usually reads a single sector.  A directory of one
+ * bucket or less is just the old flat array of entries, scanned
+ * linearly.
+ *
+ * A whole bucket ends with a CRC-32C of its slots, checked when it
+ * is read, so that a damaged bucket is not searched.  It is seeded
+ * with 0, so that the zeros of a bucket never written check out.
+ *
+ * A slot that has never held an entry has INODE_SECTOR 0.  A
+ * removed entry keeps its sector number as a tombstone, so that
+ * a lookup stops probing only at a bucket with a never-used slot.
+ * When an insertion finds no room within DIR_PROBE_MAX buckets,
+ * the directory doubles its bucket count and rehashes, which
+ * also clears the tombstones.
+ *
+ * Each directory's entries are protected by inode_dir_lock() of
+ * its inode, which lookups and reads share, so that they proceed
+ * together, and which additions and removals hold exclusively.
+ * The directory entry cache is filled under the same lock, so that
+ * a lookup cannot cache an answer that a concurrent change has
+ * already made stale. */
+#define DIR_BUCKET_SLOTS (DISK_SECTOR_SIZE / sizeof (struct dir_entry))
+#define DIR_PROBE_MAX 4
+
+/* One bucket, as read from disk.
+ * Must be exactly DISK_SECTOR_SIZE bytes long. */
+struct dir_bucket {
+	struct dir_entry slots[DIR_BUCKET_SLOTS];
+	uint8_t unused[DISK_SECTOR_SIZE - sizeof (struct dir_entry)
+		* DIR_BUCKET_SLOTS - sizeof (uint32_t)];
+	uint32_t checksum;                  /* Of SLOTS; see above. */
+};
+
+/* Returns the number of buckets in DIR. */
+static size_t
+bucket_cnt (const struct dir *dir) {
+	return DIV_ROUND_UP (inode_length (dir->inode), DISK_SECTOR_SIZE);
+}
+
+/* Returns the byte offset of SLOT in bucket IDX. */
+static off_t
+slot_ofs (size_t idx, size_t slot) {
+	return idx * DISK_SECTOR_SIZE + slot * sizeof (struct dir_entry);
+}
+
+/* Returns the checksum of bucket B. */
+static uint32_t
+bucket_checksum (const struct dir_bucket *b) {
+	return crc32c (0, b->slots, sizeof b->slots);
+}
+
+/* Reads bucket IDX of DIR into *B and returns its number of
+ * slots, which is less than DIR_BUCKET_SLOTS only for a short
+ * single-bucket directory.  A whole bucket that fails its checksum
+ * is reported and taken to have no slots. */
+static size_t
+read_bucket (const struct dir *dir, size_t idx, struct dir_bucket *b) {
+	off_t bytes = inode_read_at (dir->inode, b, sizeof *b, slot_ofs (idx, 0));
+
+	if (bytes == sizeof *b && b->checksum != bucket_checksum (b)) {
+		printf ("directory %"PRDSNu": bucket %zu: bad checksum\n",
+				inode_get_inumber (dir->inode), idx);
+		return 0;
+	}
+	return bytes / sizeof (struct dir_entry);
+}
+
+/* Stat-ahead: starts reading in the inodes named by the entries of
+ * bucket *B from slot SLOT up to SLOTS, which a listing is about to
+ * hand out and its caller, like "ls -l", to open one by one.  New
+ * files are placed near their directory, so these reads tend to be
+ * adjacent and the disk merges them. */
+static void
+statahead (const struct dir_bucket *b, size_t slot, size_t slots) {
+	for (; slot < slots; slot++)
+		if (b->slots[slot].in_use)
+			inode_prefetch (b->slots[slot].inode_sector);
+}
+
+/* Writes slot SLOT of *B, bucket IDX of DIR, back to disk.  A whole
+ * bucket is rewritten with a fresh checksum; a short one has none,
+ * and just the slot is written.  Returns true if successful. */
+static bool
+write_slot (struct dir *dir, size_t idx, struct dir_bucket *b, size_t slot) {
+	if (inode_length (dir->inode) >= (off_t) ((idx + 1) * sizeof *b)) {
+		b->checksum = bucket_checksum (b);
+		return inode_write_at (dir->inode, b, sizeof *b, slot_ofs (idx, 0))
+			== sizeof *b;
+	}
+	return inode_write_at (dir->inode, &b->slots[slot], sizeof b->slots[slot],
+			slot_ofs (idx, slot)) == sizeof b->slots[slot];
+}
+
+/* Returns the bucket for NAME in a directory of BUCKETS buckets. */
+static size_t
+name_bucket (const char *name, size_t buckets) {
+	return hash_string (name) % buckets;
+}
+
+/* Returns the length of a new directory with space for ENTRY_CNT
+ * entries. */
+off_t
+dir_initial_length (size_t entry_cnt) {
+	if (entry_cnt > DIR_BUCKET_SLOTS)
+		return DIV_ROUND_UP (entry_cnt, DIR_BUCKET_SLOTS) * DISK_SECTOR_SIZE;
+	return entry_cnt * sizeof (struct dir_entry);
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
  * given SECTOR.  Returns true if successful, false on failure. */
 bool
 dir_create (disk_sector_t sector, size_t entry_cnt) {
-	return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+	ASSERT (sizeof (struct dir_bucket) == DISK_SECTOR_SIZE);
+	return inode_create (sector, dir_initial_length (entry_cnt), true);
 }
 
 /* Opens and returns the directory for the given INODE, of which
  * it takes ownership.  Returns a null pointer on failure. */
 struct dir *
 dir_open (struct inode *inode) {
-	struct dir *dir = calloc (1, sizeof *dir);
+	struct dir *dir = calloc_tagged (1, sizeof *dir, TAG_DIR);
 	if (inode != NULL && dir != NULL) {
 		dir->inode = inode;
 		dir->pos = 0;
@@ -65,6 +186,19 @@ dir_close (struct dir *dir) {
 	}
 }
 
+/* Sets DIR's position, where dir_readdir() and dir_readdir_batch()
+ * go on from, to POS, as returned by dir_tell(). */
+void
+dir_seek (struct dir *dir, off_t pos) {
+	dir->pos = pos;
+}
+
+/* Returns DIR's position. */
+off_t
+dir_tell (struct dir *dir) {
+	return dir->pos;
+}
+
 /* Returns the inode encapsulated by DIR. */
 struct inode *
 dir_get_inode (struct dir *dir) {
@@ -79,24 +213,102 @@ dir_get_inode (struct dir *dir) {
 static bool
 lookup (const struct dir *dir, const char *name,
 		struct dir_entry *ep, off_t *ofsp) {
-	struct dir_entry e;
-	size_t ofs;
+	struct dir_bucket b;
+	size_t buckets, first, i;
 
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
-	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-			ofs += sizeof e)
-		if (e.in_use && !strcmp (name, e.name)) {
-			if (ep != NULL)
-				*ep = e;
-			if (ofsp != NULL)
-				*ofsp = ofs;
-			return true;
+	buckets = bucket_cnt (dir);
+	if (buckets == 0)
+		return false;
+	first = name_bucket (name, buckets);
+	for (i = 0; i < buckets; i++) {
+		size_t idx = (first + i) % buckets;
+		size_t slots = read_bucket (dir, idx, &b);
+		bool never_used = false;
+		size_t slot;
+
+		for (slot = 0; slot < slots; slot++) {
+			struct dir_entry *e = &b.slots[slot];
+			if (e->in_use && !strcmp (name, e->name)) {
+				if (ep != NULL)
+					*ep = *e;
+				if (ofsp != NULL)
+					*ofsp = slot_ofs (idx, slot);
+				return true;
+			} else if (!e->in_use && e->inode_sector == 0)
+				never_used = true;
 		}
+		if (never_used)
+			break;
+	}
 	return false;
 }
 
+/* Writes E into the first free slot along NAME's probe sequence
+ * in DIR, looking at no more than MAX_PROBE buckets.  Returns
+ * true if successful, false if there was no free slot or the
+ * write failed. */
+static bool
+insert (struct dir *dir, const struct dir_entry *e, size_t max_probe) {
+	struct dir_bucket b;
+	size_t buckets, first, i;
+
+	buckets = bucket_cnt (dir);
+	if (buckets == 0)
+		return false;
+	first = name_bucket (e->name, buckets);
+	for (i = 0; i < buckets && i < max_probe; i++) {
+		size_t idx = (first + i) % buckets;
+		size_t slots = read_bucket (dir, idx, &b);
+		size_t slot;
+
+		for (slot = 0; slot < slots; slot++)
+			if (!b.slots[slot].in_use) {
+				b.slots[slot] = *e;
+				return write_slot (dir, idx, &b, slot);
+			}
+	}
+	return false;
+}
+
+/* Rehashes DIR into twice as many buckets (one, if it is empty),
+ * dropping tombstones.  Returns true if successful. */
+static bool
+grow (struct dir *dir) {
+	static const struct dir_bucket empty;
+	size_t old_buckets = bucket_cnt (dir);
+	size_t new_buckets = old_buckets == 0 ? 1 : old_buckets * 2;
+	struct dir_entry *entries;
+	size_t entry_cnt = 0, idx, i;
+	bool success = true;
+
+	/* Save the live entries. */
+	entries = malloc_tagged ((old_buckets + 1) * sizeof (struct dir_bucket),
+			TAG_DIR);
+	if (entries == NULL)
+		return false;
+	for (idx = 0; idx < old_buckets; idx++) {
+		struct dir_bucket b;
+		size_t slots = read_bucket (dir, idx, &b);
+
+		for (i = 0; i < slots; i++)
+			if (b.slots[i].in_use)
+				entries[entry_cnt++] = b.slots[i];
+	}
+
+	/* Clear the table at its new size and put them back. */
+	for (idx = 0; idx < new_buckets && success; idx++)
+		success = inode_write_at (dir->inode, &empty, DISK_SECTOR_SIZE,
+				idx * DISK_SECTOR_SIZE) == DISK_SECTOR_SIZE;
+	for (i = 0; i < entry_cnt && success; i++)
+		success = insert (dir, &entries[i], new_buckets);
+
+	free (entries);
+	return success;
+}
+
 /* Searches DIR for a file with the given NAME
  * and returns true if one exists, false otherwise.
  * On success, sets *INODE to an inode for the file, otherwise to
@@ -104,19 +316,69 @@ lookup (const struct dir *dir, const char *name,
 bool
 dir_lookup (const struct dir *dir, const char *name,
 		struct inode **inode) {
+	disk_sector_t parent, child;
 	struct dir_entry e;
 
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
-	if (lookup (dir, name, &e, NULL))
-		*inode = inode_open (e.inode_sector);
+	parent = inode_get_inumber (dir->inode);
+	if (!dcache_lookup (parent, name, &child)) {
+		struct rwlock *rw = inode_dir_lock (dir->inode);
+
+		rw_read_acquire (rw);
+		child = lookup (dir, name, &e, NULL) ? e.inode_sector : DCACHE_NEGATIVE;
+		dcache_insert (parent, name, child);
+		rw_read_release (rw);
+	}
+
+	if (child != DCACHE_NEGATIVE)
+		*inode = inode_open (child);
 	else
 		*inode = NULL;
 
 	return *inode != NULL;
 }
 
+/* Looks up NAME in DIR, like dir_lookup(), and returns true if it
+ * exists.  If NAME is a symbolic link, though, stores its target in
+ * TARGET, which has room for SIZE bytes, and sets *INODE to a null
+ * pointer; otherwise sets TARGET to "".  A link looked up recently
+ * is answered from the directory entry cache, without opening its
+ * inode. */
+bool
+dir_lookup_link (const struct dir *dir, const char *name,
+		struct inode **inode, char *target, size_t size) {
+	disk_sector_t parent = inode_get_inumber (dir->inode);
+	off_t len;
+
+	ASSERT (size > 0);
+	*target = '\0';
+	if (dcache_lookup_link (parent, name, target, size)) {
+		*inode = NULL;
+		return true;
+	}
+	if (!dir_lookup (dir, name, inode))
+		return false;
+	if (inode_is_symlink (*inode)) {
+		struct rwlock *rw = inode_dir_lock (dir->inode);
+		disk_sector_t link = inode_get_inumber (*inode);
+		struct dir_entry e;
+
+		len = inode_read_at (*inode, target, size - 1, 0);
+		target[len] = '\0';
+
+		/* Cache the target only if NAME still names the link. */
+		rw_read_acquire (rw);
+		if (lookup (dir, name, &e, NULL) && e.inode_sector == link)
+			dcache_insert_link (parent, name, link, target);
+		rw_read_release (rw);
+		inode_close (*inode);
+		*inode = NULL;
+	}
+	return true;
+}
+
 /* Adds a file named NAME to DIR, which must not already contain a
  * file by that name.  The file's inode is in sector
  * INODE_SECTOR.
@@ -125,8 +387,8 @@ dir_lookup (const struct dir *dir, const char *name,
  * error occurs. */
 bool
 dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
+	struct rwlock *rw;
 	struct dir_entry e;
-	off_t ofs;
 	bool success = false;
 
 	ASSERT (dir != NULL);
@@ -136,29 +398,29 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
 	if (*name == '\0' || strlen (name) > NAME_MAX)
 		return false;
 
+	rw = inode_dir_lock (dir->inode);
+	rw_write_acquire (rw);
+
 	/* Check that NAME is not in use. */
 	if (lookup (dir, name, NULL, NULL))
 		goto done;
 
-	/* Set OFS to offset of free slot.
-	 * If there are no free slots, then it will be set to the
-	 * current end-of-file.
-
-	 * inode_read_at() will only return a short read at end of file.
-	 * Otherwise, we'd need to verify that we didn't get a short
-	 * read due to something intermittent such as low memory. */
-	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-			ofs += sizeof e)
-		if (!e.in_use)
-			break;
-
-	/* Write slot. */
+	/* Write the entry into its bucket, or a nearby one, growing
+	 * the table if they are all full. */
+	memset (&e, 0, sizeof e);
 	e.in_use = true;
 	strlcpy (e.name, name, sizeof e.name);
 	e.inode_sector = inode_sector;
-	success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+	while (!(success = insert (dir, &e, DIR_PROBE_MAX)))
+		if (!grow (dir))
+			break;
+	if (success)
+		dcache_insert (inode_get_inumber (dir->inode), name, inode_sector);
+	else
+		dcache_invalidate (inode_get_inumber (dir->inode), name);
 
 done:
+	rw_write_release (rw);
 	return success;
 }
 
@@ -167,14 +429,20 @@ done:
  * which occurs only if there is no file with the given NAME. */
 bool
 dir_remove (struct dir *dir, const char *name) {
+	struct rwlock *rw;
 	struct dir_entry e;
+	struct dir_bucket b;
 	struct inode *inode = NULL;
 	bool success = false;
+	size_t idx, slot;
 	off_t ofs;
 
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
+	rw = inode_dir_lock (dir->inode);
+	rw_write_acquire (rw);
+
 	/* Find directory entry. */
 	if (!lookup (dir, name, &e, &ofs))
 		goto done;
@@ -184,33 +452,110 @@ dir_remove (struct dir *dir, const char *name) {
 	if (inode == NULL)
 		goto done;
 
-	/* Erase directory entry. */
-	e.in_use = false;
-	if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+	/* Erase directory entry, leaving a tombstone. */
+	idx = ofs / DISK_SECTOR_SIZE;
+	slot = ofs % DISK_SECTOR_SIZE / sizeof e;
+	if (read_bucket (dir, idx, &b) <= slot)
+		goto done;
+	b.slots[slot].in_use = false;
+	if (!write_slot (dir, idx, &b, slot)) {
+		dcache_invalidate (inode_get_inumber (dir->inode), name);
 		goto done;
+	}
+	dcache_insert (inode_get_inumber (dir->inode), name, DCACHE_NEGATIVE);
 
 	/* Remove inode. */
 	inode_remove (inode);
 	success = true;
 
 done:
+	rw_write_release (rw);
 	inode_close (inode);
 	return success;
 }
 
 /* Reads the next directory entry in DIR and stores the name in
  * NAME.  Returns true if successful, false if the directory
- * contains no more entries. */
+ * contains no more entries.  Entries come back in bucket order,
+ * which stays put until an insertion grows the directory. */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1]) {
+	struct rwlock *rw = inode_dir_lock (dir->inode);
 	struct dir_entry e;
-
-	while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) {
+	bool found = false;
+
+	rw_read_acquire (rw);
+	for (;;) {
+		/* Skip the unused tail of each bucket. */
+		if (dir->pos % DISK_SECTOR_SIZE == slot_ofs (0, DIR_BUCKET_SLOTS))
+			dir->pos = ROUND_UP (dir->pos, DISK_SECTOR_SIZE);
+		if (dir->pos % DISK_SECTOR_SIZE == 0) {
+			struct dir_bucket b;
+			size_t slots = read_bucket (dir, dir->pos / DISK_SECTOR_SIZE, &b);
+
+			statahead (&b, 0, slots);
+		}
+		if (inode_read_at (dir->inode, &e, sizeof e, dir->pos) != sizeof e)
+			break;
 		dir->pos += sizeof e;
 		if (e.in_use) {
 			strlcpy (name, e.name, NAME_MAX + 1);
-			return true;
+			found = true;
+			break;
 		}
 	}
-	return false;
+	rw_read_release (rw);
+	return found;
+}
+
+/* Stores the directory entries of DIR that come next, as packed
+ * struct dirent records, in the SIZE bytes at BUF, and advances
+ * past them.  Reads a whole bucket at a time, where dir_readdir()
+ * reads an entry.  Returns the number of bytes stored, which is 0
+ * at the end of the directory or if the next record does not fit
+ * in SIZE bytes. */
+size_t
+dir_readdir_batch (struct dir *dir, void *buf_, size_t size) {
+	struct rwlock *rw = inode_dir_lock (dir->inode);
+	uint8_t *buf = buf_;
+	size_t buckets;
+	size_t used = 0;
+
+	rw_read_acquire (rw);
+	buckets = bucket_cnt (dir);
+	while ((size_t) dir->pos / DISK_SECTOR_SIZE < buckets) {
+		size_t idx = dir->pos / DISK_SECTOR_SIZE;
+		size_t slot = dir->pos % DISK_SECTOR_SIZE / sizeof (struct dir_entry);
+		struct dir_bucket b;
+		size_t slots = read_bucket (dir, idx, &b);
+
+		statahead (&b, slot, slots);
+		for (; slot < slots; slot++) {
+			const struct dir_entry *e = &b.slots[slot];
+			struct dirent *d = (struct dirent *) (buf + used);
+			size_t len, reclen;
+
+			if (!e->in_use)
+				continue;
+			len = strlen (e->name);
+			reclen = DIRENT_RECLEN (len);
+			if (used + reclen > size) {
+				dir->pos = slot_ofs (idx, slot);
+				goto done;
+			}
+			d->d_ino = e->inode_sector;
+			d->d_reclen = reclen;
+
+			/* Directories do not nest, so every entry names a
+			 * regular file. */
+			d->d_type = DT_REG;
+			memcpy (d->d_name, e->name, len + 1);
+			used += reclen;
+		}
+		dir->pos = (idx + 1) * DISK_SECTOR_SIZE;
+	}
+
+done:
+	rw_read_release (rw);
+	return used;
 }
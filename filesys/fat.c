@@ -1,6 +1,8 @@
 #include "filesys/fat.h"
 #include "devices/disk.h"
 #include "filesys/filesys.h"
+#include "filesys/page_cache.h"
+#include "lib/kernel/bitmap.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
 #include <stdio.h>
@@ -22,28 +24,32 @@ struct fat_fs {
 	unsigned int *fat;
 	unsigned int fat_length;
 	disk_sector_t data_start;
-	cluster_t last_clst;
+	cluster_t last_clst;        /* Next-fit cursor for allocation. */
+	struct bitmap *used_map;    /* In-use clusters, derived from FAT. */
+	struct bitmap *dirty_map;   /* FAT sectors changed since written. */
 	struct lock write_lock;
+	unsigned chain_gen;     /* Bumped whenever a chain is cut. */
 };
 
 static struct fat_fs *fat_fs;
 
+unsigned fat_format_spc = SECTORS_PER_CLUSTER;
+
 void fat_boot_create (void);
 void fat_fs_init (void);
+static void fat_build_maps (void);
+static void fat_write_sector (unsigned idx);
 
 void
 fat_init (void) {
-	fat_fs = calloc (1, sizeof (struct fat_fs));
+	fat_fs = calloc_tagged (1, sizeof (struct fat_fs), TAG_FAT);
 	if (fat_fs == NULL)
 		PANIC ("FAT init failed");
 
 	// Read boot sector from the disk
-	unsigned int *bounce = malloc (DISK_SECTOR_SIZE);
-	if (bounce == NULL)
-		PANIC ("FAT init failed");
-	disk_read (filesys_disk, FAT_BOOT_SECTOR, bounce);
+	uint8_t bounce[DISK_SECTOR_SIZE];
+	disk_read_tagged (filesys_disk, FAT_BOOT_SECTOR, 1, bounce, DISK_SRC_META);
 	memcpy (&fat_fs->bs, bounce, sizeof (fat_fs->bs));
-	free (bounce);
 
 	// Extract FAT info
 	if (fat_fs->bs.magic != FAT_MAGIC)
@@ -53,64 +59,38 @@ fat_init (void) {
 
 void
 fat_open (void) {
-	fat_fs->fat = calloc (fat_fs->fat_length, sizeof (cluster_t));
+	free (fat_fs->fat);
+	fat_fs->fat = calloc_tagged (fat_fs->fat_length, sizeof (cluster_t),
+			TAG_FAT);
 	if (fat_fs->fat == NULL)
 		PANIC ("FAT load failed");
 
-	// Load FAT directly from the disk
+	// Load FAT directly from the disk, whole sectors in bulk
 	uint8_t *buffer = (uint8_t *) fat_fs->fat;
-	off_t bytes_read = 0;
-	off_t bytes_left = sizeof (fat_fs->fat);
 	const off_t fat_size_in_bytes = fat_fs->fat_length * sizeof (cluster_t);
-	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++) {
-		bytes_left = fat_size_in_bytes - bytes_read;
-		if (bytes_left >= DISK_SECTOR_SIZE) {
-			disk_read (filesys_disk, fat_fs->bs.fat_start + i,
-			           buffer + bytes_read);
-			bytes_read += DISK_SECTOR_SIZE;
-		} else {
-			uint8_t *bounce = malloc (DISK_SECTOR_SIZE);
-			if (bounce == NULL)
-				PANIC ("FAT load failed");
-			disk_read (filesys_disk, fat_fs->bs.fat_start + i, bounce);
-			memcpy (buffer + bytes_read, bounce, bytes_left);
-			bytes_read += bytes_left;
-			free (bounce);
-		}
+	const unsigned full_sectors = fat_size_in_bytes / DISK_SECTOR_SIZE;
+	const off_t bytes_left = fat_size_in_bytes % DISK_SECTOR_SIZE;
+	if (full_sectors > 0)
+		disk_read_tagged (filesys_disk, fat_fs->bs.fat_start, full_sectors,
+		                  buffer, DISK_SRC_META);
+	if (bytes_left > 0) {
+		uint8_t bounce[DISK_SECTOR_SIZE];
+		disk_read_tagged (filesys_disk, fat_fs->bs.fat_start + full_sectors, 1,
+		                  bounce, DISK_SRC_META);
+		memcpy (buffer + full_sectors * DISK_SECTOR_SIZE, bounce, bytes_left);
 	}
+	fat_build_maps ();
 }
 
 void
 fat_close (void) {
 	// Write FAT boot sector
-	uint8_t *bounce = calloc (1, DISK_SECTOR_SIZE);
-	if (bounce == NULL)
-		PANIC ("FAT close failed");
+	uint8_t bounce[DISK_SECTOR_SIZE] = { 0 };
 	memcpy (bounce, &fat_fs->bs, sizeof (fat_fs->bs));
-	disk_write (filesys_disk, FAT_BOOT_SECTOR, bounce);
-	free (bounce);
+	disk_write_tagged (filesys_disk, FAT_BOOT_SECTOR, 1, bounce, DISK_SRC_META);
 
-	// Write FAT directly to the disk
-	uint8_t *buffer = (uint8_t *) fat_fs->fat;
-	off_t bytes_wrote = 0;
-	off_t bytes_left = sizeof (fat_fs->fat);
-	const off_t fat_size_in_bytes = fat_fs->fat_length * sizeof (cluster_t);
-	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++) {
-		bytes_left = fat_size_in_bytes - bytes_wrote;
-		if (bytes_left >= DISK_SECTOR_SIZE) {
-			disk_write (filesys_disk, fat_fs->bs.fat_start + i,
-			            buffer + bytes_wrote);
-			bytes_wrote += DISK_SECTOR_SIZE;
-		} else {
-			bounce = calloc (1, DISK_SECTOR_SIZE);
-			if (bounce == NULL)
-				PANIC ("FAT close failed");
-			memcpy (bounce, buffer + bytes_wrote, bytes_left);
-			disk_write (filesys_disk, fat_fs->bs.fat_start + i, bounce);
-			bytes_wrote += bytes_left;
-			free (bounce);
-		}
-	}
+	// Write back the FAT sectors changed since the last flush
+	fat_flush ();
 }
 
 void
@@ -120,29 +100,35 @@ fat_create (void) {
 	fat_fs_init ();
 
 	// Create FAT table
-	fat_fs->fat = calloc (fat_fs->fat_length, sizeof (cluster_t));
+	fat_fs->fat = calloc_tagged (fat_fs->fat_length, sizeof (cluster_t),
+			TAG_FAT);
 	if (fat_fs->fat == NULL)
 		PANIC ("FAT creation failed");
+	fat_build_maps ();
+	bitmap_set_all (fat_fs->dirty_map, true);
 
 	// Set up ROOT_DIR_CLST
 	fat_put (ROOT_DIR_CLUSTER, EOChain);
 
 	// Fill up ROOT_DIR_CLUSTER region with 0
-	uint8_t *buf = calloc (1, DISK_SECTOR_SIZE);
-	if (buf == NULL)
-		PANIC ("FAT create failed due to OOM");
-	disk_write (filesys_disk, cluster_to_sector (ROOT_DIR_CLUSTER), buf);
-	free (buf);
+	static const uint8_t zeros[DISK_SECTOR_SIZE];
+	for (unsigned i = 0; i < fat_fs->bs.sectors_per_cluster; i++)
+		page_cache_write (cluster_to_sector (ROOT_DIR_CLUSTER) + i, zeros, 0,
+				DISK_SECTOR_SIZE);
 }
 
 void
 fat_boot_create (void) {
+	unsigned int spc = fat_format_spc;
+	if (spc == 0 || spc > MAX_SECTORS_PER_CLUSTER || (spc & (spc - 1)) != 0)
+		PANIC ("bad sectors per cluster %u", spc);
+
 	unsigned int fat_sectors =
 	    (disk_size (filesys_disk) - 1)
-	    / (DISK_SECTOR_SIZE / sizeof (cluster_t) * SECTORS_PER_CLUSTER + 1) + 1;
+	    / (DISK_SECTOR_SIZE / sizeof (cluster_t) * spc + 1) + 1;
 	fat_fs->bs = (struct fat_boot){
 	    .magic = FAT_MAGIC,
-	    .sectors_per_cluster = SECTORS_PER_CLUSTER,
+	    .sectors_per_cluster = spc,
 	    .total_sectors = disk_size (filesys_disk),
 	    .fat_start = 1,
 	    .fat_sectors = fat_sectors,
@@ -152,42 +138,272 @@ fat_boot_create (void) {
 
 void
 fat_fs_init (void) {
-	/* TODO: Your code goes here. */
+	/* Data clusters follow the FAT.  Cluster 0 is never used, so
+	 * that a zero FAT entry can mean "free". */
+	fat_fs->data_start = fat_fs->bs.fat_start + fat_fs->bs.fat_sectors;
+	fat_fs->fat_length = (fat_fs->bs.total_sectors - fat_fs->data_start)
+		/ fat_fs->bs.sectors_per_cluster;
+	fat_fs->last_clst = ROOT_DIR_CLUSTER;
+	fat_fs->chain_gen = 0;
+	lock_init (&fat_fs->write_lock);
+}
+
+/* Builds the in-use cluster bitmap from the loaded FAT, and an
+ * all-clean dirty-sector bitmap. */
+static void
+fat_build_maps (void) {
+	cluster_t i;
+
+	if (fat_fs->used_map != NULL)
+		bitmap_destroy (fat_fs->used_map);
+	if (fat_fs->dirty_map != NULL)
+		bitmap_destroy (fat_fs->dirty_map);
+	fat_fs->used_map = bitmap_create (fat_fs->fat_length);
+	fat_fs->dirty_map = bitmap_create (fat_fs->bs.fat_sectors);
+	if (fat_fs->used_map == NULL || fat_fs->dirty_map == NULL)
+		PANIC ("FAT bitmap creation failed");
+	bitmap_mark (fat_fs->used_map, 0);
+	for (i = 1; i < fat_fs->fat_length; i++)
+		if (fat_fs->fat[i] != 0)
+			bitmap_mark (fat_fs->used_map, i);
+}
+
+/* Writes FAT sector IDX (counting from the start of the FAT) to
+ * disk. */
+static void
+fat_write_sector (unsigned idx) {
+	const off_t fat_size_in_bytes = fat_fs->fat_length * sizeof (cluster_t);
+	const off_t ofs = (off_t) idx * DISK_SECTOR_SIZE;
+	uint8_t *buffer = (uint8_t *) fat_fs->fat;
+
+	if (fat_size_in_bytes - ofs >= DISK_SECTOR_SIZE)
+		disk_write_tagged (filesys_disk, fat_fs->bs.fat_start + idx, 1,
+		                   buffer + ofs, DISK_SRC_META);
+	else {
+		uint8_t bounce[DISK_SECTOR_SIZE] = { 0 };
+		if (fat_size_in_bytes > ofs)
+			memcpy (bounce, buffer + ofs, fat_size_in_bytes - ofs);
+		disk_write_tagged (filesys_disk, fat_fs->bs.fat_start + idx, 1, bounce,
+		                   DISK_SRC_META);
+	}
+}
+
+/* Writes the FAT sectors changed since the last flush to disk.
+ * Called at fat_close() and periodically by the buffer cache's
+ * writeback thread, so a crash loses only recent allocations. */
+void
+fat_flush (void) {
+	size_t idx;
+
+	if (fat_fs == NULL || fat_fs->dirty_map == NULL)
+		return;
+
+	lock_acquire (&fat_fs->write_lock);
+	for (idx = bitmap_scan (fat_fs->dirty_map, 0, 1, true);
+			idx != BITMAP_ERROR;
+			idx = bitmap_scan (fat_fs->dirty_map, idx + 1, 1, true)) {
+		bitmap_reset (fat_fs->dirty_map, idx);
+		fat_write_sector (idx);
+	}
+	lock_release (&fat_fs->write_lock);
 }
 
 /*----------------------------------------------------------------------------*/
 /* FAT handling                                                               */
 /*----------------------------------------------------------------------------*/
 
+/* Sets the FAT entry for CLST to VAL, keeping the in-use and
+ * dirty-sector bitmaps in step: fat_put() marks CLST used or free,
+ * and the sector holding the entry is marked dirty.  Must be called
+ * with the write lock held. */
+static void
+fat_set (cluster_t clst, cluster_t val) {
+	ASSERT (lock_held_by_current_thread (&fat_fs->write_lock));
+	fat_put (clst, val);
+	bitmap_mark (fat_fs->dirty_map,
+			clst * sizeof (cluster_t) / DISK_SECTOR_SIZE);
+}
+
+/* Finds CNT consecutive free clusters, searching from the
+ * next-fit cursor and wrapping around to the start of the FAT.
+ * Returns the first of them, or 0 if there is no such run.  Must
+ * be called with the write lock held. */
+static cluster_t
+find_free_run (size_t cnt) {
+	size_t idx = bitmap_scan_wrap (fat_fs->used_map, fat_fs->last_clst, cnt,
+			false);
+	return idx == BITMAP_ERROR ? 0 : idx;
+}
+
+/* Links the CNT clusters starting at FIRST into a chain that
+ * follows CLST (0 for none) and ends the chain.  Must be called
+ * with the write lock held. */
+static void
+link_run (cluster_t clst, cluster_t first, size_t cnt) {
+	size_t i;
+
+	for (i = 0; i + 1 < cnt; i++)
+		fat_set (first + i, first + i + 1);
+	fat_set (first + cnt - 1, EOChain);
+	if (clst != 0)
+		fat_set (clst, first);
+	fat_fs->last_clst = first + cnt < fat_fs->fat_length ? first + cnt : 1;
+}
+
 /* Add a cluster to the chain.
  * If CLST is 0, start a new chain.
  * Returns 0 if fails to allocate a new cluster. */
 cluster_t
 fat_create_chain (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	return fat_create_chain_n (clst, 1);
+}
+
+/* Adds CNT clusters to the chain that ends at CLST, or starts a
+ * new chain if CLST is 0.  The clusters are taken as one
+ * contiguous run when one is free, and one by one otherwise.
+ * Returns the first new cluster, or 0 if CNT clusters could not
+ * be found, in which case nothing is allocated. */
+cluster_t
+fat_create_chain_n (cluster_t clst, size_t cnt) {
+	cluster_t first, prev;
+	size_t i;
+
+	ASSERT (cnt > 0);
+
+	lock_acquire (&fat_fs->write_lock);
+	first = find_free_run (cnt);
+	if (first != 0) {
+		link_run (clst, first, cnt);
+		lock_release (&fat_fs->write_lock);
+		return first;
+	}
+
+	/* No run is long enough: link single clusters, undoing the
+	 * work if the disk runs out part way. */
+	if (cnt > 1) {
+		first = prev = 0;
+		for (i = 0; i < cnt; i++) {
+			cluster_t c = find_free_run (1);
+			if (c == 0)
+				break;
+			link_run (prev, c, 1);
+			if (first == 0)
+				first = c;
+			prev = c;
+		}
+		if (i == cnt) {
+			if (clst != 0)
+				fat_set (clst, first);
+			lock_release (&fat_fs->write_lock);
+			return first;
+		}
+		while (first != 0 && first != EOChain) {
+			cluster_t next = fat_fs->fat[first];
+			fat_set (first, 0);
+			first = next;
+		}
+	}
+	lock_release (&fat_fs->write_lock);
+	return 0;
 }
 
 /* Remove the chain of clusters starting from CLST.
  * If PCLST is 0, assume CLST as the start of the chain. */
 void
 fat_remove_chain (cluster_t clst, cluster_t pclst) {
-	/* TODO: Your code goes here. */
+	lock_acquire (&fat_fs->write_lock);
+	if (pclst != 0)
+		fat_set (pclst, EOChain);
+	while (clst != 0 && clst != EOChain) {
+		cluster_t next = fat_fs->fat[clst];
+		fat_set (clst, 0);
+		clst = next;
+	}
+	fat_fs->chain_gen++;
+	lock_release (&fat_fs->write_lock);
 }
 
 /* Update a value in the FAT table. */
 void
 fat_put (cluster_t clst, cluster_t val) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst != 0 && clst < fat_fs->fat_length);
+	fat_fs->fat[clst] = val;
+	bitmap_set (fat_fs->used_map, clst, val != 0);
 }
 
 /* Fetch a value in the FAT table. */
 cluster_t
 fat_get (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst != 0 && clst < fat_fs->fat_length);
+	return fat_fs->fat[clst];
 }
 
 /* Covert a cluster # to a sector number. */
 disk_sector_t
 cluster_to_sector (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst != 0 && clst < fat_fs->fat_length);
+	return fat_fs->data_start + (clst - 1) * fat_fs->bs.sectors_per_cluster;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Cluster chain index                                                        */
+/*----------------------------------------------------------------------------*/
+
+/* Initializes CHAIN as an empty index of the chain starting at
+ * HEAD. */
+void
+fat_chain_init (struct fat_chain *chain, cluster_t head) {
+	chain->head = head;
+	chain->clusters = NULL;
+	chain->cnt = 0;
+	chain->capacity = 0;
+	chain->gen = fat_fs->chain_gen;
+}
+
+/* Frees the memory held by CHAIN. */
+void
+fat_chain_destroy (struct fat_chain *chain) {
+	free (chain->clusters);
+	chain->clusters = NULL;
+	chain->cnt = chain->capacity = 0;
+}
+
+/* Returns the Nth cluster (counting from 0) of CHAIN, or 0 if the
+ * chain is shorter than that.  Clusters already indexed are found
+ * in constant time; beyond them the walk resumes from the last
+ * indexed cluster, recording what it passes.  Appending to the
+ * chain keeps the index valid; cutting it throws the index away. */
+cluster_t
+fat_chain_nth (struct fat_chain *chain, size_t n) {
+	if (chain->head == 0)
+		return 0;
+	if (chain->gen != fat_fs->chain_gen) {
+		chain->cnt = 0;
+		chain->gen = fat_fs->chain_gen;
+	}
+
+	while (chain->cnt <= n) {
+		cluster_t clst;
+
+		if (chain->cnt == 0)
+			clst = chain->head;
+		else {
+			clst = fat_get (chain->clusters[chain->cnt - 1]);
+			if (clst == EOChain || clst == 0)
+				return 0;
+		}
+
+		if (chain->cnt == chain->capacity) {
+			size_t capacity = chain->capacity ? chain->capacity * 2 : 16;
+			cluster_t *clusters = chain->clusters == NULL
+				? malloc_tagged (capacity * sizeof *clusters, TAG_FAT)
+				: realloc (chain->clusters, capacity * sizeof *clusters);
+			if (clusters == NULL)
+				return 0;
+			chain->clusters = clusters;
+			chain->capacity = capacity;
+		}
+		chain->clusters[chain->cnt++] = clst;
+	}
+	return chain->clusters[n];
 }
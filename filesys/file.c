@@ -2,28 +2,52 @@
 #include <debug.h>
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/vaddr.h"
 
 /* An open file. */
 struct file {
 	struct inode *inode;        /* File's inode. */
 	off_t pos;                  /* Current position. */
 	bool deny_write;            /* Has file_deny_write() been called? */
+
+	/* Read-ahead state. */
+	off_t ra_next;              /* Offset a sequential read starts at. */
+	off_t ra_end;               /* End of the range already prefetched. */
+	int ra_window;              /* Sectors to keep prefetched, 0 if off. */
 };
 
+/* Read-ahead window bounds, in sectors. */
+#define RA_WINDOW_MIN 4
+#define RA_WINDOW_MAX 64
+
+/* Cache of open files. */
+static struct kmem_cache *file_cache;
+
+/* Initializes the open file cache. */
+void
+file_init (void) {
+	file_cache = kmem_cache_create ("file", sizeof (struct file), 0, NULL);
+}
+
 /* Opens a file for the given INODE, of which it takes ownership,
  * and returns the new file.  Returns a null pointer if an
  * allocation fails or if INODE is null. */
 struct file *
 file_open (struct inode *inode) {
-	struct file *file = calloc (1, sizeof *file);
+	struct file *file = kmem_cache_alloc (file_cache);
 	if (inode != NULL && file != NULL) {
 		file->inode = inode;
 		file->pos = 0;
 		file->deny_write = false;
+		file->ra_next = 0;
+		file->ra_end = 0;
+		file->ra_window = 0;
 		return file;
 	} else {
 		inode_close (inode);
-		free (file);
+		kmem_cache_free (file_cache, file);
 		return NULL;
 	}
 }
@@ -54,7 +78,7 @@ file_close (struct file *file) {
 	if (file != NULL) {
 		file_allow_write (file);
 		inode_close (file->inode);
-		free (file);
+		kmem_cache_free (file_cache, file);
 	}
 }
 
@@ -64,6 +88,41 @@ file_get_inode (struct file *file) {
 	return file->inode;
 }
 
+/* Updates FILE's read-ahead state after a read of BYTES_READ
+ * bytes at OFFSET.  A read that starts where the previous one
+ * ended is sequential: it opens or doubles the window and
+ * prefetches whatever part of the window past the read has not
+ * been requested yet.  Any other read closes the window. */
+static void
+file_readahead (struct file *file, off_t offset, off_t bytes_read) {
+	off_t end = offset + bytes_read;
+	off_t ra_limit;
+
+	if (bytes_read <= 0)
+		return;
+
+	if (offset == file->ra_next) {
+		if (file->ra_window == 0)
+			file->ra_window = RA_WINDOW_MIN;
+		else if (file->ra_window < RA_WINDOW_MAX)
+			file->ra_window *= 2;
+	} else {
+		file->ra_window = 0;
+		file->ra_end = 0;
+	}
+	file->ra_next = end;
+
+	if (file->ra_window == 0)
+		return;
+	ra_limit = end + file->ra_window * DISK_SECTOR_SIZE;
+	if (file->ra_end < end)
+		file->ra_end = end;
+	if (file->ra_end < ra_limit) {
+		inode_readahead (file->inode, file->ra_end, ra_limit - file->ra_end);
+		file->ra_end = ra_limit;
+	}
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
  * starting at the file's current position.
  * Returns the number of bytes actually read,
@@ -72,6 +131,7 @@ file_get_inode (struct file *file) {
 off_t
 file_read (struct file *file, void *buffer, off_t size) {
 	off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+	file_readahead (file, file->pos, bytes_read);
 	file->pos += bytes_read;
 	return bytes_read;
 }
@@ -83,7 +143,9 @@ file_read (struct file *file, void *buffer, off_t size) {
  * The file's current position is unaffected. */
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) {
-	return inode_read_at (file->inode, buffer, size, file_ofs);
+	off_t bytes_read = inode_read_at (file->inode, buffer, size, file_ofs);
+	file_readahead (file, file_ofs, bytes_read);
+	return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
@@ -95,7 +157,7 @@ file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) {
  * Advances FILE's position by the number of bytes read. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) {
-	off_t bytes_written = inode_write_at (file->inode, buffer, size, file->pos);
+	off_t bytes_written = file_write_at (file, buffer, size, file->pos);
 	file->pos += bytes_written;
 	return bytes_written;
 }
@@ -106,13 +168,58 @@ file_write (struct file *file, const void *buffer, off_t size) {
  * which may be less than SIZE if end of file is reached.
  * (Normally we'd grow the file in that case, but file growth is
  * not yet implemented.)
- * The file's current position is unaffected. */
+ * The file's current position is unaffected.
+ * Directories change only through filesys/directory.c, and links
+ * not at all, so nothing is written to either opened as a file. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
 		off_t file_ofs) {
+	if (inode_is_dir (file->inode) || inode_is_symlink (file->inode))
+		return 0;
 	return inode_write_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Copies SIZE bytes of IN, starting at offset IN_OFS, into OUT at
+ * offset OUT_OFS, which must not overlap the source if IN and OUT
+ * share an inode.  The data goes from cache to cache through a
+ * kernel page, never through user memory.  Returns the number of
+ * bytes copied, which may be less than SIZE at end of IN or if OUT
+ * cannot grow, or -1 if memory is short.  Neither file's position
+ * changes. */
+off_t
+file_copy_range (struct file *in, off_t in_ofs, struct file *out,
+		off_t out_ofs, off_t size) {
+	uint8_t *buffer = palloc_get_page (0);
+	off_t copied = 0;
+
+	if (buffer == NULL)
+		return -1;
+	while (copied < size) {
+		off_t chunk = size - copied < PGSIZE ? size - copied : PGSIZE;
+		off_t bytes_read = file_read_at (in, buffer, chunk, in_ofs + copied);
+		off_t bytes_written = file_write_at (out, buffer, bytes_read,
+				out_ofs + copied);
+
+		copied += bytes_written;
+		if (bytes_read < chunk || bytes_written < bytes_read)
+			break;
+	}
+	palloc_free_page (buffer);
+	return copied;
+}
+
+/* Allocates space for the SIZE bytes of FILE starting at OFFSET,
+ * extending FILE with zeros if it ends before them, so that
+ * writing them later takes no allocation and, on disk, finds them
+ * as contiguous as free space allows.  Returns true if
+ * successful. */
+bool
+file_allocate (struct file *file, off_t offset, off_t size) {
+	if (inode_is_dir (file->inode) || inode_is_symlink (file->inode))
+		return false;
+	return inode_allocate (file->inode, offset + size);
+}
+
 /* Prevents write operations on FILE's underlying inode
  * until file_allow_write() is called or FILE is closed. */
 void
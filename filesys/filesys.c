@@ -2,15 +2,50 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/dcache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
+#include "filesys/fsck.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "filesys/directory.h"
+#include "filesys/page_cache.h"
 #include "devices/disk.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* The disk that contains the file system. */
 struct disk *filesys_disk;
 
+/* Mount table.
+ *
+ * A file system mounted on NAME, a file in the root directory of
+ * the disk, takes over the paths "NAME/FILE" and "/NAME/FILE":
+ * they name FILE in that file system's root instead.  The mount
+ * point's inode stays open while mounted and points back at its
+ * mount, so crossing into a mount is a dir_lookup() of the first
+ * name, which the directory entry cache answers, and a pointer
+ * check, not a walk of the table. */
+#define MOUNT_MAX 4
+
+struct mount {
+	struct inode *covered;              /* Mount point, or null if free. */
+	struct inode *root;                 /* Root of the mounted file system. */
+	const struct fs_ops *ops;           /* Its operations. */
+};
+
+static struct mount mounts[MOUNT_MAX];
+static struct lock mount_lock;          /* Protects MOUNTS. */
+
+static bool disk_create (struct dir *, const char *, off_t);
+
+/* The file system on the disk, whose root is the root of every
+ * path. */
+static const struct fs_ops disk_fs_ops = {
+	.name = "disk",
+	.create = disk_create,
+};
+
 static void do_format (void);
 
 /* Initializes the file system module.
@@ -21,7 +56,12 @@ filesys_init (bool format) {
 	if (filesys_disk == NULL)
 		PANIC ("hd0:1 (hdb) not present, file system initialization failed");
 
+	page_cache_init ();
 	inode_init ();
+	dcache_init ();
+	file_init ();
+	journal_init ();
+	lock_init (&mount_lock);
 
 #ifdef EFILESYS
 	fat_init ();
@@ -37,7 +77,14 @@ filesys_init (bool format) {
 	if (format)
 		do_format ();
 
+	journal_open ();
 	free_map_open ();
+
+	/* A clean unmount leaves nothing to check. */
+	if (!journal_was_clean ()) {
+		printf ("File system was not unmounted cleanly, checking...\n");
+		fsck (true);
+	}
 #endif
 }
 
@@ -45,6 +92,10 @@ filesys_init (bool format) {
  * to disk. */
 void
 filesys_done (void) {
+	inode_writeback ();
+	journal_close ();
+	page_cache_flush ();
+
 	/* Original FS */
 #ifdef EFILESYS
 	fat_close ();
@@ -53,55 +104,324 @@ filesys_done (void) {
 #endif
 }
 
+/* Looks up PATH's first name, of LEN bytes, in the root directory
+ * and returns the mount on it, or a null pointer.  Stores the
+ * name's inode, if any, in *INODEP for the caller to close.  If
+ * TARGET is non-null, a name that is a symbolic link is not opened
+ * but stores its target there instead, as for dir_lookup_link(). */
+static struct mount *
+mount_lookup (const char *path, size_t len, struct inode **inodep,
+		char target[SYMLINK_MAX_LEN + 1]) {
+	char name[NAME_MAX + 1];
+	struct dir *root;
+
+	*inodep = NULL;
+	if (target != NULL)
+		*target = '\0';
+	if (len == 0 || len > NAME_MAX)
+		return NULL;
+	memcpy (name, path, len);
+	name[len] = '\0';
+	root = dir_open_root ();
+	if (root != NULL && target != NULL)
+		dir_lookup_link (root, name, inodep, target, SYMLINK_MAX_LEN + 1);
+	else if (root != NULL)
+		dir_lookup (root, name, inodep);
+	dir_close (root);
+	return *inodep != NULL ? inode_get_mount (*inodep) : NULL;
+}
+
+/* Most symbolic links one path resolution follows, so that a loop
+ * of links ends in failure. */
+#define SYMLINK_FOLLOW_MAX 8
+
+/* One path resolution. */
+struct walk {
+	char *buf;                          /* Path after following links. */
+	int links;                          /* Number of links followed. */
+};
+
+/* Points *PATHP at a path made of TARGET, a symbolic link's target,
+ * followed by "/" and REST if REST is non-null; the link stood for
+ * the first name of the path REST came from.  Returns false if W
+ * has followed too many links or memory is short. */
+static bool
+walk_follow (struct walk *w, const char *target, const char *rest,
+		const char **pathp) {
+	size_t len = strlen (target);
+	size_t rest_len = rest != NULL ? strlen (rest) : 0;
+	char *buf;
+
+	if (++w->links > SYMLINK_FOLLOW_MAX)
+		return false;
+	buf = malloc (len + 1 + rest_len + 1);
+	if (buf == NULL)
+		return false;
+	memcpy (buf, target, len);
+	buf[len] = '\0';
+	if (rest != NULL) {
+		buf[len] = '/';
+		memcpy (buf + len + 1, rest, rest_len + 1);
+	}
+	free (w->buf);
+	w->buf = buf;
+	*pathp = buf;
+	return true;
+}
+
+/* Opens the directory that PATH names a file in and points *NAMEP
+ * at the file's name within PATH, or within W->buf if a symbolic
+ * link on the way had to be followed.  Sets *OPSP to the operations
+ * of the file system the directory is in.  Returns a null pointer
+ * on failure.  Link targets are paths like any other, resolved
+ * from the root. */
+static struct dir *
+resolve (const char *path, const char **namep, const struct fs_ops **opsp,
+		struct walk *w) {
+	char target[SYMLINK_MAX_LEN + 1];
+	const char *name, *slash;
+	struct inode *inode;
+	struct mount *m;
+	struct dir *dir = NULL;
+
+	for (;;) {
+		name = path;
+		while (*name == '/')
+			name++;
+		slash = strchr (name, '/');
+		if (slash == NULL)
+			break;
+		m = mount_lookup (name, slash - name, &inode, target);
+		if (m != NULL) {
+			/* The mount may be going away; its root is gone once its
+			 * mount point no longer points at it. */
+			lock_acquire (&mount_lock);
+			if (inode_get_mount (inode) == m)
+				dir = dir_open (inode_reopen (m->root));
+			lock_release (&mount_lock);
+			inode_close (inode);
+			*namep = slash + 1;
+			*opsp = m->ops;
+			return dir;
+		}
+		inode_close (inode);
+		if (*target == '\0')
+			break;
+		if (!walk_follow (w, target, slash + 1, &path))
+			return NULL;
+	}
+	*namep = path;
+	*opsp = &disk_fs_ops;
+	return dir_open_root ();
+}
+
+/* Creates a file named NAME with the given INITIAL_SIZE in DIR, a
+ * directory on the disk.  The inode goes near DIR's, so that the
+ * inodes of one directory's files sit together for stat-ahead. */
+static bool
+disk_create (struct dir *dir, const char *name, off_t initial_size) {
+	disk_sector_t inode_sector = 0;
+	bool success;
+
+	journal_begin ();
+	success = (free_map_allocate_near (1,
+				inode_get_inumber (dir_get_inode (dir)), &inode_sector)
+			&& inode_create (inode_sector, initial_size, false)
+			&& dir_add (dir, name, inode_sector));
+	if (!success && inode_sector != 0)
+		free_map_release (inode_sector, 1);
+	journal_end ();
+	return success;
+}
+
 /* Creates a file named NAME with the given INITIAL_SIZE.
  * Returns true if successful, false otherwise.
  * Fails if a file named NAME already exists,
  * or if internal memory allocation fails. */
 bool
 filesys_create (const char *name, off_t initial_size) {
-	disk_sector_t inode_sector = 0;
-	struct dir *dir = dir_open_root ();
-	bool success = (dir != NULL
-			&& free_map_allocate (1, &inode_sector)
-			&& inode_create (inode_sector, initial_size)
-			&& dir_add (dir, name, inode_sector));
-	if (!success && inode_sector != 0)
-		free_map_release (inode_sector, 1);
-	dir_close (dir);
+	struct walk w = { NULL, 0 };
+	const char *file;
+	const struct fs_ops *ops;
+	struct dir *dir = resolve (name, &file, &ops, &w);
+	bool success = dir != NULL && ops->create (dir, file, initial_size);
 
+	dir_close (dir);
+	free (w.buf);
 	return success;
 }
 
-/* Opens the file with the given NAME.
+/* Opens the file with the given NAME, following symbolic links.
  * Returns the new file if successful or a null pointer
- * otherwise.
- * Fails if no file named NAME exists,
+ * otherwise.  A NAME such as "/" or "NAME/" that ends at a
+ * directory opens the directory itself, for reading its entries.
+ * Fails if no file named NAME exists, if links loop,
  * or if an internal memory allocation fails. */
 struct file *
 filesys_open (const char *name) {
-	struct dir *dir = dir_open_root ();
+	char target[SYMLINK_MAX_LEN + 1];
+	struct walk w = { NULL, 0 };
+	const char *file;
+	const struct fs_ops *ops;
+	struct dir *dir;
 	struct inode *inode = NULL;
 
-	if (dir != NULL)
-		dir_lookup (dir, name, &inode);
-	dir_close (dir);
+	if (*name == '\0')
+		return NULL;
+	for (;;) {
+		dir = resolve (name, &file, &ops, &w);
+		*target = '\0';
+		if (dir != NULL && file[strspn (file, "/")] == '\0')
+			inode = inode_reopen (dir_get_inode (dir));
+		else if (dir != NULL)
+			dir_lookup_link (dir, file, &inode, target, sizeof target);
+		dir_close (dir);
+		if (*target == '\0' || !walk_follow (&w, target, NULL, &name))
+			break;
+	}
+	free (w.buf);
 
 	return file_open (inode);
 }
 
-/* Deletes the file named NAME.
+/* Deletes the file named NAME; a symbolic link is removed itself,
+ * not followed.
  * Returns true if successful, false on failure.
- * Fails if no file named NAME exists,
+ * Fails if no file named NAME exists, if it is a mount point,
  * or if an internal memory allocation fails. */
 bool
 filesys_remove (const char *name) {
-	struct dir *dir = dir_open_root ();
-	bool success = dir != NULL && dir_remove (dir, name);
+	struct walk w = { NULL, 0 };
+	const char *file;
+	const struct fs_ops *ops;
+	struct inode *inode = NULL;
+	struct dir *dir;
+	bool success;
+
+	journal_begin ();
+	dir = resolve (name, &file, &ops, &w);
+	if (dir != NULL)
+		dir_lookup (dir, file, &inode);
+	success = (inode != NULL && inode_get_mount (inode) == NULL
+			&& dir_remove (dir, file));
+	inode_close (inode);
 	dir_close (dir);
+	journal_end ();
+	free (w.buf);
 
 	return success;
 }
 
+/* Creates a symbolic link named LINKPATH to TARGET, which need not
+ * exist.  Returns true if successful, false if LINKPATH exists
+ * already, if TARGET is empty or longer than SYMLINK_MAX_LEN, or if
+ * memory or disk allocation fails. */
+bool
+filesys_symlink (const char *target, const char *linkpath) {
+	struct walk w = { NULL, 0 };
+	const char *file;
+	const struct fs_ops *ops;
+	struct inode *inode = NULL;
+	struct dir *dir;
+	bool success;
+
+	if (*target == '\0' || strlen (target) > SYMLINK_MAX_LEN)
+		return false;
+
+	/* On disk, creating the file and making it a link commit
+	 * together. */
+	journal_begin ();
+	dir = resolve (linkpath, &file, &ops, &w);
+	success = (dir != NULL && ops->create (dir, file, 0)
+			&& dir_lookup (dir, file, &inode));
+	if (success && !inode_make_symlink (inode, target)) {
+		dir_remove (dir, file);
+		success = false;
+	}
+	inode_close (inode);
+	dir_close (dir);
+	journal_end ();
+	free (w.buf);
+
+	return success;
+}
+
+/* Mounts a new, empty file system of the kind OPS makes on PATH,
+ * which is a single name with an optional leading '/', creating an
+ * empty file there first if there is none.  Returns true if
+ * successful, false if PATH is not such a name or is a mount point
+ * already, or if the mount table or memory is full. */
+bool
+filesys_mount (const char *path, const struct fs_ops *ops) {
+	struct mount *m = NULL;
+	struct inode *covered;
+	size_t len, i;
+	bool success = false;
+
+	while (*path == '/')
+		path++;
+	len = strlen (path);
+	if (strchr (path, '/') != NULL)
+		return false;
+	if (mount_lookup (path, len, &covered, NULL) == NULL && covered == NULL
+			&& len > 0 && len <= NAME_MAX && filesys_create (path, 0))
+		mount_lookup (path, len, &covered, NULL);
+	if (covered == NULL)
+		return false;
+	if (inode_is_symlink (covered)) {
+		inode_close (covered);
+		return false;
+	}
+
+	lock_acquire (&mount_lock);
+	if (inode_get_mount (covered) == NULL)
+		for (i = 0; i < MOUNT_MAX && m == NULL; i++)
+			if (mounts[i].covered == NULL)
+				m = &mounts[i];
+	if (m != NULL && (m->root = ops->mount ()) != NULL) {
+		/* The mount keeps COVERED open. */
+		m->covered = covered;
+		m->ops = ops;
+		inode_set_mount (covered, m);
+		success = true;
+	}
+	lock_release (&mount_lock);
+
+	if (!success)
+		inode_close (covered);
+	return success;
+}
+
+/* Unmounts the file system on PATH, discarding its files; those
+ * still open stay usable until closed.  Returns true if
+ * successful, false if nothing is mounted on PATH. */
+bool
+filesys_umount (const char *path) {
+	struct inode *covered = NULL;
+	struct inode *inode;
+	struct mount *m;
+	struct mount gone;
+
+	while (*path == '/')
+		path++;
+	m = mount_lookup (path, strlen (path), &inode, NULL);
+	lock_acquire (&mount_lock);
+	if (m != NULL && inode_get_mount (inode) == m) {
+		gone = *m;
+		covered = m->covered;
+		inode_set_mount (covered, NULL);
+		m->covered = NULL;
+	}
+	lock_release (&mount_lock);
+	inode_close (inode);
+
+	if (covered == NULL)
+		return false;
+	gone.ops->unmount (gone.root);
+	inode_close (covered);
+	return true;
+}
+
 /* Formats the file system. */
 static void
 do_format (void) {
@@ -115,6 +435,7 @@ do_format (void) {
 	free_map_create ();
 	if (!dir_create (ROOT_DIR_SECTOR, 16))
 		PANIC ("root directory creation failed");
+	journal_create ();
 	free_map_close ();
 #endif
 
@@ -4,9 +4,11 @@
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per disk sector. */
+static disk_sector_t free_map_hint;  /* Where the next search starts. */
 
 /* Initializes the free map. */
 void
@@ -16,18 +18,53 @@ free_map_init (void) {
 		PANIC ("bitmap creation failed--disk is too large");
 	bitmap_mark (free_map, FREE_MAP_SECTOR);
 	bitmap_mark (free_map, ROOT_DIR_SECTOR);
+	bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SECTORS, true);
+}
+
+/* Writes the bits for the CNT sectors starting at SECTOR to the free
+ * map file, if it is open.  Only the sectors of the file that hold them
+ * are written, not the whole map, so an operation logs one or two free
+ * map sectors into its journal transaction rather than all of them.
+ * Returns true if successful. */
+static bool
+free_map_write (disk_sector_t sector, size_t cnt) {
+	return free_map_file == NULL
+		|| bitmap_write_range (free_map, free_map_file, sector, cnt,
+				DISK_SECTOR_SIZE);
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
- * the first into *SECTORP.
+ * the first into *SECTORP.  The search starts where the last
+ * allocation ended, so it need not pass over the full front of
+ * the disk each time.
  * Returns true if successful, false if all sectors were
  * available. */
 bool
 free_map_allocate (size_t cnt, disk_sector_t *sectorp) {
-	disk_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-	if (sector != BITMAP_ERROR
-			&& free_map_file != NULL
-			&& !bitmap_write (free_map, free_map_file)) {
+	size_t sector = bitmap_scan_wrap (free_map, free_map_hint, cnt, false);
+	if (sector != BITMAP_ERROR)
+		bitmap_set_multiple (free_map, sector, cnt, true);
+	if (sector != BITMAP_ERROR && !free_map_write (sector, cnt)) {
+		bitmap_set_multiple (free_map, sector, cnt, false);
+		sector = BITMAP_ERROR;
+	}
+	if (sector != BITMAP_ERROR) {
+		*sectorp = sector;
+		free_map_hint = sector + cnt;
+	}
+	return sector != BITMAP_ERROR;
+}
+
+/* Like free_map_allocate(), but searches from GOAL instead, so
+ * that what is allocated lands near it, and leaves the search
+ * position of free_map_allocate() alone. */
+bool
+free_map_allocate_near (size_t cnt, disk_sector_t goal,
+		disk_sector_t *sectorp) {
+	size_t sector = bitmap_scan_wrap (free_map, goal, cnt, false);
+	if (sector != BITMAP_ERROR)
+		bitmap_set_multiple (free_map, sector, cnt, true);
+	if (sector != BITMAP_ERROR && !free_map_write (sector, cnt)) {
 		bitmap_set_multiple (free_map, sector, cnt, false);
 		sector = BITMAP_ERROR;
 	}
@@ -36,12 +73,33 @@ free_map_allocate (size_t cnt, disk_sector_t *sectorp) {
 	return sector != BITMAP_ERROR;
 }
 
+/* Allocates the CNT consecutive sectors starting at SECTOR, if
+ * they are all free.  Returns true if successful. */
+bool
+free_map_allocate_at (disk_sector_t sector, size_t cnt) {
+	if (sector + cnt > bitmap_size (free_map)
+			|| !bitmap_none (free_map, sector, cnt))
+		return false;
+	bitmap_set_multiple (free_map, sector, cnt, true);
+	if (!free_map_write (sector, cnt)) {
+		bitmap_set_multiple (free_map, sector, cnt, false);
+		return false;
+	}
+	return true;
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (disk_sector_t sector, size_t cnt) {
 	ASSERT (bitmap_all (free_map, sector, cnt));
 	bitmap_set_multiple (free_map, sector, cnt, false);
-	bitmap_write (free_map, free_map_file);
+	free_map_write (sector, cnt);
+}
+
+/* Returns true if SECTOR is marked in use. */
+bool
+free_map_in_use (disk_sector_t sector) {
+	return bitmap_test (free_map, sector);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -65,7 +123,7 @@ free_map_close (void) {
 void
 free_map_create (void) {
 	/* Create inode. */
-	if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+	if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), false))
 		PANIC ("free map creation failed");
 
 	/* Write bitmap to file. */
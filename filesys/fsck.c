@@ -0,0 +1,172 @@
+#include "filesys/fsck.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "filesys/directory.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "filesys/page_cache.h"
+#include "threads/malloc.h"
+
+/* File system check.
+
+   One pass over the metadata: the root directory is listed a
+   bucket at a time, and the inodes it names are then checked in
+   sector order, with the ones coming up prefetched, so the disk
+   sees a forward sweep of large reads instead of a seek per file.
+   Each inode marks the sectors it owns in a bitmap; a sector
+   claimed twice is cross-linked.  At the end the bitmap is
+   compared with the free map.
+
+   The journal already keeps metadata consistent across a crash,
+   short of what it cannot log, so what a check finds afterwards
+   is mostly leaks: sectors the free map has in use that no inode
+   owns, such as the reservations of files that were open (see
+   inode_reserve()).  These, and sectors in use but marked free,
+   are the problems a repair fixes.  Damaged inodes and
+   cross-links are only reported. */
+
+/* Inodes prefetched ahead of the one being checked. */
+#define FSCK_PREFETCH 16
+
+/* Compares inode numbers, for qsort(). */
+static int
+compare_sectors (const void *a_, const void *b_) {
+	const disk_sector_t *a = a_;
+	const disk_sector_t *b = b_;
+
+	return *a < *b ? -1 : *a > *b;
+}
+
+/* Stores the inode numbers of the files in the root directory in
+   a new array, in *SECTORSP, sorted.  Returns how many there are,
+   or -1 if memory is short. */
+static int
+list_root (disk_sector_t **sectorsp) {
+	uint32_t buf[DISK_SECTOR_SIZE / sizeof (uint32_t)];
+	disk_sector_t *sectors = NULL;
+	size_t cnt = 0, cap = 0, size, ofs;
+	struct dir *dir = dir_open_root ();
+
+	if (dir == NULL)
+		return -1;
+	while ((size = dir_readdir_batch (dir, buf, sizeof buf)) > 0)
+		for (ofs = 0; ofs < size; ) {
+			const struct dirent *d
+				= (const struct dirent *) ((uint8_t *) buf + ofs);
+
+			if (cnt == cap) {
+				disk_sector_t *new;
+
+				cap = cap == 0 ? 64 : cap * 2;
+				new = realloc (sectors, cap * sizeof *sectors);
+				if (new == NULL) {
+					free (sectors);
+					dir_close (dir);
+					return -1;
+				}
+				sectors = new;
+			}
+			sectors[cnt++] = d->d_ino;
+			ofs += d->d_reclen;
+		}
+	dir_close (dir);
+
+	qsort (sectors, cnt, sizeof *sectors, compare_sectors);
+	*sectorsp = sectors;
+	return cnt;
+}
+
+/* Marks the sectors in [START, END) in use in the free map if
+   IN_USE, or else free. */
+static void
+repair_run (bool in_use, size_t start, size_t end) {
+	if (in_use)
+		free_map_allocate_at (start, end - start);
+	else
+		free_map_release (start, end - start);
+}
+
+/* Checks the file system on the disk, which must be mounted but
+   otherwise idle, and prints what it finds.  If REPAIR, also
+   brings the free map into line with the sectors that inodes own.
+   Returns true if nothing was wrong. */
+bool
+fsck (bool repair) {
+	size_t sectors = disk_size (filesys_disk);
+	struct bitmap *used = bitmap_create (sectors);
+	disk_sector_t *files = NULL;
+	size_t leaked = 0, unmarked = 0, errors = 0;
+	size_t i;
+	int file_cnt = 0;
+
+	if (used == NULL) {
+		printf ("fsck: out of memory\n");
+		return false;
+	}
+	bitmap_set_multiple (used, JOURNAL_SECTOR, JOURNAL_SECTORS, true);
+	if (!inode_check (FREE_MAP_SECTOR, used))
+		errors++;
+	if (!inode_check (ROOT_DIR_SECTOR, used))
+		errors++;
+	else if ((file_cnt = list_root (&files)) < 0) {
+		printf ("fsck: out of memory\n");
+		bitmap_destroy (used);
+		return false;
+	}
+
+	for (i = 0; i < (size_t) file_cnt; i++) {
+		if (i % FSCK_PREFETCH == 0) {
+			size_t j;
+
+			for (j = i + FSCK_PREFETCH; j < (size_t) file_cnt
+					&& j < i + 2 * FSCK_PREFETCH; j++)
+				page_cache_prefetch (files[j]);
+		}
+		if (i > 0 && files[i] == files[i - 1]) {
+			printf ("fsck: inode %"PRDSNu" has two names\n", files[i]);
+			errors++;
+		} else if (!inode_check (files[i], used))
+			errors++;
+	}
+	free (files);
+
+	/* Compare with the free map, a run of sectors on which the two
+	   disagree the same way at a time. */
+	for (i = 0; i < sectors; ) {
+		bool in_use = bitmap_test (used, i);
+		size_t end;
+
+		if (in_use == free_map_in_use (i)) {
+			i++;
+			continue;
+		}
+		for (end = i + 1; end < sectors && bitmap_test (used, end) == in_use
+				&& free_map_in_use (end) != in_use; end++)
+			continue;
+		if (in_use)
+			unmarked += end - i;
+		else
+			leaked += end - i;
+		if (repair) {
+			journal_begin ();
+			repair_run (in_use, i, end);
+			journal_end ();
+		}
+		i = end;
+	}
+	if (unmarked > 0)
+		errors++;
+
+	printf ("fsck: %d files, %zu sectors in use, %zu leaked, "
+			"%zu in use but free, %zu errors%s\n",
+			file_cnt, bitmap_count (used, 0, sectors, true), leaked, unmarked,
+			errors, repair && leaked + unmarked > 0 ? ", free map fixed" : "");
+	bitmap_destroy (used);
+	return errors == 0 && leaked == 0;
+}
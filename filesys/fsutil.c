@@ -1,31 +1,57 @@
 #include "filesys/fsutil.h"
 #include <debug.h>
+#include <dirent.h>
+#include <round.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/fsck.h"
 #include "devices/disk.h"
-#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
 
-/* List files in the root directory. */
+/* Pages in the buffer that fsutil_put() and fsutil_get() move
+   data through, so that each disk command and file write covers
+   up to 64 kB instead of a sector. */
+#define XFER_PAGES 16
+#define XFER_SIZE (XFER_PAGES * PGSIZE)
+
+/* List files in the root directory, a bucket's worth of entries
+   at a time. */
 void
 fsutil_ls (char **argv UNUSED) {
 	struct dir *dir;
-	char name[NAME_MAX + 1];
+	uint32_t buf[DISK_SECTOR_SIZE / sizeof (uint32_t)];
+	size_t size, ofs;
 
 	printf ("Files in the root directory:\n");
 	dir = dir_open_root ();
 	if (dir == NULL)
 		PANIC ("root dir open failed");
-	while (dir_readdir (dir, name))
-		printf ("%s\n", name);
+	while ((size = dir_readdir_batch (dir, buf, sizeof buf)) > 0)
+		for (ofs = 0; ofs < size; ) {
+			const struct dirent *d
+				= (const struct dirent *) ((uint8_t *) buf + ofs);
+
+			printf ("%s\n", d->d_name);
+			ofs += d->d_reclen;
+		}
+	dir_close (dir);
 	printf ("End of listing.\n");
 }
 
+/* Checks the file system and repairs the free map. */
+void
+fsutil_fsck (char **argv UNUSED) {
+	printf ("Checking file system...\n");
+	if (fsck (true))
+		printf ("File system is clean.\n");
+}
+
 /* Prints the contents of file ARGV[1] to the system console as
  * hex and ASCII. */
 void
@@ -82,12 +108,12 @@ fsutil_put (char **argv) {
 	struct disk *src;
 	struct file *dst;
 	off_t size;
-	void *buffer;
+	uint8_t *buffer;
 
 	printf ("Putting '%s' into the file system...\n", file_name);
 
 	/* Allocate buffer. */
-	buffer = malloc (DISK_SECTOR_SIZE);
+	buffer = palloc_get_multiple (0, XFER_PAGES);
 	if (buffer == NULL)
 		PANIC ("couldn't allocate buffer");
 
@@ -102,9 +128,9 @@ fsutil_put (char **argv) {
 		PANIC ("%s: missing PUT signature on scratch disk", file_name);
 	size = ((int32_t *) buffer)[1];
 	if (size < 0)
-		PANIC ("%s: invalid file size %d", file_name, size);
+		PANIC ("%s: invalid file size %"PROTd, file_name, size);
 
-	/* Create destination file. */
+	/* Create destination file, with all of its sectors allocated. */
 	if (!filesys_create (file_name, size))
 		PANIC ("%s: create failed", file_name);
 	dst = filesys_open (file_name);
@@ -113,8 +139,13 @@ fsutil_put (char **argv) {
 
 	/* Do copy. */
 	while (size > 0) {
-		int chunk_size = size > DISK_SECTOR_SIZE ? DISK_SECTOR_SIZE : size;
-		disk_read (src, sector++, buffer);
+		int chunk_size = size > XFER_SIZE ? XFER_SIZE : size;
+		size_t sectors = DIV_ROUND_UP (chunk_size, DISK_SECTOR_SIZE);
+
+		if (sector + sectors > disk_size (src))
+			PANIC ("%s: scratch disk ends within the file", file_name);
+		disk_read_multiple (src, sector, sectors, buffer);
+		sector += sectors;
 		if (file_write (dst, buffer, chunk_size) != chunk_size)
 			PANIC ("%s: write failed with %"PROTd" bytes unwritten",
 					file_name, size);
@@ -123,7 +154,7 @@ fsutil_put (char **argv) {
 
 	/* Finish up. */
 	file_close (dst);
-	free (buffer);
+	palloc_free_multiple (buffer, XFER_PAGES);
 }
 
 /* Copies file FILE_NAME from the file system to the scratch disk.
@@ -142,7 +173,7 @@ fsutil_get (char **argv) {
 	static disk_sector_t sector = 0;
 
 	const char *file_name = argv[1];
-	void *buffer;
+	uint8_t *buffer;
 	struct file *src;
 	struct disk *dst;
 	off_t size;
@@ -150,7 +181,7 @@ fsutil_get (char **argv) {
 	printf ("Getting '%s' from the file system...\n", file_name);
 
 	/* Allocate buffer. */
-	buffer = malloc (DISK_SECTOR_SIZE);
+	buffer = palloc_get_multiple (0, XFER_PAGES);
 	if (buffer == NULL)
 		PANIC ("couldn't allocate buffer");
 
@@ -173,17 +204,21 @@ fsutil_get (char **argv) {
 
 	/* Do copy. */
 	while (size > 0) {
-		int chunk_size = size > DISK_SECTOR_SIZE ? DISK_SECTOR_SIZE : size;
-		if (sector >= disk_size (dst))
+		int chunk_size = size > XFER_SIZE ? XFER_SIZE : size;
+		size_t sectors = DIV_ROUND_UP (chunk_size, DISK_SECTOR_SIZE);
+
+		if (sector + sectors > disk_size (dst))
 			PANIC ("%s: out of space on scratch disk", file_name);
 		if (file_read (src, buffer, chunk_size) != chunk_size)
 			PANIC ("%s: read failed with %"PROTd" bytes unread", file_name, size);
-		memset (buffer + chunk_size, 0, DISK_SECTOR_SIZE - chunk_size);
-		disk_write (dst, sector++, buffer);
+		memset (buffer + chunk_size, 0,
+				sectors * DISK_SECTOR_SIZE - chunk_size);
+		disk_write_multiple (dst, sector, sectors, buffer);
+		sector += sectors;
 		size -= chunk_size;
 	}
 
 	/* Finish up. */
 	file_close (src);
-	free (buffer);
+	palloc_free_multiple (buffer, XFER_PAGES);
 }
@@ -1,24 +1,112 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <bitmap.h>
+#include <crc32c.h>
+#include <hash.h>
 #include <debug.h>
+#include <rculist.h>
 #include <round.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
+#include "filesys/page_cache.h"
+#include "filesys/tmpfs.h"
+#include "threads/atomic.h"
 #include "threads/malloc.h"
+#include "threads/rcu.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
 
-/* Identifies an inode. */
-#define INODE_MAGIC 0x494e4f44
+/* Identifies an inode, with a 64-bit length. */
+#define INODE_MAGIC 0x494e4f38
+
+/* A run of COUNT consecutive disk sectors starting at START,
+ * holding the file's sectors from FILE_SECTOR on. */
+struct extent {
+	uint32_t file_sector;               /* First file sector mapped. */
+	disk_sector_t start;                /* First disk sector. */
+	uint32_t count;                     /* Number of sectors. */
+};
+
+/* Extents held in the inode sector and in its overflow block. */
+#define INODE_EXTENTS 40
+#define OVERFLOW_EXTENTS 42
+#define MAX_EXTENTS (INODE_EXTENTS + OVERFLOW_EXTENTS)
+
+/* Bytes of data an inline inode holds in place of its extents. */
+#define INODE_INLINE_MAX (INODE_EXTENTS * sizeof (struct extent))
+
+/* Most free sectors a growing file keeps reserved past its end. */
+#define PREALLOC_SECTORS 64
+
+/* Data sectors a file may dirty in the buffer cache, an eighth of
+ * it, before its writer writes them back, so that one large writer
+ * leaves room for everyone else. */
+#define INODE_DIRTY_MAX 64
+
+/* Inode flags. */
+#define INODE_INLINE 0x1                /* Data is in the inode sector. */
+#define INODE_DIR 0x2                   /* Holds a directory. */
+#define INODE_SYMLINK 0x4               /* Symbolic link; data is its target. */
 
 /* On-disk inode.
- * Must be exactly DISK_SECTOR_SIZE bytes long. */
+ * Must be exactly DISK_SECTOR_SIZE bytes long.
+ *
+ * A file's data is described by a list of extents, sorted by
+ * file sector and covering it without gaps.  The first
+ * INODE_EXTENTS live here; more go in a single overflow block.
+ *
+ * A file of at most INODE_INLINE_MAX bytes, such as a small
+ * directory, is created "inline": its data takes the place of the
+ * extents, so it costs no sectors beyond the inode and is read
+ * along with it.  It moves out to a data sector of its own when
+ * it grows past that.
+ *
+ * The last word of the sector is a CRC-32C of the rest, checked
+ * whenever the inode is read in, so that a damaged inode is caught
+ * before its extents are believed.  The overflow block ends with
+ * one too. */
 struct inode_disk {
-	disk_sector_t start;                /* First data sector. */
 	off_t length;                       /* File size in bytes. */
 	unsigned magic;                     /* Magic number. */
-	uint32_t unused[125];               /* Not used. */
+	uint32_t extent_cnt;                /* Number of extents in use. */
+	disk_sector_t overflow;             /* Overflow extent block, or 0. */
+	union {
+		struct extent extents[INODE_EXTENTS];
+		uint8_t inline_data[INODE_INLINE_MAX];
+	};
+	uint32_t flags;                     /* INODE_* flags. */
+	uint32_t unused;                    /* Not used. */
+	uint32_t checksum;                  /* Of the bytes above. */
+};
+
+/* Overflow extent block.
+ * Must be exactly DISK_SECTOR_SIZE bytes long. */
+struct extent_block {
+	struct extent extents[OVERFLOW_EXTENTS];
+	uint32_t unused;                    /* Not used. */
+	uint32_t checksum;                  /* Of the bytes above. */
 };
 
+/* Returns the checksum of the metadata sector at SECTOR_, whose
+ * last word holds it. */
+static uint32_t
+sector_checksum (const void *sector_) {
+	return ~crc32c (~0u, sector_, DISK_SECTOR_SIZE - sizeof (uint32_t));
+}
+
+/* Returns true if the metadata sector at SECTOR_ matches its
+ * checksum. */
+static bool
+sector_verify (const void *sector_) {
+	const uint32_t *sector = sector_;
+
+	return sector[DISK_SECTOR_SIZE / sizeof *sector - 1]
+		== sector_checksum (sector_);
+}
+
 /* Returns the number of sectors to allocate for an inode SIZE
  * bytes long. */
 static inline size_t
@@ -26,37 +114,355 @@ bytes_to_sectors (off_t size) {
 	return DIV_ROUND_UP (size, DISK_SECTOR_SIZE);
 }
 
+/* Operations on an inode's contents, which are kept differently
+ * by each kind of inode: on disk (DISK_OPS) or in memory for tmpfs
+ * (MEM_OPS).  The public functions below dispatch through
+ * inode->ops; READAHEAD and FLUSH may be null. */
+struct inode_ops {
+	off_t (*read_at) (struct inode *, void *, off_t size, off_t offset);
+	off_t (*write_at) (struct inode *, const void *, off_t size,
+			off_t offset);
+	void (*readahead) (struct inode *, off_t offset, off_t size);
+	void (*flush) (struct inode *);
+	bool (*allocate) (struct inode *, off_t length);
+	void (*release) (struct inode *);   /* After the last close. */
+	bool linked;                        /* Held open by its name? */
+};
+
+static const struct inode_ops disk_ops;
+static const struct inode_ops mem_ops;
+
 /* In-memory inode. */
 struct inode {
-	struct list_elem elem;              /* Element in inode list. */
+	struct rculist_elem elem;           /* Element in open inode table. */
+	struct rcu_head rcu;                /* For freeing after lookups. */
 	disk_sector_t sector;               /* Sector number of disk location. */
 	int open_cnt;                       /* Number of openers. */
 	bool removed;                       /* True if deleted, false otherwise. */
 	int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+	uint64_t version;                   /* Bumped by every write. */
+	struct rwlock rw;                   /* Shared to read inline data,
+	                                       exclusive to grow or change
+	                                       metadata. */
+	struct rwlock dir_rw;               /* Protects a directory's entries. */
+	bool dirty;                         /* Length not yet in the cache? */
+	size_t dirty_sectors;               /* Data sectors written since the
+	                                       writer last wrote them back. */
+	disk_sector_t prealloc;             /* First reserved sector past the end. */
+	size_t prealloc_cnt;                /* Number of reserved sectors. */
+	const struct inode_ops *ops;        /* Operations on the contents. */
+	struct tmpfs_data *mem;             /* Data of an in-memory inode. */
+	struct mount *mount;                /* Mounted over this, or null. */
+	struct extent_block *overflow;      /* Overflow extents, or null. */
 	struct inode_disk data;             /* Inode content. */
 };
 
+/* Returns true if INODE's data is inline.  Only inode_promote()
+ * changes this, holding INODE's lock exclusively, from true to
+ * false. */
+static inline bool
+inode_is_inline (const struct inode *inode) {
+	return __atomic_load_n (&inode->data.flags, __ATOMIC_ACQUIRE)
+		& INODE_INLINE;
+}
+
+/* Returns extent IDX of INODE. */
+static struct extent *
+inode_extent (const struct inode *inode, size_t idx) {
+	ASSERT (idx < inode->data.extent_cnt);
+	if (idx < INODE_EXTENTS)
+		return (struct extent *) &inode->data.extents[idx];
+	return &inode->overflow->extents[idx - INODE_EXTENTS];
+}
+
+/* Returns the number of sectors INODE's extents map. */
+static size_t
+inode_capacity (const struct inode *inode) {
+	const struct extent *last;
+
+	if (inode->data.extent_cnt == 0)
+		return 0;
+	last = inode_extent (inode, inode->data.extent_cnt - 1);
+	return last->file_sector + last->count;
+}
+
 /* Returns the disk sector that contains byte offset POS within
  * INODE.
  * Returns -1 if INODE does not contain data for a byte at offset
  * POS. */
 static disk_sector_t
 byte_to_sector (const struct inode *inode, off_t pos) {
+	uint32_t file_sector;
+	size_t lo, hi;
+
 	ASSERT (inode != NULL);
-	if (pos < inode->data.length)
-		return inode->data.start + pos / DISK_SECTOR_SIZE;
-	else
+	if (pos >= inode->data.length)
 		return -1;
+
+	/* Binary search for the last extent starting at or before
+	 * FILE_SECTOR.  The extents cover the file without gaps. */
+	file_sector = pos / DISK_SECTOR_SIZE;
+	lo = 0;
+	hi = inode->data.extent_cnt;
+	while (hi - lo > 1) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (inode_extent (inode, mid)->file_sector <= file_sector)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	ASSERT (file_sector - inode_extent (inode, lo)->file_sector
+			< inode_extent (inode, lo)->count);
+	return inode_extent (inode, lo)->start
+		+ (file_sector - inode_extent (inode, lo)->file_sector);
+}
+
+/* Writes INODE's inode sector and overflow block to the cache,
+ * as part of the running journal operation if there is one. */
+static void
+inode_write_disk (struct inode *inode) {
+	inode->data.checksum = sector_checksum (&inode->data);
+	journal_write (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+	if (inode->overflow != NULL) {
+		inode->overflow->checksum = sector_checksum (inode->overflow);
+		journal_write (inode->data.overflow, inode->overflow, 0,
+				DISK_SECTOR_SIZE);
+	}
+}
+
+/* Writes INODE to the cache if its length has changed since it
+ * was last written there.  INODE's lock must be held exclusively, or
+ * INODE must have no other users. */
+static void
+inode_sync (struct inode *inode) {
+	if (inode->dirty) {
+		inode->dirty = false;
+		inode_write_disk (inode);
+	}
+}
+
+/* Appends the COUNT sectors at START to INODE's extents, merging
+ * with the last extent when they are adjacent on disk.  Returns
+ * false if INODE has no room for another extent. */
+static bool
+inode_add_extent (struct inode *inode, disk_sector_t start, size_t count) {
+	uint32_t file_sector = inode_capacity (inode);
+	struct extent *e;
+
+	if (inode->data.extent_cnt > 0) {
+		e = inode_extent (inode, inode->data.extent_cnt - 1);
+		if (e->start + e->count == start) {
+			e->count += count;
+			return true;
+		}
+	}
+
+	if (inode->data.extent_cnt == MAX_EXTENTS)
+		return false;
+	if (inode->data.extent_cnt == INODE_EXTENTS && inode->overflow == NULL) {
+		inode->overflow = calloc_tagged (1, sizeof *inode->overflow, TAG_INODE);
+		if (inode->overflow == NULL)
+			return false;
+		if (!free_map_allocate (1, &inode->data.overflow)) {
+			free (inode->overflow);
+			inode->overflow = NULL;
+			return false;
+		}
+	}
+
+	e = inode_extent (inode, inode->data.extent_cnt++);
+	e->file_sector = file_sector;
+	e->start = start;
+	e->count = count;
+	return true;
 }
 
-/* List of open inodes, so that opening a single inode twice
- * returns the same `struct inode'. */
-static struct list open_inodes;
+/* Allocates and zeroes disk sectors so that INODE's extents
+ * cover LENGTH bytes.  Sectors INODE has reserved come first.
+ * Each other run of sectors is taken right after the last extent
+ * if possible, so the file stays contiguous, and otherwise
+ * wherever the largest run that fits can be found.  Returns false
+ * if the disk or INODE's extent list fills up, in which case some
+ * sectors may have been added anyway. */
+static bool
+inode_grow (struct inode *inode, off_t length) {
+	static char zeros[DISK_SECTOR_SIZE];
+	size_t capacity = inode_capacity (inode);
+	size_t need = bytes_to_sectors (length);
+
+	while (capacity < need) {
+		size_t chunk, i;
+		disk_sector_t start = 0;
+
+		/* The reservation starts right after the last extent, so
+		 * this merges with it. */
+		if (inode->prealloc_cnt > 0) {
+			chunk = need - capacity < inode->prealloc_cnt
+				? need - capacity : inode->prealloc_cnt;
+			start = inode->prealloc;
+			inode->prealloc += chunk;
+			inode->prealloc_cnt -= chunk;
+			inode_add_extent (inode, start, chunk);
+			for (i = 0; i < chunk; i++)
+				page_cache_write (start + i, zeros, 0, DISK_SECTOR_SIZE);
+			capacity += chunk;
+			continue;
+		}
+
+		for (chunk = need - capacity; chunk > 0; chunk /= 2) {
+			if (inode->data.extent_cnt > 0) {
+				struct extent *last
+					= inode_extent (inode, inode->data.extent_cnt - 1);
+				start = last->start + last->count;
+				if (free_map_allocate_at (start, chunk))
+					break;
+			}
+			if (free_map_allocate (chunk, &start))
+				break;
+		}
+		if (chunk == 0)
+			return false;
+		if (!inode_add_extent (inode, start, chunk)) {
+			free_map_release (start, chunk);
+			return false;
+		}
+		for (i = 0; i < chunk; i++)
+			page_cache_write (start + i, zeros, 0, DISK_SECTOR_SIZE);
+		capacity += chunk;
+	}
+	return true;
+}
+
+/* Reserves up to PREALLOC_SECTORS free sectors right after
+ * INODE's last extent, unless it has some reserved already, so
+ * that the next appends extend the file in place even while other
+ * files grow at the same time.  The reservation is returned to the
+ * free map on the last close.  INODE's lock must be held
+ * exclusively. */
+static void
+inode_reserve (struct inode *inode) {
+	struct extent *last;
+	size_t cnt;
+
+	if (inode->prealloc_cnt > 0 || inode->data.extent_cnt == 0)
+		return;
+	last = inode_extent (inode, inode->data.extent_cnt - 1);
+	for (cnt = PREALLOC_SECTORS; cnt > 0; cnt /= 2)
+		if (free_map_allocate_at (last->start + last->count, cnt)) {
+			inode->prealloc = last->start + last->count;
+			inode->prealloc_cnt = cnt;
+			return;
+		}
+}
+
+/* Moves the data of inline INODE out to a data sector of its
+ * own, so that it can grow past INODE_INLINE_MAX bytes.  INODE's
+ * lock must be held exclusively.  Returns false if the disk is full. */
+static bool
+inode_promote (struct inode *inode) {
+	uint8_t data[DISK_SECTOR_SIZE];
+	disk_sector_t sector;
+
+	if (!free_map_allocate (1, &sector))
+		return false;
+	memset (data, 0, sizeof data);
+	memcpy (data, inode->data.inline_data, inode->data.length);
+	page_cache_write (sector, data, 0, DISK_SECTOR_SIZE);
+
+	/* Readers that find the flag clear look at the extents, so fill
+	 * them in first. */
+	memset (inode->data.extents, 0, sizeof inode->data.extents);
+	inode_add_extent (inode, sector, 1);
+	__atomic_store_n (&inode->data.flags, inode->data.flags & ~INODE_INLINE,
+			__ATOMIC_RELEASE);
+	return true;
+}
+
+/* Returns all of INODE's data sectors and its overflow block to
+ * the free map. */
+static void
+inode_release_sectors (struct inode *inode) {
+	size_t i;
+
+	for (i = 0; i < inode->data.extent_cnt; i++)
+		free_map_release (inode_extent (inode, i)->start,
+				inode_extent (inode, i)->count);
+	if (inode->overflow != NULL)
+		free_map_release (inode->data.overflow, 1);
+}
+
+/* Table of open inodes, keyed by sector, so that opening a
+ * single inode twice returns the same `struct inode'.
+ *
+ * Opening an inode that is already open takes no lock: the bucket
+ * is searched under rcu_read_lock(), and the inode's open_cnt is
+ * raised atomically unless it has dropped to 0.  Adding and
+ * removing inodes is serialized by the lock, and an inode that has
+ * been removed is freed only after a grace period (see
+ * threads/rcu.h).  An open_cnt reaches 0 only under the lock, at
+ * the moment its inode leaves the table. */
+#define OPEN_INODE_BUCKETS 64
+static struct rculist open_inodes[OPEN_INODE_BUCKETS];
+static struct lock open_inodes_lock;
+
+/* Cache of in-memory inodes. */
+static struct kmem_cache *inode_cache;
 
 /* Initializes the inode module. */
 void
 inode_init (void) {
-	list_init (&open_inodes);
+	size_t i;
+
+	for (i = 0; i < OPEN_INODE_BUCKETS; i++)
+		rculist_init (&open_inodes[i]);
+	lock_init (&open_inodes_lock);
+	inode_cache = kmem_cache_create ("inode", sizeof (struct inode), 0, NULL);
+}
+
+/* Returns the bucket of open_inodes for SECTOR. */
+static struct rculist *
+open_inodes_bucket (disk_sector_t sector) {
+	return &open_inodes[hash_int (sector) % OPEN_INODE_BUCKETS];
+}
+
+/* Returns the open inode for SECTOR, or a null pointer.  Must be
+ * called with OPEN_INODES_LOCK held or in an RCU read-side critical
+ * section. */
+static struct inode *
+open_inodes_find (disk_sector_t sector) {
+	struct rculist_elem *e;
+
+	for (e = rculist_first (open_inodes_bucket (sector)); e != NULL;
+			e = rculist_next (e)) {
+		struct inode *inode = rculist_entry (e, struct inode, elem);
+
+		if (inode->sector == sector)
+			return inode;
+	}
+	return NULL;
+}
+
+/* Raises INODE's open count, unless it has dropped to 0, and
+ * returns true if it did. */
+static bool
+open_cnt_get (struct inode *inode) {
+	int cnt = __atomic_load_n (&inode->open_cnt, __ATOMIC_RELAXED);
+
+	while (cnt > 0)
+		if (__atomic_compare_exchange_n (&inode->open_cnt, &cnt, cnt + 1,
+					false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			return true;
+	return false;
+}
+
+/* Frees an inode once no lookup can see it. */
+static void
+inode_free (struct rcu_head *rcu) {
+	struct inode *inode = (struct inode *) ((uint8_t *) rcu
+			- offsetof (struct inode, rcu));
+
+	free (inode->overflow);
+	kmem_cache_free (inode_cache, inode);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -65,33 +471,38 @@ inode_init (void) {
  * Returns true if successful.
  * Returns false if memory or disk allocation fails. */
 bool
-inode_create (disk_sector_t sector, off_t length) {
-	struct inode_disk *disk_inode = NULL;
+inode_create (disk_sector_t sector, off_t length, bool is_dir) {
+	struct inode *inode;
 	bool success = false;
 
 	ASSERT (length >= 0);
 
-	/* If this assertion fails, the inode structure is not exactly
-	 * one sector in size, and you should fix that. */
-	ASSERT (sizeof *disk_inode == DISK_SECTOR_SIZE);
-
-	disk_inode = calloc (1, sizeof *disk_inode);
-	if (disk_inode != NULL) {
-		size_t sectors = bytes_to_sectors (length);
-		disk_inode->length = length;
-		disk_inode->magic = INODE_MAGIC;
-		if (free_map_allocate (sectors, &disk_inode->start)) {
-			disk_write (filesys_disk, sector, disk_inode);
-			if (sectors > 0) {
-				static char zeros[DISK_SECTOR_SIZE];
-				size_t i;
-
-				for (i = 0; i < sectors; i++) 
-					disk_write (filesys_disk, disk_inode->start + i, zeros); 
-			}
-			success = true; 
-		} 
-		free (disk_inode);
+	/* If these assertions fail, the inode structure or the
+	 * overflow block is not exactly one sector in size, and you
+	 * should fix that. */
+	ASSERT (sizeof inode->data == DISK_SECTOR_SIZE);
+	ASSERT (sizeof *inode->overflow == DISK_SECTOR_SIZE);
+
+	/* Build the inode in a scratch in-memory inode, so the growth
+	 * code can be shared with inode_write_at(). */
+	inode = calloc_tagged (1, sizeof *inode, TAG_INODE);
+	if (inode != NULL) {
+		inode->sector = sector;
+		inode->data.magic = INODE_MAGIC;
+		inode->data.flags = is_dir ? INODE_DIR : 0;
+		if (length <= (off_t) INODE_INLINE_MAX) {
+			inode->data.flags |= INODE_INLINE;
+			inode->data.length = length;
+			inode_write_disk (inode);
+			success = true;
+		} else if (inode_grow (inode, length)) {
+			inode->data.length = length;
+			inode_write_disk (inode);
+			success = true;
+		} else
+			inode_release_sectors (inode);
+		free (inode->overflow);
+		free (inode);
 	}
 	return success;
 }
@@ -101,31 +512,128 @@ inode_create (disk_sector_t sector, off_t length) {
  * Returns a null pointer if memory allocation fails. */
 struct inode *
 inode_open (disk_sector_t sector) {
-	struct list_elem *e;
 	struct inode *inode;
 
-	/* Check whether this inode is already open. */
-	for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-			e = list_next (e)) {
-		inode = list_entry (e, struct inode, elem);
-		if (inode->sector == sector) {
-			inode_reopen (inode);
-			return inode; 
-		}
+	/* Check whether this inode is already open, without the lock. */
+	rcu_read_lock ();
+	inode = open_inodes_find (sector);
+	if (inode != NULL && !open_cnt_get (inode))
+		inode = NULL;
+	rcu_read_unlock ();
+	if (inode != NULL)
+		return inode;
+
+	/* Check again under the lock, which an opener holds while it
+	 * reads the inode in. */
+	lock_acquire (&open_inodes_lock);
+	inode = open_inodes_find (sector);
+	if (inode != NULL) {
+		__atomic_add_fetch (&inode->open_cnt, 1, __ATOMIC_RELAXED);
+		lock_release (&open_inodes_lock);
+		return inode;
+	}
+
+	/* An in-memory inode that is not open does not exist. */
+	if (sector >= TMPFS_INUMBER_BASE) {
+		lock_release (&open_inodes_lock);
+		return NULL;
 	}
 
 	/* Allocate memory. */
-	inode = malloc (sizeof *inode);
-	if (inode == NULL)
+	inode = kmem_cache_alloc (inode_cache);
+	if (inode == NULL) {
+		lock_release (&open_inodes_lock);
 		return NULL;
+	}
 
-	/* Initialize. */
-	list_push_front (&open_inodes, &inode->elem);
+	/* Initialize.  The lock stays held across the read so that a
+	 * concurrent opener of the same sector cannot see the inode
+	 * before its data arrives. */
 	inode->sector = sector;
 	inode->open_cnt = 1;
 	inode->deny_write_cnt = 0;
+	inode->version = 0;
+	inode->removed = false;
+	inode->dirty = false;
+	inode->dirty_sectors = 0;
+	inode->prealloc_cnt = 0;
+	inode->ops = &disk_ops;
+	inode->mem = NULL;
+	inode->mount = NULL;
+	inode->overflow = NULL;
+	rwlock_init (&inode->rw);
+	rwlock_init (&inode->dir_rw);
+	page_cache_read_tagged (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE,
+			DISK_SRC_META);
+	if (!sector_verify (&inode->data))
+		goto damaged;
+	if (inode->data.overflow != 0) {
+		inode->overflow = malloc_tagged (sizeof *inode->overflow, TAG_INODE);
+		if (inode->overflow == NULL) {
+			kmem_cache_free (inode_cache, inode);
+			lock_release (&open_inodes_lock);
+			return NULL;
+		}
+		page_cache_read_tagged (inode->data.overflow, inode->overflow, 0,
+				DISK_SECTOR_SIZE, DISK_SRC_META);
+		if (!sector_verify (inode->overflow))
+			goto damaged;
+	}
+	rculist_push_front (open_inodes_bucket (sector), &inode->elem);
+	lock_release (&open_inodes_lock);
+	return inode;
+
+damaged:
+	/* Rather than trust extents that may point anywhere, refuse
+	 * the inode and leave it to fsck. */
+	printf ("inode %"PRDSNu": bad checksum\n", sector);
+	free (inode->overflow);
+	kmem_cache_free (inode_cache, inode);
+	lock_release (&open_inodes_lock);
+	return NULL;
+}
+
+/* Creates an in-memory inode numbered INUMBER, at least
+ * TMPFS_INUMBER_BASE, holding LENGTH bytes of zeros, for tmpfs.
+ * Returns it open, or a null pointer if memory is short.  The
+ * inode lasts until that reference is dropped, by inode_remove()
+ * or inode_close(), and any others are closed. */
+struct inode *
+inode_create_mem (disk_sector_t inumber, off_t length, bool is_dir) {
+	struct inode *inode;
+
+	ASSERT (inumber >= TMPFS_INUMBER_BASE);
+	ASSERT (length >= 0);
+
+	inode = kmem_cache_alloc (inode_cache);
+	if (inode == NULL)
+		return NULL;
+	inode->mem = tmpfs_data_create ();
+	if (inode->mem == NULL) {
+		kmem_cache_free (inode_cache, inode);
+		return NULL;
+	}
+	inode->ops = &mem_ops;
+	inode->mount = NULL;
+	inode->sector = inumber;
+	inode->open_cnt = 1;
+	inode->deny_write_cnt = 0;
+	inode->version = 0;
 	inode->removed = false;
-	disk_read (filesys_disk, inode->sector, &inode->data);
+	inode->dirty = false;
+	inode->dirty_sectors = 0;
+	inode->prealloc_cnt = 0;
+	inode->overflow = NULL;
+	rwlock_init (&inode->rw);
+	rwlock_init (&inode->dir_rw);
+	memset (&inode->data, 0, sizeof inode->data);
+	inode->data.magic = INODE_MAGIC;
+	inode->data.length = length;
+	inode->data.flags = is_dir ? INODE_DIR : 0;
+
+	lock_acquire (&open_inodes_lock);
+	rculist_push_front (open_inodes_bucket (inumber), &inode->elem);
+	lock_release (&open_inodes_lock);
 	return inode;
 }
 
@@ -133,7 +641,7 @@ inode_open (disk_sector_t sector) {
 struct inode *
 inode_reopen (struct inode *inode) {
 	if (inode != NULL)
-		inode->open_cnt++;
+		__atomic_add_fetch (&inode->open_cnt, 1, __ATOMIC_RELAXED);
 	return inode;
 }
 
@@ -153,37 +661,97 @@ inode_close (struct inode *inode) {
 		return;
 
 	/* Release resources if this was the last opener. */
-	if (--inode->open_cnt == 0) {
-		/* Remove from inode list and release lock. */
-		list_remove (&inode->elem);
+	lock_acquire (&open_inodes_lock);
+	if (__atomic_sub_fetch (&inode->open_cnt, 1, __ATOMIC_RELEASE) > 0) {
+		lock_release (&open_inodes_lock);
+		return;
+	}
 
-		/* Deallocate blocks if removed. */
-		if (inode->removed) {
-			free_map_release (inode->sector, 1);
-			free_map_release (inode->data.start,
-					bytes_to_sectors (inode->data.length)); 
-		}
+	/* Remove from inode table and release lock. */
+	rculist_remove (&inode->elem);
+	lock_release (&open_inodes_lock);
 
-		free (inode); 
-	}
+	inode->ops->release (inode);
+	call_rcu (&inode->rcu, inode_free);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
- * has it open. */
+ * has it open.  For an inode held open by its name, such as an
+ * in-memory one, also drops that reference, which must not be the
+ * caller's own. */
 void
 inode_remove (struct inode *inode) {
 	ASSERT (inode != NULL);
-	inode->removed = true;
+	if (!__atomic_exchange_n (&inode->removed, true, __ATOMIC_RELAXED)
+			&& inode->ops->linked)
+		inode_close (inode);
 }
 
-/* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
- * Returns the number of bytes actually read, which may be less
- * than SIZE if an error occurs or end of file is reached. */
-off_t
-inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
+/* Returns what is mounted over INODE, or a null pointer. */
+struct mount *
+inode_get_mount (const struct inode *inode) {
+	return __atomic_load_n (&inode->mount, __ATOMIC_ACQUIRE);
+}
+
+/* Records MOUNT, or a null pointer, as mounted over INODE, which
+ * the mount must keep open. */
+void
+inode_set_mount (struct inode *inode, struct mount *mount) {
+	__atomic_store_n (&inode->mount, mount, __ATOMIC_RELEASE);
+}
+
+/* Reads up to SIZE bytes at OFFSET of inline INODE into BUFFER
+ * and stores the number read in *READ.  Returns false, having
+ * read nothing, if INODE has stopped being inline. */
+static bool
+inline_read (struct inode *inode, void *buffer, off_t size, off_t offset,
+		off_t *read) {
+	bool done = false;
+
+	rw_read_acquire (&inode->rw);
+	if (inode_is_inline (inode)) {
+		off_t left = inode->data.length - offset;
+
+		*read = left <= 0 ? 0 : size < left ? size : left;
+		memcpy (buffer, inode->data.inline_data + offset, *read);
+		done = true;
+	}
+	rw_read_release (&inode->rw);
+	return done;
+}
+
+/* Writes SIZE bytes from BUFFER at OFFSET into the inode sector of
+ * inline INODE, extending it if need be.  Returns false, having
+ * written nothing, if INODE has stopped being inline or the write
+ * does not fit. */
+static bool
+inline_write (struct inode *inode, const void *buffer, off_t size,
+		off_t offset) {
+	bool done = false;
+
+	rw_write_acquire (&inode->rw);
+	if (inode_is_inline (inode) && offset + size <= (off_t) INODE_INLINE_MAX) {
+		memcpy (inode->data.inline_data + offset, buffer, size);
+		if (offset + size > inode->data.length)
+			inode->data.length = offset + size;
+		inode->dirty = false;
+		inode_write_disk (inode);
+		done = true;
+	}
+	rw_write_release (&inode->rw);
+	return done;
+}
+
+/* Reads SIZE bytes from disk inode INODE into BUFFER, starting at
+ * position OFFSET.  Returns the number of bytes actually read. */
+static off_t
+disk_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 	uint8_t *buffer = buffer_;
 	off_t bytes_read = 0;
-	uint8_t *bounce = NULL;
+
+	if (inode_is_inline (inode)
+			&& inline_read (inode, buffer, size, offset, &bytes_read))
+		return bytes_read;
 
 	while (size > 0) {
 		/* Disk sector to read, starting byte offset within sector. */
@@ -200,45 +768,167 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 		if (chunk_size <= 0)
 			break;
 
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Read full sector directly into caller's buffer. */
-			disk_read (filesys_disk, sector_idx, buffer + bytes_read); 
-		} else {
-			/* Read sector into bounce buffer, then partially copy
-			 * into caller's buffer. */
-			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
-				if (bounce == NULL)
-					break;
-			}
-			disk_read (filesys_disk, sector_idx, bounce);
-			memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-		}
+		/* Copy out of the buffer cache. */
+		page_cache_read (sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
 
 		/* Advance. */
 		size -= chunk_size;
 		offset += chunk_size;
 		bytes_read += chunk_size;
 	}
-	free (bounce);
 
 	return bytes_read;
 }
 
-/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
- * Returns the number of bytes actually written, which may be
- * less than SIZE if end of file is reached or an error occurs.
- * (Normally a write at end of file would extend the inode, but
- * growth is not yet implemented.) */
-off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+/* Asks the buffer cache to fetch, in the background, the sectors
+ * holding the SIZE bytes of disk inode INODE starting at OFFSET, as
+ * far as the end of the file. */
+static void
+disk_readahead (struct inode *inode, off_t offset, off_t size) {
+	off_t end = offset + size;
+
+	if (inode_is_inline (inode))
+		return;
+	if (end > inode_length (inode))
+		end = inode_length (inode);
+	offset -= offset % DISK_SECTOR_SIZE;
+	for (; offset < end; offset += DISK_SECTOR_SIZE)
+		page_cache_prefetch (byte_to_sector (inode, offset));
+}
+
+/* Writes the lengths of open inodes that have grown since they
+ * were last written to the cache, in one journal operation.
+ * Called periodically by the buffer cache's writeback thread.
+ * Inodes that are growing right now are left for next time. */
+void
+inode_writeback (void) {
+	size_t i;
+
+	journal_begin ();
+	lock_acquire (&open_inodes_lock);
+	for (i = 0; i < OPEN_INODE_BUCKETS; i++) {
+		struct rculist_elem *e;
+
+		for (e = rculist_first (&open_inodes[i]); e != NULL;
+				e = rculist_next (e)) {
+			struct inode *inode = rculist_entry (e, struct inode, elem);
+
+			if (inode->dirty && rw_write_try_acquire (&inode->rw)) {
+				inode_sync (inode);
+				rw_write_release (&inode->rw);
+			}
+		}
+	}
+	lock_release (&open_inodes_lock);
+	journal_end ();
+}
+
+/* Writes disk inode INODE's cached data and its on-disk inode to
+ * disk, and through the disk's write cache to the medium. */
+static void
+disk_flush (struct inode *inode) {
+	size_t i;
+
+	journal_begin ();
+	rw_write_acquire (&inode->rw);
+	inode_sync (inode);
+	rw_write_release (&inode->rw);
+	journal_end ();
+
+	/* Let the cache write the metadata it holds for the journal. */
+	journal_commit ();
+	page_cache_flush_range (inode->sector, 1);
+	if (inode->overflow != NULL)
+		page_cache_flush_range (inode->data.overflow, 1);
+	for (i = 0; i < inode->data.extent_cnt; i++)
+		page_cache_flush_range (inode_extent (inode, i)->start,
+				inode_extent (inode, i)->count);
+	disk_flush_cache (filesys_disk);
+}
+
+/* Called after a write dirtied SECTORS data sectors of disk inode
+ * INODE.  Once INODE_DIRTY_MAX have built up, writes INODE's data
+ * back, and in any case lets the buffer cache throttle the writer
+ * if it is too dirty overall.  Directories are left alone: their
+ * writes are metadata, held in the cache by the journal. */
+static void
+disk_throttle (struct inode *inode, size_t sectors) {
+	size_t i;
+
+	if (inode_is_dir (inode))
+		return;
+	if (atomic_fetch_add (&inode->dirty_sectors, sectors) + sectors
+			>= INODE_DIRTY_MAX) {
+		atomic_store (&inode->dirty_sectors, 0);
+		rw_read_acquire (&inode->rw);
+		for (i = 0; i < inode->data.extent_cnt; i++)
+			page_cache_flush_range (inode_extent (inode, i)->start,
+					inode_extent (inode, i)->count);
+		rw_read_release (&inode->rw);
+	}
+	page_cache_balance ();
+}
+
+/* Extends disk inode INODE to LENGTH bytes, as far as disk space
+ * and the extent list allow, in a journal operation of its own. */
+static void
+disk_extend (struct inode *inode, off_t length) {
+	journal_begin ();
+	rw_write_acquire (&inode->rw);
+	if (length > inode->data.length) {
+		size_t capacity = inode_capacity (inode);
+
+		/* Too big to stay inline?  On failure, grow only as far as
+		 * sectors were found. */
+		if (inode_is_inline (inode) && length > (off_t) INODE_INLINE_MAX
+				&& !inode_promote (inode))
+			length = inode->data.length;
+		else if (!inode_is_inline (inode)) {
+			if (!inode_grow (inode, length)
+					&& length > (off_t) inode_capacity (inode) * DISK_SECTOR_SIZE)
+				length = inode_capacity (inode) * DISK_SECTOR_SIZE;
+			inode_reserve (inode);
+		}
+		if (length > inode->data.length) {
+			inode->data.length = length;
+
+			/* New extents must reach the cache in this operation,
+			 * since the free map already has them.  A longer length
+			 * alone can wait, so that an append stream writes the
+			 * inode once rather than once per write. */
+			if (inode_capacity (inode) != capacity) {
+				inode->dirty = false;
+				inode_write_disk (inode);
+			} else
+				inode->dirty = true;
+		}
+	}
+	rw_write_release (&inode->rw);
+	journal_end ();
+}
+
+/* Writes SIZE bytes from BUFFER into disk inode INODE, starting at
+ * OFFSET.  A write past end of file extends the inode, as far as
+ * disk space and the extent list allow, in a journal operation of
+ * its own.  Writes made within an operation are to directories and
+ * the free map, so they are journaled as metadata too. */
+static off_t
+disk_write_at (struct inode *inode, const void *buffer_, off_t size,
 		off_t offset) {
 	const uint8_t *buffer = buffer_;
 	off_t bytes_written = 0;
-	uint8_t *bounce = NULL;
+	size_t sectors = 0;
 
-	if (inode->deny_write_cnt)
-		return 0;
+	if (inode_is_inline (inode) && inline_write (inode, buffer, size, offset))
+		return size;
+
+	if (offset + size > inode_length (inode)) {
+		disk_extend (inode, offset + size);
+
+		/* Still inline only if the disk is full. */
+		if (inode_is_inline (inode))
+			return 0;
+	}
 
 	while (size > 0) {
 		/* Sector to write, starting byte offset within sector. */
@@ -255,38 +945,185 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		if (chunk_size <= 0)
 			break;
 
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Write full sector directly to disk. */
-			disk_write (filesys_disk, sector_idx, buffer + bytes_written); 
-		} else {
-			/* We need a bounce buffer. */
-			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
-				if (bounce == NULL)
-					break;
-			}
-
-			/* If the sector contains data before or after the chunk
-			   we're writing, then we need to read in the sector
-			   first.  Otherwise we start with a sector of all zeros. */
-			if (sector_ofs > 0 || chunk_size < sector_left) 
-				disk_read (filesys_disk, sector_idx, bounce);
-			else
-				memset (bounce, 0, DISK_SECTOR_SIZE);
-			memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-			disk_write (filesys_disk, sector_idx, bounce); 
-		}
+		/* Copy into the buffer cache, which reads the rest of the
+		   sector first if this is a partial write. */
+		journal_write (sector_idx, buffer + bytes_written, sector_ofs,
+				chunk_size);
+		sectors++;
 
 		/* Advance. */
 		size -= chunk_size;
 		offset += chunk_size;
 		bytes_written += chunk_size;
 	}
-	free (bounce);
 
+	if (sectors > 0)
+		disk_throttle (inode, sectors);
 	return bytes_written;
 }
 
+/* Makes sure disk inode INODE covers LENGTH bytes, extending it
+ * with zeros if need be.  Returns false if the disk or INODE's
+ * extent list filled up first. */
+static bool
+disk_allocate (struct inode *inode, off_t length) {
+	disk_extend (inode, length);
+	return inode_length (inode) >= length;
+}
+
+/* Frees the sectors of disk inode INODE, after its last close, if
+ * it was removed, or else writes out its length if that is still
+ * pending.  Either way, gives back the sectors it has reserved. */
+static void
+disk_release (struct inode *inode) {
+	if (inode->removed || inode->dirty || inode->prealloc_cnt > 0) {
+		journal_begin ();
+		if (inode->prealloc_cnt > 0)
+			free_map_release (inode->prealloc, inode->prealloc_cnt);
+		if (inode->removed) {
+			free_map_release (inode->sector, 1);
+			inode_release_sectors (inode);
+		} else
+			inode_sync (inode);
+		journal_end ();
+	}
+}
+
+static const struct inode_ops disk_ops = {
+	.read_at = disk_read_at,
+	.write_at = disk_write_at,
+	.readahead = disk_readahead,
+	.flush = disk_flush,
+	.allocate = disk_allocate,
+	.release = disk_release,
+	.linked = false,
+};
+
+/* Reads SIZE bytes at OFFSET of in-memory INODE into BUFFER. */
+static off_t
+mem_read_at (struct inode *inode, void *buffer, off_t size, off_t offset) {
+	return tmpfs_read (inode->mem, buffer, size, offset, inode_length (inode));
+}
+
+/* Writes SIZE bytes from BUFFER into in-memory INODE at OFFSET,
+ * extending it if need be. */
+static off_t
+mem_write_at (struct inode *inode, const void *buffer, off_t size,
+		off_t offset) {
+	off_t bytes_written;
+
+	rw_write_acquire (&inode->rw);
+	bytes_written = tmpfs_write (inode->mem, buffer, size, offset);
+	if (offset + bytes_written > inode->data.length)
+		inode->data.length = offset + bytes_written;
+	rw_write_release (&inode->rw);
+	return bytes_written;
+}
+
+/* Extends in-memory INODE to LENGTH bytes.  Its data is sparse, so
+ * this takes no pages. */
+static bool
+mem_allocate (struct inode *inode, off_t length) {
+	rw_write_acquire (&inode->rw);
+	if (length > inode->data.length)
+		inode->data.length = length;
+	rw_write_release (&inode->rw);
+	return true;
+}
+
+/* Frees the data of in-memory INODE, after its last close, which
+ * comes only once it is removed or was never linked. */
+static void
+mem_release (struct inode *inode) {
+	tmpfs_data_destroy (inode->mem);
+}
+
+static const struct inode_ops mem_ops = {
+	.read_at = mem_read_at,
+	.write_at = mem_write_at,
+	.allocate = mem_allocate,
+	.release = mem_release,
+	.linked = true,
+};
+
+/* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
+ * Returns the number of bytes actually read, which may be less
+ * than SIZE if an error occurs or end of file is reached. */
+off_t
+inode_read_at (struct inode *inode, void *buffer, off_t size, off_t offset) {
+	return inode->ops->read_at (inode, buffer, size, offset);
+}
+
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+ * Returns the number of bytes actually written, which may be
+ * less than SIZE if an error occurs.  A write past end of file
+ * extends the inode. */
+off_t
+inode_write_at (struct inode *inode, const void *buffer, off_t size,
+		off_t offset) {
+	off_t bytes_written;
+
+	if (inode->deny_write_cnt)
+		return 0;
+	bytes_written = inode->ops->write_at (inode, buffer, size, offset);
+
+	/* Only once the data is in, so that whoever saw the old version
+	 * before reading the file knows the contents may have changed. */
+	if (bytes_written > 0)
+		inode->version++;
+	return bytes_written;
+}
+
+/* Makes sure INODE has space for its first LENGTH bytes,
+ * extending it with zeros if it is shorter, so that writes there
+ * need not allocate.  Returns false if writes to INODE are denied
+ * or space ran out first, in which case INODE may have grown
+ * partway. */
+bool
+inode_allocate (struct inode *inode, off_t length) {
+	off_t old_length = inode_length (inode);
+	bool success;
+
+	if (inode->deny_write_cnt)
+		return false;
+	success = inode->ops->allocate (inode, length);
+	if (inode_length (inode) != old_length)
+		inode->version++;
+	return success;
+}
+
+/* Asks for the SIZE bytes of INODE starting at OFFSET, as far as
+ * the end of the file, to be fetched in the background. */
+void
+inode_readahead (struct inode *inode, off_t offset, off_t size) {
+	if (inode->ops->readahead != NULL)
+		inode->ops->readahead (inode, offset, size);
+}
+
+/* Asks for the disk inode at SECTOR, named by a directory entry
+ * that a listing is about to reach, to be read into the buffer
+ * cache in the background, so that opening it does not wait on the
+ * disk.  Does nothing if it is open already or lives in memory. */
+void
+inode_prefetch (disk_sector_t sector) {
+	bool open;
+
+	if (sector >= TMPFS_INUMBER_BASE)
+		return;
+	rcu_read_lock ();
+	open = open_inodes_find (sector) != NULL;
+	rcu_read_unlock ();
+	if (!open)
+		page_cache_prefetch (sector);
+}
+
+/* Writes INODE's data and metadata to disk, if it lives there. */
+void
+inode_flush (struct inode *inode) {
+	if (inode->ops->flush != NULL)
+		inode->ops->flush (inode);
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 	void
@@ -306,8 +1143,155 @@ inode_allow_write (struct inode *inode) {
 	inode->deny_write_cnt--;
 }
 
+/* Returns true if INODE has been removed. */
+bool
+inode_is_removed (const struct inode *inode) {
+	return inode->removed;
+}
+
+/* Returns true if INODE holds a directory. */
+bool
+inode_is_dir (const struct inode *inode) {
+	return inode->data.flags & INODE_DIR;
+}
+
+/* Returns true if INODE is a symbolic link. */
+bool
+inode_is_symlink (const struct inode *inode) {
+	return inode->data.flags & INODE_SYMLINK;
+}
+
+/* Turns INODE, a new, empty file, into a symbolic link to TARGET,
+ * which is stored inline, so that reading a link costs no more than
+ * reading its inode.  Returns false if TARGET does not fit or the
+ * write fails. */
+bool
+inode_make_symlink (struct inode *inode, const char *target) {
+	off_t len = strlen (target);
+
+	ASSERT (SYMLINK_MAX_LEN <= INODE_INLINE_MAX);
+	if (len == 0 || len > SYMLINK_MAX_LEN || inode_length (inode) != 0
+			|| inode_write_at (inode, target, len, 0) != len)
+		return false;
+
+	rw_write_acquire (&inode->rw);
+	__atomic_or_fetch (&inode->data.flags, INODE_SYMLINK, __ATOMIC_RELEASE);
+	if (inode->ops == &disk_ops) {
+		inode->dirty = false;
+		inode_write_disk (inode);
+	}
+	rw_write_release (&inode->rw);
+	return true;
+}
+
+/* Returns INODE's version, which changes whenever a write to INODE
+ * completes.  Callers that keep something derived from the contents
+ * of an open inode can compare versions to tell whether it is still
+ * current. */
+uint64_t
+inode_version (const struct inode *inode) {
+	return inode->version;
+}
+
 /* Returns the length, in bytes, of INODE's data. */
 off_t
 inode_length (const struct inode *inode) {
 	return inode->data.length;
 }
+
+/* Returns the lock that protects the entries of directory INODE:
+ * shared to look names up or read the directory, exclusive to add
+ * or remove them.  It is apart from INODE's own lock, which the
+ * writes of an entry take in turn. */
+struct rwlock *
+inode_dir_lock (struct inode *inode) {
+	return &inode->dir_rw;
+}
+
+/* Marks the CNT sectors from START in USED, for inode SECTOR's
+ * check.  Returns false, printing why, if any of them is off the
+ * disk or marked already. */
+static bool
+check_claim (struct bitmap *used, disk_sector_t sector,
+		disk_sector_t start, size_t cnt) {
+	if (start >= bitmap_size (used) || cnt > bitmap_size (used) - start) {
+		printf ("fsck: inode %"PRDSNu": sectors %"PRDSNu"+%zu off the disk\n",
+				sector, start, cnt);
+		return false;
+	}
+	if (!bitmap_none (used, start, cnt)) {
+		printf ("fsck: inode %"PRDSNu": sectors %"PRDSNu"+%zu cross-linked\n",
+				sector, start, cnt);
+		return false;
+	}
+	bitmap_set_multiple (used, start, cnt, true);
+	return true;
+}
+
+/* Checks the inode in SECTOR on disk, for fsck, and marks the
+ * sectors it owns, its own included, in USED, which has a bit per
+ * disk sector.  The inode need not be open.  Returns false,
+ * printing each problem, if it is damaged or claims a sector that
+ * is off the disk or owned already. */
+bool
+inode_check (disk_sector_t sector, struct bitmap *used) {
+	struct inode_disk data;
+	struct extent_block overflow;
+	uint32_t capacity = 0;
+	bool ok = true;
+	size_t i;
+
+	if (!check_claim (used, sector, sector, 1))
+		return false;
+	page_cache_read_tagged (sector, &data, 0, DISK_SECTOR_SIZE, DISK_SRC_META);
+	if (!sector_verify (&data)) {
+		printf ("fsck: inode %"PRDSNu": bad checksum\n", sector);
+		return false;
+	}
+	if (data.magic != INODE_MAGIC || data.length < 0) {
+		printf ("fsck: inode %"PRDSNu": bad magic or length\n", sector);
+		return false;
+	}
+
+	if (data.flags & INODE_INLINE) {
+		if (data.length > (off_t) INODE_INLINE_MAX || data.extent_cnt != 0
+				|| data.overflow != 0) {
+			printf ("fsck: inode %"PRDSNu": bad inline inode\n", sector);
+			return false;
+		}
+		return true;
+	}
+
+	if (data.extent_cnt > MAX_EXTENTS
+			|| (data.extent_cnt > INODE_EXTENTS) != (data.overflow != 0)) {
+		printf ("fsck: inode %"PRDSNu": bad extent count\n", sector);
+		return false;
+	}
+	if (data.overflow != 0) {
+		if (!check_claim (used, sector, data.overflow, 1))
+			return false;
+		page_cache_read_tagged (data.overflow, &overflow, 0, DISK_SECTOR_SIZE,
+				DISK_SRC_META);
+		if (!sector_verify (&overflow)) {
+			printf ("fsck: inode %"PRDSNu": bad overflow checksum\n", sector);
+			return false;
+		}
+	}
+	for (i = 0; i < data.extent_cnt; i++) {
+		const struct extent *e = i < INODE_EXTENTS ? &data.extents[i]
+			: &overflow.extents[i - INODE_EXTENTS];
+
+		if (e->file_sector != capacity || e->count == 0) {
+			printf ("fsck: inode %"PRDSNu": extent %zu out of order\n",
+					sector, i);
+			return false;
+		}
+		ok = check_claim (used, sector, e->start, e->count) && ok;
+		capacity += e->count;
+	}
+	if (capacity < bytes_to_sectors (data.length)) {
+		printf ("fsck: inode %"PRDSNu": length past its extents\n", sector);
+		ok = false;
+	}
+	return ok;
+}
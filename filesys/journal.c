@@ -0,0 +1,398 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <hash.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "filesys/page_cache.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Write-ahead journal for file system metadata.
+
+   Each operation that changes metadata (creating or removing a
+   file, growing an inode, freeing a removed one) runs between
+   journal_begin() and journal_end().  The metadata sectors it
+   writes through journal_write() -- inode sectors, overflow
+   blocks, directory buckets and free map sectors -- join the
+   running transaction, and the buffer cache holds them back from
+   writeback until the transaction commits.
+
+   A commit waits for the transaction's operations to finish,
+   keeping new ones out meanwhile, then writes a descriptor sector
+   and a copy of every logged sector to the log with a single
+   sequential disk write, which flushes the disk's write cache
+   first and goes through it to the medium, so that the data
+   written before the commit are durable with it.  After that the
+   buffer cache may write the sectors home whenever it likes.  Operations that overlap
+   share a transaction, and the writeback thread commits only once
+   per writeback period, so a burst of creates costs one log write
+   rather than scattered writes to a dozen places.
+
+   The log is a circular region after the superblock.  When the
+   next transaction might not fit before its end, a checkpoint
+   writes every dirty cached sector home, since nothing is held
+   back at that point, and records in the superblock the sequence
+   number the next transaction will get; the log then starts over
+   from the front.  Thus the log only ever needs the transactions
+   since the last checkpoint, in order, from its first sector on.
+
+   Recovery, at mount, replays those transactions: a record
+   counts only if its sequence number is the expected next one and
+   its checksum matches, so a torn write of the last record, or a
+   stale record from before the checkpoint, ends the replay.
+
+   Sectors beyond JOURNAL_TXN_MAX in one transaction are written
+   unlogged, losing atomicity but not the update.  Operations stop
+   joining a transaction once it has fewer than JOURNAL_TXN_RESERVE
+   free slots, which keeps that to operations that are large on
+   their own. */
+
+#define JOURNAL_MAGIC 0x4a524e4c        /* "JRNL" */
+
+/* Room left for one operation to log into a transaction. */
+#define JOURNAL_TXN_RESERVE 8
+
+/* Journal superblock, at JOURNAL_SECTOR.
+   Must be exactly DISK_SECTOR_SIZE bytes long. */
+struct journal_super {
+	uint32_t magic;                     /* JOURNAL_MAGIC. */
+	uint32_t seq;                       /* Sequence number of the first
+	                                       record since the checkpoint. */
+	uint32_t clean;                     /* Unmounted by journal_close()? */
+	uint32_t unused[125];               /* Not used. */
+};
+
+/* Transaction descriptor, followed in the log by CNT sectors
+   holding the new contents of SECTORS[], in order.
+   Must be exactly DISK_SECTOR_SIZE bytes long. */
+struct journal_desc {
+	uint32_t magic;                     /* JOURNAL_MAGIC. */
+	uint32_t seq;                       /* Sequence number. */
+	uint32_t cnt;                       /* Number of sectors logged. */
+	uint32_t checksum;                  /* Of the record, with this 0. */
+	disk_sector_t sectors[JOURNAL_TXN_MAX]; /* Home sectors. */
+	uint32_t unused[92];                /* Not used. */
+};
+
+/* Log state.  Set up by journal_open(), then changed only by the
+   thread that sets COMMITTING. */
+static bool enabled;                /* Journal found at mount? */
+static bool was_clean;              /* Was it unmounted cleanly? */
+static uint32_t next_seq;           /* Sequence number of the next record. */
+static size_t head;                 /* Next record, as an offset from
+                                       JOURNAL_SECTOR. */
+static uint8_t *txn_buf;            /* A record: descriptor and sectors. */
+
+/* Running transaction, protected by JOURNAL_LOCK. */
+static struct lock journal_lock;
+static struct condition journal_cond; /* Signalled when ACTIVE drops to 0
+                                         and when a commit finishes. */
+static int active;                  /* Operations in progress. */
+static bool committing;             /* Keeping new operations out? */
+static disk_sector_t txn_sectors[JOURNAL_TXN_MAX];
+static size_t txn_cnt;
+
+/* Statistics. */
+static long long commit_cnt;        /* Transactions committed. */
+static long long logged_cnt;        /* Sectors written to the log. */
+static long long checkpoint_cnt;    /* Checkpoints. */
+static long long unlogged_cnt;      /* Metadata writes that did not fit. */
+
+/* Initializes the journal module.  The journal stays off until
+   journal_open() finds one on disk. */
+void
+journal_init (void) {
+	ASSERT (sizeof (struct journal_super) == DISK_SECTOR_SIZE);
+	ASSERT (sizeof (struct journal_desc) == DISK_SECTOR_SIZE);
+
+	lock_init (&journal_lock);
+	cond_init (&journal_cond);
+	txn_buf = palloc_get_multiple (PAL_ASSERT,
+			DIV_ROUND_UP ((JOURNAL_TXN_MAX + 1) * DISK_SECTOR_SIZE, PGSIZE));
+}
+
+/* Writes the superblock, pointing recovery at sequence number
+   NEXT_SEQ and the front of the log, and marking the file system
+   CLEAN or not. */
+static void
+super_write (bool clean) {
+	struct journal_super *s = (struct journal_super *) txn_buf;
+
+	memset (s, 0, sizeof *s);
+	s->magic = JOURNAL_MAGIC;
+	s->seq = next_seq;
+	s->clean = clean;
+	disk_write_ordered (filesys_disk, JOURNAL_SECTOR, 1, s, DISK_SRC_META,
+			DISK_REQ_FLUSH | DISK_REQ_FUA | DISK_REQ_BARRIER);
+}
+
+/* Returns the checksum of the record in TXN_BUF, whose
+   descriptor's checksum field must be 0. */
+static uint32_t
+record_checksum (const struct journal_desc *d) {
+	return hash_bytes (d, (d->cnt + 1) * DISK_SECTOR_SIZE);
+}
+
+/* Creates an empty journal.  Called from do_format(); the free
+   map already reserves the region. */
+void
+journal_create (void) {
+	size_t ofs;
+
+	/* Clear the log, so that no record from an earlier file system
+	   on this disk can pass for one of ours. */
+	memset (txn_buf, 0, (JOURNAL_TXN_MAX + 1) * DISK_SECTOR_SIZE);
+	for (ofs = 1; ofs < JOURNAL_SECTORS; ofs += JOURNAL_TXN_MAX + 1) {
+		size_t cnt = JOURNAL_SECTORS - ofs;
+
+		if (cnt > JOURNAL_TXN_MAX + 1)
+			cnt = JOURNAL_TXN_MAX + 1;
+		disk_write_tagged (filesys_disk, JOURNAL_SECTOR + ofs, cnt, txn_buf,
+				DISK_SRC_META);
+	}
+	next_seq = 1;
+	super_write (true);
+}
+
+/* Reads the record at HEAD into TXN_BUF and returns true if it is
+   the one numbered NEXT_SEQ, intact. */
+static bool
+record_read (void) {
+	struct journal_desc *d = (struct journal_desc *) txn_buf;
+	uint32_t checksum;
+
+	disk_read_tagged (filesys_disk, JOURNAL_SECTOR + head, 1, d,
+			DISK_SRC_META);
+	if (d->magic != JOURNAL_MAGIC || d->seq != next_seq
+			|| d->cnt == 0 || d->cnt > JOURNAL_TXN_MAX
+			|| head + 1 + d->cnt > JOURNAL_SECTORS)
+		return false;
+	disk_read_tagged (filesys_disk, JOURNAL_SECTOR + head + 1, d->cnt,
+			txn_buf + DISK_SECTOR_SIZE, DISK_SRC_META);
+	checksum = d->checksum;
+	d->checksum = 0;
+	return record_checksum (d) == checksum;
+}
+
+/* Looks for a journal on the file system disk.  If there is one,
+   replays the transactions committed since its last checkpoint,
+   marks the file system as mounted until journal_close(), and
+   turns journaling on.  Must be called before anything reads
+   metadata through the buffer cache. */
+void
+journal_open (void) {
+	struct journal_super *s = (struct journal_super *) txn_buf;
+	int replayed = 0;
+
+	disk_read_tagged (filesys_disk, JOURNAL_SECTOR, 1, s, DISK_SRC_META);
+	if (s->magic != JOURNAL_MAGIC)
+		return;
+
+	next_seq = s->seq;
+	was_clean = s->clean;
+	for (head = 1; head < JOURNAL_SECTORS && record_read (); ) {
+		struct journal_desc *d = (struct journal_desc *) txn_buf;
+		size_t i;
+
+		for (i = 0; i < d->cnt; i++)
+			disk_write_tagged (filesys_disk, d->sectors[i], 1,
+					txn_buf + (i + 1) * DISK_SECTOR_SIZE, DISK_SRC_META);
+		head += 1 + d->cnt;
+		next_seq++;
+		replayed++;
+	}
+	if (replayed > 0)
+		printf ("journal: replayed %d transactions\n", replayed);
+
+	/* Everything replayed is home now. */
+	head = 1;
+	super_write (false);
+	enabled = true;
+}
+
+/* Returns true if journal_open() found a journal and the file
+   system was unmounted cleanly, by journal_close(), last time, so
+   that it needs no check.  A file system without a journal never
+   counts as clean. */
+bool
+journal_was_clean (void) {
+	return enabled && was_clean;
+}
+
+/* Waits for the operations in the running transaction to finish,
+   keeping new ones out until resume(). */
+static void
+quiesce (void) {
+	lock_acquire (&journal_lock);
+	while (committing)
+		cond_wait (&journal_cond, &journal_lock);
+	committing = true;
+	while (active > 0)
+		cond_wait (&journal_cond, &journal_lock);
+	lock_release (&journal_lock);
+}
+
+/* Starts a new transaction and lets operations in again. */
+static void
+resume (void) {
+	lock_acquire (&journal_lock);
+	txn_cnt = 0;
+	committing = false;
+	cond_broadcast (&journal_cond, &journal_lock);
+	lock_release (&journal_lock);
+}
+
+/* Writes every dirty cached sector home and starts the log over,
+   marking the file system CLEAN or not.  Must be called between
+   quiesce() and resume(), with nothing held back in the cache. */
+static void
+checkpoint (bool clean) {
+	page_cache_flush ();
+	head = 1;
+	super_write (clean);
+	checkpoint_cnt++;
+}
+
+/* Writes the running transaction to the log, then lets the
+   buffer cache write its sectors home.  Must be called between
+   quiesce() and resume(). */
+static void
+txn_write (void) {
+	struct journal_desc *d = (struct journal_desc *) txn_buf;
+	size_t i;
+
+	memset (d, 0, sizeof *d);
+	d->magic = JOURNAL_MAGIC;
+	d->seq = next_seq;
+	d->cnt = txn_cnt;
+	for (i = 0; i < txn_cnt; i++) {
+		d->sectors[i] = txn_sectors[i];
+		page_cache_read_tagged (txn_sectors[i],
+				txn_buf + (i + 1) * DISK_SECTOR_SIZE, 0, DISK_SECTOR_SIZE,
+				DISK_SRC_META);
+	}
+	d->checksum = record_checksum (d);
+	disk_write_ordered (filesys_disk, JOURNAL_SECTOR + head, txn_cnt + 1,
+			txn_buf, DISK_SRC_META,
+			DISK_REQ_FLUSH | DISK_REQ_FUA | DISK_REQ_BARRIER);
+	head += txn_cnt + 1;
+	next_seq++;
+	commit_cnt++;
+	logged_cnt += txn_cnt;
+
+	for (i = 0; i < txn_cnt; i++)
+		page_cache_unhold (txn_sectors[i]);
+
+	/* Make sure the largest transaction fits next time. */
+	if (head + 1 + JOURNAL_TXN_MAX > JOURNAL_SECTORS)
+		checkpoint (false);
+}
+
+/* Commits the running transaction, waiting for its operations to
+   finish first.  Must not be called within an operation. */
+void
+journal_commit (void) {
+	ASSERT (thread_current ()->journal_depth == 0);
+
+	if (!enabled)
+		return;
+	quiesce ();
+	if (txn_cnt > 0)
+		txn_write ();
+	resume ();
+}
+
+/* Commits the running transaction and checkpoints, leaving
+   nothing for recovery to do, and marks the file system clean.
+   Called from filesys_done(). */
+void
+journal_close (void) {
+	if (!enabled)
+		return;
+	quiesce ();
+	if (txn_cnt > 0)
+		txn_write ();
+	checkpoint (true);
+	resume ();
+}
+
+/* Starts an operation that changes metadata, in the running
+   transaction.  Operations nest: only the outermost one counts,
+   and one nested in another just joins it. */
+void
+journal_begin (void) {
+	struct thread *t = thread_current ();
+
+	if (t->journal_depth++ > 0 || !enabled)
+		return;
+	lock_acquire (&journal_lock);
+	while (committing || txn_cnt > JOURNAL_TXN_MAX - JOURNAL_TXN_RESERVE)
+		cond_wait (&journal_cond, &journal_lock);
+	active++;
+	lock_release (&journal_lock);
+}
+
+/* Ends an operation started with journal_begin().  The last one
+   out of a nearly full transaction commits it. */
+void
+journal_end (void) {
+	struct thread *t = thread_current ();
+	bool full;
+
+	ASSERT (t->journal_depth > 0);
+	if (--t->journal_depth > 0 || !enabled)
+		return;
+	lock_acquire (&journal_lock);
+	full = --active == 0 && txn_cnt > JOURNAL_TXN_MAX - JOURNAL_TXN_RESERVE;
+	if (active == 0)
+		cond_broadcast (&journal_cond, &journal_lock);
+	lock_release (&journal_lock);
+	if (full)
+		journal_commit ();
+}
+
+/* Copies SIZE bytes from BUFFER into metadata SECTOR starting at
+   byte OFS, through the buffer cache.  Within an operation, the
+   sector joins the running transaction; otherwise this is just
+   page_cache_write(). */
+void
+journal_write (disk_sector_t sector, const void *buffer, int ofs, int size) {
+	size_t i;
+	bool logged = false;
+
+	if (!enabled || thread_current ()->journal_depth == 0) {
+		page_cache_write (sector, buffer, ofs, size);
+		return;
+	}
+
+	lock_acquire (&journal_lock);
+	for (i = 0; i < txn_cnt && !logged; i++)
+		logged = txn_sectors[i] == sector;
+	if (!logged && txn_cnt < JOURNAL_TXN_MAX) {
+		txn_sectors[txn_cnt++] = sector;
+		logged = true;
+	}
+	if (!logged)
+		unlogged_cnt++;
+	lock_release (&journal_lock);
+
+	/* No commit can start before this operation ends, so the cache
+	   cannot let go of the sector in between. */
+	if (logged)
+		page_cache_write_held (sector, buffer, ofs, size);
+	else
+		page_cache_write (sector, buffer, ofs, size);
+}
+
+/* Prints journal statistics. */
+void
+journal_print_stats (void) {
+	printf ("Journal: %lld commits, %lld sectors logged, %lld checkpoints, "
+			"%lld unlogged writes\n",
+			commit_cnt, logged_cnt, checkpoint_cnt, unlogged_cnt);
+}
@@ -1,9 +1,117 @@
 /* page_cache.c: Implementation of Page Cache (Buffer Cache). */
 
+#include "filesys/page_cache.h"
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/disk.h"
+#include "devices/timer.h"
+#include "filesys/fat.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/atomic.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/workq.h"
 #include "vm/vm.h"
+
+/* Buffer cache for the file system disk.
+
+   The cache holds PAGE_CACHE_ENTRIES entries, each one page of
+   PAGE_CACHE_SECTORS consecutive sectors starting at a multiple
+   of PAGE_CACHE_SECTORS.  Each sector in an entry is separately
+   valid (read from disk, or entirely overwritten) and dirty, so
+   a miss reads only the sector that is needed and a full-sector
+   write reads nothing.
+
+   Entries are replaced with the CLOCK algorithm.  Dirty sectors
+   of a victim are written back before the entry is reused, and
+   the page_cache_kworkerd thread writes back dirty sectors every
+   PAGE_CACHE_WRITEBACK_MS milliseconds so that eviction usually
+   finds clean entries.  Writeback visits dirty entries in sector
+   order, so that consecutive dirty sectors go to the disk back to
+   back instead of in whatever order they were dirtied.
+
+   page_cache_prefetch() submits sectors to the worker pool (see
+   threads/workq.c) to read in the background, so a sequential
+   reader finds the next sectors already cached.  Requests that do
+   not fit in the pool are dropped, since read-ahead is only a
+   hint.
+
+   Dirty sectors are throttled so that a fast writer cannot fill
+   the cache with them and leave every other thread to wait behind
+   the writeback.  Once DIRTY_BACKGROUND sectors are dirty, a
+   writeback job goes to the worker pool without waiting for the
+   next period.  A writer that finds more than DIRTY_LIMIT dirty
+   calls page_cache_balance(), which writes them back itself,
+   one such writer at a time, so the writers that make the dirt
+   wait for it and other threads keep finding clean entries.  (See
+   also inode.c, which has each file write back its own data once
+   it has dirtied an inode's share.)
+
+   Metadata sectors logged in the running journal transaction are
+   "held" (see filesys/journal.c): they stay dirty in the cache,
+   and neither writeback nor eviction touches them, until the
+   transaction is in the log.
+
+   Synchronization: CACHE_LOCK protects the mapping from entries
+   to sectors, the pin counts, and the clock hand.  Each entry's
+   own lock protects its data and valid/dirty masks.  A thread
+   pins an entry under CACHE_LOCK, which keeps it from being
+   evicted, then drops CACHE_LOCK before taking the entry lock,
+   so that waiting for one entry's I/O does not stall lookups of
+   others. */
+
+#define PAGE_CACHE_ENTRIES 64
+#define PAGE_CACHE_WRITEBACK_MS 1000
+
+/* Dirty sectors at which writeback starts early, and past which
+   writers are throttled. */
+#define DIRTY_BACKGROUND (PAGE_CACHE_ENTRIES * PAGE_CACHE_SECTORS / 4)
+#define DIRTY_LIMIT (PAGE_CACHE_ENTRIES * PAGE_CACHE_SECTORS / 2)
+
+/* Marks an entry that holds no sectors. */
+#define NO_SECTOR ((disk_sector_t) -1)
+
+/* A cache entry. */
+struct cache_entry {
+	disk_sector_t base;         /* First sector held, or NO_SECTOR. */
+	uint8_t valid;              /* Bit I set: sector BASE + I is valid. */
+	uint8_t dirty;              /* Bit I set: sector BASE + I is dirty. */
+	uint8_t held;               /* Bit I set: not to be written back yet. */
+	bool accessed;              /* Used since the clock hand passed. */
+	int pin_cnt;                /* Users that keep it from eviction. */
+	struct lock lock;           /* Protects data, valid, dirty. */
+	uint8_t *data;              /* PAGE_CACHE_SECTORS sectors of data. */
+};
+
+static struct cache_entry entries[PAGE_CACHE_ENTRIES];
+static struct lock cache_lock;
+static size_t clock_hand;
+
+/* Dirty throttling. */
+static size_t dirty_cnt;        /* Dirty sectors in the cache. */
+static bool kick_pending;       /* Early writeback job submitted? */
+static struct lock balance_lock; /* Held by the throttled writer. */
+
+/* Statistics. */
+static long long cache_hits;    /* Sector accesses found valid. */
+static long long cache_misses;  /* Sector accesses read from disk. */
+static long long writebacks;    /* Sectors written back to disk. */
+static long long readaheads;    /* Sectors read ahead of use. */
+static long long ra_dropped;    /* Read-ahead requests dropped. */
+static long long kicks;         /* Early writebacks started. */
+static long long throttles;     /* Writers made to write back. */
+
 static bool page_cache_readahead (struct page *page, void *kva);
 static bool page_cache_writeback (struct page *page);
 static void page_cache_destroy (struct page *page);
+static void page_cache_kworkerd (void *aux);
+static void page_cache_readahead_work (void *aux);
+static void page_cache_kick_work (void *aux);
 
 /* DO NOT MODIFY this struct */
 static const struct page_operations page_cache_op = {
@@ -15,10 +123,340 @@ static const struct page_operations page_cache_op = {
 
 tid_t page_cache_workerd;
 
+/* Initializes the buffer cache and starts its writeback thread.
+   Called from filesys_init(). */
+void
+page_cache_init (void) {
+	size_t i;
+
+	lock_init (&cache_lock);
+	lock_init (&balance_lock);
+	for (i = 0; i < PAGE_CACHE_ENTRIES; i++) {
+		struct cache_entry *e = &entries[i];
+
+		e->base = NO_SECTOR;
+		e->valid = e->dirty = e->held = 0;
+		e->accessed = false;
+		e->pin_cnt = 0;
+		lock_init (&e->lock);
+		e->data = palloc_get_page (PAL_ASSERT);
+	}
+	clock_hand = 0;
+
+	page_cache_workerd = thread_create ("page_cache_kworkerd", PRI_DEFAULT,
+			page_cache_kworkerd, NULL);
+	if (page_cache_workerd == TID_ERROR)
+		PANIC ("page cache: cannot start writeback thread");
+}
+
 /* The initializer of file vm */
 void
 pagecache_init (void) {
-	/* TODO: Create a worker daemon for page cache with page_cache_kworkerd */
+	/* The buffer cache and its worker are started from
+	   filesys_init(), which runs before vm_init(). */
+}
+
+/* Returns the number of bits set in MASK. */
+static int
+bit_cnt (uint8_t mask) {
+	int cnt = 0;
+
+	for (; mask != 0; mask &= mask - 1)
+		cnt++;
+	return cnt;
+}
+
+/* Writes the dirty sectors of E selected by MASK, other than held
+   ones, to disk in sector order.  E's lock must be held. */
+static void
+entry_writeback (struct cache_entry *e, uint8_t mask) {
+	uint8_t dirty = e->dirty & mask & ~e->held;
+	int i = 0;
+
+	/* Write each run of consecutive dirty sectors with a single
+	   command. */
+	while (i < PAGE_CACHE_SECTORS) {
+		int n = 0;
+
+		while (i + n < PAGE_CACHE_SECTORS && (dirty & (1 << (i + n))))
+			n++;
+		if (n > 0) {
+			disk_write_tagged (filesys_disk, e->base + i, n,
+					e->data + i * DISK_SECTOR_SIZE, DISK_SRC_WRITEBACK);
+			writebacks += n;
+			i += n;
+		} else
+			i++;
+	}
+	e->dirty &= ~dirty;
+	atomic_fetch_sub (&dirty_cnt, bit_cnt (dirty));
+}
+
+/* Returns the mask of E's sectors that lie within sectors
+   [FIRST, LAST). */
+static uint8_t
+entry_range_mask (const struct cache_entry *e, disk_sector_t first,
+		disk_sector_t last) {
+	uint8_t mask = 0;
+	int i;
+
+	for (i = 0; i < PAGE_CACHE_SECTORS; i++)
+		if (e->base + i >= first && e->base + i < last)
+			mask |= 1 << i;
+	return mask;
+}
+
+/* Returns the entry holding the sectors at BASE, pinned and with
+   its lock held, replacing another entry if none does. */
+static struct cache_entry *
+entry_get (disk_sector_t base) {
+	struct cache_entry *e;
+	size_t i, scanned;
+
+	for (;;) {
+		lock_acquire (&cache_lock);
+		for (i = 0; i < PAGE_CACHE_ENTRIES; i++) {
+			e = &entries[i];
+			if (e->base == base) {
+				e->pin_cnt++;
+				e->accessed = true;
+				lock_release (&cache_lock);
+				lock_acquire (&e->lock);
+				return e;
+			}
+		}
+
+		/* Miss: sweep the clock for an unpinned entry that has not
+		   been used since the hand last passed it.  Two sweeps
+		   suffice unless every entry is pinned. */
+		for (scanned = 0; scanned < 2 * PAGE_CACHE_ENTRIES; scanned++) {
+			e = &entries[clock_hand];
+			clock_hand = (clock_hand + 1) % PAGE_CACHE_ENTRIES;
+			if (e->pin_cnt > 0)
+				continue;
+			if (e->accessed) {
+				e->accessed = false;
+				continue;
+			}
+			if (!lock_try_acquire (&e->lock))
+				continue;
+			if (e->held != 0) {
+				lock_release (&e->lock);
+				continue;
+			}
+
+			/* Write back the old contents while still holding
+			   CACHE_LOCK, so that nobody can read the old sectors
+			   from disk before they are up to date there. */
+			if (e->base != NO_SECTOR)
+				entry_writeback (e, 0xff);
+			e->base = base;
+			e->valid = 0;
+			e->pin_cnt = 1;
+			e->accessed = true;
+			lock_release (&cache_lock);
+			return e;
+		}
+
+		/* Everything is in use.  Let someone finish and retry. */
+		lock_release (&cache_lock);
+		thread_yield ();
+	}
+}
+
+/* Releases E, obtained from entry_get(). */
+static void
+entry_put (struct cache_entry *e) {
+	lock_release (&e->lock);
+	lock_acquire (&cache_lock);
+	e->pin_cnt--;
+	lock_release (&cache_lock);
+}
+
+/* Makes sure sector IDX of E, whose lock is held, is valid,
+   attributing any disk read to SRC. */
+static void
+entry_fill (struct cache_entry *e, int idx, enum disk_src src) {
+	if (e->valid & (1 << idx))
+		cache_hits++;
+	else {
+		disk_read_tagged (filesys_disk, e->base + idx, 1,
+				e->data + idx * DISK_SECTOR_SIZE, src);
+		e->valid |= 1 << idx;
+		cache_misses++;
+	}
+}
+
+/* Copies SIZE bytes starting at byte OFS in SECTOR, which holds
+   file data, into BUFFER, through the cache. */
+void
+page_cache_read (disk_sector_t sector, void *buffer, int ofs, int size) {
+	page_cache_read_tagged (sector, buffer, ofs, size, DISK_SRC_DATA);
+}
+
+/* Like page_cache_read(), but attributes a disk read, if one is
+   needed, to SRC. */
+void
+page_cache_read_tagged (disk_sector_t sector, void *buffer, int ofs,
+		int size, enum disk_src src) {
+	int idx = sector % PAGE_CACHE_SECTORS;
+	struct cache_entry *e;
+
+	ASSERT (ofs >= 0 && size >= 0 && ofs + size <= DISK_SECTOR_SIZE);
+
+	e = entry_get (sector - idx);
+	entry_fill (e, idx, src);
+	memcpy (buffer, e->data + idx * DISK_SECTOR_SIZE + ofs, size);
+	entry_put (e);
+}
+
+/* Copies SIZE bytes from BUFFER into SECTOR starting at byte
+   OFS, through the cache, and holds the sector back from
+   writeback if HOLD is true. */
+static void
+cache_write (disk_sector_t sector, const void *buffer, int ofs, int size,
+		bool hold) {
+	int idx = sector % PAGE_CACHE_SECTORS;
+	struct cache_entry *e;
+
+	ASSERT (ofs >= 0 && size >= 0 && ofs + size <= DISK_SECTOR_SIZE);
+
+	e = entry_get (sector - idx);
+	if (size == DISK_SECTOR_SIZE) {
+		/* Overwritten entirely, so there is no need to read it. */
+		e->valid |= 1 << idx;
+	} else
+		entry_fill (e, idx, DISK_SRC_DATA);
+	memcpy (e->data + idx * DISK_SECTOR_SIZE + ofs, buffer, size);
+	if (!(e->dirty & (1 << idx))) {
+		e->dirty |= 1 << idx;
+		if (atomic_fetch_add (&dirty_cnt, 1) + 1 >= DIRTY_BACKGROUND
+				&& !atomic_xchg (&kick_pending, true)) {
+			if (workq_submit (page_cache_kick_work, NULL, PRI_DEFAULT))
+				kicks++;
+			else
+				atomic_store (&kick_pending, false);
+		}
+	}
+	if (hold)
+		e->held |= 1 << idx;
+	entry_put (e);
+}
+
+/* Copies SIZE bytes from BUFFER into SECTOR starting at byte
+   OFS, through the cache.  The sector is written to disk later,
+   by the writeback thread, by eviction, or by page_cache_flush(). */
+void
+page_cache_write (disk_sector_t sector, const void *buffer, int ofs,
+		int size) {
+	cache_write (sector, buffer, ofs, size, false);
+}
+
+/* Like page_cache_write(), but the sector is not written to disk
+   at all until page_cache_unhold() releases it. */
+void
+page_cache_write_held (disk_sector_t sector, const void *buffer, int ofs,
+		int size) {
+	cache_write (sector, buffer, ofs, size, true);
+}
+
+/* Lets SECTOR, written with page_cache_write_held(), be written to
+   disk again. */
+void
+page_cache_unhold (disk_sector_t sector) {
+	int idx = sector % PAGE_CACHE_SECTORS;
+	struct cache_entry *e = entry_get (sector - idx);
+
+	e->held &= ~(1 << idx);
+	entry_put (e);
+}
+
+/* Queues SECTOR to be read into the cache in the background. */
+void
+page_cache_prefetch (disk_sector_t sector) {
+	if (!workq_submit (page_cache_readahead_work,
+				(void *) (uintptr_t) sector, PRI_DEFAULT))
+		ra_dropped++;
+}
+
+/* Writes the dirty cached sectors in [FIRST, LAST) to disk, in
+   sector order. */
+static void
+flush_range (disk_sector_t first, disk_sector_t last) {
+	struct cache_entry *order[PAGE_CACHE_ENTRIES];
+	size_t cnt = 0, i, j;
+
+	/* Pin the dirty entries in range.  The dirty masks may change
+	   once CACHE_LOCK is dropped; that only means a little more
+	   or less to write. */
+	lock_acquire (&cache_lock);
+	for (i = 0; i < PAGE_CACHE_ENTRIES; i++) {
+		struct cache_entry *e = &entries[i];
+
+		if (e->base != NO_SECTOR && e->dirty != 0
+				&& e->base < last && e->base + PAGE_CACHE_SECTORS > first) {
+			e->pin_cnt++;
+			order[cnt++] = e;
+		}
+	}
+	lock_release (&cache_lock);
+
+	/* Insertion sort by first sector. */
+	for (i = 1; i < cnt; i++) {
+		struct cache_entry *e = order[i];
+
+		for (j = i; j > 0 && order[j - 1]->base > e->base; j--)
+			order[j] = order[j - 1];
+		order[j] = e;
+	}
+
+	for (i = 0; i < cnt; i++) {
+		lock_acquire (&order[i]->lock);
+		entry_writeback (order[i], entry_range_mask (order[i], first, last));
+		entry_put (order[i]);
+	}
+}
+
+/* Writes every dirty sector in the cache to disk. */
+void
+page_cache_flush (void) {
+	flush_range (0, NO_SECTOR);
+}
+
+/* Writes the dirty cached sectors among the CNT sectors starting
+   at FIRST to disk. */
+void
+page_cache_flush_range (disk_sector_t first, size_t cnt) {
+	flush_range (first, first + cnt);
+}
+
+/* Called by a thread that has just dirtied cache sectors.  If more
+   than DIRTY_LIMIT are dirty, writes them back before returning,
+   so that the thread pays for its own writes.  Throttled threads
+   take turns, and one that finds the cache cleaned while it waited
+   goes on at once. */
+void
+page_cache_balance (void) {
+	if (atomic_load (&dirty_cnt) <= DIRTY_LIMIT)
+		return;
+
+	lock_acquire (&balance_lock);
+	if (atomic_load (&dirty_cnt) > DIRTY_LIMIT) {
+		throttles++;
+		page_cache_flush ();
+	}
+	lock_release (&balance_lock);
+}
+
+/* Prints buffer cache statistics. */
+void
+page_cache_print_stats (void) {
+	printf ("Buffer cache: %lld hits, %lld misses, %lld writebacks\n",
+			cache_hits, cache_misses, writebacks);
+	printf ("Buffer cache: %lld sectors read ahead, %lld requests dropped\n",
+			readaheads, ra_dropped);
+	printf ("Buffer cache: %lld early writebacks, %lld writers throttled\n",
+			kicks, throttles);
 }
 
 /* Initialize the page cache */
@@ -44,7 +482,51 @@ static void
 page_cache_destroy (struct page *page) {
 }
 
-/* Worker thread for page cache */
+/* Worker thread for page cache: periodically writes the lengths of
+   grown inodes to the cache, commits the journal, and writes back
+   dirty sectors.  Writeback is in the idle I/O class, behind the
+   reads that threads wait for; the commit is not, since writers
+   may be waiting for it to free journal space. */
+static void
+page_cache_kworkerd (void *aux UNUSED) {
+	disk_set_ioclass (DISK_IOC_IDLE);
+	for (;;) {
+		timer_msleep (PAGE_CACHE_WRITEBACK_MS);
+		inode_writeback ();
+		disk_set_ioclass (DISK_IOC_BE);
+		journal_commit ();
+		disk_set_ioclass (DISK_IOC_IDLE);
+		page_cache_flush ();
+#ifdef EFILESYS
+		fat_flush ();
+#endif
+	}
+}
+
+/* Worker pool job started when DIRTY_BACKGROUND sectors are dirty:
+   writes back the cache ahead of the writeback thread's period. */
+static void
+page_cache_kick_work (void *aux UNUSED) {
+	enum disk_ioclass ioclass = disk_set_ioclass (DISK_IOC_IDLE);
+
+	page_cache_flush ();
+	disk_set_ioclass (ioclass);
+	atomic_store_release (&kick_pending, false);
+}
+
+/* Worker pool job for page_cache_prefetch(): reads sector AUX
+   into the cache unless it is there already. */
 static void
-page_cache_kworkerd (void *aux) {
+page_cache_readahead_work (void *aux) {
+	disk_sector_t sector = (uintptr_t) aux;
+	int idx = sector % PAGE_CACHE_SECTORS;
+	struct cache_entry *e = entry_get (sector - idx);
+
+	if (!(e->valid & (1 << idx))) {
+		disk_read_tagged (filesys_disk, sector, 1,
+				e->data + idx * DISK_SECTOR_SIZE, DISK_SRC_READAHEAD);
+		e->valid |= 1 << idx;
+		readaheads++;
+	}
+	entry_put (e);
 }
@@ -0,0 +1,231 @@
+#include "filesys/tmpfs.h"
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Memory-backed file system.
+
+   A tmpfs is a tree of inodes that keep their data in pages from
+   the user pool instead of disk sectors (see inode_create_mem()),
+   so everything above the inode layer -- open files, directories,
+   the directory entry cache, mmap -- works on it unchanged, and
+   nothing in it ever reaches the disk or the buffer cache.
+   Directories use the same format as on disk, in memory.
+
+   An in-memory inode has no disk copy to return to when its last
+   opener closes it, so the directory entry that names it holds an
+   open reference of its own, the "link", which inode_remove()
+   drops.  A tmpfs root is thus alive until it is unmounted, which
+   removes it, and a file until it is removed and its last opener
+   closes it.
+
+   File data is kept sparse: a page is allocated the first time a
+   byte in it is written, and a page never written reads as zeros.
+   At most TMPFS_PAGES_MAX pages are used across all mounts, so a
+   runaway file cannot take the user pool from processes. */
+
+#define TMPFS_PAGES_MAX 512
+
+/* Entries a new tmpfs root directory has space for. */
+#define TMPFS_ROOT_ENTRIES 16
+
+/* Contents of a tmpfs file. */
+struct tmpfs_data {
+	struct lock lock;           /* Protects the members below. */
+	uint8_t **pages;            /* Data page I, or null if never written. */
+	size_t page_cnt;            /* Number of elements in PAGES. */
+};
+
+/* Next inode number to hand out.  Numbers are not reused, so a
+   stale name in the directory entry cache never finds a new one. */
+static disk_sector_t next_inumber = TMPFS_INUMBER_BASE;
+
+/* Statistics. */
+static size_t pages_used;       /* Data pages in use. */
+static size_t pages_peak;       /* Most data pages ever in use. */
+
+/* Returns a fresh inode number. */
+static disk_sector_t
+new_inumber (void) {
+	return __atomic_fetch_add (&next_inumber, 1, __ATOMIC_RELAXED);
+}
+
+/* Creates a tmpfs and returns its root directory's inode, which
+   holds the link reference to the root, or a null pointer if
+   memory is short. */
+static struct inode *
+tmpfs_mount (void) {
+	return inode_create_mem (new_inumber (),
+			dir_initial_length (TMPFS_ROOT_ENTRIES), true);
+}
+
+/* Removes every file in the tmpfs with root ROOT, then ROOT itself,
+   dropping the references tmpfs_mount() and tmpfs_create() made.
+   Files that are still open live on until they are closed. */
+static void
+tmpfs_umount (struct inode *root) {
+	struct dir *dir = dir_open (inode_reopen (root));
+	char name[NAME_MAX + 1];
+
+	if (dir != NULL) {
+		while (dir_readdir (dir, name))
+			dir_remove (dir, name);
+		dir_close (dir);
+	}
+	inode_remove (root);
+}
+
+/* Creates a file named NAME with the given INITIAL_SIZE in DIR, a
+   tmpfs directory.  Returns true if successful, false if NAME
+   exists already or memory is short. */
+static bool
+tmpfs_create (struct dir *dir, const char *name, off_t initial_size) {
+	disk_sector_t inumber = new_inumber ();
+	struct inode *inode = inode_create_mem (inumber, initial_size, false);
+
+	if (inode == NULL)
+		return false;
+	if (!dir_add (dir, name, inumber)) {
+		inode_close (inode);
+		return false;
+	}
+	return true;
+}
+
+const struct fs_ops tmpfs_fs_ops = {
+	.name = "tmpfs",
+	.mount = tmpfs_mount,
+	.unmount = tmpfs_umount,
+	.create = tmpfs_create,
+};
+
+/* Returns new, empty file contents, or a null pointer if memory is
+   short. */
+struct tmpfs_data *
+tmpfs_data_create (void) {
+	struct tmpfs_data *d = calloc_tagged (1, sizeof *d, TAG_INODE);
+
+	if (d != NULL)
+		lock_init (&d->lock);
+	return d;
+}
+
+/* Frees D and its pages. */
+void
+tmpfs_data_destroy (struct tmpfs_data *d) {
+	size_t i;
+
+	for (i = 0; i < d->page_cnt; i++)
+		if (d->pages[i] != NULL) {
+			palloc_free_page (d->pages[i]);
+			__atomic_sub_fetch (&pages_used, 1, __ATOMIC_RELAXED);
+		}
+	free (d->pages);
+	free (d);
+}
+
+/* Returns data page IDX of D, allocating it and making room for it
+   in D's page array if need be, or a null pointer if memory is
+   short.  D's lock must be held. */
+static uint8_t *
+page_get (struct tmpfs_data *d, size_t idx) {
+	size_t used;
+
+	if (idx >= d->page_cnt) {
+		size_t cnt = d->page_cnt < 4 ? 4 : d->page_cnt * 2;
+		uint8_t **pages;
+
+		if (cnt <= idx)
+			cnt = idx + 1;
+		pages = d->pages == NULL ? malloc_tagged (cnt * sizeof *pages, TAG_INODE)
+			: realloc (d->pages, cnt * sizeof *pages);
+		if (pages == NULL)
+			return NULL;
+		memset (pages + d->page_cnt, 0, (cnt - d->page_cnt) * sizeof *pages);
+		d->pages = pages;
+		d->page_cnt = cnt;
+	}
+
+	if (d->pages[idx] == NULL) {
+		used = __atomic_add_fetch (&pages_used, 1, __ATOMIC_RELAXED);
+		if (used > TMPFS_PAGES_MAX
+				|| (d->pages[idx] = palloc_get_page (PAL_USER | PAL_ZERO)) == NULL) {
+			__atomic_sub_fetch (&pages_used, 1, __ATOMIC_RELAXED);
+			return NULL;
+		}
+		if (used > pages_peak)
+			pages_peak = used;
+	}
+	return d->pages[idx];
+}
+
+/* Reads SIZE bytes at OFFSET of D, a file LENGTH bytes long, into
+   BUFFER.  Returns the number of bytes read, which is less than
+   SIZE at end of file. */
+off_t
+tmpfs_read (struct tmpfs_data *d, void *buffer_, off_t size, off_t offset,
+		off_t length) {
+	uint8_t *buffer = buffer_;
+	off_t done = 0;
+
+	if (offset >= length)
+		return 0;
+	if (size > length - offset)
+		size = length - offset;
+
+	lock_acquire (&d->lock);
+	while (done < size) {
+		size_t idx = (offset + done) / PGSIZE;
+		size_t ofs = (offset + done) % PGSIZE;
+		off_t chunk = PGSIZE - ofs < (size_t) (size - done)
+			? (off_t) (PGSIZE - ofs) : size - done;
+
+		if (idx < d->page_cnt && d->pages[idx] != NULL)
+			memcpy (buffer + done, d->pages[idx] + ofs, chunk);
+		else
+			memset (buffer + done, 0, chunk);
+		done += chunk;
+	}
+	lock_release (&d->lock);
+	return done;
+}
+
+/* Writes SIZE bytes from BUFFER into D at OFFSET.  Returns the
+   number of bytes written, which is less than SIZE only if memory
+   ran short. */
+off_t
+tmpfs_write (struct tmpfs_data *d, const void *buffer_, off_t size,
+		off_t offset) {
+	const uint8_t *buffer = buffer_;
+	off_t done = 0;
+
+	lock_acquire (&d->lock);
+	while (done < size) {
+		size_t idx = (offset + done) / PGSIZE;
+		size_t ofs = (offset + done) % PGSIZE;
+		off_t chunk = PGSIZE - ofs < (size_t) (size - done)
+			? (off_t) (PGSIZE - ofs) : size - done;
+		uint8_t *page = page_get (d, idx);
+
+		if (page == NULL)
+			break;
+		memcpy (page + ofs, buffer + done, chunk);
+		done += chunk;
+	}
+	lock_release (&d->lock);
+	return done;
+}
+
+/* Prints tmpfs statistics. */
+void
+tmpfs_print_stats (void) {
+	printf ("tmpfs: %zu pages in use, %zu at most\n", pages_used, pages_peak);
+}
@@ -0,0 +1,7 @@
+#ifndef DEVICES_AHCI_H
+#define DEVICES_AHCI_H
+
+void ahci_init (void);
+void ahci_print_stats (void);
+
+#endif /* devices/ahci.h */
@@ -0,0 +1,10 @@
+#ifndef DEVICES_DEBUGCON_H
+#define DEVICES_DEBUGCON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+bool debugcon_present (void);
+void debugcon_putbuf (const char *, size_t);
+
+#endif /* devices/debugcon.h */
@@ -2,7 +2,11 @@
 #define DEVICES_DISK_H
 
 #include <inttypes.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include "threads/synch.h"
 
 /* Size of a disk sector in bytes. */
 #define DISK_SECTOR_SIZE 512
@@ -15,6 +19,78 @@ typedef uint32_t disk_sector_t;
  * printf ("sector=%"PRDSNu"\n", sector); */
 #define PRDSNu PRIu32
 
+/* Where a transfer comes from, for disk statistics. */
+enum disk_src {
+	DISK_SRC_OTHER,                 /* Not attributed. */
+	DISK_SRC_META,                  /* File system metadata. */
+	DISK_SRC_DATA,                  /* File data. */
+	DISK_SRC_READAHEAD,             /* Buffer cache read-ahead. */
+	DISK_SRC_WRITEBACK,             /* Buffer cache writeback. */
+	DISK_SRC_SWAP_IN,               /* Swap-in. */
+	DISK_SRC_SWAP_OUT,              /* Swap-out. */
+	DISK_SRC_CNT
+};
+
+/* Flags for a disk request.  A write returns once the disk has
+   accepted the data, which may still sit in its volatile write
+   cache; these make it durable and ordered where that matters. */
+#define DISK_REQ_FLUSH 0x1              /* Flush the write cache first. */
+#define DISK_REQ_FUA 0x2                /* Reach the medium before done. */
+#define DISK_REQ_BARRIER 0x4            /* Not reordered with others. */
+
+/* I/O scheduling classes.  A request takes the class of the thread
+   that submits it, and a level within the class from the thread's
+   priority.  The elevator serves realtime requests before
+   best-effort ones, and those before idle ones, but lets a request
+   that has waited climb a level at a time, so none starves. */
+enum disk_ioclass {
+	DISK_IOC_BE,                    /* Best effort (the default). */
+	DISK_IOC_RT,                    /* Realtime, such as page faults. */
+	DISK_IOC_IDLE,                  /* Background, such as writeback. */
+	DISK_IOC_CNT
+};
+
+/* Number of ATA channels. */
+#define DISK_CHANNEL_CNT 2
+
+/* A share of disk time, which the requests of the threads pointing
+   to it in their IO_SHARE draw on in proportion to WEIGHT.  Threads
+   with no share draw on one of DISK_WEIGHT_DEFAULT. */
+#define DISK_WEIGHT_DEFAULT 100
+struct disk_share {
+	unsigned weight;                /* Relative share, 1 or more. */
+	uint64_t finish[DISK_CHANNEL_CNT];  /* Virtual time at which the
+	                                   latest request on each ATA
+	                                   channel has had its share. */
+	long long read_cnt;             /* Sectors read. */
+	long long write_cnt;            /* Sectors written. */
+};
+
+/* An asynchronous disk request.  See disk_submit(). */
+struct disk_req {
+	struct disk *disk;              /* Disk to transfer to or from. */
+	disk_sector_t sec_no;           /* First sector. */
+	size_t cnt;                     /* Number of sectors. */
+	void *buffer;                   /* CNT * DISK_SECTOR_SIZE bytes. */
+	bool write;                     /* True to write, false to read. */
+	void (*done) (struct disk_req *);   /* Completion callback, or null. */
+	void *aux;                      /* For use by DONE. */
+	enum disk_src src;              /* Origin, for statistics. */
+	unsigned flags;                 /* DISK_REQ_*. */
+
+	/* Owned by the driver. */
+	struct list_elem elem;          /* Element in channel queue. */
+	struct semaphore sema;          /* Up'd on completion if no DONE. */
+	size_t done_cnt;                /* Sectors transferred so far. */
+	size_t issued_cnt;              /* Sectors given to a queued device. */
+	uint64_t submit_tsc;            /* TSC at disk_submit(). */
+	int64_t submit_tick;            /* timer_ticks() at disk_submit(). */
+	enum disk_ioclass ioclass;      /* Submitting thread's class. */
+	unsigned rank;                  /* Rank by class and level; 0 first. */
+	struct disk_share *share;       /* Submitting thread's share. */
+	uint64_t vstart;                /* Virtual start time on the channel. */
+};
+
 void disk_init (void);
 void disk_print_stats (void);
 
@@ -22,6 +98,34 @@ struct disk *disk_get (int chan_no, int dev_no);
 disk_sector_t disk_size (struct disk *);
 void disk_read (struct disk *, disk_sector_t, void *);
 void disk_write (struct disk *, disk_sector_t, const void *);
+void disk_read_multiple (struct disk *, disk_sector_t, size_t cnt, void *);
+void disk_write_multiple (struct disk *, disk_sector_t, size_t cnt,
+		const void *);
+void disk_read_tagged (struct disk *, disk_sector_t, size_t cnt, void *,
+		enum disk_src);
+void disk_write_tagged (struct disk *, disk_sector_t, size_t cnt,
+		const void *, enum disk_src);
+void disk_write_ordered (struct disk *, disk_sector_t, size_t cnt,
+		const void *, enum disk_src, unsigned flags);
+void disk_flush_cache (struct disk *);
+
+enum disk_ioclass disk_set_ioclass (enum disk_ioclass);
+
+void disk_submit (struct disk_req *);
+void disk_wait (struct disk_req *);
+
+/* A disk driver other than ATA's, such as virtio-blk.c.  SUBMIT
+   queues a request, which disk_submit() has checked and counted,
+   for the disk that AUX, as passed to disk_attach(), stands for. */
+struct disk_driver {
+	const char *name;               /* e.g. "virtio". */
+	void (*submit) (void *aux, struct disk_req *);
+};
+
+struct disk *disk_attach (const char *name, disk_sector_t capacity,
+		const struct disk_driver *, void *aux);
+void disk_account_cmd (struct disk *, size_t cnt, bool write);
+void disk_complete (struct disk_req *);
 
 void 	register_disk_inspect_intr ();
 #endif /* devices/disk.h */
@@ -1,23 +1,31 @@
 #ifndef DEVICES_INTQ_H
 #define DEVICES_INTQ_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include "threads/interrupt.h"
 #include "threads/synch.h"
 
 /* An "interrupt queue", a circular buffer shared between
    kernel threads and external interrupt handlers.
 
-   Interrupt queue functions can be called from kernel threads or
-   from external interrupt handlers.  Except for intq_init(),
-   interrupts must be off in either case.
-
-   The interrupt queue has the structure of a "monitor".  Locks
-   and condition variables from threads/synch.h cannot be used in
-   this case, as they normally would, because they can only
-   protect kernel threads from one another, not from interrupt
-   handlers. */
-
-/* Queue buffer size, in bytes. */
+   The queue is single-producer, single-consumer: one party at a
+   time may add bytes and one at a time may remove them, much as
+   the keyboard and serial interrupt handlers add keys and
+   input_getc() removes them.  Callers with more than one of
+   either must serialize them themselves, as input.c does by
+   turning interrupts off.  Given that, adding and removing need
+   no lock and interrupts may be on or off: each side publishes
+   its index with a release store and reads the other's with an
+   acquire load.
+
+   Only a thread that must wait, for data when the queue is empty
+   or for room when it is full, turns interrupts off, to sleep.
+   Interrupt handlers must never wait: they may only remove from a
+   queue that is not empty and add to one with room. */
+
+/* Capacity, in bytes, of a queue made by intq_init(). */
 #define INTQ_BUFSIZE 64
 
 /* A circular queue of bytes. */
@@ -27,16 +35,24 @@ struct intq {
 	struct thread *not_full;    /* Thread waiting for not-full condition. */
 	struct thread *not_empty;   /* Thread waiting for not-empty condition. */
 
-	/* Queue. */
-	uint8_t buf[INTQ_BUFSIZE];  /* Buffer. */
-	int head;                   /* New data is written here. */
-	int tail;                   /* Old data is read here. */
+	/* Queue.  HEAD and TAIL run freely and are reduced modulo
+	   CAPACITY, a power of 2, on use, so the queue holds HEAD - TAIL
+	   bytes. */
+	uint8_t *buf;               /* Buffer, BUF_INLINE or allocated. */
+	size_t capacity;            /* Size of BUF. */
+	size_t head;                /* New data is written here. */
+	size_t tail;                /* Old data is read here. */
+	uint8_t buf_inline[INTQ_BUFSIZE];
 };
 
 void intq_init (struct intq *);
+bool intq_init_capacity (struct intq *, size_t capacity);
+void intq_destroy (struct intq *);
 bool intq_empty (const struct intq *);
 bool intq_full (const struct intq *);
 uint8_t intq_getc (struct intq *);
 void intq_putc (struct intq *, uint8_t);
+size_t intq_get_buf (struct intq *, void *, size_t);
+void intq_put_buf (struct intq *, const void *, size_t);
 
 #endif /* devices/intq.h */
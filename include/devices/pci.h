@@ -0,0 +1,14 @@
+#ifndef DEVICES_PCI_H
+#define DEVICES_PCI_H
+
+#include <stdint.h>
+#include "threads/interrupt.h"
+
+/* PCI configuration space, through configuration mechanism #1. */
+uint32_t pci_read_config (int bus, int dev, int func, int reg);
+void pci_write_config (int bus, int dev, int func, int reg, uint32_t value);
+
+void pci_register_intr (uint8_t line, intr_handler_func *, const char *name);
+uint64_t pci_dma_addr (const void *);
+
+#endif /* devices/pci.h */
@@ -2,22 +2,35 @@
 #define DEVICES_TIMER_H
 
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /* Number of timer interrupts per second. */
 #define TIMER_FREQ 100
 
+extern bool timer_tickless;
+
 void timer_init (void);
 void timer_calibrate (void);
+void timer_init_ap (void);
 
 int64_t timer_ticks (void);
 int64_t timer_elapsed (int64_t);
+int64_t timer_clock (void);
+int64_t timer_ns (void);
+void timer_arm (int64_t clock);
+int64_t timer_deadline (int64_t ms);
 
 void timer_sleep (int64_t ticks);
 void timer_msleep (int64_t milliseconds);
 void timer_usleep (int64_t microseconds);
 void timer_nsleep (int64_t nanoseconds);
 
+void timer_idle_enter (int64_t deadline);
+void timer_idle_exit (void);
+
+void *timer_page (void);
+
 void timer_print_stats (void);
 
 #endif /* devices/timer.h */
@@ -0,0 +1,24 @@
+#ifndef FILESYS_DCACHE_H
+#define FILESYS_DCACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/disk.h"
+
+/* Child sector recorded for a name known not to exist.  Sector 0
+ * holds the free map, so it is never a file's inode. */
+#define DCACHE_NEGATIVE ((disk_sector_t) 0)
+
+void dcache_init (void);
+bool dcache_lookup (disk_sector_t parent, const char *name,
+		disk_sector_t *child);
+void dcache_insert (disk_sector_t parent, const char *name,
+		disk_sector_t child);
+bool dcache_lookup_link (disk_sector_t parent, const char *name,
+		char *target, size_t size);
+void dcache_insert_link (disk_sector_t parent, const char *name,
+		disk_sector_t child, const char *target);
+void dcache_invalidate (disk_sector_t parent, const char *name);
+void dcache_print_stats (void);
+
+#endif /* filesys/dcache.h */
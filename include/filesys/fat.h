@@ -14,19 +14,38 @@ typedef uint32_t cluster_t;  /* Index of a cluster within FAT. */
 #define EOChain 0x0FFFFFFF   /* End of cluster chain */
 
 /* Sectors of FAT information. */
-#define SECTORS_PER_CLUSTER 1 /* Number of sectors per cluster */
+#define SECTORS_PER_CLUSTER 1 /* Default number of sectors per cluster */
+#define MAX_SECTORS_PER_CLUSTER 8 /* One page per cluster */
 #define FAT_BOOT_SECTOR 0     /* FAT boot sector. */
 #define ROOT_DIR_CLUSTER 1    /* Cluster for the root directory */
 
+/* In-memory index of one cluster chain, so that finding the Nth
+ * cluster of a file does not mean following the FAT from the
+ * head every time.  Filled lazily as the chain is walked, and
+ * rebuilt after any fat_remove_chain(), which may have cut it. */
+struct fat_chain {
+	cluster_t head;         /* First cluster of the chain. */
+	cluster_t *clusters;    /* Clusters walked so far, in chain order. */
+	size_t cnt;             /* Number of valid entries in CLUSTERS. */
+	size_t capacity;        /* Number of entries allocated. */
+	unsigned gen;           /* Removal generation CLUSTERS reflects. */
+};
+
+/* Sectors per cluster used when formatting (-spc=N).  An existing
+ * file system keeps the cluster size it was formatted with. */
+extern unsigned fat_format_spc;
+
 void fat_init (void);
 void fat_open (void);
 void fat_close (void);
 void fat_create (void);
 void fat_close (void);
+void fat_flush (void);
 
 cluster_t fat_create_chain (
     cluster_t clst /* Cluster # to stretch, 0: Create a new chain */
 );
+cluster_t fat_create_chain_n (cluster_t clst, size_t cnt);
 void fat_remove_chain (
     cluster_t clst, /* Cluster # to be removed */
     cluster_t pclst /* Previous cluster of clst, 0: clst is the start of chain */
@@ -35,4 +54,8 @@ cluster_t fat_get (cluster_t clst);
 void fat_put (cluster_t clst, cluster_t val);
 disk_sector_t cluster_to_sector (cluster_t clst);
 
+void fat_chain_init (struct fat_chain *, cluster_t head);
+void fat_chain_destroy (struct fat_chain *);
+cluster_t fat_chain_nth (struct fat_chain *, size_t n);
+
 #endif /* filesys/fat.h */
@@ -1,10 +1,13 @@
 #ifndef FILESYS_FILE_H
 #define FILESYS_FILE_H
 
+#include <stdbool.h>
 #include "filesys/off_t.h"
 
 struct inode;
 
+void file_init (void);
+
 /* Opening and closing files. */
 struct file *file_open (struct inode *);
 struct file *file_reopen (struct file *);
@@ -17,6 +20,9 @@ off_t file_read (struct file *, void *, off_t);
 off_t file_read_at (struct file *, void *, off_t size, off_t start);
 off_t file_write (struct file *, const void *, off_t);
 off_t file_write_at (struct file *, const void *, off_t size, off_t start);
+off_t file_copy_range (struct file *in, off_t in_ofs, struct file *out,
+		off_t out_ofs, off_t size);
+bool file_allocate (struct file *, off_t offset, off_t size);
 
 /* Preventing writes. */
 void file_deny_write (struct file *);
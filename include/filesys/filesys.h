@@ -8,6 +8,27 @@
 #define FREE_MAP_SECTOR 0       /* Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1       /* Root directory file inode sector. */
 
+/* Longest symbolic link target. */
+#define SYMLINK_MAX_LEN 255
+
+struct dir;
+struct inode;
+
+/* Operations of a kind of file system that can be mounted. */
+struct fs_ops {
+	const char *name;
+
+	/* Makes a new, empty file system and returns its root
+	 * directory's inode, or a null pointer on failure. */
+	struct inode *(*mount) (void);
+
+	/* Discards the file system with root ROOT. */
+	void (*unmount) (struct inode *root);
+
+	/* Creates a file NAME of INITIAL_SIZE bytes in DIR. */
+	bool (*create) (struct dir *, const char *name, off_t initial_size);
+};
+
 /* Disk used for file system. */
 extern struct disk *filesys_disk;
 
@@ -16,5 +37,8 @@ void filesys_done (void);
 bool filesys_create (const char *name, off_t initial_size);
 struct file *filesys_open (const char *name);
 bool filesys_remove (const char *name);
+bool filesys_symlink (const char *target, const char *linkpath);
+bool filesys_mount (const char *path, const struct fs_ops *);
+bool filesys_umount (const char *path);
 
 #endif /* filesys/filesys.h */
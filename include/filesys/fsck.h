@@ -0,0 +1,8 @@
+#ifndef FILESYS_FSCK_H
+#define FILESYS_FSCK_H
+
+#include <stdbool.h>
+
+bool fsck (bool repair);
+
+#endif /* filesys/fsck.h */
@@ -2,13 +2,18 @@
 #define FILESYS_INODE_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "filesys/off_t.h"
 #include "devices/disk.h"
 
 struct bitmap;
+struct mount;
+struct rwlock;
 
 void inode_init (void);
-bool inode_create (disk_sector_t, off_t);
+bool inode_create (disk_sector_t, off_t, bool is_dir);
+struct inode *inode_create_mem (disk_sector_t inumber, off_t length,
+		bool is_dir);
 struct inode *inode_open (disk_sector_t);
 struct inode *inode_reopen (struct inode *);
 disk_sector_t inode_get_inumber (const struct inode *);
@@ -16,8 +21,22 @@ void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+void inode_readahead (struct inode *, off_t offset, off_t size);
+void inode_prefetch (disk_sector_t);
+void inode_flush (struct inode *);
+bool inode_allocate (struct inode *, off_t length);
+void inode_writeback (void);
+bool inode_check (disk_sector_t, struct bitmap *used);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
+bool inode_is_removed (const struct inode *);
+bool inode_is_dir (const struct inode *);
+bool inode_is_symlink (const struct inode *);
+bool inode_make_symlink (struct inode *, const char *target);
+struct mount *inode_get_mount (const struct inode *);
+void inode_set_mount (struct inode *, struct mount *);
+uint64_t inode_version (const struct inode *);
 off_t inode_length (const struct inode *);
+struct rwlock *inode_dir_lock (struct inode *);
 
 #endif /* filesys/inode.h */
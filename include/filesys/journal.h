@@ -0,0 +1,29 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include "devices/disk.h"
+
+/* Metadata journal region, reserved on the disk next to the free
+   map and root directory inodes: a superblock at JOURNAL_SECTOR,
+   then JOURNAL_SECTORS - 1 sectors of log. */
+#define JOURNAL_SECTOR 2
+#define JOURNAL_SECTORS 128
+
+/* Most metadata sectors one transaction can log. */
+#define JOURNAL_TXN_MAX 32
+
+void journal_init (void);
+void journal_create (void);
+void journal_open (void);
+void journal_close (void);
+bool journal_was_clean (void);
+
+void journal_begin (void);
+void journal_end (void);
+void journal_write (disk_sector_t, const void *, int ofs, int size);
+void journal_commit (void);
+
+void journal_print_stats (void);
+
+#endif /* filesys/journal.h */
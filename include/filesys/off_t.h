@@ -5,11 +5,15 @@
 
 /* An offset within a file.
  * This is a separate header because multiple headers want this
- * definition but not any others. */
-typedef int32_t off_t;
+ * definition but not any others.  It is 64 bits wide, so that files
+ * may grow past 2 GB. */
+typedef int64_t off_t;
+
+/* Largest offset. */
+#define OFF_T_MAX INT64_MAX
 
 /* Format specifier for printf(), e.g.:
  * printf ("offset=%"PROTd"\n", offset); */
-#define PROTd PRId32
+#define PROTd PRId64
 
 #endif /* filesys/off_t.h */
@@ -1,12 +1,30 @@
 #ifndef FILESYS_PAGE_CACHE_H
 #define FILESYS_PAGE_CACHE_H
-#include "vm/vm.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/disk.h"
+#include "threads/vaddr.h"
 
 struct page;
 enum vm_type;
 
 struct page_cache {};
 
+/* Each cache entry holds one page worth of consecutive sectors. */
+#define PAGE_CACHE_SECTORS (PGSIZE / DISK_SECTOR_SIZE)
+
 void page_cache_init (void);
 bool page_cache_initializer (struct page *page, enum vm_type type, void *kva);
+
+void page_cache_read (disk_sector_t, void *, int ofs, int size);
+void page_cache_read_tagged (disk_sector_t, void *, int ofs, int size,
+		enum disk_src);
+void page_cache_write (disk_sector_t, const void *, int ofs, int size);
+void page_cache_write_held (disk_sector_t, const void *, int ofs, int size);
+void page_cache_unhold (disk_sector_t);
+void page_cache_prefetch (disk_sector_t);
+void page_cache_flush (void);
+void page_cache_flush_range (disk_sector_t first, size_t cnt);
+void page_cache_balance (void);
+void page_cache_print_stats (void);
 #endif
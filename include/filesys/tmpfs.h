@@ -0,0 +1,29 @@
+#ifndef FILESYS_TMPFS_H
+#define FILESYS_TMPFS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+#include "devices/disk.h"
+
+/* Inode numbers from here up belong to tmpfs inodes, which live
+   in memory only.  No disk is that large. */
+#define TMPFS_INUMBER_BASE 0x80000000u
+
+struct fs_ops;
+struct tmpfs_data;
+
+/* For filesys_mount(). */
+extern const struct fs_ops tmpfs_fs_ops;
+
+/* File contents, for inode.c. */
+struct tmpfs_data *tmpfs_data_create (void);
+void tmpfs_data_destroy (struct tmpfs_data *);
+off_t tmpfs_read (struct tmpfs_data *, void *, off_t size, off_t offset,
+		off_t length);
+off_t tmpfs_write (struct tmpfs_data *, const void *, off_t size,
+		off_t offset);
+
+void tmpfs_print_stats (void);
+
+#endif /* filesys/tmpfs.h */
@@ -119,6 +119,36 @@ static __inline uint64_t rcr2(void) {
 	return val;
 }
 
+__attribute__((always_inline))
+static __inline uint64_t rcr0(void) {
+	uint64_t val;
+	__asm __volatile("movq %%cr0,%0" : "=r" (val));
+	return val;
+}
+
+__attribute__((always_inline))
+static __inline void lcr0(uint64_t val) {
+	__asm __volatile("movq %0, %%cr0" : : "r" (val));
+}
+
+__attribute__((always_inline))
+static __inline uint64_t rcr4(void) {
+	uint64_t val;
+	__asm __volatile("movq %%cr4,%0" : "=r" (val));
+	return val;
+}
+
+__attribute__((always_inline))
+static __inline void lcr4(uint64_t val) {
+	__asm __volatile("movq %0, %%cr4" : : "r" (val));
+}
+
+/* Clears CR0.TS.  See [IA32-v2a] "CLTS". */
+__attribute__((always_inline))
+static __inline void clts(void) {
+	__asm __volatile("clts" : : : "memory");
+}
+
 __attribute__((always_inline))
 static __inline void write_msr(uint32_t ecx, uint64_t val) {
 	uint32_t edx, eax;
@@ -128,4 +158,55 @@ static __inline void write_msr(uint32_t ecx, uint64_t val) {
 			:: "c" (ecx), "d" (edx), "a" (eax) );
 }
 
+__attribute__((always_inline))
+static __inline uint64_t read_msr(uint32_t ecx) {
+	uint32_t edx, eax;
+	__asm __volatile("rdmsr"
+			: "=d" (edx), "=a" (eax) : "c" (ecx));
+	return ((uint64_t) edx << 32) | eax;
+}
+
+/* Reads the time-stamp counter.  See [IA32-v2b] "RDTSC". */
+__attribute__((always_inline))
+static __inline uint64_t rdtsc(void) {
+	uint32_t lo, hi;
+	__asm __volatile("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((uint64_t) hi << 32) | lo;
+}
+
+/* Returns the index of the most significant set bit in VAL,
+   which must be nonzero.  See [IA32-v2a] "BSR". */
+__attribute__((always_inline))
+static __inline uint64_t bsrq(uint64_t val) {
+	uint64_t idx;
+	__asm __volatile("bsrq %1,%0" : "=r" (idx) : "rm" (val) : "cc");
+	return idx;
+}
+
+/* Executes CPUID for LEAF and SUBLEAF, storing the resulting
+   registers into REGS in the order EAX, EBX, ECX, EDX.  See
+   [IA32-v2a] "CPUID". */
+__attribute__((always_inline))
+static __inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t regs[4]) {
+	__asm __volatile("cpuid"
+			: "=a" (regs[0]), "=b" (regs[1]), "=c" (regs[2]), "=d" (regs[3])
+			: "a" (leaf), "c" (subleaf));
+}
+
+/* Arms address monitoring on the cache line that holds ADDR, so
+   that a following MWAIT returns as soon as it is written.  See
+   [IA32-v2b] "MONITOR". */
+__attribute__((always_inline))
+static __inline void monitor(const volatile void *addr) {
+	__asm __volatile("monitor" : : "a" (addr), "c" (0), "d" (0) : "memory");
+}
+
+/* Invalidates the TLB entries that TYPE selects for the PCID and
+   linear address in DESC.  See [IA32-v2a] "INVPCID". */
+__attribute__((always_inline))
+static __inline void invpcid(uint64_t type, uint64_t pcid, uint64_t addr) {
+	struct { uint64_t pcid, addr; } desc = { pcid, addr };
+	__asm __volatile("invpcid %0,%1" : : "m" (desc), "r" (type) : "memory");
+}
+
 #endif /* intrinsic.h */
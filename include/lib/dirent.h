@@ -0,0 +1,26 @@
+#ifndef __LIB_DIRENT_H
+#define __LIB_DIRENT_H
+
+#include <stdint.h>
+
+/* One directory entry as readdir_batch() returns it, shared
+   between the kernel and user programs.  The call packs as many
+   as fit into the caller's buffer, each D_RECLEN bytes long, so
+   the next one starts at (char *) d + d->d_reclen. */
+struct dirent {
+	uint32_t d_ino;             /* Inode number. */
+	uint16_t d_reclen;          /* Length of this record. */
+	uint8_t d_type;             /* DT_* type of the file. */
+	char d_name[];              /* Null-terminated name. */
+};
+
+/* File types. */
+#define DT_UNKNOWN 0
+#define DT_REG 1                /* Regular file. */
+#define DT_DIR 2                /* Directory. */
+
+/* Returns the length of a record for a name NAME_LEN bytes long. */
+#define DIRENT_RECLEN(NAME_LEN) \
+	((sizeof (struct dirent) + (NAME_LEN) + 1 + 3) & ~3)
+
+#endif /* lib/dirent.h */
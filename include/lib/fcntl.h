@@ -0,0 +1,11 @@
+#ifndef __LIB_FCNTL_H
+#define __LIB_FCNTL_H
+
+/* Commands for the fcntl() system call. */
+#define F_GETFL 3               /* Return the descriptor's flags. */
+#define F_SETFL 4               /* Set them to the argument. */
+
+/* Descriptor flags. */
+#define O_NONBLOCK 0x800        /* Fail reads and writes that would block. */
+
+#endif /* lib/fcntl.h */
@@ -0,0 +1,51 @@
+#ifndef __LIB_FSTRACE_H
+#define __LIB_FSTRACE_H
+
+#include <stdint.h>
+
+/* File system system calls recorded by a kernel run with
+   "-fstrace", in the trace that `pintos --fstrace FILE' copies out:
+   a 512-byte sector holding a struct fstrace_header, then the
+   records, in the order the calls returned.  Shared between the
+   kernel and tests/bench/fs-replay. */
+
+/* Calls recorded.  Append new ones at the end. */
+enum fstrace_op {
+	FSTRACE_CREATE,             /* SIZE is the initial size. */
+	FSTRACE_REMOVE,
+	FSTRACE_OPEN,               /* SIZE is the file's length. */
+	FSTRACE_CLOSE,
+	FSTRACE_READ,               /* pread() or readv(). */
+	FSTRACE_WRITE,              /* pwrite() or writev(). */
+	FSTRACE_SEEK,
+	FSTRACE_FSYNC,
+	FSTRACE_FALLOCATE,
+	FSTRACE_OP_CNT
+};
+
+/* One call.  A call that names a path (create, remove, open) has
+   FD -1 on entry, and its OFFSET is a hash of the path as the
+   process gave it, which stands for the file in a replay; an open
+   records the descriptor it returned in RESULT.  The others give
+   the descriptor and the file offset they started at. */
+struct fstrace_record {
+	uint64_t time;              /* Nanoseconds from the start of tracing. */
+	uint64_t latency;           /* Nanoseconds the call took. */
+	int64_t offset;             /* File offset, or path hash. */
+	uint32_t size;              /* Bytes asked for, or a length. */
+	int32_t result;             /* Return value. */
+	int32_t pid;                /* Process that made the call. */
+	int16_t fd;                 /* Descriptor, or -1. */
+	uint8_t op;                 /* enum fstrace_op. */
+	uint8_t reserved;
+};
+
+/* Starts the trace. */
+struct fstrace_header {
+	char magic[4];              /* "FST\0". */
+	uint32_t record_size;       /* sizeof (struct fstrace_record). */
+	uint64_t record_cnt;        /* Records that follow. */
+	uint64_t lost_cnt;          /* Later calls not recorded. */
+};
+
+#endif /* lib/fstrace.h */
@@ -0,0 +1,48 @@
+#ifndef __LIB_IORING_H
+#define __LIB_IORING_H
+
+#include <stdint.h>
+
+/* Submission ring, shared between the kernel and the enter_ring()
+   system call.
+
+   A process batches system calls by queueing submission entries in
+   an io_ring in its own memory, then calls enter_ring() once.  The
+   kernel runs the entries from SQ_HEAD up to SQ_TAIL in order,
+   posting one completion for each at CQ_TAIL, and stops early if
+   the completion queue fills.  The indices run freely and are
+   taken modulo IORING_ENTRIES; the kernel advances only SQ_HEAD and
+   CQ_TAIL, and the process only SQ_TAIL and CQ_HEAD.
+
+   Only calls that neither end nor replace the process may be
+   queued: open, close, write, the positional and vectored reads and
+   writes, fsync and copy_file_range.  Any other entry completes
+   with -1. */
+
+/* Entries in each queue, a power of two. */
+#define IORING_ENTRIES 32
+
+/* A queued system call. */
+struct ioring_sqe {
+	uint32_t op;                /* System call number. */
+	uint32_t reserved;          /* Must be zero. */
+	uint64_t args[6];           /* Arguments, as for the call itself. */
+	uint64_t user_data;         /* Copied to the completion. */
+};
+
+/* The result of a queued system call. */
+struct ioring_cqe {
+	int64_t res;                /* The call's return value. */
+	uint64_t user_data;         /* From the submission. */
+};
+
+struct io_ring {
+	uint32_t sq_head;           /* Next submission to run. */
+	uint32_t sq_tail;           /* End of the queued submissions. */
+	uint32_t cq_head;           /* Next completion to reap. */
+	uint32_t cq_tail;           /* End of the posted completions. */
+	struct ioring_sqe sq[IORING_ENTRIES];
+	struct ioring_cqe cq[IORING_ENTRIES];
+};
+
+#endif /* lib/ioring.h */
@@ -0,0 +1,16 @@
+#ifndef __LIB_IOVEC_H
+#define __LIB_IOVEC_H
+
+#include <stddef.h>
+
+/* One buffer of a vectored read or write, shared between the
+   kernel and the readv() and writev() system calls. */
+struct iovec {
+	void *iov_base;             /* Start of the buffer. */
+	size_t iov_len;             /* Its length in bytes. */
+};
+
+/* Most buffers that one readv() or writev() takes. */
+#define IOV_MAX 64
+
+#endif /* lib/iovec.h */
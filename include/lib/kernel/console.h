@@ -1,8 +1,16 @@
 #ifndef __LIB_KERNEL_CONSOLE_H
 #define __LIB_KERNEL_CONSOLE_H
 
+#include <stdbool.h>
+#include <stddef.h>
+
 void console_init (void);
+void console_register_sink (const char *name,
+		void (*putbuf) (const char *, size_t));
+bool console_select_sinks (const char *names);
 void console_panic (void);
 void console_print_stats (void);
+void acquire_console (void);
+void release_console (void);
 
 #endif /* lib/kernel/console.h */
@@ -0,0 +1,18 @@
+#ifndef __LIB_KERNEL_CRC32C_H
+#define __LIB_KERNEL_CRC32C_H
+
+/* CRC-32C (Castagnoli).
+ *
+ * The checksum that iSCSI, ext4 and btrfs keep on their metadata,
+ * which x86 processors with SSE4.2 compute in hardware with the
+ * crc32 instruction.  crc32c() extends the running CRC given by its
+ * first argument and neither inverts it going in nor coming out, so
+ * that a checksum can be computed a piece at a time.  With a seed of
+ * 0, a buffer of zeros has a checksum of 0. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint32_t crc32c (uint32_t crc, const void *, size_t);
+
+#endif /* lib/kernel/crc32c.h */
@@ -54,11 +54,19 @@ typedef bool hash_less_func (const struct hash_elem *a,
  * data AUX. */
 typedef void hash_action_func (struct hash_elem *e, void *aux);
 
-/* Hash table. */
+/* Hash table.
+
+   Resizing is incremental: while OLD_BUCKETS is non-null, the
+   elements of old buckets MIGRATE_IDX and up have yet to move to
+   BUCKETS, and each insertion or deletion moves a few more. */
 struct hash {
 	size_t elem_cnt;            /* Number of elements in table. */
 	size_t bucket_cnt;          /* Number of buckets, a power of 2. */
 	struct list *buckets;       /* Array of `bucket_cnt' lists. */
+	size_t min_bucket_cnt;      /* Never shrink below this many buckets. */
+	size_t old_bucket_cnt;      /* Number of old buckets, a power of 2. */
+	struct list *old_buckets;   /* Buckets being emptied, or null. */
+	size_t migrate_idx;         /* First old bucket not yet moved. */
 	hash_hash_func *hash;       /* Hash function. */
 	hash_less_func *less;       /* Comparison function. */
 	void *aux;                  /* Auxiliary data for `hash' and `less'. */
@@ -73,6 +81,8 @@ struct hash_iterator {
 
 /* Basic life cycle. */
 bool hash_init (struct hash *, hash_hash_func *, hash_less_func *, void *aux);
+bool hash_init_sized (struct hash *, size_t elem_cnt,
+		hash_hash_func *, hash_less_func *, void *aux);
 void hash_clear (struct hash *, hash_action_func *);
 void hash_destroy (struct hash *, hash_action_func *);
 
@@ -96,5 +106,7 @@ bool hash_empty (struct hash *);
 uint64_t hash_bytes (const void *, size_t);
 uint64_t hash_string (const char *);
 uint64_t hash_int (int);
+uint64_t hash_u64 (uint64_t);
+uint64_t hash_ptr (const void *);
 
 #endif /* lib/kernel/hash.h */
@@ -0,0 +1,69 @@
+#ifndef __LIB_KERNEL_HEAP_H
+#define __LIB_KERNEL_HEAP_H
+
+/* Priority queue.
+ *
+ * This is an intrusive pairing heap.  Like the list and hash
+ * table implementations, it does no dynamic allocation: each
+ * structure that can be in a heap embeds a struct heap_elem
+ * member, and the heap_entry macro converts a struct heap_elem
+ * back to the structure object that contains it.
+ *
+ * The heap is ordered by a caller-supplied "less" function, and
+ * heap_top() returns a greatest element, in the same sense as
+ * list_max().  For a min-heap, supply a "greater" function.
+ *
+ * heap_push(), heap_top() and heap_increase() take O(1) time;
+ * heap_pop(), heap_remove() and heap_update() take O(log n)
+ * amortized time.
+ * Elements of equal rank come out in no particular order, so a
+ * caller that needs FIFO behavior among equals must break ties
+ * in its comparison function. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Heap element. */
+struct heap_elem {
+	struct heap_elem *child;    /* Leftmost child. */
+	struct heap_elem *next;     /* Next sibling. */
+	struct heap_elem *prev;     /* Parent if leftmost child, otherwise
+	                               previous sibling; null for the root. */
+};
+
+/* Converts pointer to heap element HEAP_ELEM into a pointer to
+ * the structure that HEAP_ELEM is embedded inside.  Supply the
+ * name of the outer structure STRUCT and the member name MEMBER
+ * of the heap element. */
+#define heap_entry(HEAP_ELEM, STRUCT, MEMBER)           \
+	((STRUCT *) ((uint8_t *) &(HEAP_ELEM)->child        \
+		- offsetof (STRUCT, MEMBER.child)))
+
+/* Compares the value of two heap elements A and B, given
+ * auxiliary data AUX.  Returns true if A is less than B, or
+ * false if A is greater than or equal to B. */
+typedef bool heap_less_func (const struct heap_elem *a,
+		const struct heap_elem *b, void *aux);
+
+/* Heap. */
+struct heap {
+	struct heap_elem *root;     /* Greatest element, or null. */
+	size_t elem_cnt;            /* Number of elements in heap. */
+	heap_less_func *less;       /* Comparison function. */
+	void *aux;                  /* Auxiliary data for `less'. */
+};
+
+void heap_init (struct heap *, heap_less_func *, void *aux);
+
+size_t heap_size (const struct heap *);
+bool heap_empty (const struct heap *);
+struct heap_elem *heap_top (const struct heap *);
+
+void heap_push (struct heap *, struct heap_elem *);
+struct heap_elem *heap_pop (struct heap *);
+void heap_remove (struct heap *, struct heap_elem *);
+void heap_update (struct heap *, struct heap_elem *);
+void heap_increase (struct heap *, struct heap_elem *);
+
+#endif /* lib/kernel/heap.h */
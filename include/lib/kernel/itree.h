@@ -0,0 +1,53 @@
+#ifndef __LIB_KERNEL_ITREE_H
+#define __LIB_KERNEL_ITREE_H
+
+/* Interval tree.
+ *
+ * An intrusive set of half-open intervals [START, END) that finds
+ * the intervals overlapping a query range in O(log n) time per
+ * interval found.  It is a red-black tree ordered by start, in
+ * which each node also caches the greatest end in its subtree, so
+ * that a search can skip any subtree whose intervals all end
+ * before the range begins.  Intervals may overlap and may be
+ * equal; each structure in a tree embeds a struct itree_node,
+ * which itree_entry converts back to the structure. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "rbtree.h"
+
+/* Tree node: an interval. */
+struct itree_node {
+	struct rb_node rb;          /* Red-black tree node. */
+	uint64_t start;             /* First value in the interval. */
+	uint64_t end;               /* End of the interval, exclusive. */
+	uint64_t max_end;           /* Greatest END in this subtree. */
+};
+
+/* Converts pointer to tree node ITREE_NODE into a pointer to the
+ * structure that ITREE_NODE is embedded inside.  Supply the name
+ * of the outer structure STRUCT and the member name MEMBER of the
+ * tree node. */
+#define itree_entry(ITREE_NODE, STRUCT, MEMBER)         \
+	((STRUCT *) ((uint8_t *) &(ITREE_NODE)->rb         \
+		- offsetof (STRUCT, MEMBER.rb)))
+
+/* Interval tree. */
+struct itree {
+	struct rb_tree tree;
+};
+
+void itree_init (struct itree *);
+size_t itree_size (const struct itree *);
+bool itree_empty (const struct itree *);
+
+void itree_insert (struct itree *, struct itree_node *,
+		uint64_t start, uint64_t end);
+void itree_remove (struct itree *, struct itree_node *);
+
+struct itree_node *itree_first (struct itree *, uint64_t start, uint64_t end);
+struct itree_node *itree_next (struct itree_node *,
+		uint64_t start, uint64_t end);
+
+#endif /* lib/kernel/itree.h */
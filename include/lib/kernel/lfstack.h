@@ -0,0 +1,48 @@
+#ifndef __LIB_KERNEL_LFSTACK_H
+#define __LIB_KERNEL_LFSTACK_H
+
+/* Lock-free stack.
+ *
+ * An intrusive singly linked stack that any number of CPUs, and
+ * interrupt handlers, may push onto without a lock.  Elements are
+ * only taken off all at once with lfstack_pop_all(), which swaps
+ * the whole stack out in one exchange: popping one element with a
+ * compare-and-exchange would suffer from ABA, an element popped
+ * and pushed again between a reader's load and its exchange, and
+ * taking everything avoids that with no tags or hazard pointers.
+ * The caller then owns the detached elements, newest first, and
+ * may walk them with plain loads.
+ *
+ * As with the other lists, no allocation is done: embed a struct
+ * lfstack_elem and use lfstack_entry() to get back to the outer
+ * structure. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Stack element. */
+struct lfstack_elem {
+	struct lfstack_elem *next;      /* Next older element, or null. */
+};
+
+/* Stack. */
+struct lfstack {
+	struct lfstack_elem *top;       /* Newest element, or null. */
+};
+
+/* Converts pointer to stack element LFSTACK_ELEM into a pointer
+ * to the structure that LFSTACK_ELEM is embedded inside.  Supply
+ * the name of the outer structure STRUCT and the member name
+ * MEMBER of the stack element. */
+#define lfstack_entry(LFSTACK_ELEM, STRUCT, MEMBER)     \
+	((STRUCT *) ((uint8_t *) &(LFSTACK_ELEM)->next      \
+		- offsetof (STRUCT, MEMBER.next)))
+
+void lfstack_init (struct lfstack *);
+void lfstack_push (struct lfstack *, struct lfstack_elem *);
+struct lfstack_elem *lfstack_pop_all (struct lfstack *);
+struct lfstack_elem *lfstack_reverse (struct lfstack_elem *);
+bool lfstack_empty (const struct lfstack *);
+
+#endif /* lib/kernel/lfstack.h */
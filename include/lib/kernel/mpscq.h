@@ -0,0 +1,52 @@
+#ifndef __LIB_KERNEL_MPSCQ_H
+#define __LIB_KERNEL_MPSCQ_H
+
+/* Lock-free multiple-producer, single-consumer queue.
+ *
+ * An intrusive FIFO queue, after Dmitry Vyukov's, that any number
+ * of CPUs and interrupt handlers may push onto without a lock, and
+ * that one consumer at a time pops from.  A push costs a single
+ * exchange, and a pop usually none.  The queue always holds a stub
+ * element of its own, so that it never has to be empty for the
+ * consumer and producers never touch the tail.
+ *
+ * A producer links its element in with two stores, and one that is
+ * stopped between them hides the rest of the queue, so mpscq_pop()
+ * may return a null pointer while pushes are in flight; a consumer
+ * that needs every element should pop again after the producer's
+ * wakeup, as it would wait anyway.  Consumers must exclude each
+ * other.
+ *
+ * No allocation is done: embed a struct mpscq_elem and use
+ * mpscq_entry() to get back to the outer structure. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Queue element. */
+struct mpscq_elem {
+	struct mpscq_elem *next;        /* Next newer element, or null. */
+};
+
+/* Queue. */
+struct mpscq {
+	struct mpscq_elem *head;        /* Newest element, for producers. */
+	struct mpscq_elem *tail;        /* Oldest element, for the consumer. */
+	struct mpscq_elem stub;         /* Placeholder when nearly empty. */
+};
+
+/* Converts pointer to queue element MPSCQ_ELEM into a pointer to
+ * the structure that MPSCQ_ELEM is embedded inside.  Supply the
+ * name of the outer structure STRUCT and the member name MEMBER
+ * of the queue element. */
+#define mpscq_entry(MPSCQ_ELEM, STRUCT, MEMBER)         \
+	((STRUCT *) ((uint8_t *) &(MPSCQ_ELEM)->next        \
+		- offsetof (STRUCT, MEMBER.next)))
+
+void mpscq_init (struct mpscq *);
+void mpscq_push (struct mpscq *, struct mpscq_elem *);
+struct mpscq_elem *mpscq_pop (struct mpscq *);
+bool mpscq_empty (const struct mpscq *);
+
+#endif /* lib/kernel/mpscq.h */
@@ -0,0 +1,65 @@
+#ifndef __LIB_KERNEL_OHASH_H
+#define __LIB_KERNEL_OHASH_H
+
+/* Open-addressing hash table.
+ *
+ * Maps 64-bit keys to non-null pointers.  Unlike the chained
+ * table in hash.h, the key and the pointer are stored inline in
+ * one array of slots, so a lookup reads a run of adjacent slots
+ * instead of following a list through elements scattered over
+ * memory, and only touches the element it is looking for.
+ *
+ * Collisions are resolved by linear probing with Robin Hood
+ * insertion: an element being inserted takes the slot of any
+ * element it meets that sits closer to its own home slot, and
+ * that element moves on instead.  Probe sequences stay short
+ * even at high load, and a lookup for a missing key can stop at
+ * the first element closer to home than the key would be.
+ * Deletion shifts the elements that follow back by one, so no
+ * tombstones build up.
+ *
+ * The table grows all at once, by doubling, when it is three
+ * quarters full.  Where that pause matters, size the table for
+ * the expected number of elements with ohash_init(). */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* A slot: empty if VALUE is null. */
+struct ohash_slot {
+	uint64_t key;
+	void *value;
+};
+
+/* Open-addressing hash table. */
+struct ohash {
+	size_t elem_cnt;            /* Number of elements in table. */
+	size_t slot_cnt;            /* Number of slots, a power of 2. */
+	size_t min_slot_cnt;        /* Never shrink below this many slots. */
+	int shift;                  /* 64 - log2 (slot_cnt). */
+	struct ohash_slot *slots;   /* Array of `slot_cnt' slots. */
+};
+
+/* Performs some operation on the element with KEY and VALUE,
+ * given auxiliary data AUX. */
+typedef void ohash_action_func (uint64_t key, void *value, void *aux);
+
+/* Basic life cycle. */
+bool ohash_init (struct ohash *, size_t elem_cnt);
+void ohash_clear (struct ohash *);
+void ohash_destroy (struct ohash *);
+
+/* Search, insertion, deletion. */
+void *ohash_find (const struct ohash *, uint64_t key);
+bool ohash_insert (struct ohash *, uint64_t key, void *value);
+void *ohash_delete (struct ohash *, uint64_t key);
+
+/* Iteration. */
+void ohash_apply (struct ohash *, ohash_action_func *, void *aux);
+
+/* Information. */
+size_t ohash_size (const struct ohash *);
+bool ohash_empty (const struct ohash *);
+
+#endif /* lib/kernel/ohash.h */
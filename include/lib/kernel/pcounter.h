@@ -0,0 +1,33 @@
+#ifndef __LIB_KERNEL_PCOUNTER_H
+#define __LIB_KERNEL_PCOUNTER_H
+
+/* Per-CPU counter.
+ *
+ * A statistics counter that each CPU adds to in its own cache
+ * line, so that CPUs bumping the same count neither take a lock
+ * nor bounce the line between them.  Reading sums the CPUs' parts,
+ * which may miss additions in flight: good for statistics, not for
+ * anything that must be exact at every moment. */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "threads/cpu.h"
+
+/* Counter. */
+struct pcounter {
+	struct {
+		int64_t value;              /* This CPU's share. */
+	} __attribute__ ((aligned (64))) cpu[CPU_MAX];
+};
+
+void pcounter_init (struct pcounter *);
+void pcounter_add (struct pcounter *, int64_t);
+int64_t pcounter_read (const struct pcounter *);
+
+/* Adds 1 to C. */
+static inline void
+pcounter_inc (struct pcounter *c) {
+	pcounter_add (c, 1);
+}
+
+#endif /* lib/kernel/pcounter.h */
@@ -0,0 +1,75 @@
+#ifndef __LIB_KERNEL_RBTREE_H
+#define __LIB_KERNEL_RBTREE_H
+
+/* Balanced binary search tree.
+ *
+ * This is an intrusive red-black tree.  Like the list, hash
+ * table and heap implementations, it does no dynamic allocation:
+ * each structure that can be in a tree embeds a struct rb_node
+ * member, and the rb_entry macro converts a struct rb_node back
+ * to the structure object that contains it.
+ *
+ * The tree is ordered by a caller-supplied "less" function and
+ * holds at most one node of each rank.  rb_insert(), rb_remove()
+ * and rb_floor() take O(log n) time; stepping through the tree
+ * with rb_first() and rb_next() visits the nodes in ascending
+ * order in O(n) time overall. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Tree node. */
+struct rb_node {
+	struct rb_node *parent;     /* Parent, or null for the root. */
+	struct rb_node *left;       /* Lesser subtree, or null. */
+	struct rb_node *right;      /* Greater subtree, or null. */
+	bool red;                   /* Red or black? */
+};
+
+/* Converts pointer to tree node RB_NODE into a pointer to the
+ * structure that RB_NODE is embedded inside.  Supply the name of
+ * the outer structure STRUCT and the member name MEMBER of the
+ * tree node. */
+#define rb_entry(RB_NODE, STRUCT, MEMBER)               \
+	((STRUCT *) ((uint8_t *) &(RB_NODE)->parent         \
+		- offsetof (STRUCT, MEMBER.parent)))
+
+/* Compares the value of two tree nodes A and B, given auxiliary
+ * data AUX.  Returns true if A is less than B, or false if A is
+ * greater than or equal to B. */
+typedef bool rb_less_func (const struct rb_node *a,
+		const struct rb_node *b, void *aux);
+
+/* Recomputes the data that node N caches about its subtree, such
+ * as the greatest end of the intervals under it, from N itself
+ * and its children, given auxiliary data AUX.  A tree built with
+ * rb_init_augmented() calls this on every node whose subtree
+ * changes, bottom-up, so each node's cache stays current. */
+typedef void rb_augment_func (struct rb_node *n, void *aux);
+
+/* Red-black tree. */
+struct rb_tree {
+	struct rb_node *root;       /* Root node, or null. */
+	size_t node_cnt;            /* Number of nodes in tree. */
+	rb_less_func *less;         /* Comparison function. */
+	rb_augment_func *augment;   /* Subtree data function, or null. */
+	void *aux;                  /* Auxiliary data for `less' and `augment'. */
+};
+
+void rb_init (struct rb_tree *, rb_less_func *, void *aux);
+void rb_init_augmented (struct rb_tree *, rb_less_func *, rb_augment_func *,
+		void *aux);
+
+size_t rb_size (const struct rb_tree *);
+bool rb_empty (const struct rb_tree *);
+
+struct rb_node *rb_insert (struct rb_tree *, struct rb_node *);
+void rb_remove (struct rb_tree *, struct rb_node *);
+struct rb_node *rb_floor (const struct rb_tree *, const struct rb_node *);
+
+struct rb_node *rb_first (const struct rb_tree *);
+struct rb_node *rb_next (struct rb_node *);
+struct rb_node *rb_prev (struct rb_node *);
+
+#endif /* lib/kernel/rbtree.h */
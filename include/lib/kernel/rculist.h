@@ -0,0 +1,55 @@
+#ifndef __LIB_KERNEL_RCULIST_H
+#define __LIB_KERNEL_RCULIST_H
+
+/* List for read-copy-update.
+ *
+ * A null-terminated singly linked list, like a hash chain, that
+ * readers may walk while one writer at a time changes it, with no
+ * lock on the read side: an element is fully initialized before a
+ * single store links it in, and removing an element leaves its own
+ * `next' pointer alone, so that a reader standing on it still finds
+ * the rest of the list.  Writers must exclude each other, and must
+ * not reuse or free a removed element until every reader that
+ * might still see it is done, as with call_rcu() in the kernel.
+ *
+ * Each element also keeps the address of the pointer that links it
+ * in, so that a writer can remove it in O(1) time.  Like the list
+ * and hash table implementations, this does no dynamic allocation;
+ * rculist_entry() converts an element back to its structure. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* List element. */
+struct rculist_elem {
+	struct rculist_elem *next;      /* Next element, or null. */
+	struct rculist_elem **pprev;    /* Pointer that links this one in. */
+};
+
+/* List. */
+struct rculist {
+	struct rculist_elem *first;     /* First element, or null. */
+};
+
+/* Converts pointer to list element RCULIST_ELEM into a pointer to
+ * the structure that RCULIST_ELEM is embedded inside.  Supply the
+ * name of the outer structure STRUCT and the member name MEMBER
+ * of the list element. */
+#define rculist_entry(RCULIST_ELEM, STRUCT, MEMBER)     \
+	((STRUCT *) ((uint8_t *) &(RCULIST_ELEM)->next      \
+		- offsetof (STRUCT, MEMBER.next)))
+
+void rculist_init (struct rculist *);
+
+/* Reading, safe against a concurrent writer. */
+struct rculist_elem *rculist_first (const struct rculist *);
+struct rculist_elem *rculist_next (const struct rculist_elem *);
+
+/* Writing, by one writer at a time. */
+void rculist_push_front (struct rculist *, struct rculist_elem *);
+void rculist_insert_after (struct rculist_elem *, struct rculist_elem *);
+void rculist_remove (struct rculist_elem *);
+bool rculist_empty (const struct rculist *);
+
+#endif /* lib/kernel/rculist.h */
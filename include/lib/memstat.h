@@ -0,0 +1,25 @@
+#ifndef __LIB_MEMSTAT_H
+#define __LIB_MEMSTAT_H
+
+/* Kernel memory accounting tags, shared between the kernel's
+   malloc() and the memstat() debug system call. */
+enum memstat_tag {
+	TAG_MISC,                   /* Untagged allocations. */
+	TAG_INODE,                  /* On-disk inodes and inode I/O. */
+	TAG_DIR,                    /* Open directories. */
+	TAG_FAT,                    /* FAT file system metadata. */
+	TAG_PROCESS,                /* Process bookkeeping. */
+	TAG_VM,                     /* Virtual memory bookkeeping. */
+	TAG_FPU,                    /* Saved FPU state. */
+	TAG_CNT                     /* Number of tags. */
+};
+
+/* Memory usage for one tag. */
+struct memstat {
+	long long live_bytes;       /* Bytes currently allocated. */
+	long long peak_bytes;       /* Greatest value of live_bytes. */
+	long long alloc_cnt;        /* Allocations so far. */
+	long long free_cnt;         /* Frees so far. */
+};
+
+#endif /* lib/memstat.h */
@@ -0,0 +1,20 @@
+#ifndef __LIB_MMAN_H
+#define __LIB_MMAN_H
+
+/* Flag for the WRITABLE argument of the mmap() system call, next to
+   the bit that makes the mapping writable: read the whole mapping in
+   and map it before returning, so that it never faults. */
+#define MAP_POPULATE 0x2
+
+/* Advice for the madvise() system call about how a range of memory
+   will be used. */
+#define MADV_NORMAL 0           /* No special treatment. */
+#define MADV_SEQUENTIAL 2       /* Read ahead far, drop pages behind. */
+#define MADV_WILLNEED 3         /* Bring the range in now. */
+#define MADV_DONTNEED 4         /* Release the range's pages now. */
+
+/* Flags for the msync() system call; exactly one must be given. */
+#define MS_ASYNC 1              /* Hand modified pages to the cache. */
+#define MS_SYNC 4               /* ...and wait until they are on disk. */
+
+#endif /* lib/mman.h */
@@ -0,0 +1,20 @@
+#ifndef __LIB_POLL_H
+#define __LIB_POLL_H
+
+/* One descriptor watched by the poll() system call, shared between
+   the kernel and user programs. */
+struct pollfd {
+	int fd;                     /* Descriptor, or negative to skip. */
+	short events;               /* Events asked for. */
+	short revents;              /* Events that occurred. */
+};
+
+/* Events.  POLLERR, POLLHUP and POLLNVAL are reported whether asked
+   for or not. */
+#define POLLIN 0x001            /* Data may be read without blocking. */
+#define POLLOUT 0x004           /* Data may be written without blocking. */
+#define POLLERR 0x008           /* The read end of a pipe is closed. */
+#define POLLHUP 0x010           /* The write end of a pipe is closed. */
+#define POLLNVAL 0x020          /* FD is not open. */
+
+#endif /* lib/poll.h */
@@ -0,0 +1,34 @@
+#ifndef __LIB_RGROUP_H
+#define __LIB_RGROUP_H
+
+#include <stddef.h>
+
+/* Disk bandwidth weights of resource groups.  Processes outside any
+   group share the disk at the default weight. */
+#define RGROUP_IO_WEIGHT_DEFAULT 100
+#define RGROUP_IO_WEIGHT_MAX 1000
+
+/* Limits of a resource group, for rgroup_create().  A limit of zero
+   is no limit; an IO_WEIGHT of zero is the default. */
+struct rgroup_limits {
+	size_t frame_max;           /* Resident frames. */
+	size_t swap_max;            /* Pages in swap. */
+	unsigned io_weight;         /* Share of disk time, relative. */
+};
+
+/* Usage of a resource group, shared between the kernel and the
+   rgroup_stat() system call.  Frames and swap are charged to the
+   process that maps a page, so a frame that several members map
+   counts once for each. */
+struct rgroup_stat {
+	int id;                     /* The group's id. */
+	size_t member_cnt;          /* Processes in the group. */
+	size_t frames;              /* Resident frames charged. */
+	size_t swap;                /* Pages in swap charged. */
+	long long reclaim_cnt;      /* Frames evicted to stay under FRAME_MAX. */
+	long long over_cnt;         /* Frames taken beyond FRAME_MAX. */
+	long long inblock;          /* Disk sectors read by members. */
+	long long oublock;          /* Disk sectors written by members. */
+};
+
+#endif /* lib/rgroup.h */
@@ -0,0 +1,27 @@
+#ifndef __LIB_RUSAGE_H
+#define __LIB_RUSAGE_H
+
+/* Whose usage getrusage() reports. */
+#define RUSAGE_SELF 0               /* The calling process. */
+#define RUSAGE_CHILDREN (-1)        /* Its children that were waited for. */
+
+/* Resource usage of a process, shared between the kernel and the
+   getrusage() system call.  Times are in timer ticks.  Disk and
+   swap transfers count toward the process whose thread made them,
+   so write-back and eviction done by the kernel's own threads are
+   left out. */
+struct rusage {
+	long long utime;            /* Ticks spent in user mode. */
+	long long stime;            /* Ticks spent in the kernel. */
+	long long minflt;           /* Page faults served without I/O. */
+	long long majflt;           /* Page faults that read the disk. */
+	long long nswapin;          /* Pages read back from swap. */
+	long long nswapout;         /* Pages written out to swap. */
+	long long inblock;          /* Disk sectors read. */
+	long long oublock;          /* Disk sectors written. */
+	long long nvcsw;            /* Blocks and yields. */
+	long long nivcsw;           /* Preemptions. */
+	long long nmigrate;         /* Moves to another CPU. */
+};
+
+#endif /* lib/rusage.h */
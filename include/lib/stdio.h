@@ -28,9 +28,9 @@ void hex_dump (uintptr_t ofs, const void *, size_t size, bool ascii);
 
 /* Internal functions. */
 void __vprintf (const char *format, va_list args,
-		void (*output) (char, void *), void *aux);
+		void (*output) (const char *, size_t, void *), void *aux);
 void __printf (const char *format,
-		void (*output) (char, void *), void *aux, ...);
+		void (*output) (const char *, size_t, void *), void *aux, ...);
 
 /* Try to be helpful. */
 #define sprintf dont_use_sprintf_use_snprintf
@@ -36,6 +36,62 @@ enum {
 
 	SYS_MOUNT,
 	SYS_UMOUNT,
+
+	/* Debugging. */
+	SYS_MEMSTAT,                /* Kernel memory usage for a tag. */
+
+	/* Durability. */
+	SYS_FSYNC,                  /* Write a file's data to disk. */
+
+	/* Positional and vectored I/O. */
+	SYS_PREAD,                  /* Read from a file at an offset. */
+	SYS_PWRITE,                 /* Write to a file at an offset. */
+	SYS_READV,                  /* Read into several buffers. */
+	SYS_WRITEV,                 /* Write from several buffers. */
+	SYS_COPY_FILE_RANGE,        /* Copy between files in the kernel. */
+
+	/* Batching. */
+	SYS_ENTER_RING,             /* Run a submission ring's entries. */
+
+	/* User-space synchronization. */
+	SYS_FUTEX_WAIT,             /* Sleep while a word holds a value. */
+	SYS_FUTEX_WAKE,             /* Wake threads sleeping on a word. */
+	SYS_CLONE,                  /* Start a thread in this process. */
+	SYS_SPAWN,                  /* Start a process running a program. */
+
+	/* Interprocess communication. */
+	SYS_PIPE,                   /* Create a pipe. */
+	SYS_SHM_OPEN,               /* Open a shared memory segment. */
+	SYS_SHM_MAP,                /* Map a shared memory segment. */
+
+	/* Accounting. */
+	SYS_GETRUSAGE,              /* Report a process's resource usage. */
+
+	/* Space management. */
+	SYS_FALLOCATE,              /* Allocate space for part of a file. */
+
+	/* Directories. */
+	SYS_READDIR_BATCH,          /* Read many directory entries. */
+
+	/* Memory hints. */
+	SYS_MADVISE,                /* Advise on the use of a memory range. */
+	SYS_MSYNC,                  /* Write back a mapped file range. */
+
+	/* Heap. */
+	SYS_SBRK,                   /* Move the program break. */
+
+	/* Multiplexing. */
+	SYS_POLL,                   /* Wait for descriptors to be ready. */
+	SYS_FCNTL,                  /* Get or set descriptor flags. */
+
+	/* Resource groups. */
+	SYS_RGROUP_CREATE,          /* Create a group and join it. */
+	SYS_RGROUP_JOIN,            /* Move into a group. */
+	SYS_RGROUP_STAT,            /* Report a group's usage. */
+
+	/* Scheduling. */
+	SYS_SCHED_SETAFFINITY,      /* Restrict a thread to some CPUs. */
+	SYS_SCHED_GETAFFINITY,      /* Report the CPUs a thread may use. */
 };
 
 #endif /* lib/syscall-nr.h */
@@ -0,0 +1,25 @@
+#ifndef __LIB_TIMEPAGE_H
+#define __LIB_TIMEPAGE_H
+
+#include <stdint.h>
+
+/* Time page, shared between the kernel's timer and user programs.
+
+   The kernel maps one read-only page at TIMEPAGE_ADDR into every
+   process and updates it on each timer tick, so user programs can
+   read the time without a system call.  SEQ is odd while an update
+   is in progress; a reader takes a consistent snapshot by retrying
+   until it sees the same even SEQ before and after reading. */
+struct timepage {
+	volatile uint32_t seq;      /* Update sequence count. */
+	uint32_t freq;              /* Timer ticks per second. */
+	int64_t ticks;              /* Timer ticks since boot. */
+	uint64_t tick_tsc;          /* Time stamp counter at that tick. */
+	uint64_t tsc_per_tick;      /* Counter cycles per tick, 0 if unknown. */
+	uint64_t boot_tsc;          /* Time stamp counter at boot. */
+};
+
+/* User virtual address of the time page. */
+#define TIMEPAGE_ADDR ((void *) 0x47500000)
+
+#endif /* lib/timepage.h */
@@ -0,0 +1,25 @@
+#ifndef __LIB_USER_POOL_H
+#define __LIB_USER_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* A pool of threads, made with clone(), that share out work within
+   the process.  See pool.c. */
+struct pool;
+
+/* Does the work for the indexes from BEGIN up to END.  AUX is as
+   passed to parallel_for(). */
+typedef void parallel_for_func (long begin, long end, void *aux);
+
+struct pool *pool_create (int thread_cnt);
+void pool_destroy (struct pool *);
+int pool_thread_cnt (const struct pool *);
+long long pool_steal_cnt (const struct pool *);
+
+void parallel_for (struct pool *, long begin, long end, long grain,
+		parallel_for_func *, void *aux);
+bool parallel_sort (struct pool *, void *array, size_t cnt, size_t size,
+		int (*compare) (const void *, const void *));
+
+#endif /* lib/user/pool.h */
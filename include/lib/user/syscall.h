@@ -3,14 +3,25 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <fcntl.h>
+#include <ioring.h>
+#include <iovec.h>
+#include <memstat.h>
+#include <mman.h>
+#include <poll.h>
+#include <rgroup.h>
+#include <rusage.h>
 #include <stddef.h>
+#include <stdint.h>
 
 /* Process identifier. */
 typedef int pid_t;
 #define PID_ERROR ((pid_t) -1)
 
-/* Map region identifier. */
-typedef int off_t;
+/* Offset within a file, as the kernel's. */
+typedef int64_t off_t;
+
+/* Returned by mmap() on failure. */
 #define MAP_FAILED ((void *) NULL)
 
 /* Maximum characters in a filename written by readdir(). */
@@ -29,18 +40,46 @@ int wait (pid_t);
 bool create (const char *file, unsigned initial_size);
 bool remove (const char *file);
 int open (const char *file);
-int filesize (int fd);
+off_t filesize (int fd);
 int read (int fd, void *buffer, unsigned length);
 int write (int fd, const void *buffer, unsigned length);
-void seek (int fd, unsigned position);
-unsigned tell (int fd);
+void seek (int fd, off_t position);
+off_t tell (int fd);
 void close (int fd);
 
 int dup2(int oldfd, int newfd);
+int fsync (int fd);
+int pread (int fd, void *buffer, unsigned length, off_t offset);
+int pwrite (int fd, const void *buffer, unsigned length, off_t offset);
+int readv (int fd, const struct iovec *iov, int iovcnt);
+int writev (int fd, const struct iovec *iov, int iovcnt);
+int copy_file_range (int fd_in, off_t off_in, int fd_out, off_t off_out,
+		unsigned length);
+int enter_ring (struct io_ring *);
+int futex_wait (unsigned *addr, unsigned val);
+int futex_wake (unsigned *addr, int cnt);
+pid_t clone (void (*fn) (void *), void *stack, void *arg);
+pid_t spawn (const char *path, char *const argv[]);
+int pipe (int fds[2]);
+int poll (struct pollfd *fds, unsigned nfds, int timeout);
+int fcntl (int fd, int cmd, int arg);
+int getrusage (int who, struct rusage *);
+int rgroup_create (const struct rgroup_limits *);
+int rgroup_join (int id);
+int rgroup_stat (int id, struct rgroup_stat *);
+int sched_setaffinity (pid_t tid, unsigned mask);
+int sched_getaffinity (pid_t tid);
+int fallocate (int fd, off_t offset, off_t length);
+int readdir_batch (int fd, void *buffer, unsigned size);
 
 /* Project 3 and optionally project 4. */
 void *mmap (void *addr, size_t length, int writable, int fd, off_t offset);
 void munmap (void *addr);
+int shm_open (const char *name, size_t size);
+void *shm_map (int fd, void *addr);
+int madvise (void *addr, size_t length, int advice);
+int msync (void *addr, size_t length, int flags);
+void *sbrk (intptr_t increment);
 
 /* Project 4 only. */
 bool chdir (const char *dir);
@@ -50,6 +89,9 @@ bool isdir (int fd);
 int inumber (int fd);
 int symlink (const char* target, const char* linkpath);
 
+/* Debugging. */
+bool memstat (int tag, struct memstat *);
+
 static inline void* get_phys_addr (void *user_addr) {
 	void* pa;
 	asm volatile ("movq %0, %%rax" ::"r"(user_addr));
@@ -0,0 +1,11 @@
+#ifndef __LIB_USER_TIME_H
+#define __LIB_USER_TIME_H
+
+#include <stdint.h>
+
+/* Reading the time from the kernel's time page, without a system
+   call. */
+int64_t time_ticks (void);
+uint64_t time_ns (void);
+
+#endif /* lib/user/time.h */
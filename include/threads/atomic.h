@@ -0,0 +1,55 @@
+#ifndef THREADS_ATOMIC_H
+#define THREADS_ATOMIC_H
+
+#include <stdbool.h>
+
+/* Atomic operations.
+ *
+ * Thin wrappers around the compiler's __atomic builtins, for data
+ * that CPUs share without a lock.  Each works on any naturally
+ * aligned integer or pointer object of up to 8 bytes, which x86-64
+ * reads and writes whole.  The read-modify-write operations compile
+ * to `lock'-prefixed instructions and are full barriers; the plain
+ * loads and stores are relaxed unless their name says otherwise.
+ *
+ * Relaxed operations order nothing but the access itself, which is
+ * what a statistics counter needs.  A release store or fence keeps
+ * the accesses before it from moving after it, and an acquire load
+ * or fence keeps those after it from moving before it, so that a
+ * reader that acquires a value stored with release also sees
+ * everything written before the store. */
+
+#define atomic_load(P) __atomic_load_n ((P), __ATOMIC_RELAXED)
+#define atomic_load_acquire(P) __atomic_load_n ((P), __ATOMIC_ACQUIRE)
+#define atomic_store(P, V) __atomic_store_n ((P), (V), __ATOMIC_RELAXED)
+#define atomic_store_release(P, V) \
+	__atomic_store_n ((P), (V), __ATOMIC_RELEASE)
+
+/* Adds V to *P, or subtracts it, and returns the old value. */
+#define atomic_fetch_add(P, V) __atomic_fetch_add ((P), (V), __ATOMIC_SEQ_CST)
+#define atomic_fetch_sub(P, V) __atomic_fetch_sub ((P), (V), __ATOMIC_SEQ_CST)
+
+/* Adds V to *P without ordering anything else, for counters. */
+#define atomic_add(P, V) \
+	((void) __atomic_fetch_add ((P), (V), __ATOMIC_RELAXED))
+
+/* Stores V in *P and returns the old value. */
+#define atomic_xchg(P, V) __atomic_exchange_n ((P), (V), __ATOMIC_SEQ_CST)
+
+/* If *P equals *EXPECTED, stores V in *P and returns true.
+   Otherwise, stores the value of *P in *EXPECTED and returns
+   false, ready for the caller to retry. */
+#define atomic_cmpxchg(P, EXPECTED, V)                                  \
+	__atomic_compare_exchange_n ((P), (EXPECTED), (V), false,           \
+			__ATOMIC_SEQ_CST, __ATOMIC_RELAXED)
+
+/* Memory barriers.  smp_mb() orders every access before it with
+   every access after it, including a store before with a load
+   after, which x86 otherwise reorders.  smp_rmb() and smp_wmb()
+   order loads with loads and stores with stores, which x86 already
+   does, so they only keep the compiler from reordering. */
+#define smp_mb() __atomic_thread_fence (__ATOMIC_SEQ_CST)
+#define smp_rmb() __atomic_thread_fence (__ATOMIC_ACQUIRE)
+#define smp_wmb() __atomic_thread_fence (__ATOMIC_RELEASE)
+
+#endif /* threads/atomic.h */
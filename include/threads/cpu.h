@@ -0,0 +1,103 @@
+#ifndef THREADS_CPU_H
+#define THREADS_CPU_H
+
+/* Per-CPU kernel state.
+ *
+ * Each processor has a struct cpu, reached through the GS segment
+ * base while it runs in the kernel: %gs:0 holds the address of the
+ * structure itself.  User code gets its own GS base, and the
+ * kernel entry and exit paths exchange the two with `swapgs'
+ * (intr-stubs.S, syscall-entry.S and do_iret()).
+ *
+ * The boot processor sets up its structure in cpu_init().  With
+ * -smp, cpu_start_aps() later wakes the other processors (the
+ * "APs") through the local APIC, and each builds its own GDT, TSS
+ * and idle thread, starts its own timer tick, then runs threads
+ * from its own run queue (see thread.c).  Once they do, code that
+ * runs with interrupts off also holds the interrupt lock (see interrupt.c), so it excludes
+ * the other CPUs as it excludes interrupts. */
+
+/* Most CPUs supported. */
+#define CPU_MAX 8
+
+/* Offsets of the members of struct cpu used by assembly code. */
+#define CPU_SELF 0              /* struct cpu *self. */
+#define CPU_SCRATCH 8           /* uint64_t scratch. */
+#define CPU_TSS 16              /* struct task_state *tss. */
+#define CPU_ID 24               /* int id. */
+
+/* Physical page that APs start executing in real mode. */
+#define AP_START_PA 0x8000
+
+/* MSRs that hold the GS base in the kernel and for user code. */
+#define MSR_GS_BASE 0xc0000101
+#define MSR_KERNEL_GS_BASE 0xc0000102
+
+#ifndef __ASSEMBLER__
+#include <stdbool.h>
+#include <stdint.h>
+
+struct thread;
+struct task_state;
+struct defer;
+struct work;
+
+/* A processor. */
+struct cpu {
+	struct cpu *self;           /* This structure, at %gs:0. */
+	uint64_t scratch;           /* User rsp during syscall entry. */
+	struct task_state *tss;     /* Task-state segment. */
+	int id;                     /* Index in cpus[]. */
+	uint8_t apic_id;            /* Local APIC ID. */
+	bool online;                /* Running threads? */
+	struct thread *idle_thread; /* Idle thread. */
+	struct thread *curr;        /* Running thread. */
+	unsigned thread_ticks;      /* # of timer ticks since last yield. */
+	int64_t last_tick;          /* timer_ticks() at last accounting. */
+	bool yield_preempted;       /* Is the current yield a preemption? */
+	struct thread *fpu_owner;   /* Thread whose state is in the FPU. */
+
+	/* Owned by threads/thread.c. */
+	volatile bool idle_polling; /* Idle, watching IDLE_WAKE? */
+	volatile int idle_wake;     /* Written to wake a watching CPU. */
+
+	/* Owned by interrupt.c. */
+	bool in_external_intr;      /* Processing an external interrupt? */
+	bool yield_on_return;       /* Yield on interrupt return? */
+
+	/* Owned by devices/timer.c. */
+	uint64_t tick_tsc;          /* TSC at which the next tick is due. */
+	uint64_t timer_tsc;         /* TSC the local APIC timer is set for. */
+	bool timer_stretched;       /* Idle with the tick stopped? */
+
+	/* Owned by threads/mmu.c. */
+	uint64_t *pml4;             /* Page table loaded in CR3. */
+	volatile bool tlb_pending;  /* TLB shootdown to apply? */
+
+	/* Owned by threads/defer.c. */
+	struct defer *volatile defer_head; /* Deferred work, newest first. */
+
+	/* Owned by threads/workq.c. */
+	struct work *volatile work_head; /* Submitted jobs, newest first. */
+};
+
+extern struct cpu cpus[CPU_MAX];
+extern int cpu_cnt;
+extern bool cpu_smp;
+
+/* Returns the running CPU's struct cpu. */
+static inline struct cpu *
+cpu_current (void) {
+	struct cpu *c;
+
+	asm ("movq %%gs:0, %0" : "=r" (c));
+	return c;
+}
+
+void cpu_init (void);
+void cpu_start_aps (void);
+void cpu_ap_main (int id) __attribute__ ((noreturn));
+
+#endif /* __ASSEMBLER__ */
+
+#endif /* threads/cpu.h */
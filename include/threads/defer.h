@@ -0,0 +1,33 @@
+#ifndef THREADS_DEFER_H
+#define THREADS_DEFER_H
+
+#include <stdbool.h>
+
+/* Deferred work.
+ *
+ * An interrupt handler that has more to do than acknowledge its
+ * device and take its data can queue the rest as a struct defer,
+ * which a kernel thread at PRI_MAX then runs with interrupts on.
+ * Waking that thread from the handler makes the interrupt yield to
+ * it on return, so the work still runs before anything else, but
+ * outside the interrupt, where other interrupts, such as the timer,
+ * can get in. */
+
+/* Function run as deferred work, with interrupts on. */
+typedef void defer_func (void *aux);
+
+/* A piece of deferred work.  Queuing it again before it runs has no
+   further effect; queuing it while it runs makes it run once more. */
+struct defer {
+	struct defer *next;         /* Next in a CPU's queue. */
+	defer_func *func;           /* Function to run. */
+	void *aux;                  /* Its argument. */
+	volatile int queued;        /* 1 if queued and not yet run. */
+};
+
+void defer_start (void);
+void defer_init (struct defer *, defer_func *, void *aux);
+bool defer_schedule (struct defer *);
+void defer_print_stats (void);
+
+#endif /* threads/defer.h */
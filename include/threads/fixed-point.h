@@ -0,0 +1,42 @@
+#ifndef THREADS_FIXED_POINT_H
+#define THREADS_FIXED_POINT_H
+
+#include <stdint.h>
+
+/* 17.14 fixed-point arithmetic, as used by the multi-level
+ * feedback queue scheduler.  A fixed_t holds a real number X as
+ * the integer X * FP_F, giving 17 integer bits, 14 fraction bits
+ * and a sign bit.  Products and quotients of two fixed-point
+ * values go through 64 bits so they do not overflow. */
+typedef int32_t fixed_t;
+
+#define FP_Q 14                         /* Fraction bits. */
+#define FP_F (1 << FP_Q)                /* Fixed-point 1.0. */
+
+/* Converts integer N to fixed point. */
+#define FP_FROM_INT(N) ((fixed_t) ((N) * FP_F))
+
+/* Converts fixed-point X to an integer, rounding toward zero. */
+#define FP_TO_INT(X) ((X) / FP_F)
+
+/* Converts fixed-point X to an integer, rounding to nearest. */
+#define FP_ROUND(X) \
+	((X) >= 0 ? ((X) + FP_F / 2) / FP_F : ((X) - FP_F / 2) / FP_F)
+
+/* Sums and differences of two fixed-point values X and Y. */
+#define FP_ADD(X, Y) ((X) + (Y))
+#define FP_SUB(X, Y) ((X) - (Y))
+
+/* Sums and differences of fixed-point X and integer N. */
+#define FP_ADD_INT(X, N) ((X) + (N) * FP_F)
+#define FP_SUB_INT(X, N) ((X) - (N) * FP_F)
+
+/* Product and quotient of two fixed-point values X and Y. */
+#define FP_MUL(X, Y) ((fixed_t) (((int64_t) (X)) * (Y) / FP_F))
+#define FP_DIV(X, Y) ((fixed_t) (((int64_t) (X)) * FP_F / (Y)))
+
+/* Product and quotient of fixed-point X and integer N. */
+#define FP_MUL_INT(X, N) ((X) * (N))
+#define FP_DIV_INT(X, N) ((X) / (N))
+
+#endif /* threads/fixed-point.h */
@@ -0,0 +1,21 @@
+#ifndef THREADS_FPU_H
+#define THREADS_FPU_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct thread;
+
+/* Saved x87/SSE register state, in the 512-byte FXSAVE format. */
+struct fpu_state {
+	uint8_t fxsave[512];
+} __attribute__ ((aligned (16)));
+
+void fpu_init (void);
+void fpu_switch (struct thread *curr, struct thread *next);
+void fpu_handle_nm (void);
+bool fpu_fork (struct thread *child, struct thread *parent);
+void fpu_release (struct thread *);
+void fpu_print_stats (void);
+
+#endif /* threads/fpu.h */
@@ -0,0 +1,20 @@
+#ifndef THREADS_KSTACK_H
+#define THREADS_KSTACK_H
+
+#include <stdbool.h>
+#include "threads/vaddr.h"
+
+/* Kernel stacks of threads made by thread_create(). */
+
+/* Pages in a kernel stack, below which an unmapped guard page
+   makes overflow fault instead of running into other memory. */
+#define KSTACK_PAGES 4
+#define KSTACK_SIZE (KSTACK_PAGES * PGSIZE)
+
+void kstack_init (void);
+void *kstack_alloc (void);
+void kstack_free (void *);
+bool kstack_contains (const void *);
+void kstack_print_stats (void);
+
+#endif /* threads/kstack.h */
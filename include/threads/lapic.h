@@ -0,0 +1,35 @@
+#ifndef THREADS_LAPIC_H
+#define THREADS_LAPIC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Local APIC.  Device interrupts still arrive through the 8259
+   PIC (see interrupt.c); the local APIC is used for each CPU's
+   timer and to send interprocessor interrupts, including the INIT
+   and STARTUP messages that wake the other processors. */
+
+/* Vector for spurious local APIC interrupts. */
+#define LAPIC_SPURIOUS_VEC 0xff
+
+/* Vectors of interrupts raised by the local APIC itself, from
+   LAPIC_VEC_MIN up to just below LAPIC_SPURIOUS_VEC.  See
+   intr_register_lapic(). */
+#define LAPIC_VEC_MIN 0xf0
+#define LAPIC_TIMER_VEC 0xf0    /* Local APIC timer. */
+#define IPI_RESCHEDULE 0xf1     /* A thread was queued for this CPU. */
+#define IPI_TLB_SHOOTDOWN 0xf2  /* Drop TLB entries (see mmu.c). */
+
+bool lapic_init (void);
+uint8_t lapic_id (void);
+void lapic_eoi (void);
+void lapic_send_ipi (uint8_t apic_id, uint8_t vec);
+void lapic_start_aps (uint64_t start_pa);
+
+bool lapic_timer_has_deadline (void);
+uint32_t lapic_timer_measure (uint64_t cycles);
+void lapic_timer_init (uint8_t vec, bool deadline);
+void lapic_timer_oneshot (uint32_t count);
+void lapic_timer_deadline (uint64_t tsc);
+
+#endif /* threads/lapic.h */
@@ -2,12 +2,30 @@
 #define THREADS_MALLOC_H
 
 #include <debug.h>
+#include <memstat.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+
+/* Per-thread cache of free blocks, one short stack per size
+   class, that malloc() and free() use without locking. */
+#define MALLOC_TCACHE_CLASSES 8     /* Size classes cached. */
+#define MALLOC_TCACHE_DEPTH 8       /* Blocks cached per class. */
+
+struct malloc_tcache {
+	void *head[MALLOC_TCACHE_CLASSES];  /* Top free block per class. */
+	uint8_t cnt[MALLOC_TCACHE_CLASSES]; /* Blocks cached per class. */
+};
 
 void malloc_init (void);
 void *malloc (size_t) __attribute__ ((malloc));
+void *malloc_tagged (size_t, enum memstat_tag) __attribute__ ((malloc));
 void *calloc (size_t, size_t) __attribute__ ((malloc));
+void *calloc_tagged (size_t, size_t, enum memstat_tag) __attribute__ ((malloc));
 void *realloc (void *, size_t);
 void free (void *);
+void malloc_flush_tcache (void);
+bool malloc_get_stats (int tag, struct memstat *);
+void malloc_print_stats (void);
 
 #endif /* threads/malloc.h */
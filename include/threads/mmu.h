@@ -2,19 +2,44 @@
 #define THREAD_MMU_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include "threads/pte.h"
 
 typedef bool pte_for_each_func (uint64_t *pte, void *va, void *aux);
 
+/* Most pages in a TLB shootdown batch before it is sent. */
+#define TLB_BATCH_MAX 32
+
+/* TLB invalidations for other CPUs, queued by pml4_batch_begin(). */
+struct tlb_batch {
+	unsigned cpus;                      /* Mask of CPUs to send it to. */
+	size_t cnt;                         /* Number of pages. */
+	uint64_t *pml4[TLB_BATCH_MAX];      /* Page table of each, or null. */
+	const void *va[TLB_BATCH_MAX];      /* Virtual address of each page. */
+};
+
 uint64_t *pml4e_walk (uint64_t *pml4, const uint64_t va, int create);
+uint64_t *pml4_pde_walk (uint64_t *pml4, const uint64_t va, int create);
+uint64_t *pml4_pdpe_walk (uint64_t *pml4, const uint64_t va, int create);
 uint64_t *pml4_create (void);
 bool pml4_for_each (uint64_t *, pte_for_each_func *, void *);
+bool pml4_for_each_range (uint64_t *, const void *start, const void *end,
+		pte_for_each_func *, void *);
 void pml4_destroy (uint64_t *pml4);
 void pml4_activate (uint64_t *pml4);
+void pml4_pcid_init (void);
+void pml4_init_ap (void);
+void pml4_batch_begin (struct tlb_batch *);
+void pml4_batch_end (struct tlb_batch *);
+void pml4_shootdown_poll (void);
+void pml4_print_stats (void);
 void *pml4_get_page (uint64_t *pml4, const void *upage);
 bool pml4_set_page (uint64_t *pml4, void *upage, void *kpage, bool rw);
+bool pml4_share_page (uint64_t *pml4, void *upage, void *kpage);
 void pml4_clear_page (uint64_t *pml4, void *upage);
+void pml4_set_kernel_page (void *va, void *kpage);
+void pml4_clear_kernel_pages (void *va, size_t cnt, void **kpages);
 bool pml4_is_dirty (uint64_t *pml4, const void *upage);
 void pml4_set_dirty (uint64_t *pml4, const void *upage, bool dirty);
 bool pml4_is_accessed (uint64_t *pml4, const void *upage);
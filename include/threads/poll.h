@@ -0,0 +1,50 @@
+#ifndef THREADS_POLL_H
+#define THREADS_POLL_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Wait queues for poll().
+ *
+ * An object that poll() can wait on, such as a pipe or the console
+ * input buffer, has a poll_queue, and wakes it whenever it may have
+ * become ready.  A thread in poll() has one poll_table, and adds a
+ * poll_waiter to the queue of each object it watches.  Waking a
+ * queue wakes the threads whose tables have waiters on it; they look
+ * at their objects again to see what changed.
+ *
+ * A queue may be woken from an interrupt handler. */
+
+struct thread;
+
+/* Threads waiting for an object. */
+struct poll_queue {
+	struct list waiters;        /* struct poll_waiter. */
+};
+
+/* One poll() call's view of the queues it is waiting on. */
+struct poll_table {
+	struct thread *thread;      /* The polling thread. */
+	bool woken;                 /* A queue was woken since poll_arm()? */
+	bool sleeping;              /* Blocked in poll_sleep()? */
+};
+
+/* A poll_table's place in one poll_queue. */
+struct poll_waiter {
+	struct list_elem elem;      /* Element in QUEUE's list. */
+	struct poll_table *table;   /* Table it belongs to. */
+	struct poll_queue *queue;   /* Queue it is on, or null. */
+};
+
+void poll_queue_init (struct poll_queue *);
+void poll_queue_wake (struct poll_queue *);
+
+void poll_table_init (struct poll_table *);
+void poll_add (struct poll_table *, struct poll_queue *,
+		struct poll_waiter *);
+void poll_remove (struct poll_waiter *);
+void poll_arm (struct poll_table *);
+void poll_sleep (struct poll_table *, int64_t deadline);
+
+#endif /* threads/poll.h */
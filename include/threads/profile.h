@@ -0,0 +1,17 @@
+#ifndef THREADS_PROFILE_H
+#define THREADS_PROFILE_H
+#include <stdbool.h>
+
+struct intr_frame;
+
+/* Most callers recorded per sample, beyond the interrupted one. */
+#define PROFILE_DEPTH_MAX 7
+
+extern bool profile_enabled;
+extern int profile_depth;
+
+void profile_init (void);
+void profile_sample (const struct intr_frame *);
+void profile_print (void);
+
+#endif /* threads/profile.h */
@@ -0,0 +1,41 @@
+#ifndef THREADS_RCU_H
+#define THREADS_RCU_H
+
+/* Read-copy-update.
+ *
+ * Lets threads read a structure that is rarely changed without
+ * taking any lock.  A reader brackets its accesses with
+ * rcu_read_lock() and rcu_read_unlock(), which only count, and may
+ * not sleep in between; the running thread is not preempted there
+ * either.  A writer, under whatever lock writers use, unlinks what
+ * it replaces, for instance with the lists in <rculist.h>, and
+ * frees it with call_rcu(), which runs the free once every reader
+ * that might still see it is done.
+ *
+ * A CPU is done with earlier readers once it passes through a
+ * "quiescent state": a context switch, or a timer tick that finds
+ * no reader running.  A grace period ends when every CPU online at
+ * its start has done so, and the callbacks queued before it began
+ * then run on the deferred work thread (see defer.h).  Readers may
+ * not run in interrupt handlers. */
+
+struct rcu_head;
+
+/* Function that call_rcu() runs once a grace period has passed. */
+typedef void rcu_func (struct rcu_head *);
+
+/* Embedded in a structure to be freed with call_rcu(). */
+struct rcu_head {
+	struct rcu_head *next;      /* Next callback in its batch. */
+	rcu_func *func;             /* Function to run. */
+};
+
+void rcu_init (void);
+void rcu_read_lock (void);
+void rcu_read_unlock (void);
+void call_rcu (struct rcu_head *, rcu_func *);
+void synchronize_rcu (void);
+void rcu_note_qs (void);
+void rcu_print_stats (void);
+
+#endif /* threads/rcu.h */
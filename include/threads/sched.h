@@ -0,0 +1,100 @@
+#ifndef THREADS_SCHED_H
+#define THREADS_SCHED_H
+
+#include <list.h>
+#include <rbtree.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "threads/thread.h"
+
+/* A CPU's run queue: one FIFO list per level, with bit L of
+   `mask' set exactly when queues[L] is nonempty, so the highest
+   nonempty level is a single BSR away.  A scheduling class decides
+   which level each ready thread goes on.  The fair class uses a
+   tree instead.  Owned by thread.c, which also keeps `cnt';
+   protected by disabling interrupts. */
+struct runqueue {
+	struct list queues[PRI_MAX + 1];
+	uint64_t mask;
+	int cnt;                    /* # of threads queued. */
+
+	/* Fair class. */
+	struct rb_tree tree;        /* Ready threads, by vruntime. */
+	uint64_t min_vruntime;      /* Never decreases. */
+
+	/* Deadline threads, by absolute deadline. */
+	struct rb_tree dl_tree;
+};
+
+/* A scheduling policy.  thread.c makes every decision about ready
+   threads through the sched_*() functions below, always with
+   interrupts off, which ask the deadline class (deadline.c) first
+   and the selected class for the rest. */
+struct sched_class {
+	const char *name;           /* For -sched=NAME. */
+
+	/* Adds ready thread T to RQ. */
+	void (*enqueue) (struct runqueue *rq, struct thread *t);
+
+	/* Removes ready thread T, which is on RQ, from it. */
+	void (*dequeue) (struct runqueue *rq, struct thread *t);
+
+	/* Removes and returns the thread to run next from RQ, or
+	   returns a null pointer if RQ is empty. */
+	struct thread *(*pick_next) (struct runqueue *rq);
+
+	/* Returns true if a thread on RQ should replace CURR, the
+	   thread running on RQ's CPU, right away. */
+	bool (*preempts) (const struct runqueue *rq, const struct thread *curr);
+
+	/* Puts the running thread T back on RQ as it yields. */
+	void (*yield) (struct runqueue *rq, struct thread *t);
+
+	/* Called at each timer interrupt, which advanced the clock by
+	   ELAPSED ticks to NOW while T ran.  May be null. */
+	void (*tick) (struct thread *t, int64_t now, int64_t elapsed);
+};
+
+extern const struct sched_class sched_priority;
+extern const struct sched_class sched_rr;
+extern const struct sched_class sched_mlfqs;
+extern const struct sched_class sched_fair;
+
+/* The selected class. */
+extern const struct sched_class *sched;
+
+bool sched_select (const char *name);
+
+void sched_enqueue (struct runqueue *, struct thread *);
+void sched_dequeue (struct runqueue *, struct thread *);
+struct thread *sched_pick_next (struct runqueue *);
+bool sched_preempts (const struct runqueue *, const struct thread *curr);
+void sched_yield (struct runqueue *, struct thread *);
+void sched_tick (struct thread *, int64_t now, int64_t elapsed);
+
+/* Level lists shared by the classes. */
+void runqueue_init (struct runqueue *);
+void runqueue_push (struct runqueue *, struct thread *, int level);
+void runqueue_remove (struct runqueue *, struct thread *, int level);
+struct thread *runqueue_pop (struct runqueue *);
+int runqueue_top (const struct runqueue *);
+
+/* The multi-level feedback queue scheduler. */
+void mlfqs_tick (struct thread *, int64_t now, int64_t elapsed);
+void mlfqs_update_priority (struct thread *);
+int mlfqs_get_load_avg (void);
+void mlfqs_print_stats (void);
+
+/* The fair-share scheduler. */
+void fair_runqueue_init (struct runqueue *);
+
+/* Earliest-deadline-first scheduling. */
+void dl_runqueue_init (struct runqueue *);
+bool dl_enqueue (struct runqueue *, struct thread *);
+bool dl_dequeue (struct runqueue *, struct thread *);
+struct thread *dl_pick_next (struct runqueue *);
+bool dl_preempts (const struct runqueue *, const struct thread *curr,
+		bool *decided);
+void dl_tick (struct thread *, int64_t elapsed);
+
+#endif /* threads/sched.h */
@@ -0,0 +1,43 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <list.h>
+#include <stddef.h>
+#include "threads/synch.h"
+
+/* Object cache constructor.  Called once on every object when
+   its slab is created; objects must be returned to the cache in
+   their constructed state. */
+typedef void kmem_ctor_func (void *obj);
+
+/* An object cache: a set of one-page slabs carved into
+   equal-sized objects of one type. */
+struct kmem_cache {
+	const char *name;           /* For statistics. */
+	size_t obj_size;            /* Requested object size. */
+	size_t slot_size;           /* Bytes per object in a slab. */
+	size_t link_ofs;            /* Offset of free-list link in a slot. */
+	size_t first_ofs;           /* Offset of first slot in a slab. */
+	size_t objs_per_slab;       /* Number of slots per slab. */
+	kmem_ctor_func *ctor;       /* Constructor, or null. */
+
+	struct adaptive_lock lock;  /* Protects the lists and counters. */
+	struct list partial;        /* Slabs with some objects in use. */
+	struct list full;           /* Slabs with all objects in use. */
+	struct list empty;          /* Slabs with no objects in use. */
+
+	size_t slab_cnt;            /* Slabs currently held. */
+	size_t in_use;              /* Objects currently allocated. */
+	unsigned long long allocs;  /* Total allocations. */
+
+	struct list_elem elem;      /* Element in the list of all caches. */
+};
+
+void slab_init (void);
+struct kmem_cache *kmem_cache_create (const char *name, size_t size,
+		size_t align, kmem_ctor_func *ctor);
+void *kmem_cache_alloc (struct kmem_cache *);
+void kmem_cache_free (struct kmem_cache *, void *);
+void slab_print_stats (void);
+
+#endif /* threads/slab.h */
@@ -0,0 +1,29 @@
+#ifndef THREADS_SPINLOCK_H
+#define THREADS_SPINLOCK_H
+
+#include <stdbool.h>
+#include "threads/interrupt.h"
+
+/* Spinlock.
+ *
+ * Protects data shared between CPUs for short critical sections,
+ * including ones entered from interrupt handlers.  Acquiring a
+ * spinlock disables interrupts on the running CPU, so that an
+ * interrupt handler cannot deadlock against the code it
+ * interrupted, and busy-waits until the lock is free; releasing
+ * it restores the interrupt level saved by the acquire.  Holders
+ * must not sleep, and a CPU must not acquire a spinlock it
+ * already holds. */
+struct spinlock {
+	volatile int locked;        /* 1 if held, 0 if free. */
+	int cpu;                    /* Holding CPU's id, or -1. */
+	enum intr_level old_level;  /* Interrupt level before acquire. */
+};
+
+void spin_init (struct spinlock *);
+void spin_lock (struct spinlock *);
+bool spin_try_lock (struct spinlock *);
+void spin_unlock (struct spinlock *);
+bool spin_held (const struct spinlock *);
+
+#endif /* threads/spinlock.h */
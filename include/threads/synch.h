@@ -1,33 +1,120 @@
 #ifndef THREADS_SYNCH_H
 #define THREADS_SYNCH_H
 
+#include <heap.h>
 #include <list.h>
 #include <stdbool.h>
+#include <stdint.h>
 
-/* A counting semaphore. */
+struct thread;
+struct lock_class;
+
+/* A counting semaphore.
+
+   COUNT holds the value in its low 32 bits and, in its high 32
+   bits, the number of threads in sema_down()'s slow path, so that
+   a down of a positive value and an up with nobody waiting are a
+   single compare-and-exchange each, with interrupts left on.  The
+   waiters heap is touched only with interrupts off. */
 struct semaphore {
-	unsigned value;             /* Current value. */
-	struct list waiters;        /* List of waiting threads. */
+	uint64_t count;             /* Sleepers << 32 | value. */
+	struct heap waiters;        /* Waiting threads, by priority. */
 };
 
 void sema_init (struct semaphore *, unsigned value);
 void sema_down (struct semaphore *);
 bool sema_try_down (struct semaphore *);
 void sema_up (struct semaphore *);
+void sema_up_sync (struct semaphore *);
 void sema_self_test (void);
+void sema_reorder (struct semaphore *, struct thread *, int old_priority);
+
+/* Lock.
 
-/* Lock. */
+   OWNER is the holding thread, or 0 if the lock is free; HOLDER
+   is the same word as a pointer, null exactly when the lock is
+   free.  An uncontended acquire or release is one
+   compare-and-exchange on it.  Its low bit, LOCK_SLOW, is set once the lock is in the
+   holder's held_locks, which happens when a waiter arrives or the
+   lock was taken on the slow path; the release then takes the
+   slow path too, with interrupts off, to wake the waiter and
+   drop the donation. */
 struct lock {
-	struct thread *holder;      /* Thread holding lock (for debugging). */
-	struct semaphore semaphore; /* Binary semaphore controlling access. */
+	union {
+		struct thread *holder;  /* Thread holding lock, tagged. */
+		uintptr_t owner;        /* Holder | LOCK_SLOW, or 0 if free. */
+	};
+	struct semaphore semaphore; /* Waiters, by priority. */
+	struct heap_elem elem;      /* Element in holder's held_locks. */
+	int priority;               /* Highest priority donated by a waiter,
+	                               or PRI_MIN - 1 if none. */
+	struct lock_class *class;   /* Contention statistics, or null. */
+	uint64_t acquire_tsc;       /* Time stamp of the last acquire. */
 };
 
-void lock_init (struct lock *);
+/* Lock contention statistics.  When enabled (with -lockstat),
+   locks are grouped into classes by the source line that
+   initialized them, and each class counts its acquires, the
+   acquires that had to wait, the time spent waiting and the
+   longest time the lock was held. */
+extern bool lock_stats_enabled;
+
+#define lock_init(LOCK) lock_init_at (LOCK, __FILE__, __LINE__)
+void lock_init_at (struct lock *, const char *file, int line);
 void lock_acquire (struct lock *);
 bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
 
+/* Adaptive lock.
+ *
+ * A lock for short critical sections.  A contended acquire first
+ * spins for a bounded number of iterations, as long as the
+ * holder is running on a CPU and so may release it soon, and
+ * only then blocks on the underlying lock.  On a uniprocessor the
+ * holder of a contended lock is never running, so acquire blocks
+ * straight away. */
+struct adaptive_lock {
+	struct lock lock;           /* Underlying sleeping lock. */
+	unsigned spins;             /* # of acquires won by spinning. */
+	unsigned sleeps;            /* # of acquires that had to block. */
+};
+
+#define adaptive_lock_init(ALOCK) \
+	adaptive_lock_init_at (ALOCK, __FILE__, __LINE__)
+void adaptive_lock_init_at (struct adaptive_lock *,
+		const char *file, int line);
+void adaptive_lock_acquire (struct adaptive_lock *);
+bool adaptive_lock_try_acquire (struct adaptive_lock *);
+void adaptive_lock_release (struct adaptive_lock *);
+bool adaptive_lock_held_by_current_thread (const struct adaptive_lock *);
+void lock_print_stats (void);
+
+/* Readers-writer lock.
+ *
+ * Any number of readers, or a single writer, may hold the lock.
+ * A writer holds the inner lock for its whole critical section,
+ * and readers pass through that lock on their way in, so once a
+ * writer is waiting no new reader is admitted (writer
+ * preference), and threads blocked behind a writer donate their
+ * priority to it.  A thread must not re-acquire a read lock it
+ * already holds, since a waiting writer would then deadlock it. */
+struct rwlock {
+	struct lock lock;           /* Held by the writer; passed by readers. */
+	struct semaphore drained;   /* Upped when the last reader leaves. */
+	unsigned readers;           /* Number of active readers. */
+	bool writer_waiting;        /* Is a writer waiting for readers? */
+};
+
+#define rwlock_init(RW) rwlock_init_at (RW, __FILE__, __LINE__)
+void rwlock_init_at (struct rwlock *, const char *file, int line);
+void rw_read_acquire (struct rwlock *);
+void rw_read_release (struct rwlock *);
+void rw_write_acquire (struct rwlock *);
+bool rw_write_try_acquire (struct rwlock *);
+void rw_write_release (struct rwlock *);
+bool rw_write_held_by_current_thread (const struct rwlock *);
+
 /* Condition variable. */
 struct condition {
 	struct list waiters;        /* List of waiting threads. */
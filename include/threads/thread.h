@@ -2,9 +2,20 @@
 #define THREADS_THREAD_H
 
 #include <debug.h>
+#include <heap.h>
+#include <lfstack.h>
 #include <list.h>
+#include <rbtree.h>
+#include <rusage.h>
 #include <stdint.h>
 #include "threads/interrupt.h"
+#include "threads/fixed-point.h"
+#include "threads/malloc.h"
+#ifdef USERPROG
+#include <hash.h>
+#include "threads/synch.h"
+#include "userprog/fdtable.h"
+#endif
 #ifdef VM
 #include "vm/vm.h"
 #endif
@@ -28,95 +39,160 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
+/* Thread niceness, for the multi-level feedback queue scheduler. */
+#define NICE_MIN -20                    /* Most generous. */
+#define NICE_DEFAULT 0                  /* Default niceness. */
+#define NICE_MAX 20                     /* Least generous. */
 
-#define MAX_FILEDES_ENTRY 10
-
-typedef struct _filedes_entry{
-	struct file *file_p;
-	bool use;
-}filedes_entry;
 
 /* A kernel thread or user process.
  *
- * Each thread structure is stored in its own 4 kB page.  The
- * thread structure itself sits at the very bottom of the page
- * (at offset 0).  The rest of the page is reserved for the
- * thread's kernel stack, which grows downward from the top of
- * the page (at offset 4 kB).  Here's an illustration:
+ * Each thread structure is stored in its own 4 kB page, at the
+ * very bottom of the page (at offset 0).  A thread made by
+ * thread_create() runs on a kernel stack of KSTACK_SIZE bytes
+ * allocated separately (see kstack.c), with an unmapped guard
+ * page below it, so that a stack overflow faults instead of
+ * running into the thread state:
  *
- *      4 kB +---------------------------------+
- *           |          kernel stack           |
- *           |                |                |
- *           |                |                |
- *           |                V                |
- *           |         grows downward          |
- *           |                                 |
- *           |                                 |
- *           |                                 |
- *           |                                 |
- *           |                                 |
- *           |                                 |
- *           |                                 |
- *           |                                 |
- *           +---------------------------------+
- *           |              magic              |
- *           |            intr_frame           |
- *           |                :                |
- *           |                :                |
- *           |               name              |
- *           |              status             |
- *      0 kB +---------------------------------+
+ *       kernel stack, at `kstack'       thread page
  *
- * The upshot of this is twofold:
+ *           +-----------------------+        4 kB +-----------------------+
+ *           |     kernel stack      |             |  (unused, or the      |
+ *           |           |           |             |  stack of a boot or   |
+ *           |           V           |             |  idle thread)         |
+ *           |    grows downward     |             +-----------------------+
+ *           +-----------------------+             |         magic         |
+ *           | guard page (unmapped) |             |       intr_frame      |
+ *           +-----------------------+             |           :           |
+ *                                                 |          name         |
+ *                                                 |         status        |
+ *                                            0 kB +-----------------------+
  *
- *    1. First, `struct thread' must not be allowed to grow too
- *       big.  If it does, then there will not be enough room for
- *       the kernel stack.  Our base `struct thread' is only a
- *       few bytes in size.  It probably should stay well under 1
- *       kB.
- *
- *    2. Second, kernel stacks must not be allowed to grow too
- *       large.  If a stack overflows, it will corrupt the thread
- *       state.  Thus, kernel functions should not allocate large
- *       structures or arrays as non-static local variables.  Use
- *       dynamic allocation with malloc() or palloc_get_page()
- *       instead.
- *
- * The first symptom of either of these problems will probably be
- * an assertion failure in thread_current(), which checks that
- * the `magic' member of the running thread's `struct thread' is
- * set to THREAD_MAGIC.  Stack overflow will normally change this
- * value, triggering the assertion. */
-/* The `elem' member has a dual purpose.  It can be an element in
- * the run queue (thread.c), or it can be an element in a
- * semaphore wait list (synch.c).  It can be used these two ways
- * only because they are mutually exclusive: only a thread in the
- * ready state is on the run queue, whereas only a thread in the
- * blocked state is on a semaphore wait list. */
+ * The initial thread and the other CPUs' idle threads, which
+ * thread_create() does not make, have their stacks in their thread
+ * pages instead, growing down from the top.  So their stacks must stay small, and `magic' still
+ * catches an overflow of one: thread_current(), which returns the
+ * running CPU's current thread, checks that it is set to
+ * THREAD_MAGIC. */
+/* The `elem' member is an element in the run queue (thread.c);
+ * a thread blocked on a semaphore is instead in that semaphore's
+ * waiter heap through `wait_elem' (synch.c). */
 struct thread {
 	/* Owned by thread.c. */
 	tid_t tid;                          /* Thread identifier. */
 	enum thread_status status;          /* Thread state. */
-	int wakeup_this_tick;               /* Tick to wake up.*/
+	int64_t wakeup_time;                /* timer_clock() to wake up at. */
+	struct thread *sleep_child;         /* Sleep heap: leftmost child. */
+	struct thread *sleep_sibling;       /* Sleep heap: next sibling. */
+	struct thread *sleep_prev;          /* Sleep heap: parent or left sibling. */
 	char name[16];                      /* Name (for debugging purposes). */
-	int priority;                       /* Priority. */
+	int priority;                       /* Effective priority. */
+	int base_priority;                  /* Priority before donation. */
+	int nice;                           /* Niceness (MLFQS). */
+	fixed_t recent_cpu;                 /* Recent CPU time (MLFQS). */
+	int cpu;                            /* CPU whose run queue it uses. */
+	unsigned affinity;                  /* CPUs it may run on, a bit each. */
+	struct list_elem all_elem;          /* List element for all threads. */
+
+	/* Scheduling statistics, owned by thread.c. */
+	long long sched_cnt;                /* # of times scheduled. */
+	long long voluntary_cnt;            /* # of blocks and yields. */
+	long long involuntary_cnt;          /* # of preemptions. */
+	uint64_t ready_tsc;                 /* TSC when last made ready. */
+	uint64_t ready_wait_tsc;            /* Total TSC cycles spent ready. */
+	uint64_t max_wakeup_tsc;            /* Worst timer_sleep() wakeup latency. */
+	bool sleep_woken;                   /* Made ready by the sleep queue? */
+	long long migrate_cnt;              /* # of moves to another CPU. */
+
+	/* Resource usage, counted by the thread itself, except for the
+	 * ticks, which the timer interrupt adds.  Its context switches
+	 * are the scheduling statistics above. */
+	struct rusage ru;
+
+	/* Owned by threads/fair.c. */
+	uint64_t vruntime;                  /* Weighted CPU time (fair class). */
+	struct rb_node fair_elem;           /* Run queue tree element. */
+
+	/* Owned by threads/deadline.c. */
+	int64_t dl_runtime;                 /* Ticks of budget per period, or 0. */
+	int64_t dl_deadline;                /* Relative deadline, in ticks. */
+	int64_t dl_period;                  /* Period, in ticks. */
+	int64_t dl_period_start;            /* Start of the current period. */
+	int64_t dl_abs_deadline;            /* Deadline in the current period. */
+	int64_t dl_budget;                  /* Budget left; throttled if <= 0. */
+	bool dl_queued;                     /* On a deadline tree? */
+	struct rb_node dl_elem;             /* Deadline tree element. */
+
+	/* Owned by threads/fpu.c. */
+	struct fpu_state *fpu;              /* Saved FPU state, or null. */
+	void *fpu_block;                    /* Allocation holding `fpu'. */
+
+	/* Owned by filesys/journal.c. */
+	int journal_depth;                  /* Depth of journal operations. */
+
+	/* Owned by devices/disk.c. */
+	int io_class;                       /* enum disk_ioclass of requests. */
+	struct disk_share *io_share;        /* Share of disk time, or null. */
+
+	/* Owned by threads/malloc.c. */
+	struct malloc_tcache tcache;        /* Free blocks for malloc(). */
+
+	/* Owned by threads/mmu.c. */
+	struct tlb_batch *tlb_batch;        /* Open TLB shootdown batch, or null. */
+
+	/* Owned by threads/rcu.c. */
+	int rcu_nesting;                    /* Depth of RCU read-side sections. */
+	bool rcu_yield;                     /* Preempted in one, to yield after. */
 
 	/* Shared between thread.c and synch.c. */
 	struct list_elem elem;              /* List element. */
+	struct heap_elem wait_elem;         /* Semaphore waiters element. */
+	unsigned wait_seq;                  /* FIFO order among equal waiters. */
+	struct semaphore *waiting_sema;     /* Semaphore being waited on. */
+	struct lock *waiting_lock;          /* Lock being waited on. */
+	struct heap held_locks;             /* Held locks, by donated priority. */
 
 #ifdef USERPROG
 	/* Owned by userprog/process.c. */
 	int exit_code;					/* Process exit code.*/
-	filedes_entry filedes_table[MAX_FILEDES_ENTRY];  /* file descriptor table */
+	struct fd_table fds;                /* File descriptor table. */
 	uint64_t *pml4;                     		/* Page map level 4 */
+
+	/* Threads made by clone() share the address space and descriptors
+	 * of their process's first thread, the leader, which lives on
+	 * until the last of them exits. */
+	struct thread *leader;              /* Leader; itself if not a clone. */
+	int clone_cnt;                      /* Leader: clones still running. */
+	struct semaphore clones_done;       /* Leader: upped as they finish. */
+
+	/* Exit statuses for wait(), in records that outlive the thread. */
+	struct hash children;               /* Leader: children, by tid. */
+	struct lock children_lock;          /* Leader: protects CHILDREN. */
+	struct child *child;                /* Record shared with the parent. */
+
+	/* Usage that getrusage() adds to the threads' own. */
+	struct rusage ru_exited;            /* Leader: clones that exited. */
+	struct rusage ru_children;          /* Leader: children waited for. */
+
+	/* Owned by userprog/rgroup.c. */
+	struct rgroup *rgroup;              /* Leader: resource group, or null. */
 #endif
 #ifdef VM
 	/* Table for whole virtual memory owned by thread. */
 	struct supplemental_page_table spt;
+	uintptr_t user_rsp;                 /* User rsp at the last system call. */
 #endif
 
+	/* Owned by lib/kernel/random.c. */
+	uint64_t rng[4];                    /* Generator state, 0 until used. */
+
 	/* Owned by thread.c. */
-	struct intr_frame tf;               /* Information for switching */
+	void *kstack;                       /* Stack from kstack_alloc(), if any. */
+	uintptr_t stack_top;                /* Top of its kernel stack. */
+	struct intr_frame tf;               /* Where a new thread starts. */
+	uintptr_t switch_rsp;               /* Stack pointer while switched out,
+	                                       or 0 if it has never run. */
+	struct lfstack_elem dead_elem;      /* Element in destruction requests. */
 	unsigned magic;                     /* Detects stack overflow. */
 };
 
@@ -125,19 +201,30 @@ struct thread {
    Controlled by kernel command-line option "-o mlfqs". */
 extern bool thread_mlfqs;
 
+/* Microseconds an idle CPU spins watching for work before it
+   sleeps, set by the -poll-idle option. */
+extern unsigned idle_poll_us;
+
 void thread_init (void);
 void thread_start (void);
+struct thread *thread_init_idle (void *page, const char *name);
+void thread_start_ap (void) NO_RETURN;
 
-void thread_tick (void);
+void thread_tick (bool user);
 void thread_print_stats (void);
+void thread_get_rusage (const struct thread *, struct rusage *);
 void thread_sleep(struct thread* target);
+void thread_block_until (int64_t deadline);
+void thread_wake (struct thread *);
 
-void check_thread_woken_up(struct list* sleep_list); //find any thread which needs to be woken up.
+void check_thread_woken_up (int64_t now);
+int64_t thread_next_wakeup (void);
 typedef void thread_func (void *aux);
 tid_t thread_create (const char *name, int priority, thread_func *, void *);
 
 void thread_block (void);
 void thread_unblock (struct thread *);
+void thread_unblock_sync (struct thread *);
 
 struct thread *thread_current (void);
 tid_t thread_tid (void);
@@ -146,6 +233,15 @@ void change_thread_name(const char *);
 
 void thread_exit (void) NO_RETURN;
 void thread_yield (void);
+void thread_yield_on_return (void);
+void thread_preempt (void);
+void thread_update_priority (struct thread *, int priority);
+void thread_refresh_priority (struct thread *);
+
+/* Performs some operation on thread t, given auxiliary data AUX. */
+typedef void thread_action_func (struct thread *t, void *aux);
+void thread_foreach (thread_action_func *, void *);
+int thread_ready_cnt (void);
 
 int thread_get_priority (void);
 void thread_set_priority (int);
@@ -155,6 +251,11 @@ void thread_set_nice (int);
 int thread_get_recent_cpu (void);
 int thread_get_load_avg (void);
 
+bool thread_set_deadline (int64_t runtime, int64_t deadline, int64_t period);
+
+bool thread_set_affinity (tid_t, unsigned mask);
+int thread_get_affinity (tid_t);
+
 void do_iret (struct intr_frame *tf);
 
 #endif /* threads/thread.h */
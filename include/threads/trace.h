@@ -0,0 +1,54 @@
+#ifndef THREADS_TRACE_H
+#define THREADS_TRACE_H
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Static tracepoints.
+
+   TRACE(EVENT, A, B, C) records a time-stamped event with three
+   arguments.  Tracepoints are built into the kernel only when it
+   is compiled with -DTRACING ("make KDEFINE=-DTRACING" after a
+   clean); otherwise each one expands to nothing, arguments and
+   all.  Even then, events are recorded only if the kernel is run
+   with -trace. */
+
+/* Events and the meaning of their arguments.  utils/tracedump
+   knows these by number, so append new ones at the end. */
+enum trace_event {
+	TRACE_SWITCH,               /* Previous tid, next tid, previous
+	                               thread's status. */
+	TRACE_FAULT,                /* Fault address, error code, rip. */
+	TRACE_EVICT,                /* User address, dirty?, pages in run. */
+	TRACE_DISK_SUBMIT,          /* Disk number, sector, count | write << 32. */
+	TRACE_DISK_DONE,            /* Disk number, sector, count | write << 32. */
+	TRACE_SYSCALL_ENTER,        /* Number, first two arguments. */
+	TRACE_SYSCALL_EXIT,         /* Number, return value, cycles. */
+	TRACE_EVENT_CNT
+};
+
+/* One recorded event. */
+struct trace_record {
+	uint64_t tsc;               /* Time stamp counter. */
+	uint32_t event;             /* A trace_event. */
+	int32_t tid;                /* Running thread. */
+	uint64_t args[3];           /* Event arguments. */
+};
+
+extern bool trace_enabled;
+
+void trace_init (void);
+
+#ifdef TRACING
+#define TRACE(EVENT, A, B, C)                                  \
+	trace_emit (TRACE_##EVENT, (uint64_t) (A), (uint64_t) (B), \
+			(uint64_t) (C))
+
+void trace_emit (enum trace_event, uint64_t, uint64_t, uint64_t);
+void trace_dump (void);
+#else
+#define TRACE(EVENT, A, B, C) ((void) 0)
+
+static inline void trace_dump (void) { }
+#endif
+
+#endif /* threads/trace.h */
@@ -0,0 +1,20 @@
+#ifndef THREADS_VMALLOC_H
+#define THREADS_VMALLOC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Virtually contiguous kernel allocations, assembled from pages
+   that need not be physically contiguous. */
+
+/* Pages from which malloc() goes to vmalloc() first, instead of
+   asking the page allocator for contiguous pages. */
+#define VMALLOC_MIN_PAGES 16
+
+void vmalloc_init (void);
+void *vmalloc (size_t page_cnt);
+void vfree (void *);
+bool vmalloc_contains (const void *);
+void vmalloc_print_stats (void);
+
+#endif /* threads/vmalloc.h */
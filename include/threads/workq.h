@@ -0,0 +1,34 @@
+#ifndef THREADS_WORKQ_H
+#define THREADS_WORKQ_H
+
+#include <stdbool.h>
+
+/* Kernel worker pool.
+ *
+ * Runs background jobs on a fixed set of kernel threads, WORKQ_PER_CPU
+ * for each CPU, instead of a thread per kind of job.  A job is a
+ * function and an argument submitted with a priority; the workers
+ * take the highest-priority job first, oldest first among equals, and
+ * run it at that priority with interrupts on.  Jobs may sleep, but
+ * one that sleeps for long ties up a worker, so periodic jobs keep
+ * their own threads.
+ *
+ * Submitting takes no lock, so it may be done from an interrupt
+ * handler: the job goes into a fixed pool of WORKQ_JOBS slots and
+ * onto the running CPU's list with atomic operations.  It fails if
+ * every slot is taken. */
+
+/* Workers per CPU. */
+#define WORKQ_PER_CPU 2
+
+/* Most jobs submitted and not yet started. */
+#define WORKQ_JOBS 128
+
+/* Function run as a job. */
+typedef void workq_func (void *aux);
+
+void workq_init (void);
+bool workq_submit (workq_func *, void *aux, int priority);
+void workq_print_stats (void);
+
+#endif /* threads/workq.h */
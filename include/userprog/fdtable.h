@@ -0,0 +1,60 @@
+#ifndef USERPROG_FDTABLE_H
+#define USERPROG_FDTABLE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "threads/synch.h"
+
+struct file;
+struct pipe;
+struct shm;
+
+/* Lowest descriptor handed out for files: 0, 1 and 2 are the
+ * console. */
+#define FD_FIRST 3
+
+/* Most descriptors a process may have open. */
+#define FD_MAX 4096
+
+/* An open file, pipe end or shared memory segment.  Descriptors made
+ * by dup2() and inherited across fork() share it, and with it the file
+ * position; what it refers to is closed when the last of them is.
+ * Exactly one of FILE, PIPE and SHM is not null. */
+struct open_file {
+	struct file *file;          /* The file, or null. */
+	struct pipe *pipe;          /* The pipe, or null. */
+	bool pipe_writer;           /* Write end of PIPE? */
+	struct shm *shm;            /* The segment, or null. */
+	int flags;                  /* O_NONBLOCK or 0. */
+	unsigned ref_cnt;           /* Descriptors, in any process, on it. */
+};
+
+/* A process's file descriptors.  The table lives on the heap, not in
+ * the thread's page, and doubles as needed up to FD_MAX.  The threads
+ * of a process share it, so its operations take LOCK. */
+struct fd_table {
+	struct lock lock;           /* Protects the members below. */
+	struct open_file **files;   /* Per descriptor; null if free. */
+	uint64_t *used;             /* Bitmap of descriptors in use. */
+	size_t cap;                 /* Descriptors allocated, multiple of 64. */
+	size_t free_word;           /* No free descriptor in a lower word. */
+};
+
+void fd_table_init (struct fd_table *);
+int fd_open (struct fd_table *, struct file *);
+int fd_open_pipe (struct fd_table *, struct pipe *, bool writer);
+int fd_open_shm (struct fd_table *, struct shm *);
+struct file *fd_get (struct fd_table *, int fd, struct open_file **ref);
+struct pipe *fd_get_pipe (struct fd_table *, int fd, bool writer,
+		struct open_file **ref);
+struct shm *fd_get_shm (struct fd_table *, int fd, struct open_file **ref);
+struct open_file *fd_ref (struct fd_table *, int fd);
+void fd_unref (struct open_file *);
+int fd_get_flags (struct fd_table *, int fd);
+bool fd_set_flags (struct fd_table *, int fd, int flags);
+bool fd_close (struct fd_table *, int fd);
+int fd_dup2 (struct fd_table *, int oldfd, int newfd);
+bool fd_table_copy (struct fd_table *dst, struct fd_table *src);
+void fd_table_destroy (struct fd_table *);
+
+#endif /* userprog/fdtable.h */
@@ -0,0 +1,20 @@
+#ifndef USERPROG_FSTRACE_H
+#define USERPROG_FSTRACE_H
+
+#include <fstrace.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+
+extern bool fstrace_enabled;
+
+void fstrace_init (void);
+int64_t fstrace_begin (void);
+void fstrace_fd (int64_t start, enum fstrace_op, int fd, off_t offset,
+		size_t size, int result);
+void fstrace_path (int64_t start, enum fstrace_op, const char *path,
+		size_t size, int result);
+void fstrace_dump (void);
+
+#endif /* userprog/fstrace.h */
@@ -0,0 +1,40 @@
+#ifndef USERPROG_IMAGE_H
+#define USERPROG_IMAGE_H
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+
+struct file;
+struct inode;
+
+/* A loadable segment of an executable, as load_segment() maps it:
+ * READ_BYTES bytes from file offset OFS at user page UPAGE, then
+ * ZERO_BYTES of zeros, a whole number of pages in all. */
+struct image_segment {
+	off_t ofs;                  /* Page-aligned file offset. */
+	uintptr_t upage;            /* Page-aligned user address. */
+	uint32_t read_bytes;        /* Bytes read from the file... */
+	uint32_t zero_bytes;        /* ...and zeroed after them. */
+	bool writable;              /* Writable by the process? */
+};
+
+/* The parsed headers of an executable: what load() needs to map it,
+ * valid for as long as its inode's version stays VERSION. */
+struct image {
+	struct list_elem elem;      /* Element in the image cache. */
+	int ref_cnt;                /* References, the cache's included. */
+	struct file *file;          /* Keeps INODE open while cached. */
+	struct inode *inode;        /* The executable. */
+	uint64_t version;           /* INODE's version when parsed. */
+	uintptr_t entry;            /* Entry point. */
+	size_t seg_cnt;             /* Number of loadable segments. */
+	struct image_segment segs[]; /* Loadable segments, in file order. */
+};
+
+void image_init (void);
+struct image *image_get (struct file *);
+void image_put (struct image *);
+
+#endif /* userprog/image.h */
@@ -0,0 +1,22 @@
+#ifndef USERPROG_PIPE_H
+#define USERPROG_PIPE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct pipe;
+struct poll_table;
+struct poll_waiter;
+
+/* Returned by pipe_read() and pipe_write() for a bad user buffer. */
+#define PIPE_FAULT (-2)
+
+struct pipe *pipe_create (void);
+int64_t pipe_read (struct pipe *, void *ubuf, size_t size, bool nonblock);
+int64_t pipe_write (struct pipe *, const void *ubuf, size_t size,
+		bool nonblock);
+void pipe_close (struct pipe *, bool writer);
+int pipe_poll (struct pipe *, bool writer, struct poll_table *,
+		struct poll_waiter *);
+
+#endif /* userprog/pipe.h */
@@ -1,12 +1,19 @@
 #ifndef USERPROG_PROCESS_H
 #define USERPROG_PROCESS_H
 
+#include <rusage.h>
+#include <stdbool.h>
 #include "threads/thread.h"
 
+extern bool process_report_rusage;
+
 tid_t process_create_initd (const char *file_name);
 tid_t process_fork (const char *name, struct intr_frame *if_);
+tid_t process_clone (void *entry, void *stack, uint64_t arg);
 int process_exec (void *f_name);
+tid_t process_spawn (char *cmd_line);
 int process_wait (tid_t);
+bool process_get_rusage (int who, struct rusage *);
 void process_exit (void);
 void process_activate (struct thread *next);
 
@@ -0,0 +1,54 @@
+#ifndef USERPROG_RGROUP_H
+#define USERPROG_RGROUP_H
+#include <list.h>
+#include <rgroup.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/disk.h"
+
+struct thread;
+
+/* A resource group: processes whose resident frames, pages in swap
+   and share of disk time are limited together.  See rgroup.c. */
+struct rgroup {
+	int id;                     /* Identifier, 1 or more. */
+	size_t member_cnt;          /* Processes in the group. */
+	struct list_elem elem;      /* Element in the group list. */
+	struct rgroup_limits limits;    /* Limits, as given at creation. */
+
+	/* Charged by vm.c, with its frame lock held. */
+	size_t frames;              /* Resident frames of members. */
+	long long reclaim_cnt;      /* Frames evicted to stay under the cap. */
+	long long over_cnt;         /* Frames taken beyond the cap. */
+
+	/* Charged by anon.c, with its charge lock held. */
+	size_t swap;                /* Pages of members in swap. */
+
+	/* Drawn on by the members' disk requests. */
+	struct disk_share io;
+};
+
+/* Does group G, which may be null, hold its cap of frames? */
+static inline bool
+rgroup_frames_full (const struct rgroup *g) {
+	return g != NULL && g->limits.frame_max > 0
+		&& g->frames >= g->limits.frame_max;
+}
+
+/* Does group G, which may be null, hold its cap of swap? */
+static inline bool
+rgroup_swap_full (const struct rgroup *g) {
+	return g != NULL && g->limits.swap_max > 0
+		&& g->swap >= g->limits.swap_max;
+}
+
+void rgroup_init (void);
+int rgroup_create (const struct rgroup_limits *);
+int rgroup_join (int id);
+bool rgroup_stat (int id, struct rgroup_stat *);
+struct rgroup *rgroup_get (struct rgroup *);
+void rgroup_adopt (struct thread *, struct rgroup *);
+void rgroup_put (struct rgroup *);
+void rgroup_exit (void);
+
+#endif /* userprog/rgroup.h */
@@ -3,16 +3,62 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include "filesys/off_t.h"
+
+struct iovec;
+struct memstat;
+struct pollfd;
+struct rgroup_limits;
+struct rgroup_stat;
+struct rusage;
 
-static int64_t get_user(const uint8_t *);
-static bool put_user(uint8_t *, uint8_t);
 void syscall_init (void);
+void syscall_init_cpu (void);
+void syscall_print_stats (void);
 void sys_halt(void);
+int sys_read(int fd, void *buf, size_t size);
 size_t sys_write(int fildes, const void *buf, size_t nbyte);
 void sys_exit(int);
+bool sys_create(const char *, off_t initial_size);
+bool sys_remove(const char *);
 int sys_open(const char *);
+int sys_mount(const char *path, int chan_no, int dev_no);
+int sys_umount(const char *path);
+int sys_symlink(const char *target, const char *linkpath);
 int sys_close(int fd);
-int memory_check(void *mem);
+off_t sys_filesize(int fd);
+void sys_seek(int fd, off_t position);
+off_t sys_tell(int fd);
+int sys_fsync(int fd);
+int sys_spawn(const char *path, char *const argv[]);
+int sys_wait(int pid);
+int sys_pipe(int *fds);
+int sys_poll(struct pollfd *fds, unsigned nfds, int timeout);
+int sys_fcntl(int fd, int cmd, int arg);
+void *sys_mmap(void *addr, size_t length, int writable, int fd,
+		off_t offset);
+void sys_munmap(void *addr);
+int sys_shm_open(const char *name, size_t size);
+void *sys_shm_map(int fd, void *addr);
+int sys_madvise(void *addr, size_t length, int advice);
+int sys_msync(void *addr, size_t length, int flags);
+void *sys_sbrk(intptr_t increment);
+bool sys_memstat(int tag, struct memstat *st);
+int sys_getrusage(int who, struct rusage *ru);
+int sys_rgroup_create(const struct rgroup_limits *limits);
+int sys_rgroup_join(int id);
+int sys_rgroup_stat(int id, struct rgroup_stat *st);
+int sys_sched_setaffinity(int tid, unsigned mask);
+int sys_sched_getaffinity(int tid);
+int sys_dup2(int oldfd, int newfd);
+int sys_pread(int fd, void *buf, size_t size, off_t ofs);
+int sys_pwrite(int fd, const void *buf, size_t size, off_t ofs);
+int sys_readv(int fd, const struct iovec *iov, int iovcnt);
+int sys_writev(int fd, const struct iovec *iov, int iovcnt);
+int sys_copy_file_range(int fd_in, off_t off_in, int fd_out, off_t off_out,
+		size_t size);
+int sys_fallocate(int fd, off_t offset, off_t length);
+int sys_readdir_batch(int fd, void *buf, size_t size);
 
 
 #endif /* userprog/syscall.h */
@@ -2,12 +2,27 @@
 #define VM_ANON_H
 #include "vm/vm.h"
 struct page;
+struct rgroup;
+struct thread;
+struct zswap_entry;
 enum vm_type;
 
 struct anon_page {
+	size_t slot;                /* Swap slot, or BITMAP_ERROR if none. */
+	struct zswap_entry *zentry; /* Compressed copy, or null if none. */
 };
 
 void vm_anon_init (void);
 bool anon_initializer (struct page *page, enum vm_type type, void *kva);
+bool anon_swap_out_run (struct page **pages, size_t cnt);
+bool anon_swapped (const struct page *page);
+bool anon_swap_cached (const struct page *page);
+void anon_share_swap (struct page *dst, const struct page *src);
+void anon_swap_in_run (struct page **pages, size_t cnt);
+size_t swap_write_page (const void *kva);
+void swap_read_page (size_t slot, void *kva);
+void swap_discard (size_t slot);
+void swap_print_stats (void);
+void anon_rgroup_move (struct thread *leader, struct rgroup *to);
 
 #endif
@@ -4,6 +4,8 @@
 #include "vm/vm.h"
 
 struct page;
+struct supplemental_page_table;
+struct vma;
 enum vm_type;
 
 struct file_page {
@@ -11,6 +13,11 @@ struct file_page {
 
 void vm_file_init (void);
 bool file_backed_initializer (struct page *page, enum vm_type type, void *kva);
+void file_backed_share (struct page *page);
+void file_backed_sync (struct page *page);
+void file_backed_writeback (struct supplemental_page_table *spt,
+		struct vma *vma, void *start, void *end);
+void file_backed_print_stats (void);
 void *do_mmap(void *addr, size_t length, int writable,
 		struct file *file, off_t offset);
 void do_munmap (void *va);
@@ -0,0 +1,44 @@
+#ifndef VM_SHM_H
+#define VM_SHM_H
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "threads/synch.h"
+
+struct frame;
+struct page;
+enum vm_type;
+
+/* Longest segment name, and most pages in a segment. */
+#define SHM_NAME_MAX 14
+#define SHM_PAGES_MAX 1024
+
+/* Where one page of a segment is: in FRAME, which every mapping of
+ * the page shares, or, if FRAME is null, in swap SLOT, or nowhere
+ * yet if SLOT is BITMAP_ERROR too.  Protected by the frame lock. */
+struct shm_slot {
+	struct frame *frame;        /* Frame holding the page, or null. */
+	size_t slot;                /* Swap slot, or BITMAP_ERROR. */
+};
+
+/* A shared memory segment: anonymous memory that every process
+ * mapping it sees the same, page for page. */
+struct shm {
+	char name[SHM_NAME_MAX + 1]; /* Name it is opened by. */
+	unsigned ref_cnt;           /* Descriptors and regions on it. */
+	struct list_elem elem;      /* Element in the list of segments. */
+	struct lock lock;           /* Serializes faults on its pages. */
+	size_t page_cnt;            /* Size, in pages. */
+	struct shm_slot pages[];    /* Per page. */
+};
+
+void vm_shm_init (void);
+struct shm *shm_open (const char *name, size_t size);
+struct shm *shm_dup (struct shm *);
+void shm_put (struct shm *);
+void *shm_map (struct shm *, void *addr);
+struct shm_slot *shm_slot (const struct page *);
+bool shm_initializer (struct page *page, enum vm_type type, void *kva);
+void shm_share (struct page *page);
+
+#endif /* vm/shm.h */
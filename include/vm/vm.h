@@ -1,7 +1,10 @@
 #ifndef VM_VM_H
 #define VM_VM_H
 #include <stdbool.h>
+#include <hash.h>
+#include <ohash.h>
 #include "threads/palloc.h"
+#include "threads/synch.h"
 
 enum vm_type {
 	/* page not initialized */
@@ -12,6 +15,8 @@ enum vm_type {
 	VM_FILE = 2,
 	/* page that hold the page cache, for project 4 */
 	VM_PAGE_CACHE = 3,
+	/* page of a shared memory segment */
+	VM_SHM = 4,
 
 	/* Bit flags to store state */
 
@@ -27,11 +32,15 @@ enum vm_type {
 #include "vm/uninit.h"
 #include "vm/anon.h"
 #include "vm/file.h"
+#include "vm/vma.h"
+#include "vm/shm.h"
 #ifdef EFILESYS
 #include "filesys/page_cache.h"
 #endif
 
+struct inode;
 struct page_operations;
+struct rgroup;
 struct thread;
 
 #define VM_TYPE(type) ((type) & 7)
@@ -46,6 +55,13 @@ struct page {
 	struct frame *frame;   /* Back reference for frame */
 
 	/* Your implementation */
+	struct thread *owner;       /* Process whose page table maps it. */
+	struct vma *vma;            /* Region the page belongs to. */
+	struct list_elem vma_elem;  /* Element in the region's page list. */
+	struct list_elem frame_elem; /* Element in the frame's page list. */
+	bool writable;              /* May the user write the page? */
+	bool prefetched;            /* Brought in by fault-around, not yet used? */
+	bool evicted;               /* Evicted since it was last faulted in? */
 
 	/* Per-type data are binded into the union.
 	 * Each function automatically detects the current union */
@@ -59,11 +75,87 @@ struct page {
 	};
 };
 
-/* The representation of "frame" */
+/* The LRU lists that the frame table is sorted into, one pair for
+ * frames of file pages and one for all others.  See vm.c. */
+enum frame_lru {
+	LRU_ANON_INACTIVE,
+	LRU_ANON_ACTIVE,
+	LRU_FILE_INACTIVE,
+	LRU_FILE_ACTIVE,
+	LRU_CNT,
+	LRU_NONE = LRU_CNT          /* Not on any list. */
+};
+
+/* The representation of "frame".  A frame may be mapped by many pages:
+ * the copies of an anonymous page that a fork or same-page merging left
+ * sharing it read-only, the mappings of a file page in the file cache,
+ * or those of a shared memory segment.  PAGES is the frame's reverse
+ * map, every page mapping it, each with its owner's page table, so that
+ * eviction and write protection touch exactly the page table entries
+ * that map the frame. */
 struct frame {
 	void *kva;
-	struct page *page;
+	struct page *page;          /* First page in PAGES, or null. */
+	struct list pages;          /* Pages mapping the frame. */
+	struct list_elem elem;      /* Element in the frame table. */
+	unsigned pin_cnt;           /* Not evicted while filled or written. */
+	bool evicting;              /* Being written out by an eviction. */
+	enum frame_lru lru;         /* List holding the frame. */
+	struct list_elem lru_elem;  /* Element in that list. */
+	bool referenced;            /* Found accessed once while inactive? */
+
+	/* For a frame holding a read-only file page, in the file cache.
+	 * INODE is null for any other frame. */
+	struct inode *inode;        /* File the contents come from. */
+	off_t ofs;                  /* Offset in the file. */
+	size_t bytes;               /* Bytes from the file; the rest is zero. */
+	struct hash_elem cache_elem; /* Element in the file cache. */
+
+	/* Same-page merging. */
+	uint64_t ksm_sum;           /* Hash of the contents at the last scan. */
+	bool ksm_scanned;           /* Has KSM_SUM been computed? */
+	bool ksm_listed;            /* In the table of stable frames? */
+	struct hash_elem ksm_elem;  /* Element in that table. */
+};
+
+/* Frame eviction policies, chosen with the -evict option. */
+enum vm_evict_policy {
+	EVICT_FIFO,                 /* Oldest frame first. */
+	EVICT_CLOCK,                /* Second chance, clean frames first. */
+	EVICT_CLOCK2,               /* Two-handed clock. */
+	EVICT_LRU,                  /* Active and inactive lists. */
 };
+extern enum vm_evict_policy vm_evict_policy;
+
+/* Pages after a faulting one that are brought in with it, set by the
+ * -fault-around option.  Zero disables fault-around. */
+#define FAULT_AROUND_MAX 16
+extern unsigned vm_fault_around;
+
+/* The user stack grows on demand down to STACK_MAX below USER_STACK.
+ * A fault that grows it maps a batch of pages at once, set by the
+ * -stack-batch option. */
+#define STACK_MAX (1 << 20)
+#define STACK_BATCH_MAX 16
+extern unsigned vm_stack_batch;
+
+/* Merge identical anonymous pages in the background?  Set by the -ksm
+ * option. */
+extern bool vm_ksm;
+
+/* Size of the compressed swap cache, in percent of the user pool,
+ * set by the -zswap option.  Zero disables it.  See zswap.c. */
+extern unsigned vm_zswap_percent;
+
+/* Swap slots read by a swap-in fault, counting the faulting page's,
+ * set by the -swap-ra option.  The others go to the swap cache.  One
+ * or zero disables swap read-ahead.  See anon.c. */
+#define SWAP_RA_MAX 16
+extern unsigned vm_swap_ra;
+
+/* Most pages one prefetch brings in. */
+#define PREFETCH_MAX (FAULT_AROUND_MAX > STACK_BATCH_MAX \
+		? FAULT_AROUND_MAX : STACK_BATCH_MAX)
 
 /* The function table for page operations.
  * This is one way of implementing "interface" in C.
@@ -85,6 +177,26 @@ struct page_operations {
  * We don't want to force you to obey any specific design for this struct.
  * All designs up to you for this. */
 struct supplemental_page_table {
+	struct lock lock;           /* Serializes faults and (un)mapping. */
+	struct rb_tree vmas;        /* struct vmas, ordered by start. */
+	struct ohash pages;         /* Materialized struct pages, keyed by VA. */
+
+	/* Footprint and page-fault frequency, for eviction and the OOM
+	 * killer.  Owned by vm.c; RSS, OOM_KILLED and RESIDENT_ELEM are
+	 * protected by the frame lock. */
+	size_t rss;                 /* Frames held. */
+	size_t swap_cnt;            /* Pages in swap, counted by anon.c. */
+	bool oom_killed;            /* Chosen by the OOM killer? */
+	size_t ws_target;           /* Working-set estimate, in frames. */
+	int64_t last_fault;         /* Timer tick of the last fault. */
+	long long fault_cnt;        /* Faults taken. */
+	long long stack_grow_cnt;   /* Faults that grew the stack. */
+
+	/* The heap, grown and shrunk by sbrk(): an anonymous region from
+	 * HEAP_START up to BRK, rounded up to a page.  Set by load. */
+	uint8_t *heap_start;        /* First byte of the heap. */
+	uint8_t *brk;               /* The program break. */
+	struct list_elem resident_elem; /* Element in resident list. */
 };
 
 #include "threads/thread.h"
@@ -98,6 +210,8 @@ bool spt_insert_page (struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page (struct supplemental_page_table *spt, struct page *page);
 
 void vm_init (void);
+void vm_set_evict_policy (const char *name);
+void vm_print_stats (void);
 bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 		bool write, bool not_present);
 
@@ -106,7 +220,16 @@ bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 bool vm_alloc_page_with_initializer (enum vm_type type, void *upage,
 		bool writable, vm_initializer *init, void *aux);
 void vm_dealloc_page (struct page *page);
+void vm_free_frame (struct page *page);
+struct frame *vm_frame_pin (struct page *page, bool *dirty);
+void vm_frame_unpin (struct frame *frame);
 bool vm_claim_page (void *va);
+bool vm_madvise (void *addr, size_t length, int advice);
+bool vm_msync (void *addr, size_t length, int flags);
+void *vm_sbrk (intptr_t increment);
+void vm_populate (void *addr);
+bool vm_oom_killed (void);
+void vm_rgroup_move (struct thread *leader, struct rgroup *to);
 enum vm_type page_get_type (struct page *page);
 
 #endif  /* VM_VM_H */
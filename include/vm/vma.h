@@ -0,0 +1,57 @@
+#ifndef VM_VMA_H
+#define VM_VMA_H
+#include <list.h>
+#include <rbtree.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+#include "vm/vm.h"
+
+struct file;
+struct shm;
+struct supplemental_page_table;
+
+/* A virtual memory area: a page-aligned range [START, END) of a
+ * process's address space whose pages share one type, one set of
+ * permissions and one backing store.  Mapping a region creates
+ * only this descriptor; the struct page for each page is made on
+ * first touch and linked into PAGES. */
+struct vma {
+	void *start;                /* First page of the region. */
+	void *end;                  /* End of the region, exclusive. */
+	enum vm_type type;          /* Type of the region's pages. */
+	bool writable;              /* May the pages be written? */
+
+	/* Backing store.  The first READ_BYTES bytes of the region
+	 * come from FILE starting at OFFSET; the rest is zero. */
+	struct file *file;          /* Owned by the region, or null. */
+	off_t offset;               /* File offset of START. */
+	size_t read_bytes;          /* Bytes backed by FILE. */
+	struct shm *shm;            /* Shared segment, owned by the region,
+	                               or null. */
+
+	vm_initializer *init;       /* Fills each page on first fault. */
+	void *aux;                  /* Auxiliary data for INIT. */
+	int advice;                 /* MADV_NORMAL or MADV_SEQUENTIAL. */
+
+	struct list pages;          /* Materialized pages. */
+	struct rb_node elem;        /* Element in the spt's region tree. */
+};
+
+void vma_table_init (struct supplemental_page_table *);
+struct vma *vma_create (struct supplemental_page_table *, void *start,
+		size_t length, enum vm_type type, bool writable);
+struct vma *vma_find (struct supplemental_page_table *, const void *addr);
+void vma_destroy (struct supplemental_page_table *, struct vma *);
+void vma_destroy_all (struct supplemental_page_table *);
+bool vma_extend_down (struct supplemental_page_table *, struct vma *,
+		void *start, size_t gap);
+bool vma_extend_up (struct supplemental_page_table *, struct vma *,
+		void *end, size_t gap);
+void vma_truncate (struct supplemental_page_table *, struct vma *,
+		void *end);
+
+size_t vma_page_bytes (const struct vma *, const void *va, off_t *ofs);
+bool vma_read_page (const struct vma *, const void *va, void *kva);
+
+#endif /* vm/vma.h */
@@ -63,6 +63,37 @@ last_mask (const struct bitmap *b) {
 	int last_bits = b->bit_cnt % ELEM_BITS;
 	return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
+
+/* Returns a bit mask of the bits of element ELEM that represent
+   bits START through END, exclusive, which must overlap it. */
+static inline elem_type
+range_mask (size_t elem, size_t start, size_t end) {
+	size_t base = elem * ELEM_BITS;
+	elem_type mask = (elem_type) -1;
+
+	if (start > base)
+		mask &= (elem_type) -1 << (start - base);
+	if (end < base + ELEM_BITS)
+		mask &= ((elem_type) 1 << (end - base)) - 1;
+	return mask;
+}
+
+/* Returns element ELEM of B with a 1 in each bit that is set to
+   VALUE. */
+static inline elem_type
+elem_matching (const struct bitmap *b, size_t elem, bool value) {
+	return value ? b->bits[elem] : ~b->bits[elem];
+}
+
+/* Returns the number of 1 bits in X.  (GCC's __builtin_popcountl
+   would call into libgcc, which the kernel does not link.) */
+static inline size_t
+elem_popcount (elem_type x) {
+	x = x - ((x >> 1) & 0x5555555555555555UL);
+	x = (x & 0x3333333333333333UL) + ((x >> 2) & 0x3333333333333333UL);
+	x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fUL;
+	return (x * 0x0101010101010101UL) >> 56;
+}
 
 /* Creation and destruction. */
 
@@ -195,7 +226,8 @@ bitmap_set_all (struct bitmap *b, bool value) {
 	bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE, a whole
+   element at a time.  Each element is updated atomically. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) {
 	size_t i;
@@ -204,8 +236,16 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) {
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		bitmap_set (b, start + i, value);
+	if (cnt == 0)
+		return;
+	for (i = elem_idx (start); i <= elem_idx (start + cnt - 1); i++) {
+		elem_type mask = range_mask (i, start, start + cnt);
+
+		if (value)
+			asm ("lock orq %1, %0" : "=m" (b->bits[i]) : "r" (mask) : "cc");
+		else
+			asm ("lock andq %1, %0" : "=m" (b->bits[i]) : "r" (~mask) : "cc");
+	}
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -219,9 +259,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) {
 	ASSERT (start + cnt <= b->bit_cnt);
 
 	value_cnt = 0;
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
-			value_cnt++;
+	if (cnt == 0)
+		return 0;
+	for (i = elem_idx (start); i <= elem_idx (start + cnt - 1); i++)
+		value_cnt += elem_popcount (elem_matching (b, i, value)
+				& range_mask (i, start, start + cnt));
 	return value_cnt;
 }
 
@@ -235,8 +277,11 @@ bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) {
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
+	if (cnt == 0)
+		return false;
+	for (i = elem_idx (start); i <= elem_idx (start + cnt - 1); i++)
+		if ((elem_matching (b, i, value)
+					& range_mask (i, start, start + cnt)) != 0)
 			return true;
 	return false;
 }
@@ -264,6 +309,56 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt) {
 
 /* Finding set or unset bits. */
 
+/* Returns the starting index of the first group of CNT
+   consecutive bits in B between START and END, exclusive, that
+   are all set to VALUE, or BITMAP_ERROR if there is none.
+
+   Works an element at a time: an element with no bit set to
+   VALUE ends any run in one step, and the bits of the others are
+   consumed a run of equal bits at a time, found with a
+   count-trailing-zeros instruction. */
+static size_t
+scan_range (const struct bitmap *b, size_t start, size_t end, size_t cnt,
+		bool value) {
+	size_t run_start = start, run_len = 0;
+	size_t i;
+
+	if (cnt == 0)
+		return start;
+	if (end < start || cnt > end - start)
+		return BITMAP_ERROR;
+
+	for (i = elem_idx (start); i <= elem_idx (end - 1); i++) {
+		elem_type bits = elem_matching (b, i, value) & range_mask (i, start, end);
+		size_t pos = 0;
+
+		while (pos < ELEM_BITS) {
+			elem_type rest = bits >> pos;
+			size_t ones;
+
+			if (rest == 0) {
+				run_len = 0;
+				break;
+			}
+			if (run_len == 0) {
+				size_t zeros = __builtin_ctzl (rest);
+
+				pos += zeros;
+				rest >>= zeros;
+				run_start = i * ELEM_BITS + pos;
+			}
+			ones = ~rest == 0 ? ELEM_BITS : (size_t) __builtin_ctzl (~rest);
+			run_len += ones;
+			if (run_len >= cnt)
+				return run_start;
+			pos += ones;
+			if (pos < ELEM_BITS)
+				run_len = 0;
+		}
+	}
+	return BITMAP_ERROR;
+}
+
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
@@ -273,14 +368,31 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) {
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 
-	if (cnt <= b->bit_cnt) {
-		size_t last = b->bit_cnt - cnt;
-		size_t i;
-		for (i = start; i <= last; i++)
-			if (!bitmap_contains (b, i, cnt, !value))
-				return i;
+	return scan_range (b, start, b->bit_cnt, cnt, value);
+}
+
+/* Finds and returns the starting index of a group of CNT
+   consecutive bits in B that are all set to VALUE, preferring
+   the first one at or after HINT and otherwise taking the first
+   one before it.  Lets an allocator carry on from where its last
+   allocation ended instead of rescanning the front of the map.
+   If there is no such group, returns BITMAP_ERROR. */
+size_t
+bitmap_scan_wrap (const struct bitmap *b, size_t hint, size_t cnt,
+		bool value) {
+	size_t idx;
+
+	ASSERT (b != NULL);
+	ASSERT (hint <= b->bit_cnt);
+
+	idx = scan_range (b, hint, b->bit_cnt, cnt, value);
+	if (idx == BITMAP_ERROR && hint > 0) {
+		/* Only groups that start before HINT are left. */
+		size_t end = cnt - 1 < b->bit_cnt - hint ? hint + cnt - 1 : b->bit_cnt;
+
+		idx = scan_range (b, 0, end, cnt, value);
 	}
-	return BITMAP_ERROR;
+	return idx;
 }
 
 /* Finds the first group of CNT consecutive bits in B at or after
@@ -327,6 +439,31 @@ bitmap_write (const struct bitmap *b, struct file *file) {
 	off_t size = byte_cnt (b->bit_cnt);
 	return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the part of B that holds the CNT bits starting at START
+   to FILE, where bitmap_write() would put it, widened to whole
+   BLOCK-byte blocks of the file.  Returns true if successful,
+   false otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file,
+		size_t start, size_t cnt, size_t block) {
+	size_t size = byte_cnt (b->bit_cnt);
+	size_t ofs, end;
+
+	ASSERT (start <= b->bit_cnt);
+	ASSERT (cnt <= b->bit_cnt - start);
+	ASSERT (block > 0);
+
+	if (cnt == 0)
+		return true;
+	ofs = elem_idx (start) * sizeof (elem_type) / block * block;
+	end = DIV_ROUND_UP ((elem_idx (start + cnt - 1) + 1) * sizeof (elem_type),
+			block) * block;
+	if (end > size)
+		end = size;
+	return file_write_at (file, (const uint8_t *) b->bits + ofs, end - ofs, ofs)
+		== (off_t) (end - ofs);
+}
 #endif /* FILESYS */
 
 /* Debugging. */
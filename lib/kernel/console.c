@@ -1,14 +1,17 @@
 #include <console.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
+#include "devices/debugcon.h"
 #include "devices/serial.h"
 #include "devices/vga.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
 
-static void vprintf_helper (char, void *);
+static void vprintf_helper (const char *, size_t, void *);
 static void putchar_have_lock (uint8_t c);
+static void putbuf_have_lock (const char *, size_t);
 
 /* The console lock.
    Both the vga and serial layers do their own locking, so it's
@@ -59,6 +62,29 @@ static int console_lock_depth;
 /* Number of characters written to console. */
 static int64_t write_cnt;
 
+/* A device that console output goes to. */
+struct console_sink {
+	const char *name;                   /* Name, for -console. */
+	void (*putbuf) (const char *, size_t); /* Writes a run of output. */
+	bool enabled;                       /* Receiving output? */
+};
+
+/* Maximum number of console sinks. */
+#define SINK_MAX 4
+
+/* The console sinks.  The serial port and the VGA display are
+   present from the first byte of output; others can be added
+   with console_register_sink().  The emulator's debug console
+   takes a run of output in one instruction instead of one per
+   byte, but only -console=debugcon selects it, since it is not
+   where Pintos output is usually looked for. */
+static struct console_sink sinks[SINK_MAX] = {
+	{ "serial", serial_putbuf, true },
+	{ "vga", vga_putbuf, true },
+	{ "debugcon", debugcon_putbuf, false },
+};
+static size_t sink_cnt = 3;
+
 /* Enable console locking. */
 void
 console_init (void) {
@@ -74,14 +100,72 @@ console_panic (void) {
 	use_console_lock = false;
 }
 
+/* Adds a console sink called NAME that writes runs of output
+   with PUTBUF.  It starts out enabled. */
+void
+console_register_sink (const char *name,
+		void (*putbuf) (const char *, size_t)) {
+	enum intr_level old_level;
+
+	ASSERT (sink_cnt < SINK_MAX);
+
+	acquire_console ();
+	old_level = intr_disable ();
+	sinks[sink_cnt].name = name;
+	sinks[sink_cnt].putbuf = putbuf;
+	sinks[sink_cnt].enabled = true;
+	sink_cnt++;
+	intr_set_level (old_level);
+	release_console ();
+}
+
+/* Sends console output only to the sinks named in NAMES, a
+   comma-separated list such as "serial".  Running with just the
+   serial port skips drawing to a VGA display that nobody is
+   watching.  Returns false, changing nothing, if NAMES names an
+   unknown sink or none at all, or the debug console when the
+   emulator has none. */
+bool
+console_select_sinks (const char *names) {
+	bool enable[SINK_MAX] = { false };
+	bool any = false;
+	const char *p = names;
+	size_t i;
+
+	while (*p != '\0') {
+		size_t len = strcspn (p, ",");
+
+		for (i = 0; i < sink_cnt; i++)
+			if (strlen (sinks[i].name) == len
+					&& !memcmp (sinks[i].name, p, len))
+				break;
+		if (i == sink_cnt
+				|| (sinks[i].putbuf == debugcon_putbuf && !debugcon_present ()))
+			return false;
+		enable[i] = any = true;
+		p += len;
+		if (*p == ',')
+			p++;
+	}
+	if (!any)
+		return false;
+
+	acquire_console ();
+	for (i = 0; i < sink_cnt; i++)
+		sinks[i].enabled = enable[i];
+	release_console ();
+	return true;
+}
+
 /* Prints console statistics. */
 void
 console_print_stats (void) {
 	printf ("Console: %lld characters output\n", write_cnt);
 }
 
-/* Acquires the console lock. */
-	static void
+/* Acquires the console lock, so that several writes reach the
+   console without other output in between.  May be nested. */
+void
 acquire_console (void) {
 	if (!intr_context () && use_console_lock) {
 		if (lock_held_by_current_thread (&console_lock)) 
@@ -92,7 +176,7 @@ acquire_console (void) {
 }
 
 /* Releases the console lock. */
-static void
+void
 release_console (void) {
 	if (!intr_context () && use_console_lock) {
 		if (console_lock_depth > 0)
@@ -113,7 +197,7 @@ console_locked_by_current_thread (void) {
 
 /* The standard vprintf() function,
    which is like printf() but uses a va_list.
-   Writes its output to both vga display and serial port. */
+   Writes its output to the enabled console sinks. */
 int
 vprintf (const char *format, va_list args) {
 	int char_cnt = 0;
@@ -130,8 +214,7 @@ vprintf (const char *format, va_list args) {
 int
 puts (const char *s) {
 	acquire_console ();
-	while (*s != '\0')
-		putchar_have_lock (*s++);
+	putbuf_have_lock (s, strlen (s));
 	putchar_have_lock ('\n');
 	release_console ();
 
@@ -142,12 +225,11 @@ puts (const char *s) {
 void
 putbuf (const char *buffer, size_t n) {
 	acquire_console ();
-	while (n-- > 0)
-		putchar_have_lock (*buffer++);
+	putbuf_have_lock (buffer, n);
 	release_console ();
 }
 
-/* Writes C to the vga display and serial port. */
+/* Writes C to the console. */
 int
 putchar (int c) {
 	acquire_console ();
@@ -159,19 +241,32 @@ putchar (int c) {
 
 /* Helper function for vprintf(). */
 static void
-vprintf_helper (char c, void *char_cnt_) {
+vprintf_helper (const char *buf, size_t n, void *char_cnt_) {
 	int *char_cnt = char_cnt_;
-	(*char_cnt)++;
-	putchar_have_lock (c);
+	*char_cnt += n;
+	putbuf_have_lock (buf, n);
 }
 
-/* Writes C to the vga display and serial port.
+/* Writes C to the enabled console sinks.
    The caller has already acquired the console lock if
    appropriate. */
 static void
 putchar_have_lock (uint8_t c) {
+	char ch = c;
+
+	putbuf_have_lock (&ch, 1);
+}
+
+/* Writes the N characters in BUF to each enabled console sink,
+   a run at a time.  The caller has already acquired the console
+   lock if appropriate. */
+static void
+putbuf_have_lock (const char *buf, size_t n) {
+	size_t i;
+
 	ASSERT (console_locked_by_current_thread ());
-	write_cnt++;
-	serial_putc (c);
-	vga_putc (c);
+	write_cnt += n;
+	for (i = 0; i < sink_cnt; i++)
+		if (sinks[i].enabled)
+			sinks[i].putbuf (buf, n);
 }
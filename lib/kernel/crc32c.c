@@ -0,0 +1,71 @@
+#include "crc32c.h"
+#include <intrinsic.h>
+#include <stdbool.h>
+
+/* Reflected CRC-32C polynomial. */
+#define CRC32C_POLY 0x82f63b78
+
+/* Does the CPU have SSE4.2, and so the crc32 instruction?  -1 until
+   first checked.  The instruction works on general registers only,
+   so it needs no SSE state for all that the kernel is built with
+   -mno-sse. */
+static int have_sse42 = -1;
+
+/* Byte-at-a-time table for CPUs without it, built on first use. */
+static uint32_t crc_table[256];
+static bool crc_table_ready;
+
+static void
+table_init (void) {
+	uint32_t i;
+	int k;
+
+	for (i = 0; i < 256; i++) {
+		uint32_t crc = i;
+
+		for (k = 0; k < 8; k++)
+			crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+		crc_table[i] = crc;
+	}
+	crc_table_ready = true;
+}
+
+/* Extends CRC over the SIZE bytes at BUF with the crc32
+   instruction, eight bytes at a time. */
+static uint32_t
+crc32c_hw (uint32_t crc, const uint8_t *buf, size_t size) {
+	uint64_t crc64 = crc;
+
+	for (; size >= 8; size -= 8, buf += 8) {
+		uint64_t word;
+
+		__builtin_memcpy (&word, buf, sizeof word);
+
+		asm ("crc32q %1, %0" : "+r" (crc64) : "rm" (word));
+	}
+	crc = crc64;
+	for (; size > 0; size--, buf++)
+		asm ("crc32b %1, %0" : "+r" (crc) : "rm" (*buf));
+	return crc;
+}
+
+/* Extends CRC over the SIZE bytes at BUF_ and returns the result. */
+uint32_t
+crc32c (uint32_t crc, const void *buf_, size_t size) {
+	const uint8_t *buf = buf_;
+
+	if (have_sse42 < 0) {
+		uint32_t regs[4];
+
+		cpuid (1, 0, regs);
+		have_sse42 = (regs[2] >> 20) & 1;
+	}
+	if (have_sse42)
+		return crc32c_hw (crc, buf, size);
+
+	if (!crc_table_ready)
+		table_init ();
+	for (; size > 0; size--)
+		crc = crc_table[(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+	return crc;
+}
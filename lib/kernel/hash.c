@@ -6,6 +6,7 @@
    See hash.h for basic information. */
 
 #include "hash.h"
+#include <string.h>
 #include "../debug.h"
 #include "threads/malloc.h"
 
@@ -18,15 +19,32 @@ static struct hash_elem *find_elem (struct hash *, struct list *,
 static void insert_elem (struct hash *, struct list *, struct hash_elem *);
 static void remove_elem (struct hash *, struct hash_elem *);
 static void rehash (struct hash *);
+static void migrate (struct hash *, size_t cnt);
+static void finish_migration (struct hash *);
+static size_t bucket_cnt_for (size_t elem_cnt, size_t min);
 
 /* Initializes hash table H to compute hash values using HASH and
    compare hash elements using LESS, given auxiliary data AUX. */
 bool
 hash_init (struct hash *h,
 		hash_hash_func *hash, hash_less_func *less, void *aux) {
+	return hash_init_sized (h, 0, hash, less, aux);
+}
+
+/* Initializes hash table H as hash_init() does, with buckets for
+   about ELEM_CNT elements from the start.  The table never shrinks
+   below that size, so filling it up to ELEM_CNT elements, or
+   emptying it again, never resizes it. */
+bool
+hash_init_sized (struct hash *h, size_t elem_cnt,
+		hash_hash_func *hash, hash_less_func *less, void *aux) {
 	h->elem_cnt = 0;
-	h->bucket_cnt = 4;
+	h->bucket_cnt = bucket_cnt_for (elem_cnt, 4);
+	h->min_bucket_cnt = h->bucket_cnt;
 	h->buckets = malloc (sizeof *h->buckets * h->bucket_cnt);
+	h->old_bucket_cnt = 0;
+	h->old_buckets = NULL;
+	h->migrate_idx = 0;
 	h->hash = hash;
 	h->less = less;
 	h->aux = aux;
@@ -51,6 +69,7 @@ void
 hash_clear (struct hash *h, hash_action_func *destructor) {
 	size_t i;
 
+	finish_migration (h);
 	for (i = 0; i < h->bucket_cnt; i++) {
 		struct list *bucket = &h->buckets[i];
 
@@ -81,6 +100,7 @@ void
 hash_destroy (struct hash *h, hash_action_func *destructor) {
 	if (destructor != NULL)
 		hash_clear (h, destructor);
+	free (h->old_buckets);
 	free (h->buckets);
 }
 
@@ -162,6 +182,17 @@ hash_apply (struct hash *h, hash_action_func *action) {
 			action (list_elem_to_hash_elem (elem), h->aux);
 		}
 	}
+	if (h->old_buckets != NULL)
+		for (i = h->migrate_idx; i < h->old_bucket_cnt; i++) {
+			struct list *bucket = &h->old_buckets[i];
+			struct list_elem *elem, *next;
+
+			for (elem = list_begin (bucket); elem != list_end (bucket);
+					elem = next) {
+				next = list_next (elem);
+				action (list_elem_to_hash_elem (elem), h->aux);
+			}
+		}
 }
 
 /* Initializes I for iterating hash table H.
@@ -205,7 +236,16 @@ hash_next (struct hash_iterator *i) {
 
 	i->elem = list_elem_to_hash_elem (list_next (&i->elem->list_elem));
 	while (i->elem == list_elem_to_hash_elem (list_end (i->bucket))) {
-		if (++i->bucket >= i->hash->buckets + i->hash->bucket_cnt) {
+		struct hash *h = i->hash;
+
+		/* After the current buckets, visit the old buckets that
+		   have not been migrated yet. */
+		++i->bucket;
+		if (i->bucket == h->buckets + h->bucket_cnt && h->old_buckets != NULL)
+			i->bucket = h->old_buckets + h->migrate_idx;
+		if (i->bucket == h->buckets + h->bucket_cnt
+				|| (h->old_buckets != NULL
+					&& i->bucket == h->old_buckets + h->old_bucket_cnt)) {
 			i->elem = NULL;
 			break;
 		}
@@ -235,52 +275,90 @@ hash_empty (struct hash *h) {
 	return h->elem_cnt == 0;
 }
 
-/* Fowler-Noll-Vo hash constants, for 32-bit word sizes. */
-#define FNV_64_PRIME 0x00000100000001B3UL
-#define FNV_64_BASIS 0xcbf29ce484222325UL
+/* MurmurHash64A constants. */
+#define MURMUR_M 0xc6a4a7935bd1e995ULL
+#define MURMUR_R 47
 
-/* Returns a hash of the SIZE bytes in BUF. */
+/* Returns a hash of the SIZE bytes in BUF.  Austin Appleby's
+   MurmurHash64A: a 64-bit word at a time, with the last few
+   bytes folded in together. */
 uint64_t
 hash_bytes (const void *buf_, size_t size) {
-	/* Fowler-Noll-Vo 32-bit hash, for bytes. */
 	const unsigned char *buf = buf_;
 	uint64_t hash;
 
 	ASSERT (buf != NULL);
 
-	hash = FNV_64_BASIS;
-	while (size-- > 0)
-		hash = (hash * FNV_64_PRIME) ^ *buf++;
+	hash = size * MURMUR_M;
+	for (; size >= 8; size -= 8, buf += 8) {
+		uint64_t k;
 
+		__builtin_memcpy (&k, buf, sizeof k);
+		k *= MURMUR_M;
+		k ^= k >> MURMUR_R;
+		k *= MURMUR_M;
+		hash = (hash ^ k) * MURMUR_M;
+	}
+	if (size > 0) {
+		uint64_t k = 0;
+
+		__builtin_memcpy (&k, buf, size);
+		hash = (hash ^ k) * MURMUR_M;
+	}
+
+	hash ^= hash >> MURMUR_R;
+	hash *= MURMUR_M;
+	hash ^= hash >> MURMUR_R;
 	return hash;
 }
 
-/* Returns a hash of string S. */
+/* Returns a hash of string S.  strlen() already goes a word at a
+   time, so measuring S first costs less than hashing it a byte at
+   a time would. */
 uint64_t
-hash_string (const char *s_) {
-	const unsigned char *s = (const unsigned char *) s_;
-	uint64_t hash;
-
+hash_string (const char *s) {
 	ASSERT (s != NULL);
 
-	hash = FNV_64_BASIS;
-	while (*s != '\0')
-		hash = (hash * FNV_64_PRIME) ^ *s++;
+	return hash_bytes (s, strlen (s));
+}
 
-	return hash;
+/* Returns a hash of X, every bit of which depends on every bit of
+   X.  MurmurHash3's finalizer. */
+uint64_t
+hash_u64 (uint64_t x) {
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+/* Returns a hash of pointer P.  Page addresses, which differ only
+   in their high bits, spread out as well as any. */
+uint64_t
+hash_ptr (const void *p) {
+	return hash_u64 ((uintptr_t) p);
 }
 
 /* Returns a hash of integer I. */
 uint64_t
 hash_int (int i) {
-	return hash_bytes (&i, sizeof i);
+	return hash_u64 ((unsigned) i);
 }
-
-/* Returns the bucket in H that E belongs in. */
+
+/* Returns the bucket in H that E belongs in: its old bucket, if
+   that has not been migrated yet, otherwise its current one. */
 static struct list *
 find_bucket (struct hash *h, struct hash_elem *e) {
-	size_t bucket_idx = h->hash (e, h->aux) & (h->bucket_cnt - 1);
-	return &h->buckets[bucket_idx];
+	uint64_t hash = h->hash (e, h->aux);
+
+	if (h->old_buckets != NULL) {
+		size_t old_idx = hash & (h->old_bucket_cnt - 1);
+		if (old_idx >= h->migrate_idx)
+			return &h->old_buckets[old_idx];
+	}
+	return &h->buckets[hash & (h->bucket_cnt - 1)];
 }
 
 /* Searches BUCKET in H for a hash element equal to E.  Returns
@@ -309,36 +387,91 @@ is_power_of_2 (size_t x) {
 	return x != 0 && turn_off_least_1bit (x) == 0;
 }
 
+/* Old buckets migrated per insertion or deletion.  Growth halves
+   the load, so at least one is needed to finish before the next
+   resize is due. */
+#define MIGRATE_STEP 2
+
 /* Element per bucket ratios. */
 #define MIN_ELEMS_PER_BUCKET  1 /* Elems/bucket < 1: reduce # of buckets. */
 #define BEST_ELEMS_PER_BUCKET 2 /* Ideal elems/bucket. */
 #define MAX_ELEMS_PER_BUCKET  4 /* Elems/bucket > 4: increase # of buckets. */
 
-/* Changes the number of buckets in hash table H to match the
-   ideal.  This function can fail because of an out-of-memory
-   condition, but that'll just make hash accesses less efficient;
-   we can still continue. */
+/* Returns the number of buckets to use for ELEM_CNT elements:
+   one for about every BEST_ELEMS_PER_BUCKET, as a power of 2 and
+   no fewer than MIN, which must be a power of 2. */
+static size_t
+bucket_cnt_for (size_t elem_cnt, size_t min) {
+	size_t cnt = elem_cnt / BEST_ELEMS_PER_BUCKET;
+
+	while (!is_power_of_2 (cnt) && cnt != 0)
+		cnt = turn_off_least_1bit (cnt);
+	return cnt > min ? cnt : min;
+}
+
+/* Moves the elements of up to CNT old buckets of H into the
+   current buckets, freeing the old buckets once all are empty. */
+static void
+migrate (struct hash *h, size_t cnt) {
+	while (h->old_buckets != NULL && cnt-- > 0) {
+		struct list *old_bucket = &h->old_buckets[h->migrate_idx++];
+
+		while (!list_empty (old_bucket)) {
+			struct list_elem *elem = list_pop_front (old_bucket);
+			struct hash_elem *e = list_elem_to_hash_elem (elem);
+			size_t idx = h->hash (e, h->aux) & (h->bucket_cnt - 1);
+			list_push_front (&h->buckets[idx], elem);
+		}
+
+		if (h->migrate_idx == h->old_bucket_cnt) {
+			free (h->old_buckets);
+			h->old_buckets = NULL;
+			h->old_bucket_cnt = 0;
+			h->migrate_idx = 0;
+		}
+	}
+}
+
+/* Moves every element of H into its current buckets. */
+static void
+finish_migration (struct hash *h) {
+	migrate (h, h->old_bucket_cnt);
+}
+
+/* Advances any resize of H in progress and, if none is, starts
+   one when the load is above MAX_ELEMS_PER_BUCKET or below
+   MIN_ELEMS_PER_BUCKET, the gap between the two keeping a table
+   whose size hovers around a power of 2 from resizing back and
+   forth.  Resizing
+   installs the new buckets at once but moves elements a few
+   buckets at a time, so no single operation pays for moving the
+   whole table.  This function can fail because of an
+   out-of-memory condition, but that'll just make hash accesses
+   less efficient; we can still continue. */
 static void
 rehash (struct hash *h) {
 	size_t old_bucket_cnt, new_bucket_cnt;
-	struct list *new_buckets, *old_buckets;
+	struct list *new_buckets;
 	size_t i;
 
 	ASSERT (h != NULL);
 
-	/* Save old bucket info for later use. */
-	old_buckets = h->buckets;
+	if (h->old_buckets != NULL) {
+		migrate (h, MIGRATE_STEP);
+		return;
+	}
+
 	old_bucket_cnt = h->bucket_cnt;
+	if (h->elem_cnt <= old_bucket_cnt * MAX_ELEMS_PER_BUCKET
+			&& (h->elem_cnt >= old_bucket_cnt * MIN_ELEMS_PER_BUCKET
+				|| old_bucket_cnt == h->min_bucket_cnt))
+		return;
 
 	/* Calculate the number of buckets to use now.
-	   We want one bucket for about every BEST_ELEMS_PER_BUCKET.
-	   We must have at least four buckets, and the number of
+	   We want one bucket for about every BEST_ELEMS_PER_BUCKET,
+	   but no fewer than the table started with, and the number of
 	   buckets must be a power of 2. */
-	new_bucket_cnt = h->elem_cnt / BEST_ELEMS_PER_BUCKET;
-	if (new_bucket_cnt < 4)
-		new_bucket_cnt = 4;
-	while (!is_power_of_2 (new_bucket_cnt))
-		new_bucket_cnt = turn_off_least_1bit (new_bucket_cnt);
+	new_bucket_cnt = bucket_cnt_for (h->elem_cnt, h->min_bucket_cnt);
 
 	/* Don't do anything if the bucket count wouldn't change. */
 	if (new_bucket_cnt == old_bucket_cnt)
@@ -355,27 +488,14 @@ rehash (struct hash *h) {
 	for (i = 0; i < new_bucket_cnt; i++)
 		list_init (&new_buckets[i]);
 
-	/* Install new bucket info. */
+	/* Install new bucket info, keeping the old buckets until their
+	   elements have been moved. */
+	h->old_buckets = h->buckets;
+	h->old_bucket_cnt = old_bucket_cnt;
+	h->migrate_idx = 0;
 	h->buckets = new_buckets;
 	h->bucket_cnt = new_bucket_cnt;
-
-	/* Move each old element into the appropriate new bucket. */
-	for (i = 0; i < old_bucket_cnt; i++) {
-		struct list *old_bucket;
-		struct list_elem *elem, *next;
-
-		old_bucket = &old_buckets[i];
-		for (elem = list_begin (old_bucket);
-				elem != list_end (old_bucket); elem = next) {
-			struct list *new_bucket
-				= find_bucket (h, list_elem_to_hash_elem (elem));
-			next = list_next (elem);
-			list_remove (elem);
-			list_push_front (new_bucket, elem);
-		}
-	}
-
-	free (old_buckets);
+	migrate (h, MIGRATE_STEP);
 }
 
 /* Inserts E into BUCKET (in hash table H). */
@@ -0,0 +1,186 @@
+#include "heap.h"
+#include "../debug.h"
+
+/* A pairing heap is a heap-ordered multiway tree.  Each node
+   points to its leftmost child and to its next sibling, and back
+   to its previous sibling or, for a leftmost child, to its
+   parent, so that any node can be cut out in O(1) time.
+
+   Two heaps are melded by making the lesser root the leftmost
+   child of the greater one.  Popping the root leaves its
+   children as a list of heaps, which are combined in two passes:
+   adjacent pairs left to right, then the results right to left.
+   This is what gives the O(log n) amortized bound.
+
+   Raising an element's rank can only break the order between it
+   and its parent, so heap_increase() just cuts the element's
+   subtree out and melds it back with the root, in O(1) time.
+   This is the "decrease-key" of a min-heap. */
+
+/* Makes the lesser of A and B, either of which may be null, the
+   leftmost child of the other, and returns the new root.  A and
+   B must both be detached (no siblings, no parent). */
+static struct heap_elem *
+meld (struct heap *heap, struct heap_elem *a, struct heap_elem *b) {
+	if (a == NULL)
+		return b;
+	if (b == NULL)
+		return a;
+	if (heap->less (a, b, heap->aux)) {
+		struct heap_elem *tmp = a;
+		a = b;
+		b = tmp;
+	}
+
+	b->prev = a;
+	b->next = a->child;
+	if (a->child != NULL)
+		a->child->prev = b;
+	a->child = b;
+	return a;
+}
+
+/* Combines the sibling list starting at FIRST into a single
+   detached heap and returns its root. */
+static struct heap_elem *
+merge_pairs (struct heap *heap, struct heap_elem *first) {
+	struct heap_elem *pairs = NULL;
+	struct heap_elem *root = NULL;
+
+	/* Left to right: meld adjacent siblings, stacking each pair
+	   through its `next' link. */
+	while (first != NULL) {
+		struct heap_elem *a = first;
+		struct heap_elem *b = a->next;
+
+		first = b != NULL ? b->next : NULL;
+		a->next = a->prev = NULL;
+		if (b != NULL)
+			b->next = b->prev = NULL;
+
+		a = meld (heap, a, b);
+		a->next = pairs;
+		pairs = a;
+	}
+
+	/* Right to left: fold the stacked pairs into one heap. */
+	while (pairs != NULL) {
+		struct heap_elem *next = pairs->next;
+
+		pairs->next = NULL;
+		root = meld (heap, root, pairs);
+		pairs = next;
+	}
+	return root;
+}
+
+/* Detaches non-root element E, and the subtree below it, from
+   the tree it is in. */
+static void
+cut (struct heap_elem *e) {
+	ASSERT (e->prev != NULL);
+
+	if (e->prev->child == e)
+		e->prev->child = e->next;
+	else
+		e->prev->next = e->next;
+	if (e->next != NULL)
+		e->next->prev = e->prev;
+	e->next = e->prev = NULL;
+}
+
+/* Initializes HEAP as an empty heap ordered by LESS given
+   auxiliary data AUX. */
+void
+heap_init (struct heap *heap, heap_less_func *less, void *aux) {
+	ASSERT (heap != NULL);
+	ASSERT (less != NULL);
+
+	heap->root = NULL;
+	heap->elem_cnt = 0;
+	heap->less = less;
+	heap->aux = aux;
+}
+
+/* Returns the number of elements in HEAP. */
+size_t
+heap_size (const struct heap *heap) {
+	return heap->elem_cnt;
+}
+
+/* Returns true if HEAP is empty, false otherwise. */
+bool
+heap_empty (const struct heap *heap) {
+	return heap->root == NULL;
+}
+
+/* Returns a greatest element in HEAP, or a null pointer if HEAP
+   is empty. */
+struct heap_elem *
+heap_top (const struct heap *heap) {
+	return heap->root;
+}
+
+/* Inserts E into HEAP. */
+void
+heap_push (struct heap *heap, struct heap_elem *e) {
+	ASSERT (heap != NULL);
+	ASSERT (e != NULL);
+
+	e->child = e->next = e->prev = NULL;
+	heap->root = meld (heap, heap->root, e);
+	heap->elem_cnt++;
+}
+
+/* Removes and returns a greatest element of HEAP, which must not
+   be empty. */
+struct heap_elem *
+heap_pop (struct heap *heap) {
+	struct heap_elem *top = heap->root;
+
+	ASSERT (top != NULL);
+	heap_remove (heap, top);
+	return top;
+}
+
+/* Removes E, which must be in HEAP, from HEAP. */
+void
+heap_remove (struct heap *heap, struct heap_elem *e) {
+	struct heap_elem *children;
+
+	ASSERT (heap != NULL);
+	ASSERT (e != NULL);
+	ASSERT (heap->elem_cnt > 0);
+
+	children = merge_pairs (heap, e->child);
+	e->child = NULL;
+	if (e == heap->root)
+		heap->root = children;
+	else {
+		cut (e);
+		heap->root = meld (heap, heap->root, children);
+	}
+	heap->elem_cnt--;
+}
+
+/* Restores heap order after the value of E, which must be in
+   HEAP, has changed in either direction. */
+void
+heap_update (struct heap *heap, struct heap_elem *e) {
+	heap_remove (heap, e);
+	heap_push (heap, e);
+}
+
+/* Restores heap order after the value of E, which must be in
+   HEAP, has increased or stayed the same.  Cheaper than
+   heap_update(), which allows for either direction. */
+void
+heap_increase (struct heap *heap, struct heap_elem *e) {
+	ASSERT (heap != NULL);
+	ASSERT (e != NULL);
+
+	if (e != heap->root) {
+		cut (e);
+		heap->root = meld (heap, heap->root, e);
+	}
+}
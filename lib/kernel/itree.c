@@ -0,0 +1,134 @@
+#include "itree.h"
+#include "../debug.h"
+
+/* See itree.h for basic information.  The search and iteration
+   follow the classic augmented-tree algorithm: a subtree whose
+   greatest end is not past START holds nothing of interest, and
+   once a node starts at or past END, neither it nor anything to
+   its right does. */
+
+#define node_of(RB) rb_entry (RB, struct itree_node, rb)
+
+/* Orders intervals by start, then by address, so that equal
+   intervals can coexist in the tree. */
+static bool
+itree_less (const struct rb_node *a_, const struct rb_node *b_,
+		void *aux UNUSED) {
+	const struct itree_node *a = node_of (a_);
+	const struct itree_node *b = node_of (b_);
+
+	if (a->start != b->start)
+		return a->start < b->start;
+	return a < b;
+}
+
+/* Recomputes the greatest end in N's subtree. */
+static void
+itree_augment (struct rb_node *n, void *aux UNUSED) {
+	struct itree_node *node = node_of (n);
+	uint64_t max = node->end;
+
+	if (n->left != NULL && node_of (n->left)->max_end > max)
+		max = node_of (n->left)->max_end;
+	if (n->right != NULL && node_of (n->right)->max_end > max)
+		max = node_of (n->right)->max_end;
+	node->max_end = max;
+}
+
+/* Initializes T as an empty interval tree. */
+void
+itree_init (struct itree *t) {
+	rb_init_augmented (&t->tree, itree_less, itree_augment, NULL);
+}
+
+/* Returns the number of intervals in T. */
+size_t
+itree_size (const struct itree *t) {
+	return rb_size (&t->tree);
+}
+
+/* Returns true if T holds no intervals. */
+bool
+itree_empty (const struct itree *t) {
+	return rb_empty (&t->tree);
+}
+
+/* Inserts N into T as the interval [START, END), which must not
+   be empty. */
+void
+itree_insert (struct itree *t, struct itree_node *n,
+		uint64_t start, uint64_t end) {
+	ASSERT (start < end);
+
+	n->start = start;
+	n->end = end;
+	n->max_end = end;
+	rb_insert (&t->tree, &n->rb);
+}
+
+/* Removes N, which must be in T, from T. */
+void
+itree_remove (struct itree *t, struct itree_node *n) {
+	rb_remove (&t->tree, &n->rb);
+}
+
+/* Returns the leftmost interval in the subtree rooted at N that
+   overlaps [START, END), or a null pointer if there is none. */
+static struct itree_node *
+subtree_first (struct rb_node *n, uint64_t start, uint64_t end) {
+	while (n != NULL) {
+		struct itree_node *node = node_of (n);
+
+		if (n->left != NULL && node_of (n->left)->max_end > start) {
+			n = n->left;
+			continue;
+		}
+		if (node->start >= end)
+			break;
+		if (node->end > start)
+			return node;
+		n = n->right;
+		if (n == NULL || node_of (n)->max_end <= start)
+			break;
+	}
+	return NULL;
+}
+
+/* Returns the interval in T with the least start, among those
+   overlapping [START, END), or a null pointer if none does. */
+struct itree_node *
+itree_first (struct itree *t, uint64_t start, uint64_t end) {
+	ASSERT (start < end);
+
+	if (t->tree.root == NULL || node_of (t->tree.root)->max_end <= start)
+		return NULL;
+	return subtree_first (t->tree.root, start, end);
+}
+
+/* Returns the interval after N, in the order of itree_first(),
+   that overlaps [START, END), or a null pointer if there is none.
+   N must have been returned by itree_first() or itree_next() for
+   the same range. */
+struct itree_node *
+itree_next (struct itree_node *n, uint64_t start, uint64_t end) {
+	for (;;) {
+		struct rb_node *rb = n->rb.right, *prev;
+
+		if (rb != NULL && node_of (rb)->max_end > start)
+			return subtree_first (rb, start, end);
+
+		/* Go up to the first ancestor that N is to the left of. */
+		do {
+			prev = &n->rb;
+			rb = n->rb.parent;
+			if (rb == NULL)
+				return NULL;
+			n = node_of (rb);
+		} while (rb->right == prev);
+
+		if (n->start >= end)
+			return NULL;
+		if (n->end > start)
+			return n;
+	}
+}
@@ -0,0 +1,60 @@
+#include "lfstack.h"
+#include "../debug.h"
+#include "threads/atomic.h"
+
+/* Initializes STACK as an empty stack. */
+void
+lfstack_init (struct lfstack *stack) {
+	ASSERT (stack != NULL);
+	stack->top = NULL;
+}
+
+/* Pushes ELEM onto STACK.  Safe against concurrent pushes and
+   lfstack_pop_all() on any CPU, and in an interrupt handler.  The
+   release ordering of the exchange makes ELEM, and everything the
+   caller wrote to its structure before now, visible to whoever
+   pops it. */
+void
+lfstack_push (struct lfstack *stack, struct lfstack_elem *elem) {
+	struct lfstack_elem *top = atomic_load (&stack->top);
+
+	ASSERT (elem != NULL);
+	do
+		elem->next = top;
+	while (!atomic_cmpxchg (&stack->top, &top, elem));
+}
+
+/* Removes every element from STACK and returns the newest, linked
+   through `next' to the older ones down to a null pointer, or
+   returns a null pointer if STACK was empty. */
+struct lfstack_elem *
+lfstack_pop_all (struct lfstack *stack) {
+	if (atomic_load (&stack->top) == NULL)
+		return NULL;
+	return atomic_xchg (&stack->top, NULL);
+}
+
+/* Reverses the detached chain of elements starting at FIRST, as
+   returned by lfstack_pop_all(), into push order, oldest first.
+   Returns the new first element. */
+struct lfstack_elem *
+lfstack_reverse (struct lfstack_elem *first) {
+	struct lfstack_elem *fifo = NULL;
+
+	while (first != NULL) {
+		struct lfstack_elem *next = first->next;
+
+		first->next = fifo;
+		fifo = first;
+		first = next;
+	}
+	return fifo;
+}
+
+/* Returns true if STACK was empty when looked at.  Another CPU may
+   push at any time, so this is only a hint unless the caller knows
+   better. */
+bool
+lfstack_empty (const struct lfstack *stack) {
+	return atomic_load (&stack->top) == NULL;
+}
@@ -1,4 +1,5 @@
 #include "list.h"
+#include <limits.h>
 #include "../debug.h"
 
 /* Our doubly linked lists have two header elements: the "head"
@@ -330,84 +331,87 @@ is_sorted (struct list_elem *a, struct list_elem *b,
 	return true;
 }
 
-/* Finds a run, starting at A and ending not after B, of list
-   elements that are in nondecreasing order according to LESS
-   given auxiliary data AUX.  Returns the (exclusive) end of the
-   run.
-   A through B (exclusive) must form a non-empty range. */
+/* Merges the null-terminated chains A and B, linked through
+   their `next' pointers and each sorted according to LESS given
+   auxiliary data AUX, into a single sorted chain and returns it.
+   Every element of A must have come before every element of B in
+   the original list; ties are resolved in favor of A, which keeps
+   the sort stable.  The `prev' pointers are left stale. */
 static struct list_elem *
-find_end_of_run (struct list_elem *a, struct list_elem *b,
+merge (struct list_elem *a, struct list_elem *b,
 		list_less_func *less, void *aux) {
-	ASSERT (a != NULL);
-	ASSERT (b != NULL);
-	ASSERT (less != NULL);
-	ASSERT (a != b);
-
-	do {
-		a = list_next (a);
-	} while (a != b && !less (a, list_prev (a), aux));
-	return a;
-}
-
-/* Merges A0 through A1B0 (exclusive) with A1B0 through B1
-   (exclusive) to form a combined range also ending at B1
-   (exclusive).  Both input ranges must be nonempty and sorted in
-   nondecreasing order according to LESS given auxiliary data
-   AUX.  The output range will be sorted the same way. */
-static void
-inplace_merge (struct list_elem *a0, struct list_elem *a1b0,
-		struct list_elem *b1,
-		list_less_func *less, void *aux) {
-	ASSERT (a0 != NULL);
-	ASSERT (a1b0 != NULL);
-	ASSERT (b1 != NULL);
-	ASSERT (less != NULL);
-	ASSERT (is_sorted (a0, a1b0, less, aux));
-	ASSERT (is_sorted (a1b0, b1, less, aux));
-
-	while (a0 != a1b0 && a1b0 != b1)
-		if (!less (a1b0, a0, aux))
-			a0 = list_next (a0);
-		else {
-			a1b0 = list_next (a1b0);
-			list_splice (a0, list_prev (a1b0), a1b0);
+	struct list_elem *head = NULL;
+	struct list_elem **tail = &head;
+
+	while (a != NULL && b != NULL) {
+		if (less (b, a, aux)) {
+			*tail = b;
+			b = b->next;
+		} else {
+			*tail = a;
+			a = a->next;
 		}
+		tail = &(*tail)->next;
+	}
+	*tail = a != NULL ? a : b;
+	return head;
 }
 
 /* Sorts LIST according to LESS given auxiliary data AUX, using a
-   natural iterative merge sort that runs in O(n lg n) time and
-   O(1) space in the number of elements in LIST. */
+   bottom-up merge sort that runs in O(n lg n) time in the number
+   of elements in LIST.  The sort is stable.
+
+   The elements are taken off the list one at a time and fed into
+   an array of pending sublists, BINS, whose slot I is either
+   empty or holds a sorted sublist of exactly 2**I elements.
+   Adding an element works like incrementing a binary counter:
+   it merges with the sublists in slots 0, 1, ... until it reaches
+   an empty slot.  So each element is visited once on the way in
+   and once per merge it takes part in, with no passes over the
+   list to find runs. */
 void
 list_sort (struct list *list, list_less_func *less, void *aux) {
-	size_t output_run_cnt;        /* Number of runs output in current pass. */
+	struct list_elem *bins[sizeof (size_t) * CHAR_BIT];
+	struct list_elem *e, *next, *sorted;
+	size_t bin_cnt = 0;
+	size_t i;
 
 	ASSERT (list != NULL);
 	ASSERT (less != NULL);
 
-	/* Pass over the list repeatedly, merging adjacent runs of
-	   nondecreasing elements, until only one run is left. */
-	do {
-		struct list_elem *a0;     /* Start of first run. */
-		struct list_elem *a1b0;   /* End of first run, start of second. */
-		struct list_elem *b1;     /* End of second run. */
-
-		output_run_cnt = 0;
-		for (a0 = list_begin (list); a0 != list_end (list); a0 = b1) {
-			/* Each iteration produces one output run. */
-			output_run_cnt++;
-
-			/* Locate two adjacent runs of nondecreasing elements
-			   A0...A1B0 and A1B0...B1. */
-			a1b0 = find_end_of_run (a0, list_end (list), less, aux);
-			if (a1b0 == list_end (list))
-				break;
-			b1 = find_end_of_run (a1b0, list_end (list), less, aux);
-
-			/* Merge the runs. */
-			inplace_merge (a0, a1b0, b1, less, aux);
+	if (list_empty (list) || list_begin (list) == list_rbegin (list))
+		return;
+
+	/* Feed each element into the bins. */
+	list->tail.prev->next = NULL;
+	for (e = list_begin (list); e != NULL; e = next) {
+		struct list_elem *carry = e;
+
+		next = e->next;
+		e->next = NULL;
+		for (i = 0; i < bin_cnt && bins[i] != NULL; i++) {
+			carry = merge (bins[i], carry, less, aux);
+			bins[i] = NULL;
 		}
+		if (i == bin_cnt)
+			bin_cnt++;
+		bins[i] = carry;
 	}
-	while (output_run_cnt > 1);
+
+	/* Merge the bins together.  Higher bins hold earlier
+	   elements. */
+	sorted = NULL;
+	for (i = 0; i < bin_cnt; i++)
+		if (bins[i] != NULL)
+			sorted = merge (bins[i], sorted, less, aux);
+
+	/* Rebuild the `prev' links and the list's ends. */
+	list->head.next = sorted;
+	sorted->prev = &list->head;
+	for (e = sorted; e->next != NULL; e = e->next)
+		e->next->prev = e;
+	e->next = &list->tail;
+	list->tail.prev = e;
 
 	ASSERT (is_sorted (list_begin (list), list_end (list), less, aux));
 }
@@ -430,6 +434,26 @@ list_insert_ordered (struct list *list, struct list_elem *elem,
 	return list_insert (e, elem);
 }
 
+/* Inserts ELEM in the same position in LIST as
+   list_insert_ordered(), that is, after any elements equal to
+   it, but searches from the back of LIST.  Takes O(1) time when
+   ELEM belongs at or near the back, as it does for queues whose
+   elements mostly arrive in order, such as queues of deadlines. */
+void
+list_insert_ordered_back (struct list *list, struct list_elem *elem,
+		list_less_func *less, void *aux) {
+	struct list_elem *e;
+
+	ASSERT (list != NULL);
+	ASSERT (elem != NULL);
+	ASSERT (less != NULL);
+
+	for (e = list_rbegin (list); e != list_rend (list); e = list_prev (e))
+		if (!less (elem, e, aux))
+			break;
+	return list_insert (list_next (e), elem);
+}
+
 /* Iterates through LIST and removes all but the first in each
    set of adjacent elements that are equal according to LESS
    given auxiliary data AUX.  If DUPLICATES is non-null, then the
@@ -0,0 +1,72 @@
+#include "mpscq.h"
+#include "../debug.h"
+#include "threads/atomic.h"
+
+/* Initializes Q as an empty queue, holding only its stub. */
+void
+mpscq_init (struct mpscq *q) {
+	ASSERT (q != NULL);
+	q->stub.next = NULL;
+	q->head = q->tail = &q->stub;
+}
+
+/* Appends ELEM to Q.  Safe against concurrent pushes on any CPU,
+   in an interrupt handler, and against the consumer.  The release
+   store makes ELEM, and everything the caller wrote to its
+   structure before now, visible to the consumer that pops it. */
+void
+mpscq_push (struct mpscq *q, struct mpscq_elem *elem) {
+	struct mpscq_elem *prev;
+
+	ASSERT (elem != NULL);
+	elem->next = NULL;
+	prev = atomic_xchg (&q->head, elem);
+	/* Until this store, the consumer sees the queue end at PREV. */
+	atomic_store_release (&prev->next, elem);
+}
+
+/* Removes and returns the oldest element in Q, or returns a null
+   pointer if Q is empty or its oldest element is still being
+   pushed.  For the consumer only. */
+struct mpscq_elem *
+mpscq_pop (struct mpscq *q) {
+	struct mpscq_elem *tail = q->tail;
+	struct mpscq_elem *next = atomic_load_acquire (&tail->next);
+
+	/* Step over the stub. */
+	if (tail == &q->stub) {
+		if (next == NULL)
+			return NULL;
+		q->tail = tail = next;
+		next = atomic_load_acquire (&tail->next);
+	}
+	if (next != NULL) {
+		q->tail = next;
+		return tail;
+	}
+
+	/* TAIL is the last element linked in.  If it is not the newest
+	   either, a push is half done, so come back later. */
+	if (tail != atomic_load_acquire (&q->head))
+		return NULL;
+
+	/* Put the stub behind TAIL, so that TAIL can go. */
+	mpscq_push (q, &q->stub);
+	next = atomic_load_acquire (&tail->next);
+	if (next != NULL) {
+		q->tail = next;
+		return tail;
+	}
+	return NULL;
+}
+
+/* Returns true if Q holds no elements, or none that a pop could
+   return yet.  For the consumer only. */
+bool
+mpscq_empty (const struct mpscq *q) {
+	const struct mpscq_elem *tail = q->tail;
+	const struct mpscq_elem *next = atomic_load_acquire (&tail->next);
+
+	return next == NULL && (tail == &q->stub
+			|| tail != atomic_load_acquire (&q->head));
+}
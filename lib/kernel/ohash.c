@@ -0,0 +1,250 @@
+/* Open-addressing hash table.
+
+   See ohash.h for basic information. */
+
+#include "ohash.h"
+#include "../debug.h"
+#include "threads/malloc.h"
+
+/* Fewest slots a table has. */
+#define MIN_SLOTS 8
+
+/* Grow when more than MAX_LOAD_NUM / MAX_LOAD_DEN of the slots are
+   in use; shrink, down to the initial size, below 1 / SHRINK_DEN. */
+#define MAX_LOAD_NUM 3
+#define MAX_LOAD_DEN 4
+#define SHRINK_DEN 8
+
+/* Returns the home slot of KEY in H.  Fibonacci hashing: the top
+   bits of the product depend on every bit of KEY, so keys that
+   differ only in their high bits, such as page addresses, still
+   spread out. */
+static inline size_t
+home_slot (const struct ohash *h, uint64_t key) {
+	return (key * 0x9e3779b97f4a7c15ULL) >> h->shift;
+}
+
+/* Returns how far slot IDX of H, which holds KEY, is from KEY's
+   home slot. */
+static inline size_t
+probe_dist (const struct ohash *h, uint64_t key, size_t idx) {
+	return (idx - home_slot (h, key)) & (h->slot_cnt - 1);
+}
+
+/* Returns log2 (X), for X a power of 2. */
+static int
+log2_exact (size_t x) {
+	int n = 0;
+
+	ASSERT (x != 0 && (x & (x - 1)) == 0);
+	while (x >>= 1)
+		n++;
+	return n;
+}
+
+/* Returns the number of slots to use for ELEM_CNT elements: a
+   power of 2, no fewer than MIN_SLOTS, keeping the load at or
+   under the maximum. */
+static size_t
+slot_cnt_for (size_t elem_cnt) {
+	size_t cnt = MIN_SLOTS;
+
+	while (cnt * MAX_LOAD_NUM / MAX_LOAD_DEN < elem_cnt)
+		cnt *= 2;
+	return cnt;
+}
+
+/* Stores KEY and VALUE, which must not be in H, in H's slots,
+   which must have one free.  Robin Hood insertion: the element
+   being placed swaps with any it meets that is closer to home. */
+static void
+place (struct ohash *h, uint64_t key, void *value) {
+	size_t mask = h->slot_cnt - 1;
+	size_t idx = home_slot (h, key);
+	size_t dist = 0;
+
+	for (;;) {
+		struct ohash_slot *s = &h->slots[idx];
+		size_t s_dist;
+
+		if (s->value == NULL) {
+			s->key = key;
+			s->value = value;
+			return;
+		}
+		s_dist = probe_dist (h, s->key, idx);
+		if (s_dist < dist) {
+			struct ohash_slot tmp = *s;
+
+			s->key = key;
+			s->value = value;
+			key = tmp.key;
+			value = tmp.value;
+			dist = s_dist;
+		}
+		idx = (idx + 1) & mask;
+		dist++;
+	}
+}
+
+/* Moves the elements of H into a new array of SLOT_CNT slots.
+   Returns false, leaving H as it was, if memory is short. */
+static bool
+resize (struct ohash *h, size_t slot_cnt) {
+	struct ohash_slot *old = h->slots;
+	size_t old_cnt = h->slot_cnt;
+	struct ohash_slot *slots;
+	size_t i;
+
+	slots = calloc (slot_cnt, sizeof *slots);
+	if (slots == NULL)
+		return false;
+
+	h->slots = slots;
+	h->slot_cnt = slot_cnt;
+	h->shift = 64 - log2_exact (slot_cnt);
+	for (i = 0; i < old_cnt; i++)
+		if (old[i].value != NULL)
+			place (h, old[i].key, old[i].value);
+	free (old);
+	return true;
+}
+
+/* Returns the index of the slot of H that holds KEY, or
+   SIZE_MAX if KEY is not in H. */
+static size_t
+find_slot (const struct ohash *h, uint64_t key) {
+	size_t mask = h->slot_cnt - 1;
+	size_t idx = home_slot (h, key);
+	size_t dist;
+
+	for (dist = 0; ; dist++, idx = (idx + 1) & mask) {
+		const struct ohash_slot *s = &h->slots[idx];
+
+		/* An element closer to home would have been passed over
+		   by KEY's insertion. */
+		if (s->value == NULL || probe_dist (h, s->key, idx) < dist)
+			return SIZE_MAX;
+		if (s->key == key)
+			return idx;
+	}
+}
+
+/* Initializes H as an empty table with room for ELEM_CNT
+   elements before it first grows.  It never shrinks below that.
+   Returns false if memory is short. */
+bool
+ohash_init (struct ohash *h, size_t elem_cnt) {
+	h->elem_cnt = 0;
+	h->slot_cnt = 0;
+	h->slots = NULL;
+	if (!resize (h, slot_cnt_for (elem_cnt)))
+		return false;
+	h->min_slot_cnt = h->slot_cnt;
+	return true;
+}
+
+/* Removes all the elements from H. */
+void
+ohash_clear (struct ohash *h) {
+	size_t i;
+
+	for (i = 0; i < h->slot_cnt; i++)
+		h->slots[i].value = NULL;
+	h->elem_cnt = 0;
+}
+
+/* Destroys H.  The elements are the caller's to free. */
+void
+ohash_destroy (struct ohash *h) {
+	free (h->slots);
+	h->slots = NULL;
+	h->slot_cnt = h->elem_cnt = 0;
+}
+
+/* Returns the value stored under KEY in H, or a null pointer if
+   there is none. */
+void *
+ohash_find (const struct ohash *h, uint64_t key) {
+	size_t idx;
+
+	if (h->elem_cnt == 0)
+		return NULL;
+	idx = find_slot (h, key);
+	return idx != SIZE_MAX ? h->slots[idx].value : NULL;
+}
+
+/* Stores non-null VALUE under KEY in H.  Returns false, changing
+   nothing, if KEY is already in H or if H is full and memory to
+   grow it is short. */
+bool
+ohash_insert (struct ohash *h, uint64_t key, void *value) {
+	ASSERT (value != NULL);
+
+	if (h->slots == NULL || ohash_find (h, key) != NULL)
+		return false;
+
+	/* Growing is only an optimization until the table is full. */
+	if ((h->elem_cnt + 1) * MAX_LOAD_DEN > h->slot_cnt * MAX_LOAD_NUM
+			&& !resize (h, h->slot_cnt * 2) && h->elem_cnt + 1 >= h->slot_cnt)
+		return false;
+
+	place (h, key, value);
+	h->elem_cnt++;
+	return true;
+}
+
+/* Removes KEY from H and returns the value that was stored under
+   it, or a null pointer if KEY was not in H. */
+void *
+ohash_delete (struct ohash *h, uint64_t key) {
+	size_t mask = h->slot_cnt - 1;
+	size_t idx;
+	void *value;
+
+	if (h->elem_cnt == 0 || (idx = find_slot (h, key)) == SIZE_MAX)
+		return NULL;
+	value = h->slots[idx].value;
+
+	/* Shift the rest of the probe run back into the hole. */
+	for (;;) {
+		size_t next = (idx + 1) & mask;
+		struct ohash_slot *s = &h->slots[next];
+
+		if (s->value == NULL || probe_dist (h, s->key, next) == 0)
+			break;
+		h->slots[idx] = *s;
+		idx = next;
+	}
+	h->slots[idx].value = NULL;
+	h->elem_cnt--;
+
+	/* Shrinking can fail harmlessly. */
+	if (h->slot_cnt > h->min_slot_cnt
+			&& h->elem_cnt * SHRINK_DEN < h->slot_cnt)
+		resize (h, h->slot_cnt / 2);
+	return value;
+}
+
+/* Calls ACTION for each element in H in arbitrary order, with
+   auxiliary data AUX.  ACTION must not modify H. */
+void
+ohash_apply (struct ohash *h, ohash_action_func *action, void *aux) {
+	size_t i;
+
+	for (i = 0; i < h->slot_cnt; i++)
+		if (h->slots[i].value != NULL)
+			action (h->slots[i].key, h->slots[i].value, aux);
+}
+
+/* Returns the number of elements in H. */
+size_t
+ohash_size (const struct ohash *h) {
+	return h->elem_cnt;
+}
+
+/* Returns true if H contains no elements, false otherwise. */
+bool
+ohash_empty (const struct ohash *h) {
+	return h->elem_cnt == 0;
+}
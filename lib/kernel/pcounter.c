@@ -0,0 +1,33 @@
+#include "pcounter.h"
+#include "../debug.h"
+#include "threads/atomic.h"
+
+/* Initializes C to zero. */
+void
+pcounter_init (struct pcounter *c) {
+	int i;
+
+	ASSERT (c != NULL);
+	for (i = 0; i < CPU_MAX; i++)
+		c->cpu[i].value = 0;
+}
+
+/* Adds DELTA to C, in the running CPU's share.  The add is atomic,
+   so being moved to another CPU between finding the share and
+   adding to it loses nothing; it only puts DELTA in the old CPU's
+   line, which is still uncontended almost always. */
+void
+pcounter_add (struct pcounter *c, int64_t delta) {
+	atomic_add (&c->cpu[cpu_current ()->id].value, delta);
+}
+
+/* Returns the sum of C's shares. */
+int64_t
+pcounter_read (const struct pcounter *c) {
+	int64_t sum = 0;
+	int i;
+
+	for (i = 0; i < CPU_MAX; i++)
+		sum += atomic_load (&c->cpu[i].value);
+	return sum;
+}
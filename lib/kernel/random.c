@@ -0,0 +1,146 @@
+#include "../random.h"
+#include <intrinsic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "threads/thread.h"
+
+/* The kernel's random numbers.
+
+   User programs get lib/random.c, whose RC4 stream tests/random.pm
+   reproduces to check their output.  The kernel needs no such
+   agreement, but does need numbers from many threads at once, and
+   one global RC4 state, stirred a byte at a time without a lock,
+   serves that poorly.  Here instead each thread has a generator of
+   its own in its struct thread: xoshiro256** (Blackman and Vigna),
+   which makes 64 bits from four words of state with a few shifts,
+   rotates and adds, needing no lock since no other thread touches
+   it.
+
+   A thread's state is made on first use from the boot seed and its
+   tid, through splitmix64, so that no two threads' streams start
+   alike.  The boot seed comes from RDSEED or RDRAND if the CPU has
+   one, else from the time stamp counter, unless the -rs option
+   fixed it with random_init(). */
+
+static uint64_t boot_seed;
+static bool boot_seeded;
+
+/* splitmix64: returns the next output of the generator whose state
+   is *X. */
+static uint64_t
+splitmix64 (uint64_t *x) {
+	uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+/* Returns a seed from the CPU's random number generator, or from
+   the time stamp counter if it has none. */
+static uint64_t
+hw_seed (void) {
+	uint32_t regs[4];
+	uint64_t seed;
+	bool ok;
+	int tries;
+
+	cpuid (0, 0, regs);
+	if (regs[0] >= 7) {
+		cpuid (7, 0, regs);
+		if (regs[1] & (1u << 18))                   /* RDSEED. */
+			for (tries = 0; tries < 10; tries++) {
+				asm volatile ("rdseed %0; setc %1" : "=r" (seed), "=qm" (ok));
+				if (ok)
+					return seed;
+			}
+	}
+	cpuid (1, 0, regs);
+	if (regs[2] & (1u << 30))                       /* RDRAND. */
+		for (tries = 0; tries < 10; tries++) {
+			asm volatile ("rdrand %0; setc %1" : "=r" (seed), "=qm" (ok));
+			if (ok)
+				return seed;
+		}
+	return rdtsc ();
+}
+
+/* Fills S from SEED. */
+static void
+seed_state (uint64_t s[4], uint64_t seed) {
+	int i;
+
+	for (i = 0; i < 4; i++)
+		s[i] = splitmix64 (&seed);
+}
+
+/* Returns the running thread's generator state, made if need be. */
+static uint64_t *
+state (void) {
+	struct thread *t = thread_current ();
+
+	if ((t->rng[0] | t->rng[1] | t->rng[2] | t->rng[3]) == 0) {
+		if (!boot_seeded) {
+			boot_seed = hw_seed ();
+			boot_seeded = true;
+		}
+		seed_state (t->rng, boot_seed ^ ((uint64_t) t->tid << 32));
+	}
+	return t->rng;
+}
+
+static inline uint64_t
+rotl (uint64_t x, int k) {
+	return (x << k) | (x >> (64 - k));
+}
+
+/* xoshiro256**: returns the next output of S. */
+static uint64_t
+next (uint64_t s[4]) {
+	uint64_t result = rotl (s[1] * 5, 7) * 9;
+	uint64_t t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl (s[3], 45);
+	return result;
+}
+
+/* Sets the boot seed to SEED, so that threads' streams repeat from
+   one run to the next.  Called while parsing the command line,
+   before there are threads; a stream already started goes on. */
+void
+random_init (unsigned seed) {
+	boot_seed = seed;
+	boot_seeded = true;
+}
+
+/* Writes SIZE random bytes into BUF, eight at a time. */
+void
+random_bytes (void *buf_, size_t size) {
+	uint64_t *s = state ();
+	uint8_t *buf = buf_;
+
+	for (; size >= 8; size -= 8, buf += 8) {
+		uint64_t x = next (s);
+
+		memcpy (buf, &x, 8);
+	}
+	if (size > 0) {
+		uint64_t x = next (s);
+
+		memcpy (buf, &x, size);
+	}
+}
+
+/* Returns a pseudo-random unsigned long.
+   Use random_ulong() % n to obtain a random number in the range
+   0...n (exclusive). */
+unsigned long
+random_ulong (void) {
+	return next (state ());
+}
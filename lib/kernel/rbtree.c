@@ -0,0 +1,378 @@
+#include "rbtree.h"
+#include "../debug.h"
+
+/* A red-black tree is a binary search tree whose nodes are
+   colored so that the root is black, no red node has a red
+   child, and every path from a node down to a null leaf passes
+   through the same number of black nodes.  Together these keep
+   the longest path within twice the shortest, so the height stays
+   O(log n).  Insertion and removal restore the coloring with at
+   most three rotations, plus recoloring along the path to the
+   root.  Null children count as black leaves. */
+
+/* Recomputes the subtree data of N, if TREE keeps any. */
+static inline void
+augment (struct rb_tree *tree, struct rb_node *n) {
+	if (tree->augment != NULL)
+		tree->augment (n, tree->aux);
+}
+
+/* Recomputes the subtree data of N and each of its ancestors,
+   if TREE keeps any. */
+static void
+augment_path (struct rb_tree *tree, struct rb_node *n) {
+	if (tree->augment != NULL)
+		for (; n != NULL; n = n->parent)
+			tree->augment (n, tree->aux);
+}
+
+/* Returns true if node N is red.  N may be null. */
+static inline bool
+is_red (const struct rb_node *n) {
+	return n != NULL && n->red;
+}
+
+/* Makes NEW take OLD's place as the child of PARENT, or as the
+   root of TREE if PARENT is null. */
+static void
+replace_child (struct rb_tree *tree, struct rb_node *parent,
+		struct rb_node *old, struct rb_node *new) {
+	if (parent == NULL)
+		tree->root = new;
+	else if (parent->left == old)
+		parent->left = new;
+	else
+		parent->right = new;
+}
+
+/* Rotates X's right child up into X's place. */
+static void
+rotate_left (struct rb_tree *tree, struct rb_node *x) {
+	struct rb_node *y = x->right;
+
+	x->right = y->left;
+	if (y->left != NULL)
+		y->left->parent = x;
+	y->parent = x->parent;
+	replace_child (tree, x->parent, x, y);
+	y->left = x;
+	x->parent = y;
+	augment (tree, x);
+	augment (tree, y);
+}
+
+/* Rotates X's left child up into X's place. */
+static void
+rotate_right (struct rb_tree *tree, struct rb_node *x) {
+	struct rb_node *y = x->left;
+
+	x->left = y->right;
+	if (y->right != NULL)
+		y->right->parent = x;
+	y->parent = x->parent;
+	replace_child (tree, x->parent, x, y);
+	y->right = x;
+	x->parent = y;
+	augment (tree, x);
+	augment (tree, y);
+}
+
+/* Restores the coloring after red node N has been linked in as
+   a leaf. */
+static void
+insert_fixup (struct rb_tree *tree, struct rb_node *n) {
+	struct rb_node *p;
+
+	while ((p = n->parent) != NULL && p->red) {
+		/* P is red, so it is not the root and G exists. */
+		struct rb_node *g = p->parent;
+
+		if (p == g->left) {
+			struct rb_node *u = g->right;
+
+			if (is_red (u)) {
+				p->red = u->red = false;
+				g->red = true;
+				n = g;
+				continue;
+			}
+			if (n == p->right) {
+				rotate_left (tree, p);
+				n = p;
+				p = n->parent;
+			}
+			p->red = false;
+			g->red = true;
+			rotate_right (tree, g);
+		} else {
+			struct rb_node *u = g->left;
+
+			if (is_red (u)) {
+				p->red = u->red = false;
+				g->red = true;
+				n = g;
+				continue;
+			}
+			if (n == p->left) {
+				rotate_right (tree, p);
+				n = p;
+				p = n->parent;
+			}
+			p->red = false;
+			g->red = true;
+			rotate_left (tree, g);
+		}
+	}
+	tree->root->red = false;
+}
+
+/* Restores the coloring after a black node has been unlinked.
+   X, which may be null, took its place as a child of PARENT and
+   is one black node short on every path through it. */
+static void
+remove_fixup (struct rb_tree *tree, struct rb_node *x,
+		struct rb_node *parent) {
+	while (x != tree->root && !is_red (x)) {
+		/* X is short a black node, so its sibling W exists. */
+		if (x == parent->left) {
+			struct rb_node *w = parent->right;
+
+			if (w->red) {
+				w->red = false;
+				parent->red = true;
+				rotate_left (tree, parent);
+				w = parent->right;
+			}
+			if (!is_red (w->left) && !is_red (w->right)) {
+				w->red = true;
+				x = parent;
+				parent = x->parent;
+			} else {
+				if (!is_red (w->right)) {
+					w->left->red = false;
+					w->red = true;
+					rotate_right (tree, w);
+					w = parent->right;
+				}
+				w->red = parent->red;
+				parent->red = false;
+				w->right->red = false;
+				rotate_left (tree, parent);
+				x = tree->root;
+			}
+		} else {
+			struct rb_node *w = parent->left;
+
+			if (w->red) {
+				w->red = false;
+				parent->red = true;
+				rotate_right (tree, parent);
+				w = parent->left;
+			}
+			if (!is_red (w->left) && !is_red (w->right)) {
+				w->red = true;
+				x = parent;
+				parent = x->parent;
+			} else {
+				if (!is_red (w->left)) {
+					w->right->red = false;
+					w->red = true;
+					rotate_left (tree, w);
+					w = parent->left;
+				}
+				w->red = parent->red;
+				parent->red = false;
+				w->left->red = false;
+				rotate_right (tree, parent);
+				x = tree->root;
+			}
+		}
+	}
+	if (x != NULL)
+		x->red = false;
+}
+
+/* Initializes TREE as an empty tree ordered by LESS given
+   auxiliary data AUX. */
+void
+rb_init (struct rb_tree *tree, rb_less_func *less, void *aux) {
+	rb_init_augmented (tree, less, NULL, aux);
+}
+
+/* Initializes TREE as an empty tree ordered by LESS whose nodes
+   cache data about their subtrees, kept up to date by AUGMENT,
+   given auxiliary data AUX. */
+void
+rb_init_augmented (struct rb_tree *tree, rb_less_func *less,
+		rb_augment_func *augment, void *aux) {
+	ASSERT (tree != NULL);
+	ASSERT (less != NULL);
+
+	tree->root = NULL;
+	tree->node_cnt = 0;
+	tree->less = less;
+	tree->augment = augment;
+	tree->aux = aux;
+}
+
+/* Returns the number of nodes in TREE. */
+size_t
+rb_size (const struct rb_tree *tree) {
+	return tree->node_cnt;
+}
+
+/* Returns true if TREE is empty, false otherwise. */
+bool
+rb_empty (const struct rb_tree *tree) {
+	return tree->root == NULL;
+}
+
+/* Inserts N into TREE, if no equal node is already present, and
+   returns a null pointer.  If an equal node is already in TREE,
+   returns it without inserting N. */
+struct rb_node *
+rb_insert (struct rb_tree *tree, struct rb_node *n) {
+	struct rb_node **link = &tree->root;
+	struct rb_node *parent = NULL;
+
+	ASSERT (tree != NULL);
+	ASSERT (n != NULL);
+
+	while (*link != NULL) {
+		parent = *link;
+		if (tree->less (n, parent, tree->aux))
+			link = &parent->left;
+		else if (tree->less (parent, n, tree->aux))
+			link = &parent->right;
+		else
+			return parent;
+	}
+
+	n->parent = parent;
+	n->left = n->right = NULL;
+	n->red = true;
+	*link = n;
+	tree->node_cnt++;
+	augment_path (tree, n);
+	insert_fixup (tree, n);
+	return NULL;
+}
+
+/* Removes N, which must be in TREE, from TREE. */
+void
+rb_remove (struct rb_tree *tree, struct rb_node *n) {
+	struct rb_node *child, *parent;
+	bool removed_red;
+
+	ASSERT (tree != NULL);
+	ASSERT (n != NULL);
+	ASSERT (tree->node_cnt > 0);
+
+	if (n->left == NULL || n->right == NULL) {
+		/* Splice N out, moving its only child (if any) up. */
+		child = n->left != NULL ? n->left : n->right;
+		parent = n->parent;
+		removed_red = n->red;
+		if (child != NULL)
+			child->parent = parent;
+		replace_child (tree, parent, n, child);
+	} else {
+		/* Move N's successor S, which has no left child, into N's
+		   place, taking on N's color.  The node effectively
+		   removed is S, from its old position. */
+		struct rb_node *s = n->right;
+
+		while (s->left != NULL)
+			s = s->left;
+		child = s->right;
+		removed_red = s->red;
+		if (s->parent == n)
+			parent = s;
+		else {
+			parent = s->parent;
+			parent->left = child;
+			if (child != NULL)
+				child->parent = parent;
+			s->right = n->right;
+			s->right->parent = s;
+		}
+		s->left = n->left;
+		s->left->parent = s;
+		s->parent = n->parent;
+		replace_child (tree, n->parent, n, s);
+		s->red = n->red;
+	}
+
+	/* Every node whose subtree lost a node lies on the path up
+	   from PARENT, including S if it moved. */
+	augment_path (tree, parent);
+	if (!removed_red)
+		remove_fixup (tree, child, parent);
+	tree->node_cnt--;
+}
+
+/* Returns the greatest node in TREE that is not greater than
+   KEY, or a null pointer if every node is greater.  KEY need
+   not be in TREE; only the fields that the comparison function
+   reads need to be set. */
+struct rb_node *
+rb_floor (const struct rb_tree *tree, const struct rb_node *key) {
+	struct rb_node *n = tree->root;
+	struct rb_node *floor = NULL;
+
+	while (n != NULL) {
+		if (tree->less (key, n, tree->aux))
+			n = n->left;
+		else {
+			floor = n;
+			n = n->right;
+		}
+	}
+	return floor;
+}
+
+/* Returns the least node in TREE, or a null pointer if TREE is
+   empty. */
+struct rb_node *
+rb_first (const struct rb_tree *tree) {
+	struct rb_node *n = tree->root;
+
+	if (n != NULL)
+		while (n->left != NULL)
+			n = n->left;
+	return n;
+}
+
+/* Returns the node that follows N in its tree, or a null pointer
+   if N is the greatest. */
+struct rb_node *
+rb_next (struct rb_node *n) {
+	ASSERT (n != NULL);
+
+	if (n->right != NULL) {
+		n = n->right;
+		while (n->left != NULL)
+			n = n->left;
+		return n;
+	}
+	while (n->parent != NULL && n == n->parent->right)
+		n = n->parent;
+	return n->parent;
+}
+
+/* Returns the node that precedes N in its tree, or a null
+   pointer if N is the least. */
+struct rb_node *
+rb_prev (struct rb_node *n) {
+	ASSERT (n != NULL);
+
+	if (n->left != NULL) {
+		n = n->left;
+		while (n->right != NULL)
+			n = n->right;
+		return n;
+	}
+	while (n->parent != NULL && n == n->parent->left)
+		n = n->parent;
+	return n->parent;
+}
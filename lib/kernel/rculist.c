@@ -0,0 +1,86 @@
+#include "rculist.h"
+#include "../debug.h"
+
+/* Stores ELEM in *LINK so that a reader that loads *LINK sees ELEM
+   fully initialized: the release store keeps the compiler, and on
+   other machines the processor, from moving the stores that
+   initialized it after this one. */
+static inline void
+publish (struct rculist_elem **link, struct rculist_elem *elem) {
+	__atomic_store_n (link, elem, __ATOMIC_RELEASE);
+}
+
+/* Loads *LINK once, for a reader.  The acquire load orders the
+   reader's loads from the element after it. */
+static inline struct rculist_elem *
+lookup (struct rculist_elem *const *link) {
+	return __atomic_load_n (link, __ATOMIC_ACQUIRE);
+}
+
+/* Initializes LIST as an empty list. */
+void
+rculist_init (struct rculist *list) {
+	ASSERT (list != NULL);
+	list->first = NULL;
+}
+
+/* Returns the first element in LIST, or a null pointer if it is
+   empty.  Safe while a writer changes LIST. */
+struct rculist_elem *
+rculist_first (const struct rculist *list) {
+	ASSERT (list != NULL);
+	return lookup (&list->first);
+}
+
+/* Returns the element after ELEM, or a null pointer if ELEM is the
+   last.  Safe while a writer changes the list, even if ELEM has
+   just been removed from it. */
+struct rculist_elem *
+rculist_next (const struct rculist_elem *elem) {
+	ASSERT (elem != NULL);
+	return lookup (&elem->next);
+}
+
+/* Inserts ELEM at the front of LIST. */
+void
+rculist_push_front (struct rculist *list, struct rculist_elem *elem) {
+	ASSERT (list != NULL && elem != NULL);
+
+	elem->next = list->first;
+	elem->pprev = &list->first;
+	if (list->first != NULL)
+		list->first->pprev = &elem->next;
+	publish (&list->first, elem);
+}
+
+/* Inserts ELEM just after PREV, which must be in a list. */
+void
+rculist_insert_after (struct rculist_elem *prev, struct rculist_elem *elem) {
+	ASSERT (prev != NULL && elem != NULL);
+
+	elem->next = prev->next;
+	elem->pprev = &prev->next;
+	if (prev->next != NULL)
+		prev->next->pprev = &elem->next;
+	publish (&prev->next, elem);
+}
+
+/* Removes ELEM from its list.  ELEM's `next' pointer is left as it
+   was, for readers that have already reached ELEM, so ELEM must not
+   be reused until they are done. */
+void
+rculist_remove (struct rculist_elem *elem) {
+	ASSERT (elem != NULL && elem->pprev != NULL);
+
+	if (elem->next != NULL)
+		elem->next->pprev = elem->pprev;
+	publish (elem->pprev, elem->next);
+	elem->pprev = NULL;
+}
+
+/* Returns true if LIST is empty, false otherwise.  For writers. */
+bool
+rculist_empty (const struct rculist *list) {
+	ASSERT (list != NULL);
+	return list->first == NULL;
+}
@@ -2,4 +2,14 @@ lib/kernel_SRC  = lib/kernel/debug.c	# Debug helpers.
 lib/kernel_SRC += lib/kernel/list.c	# Doubly-linked lists.
 lib/kernel_SRC += lib/kernel/bitmap.c	# Bitmaps.
 lib/kernel_SRC += lib/kernel/hash.c	# Hash tables.
+lib/kernel_SRC += lib/kernel/ohash.c	# Open-addressing hash tables.
+lib/kernel_SRC += lib/kernel/heap.c	# Priority queues.
+lib/kernel_SRC += lib/kernel/rbtree.c	# Balanced search trees.
+lib/kernel_SRC += lib/kernel/itree.c	# Interval trees.
+lib/kernel_SRC += lib/kernel/rculist.c	# Lists for read-copy-update.
+lib/kernel_SRC += lib/kernel/lfstack.c	# Lock-free stacks.
+lib/kernel_SRC += lib/kernel/mpscq.c	# Lock-free queues.
+lib/kernel_SRC += lib/kernel/pcounter.c	# Per-CPU counters.
+lib/kernel_SRC += lib/kernel/crc32c.c	# CRC-32C checksums.
+lib/kernel_SRC += lib/kernel/random.c	# Per-thread random numbers.
 lib/kernel_SRC += lib/kernel/console.c	# printf(), putchar().
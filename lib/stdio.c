@@ -12,7 +12,7 @@ struct vsnprintf_aux {
 	int max_length;     /* Max length of output string. */
 };
 
-static void vsnprintf_helper (char, void *);
+static void vsnprintf_helper (const char *, size_t, void *);
 
 /* Like vprintf(), except that output is stored into BUFFER,
    which must have space for BUF_SIZE characters.  Writes at most
@@ -41,11 +41,17 @@ vsnprintf (char *buffer, size_t buf_size, const char *format, va_list args) {
 
 /* Helper function for vsnprintf(). */
 static void
-vsnprintf_helper (char ch, void *aux_) {
+vsnprintf_helper (const char *buf, size_t n, void *aux_) {
 	struct vsnprintf_aux *aux = aux_;
 
-	if (aux->length++ < aux->max_length)
-		*aux->p++ = ch;
+	if (aux->length < aux->max_length) {
+		size_t room = aux->max_length - aux->length;
+		size_t copy = n < room ? n : room;
+
+		memcpy (aux->p, buf, copy);
+		aux->p += copy;
+	}
+	aux->length += n;
 }
 
 /* Like printf(), except that output is stored into BUFFER,
@@ -129,35 +135,87 @@ static const struct integer_base base_o = {8, "01234567", 0, 3};
 static const struct integer_base base_x = {16, "0123456789abcdef", 'x', 4};
 static const struct integer_base base_X = {16, "0123456789ABCDEF", 'X', 4};
 
+/* Output buffer for __vprintf().  Characters collect in BUF and
+   go to OUTPUT a run at a time, so that the output function is
+   called once per run instead of once per character. */
+struct printf_buffer {
+	char buf[64];               /* Pending characters. */
+	size_t len;                 /* Number of characters in BUF. */
+	void (*output) (const char *, size_t, void *);
+	void *aux;                  /* Auxiliary data for OUTPUT. */
+};
+
 static const char *parse_conversion (const char *format,
 		struct printf_conversion *,
 		va_list *);
 static void format_integer (uintmax_t value, bool is_signed, bool negative,
 		const struct integer_base *,
 		const struct printf_conversion *,
-		void (*output) (char, void *), void *aux);
-static void output_dup (char ch, size_t cnt,
-		void (*output) (char, void *), void *aux);
+		struct printf_buffer *);
+static void output_dup (char ch, size_t cnt, struct printf_buffer *);
 static void format_string (const char *string, int length,
 		struct printf_conversion *,
-		void (*output) (char, void *), void *aux);
+		struct printf_buffer *);
+
+/* Passes the characters pending in PB to its output function. */
+static void
+output_flush (struct printf_buffer *pb) {
+	if (pb->len > 0) {
+		pb->output (pb->buf, pb->len, pb->aux);
+		pb->len = 0;
+	}
+}
+
+/* Writes CH to PB. */
+static inline void
+output_char (char ch, struct printf_buffer *pb) {
+	if (pb->len >= sizeof pb->buf)
+		output_flush (pb);
+	pb->buf[pb->len++] = ch;
+}
 
+/* Writes the N characters in S to PB.  A run too long to fit in
+   PB's buffer goes straight to the output function. */
+static void
+output_bytes (const char *s, size_t n, struct printf_buffer *pb) {
+	if (pb->len + n > sizeof pb->buf) {
+		output_flush (pb);
+		if (n >= sizeof pb->buf) {
+			pb->output (s, n, pb->aux);
+			return;
+		}
+	}
+	memcpy (pb->buf + pb->len, s, n);
+	pb->len += n;
+}
+
+/* Formats FORMAT with ARGS, passing the output a run at a time
+   to OUTPUT along with auxiliary data AUX. */
 void
 __vprintf (const char *format, va_list args,
-		void (*output) (char, void *), void *aux) {
+		void (*output) (const char *, size_t, void *), void *aux) {
+	struct printf_buffer pb;
+
+	pb.len = 0;
+	pb.output = output;
+	pb.aux = aux;
 	for (; *format != '\0'; format++) {
 		struct printf_conversion c;
 
 		/* Literally copy non-conversions to output. */
 		if (*format != '%') {
-			output (*format, aux);
+			const char *run = format;
+
+			while (format[1] != '\0' && format[1] != '%')
+				format++;
+			output_bytes (run, format - run + 1, &pb);
 			continue;
 		}
 		format++;
 
 		/* %% => %. */
 		if (*format == '%') {
-			output ('%', aux);
+			output_char ('%', &pb);
 			continue;
 		}
 
@@ -204,7 +262,7 @@ __vprintf (const char *format, va_list args,
 					}
 
 					format_integer (value < 0 ? -value : value,
-							true, value < 0, &base_d, &c, output, aux);
+							true, value < 0, &base_d, &c, &pb);
 				}
 				break;
 
@@ -257,7 +315,7 @@ __vprintf (const char *format, va_list args,
 						default: NOT_REACHED ();
 					}
 
-					format_integer (value, false, false, b, &c, output, aux);
+					format_integer (value, false, false, b, &c, &pb);
 				}
 				break;
 
@@ -265,7 +323,7 @@ __vprintf (const char *format, va_list args,
 				{
 					/* Treat character as single-character string. */
 					char ch = va_arg (args, int);
-					format_string (&ch, 1, &c, output, aux);
+					format_string (&ch, 1, &c, &pb);
 				}
 				break;
 
@@ -279,7 +337,7 @@ __vprintf (const char *format, va_list args,
 					/* Limit string length according to precision.
 Note: if c.precision == -1 then strnlen() will get
 SIZE_MAX for MAXLEN, which is just what we want. */
-					format_string (s, strnlen (s, c.precision), &c, output, aux);
+					format_string (s, strnlen (s, c.precision), &c, &pb);
 				}
 				break;
 
@@ -291,7 +349,7 @@ SIZE_MAX for MAXLEN, which is just what we want. */
 
 					c.flags = POUND;
 					format_integer ((uintptr_t) p, false, false,
-							&base_x, &c, output, aux);
+							&base_x, &c, &pb);
 				}
 				break;
 
@@ -303,14 +361,19 @@ SIZE_MAX for MAXLEN, which is just what we want. */
 			case 'n':
 				/* We don't support floating-point arithmetic,
 				   and %n can be part of a security hole. */
-				__printf ("<<no %%%c in kernel>>", output, aux, *format);
+				output_bytes ("<<no %", 6, &pb);
+				output_char (*format, &pb);
+				output_bytes (" in kernel>>", 12, &pb);
 				break;
 
 			default:
-				__printf ("<<no %%%c conversion>>", output, aux, *format);
+				output_bytes ("<<no %", 6, &pb);
+				output_char (*format, &pb);
+				output_bytes (" conversion>>", 13, &pb);
 				break;
 		}
 	}
+	output_flush (&pb);
 }
 
 /* Parses conversion option characters starting at FORMAT and
@@ -426,8 +489,8 @@ not_a_flag:
 	return format;
 }
 
-/* Performs an integer conversion, writing output to OUTPUT with
-   auxiliary data AUX.  The integer converted has absolute value
+/* Performs an integer conversion, writing output to PB.  The
+   integer converted has absolute value
    VALUE.  If IS_SIGNED is true, does a signed conversion with
    NEGATIVE indicating a negative value; otherwise does an
    unsigned conversion and ignores NEGATIVE.  The output is done
@@ -437,7 +500,7 @@ static void
 format_integer (uintmax_t value, bool is_signed, bool negative,
 		const struct integer_base *b,
 		const struct printf_conversion *c,
-		void (*output) (char, void *), void *aux) {
+		struct printf_buffer *pb) {
 	char buf[64], *cp;            /* Buffer and current position. */
 	int x;                        /* `x' character to use or 0 if none. */
 	int sign;                     /* Sign character or 0 if none. */
@@ -464,79 +527,77 @@ format_integer (uintmax_t value, bool is_signed, bool negative,
 	x = (c->flags & POUND) && value ? b->x : 0;
 
 	/* Accumulate digits into buffer.
-	   This algorithm produces digits in reverse order, so later we
-	   will output the buffer's content in reverse. */
-	cp = buf;
+	   This algorithm produces digits least significant first, so
+	   it fills the buffer from the end backward, leaving them in
+	   order to be output as one run. */
+	cp = buf + sizeof buf;
 	digit_cnt = 0;
 	while (value > 0) {
 		if ((c->flags & GROUP) && digit_cnt > 0 && digit_cnt % b->group == 0)
-			*cp++ = ',';
-		*cp++ = b->digits[value % b->base];
+			*--cp = ',';
+		*--cp = b->digits[value % b->base];
 		value /= b->base;
 		digit_cnt++;
 	}
 
-	/* Append enough zeros to match precision.
+	/* Prepend enough zeros to match precision.
 	   If requested precision is 0, then a value of zero is
 	   rendered as a null string, otherwise as "0".
 	   If the # flag is used with base 8, the result must always
 	   begin with a zero. */
 	precision = c->precision < 0 ? 1 : c->precision;
-	while (cp - buf < precision && cp < buf + sizeof buf - 1)
-		*cp++ = '0';
-	if ((c->flags & POUND) && b->base == 8 && (cp == buf || cp[-1] != '0'))
-		*cp++ = '0';
+	while (buf + sizeof buf - cp < precision && cp > buf + 1)
+		*--cp = '0';
+	if ((c->flags & POUND) && b->base == 8
+			&& (cp == buf + sizeof buf || *cp != '0'))
+		*--cp = '0';
 
 	/* Calculate number of pad characters to fill field width. */
-	pad_cnt = c->width - (cp - buf) - (x ? 2 : 0) - (sign != 0);
+	pad_cnt = c->width - (buf + sizeof buf - cp) - (x ? 2 : 0) - (sign != 0);
 	if (pad_cnt < 0)
 		pad_cnt = 0;
 
 	/* Do output. */
 	if ((c->flags & (MINUS | ZERO)) == 0)
-		output_dup (' ', pad_cnt, output, aux);
+		output_dup (' ', pad_cnt, pb);
 	if (sign)
-		output (sign, aux);
+		output_char (sign, pb);
 	if (x) {
-		output ('0', aux);
-		output (x, aux);
+		output_char ('0', pb);
+		output_char (x, pb);
 	}
 	if (c->flags & ZERO)
-		output_dup ('0', pad_cnt, output, aux);
-	while (cp > buf)
-		output (*--cp, aux);
+		output_dup ('0', pad_cnt, pb);
+	output_bytes (cp, buf + sizeof buf - cp, pb);
 	if (c->flags & MINUS)
-		output_dup (' ', pad_cnt, output, aux);
+		output_dup (' ', pad_cnt, pb);
 }
 
-/* Writes CH to OUTPUT with auxiliary data AUX, CNT times. */
+/* Writes CH to PB, CNT times. */
 static void
-output_dup (char ch, size_t cnt, void (*output) (char, void *), void *aux) {
+output_dup (char ch, size_t cnt, struct printf_buffer *pb) {
 	while (cnt-- > 0)
-		output (ch, aux);
+		output_char (ch, pb);
 }
 
 /* Formats the LENGTH characters starting at STRING according to
-   the conversion specified in C.  Writes output to OUTPUT with
-   auxiliary data AUX. */
+   the conversion specified in C.  Writes output to PB. */
 static void
 format_string (const char *string, int length,
 		struct printf_conversion *c,
-		void (*output) (char, void *), void *aux) {
-	int i;
+		struct printf_buffer *pb) {
 	if (c->width > length && (c->flags & MINUS) == 0)
-		output_dup (' ', c->width - length, output, aux);
-	for (i = 0; i < length; i++)
-		output (string[i], aux);
+		output_dup (' ', c->width - length, pb);
+	output_bytes (string, length, pb);
 	if (c->width > length && (c->flags & MINUS) != 0)
-		output_dup (' ', c->width - length, output, aux);
+		output_dup (' ', c->width - length, pb);
 }
 
 /* Wrapper for __vprintf() that converts varargs into a
    va_list. */
 void
 __printf (const char *format,
-		void (*output) (char, void *), void *aux, ...) {
+		void (*output) (const char *, size_t, void *), void *aux, ...) {
 	va_list args;
 
 	va_start (args, aux);
@@ -3,6 +3,7 @@
 #include <random.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 /* Converts a string representation of a signed decimal integer
    in S into an `int', which is returned. */
@@ -48,67 +49,116 @@ compare_thunk (const void *a, const void *b, void *aux)
   return (*compare) (a, b);
 }
 
-/* Sorts ARRAY, which contains CNT elements of SIZE bytes each,
-   using COMPARE.  When COMPARE is passed a pair of elements A
-   and B, respectively, it must return a strcmp()-type result,
-   i.e. less than zero if A < B, zero if A == B, greater than
-   zero if A > B.  Runs in O(n lg n) time and O(1) space in
-   CNT. */
-void
-qsort (void *array, size_t cnt, size_t size,
-       int (*compare) (const void *, const void *)) 
+/* Arrays of at most this many elements are insertion sorted. */
+#define INSERTION_SORT_MAX 16
+
+/* What sort() and qsort() need to know about the array they are
+   sorting.  Exactly one of COMPARE and QCOMPARE is non-null, so
+   that qsort() can call its comparison function directly instead
+   of through compare_thunk(). */
+struct sort_info
+  {
+    size_t size;                /* Element size in bytes. */
+    int (*compare) (const void *, const void *, void *aux);
+    void *aux;                  /* Auxiliary data for COMPARE. */
+    int (*qcompare) (const void *, const void *);
+  };
+
+/* Compares elements A and B as described by INFO and returns a
+   strcmp()-type result. */
+static inline int
+do_compare (const struct sort_info *info, const void *a, const void *b) 
 {
-  sort (array, cnt, size, compare_thunk, &compare);
+  return (info->qcompare != NULL
+          ? info->qcompare (a, b)
+          : info->compare (a, b, info->aux));
 }
 
-/* Swaps elements with 1-based indexes A_IDX and B_IDX in ARRAY
-   with elements of SIZE bytes each. */
-static void
-do_swap (unsigned char *array, size_t a_idx, size_t b_idx, size_t size)
+/* Swaps elements A and B of SIZE bytes each.  Elements made of
+   whole, aligned words, such as ints, longs and pointers, are
+   swapped a word at a time. */
+static inline void
+do_swap (unsigned char *a, unsigned char *b, size_t size)
 {
-  unsigned char *a = array + (a_idx - 1) * size;
-  unsigned char *b = array + (b_idx - 1) * size;
-  size_t i;
+  if (size == sizeof (long)
+      && ((uintptr_t) a | (uintptr_t) b) % sizeof (long) == 0)
+    {
+      long t = *(long *) a;
+      *(long *) a = *(long *) b;
+      *(long *) b = t;
+    }
+  else if (size == sizeof (int)
+           && ((uintptr_t) a | (uintptr_t) b) % sizeof (int) == 0)
+    {
+      int t = *(int *) a;
+      *(int *) a = *(int *) b;
+      *(int *) b = t;
+    }
+  else if ((size | (uintptr_t) a | (uintptr_t) b) % sizeof (long) == 0)
+    {
+      long *x = (long *) a;
+      long *y = (long *) b;
+      size_t i;
 
-  for (i = 0; i < size; i++)
+      for (i = 0; i < size / sizeof (long); i++)
+        {
+          long t = x[i];
+          x[i] = y[i];
+          y[i] = t;
+        }
+    }
+  else
     {
-      unsigned char t = a[i];
-      a[i] = b[i];
-      b[i] = t;
+      size_t i;
+
+      for (i = 0; i < size; i++)
+        {
+          unsigned char t = a[i];
+          a[i] = b[i];
+          b[i] = t;
+        }
     }
 }
 
-/* Compares elements with 1-based indexes A_IDX and B_IDX in
-   ARRAY with elements of SIZE bytes each, using COMPARE to
-   compare elements, passing AUX as auxiliary data, and returns a
-   strcmp()-type result. */
-static int
-do_compare (unsigned char *array, size_t a_idx, size_t b_idx, size_t size,
-            int (*compare) (const void *, const void *, void *aux),
-            void *aux) 
+/* Sorts the CNT elements in ARRAY by insertion sort.  Fast for
+   the short runs that quicksort leaves behind. */
+static void
+insertion_sort (const struct sort_info *info, unsigned char *array,
+                size_t cnt) 
 {
-  return compare (array + (a_idx - 1) * size, array + (b_idx - 1) * size, aux);
+  size_t size = info->size;
+  size_t i;
+
+  for (i = 1; i < cnt; i++)
+    {
+      unsigned char *p;
+
+      for (p = array + i * size;
+           p > array && do_compare (info, p - size, p) > 0; p -= size)
+        do_swap (p - size, p, size);
+    }
 }
 
-/* "Float down" the element with 1-based index I in ARRAY of CNT
-   elements of SIZE bytes each, using COMPARE to compare
-   elements, passing AUX as auxiliary data. */
+/* "Float down" the element with 0-based index I in ARRAY of CNT
+   elements, to restore the heap property. */
 static void
-heapify (unsigned char *array, size_t i, size_t cnt, size_t size,
-         int (*compare) (const void *, const void *, void *aux),
-         void *aux) 
+heapify (const struct sort_info *info, unsigned char *array, size_t i,
+         size_t cnt) 
 {
+  size_t size = info->size;
+
   for (;;) 
     {
       /* Set `max' to the index of the largest element among I
          and its children (if any). */
-      size_t left = 2 * i;
-      size_t right = 2 * i + 1;
+      size_t left = 2 * i + 1;
+      size_t right = 2 * i + 2;
       size_t max = i;
-      if (left <= cnt && do_compare (array, left, max, size, compare, aux) > 0)
+      if (left < cnt
+          && do_compare (info, array + left * size, array + max * size) > 0)
         max = left;
-      if (right <= cnt
-          && do_compare (array, right, max, size, compare, aux) > 0) 
+      if (right < cnt
+          && do_compare (info, array + right * size, array + max * size) > 0) 
         max = right;
 
       /* If the maximum value is already in element I, we're
@@ -117,38 +167,153 @@ heapify (unsigned char *array, size_t i, size_t cnt, size_t size,
         break;
 
       /* Swap and continue down the heap. */
-      do_swap (array, i, max, size);
+      do_swap (array + i * size, array + max * size, size);
       i = max;
     }
 }
 
+/* Sorts the CNT elements in ARRAY by heapsort, in O(n lg n) time
+   whatever their order. */
+static void
+heap_sort (const struct sort_info *info, unsigned char *array, size_t cnt) 
+{
+  size_t i;
+
+  /* Build a heap. */
+  for (i = cnt / 2; i > 0; i--)
+    heapify (info, array, i - 1, cnt);
+
+  /* Sort the heap. */
+  for (i = cnt - 1; i > 0; i--) 
+    {
+      do_swap (array, array + i * info->size, info->size);
+      heapify (info, array, 0, i); 
+    }
+}
+
+/* Sorts the CNT elements in ARRAY by introsort: quicksort with a
+   median-of-three pivot, falling back to heapsort once DEPTH
+   levels of partitioning have failed to finish the job, and
+   leaving short partitions to insertion sort.  Recurses only on
+   the smaller partition, so the stack stays O(lg n) deep. */
+static void
+intro_sort (const struct sort_info *info, unsigned char *array, size_t cnt,
+            int depth) 
+{
+  size_t size = info->size;
+
+  while (cnt > INSERTION_SORT_MAX) 
+    {
+      unsigned char *first = array;
+      unsigned char *middle = array + (cnt / 2) * size;
+      unsigned char *last = array + (cnt - 1) * size;
+      unsigned char *pivot = array + size;
+      unsigned char *i, *j;
+
+      if (depth-- == 0)
+        {
+          heap_sort (info, array, cnt);
+          return;
+        }
+
+      /* Order the first, middle and last elements, then put their
+         median at index 1.  The first and last elements now bound
+         the scans below, so neither needs a range check. */
+      if (do_compare (info, middle, first) < 0)
+        do_swap (middle, first, size);
+      if (do_compare (info, last, middle) < 0)
+        {
+          do_swap (last, middle, size);
+          if (do_compare (info, middle, first) < 0)
+            do_swap (middle, first, size);
+        }
+      do_swap (middle, pivot, size);
+
+      /* Partition the rest around the pivot. */
+      i = pivot;
+      j = last;
+      for (;;) 
+        {
+          do
+            i += size;
+          while (do_compare (info, i, pivot) < 0);
+          do
+            j -= size;
+          while (do_compare (info, j, pivot) > 0);
+          if (i >= j)
+            break;
+          do_swap (i, j, size);
+        }
+      do_swap (pivot, j, size);
+
+      /* Elements before J are no greater than the pivot, now at
+         J, and those after it are no less. */
+      {
+        size_t left_cnt = (j - array) / size;
+        size_t right_cnt = cnt - left_cnt - 1;
+
+        if (left_cnt < right_cnt)
+          {
+            intro_sort (info, array, left_cnt, depth);
+            array = j + size;
+            cnt = right_cnt;
+          }
+        else
+          {
+            intro_sort (info, j + size, right_cnt, depth);
+            cnt = left_cnt;
+          }
+      }
+    }
+  insertion_sort (info, array, cnt);
+}
+
+/* Sorts ARRAY as described by INFO.  */
+static void
+sort_array (const struct sort_info *info, void *array, size_t cnt) 
+{
+  int depth = 0;
+  size_t i;
+
+  ASSERT (array != NULL || cnt == 0);
+  ASSERT (info->size > 0);
+
+  for (i = cnt; i > 1; i /= 2)
+    depth += 2;
+  intro_sort (info, array, cnt, depth);
+}
+
+/* Sorts ARRAY, which contains CNT elements of SIZE bytes each,
+   using COMPARE.  When COMPARE is passed a pair of elements A
+   and B, respectively, it must return a strcmp()-type result,
+   i.e. less than zero if A < B, zero if A == B, greater than
+   zero if A > B.  Runs in O(n lg n) time and O(lg n) space in
+   CNT. */
+void
+qsort (void *array, size_t cnt, size_t size,
+       int (*compare) (const void *, const void *)) 
+{
+  struct sort_info info = { size, NULL, NULL, compare };
+
+  ASSERT (compare != NULL);
+  sort_array (&info, array, cnt);
+}
+
 /* Sorts ARRAY, which contains CNT elements of SIZE bytes each,
    using COMPARE to compare elements, passing AUX as auxiliary
    data.  When COMPARE is passed a pair of elements A and B,
    respectively, it must return a strcmp()-type result, i.e. less
    than zero if A < B, zero if A == B, greater than zero if A >
-   B.  Runs in O(n lg n) time and O(1) space in CNT. */
+   B.  Runs in O(n lg n) time and O(lg n) space in CNT. */
 void
 sort (void *array, size_t cnt, size_t size,
       int (*compare) (const void *, const void *, void *aux),
       void *aux) 
 {
-  size_t i;
+  struct sort_info info = { size, compare, aux, NULL };
 
-  ASSERT (array != NULL || cnt == 0);
   ASSERT (compare != NULL);
-  ASSERT (size > 0);
-
-  /* Build a heap. */
-  for (i = cnt / 2; i > 0; i--)
-    heapify (array, i, cnt, size, compare, aux);
-
-  /* Sort the heap. */
-  for (i = cnt; i > 1; i--) 
-    {
-      do_swap (array, 1, i, size);
-      heapify (array, 1, i - 1, size, compare, aux); 
-    }
+  sort_array (&info, array, cnt);
 }
 
 /* Searches ARRAY, which contains CNT elements of SIZE bytes
@@ -1,5 +1,78 @@
 #include <string.h>
 #include <debug.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Blocks shorter than this are copied or set a byte at a time;
+   the string-instruction setup cost is not worth it below. */
+#define STRING_OP_MIN 32
+
+/* Does the CPU implement Enhanced REP MOVSB/STOSB (ERMS), making
+   byte-granular `rep movsb' and `rep stosb' at least as fast as
+   their quadword forms?  -1 until first checked. */
+static int erms = -1;
+
+/* Returns true if the CPU reports ERMS in CPUID leaf 7. */
+static bool
+have_erms (void) {
+	if (erms < 0) {
+		uint32_t eax, ebx, ecx, edx;
+
+		asm volatile ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+				: "a" (0));
+		if (eax >= 7) {
+			asm volatile ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+					: "a" (7), "c" (0));
+			erms = (ebx >> 9) & 1;
+		} else
+			erms = 0;
+	}
+	return erms;
+}
+
+/* The word-at-a-time routines below read memory in aligned
+   8-byte words.  An aligned word never straddles a page boundary,
+   so scanning past the end of a string is harmless as long as the
+   word holding its last byte is readable.  may_alias keeps these
+   reads legal on any underlying type. */
+typedef uint64_t word_t __attribute__ ((__may_alias__));
+
+#define WORD_ONES 0x0101010101010101ULL
+#define WORD_HIGHS 0x8080808080808080ULL
+
+/* Nonzero if any byte in word W is zero. */
+#define HAS_ZERO(W) (((W) - WORD_ONES) & ~(W) & WORD_HIGHS)
+
+/* Returns the byte offset within word W of its first zero byte.
+   W must have one. */
+static inline int
+zero_offset (word_t w) {
+	word_t bits = ((w - WORD_ONES) & ~w & WORD_HIGHS);
+	return __builtin_ctzll (bits) / 8;
+}
+
+/* Copies SIZE bytes forward from SRC to DST with string
+   instructions.  Safe for overlapping blocks only if DST < SRC. */
+static void
+copy_forward (unsigned char *dst, const unsigned char *src, size_t size) {
+	if (have_erms ()) {
+		asm volatile ("rep movsb"
+				: "+D" (dst), "+S" (src), "+c" (size) : : "memory");
+		return;
+	}
+
+	/* Byte head up to an 8-byte aligned destination, quadword
+	   body, byte tail. */
+	while (((uintptr_t) dst & 7) != 0) {
+		*dst++ = *src++;
+		size--;
+	}
+	size_t words = size / 8;
+	asm volatile ("rep movsq"
+			: "+D" (dst), "+S" (src), "+c" (words) : : "memory");
+	for (size &= 7; size > 0; size--)
+		*dst++ = *src++;
+}
 
 /* Copies SIZE bytes from SRC to DST, which must not overlap.
    Returns DST. */
@@ -11,8 +84,11 @@ memcpy (void *dst_, const void *src_, size_t size) {
 	ASSERT (dst != NULL || size == 0);
 	ASSERT (src != NULL || size == 0);
 
-	while (size-- > 0)
-		*dst++ = *src++;
+	if (size >= STRING_OP_MIN)
+		copy_forward (dst, src, size);
+	else
+		while (size-- > 0)
+			*dst++ = *src++;
 
 	return dst_;
 }
@@ -27,17 +103,35 @@ memmove (void *dst_, const void *src_, size_t size) {
 	ASSERT (dst != NULL || size == 0);
 	ASSERT (src != NULL || size == 0);
 
-	if (dst < src) {
-		while (size-- > 0)
-			*dst++ = *src++;
+	if (dst < src || dst >= src + size) {
+		/* A forward copy never overwrites source bytes it has yet
+		   to read. */
+		if (size >= STRING_OP_MIN)
+			copy_forward (dst, src, size);
+		else
+			while (size-- > 0)
+				*dst++ = *src++;
 	} else {
+		/* Copy backward: byte tail down to an aligned end, then
+		   quadwords, then the byte head. */
 		dst += size;
 		src += size;
+		if (size >= STRING_OP_MIN) {
+			while (((uintptr_t) dst & 7) != 0) {
+				*--dst = *--src;
+				size--;
+			}
+			for (; size >= 8; size -= 8) {
+				dst -= 8;
+				src -= 8;
+				*(uint64_t *) dst = *(const uint64_t *) src;
+			}
+		}
 		while (size-- > 0)
 			*--dst = *--src;
 	}
 
-	return dst;
+	return dst_;
 }
 
 /* Find the first differing byte in the two blocks of SIZE bytes
@@ -52,6 +146,11 @@ memcmp (const void *a_, const void *b_, size_t size) {
 	ASSERT (a != NULL || size == 0);
 	ASSERT (b != NULL || size == 0);
 
+	/* Every word read lies within the blocks, so alignment only
+	   matters for speed, not safety. */
+	for (; size >= 8; size -= 8, a += 8, b += 8)
+		if (*(const word_t *) a != *(const word_t *) b)
+			break;
 	for (; size-- > 0; a++, b++)
 		if (*a != *b)
 			return *a > *b ? +1 : -1;
@@ -71,6 +170,22 @@ strcmp (const char *a_, const char *b_) {
 	ASSERT (a != NULL);
 	ASSERT (b != NULL);
 
+	/* Word compare only when both strings reach alignment together;
+	   otherwise one of them would need unaligned reads that could
+	   cross into an unmapped page. */
+	if ((((uintptr_t) a ^ (uintptr_t) b) & 7) == 0) {
+		for (; ((uintptr_t) a & 7) != 0; a++, b++)
+			if (*a == '\0' || *a != *b)
+				return *a < *b ? -1 : *a > *b;
+		for (;;) {
+			word_t wa = *(const word_t *) a;
+			if (HAS_ZERO (wa) || wa != *(const word_t *) b)
+				break;
+			a += 8;
+			b += 8;
+		}
+	}
+
 	while (*a != '\0' && *a == *b) {
 		a++;
 		b++;
@@ -89,6 +204,16 @@ memchr (const void *block_, int ch_, size_t size) {
 
 	ASSERT (block != NULL || size == 0);
 
+	for (; size > 0 && ((uintptr_t) block & 7) != 0; size--, block++)
+		if (*block == ch)
+			return (void *) block;
+
+	/* XORing with CH in every byte turns matches into zero bytes. */
+	word_t pattern = ch * WORD_ONES;
+	for (; size >= 8; size -= 8, block += 8)
+		if (HAS_ZERO (*(const word_t *) block ^ pattern))
+			break;
+
 	for (; size-- > 0; block++)
 		if (*block == ch)
 			return (void *) block;
@@ -260,6 +385,24 @@ memset (void *dst_, int value, size_t size) {
 
 	ASSERT (dst != NULL || size == 0);
 
+	if (size >= STRING_OP_MIN) {
+		if (have_erms ()) {
+			asm volatile ("rep stosb"
+					: "+D" (dst), "+c" (size) : "a" (value) : "memory");
+			return dst_;
+		}
+
+		while (((uintptr_t) dst & 7) != 0) {
+			*dst++ = value;
+			size--;
+		}
+		uint64_t pattern = (unsigned char) value * 0x0101010101010101ULL;
+		size_t words = size / 8;
+		asm volatile ("rep stosq"
+				: "+D" (dst), "+c" (words) : "a" (pattern) : "memory");
+		size &= 7;
+	}
+
 	while (size-- > 0)
 		*dst++ = value;
 
@@ -273,9 +416,15 @@ strlen (const char *string) {
 
 	ASSERT (string);
 
-	for (p = string; *p != '\0'; p++)
-		continue;
-	return p - string;
+	for (p = string; ((uintptr_t) p & 7) != 0; p++)
+		if (*p == '\0')
+			return p - string;
+
+	for (;; p += 8) {
+		word_t w = *(const word_t *) p;
+		if (HAS_ZERO (w))
+			return p - string + zero_offset (w);
+	}
 }
 
 /* If STRING is less than MAXLEN characters in length, returns
@@ -284,7 +433,19 @@ size_t
 strnlen (const char *string, size_t maxlen) {
 	size_t length;
 
-	for (length = 0; string[length] != '\0' && length < maxlen; length++)
+	for (length = 0; length < maxlen
+			&& ((uintptr_t) (string + length) & 7) != 0; length++)
+		if (string[length] == '\0')
+			return length;
+
+	/* Whole words only while they lie entirely below MAXLEN. */
+	for (; maxlen - length >= 8; length += 8) {
+		word_t w = *(const word_t *) (string + length);
+		if (HAS_ZERO (w))
+			return length + zero_offset (w);
+	}
+
+	for (; length < maxlen && string[length] != '\0'; length++)
 		continue;
 	return length;
 }
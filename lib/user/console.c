@@ -1,8 +1,54 @@
 #include <stdio.h>
+#include <stdbool.h>
 #include <string.h>
+#include <mutex.h>
 #include <syscall.h>
 #include <syscall-nr.h>
 
+/* Standard output, buffered a page at a time.  Descriptor 1 is
+   always the console, so the buffer is written out at the end of
+   each call that completes a line, as well as when it fills; a
+   printf() of several lines, or a run of putchar() calls, takes a
+   single write() system call.  exit(), fork() and exec() flush it,
+   so that no output is lost or doubled, and so does reading the
+   standard input, so that a prompt shows before the read. */
+static char stdout_buf[4096];
+static size_t stdout_len;
+static struct mutex stdout_lock = MUTEX_INITIALIZER;
+
+/* Writes out the buffered output.  The caller must hold
+   STDOUT_LOCK. */
+static void
+stdout_drain (void) {
+	if (stdout_len > 0) {
+		write (STDOUT_FILENO, stdout_buf, stdout_len);
+		stdout_len = 0;
+	}
+}
+
+/* Appends the N characters in BUF to standard output.  The caller
+   must hold STDOUT_LOCK. */
+static void
+stdout_put (const char *buf, size_t n) {
+	if (n > sizeof stdout_buf - stdout_len) {
+		stdout_drain ();
+		if (n >= sizeof stdout_buf) {
+			write (STDOUT_FILENO, buf, n);
+			return;
+		}
+	}
+	memcpy (stdout_buf + stdout_len, buf, n);
+	stdout_len += n;
+}
+
+/* Writes out whatever standard output has buffered. */
+void
+stdout_flush (void) {
+	mutex_lock (&stdout_lock);
+	stdout_drain ();
+	mutex_unlock (&stdout_lock);
+}
+
 /* The standard vprintf() function,
    which is like printf() but uses a va_list. */
 int
@@ -27,8 +73,11 @@ hprintf (int handle, const char *format, ...) {
    character. */
 int
 puts (const char *s) {
-	write (STDOUT_FILENO, s, strlen (s));
-	putchar ('\n');
+	mutex_lock (&stdout_lock);
+	stdout_put (s, strlen (s));
+	stdout_put ("\n", 1);
+	stdout_drain ();
+	mutex_unlock (&stdout_lock);
 
 	return 0;
 }
@@ -37,20 +86,23 @@ puts (const char *s) {
 int
 putchar (int c) {
 	char c2 = c;
-	write (STDOUT_FILENO, &c2, 1);
+
+	mutex_lock (&stdout_lock);
+	stdout_put (&c2, 1);
+	if (c2 == '\n')
+		stdout_drain ();
+	mutex_unlock (&stdout_lock);
 	return c;
 }
 
 /* Auxiliary data for vhprintf_helper(). */
 struct vhprintf_aux {
-	char buf[64];       /* Character buffer. */
-	char *p;            /* Current position in buffer. */
 	int char_cnt;       /* Total characters written so far. */
 	int handle;         /* Output file handle. */
+	bool newline;       /* Was a new-line written to stdout? */
 };
 
-static void add_char (char, void *);
-static void flush (struct vhprintf_aux *);
+static void vhprintf_helper (const char *, size_t, void *);
 
 /* Formats the printf() format specification FORMAT with
    arguments given in ARGS and writes the output to the given
@@ -58,29 +110,35 @@ static void flush (struct vhprintf_aux *);
 int
 vhprintf (int handle, const char *format, va_list args) {
 	struct vhprintf_aux aux;
-	aux.p = aux.buf;
 	aux.char_cnt = 0;
 	aux.handle = handle;
-	__vprintf (format, args, add_char, &aux);
-	flush (&aux);
+	aux.newline = false;
+	if (handle != STDOUT_FILENO) {
+		__vprintf (format, args, vhprintf_helper, &aux);
+		return aux.char_cnt;
+	}
+
+	mutex_lock (&stdout_lock);
+	__vprintf (format, args, vhprintf_helper, &aux);
+	if (aux.newline)
+		stdout_drain ();
+	mutex_unlock (&stdout_lock);
 	return aux.char_cnt;
 }
 
-/* Adds C to the buffer in AUX, flushing it if the buffer fills
-   up. */
+/* Writes the N characters in BUF to the handle in AUX.
+   __vprintf() already collects its output into runs, so each
+   run takes at most one write() system call; those to standard
+   output are buffered instead. */
 static void
-add_char (char c, void *aux_) {
+vhprintf_helper (const char *buf, size_t n, void *aux_) {
 	struct vhprintf_aux *aux = aux_;
-	*aux->p++ = c;
-	if (aux->p >= aux->buf + sizeof aux->buf)
-		flush (aux);
-	aux->char_cnt++;
-}
 
-/* Flushes the buffer in AUX. */
-static void
-flush (struct vhprintf_aux *aux) {
-	if (aux->p > aux->buf)
-		write (aux->handle, aux->buf, aux->p - aux->buf);
-	aux->p = aux->buf;
+	if (aux->handle == STDOUT_FILENO) {
+		stdout_put (buf, n);
+		if (memchr (buf, '\n', n) != NULL)
+			aux->newline = true;
+	} else
+		write (aux->handle, buf, n);
+	aux->char_cnt += n;
 }
@@ -0,0 +1,268 @@
+#include <malloc.h>
+#include <debug.h>
+#include <mutex.h>
+#include <round.h>
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+
+/* A size-class allocator on top of sbrk().
+
+   A request of up to CLASS_MAX bytes is rounded up to one of a
+   few size classes and served from that class's free list.  An
+   empty list is refilled by carving a fresh chunk of the heap into
+   blocks of the class.  Blocks are never split or merged, so small
+   allocations and frees are a list push or pop.
+
+   The free lists live in CACHE_CNT caches, each with its own
+   mutex, so that threads allocating at once seldom contend.  User
+   threads have no thread-local storage here, so a thread picks its
+   cache by the page its stack is on; threads running on different
+   stacks mostly land in different caches.  A block remembers the
+   cache that carved it and goes back there when freed, whichever
+   thread frees it.
+
+   Larger requests get a block of their own, rounded up to
+   ALIGNMENT, kept on a first-fit list when freed.  A large free
+   block at the top of the heap is handed back with sbrk() once it
+   reaches TRIM_MIN bytes. */
+
+#define ALIGNMENT 16            /* Alignment of every block. */
+#define CLASS_MAX 2048          /* Largest small request. */
+#define CLASS_LARGE 0xffff      /* Class of a large block. */
+#define CACHE_CNT 4             /* Number of caches. */
+#define REFILL_BYTES 4096       /* Least heap carved in one refill. */
+#define TRIM_MIN (64 * 1024)    /* Least top block given back. */
+
+/* Size classes, in bytes of user data. */
+static const size_t class_size[] = {
+	16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048,
+};
+#define CLASS_CNT (sizeof class_size / sizeof *class_size)
+
+/* Header in front of every block, ALIGNMENT bytes long. */
+struct header {
+	size_t size;                /* Bytes of user data. */
+	uint16_t class;             /* Size class, or CLASS_LARGE. */
+	uint16_t cache;             /* Cache a small block returns to. */
+	uint32_t magic;             /* Detects bad and double frees. */
+};
+
+#define MAGIC_USED 0x6d616c6c
+#define MAGIC_FREE 0x66726565
+
+/* A free block, in a free list. */
+struct free_block {
+	struct header hdr;
+	struct free_block *next;
+};
+
+/* A set of free lists. */
+struct cache {
+	struct mutex lock;
+	struct free_block *free[CLASS_CNT];
+} __attribute__ ((aligned (64)));
+
+static struct cache caches[CACHE_CNT];
+
+/* Protects the break and the large free list. */
+static struct mutex heap_lock = MUTEX_INITIALIZER;
+static struct free_block *large_free;
+
+/* Returns the current thread's cache. */
+static unsigned
+cache_pick (void) {
+	uintptr_t page = (uintptr_t) __builtin_frame_address (0) >> 12;
+
+	return (page * 0x9e3779b97f4a7c15ULL) >> 62;
+}
+
+/* Returns the smallest class holding SIZE bytes. */
+static unsigned
+class_of (size_t size) {
+	unsigned c = 0;
+
+	while (class_size[c] < size)
+		c++;
+	return c;
+}
+
+/* Extends the heap by SIZE bytes, a multiple of ALIGNMENT, and
+   returns their start, or a null pointer.  The caller must hold
+   HEAP_LOCK. */
+static void *
+heap_grow (size_t size) {
+	uint8_t *brk = sbrk (0);
+	size_t pad = ROUND_UP ((uintptr_t) brk, ALIGNMENT) - (uintptr_t) brk;
+
+	if (brk == (void *) -1 || size > INTPTR_MAX - pad
+			|| sbrk (size + pad) == (void *) -1)
+		return NULL;
+	return brk + pad;
+}
+
+/* Carves a chunk of the heap into blocks of class C and puts them
+   on the list of CACHE, cache number IDX, which the caller has
+   locked and found empty.  Returns false if the heap is full. */
+static bool
+cache_refill (struct cache *cache, unsigned c, unsigned idx) {
+	size_t block = sizeof (struct header) + class_size[c];
+	size_t cnt = REFILL_BYTES / block > 8 ? REFILL_BYTES / block : 8;
+	uint8_t *chunk;
+	size_t i;
+
+	mutex_lock (&heap_lock);
+	chunk = heap_grow (cnt * block);
+	mutex_unlock (&heap_lock);
+	if (chunk == NULL)
+		return false;
+
+	for (i = cnt; i-- > 0; ) {
+		struct free_block *b = (struct free_block *) (chunk + i * block);
+
+		b->hdr.size = class_size[c];
+		b->hdr.class = c;
+		b->hdr.cache = idx;
+		b->hdr.magic = MAGIC_FREE;
+		b->next = cache->free[c];
+		cache->free[c] = b;
+	}
+	return true;
+}
+
+/* Allocates a large block of SIZE bytes. */
+static struct header *
+large_alloc (size_t size) {
+	struct free_block **bp, *b;
+	struct header *h = NULL;
+
+	size = ROUND_UP (size, ALIGNMENT);
+	mutex_lock (&heap_lock);
+	for (bp = &large_free; (b = *bp) != NULL; bp = &b->next)
+		if (b->hdr.size >= size) {
+			*bp = b->next;
+			h = &b->hdr;
+			break;
+		}
+	if (h == NULL) {
+		h = heap_grow (sizeof *h + size);
+		if (h != NULL)
+			h->size = size;
+	}
+	mutex_unlock (&heap_lock);
+
+	if (h != NULL)
+		h->class = CLASS_LARGE;
+	return h;
+}
+
+/* Frees large block B. */
+static void
+large_free_block (struct free_block *b) {
+	size_t span = sizeof b->hdr + b->hdr.size;
+
+	mutex_lock (&heap_lock);
+	if (span >= TRIM_MIN && (uint8_t *) b + span == sbrk (0))
+		sbrk (-(intptr_t) span);
+	else {
+		b->next = large_free;
+		large_free = b;
+	}
+	mutex_unlock (&heap_lock);
+}
+
+/* Returns a block of at least SIZE bytes, aligned to ALIGNMENT,
+   or a null pointer if the heap cannot grow. */
+void *
+malloc (size_t size) {
+	struct header *h;
+
+	if (size <= CLASS_MAX) {
+		unsigned c = class_of (size);
+		unsigned idx = cache_pick ();
+		struct cache *cache = &caches[idx];
+		struct free_block *b;
+
+		mutex_lock (&cache->lock);
+		if (cache->free[c] == NULL && !cache_refill (cache, c, idx)) {
+			mutex_unlock (&cache->lock);
+			return NULL;
+		}
+		b = cache->free[c];
+		cache->free[c] = b->next;
+		mutex_unlock (&cache->lock);
+		h = &b->hdr;
+	} else if (size > INTPTR_MAX) {
+		return NULL;
+	} else {
+		h = large_alloc (size);
+		if (h == NULL)
+			return NULL;
+	}
+	h->magic = MAGIC_USED;
+	return h + 1;
+}
+
+/* Returns CNT zeroed elements of SIZE bytes each, or a null
+   pointer. */
+void *
+calloc (size_t cnt, size_t size) {
+	void *p;
+
+	if (size != 0 && cnt > SIZE_MAX / size)
+		return NULL;
+	p = malloc (cnt * size);
+	if (p != NULL)
+		memset (p, 0, cnt * size);
+	return p;
+}
+
+/* Resizes the block at OLD to SIZE bytes, moving it if it does not
+   fit, and returns its new address.  Returns a null pointer,
+   leaving OLD alone, if no room is left. */
+void *
+realloc (void *old, size_t size) {
+	struct header *h;
+	void *new;
+
+	if (old == NULL)
+		return malloc (size);
+	if (size == 0) {
+		free (old);
+		return NULL;
+	}
+	h = (struct header *) old - 1;
+	ASSERT (h->magic == MAGIC_USED);
+	if (size <= h->size)
+		return old;
+	new = malloc (size);
+	if (new != NULL) {
+		memcpy (new, old, h->size);
+		free (old);
+	}
+	return new;
+}
+
+/* Frees P, which malloc(), calloc() or realloc() returned.  Does
+   nothing if P is a null pointer. */
+void
+free (void *p) {
+	struct free_block *b;
+
+	if (p == NULL)
+		return;
+	b = (struct free_block *) ((struct header *) p - 1);
+	ASSERT (b->hdr.magic == MAGIC_USED);
+	b->hdr.magic = MAGIC_FREE;
+
+	if (b->hdr.class == CLASS_LARGE)
+		large_free_block (b);
+	else {
+		struct cache *cache = &caches[b->hdr.cache];
+
+		mutex_lock (&cache->lock);
+		b->next = cache->free[b->hdr.class];
+		cache->free[b->hdr.class] = b;
+		mutex_unlock (&cache->lock);
+	}
+}
@@ -0,0 +1,52 @@
+#include <mutex.h>
+#include <syscall.h>
+
+/* Mutexes on top of futexes, after Drepper, "Futexes Are Tricky".
+
+   STATE is 0 while the mutex is free, 1 while it is held with no
+   waiters, and 2 while it is held and a thread may be asleep on
+   it.  Taking a free mutex and releasing one without waiters is a
+   single atomic instruction.  A thread that finds the mutex held
+   marks it contended and sleeps in futex_wait(); releasing a
+   contended mutex wakes one sleeper, which marks it contended again
+   in turn, since others may still be waiting. */
+
+/* Initializes M as a free mutex. */
+void
+mutex_init (struct mutex *m) {
+	m->state = 0;
+}
+
+/* Takes M, sleeping while another thread holds it. */
+void
+mutex_lock (struct mutex *m) {
+	unsigned c = 0;
+
+	if (__atomic_compare_exchange_n (&m->state, &c, 1, false,
+				__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return;
+	if (c != 2)
+		c = __atomic_exchange_n (&m->state, 2, __ATOMIC_ACQUIRE);
+	while (c != 0) {
+		futex_wait (&m->state, 2);
+		c = __atomic_exchange_n (&m->state, 2, __ATOMIC_ACQUIRE);
+	}
+}
+
+/* Takes M if it is free and returns true, or returns false at once. */
+bool
+mutex_trylock (struct mutex *m) {
+	unsigned c = 0;
+
+	return __atomic_compare_exchange_n (&m->state, &c, 1, false,
+			__ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+/* Releases M, which the caller must hold. */
+void
+mutex_unlock (struct mutex *m) {
+	if (__atomic_fetch_sub (&m->state, 1, __ATOMIC_RELEASE) != 1) {
+		__atomic_store_n (&m->state, 0, __ATOMIC_RELEASE);
+		futex_wake (&m->state, 1);
+	}
+}
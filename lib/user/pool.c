@@ -0,0 +1,500 @@
+#include <pool.h>
+#include <malloc.h>
+#include <mutex.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include <syscall-nr.h>
+
+/* Thread pools, with work stealing.
+
+   A pool is a set of threads made with clone() plus the thread that
+   calls into it, each with a deque of tasks.  Work is forked and
+   joined: a thread pushes the tasks it forks onto the bottom of its
+   own deque, and pops them back from there, newest first, while a
+   thread that runs out of work steals the oldest task, usually the
+   biggest, from the top of another's.  A thread waiting for the
+   tasks it forked to finish runs tasks in the meantime, its own or
+   stolen, so no thread sits idle while there is work and a join
+   never blocks the work it waits for.
+
+   Tasks live in the stack frame of the thread that forks them,
+   which stays put until they are joined.  A deque that is full
+   takes no more; the forking thread runs the task itself.
+
+   A thread with nothing to do sleeps on the pool's WORK_SEQ futex,
+   which a thread that pushes a task bumps, and wakes, only when
+   some thread sleeps, so a busy pool makes no system calls.  A
+   join that finds no work sleeps on its own counter, flagged with
+   JOIN_SLEEPING, which the last task to finish wakes.
+
+   The deques are short and guarded by mutexes, which are taken
+   without a system call unless contended.  parallel_for() and
+   parallel_sort() are built on tasks; only one thread outside the
+   pool may call into it at a time, and a task must not. */
+
+#define POOL_THREAD_MAX 16      /* Most threads in a pool. */
+#define DEQUE_SIZE 64           /* Tasks a deque holds; a power of 2. */
+#define STACK_SIZE (32 * 1024)  /* Stack of each thread made. */
+#define JOIN_SPINS 64           /* Rounds of stealing before a join sleeps. */
+#define JOIN_SLEEPING 0x80000000u   /* Set in a join counter while it sleeps. */
+#define SORT_GRAIN 1024         /* Elements below which a sort is serial. */
+#define SPLIT_MAX 64            /* Most times a range is halved. */
+
+struct worker;
+
+/* A unit of work, embedded in a larger structure with its data. */
+struct task {
+	void (*run) (struct task *, struct worker *);
+	unsigned *pending;          /* Counter of the join it is part of. */
+};
+
+/* One thread of a pool and its deque. */
+struct worker {
+	struct pool *pool;          /* Pool it belongs to. */
+	struct mutex lock;          /* Protects the deque. */
+	struct task *deque[DEQUE_SIZE];
+	unsigned top;               /* Oldest task, stolen first. */
+	unsigned bottom;            /* One past the newest, popped first. */
+	unsigned seed;              /* Picks victims to steal from. */
+	unsigned running;           /* Nonzero while its thread lives. */
+	char *stack;                /* Its thread's stack, or null. */
+};
+
+/* A thread pool. */
+struct pool {
+	int worker_cnt;             /* Elements in WORKERS. */
+	unsigned work_seq;          /* Bumped to wake sleeping threads. */
+	unsigned sleeper_cnt;       /* Threads asleep on WORK_SEQ, or going. */
+	bool stop;                  /* Set to end the threads. */
+	long long steal_cnt;        /* Tasks run by another thread. */
+	struct worker workers[];    /* [0] is the caller's, the rest made. */
+};
+
+/* Returns the number of 1 bits in X.  (GCC's __builtin_popcount
+   would call into libgcc, which user programs do not link.) */
+static unsigned
+popcount (unsigned x) {
+	x = x - ((x >> 1) & 0x55555555u);
+	x = (x & 0x33333333u) + ((x >> 2) & 0x33333333u);
+	x = (x + (x >> 4)) & 0x0f0f0f0fu;
+	return (x * 0x01010101u) >> 24;
+}
+
+/* Pushes T onto the bottom of W's deque and wakes a sleeping thread
+   to steal it.  Returns false if the deque is full. */
+static bool
+push (struct worker *w, struct task *t) {
+	struct pool *p = w->pool;
+
+	mutex_lock (&w->lock);
+	if (w->bottom - w->top == DEQUE_SIZE) {
+		mutex_unlock (&w->lock);
+		return false;
+	}
+	w->deque[w->bottom++ % DEQUE_SIZE] = t;
+	mutex_unlock (&w->lock);
+
+	/* Pairs with worker_main(): either a thread going to sleep finds
+	   T, or this sees it counted and moves WORK_SEQ under it. */
+	if (__atomic_load_n (&p->sleeper_cnt, __ATOMIC_SEQ_CST) > 0) {
+		__atomic_add_fetch (&p->work_seq, 1, __ATOMIC_SEQ_CST);
+		futex_wake (&p->work_seq, 1);
+	}
+	return true;
+}
+
+/* Pops the newest task from W's deque, or returns a null pointer if
+   it is empty. */
+static struct task *
+pop (struct worker *w) {
+	struct task *t = NULL;
+
+	mutex_lock (&w->lock);
+	if (w->bottom != w->top)
+		t = w->deque[--w->bottom % DEQUE_SIZE];
+	mutex_unlock (&w->lock);
+	return t;
+}
+
+/* Takes the oldest task from V's deque, or returns a null pointer if
+   it is empty. */
+static struct task *
+steal (struct worker *v) {
+	struct task *t = NULL;
+
+	mutex_lock (&v->lock);
+	if (v->bottom != v->top)
+		t = v->deque[v->top++ % DEQUE_SIZE];
+	mutex_unlock (&v->lock);
+	return t;
+}
+
+/* Returns a task for W to run, from its own deque or stolen from
+   another, starting at a random one, or a null pointer if there is
+   none. */
+static struct task *
+find_work (struct worker *w) {
+	struct pool *p = w->pool;
+	struct task *t = pop (w);
+	int i, start;
+
+	if (t != NULL || p->worker_cnt == 1)
+		return t;
+
+	/* Xorshift. */
+	w->seed ^= w->seed << 13;
+	w->seed ^= w->seed >> 17;
+	w->seed ^= w->seed << 5;
+	start = w->seed % p->worker_cnt;
+
+	for (i = 0; i < p->worker_cnt; i++) {
+		struct worker *v = &p->workers[(start + i) % p->worker_cnt];
+
+		if (v != w && (t = steal (v)) != NULL) {
+			__atomic_add_fetch (&p->steal_cnt, 1, __ATOMIC_RELAXED);
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/* Forks T, to be run by W or another thread before W joins it. */
+static void
+fork_task (struct worker *w, struct task *t) {
+	__atomic_add_fetch (t->pending, 1, __ATOMIC_RELAXED);
+	if (!push (w, t))
+		t->run (t, w);
+}
+
+/* Marks T done.  T may be gone as soon as this returns. */
+static void
+finish (struct task *t) {
+	unsigned *pending = t->pending;
+
+	if (__atomic_sub_fetch (pending, 1, __ATOMIC_RELEASE) == JOIN_SLEEPING)
+		futex_wake (pending, 1);
+}
+
+/* Runs tasks on W until the tasks counted by *PENDING are done. */
+static void
+join (struct worker *w, unsigned *pending) {
+	int spins = 0;
+
+	for (;;) {
+		unsigned v = __atomic_load_n (pending, __ATOMIC_ACQUIRE);
+		struct task *t;
+
+		if ((v & ~JOIN_SLEEPING) == 0)
+			return;
+		t = find_work (w);
+		if (t != NULL) {
+			t->run (t, w);
+			spins = 0;
+		} else if (++spins >= JOIN_SPINS
+				&& ((v & JOIN_SLEEPING) != 0
+					|| __atomic_compare_exchange_n (pending, &v,
+						v | JOIN_SLEEPING, false, __ATOMIC_ACQUIRE,
+						__ATOMIC_ACQUIRE)))
+			futex_wait (pending, v | JOIN_SLEEPING);
+	}
+}
+
+/* Clears *RUNNING, wakes pool_destroy() waiting on it, and ends the
+   running thread, without touching its stack once *RUNNING is
+   clear, since pool_destroy() may then free it. */
+static void __attribute__ ((noreturn))
+worker_exit (unsigned *running) {
+	asm volatile ("movl $0, (%0)\n"
+			"mov %0, %%rdi\n"
+			"mov $1, %%esi\n"
+			"mov %1, %%rax\n"
+			"syscall\n"
+			"xor %%edi, %%edi\n"
+			"mov %2, %%rax\n"
+			"syscall\n"
+			: : "r" (running), "i" (SYS_FUTEX_WAKE), "i" (SYS_EXIT)
+			: "rax", "rdi", "rsi", "rcx", "r11", "memory");
+	__builtin_unreachable ();
+}
+
+/* Thread made by pool_create() for W. */
+static void
+worker_main (void *w_) {
+	struct worker *w = w_;
+	struct pool *p = w->pool;
+
+	for (;;) {
+		struct task *t = find_work (w);
+		unsigned seq;
+
+		if (t != NULL) {
+			t->run (t, w);
+			continue;
+		}
+
+		/* Count ourselves as a sleeper before looking again, so that
+		   a push either is seen here or moves WORK_SEQ. */
+		seq = __atomic_load_n (&p->work_seq, __ATOMIC_SEQ_CST);
+		__atomic_add_fetch (&p->sleeper_cnt, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n (&p->stop, __ATOMIC_SEQ_CST)) {
+			__atomic_sub_fetch (&p->sleeper_cnt, 1, __ATOMIC_SEQ_CST);
+			break;
+		}
+		t = find_work (w);
+		if (t == NULL)
+			futex_wait (&p->work_seq, seq);
+		__atomic_sub_fetch (&p->sleeper_cnt, 1, __ATOMIC_SEQ_CST);
+		if (t != NULL)
+			t->run (t, w);
+	}
+	worker_exit (&w->running);
+}
+
+/* Creates a pool of THREAD_CNT threads, counting the caller, or of
+   one thread for each CPU the process may use if THREAD_CNT is 0.
+   Returns the pool, or a null pointer if memory or threads are
+   short. */
+struct pool *
+pool_create (int thread_cnt) {
+	struct pool *p;
+	int i;
+
+	if (thread_cnt <= 0) {
+		int mask = sched_getaffinity (0);
+
+		thread_cnt = mask > 0 ? popcount (mask) : 1;
+	}
+	if (thread_cnt > POOL_THREAD_MAX)
+		thread_cnt = POOL_THREAD_MAX;
+
+	p = calloc (1, sizeof *p + thread_cnt * sizeof *p->workers);
+	if (p == NULL)
+		return NULL;
+	p->worker_cnt = thread_cnt;
+	for (i = 0; i < thread_cnt; i++) {
+		struct worker *w = &p->workers[i];
+
+		w->pool = p;
+		mutex_init (&w->lock);
+		w->seed = 2463534242u + i * 7919;
+	}
+
+	for (i = 1; i < thread_cnt; i++) {
+		struct worker *w = &p->workers[i];
+
+		w->stack = malloc (STACK_SIZE);
+		if (w->stack == NULL)
+			break;
+		w->running = 1;
+		if (clone (worker_main, w->stack + STACK_SIZE, w) < 0) {
+			w->running = 0;
+			break;
+		}
+	}
+	if (i < thread_cnt) {
+		pool_destroy (p);
+		return NULL;
+	}
+	return p;
+}
+
+/* Ends the threads of pool P, which has no work left, and frees
+   it. */
+void
+pool_destroy (struct pool *p) {
+	int i;
+
+	if (p == NULL)
+		return;
+	__atomic_store_n (&p->stop, true, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch (&p->work_seq, 1, __ATOMIC_SEQ_CST);
+	futex_wake (&p->work_seq, p->worker_cnt);
+
+	for (i = 1; i < p->worker_cnt; i++) {
+		struct worker *w = &p->workers[i];
+		unsigned r;
+
+		while ((r = __atomic_load_n (&w->running, __ATOMIC_ACQUIRE)) != 0)
+			futex_wait (&w->running, r);
+		free (w->stack);
+	}
+	free (p);
+}
+
+/* Returns the number of threads in P, counting the caller. */
+int
+pool_thread_cnt (const struct pool *p) {
+	return p->worker_cnt;
+}
+
+/* Returns the number of tasks in P run by a thread other than the
+   one that forked them. */
+long long
+pool_steal_cnt (const struct pool *p) {
+	return __atomic_load_n (&p->steal_cnt, __ATOMIC_RELAXED);
+}
+
+/* A range of parallel_for(). */
+struct range_task {
+	struct task task;
+	long begin, end, grain;
+	parallel_for_func *func;
+	void *aux;
+};
+
+static void for_range (struct worker *, long begin, long end, long grain,
+		parallel_for_func *, void *aux);
+
+/* Runs a range_task. */
+static void
+run_range (struct task *t_, struct worker *w) {
+	struct range_task *t = (struct range_task *) t_;
+
+	for_range (w, t->begin, t->end, t->grain, t->func, t->aux);
+	finish (t_);
+}
+
+/* Calls FUNC for the indexes from BEGIN up to END on W, forking
+   the upper half of the range while it is longer than GRAIN. */
+static void
+for_range (struct worker *w, long begin, long end, long grain,
+		parallel_for_func *func, void *aux) {
+	struct range_task halves[SPLIT_MAX];
+	unsigned pending = 0;
+	int n = 0;
+
+	while (end - begin > grain && n < SPLIT_MAX) {
+		long mid = begin + (end - begin) / 2;
+
+		halves[n] = (struct range_task) {
+			.task = { run_range, &pending },
+			.begin = mid, .end = end, .grain = grain,
+			.func = func, .aux = aux,
+		};
+		fork_task (w, &halves[n].task);
+		n++;
+		end = mid;
+	}
+	func (begin, end, aux);
+	join (w, &pending);
+}
+
+/* Calls FUNC (B, E, AUX) on the threads of P for ranges [B, E) that
+   together cover the indexes from BEGIN up to END, each at most
+   GRAIN long, and returns once all the calls have. */
+void
+parallel_for (struct pool *p, long begin, long end, long grain,
+		parallel_for_func *func, void *aux) {
+	if (grain < 1)
+		grain = 1;
+	if (begin < end)
+		for_range (&p->workers[0], begin, end, grain, func, aux);
+}
+
+/* A parallel_sort() call. */
+struct sort_job {
+	char *array;                /* Elements being sorted. */
+	char *tmp;                  /* As much room again, for merging. */
+	size_t size;                /* Size of an element. */
+	int (*compare) (const void *, const void *);
+};
+
+/* A part of a sort_job. */
+struct sort_task {
+	struct task task;
+	const struct sort_job *job;
+	size_t lo, hi;
+};
+
+static void sort_range (struct worker *, const struct sort_job *,
+		size_t lo, size_t hi);
+
+/* Runs a sort_task. */
+static void
+run_sort (struct task *t_, struct worker *w) {
+	struct sort_task *t = (struct sort_task *) t_;
+
+	sort_range (w, t->job, t->lo, t->hi);
+	finish (t_);
+}
+
+/* Merges the sorted elements of JOB from LO up to MID with those
+   from MID up to HI. */
+static void
+merge (const struct sort_job *job, size_t lo, size_t mid, size_t hi) {
+	size_t size = job->size;
+	char *a = job->array + lo * size, *a_end = job->array + mid * size;
+	char *b = a_end, *b_end = job->array + hi * size;
+	char *out = job->tmp + lo * size;
+
+	if (job->compare (a_end - size, b) <= 0)
+		return;
+	while (a < a_end && b < b_end) {
+		if (job->compare (b, a) < 0) {
+			memcpy (out, b, size);
+			b += size;
+		} else {
+			memcpy (out, a, size);
+			a += size;
+		}
+		out += size;
+	}
+	memcpy (out, a, a_end - a);
+	out += a_end - a;
+	memcpy (out, b, b_end - b);
+	memcpy (job->array + lo * size, job->tmp + lo * size, (hi - lo) * size);
+}
+
+/* Sorts the elements of JOB from LO up to HI on W, forking the sort
+   of the lower half and merging the halves once both are done. */
+static void
+sort_range (struct worker *w, const struct sort_job *job,
+		size_t lo, size_t hi) {
+	struct sort_task lower;
+	unsigned pending = 0;
+	size_t mid;
+
+	if (hi - lo <= SORT_GRAIN) {
+		qsort (job->array + lo * job->size, hi - lo, job->size, job->compare);
+		return;
+	}
+	mid = lo + (hi - lo) / 2;
+	lower = (struct sort_task) {
+		.task = { run_sort, &pending },
+		.job = job, .lo = lo, .hi = mid,
+	};
+	fork_task (w, &lower.task);
+	sort_range (w, job, mid, hi);
+	join (w, &pending);
+	merge (job, lo, mid, hi);
+}
+
+/* Sorts the CNT elements of SIZE bytes each in ARRAY into the order
+   given by COMPARE, as qsort() does, on the threads of P.  Pieces
+   of SORT_GRAIN elements are sorted with qsort() and then merged.
+   Returns false, leaving ARRAY as it was, if memory is short. */
+bool
+parallel_sort (struct pool *p, void *array, size_t cnt, size_t size,
+		int (*compare) (const void *, const void *)) {
+	struct sort_job job;
+
+	if (cnt <= SORT_GRAIN) {
+		qsort (array, cnt, size, compare);
+		return true;
+	}
+	if (size != 0 && cnt > SIZE_MAX / size)
+		return false;
+	job = (struct sort_job) {
+		.array = array,
+		.tmp = malloc (cnt * size),
+		.size = size,
+		.compare = compare,
+	};
+	if (job.tmp == NULL)
+		return false;
+	sort_range (&p->workers[0], &job, 0, cnt);
+	free (job.tmp);
+	return true;
+}
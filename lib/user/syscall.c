@@ -1,5 +1,6 @@
 #include <syscall.h>
 #include <stdint.h>
+#include <stdio.h>
 #include "../syscall-nr.h"
 
 // Declares a function named `syscall` that is always inlined, with the `static` keyword indicating internal linkage (only visible within the defining source file).
@@ -68,7 +69,7 @@ static __inline int64_t syscall (
 			((uint64_t) ARG2), 0, 0, 0))
 
 #define syscall4(NUMBER, ARG0, ARG1, ARG2, ARG3) ( \
-		syscall(((uint64_t *) NUMBER), \
+		syscall(((uint64_t) NUMBER), \
 			((uint64_t) ARG0), \
 			((uint64_t) ARG1), \
 			((uint64_t) ARG2), \
@@ -84,23 +85,27 @@ static __inline int64_t syscall (
 			0))
 void
 halt (void) {
+	stdout_flush ();
 	syscall0 (SYS_HALT);
 	NOT_REACHED ();
 }
 
 void
 exit (int status) {
+	stdout_flush ();
 	syscall1 (SYS_EXIT, status);
 	NOT_REACHED ();
 }
 
 pid_t
 fork (const char *thread_name){
+	stdout_flush ();
 	return (pid_t) syscall1 (SYS_FORK, thread_name);
 }
 
 int
 exec (const char *file) {
+	stdout_flush ();
 	return (pid_t) syscall1 (SYS_EXEC, file);
 }
 
@@ -124,13 +129,15 @@ open (const char *file) {
 	return syscall1 (SYS_OPEN, file);
 }
 
-int
+off_t
 filesize (int fd) {
 	return syscall1 (SYS_FILESIZE, fd);
 }
 
 int
 read (int fd, void *buffer, unsigned size) {
+	if (fd == STDIN_FILENO)
+		stdout_flush ();
 	return syscall3 (SYS_READ, fd, buffer, size);
 }
 
@@ -140,11 +147,11 @@ write (int fd, const void *buffer, unsigned size) {
 }
 
 void
-seek (int fd, unsigned position) {
+seek (int fd, off_t position) {
 	syscall2 (SYS_SEEK, fd, position);
 }
 
-unsigned
+off_t
 tell (int fd) {
 	return syscall1 (SYS_TELL, fd);
 }
@@ -169,6 +176,31 @@ munmap (void *addr) {
 	syscall1 (SYS_MUNMAP, addr);
 }
 
+int
+madvise (void *addr, size_t length, int advice) {
+	return syscall3 (SYS_MADVISE, addr, length, advice);
+}
+
+int
+msync (void *addr, size_t length, int flags) {
+	return syscall3 (SYS_MSYNC, addr, length, flags);
+}
+
+void *
+sbrk (intptr_t increment) {
+	return (void *) syscall1 (SYS_SBRK, increment);
+}
+
+int
+shm_open (const char *name, size_t size) {
+	return syscall2 (SYS_SHM_OPEN, name, size);
+}
+
+void *
+shm_map (int fd, void *addr) {
+	return (void *) syscall2 (SYS_SHM_MAP, fd, addr);
+}
+
 bool
 chdir (const char *dir) {
 	return syscall1 (SYS_CHDIR, dir);
@@ -208,3 +240,131 @@ int
 umount (const char *path) {
 	return syscall1 (SYS_UMOUNT, path);
 }
+
+int
+fsync (int fd) {
+	return syscall1 (SYS_FSYNC, fd);
+}
+
+int
+pread (int fd, void *buffer, unsigned size, off_t offset) {
+	return syscall4 (SYS_PREAD, fd, buffer, size, offset);
+}
+
+int
+pwrite (int fd, const void *buffer, unsigned size, off_t offset) {
+	return syscall4 (SYS_PWRITE, fd, buffer, size, offset);
+}
+
+int
+readv (int fd, const struct iovec *iov, int iovcnt) {
+	return syscall3 (SYS_READV, fd, iov, iovcnt);
+}
+
+int
+writev (int fd, const struct iovec *iov, int iovcnt) {
+	return syscall3 (SYS_WRITEV, fd, iov, iovcnt);
+}
+
+int
+copy_file_range (int fd_in, off_t off_in, int fd_out, off_t off_out,
+		unsigned length) {
+	return syscall5 (SYS_COPY_FILE_RANGE, fd_in, off_in, fd_out, off_out,
+			length);
+}
+
+int
+enter_ring (struct io_ring *ring) {
+	return syscall1 (SYS_ENTER_RING, ring);
+}
+
+int
+futex_wait (unsigned *addr, unsigned val) {
+	return syscall2 (SYS_FUTEX_WAIT, addr, val);
+}
+
+int
+futex_wake (unsigned *addr, int cnt) {
+	return syscall2 (SYS_FUTEX_WAKE, addr, cnt);
+}
+
+pid_t
+spawn (const char *path, char *const argv[]) {
+	return (pid_t) syscall2 (SYS_SPAWN, path, argv);
+}
+
+int
+pipe (int fds[2]) {
+	return syscall1 (SYS_PIPE, fds);
+}
+
+int
+poll (struct pollfd *fds, unsigned nfds, int timeout) {
+	return syscall3 (SYS_POLL, fds, nfds, timeout);
+}
+
+int
+fcntl (int fd, int cmd, int arg) {
+	return syscall3 (SYS_FCNTL, fd, cmd, arg);
+}
+
+int
+getrusage (int who, struct rusage *ru) {
+	return syscall2 (SYS_GETRUSAGE, who, ru);
+}
+
+int
+rgroup_create (const struct rgroup_limits *limits) {
+	return syscall1 (SYS_RGROUP_CREATE, limits);
+}
+
+int
+rgroup_join (int id) {
+	return syscall1 (SYS_RGROUP_JOIN, id);
+}
+
+int
+rgroup_stat (int id, struct rgroup_stat *st) {
+	return syscall2 (SYS_RGROUP_STAT, id, st);
+}
+
+int
+sched_setaffinity (pid_t tid, unsigned mask) {
+	return syscall2 (SYS_SCHED_SETAFFINITY, tid, mask);
+}
+
+int
+sched_getaffinity (pid_t tid) {
+	return syscall1 (SYS_SCHED_GETAFFINITY, tid);
+}
+
+int
+fallocate (int fd, off_t offset, off_t length) {
+	return syscall3 (SYS_FALLOCATE, fd, offset, length);
+}
+
+int
+readdir_batch (int fd, void *buffer, unsigned size) {
+	return syscall3 (SYS_READDIR_BATCH, fd, buffer, size);
+}
+
+/* Where a cloned thread goes when FN returns. */
+static void
+clone_return (void) {
+	exit (0);
+}
+
+pid_t
+clone (void (*fn) (void *), void *stack, void *arg) {
+	/* The kernel starts FN with its return address slot at the first
+	   16-byte boundary below STACK, less 8; fill it in first. */
+	uintptr_t top = ((uintptr_t) stack & ~(uintptr_t) 15) - 8;
+
+	*(void (**) (void)) top = clone_return;
+	return (pid_t) syscall3 (SYS_CLONE, fn, stack, arg);
+}
+
+bool
+memstat (int tag, struct memstat *st) {
+	return syscall2 (SYS_MEMSTAT, tag, st);
+}
@@ -0,0 +1,52 @@
+#include <time.h>
+#include <timepage.h>
+
+/* Reads the time page into *SNAP, retrying until no tick lands
+   in the middle of the copy.  Returns the time stamp counter as
+   of the copy. */
+static uint64_t
+snapshot (struct timepage *snap) {
+	const struct timepage *tp = TIMEPAGE_ADDR;
+	uint32_t seq;
+	uint32_t lo, hi;
+
+	do {
+		seq = tp->seq;
+		__asm __volatile ("" : : : "memory");
+		snap->freq = tp->freq;
+		snap->ticks = tp->ticks;
+		snap->tick_tsc = tp->tick_tsc;
+		snap->tsc_per_tick = tp->tsc_per_tick;
+		__asm __volatile ("rdtsc" : "=a" (lo), "=d" (hi) : : "memory");
+	} while ((seq & 1) != 0 || seq != tp->seq);
+	return ((uint64_t) hi << 32) | lo;
+}
+
+/* Returns the number of timer ticks since the OS booted. */
+int64_t
+time_ticks (void) {
+	struct timepage snap;
+
+	snapshot (&snap);
+	return snap.ticks;
+}
+
+/* Returns nanoseconds since the OS booted, interpolated within the
+   current tick with the time stamp counter once the kernel has
+   calibrated it, and otherwise to tick resolution. */
+uint64_t
+time_ns (void) {
+	struct timepage snap;
+	uint64_t tsc = snapshot (&snap);
+	uint64_t ns_per_tick = 1000000000 / snap.freq;
+	uint64_t ns = snap.ticks * ns_per_tick;
+
+	if (snap.tsc_per_tick != 0) {
+		uint64_t delta = tsc - snap.tick_tsc;
+
+		if (delta > snap.tsc_per_tick)
+			delta = snap.tsc_per_tick;
+		ns += delta * ns_per_tick / snap.tsc_per_tick;
+	}
+	return ns;
+}
@@ -0,0 +1,36 @@
+/* Measures exec().  One operation forks a child that executes
+   bench-child, which exits at once, and waits for it. */
+
+#include <syscall.h>
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define EXEC_OPS 10
+
+static void
+exec_ops (unsigned ops, void *aux UNUSED)
+{
+  unsigned i;
+
+  for (i = 0; i < ops; i++)
+    {
+      pid_t pid = fork ("child");
+
+      if (pid == 0)
+        {
+          exec ("bench-child");
+          exit (1);
+        }
+      if (pid < 0)
+        fail ("fork failed");
+      if (wait (pid) != 0)
+        fail ("bench-child did not exit cleanly");
+    }
+}
+
+void
+test_main (void)
+{
+  bench_run ("exec", exec_ops, EXEC_OPS, NULL);
+}
@@ -0,0 +1,35 @@
+/* Measures a page fault on anonymous memory.  One operation
+   touches a page of the BSS for the first time, which faults it
+   in where pages are loaded lazily.  Each run touches its own
+   pages, since a page faults only once.  Without VM the BSS is
+   loaded eagerly, so this reports the cost of the write alone. */
+
+#include <stdint.h>
+#include <syscall.h>
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define FAULT_OPS 64
+
+static uint8_t pages[BENCH_TRIALS + 1][FAULT_OPS][PAGE_SIZE];
+
+static void
+fault_ops (unsigned ops, void *aux)
+{
+  unsigned *run = aux;
+  unsigned i;
+
+  for (i = 0; i < ops; i++)
+    pages[*run][i][0] = 1;
+  ++*run;
+}
+
+void
+test_main (void)
+{
+  unsigned run = 0;
+
+  bench_run ("fault-anon", fault_ops, FAULT_OPS, &run);
+}
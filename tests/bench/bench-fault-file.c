@@ -0,0 +1,52 @@
+/* Measures a page fault on a memory-mapped file.  One operation
+   reads a page of a freshly mapped file for the first time.  Each
+   run maps the file again, so every page faults.  Kernels without
+   mmap() report nothing. */
+
+#include <stdint.h>
+#include <syscall.h>
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define FAULT_OPS 64
+#define MAP_ADDR ((void *) 0x10000000)
+
+static void
+fault_ops (unsigned ops, void *aux)
+{
+  int fd = *(int *) aux;
+  volatile uint8_t *map = mmap (MAP_ADDR, ops * PAGE_SIZE, 0, fd, 0);
+  unsigned i;
+
+  if (map == MAP_FAILED)
+    fail ("mmap failed");
+  for (i = 0; i < ops; i++)
+    (void) map[i * PAGE_SIZE];
+  munmap ((void *) map);
+}
+
+void
+test_main (void)
+{
+  static uint8_t page[PAGE_SIZE];
+  void *map;
+  int fd, i;
+
+  CHECK (create ("bench.dat", 0), "create \"bench.dat\"");
+  CHECK ((fd = open ("bench.dat")) > 1, "open \"bench.dat\"");
+  for (i = 0; i < FAULT_OPS; i++)
+    if (write (fd, page, PAGE_SIZE) != PAGE_SIZE)
+      fail ("write failed");
+
+  map = mmap (MAP_ADDR, PAGE_SIZE, 0, fd, 0);
+  if (map == MAP_FAILED)
+    {
+      msg ("mmap not supported, skipping");
+      return;
+    }
+  munmap (map);
+  bench_run ("fault-file", fault_ops, FAULT_OPS, &fd);
+  close (fd);
+}
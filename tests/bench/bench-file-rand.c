@@ -0,0 +1,54 @@
+/* Measures random file access.  One operation writes, or reads,
+   a 512-byte block at a random block offset in a 128 kB file. */
+
+#include <random.h>
+#include <stdint.h>
+#include <syscall.h>
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BLOCK_SIZE 512
+#define FILE_OPS 256
+
+static uint8_t block[BLOCK_SIZE];
+
+static off_t
+random_offset (void)
+{
+  return random_ulong () % FILE_OPS * BLOCK_SIZE;
+}
+
+static void
+write_ops (unsigned ops, void *aux)
+{
+  int fd = *(int *) aux;
+  unsigned i;
+
+  for (i = 0; i < ops; i++)
+    if (pwrite (fd, block, BLOCK_SIZE, random_offset ()) != BLOCK_SIZE)
+      fail ("pwrite failed");
+}
+
+static void
+read_ops (unsigned ops, void *aux)
+{
+  int fd = *(int *) aux;
+  unsigned i;
+
+  for (i = 0; i < ops; i++)
+    if (pread (fd, block, BLOCK_SIZE, random_offset ()) != BLOCK_SIZE)
+      fail ("pread failed");
+}
+
+void
+test_main (void)
+{
+  int fd;
+
+  CHECK (create ("bench.dat", FILE_OPS * BLOCK_SIZE), "create \"bench.dat\"");
+  CHECK ((fd = open ("bench.dat")) > 1, "open \"bench.dat\"");
+  bench_run ("file-rand-write", write_ops, FILE_OPS, &fd);
+  bench_run ("file-rand-read", read_ops, FILE_OPS, &fd);
+  close (fd);
+}
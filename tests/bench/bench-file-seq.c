@@ -0,0 +1,49 @@
+/* Measures sequential file access.  One operation writes, or
+   reads, the next 512-byte block of a 128 kB file. */
+
+#include <stdint.h>
+#include <syscall.h>
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BLOCK_SIZE 512
+#define FILE_OPS 256
+
+static uint8_t block[BLOCK_SIZE];
+
+static void
+write_ops (unsigned ops, void *aux)
+{
+  int fd = *(int *) aux;
+  unsigned i;
+
+  seek (fd, 0);
+  for (i = 0; i < ops; i++)
+    if (write (fd, block, BLOCK_SIZE) != BLOCK_SIZE)
+      fail ("write failed");
+}
+
+static void
+read_ops (unsigned ops, void *aux)
+{
+  int fd = *(int *) aux;
+  unsigned i;
+
+  seek (fd, 0);
+  for (i = 0; i < ops; i++)
+    if (read (fd, block, BLOCK_SIZE) != BLOCK_SIZE)
+      fail ("read failed");
+}
+
+void
+test_main (void)
+{
+  int fd;
+
+  CHECK (create ("bench.dat", 0), "create \"bench.dat\"");
+  CHECK ((fd = open ("bench.dat")) > 1, "open \"bench.dat\"");
+  bench_run ("file-seq-write", write_ops, FILE_OPS, &fd);
+  bench_run ("file-seq-read", read_ops, FILE_OPS, &fd);
+  close (fd);
+}
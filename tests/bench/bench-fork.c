@@ -0,0 +1,33 @@
+/* Measures fork() and wait().  One operation forks a child that
+   exits at once and waits for it. */
+
+#include <syscall.h>
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FORK_OPS 20
+
+static void
+fork_ops (unsigned ops, void *aux UNUSED)
+{
+  unsigned i;
+
+  for (i = 0; i < ops; i++)
+    {
+      pid_t pid = fork ("child");
+
+      if (pid == 0)
+        exit (0);
+      if (pid < 0)
+        fail ("fork failed");
+      if (wait (pid) != 0)
+        fail ("child did not exit cleanly");
+    }
+}
+
+void
+test_main (void)
+{
+  bench_run ("fork", fork_ops, FORK_OPS, NULL);
+}
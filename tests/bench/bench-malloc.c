@@ -0,0 +1,32 @@
+/* Measures malloc() and free().  One operation allocates a block
+   of one of several sizes, from 16 bytes to 1 kB, and frees it
+   again. */
+
+#include <debug.h>
+#include <stdlib.h>
+#include "tests/bench/bench.h"
+#include "tests/threads/tests.h"
+#include "threads/malloc.h"
+
+#define MALLOC_OPS 10000
+
+static void
+malloc_ops (unsigned ops, void *aux UNUSED)
+{
+  unsigned i;
+
+  for (i = 0; i < ops; i++)
+    {
+      void *p = malloc (16 << (i % 7));
+
+      if (p == NULL)
+        fail ("malloc failed");
+      free (p);
+    }
+}
+
+void
+test_bench_malloc (void)
+{
+  bench_run ("malloc", malloc_ops, MALLOC_OPS, NULL);
+}
@@ -0,0 +1,31 @@
+/* Measures palloc_get_page() and palloc_free_page() on the
+   kernel pool.  One operation allocates a page and frees it
+   again. */
+
+#include <debug.h>
+#include "tests/bench/bench.h"
+#include "tests/threads/tests.h"
+#include "threads/palloc.h"
+
+#define PALLOC_OPS 10000
+
+static void
+palloc_ops (unsigned ops, void *aux UNUSED)
+{
+  unsigned i;
+
+  for (i = 0; i < ops; i++)
+    {
+      void *page = palloc_get_page (0);
+
+      if (page == NULL)
+        fail ("palloc_get_page failed");
+      palloc_free_page (page);
+    }
+}
+
+void
+test_bench_palloc (void)
+{
+  bench_run ("palloc", palloc_ops, PALLOC_OPS, NULL);
+}
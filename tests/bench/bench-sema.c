@@ -0,0 +1,51 @@
+/* Measures a semaphore handoff.  The main thread ups one
+   semaphore and downs another, which a partner thread ups after
+   downing the first, so one operation is two handoffs, each
+   waking the other thread. */
+
+#include <debug.h>
+#include "tests/bench/bench.h"
+#include "tests/threads/tests.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define SEMA_OPS 10000
+
+static struct semaphore ping, pong;
+
+static void
+partner (void *aux_)
+{
+  unsigned *ops = aux_;
+  unsigned i;
+
+  for (i = 0; i < *ops; i++)
+    {
+      sema_down (&ping);
+      sema_up (&pong);
+    }
+}
+
+static void
+sema_ops (unsigned ops, void *aux UNUSED)
+{
+  unsigned i;
+
+  for (i = 0; i < ops; i++)
+    {
+      sema_up (&ping);
+      sema_down (&pong);
+    }
+}
+
+void
+test_bench_sema (void)
+{
+  /* The warm-up run and the timed trials. */
+  static unsigned total = SEMA_OPS * (BENCH_TRIALS + 1);
+
+  sema_init (&ping, 0);
+  sema_init (&pong, 0);
+  thread_create ("partner", thread_get_priority (), partner, &total);
+  bench_run ("sema", sema_ops, SEMA_OPS, NULL);
+}
@@ -0,0 +1,151 @@
+/* Compares ways of sorting 128 kB of random bytes.  One operation
+   sorts a fresh copy of the data:
+
+     sort-seq    with qsort() in one thread;
+     sort-fork   in CHUNK_CNT chunks, each by a forked child that
+                 sends its chunk back through a pipe, then merged,
+                 in the manner of the page-merge-par test;
+     sort-pool   with parallel_sort() on a thread pool of one thread
+                 per CPU, which needs the user heap and so VM. */
+
+#include <pool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/arc4.h"
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define DATA_SIZE (128 * 1024)
+#define CHUNK_CNT 8
+#define CHUNK_SIZE (DATA_SIZE / CHUNK_CNT)
+#define SORT_OPS 1
+
+static unsigned char data[DATA_SIZE], buf[DATA_SIZE], out[DATA_SIZE];
+
+/* Orders bytes for qsort(). */
+static int
+order_bytes (const void *a_, const void *b_)
+{
+  const unsigned char *a = a_;
+  const unsigned char *b = b_;
+
+  return *a < *b ? -1 : *a > *b;
+}
+
+static void
+sort_seq (unsigned ops, void *aux UNUSED)
+{
+  unsigned i;
+
+  for (i = 0; i < ops; i++)
+    {
+      memcpy (buf, data, DATA_SIZE);
+      qsort (buf, DATA_SIZE, 1, order_bytes);
+    }
+}
+
+/* Merges the CHUNK_CNT sorted chunks of BUF into OUT. */
+static void
+merge (void)
+{
+  unsigned char *mp[CHUNK_CNT];
+  size_t mp_left = CHUNK_CNT, i;
+  unsigned char *op = out;
+
+  for (i = 0; i < CHUNK_CNT; i++)
+    mp[i] = buf + CHUNK_SIZE * i;
+  while (mp_left > 0)
+    {
+      size_t min = 0;
+
+      for (i = 1; i < mp_left; i++)
+        if (*mp[i] < *mp[min])
+          min = i;
+      *op++ = *mp[min];
+      if ((++mp[min] - buf) % CHUNK_SIZE == 0)
+        mp[min] = mp[--mp_left];
+    }
+}
+
+static void
+sort_fork (unsigned ops, void *aux UNUSED)
+{
+  unsigned i;
+  int c;
+
+  for (i = 0; i < ops; i++)
+    {
+      pid_t children[CHUNK_CNT];
+      int fds[CHUNK_CNT][2];
+
+      memcpy (buf, data, DATA_SIZE);
+      for (c = 0; c < CHUNK_CNT; c++)
+        {
+          unsigned char *chunk = buf + CHUNK_SIZE * c;
+
+          if (pipe (fds[c]) != 0)
+            fail ("pipe failed");
+          children[c] = fork ("child");
+          if (children[c] == 0)
+            {
+              qsort (chunk, CHUNK_SIZE, 1, order_bytes);
+              exit (write (fds[c][1], chunk, CHUNK_SIZE) == CHUNK_SIZE
+                    ? 0 : 1);
+            }
+          if (children[c] < 0)
+            fail ("fork failed");
+          close (fds[c][1]);
+        }
+      for (c = 0; c < CHUNK_CNT; c++)
+        {
+          unsigned char *chunk = buf + CHUNK_SIZE * c;
+          int got = 0, n;
+
+          while (got < CHUNK_SIZE
+                 && (n = read (fds[c][0], chunk + got, CHUNK_SIZE - got)) > 0)
+            got += n;
+          close (fds[c][0]);
+          if (wait (children[c]) != 0 || got != CHUNK_SIZE)
+            fail ("child %d did not sort its chunk", c);
+        }
+      merge ();
+    }
+}
+
+static void
+sort_pool (unsigned ops, void *aux)
+{
+  struct pool *pool = aux;
+  unsigned i;
+
+  for (i = 0; i < ops; i++)
+    {
+      memcpy (buf, data, DATA_SIZE);
+      if (!parallel_sort (pool, buf, DATA_SIZE, 1, order_bytes))
+        fail ("parallel_sort failed");
+    }
+}
+
+void
+test_main (void)
+{
+  struct arc4 arc4;
+  struct pool *pool;
+
+  arc4_init (&arc4, "foobar", 6);
+  arc4_crypt (&arc4, data, sizeof data);
+
+  bench_run ("sort-seq", sort_seq, SORT_OPS, NULL);
+  bench_run ("sort-fork", sort_fork, SORT_OPS, NULL);
+
+  pool = pool_create (0);
+  if (pool == NULL)
+    {
+      msg ("sort-pool skipped: no thread pool");
+      return;
+    }
+  bench_run ("sort-pool", sort_pool, SORT_OPS, pool);
+  pool_destroy (pool);
+}
@@ -0,0 +1,30 @@
+/* Measures a system call round trip with tell(), which does
+   little more than look up its file descriptor. */
+
+#include <syscall.h>
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SYSCALL_OPS 10000
+
+static void
+syscall_ops (unsigned ops, void *aux)
+{
+  int fd = *(int *) aux;
+  unsigned i;
+
+  for (i = 0; i < ops; i++)
+    tell (fd);
+}
+
+void
+test_main (void)
+{
+  int fd;
+
+  CHECK (create ("bench.dat", 0), "create \"bench.dat\"");
+  CHECK ((fd = open ("bench.dat")) > 1, "open \"bench.dat\"");
+  bench_run ("syscall", syscall_ops, SYSCALL_OPS, &fd);
+  close (fd);
+}
@@ -0,0 +1,43 @@
+/* Measures a context switch.  The main thread and a partner of
+   the same priority yield to each other, so that each
+   thread_yield() switches to the other thread; one operation is
+   a round trip of two switches. */
+
+#include <debug.h>
+#include "tests/bench/bench.h"
+#include "tests/threads/tests.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define YIELD_OPS 10000
+
+static volatile bool stop;
+static struct semaphore done;
+
+static void
+partner (void *aux UNUSED)
+{
+  while (!stop)
+    thread_yield ();
+  sema_up (&done);
+}
+
+static void
+yield_ops (unsigned ops, void *aux UNUSED)
+{
+  unsigned i;
+
+  for (i = 0; i < ops; i++)
+    thread_yield ();
+}
+
+void
+test_bench_yield (void)
+{
+  stop = false;
+  sema_init (&done, 0);
+  thread_create ("partner", thread_get_priority (), partner, NULL);
+  bench_run ("yield", yield_ops, YIELD_OPS, NULL);
+  stop = true;
+  sema_down (&done);
+}
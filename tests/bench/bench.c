@@ -0,0 +1,57 @@
+/* Timing and reporting shared by the kernel and user benchmarks.
+
+   Each benchmark prints one line of the form
+
+     BENCH <name> ops=<N> min=<C> median=<C> max=<C>
+
+   where each C is TSC cycles per operation over one of the
+   BENCH_TRIALS trials of N operations each.  The minimum is the
+   figure to compare across kernel changes; the spread between it
+   and the maximum shows how noisy the run was. */
+
+#include "tests/bench/bench.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Runs FUNC once to warm up caches and allocators, then
+   BENCH_TRIALS more times, timing each, and reports the result
+   as NAME, for OPS operations per run. */
+void
+bench_run (const char *name, bench_func *func, unsigned ops, void *aux)
+{
+  uint64_t cycles[BENCH_TRIALS];
+  int i;
+
+  func (ops, aux);
+  for (i = 0; i < BENCH_TRIALS; i++)
+    {
+      uint64_t start = bench_tsc ();
+      func (ops, aux);
+      cycles[i] = bench_tsc () - start;
+    }
+  bench_report (name, ops, cycles);
+}
+
+/* Orders cycle counts for qsort(). */
+static int
+compare_cycles (const void *a_, const void *b_)
+{
+  const uint64_t *a = a_;
+  const uint64_t *b = b_;
+
+  return *a < *b ? -1 : *a > *b;
+}
+
+/* Prints the BENCH line for benchmark NAME, whose BENCH_TRIALS
+   trials of OPS operations each took CYCLES, which is sorted. */
+void
+bench_report (const char *name, unsigned ops, uint64_t cycles[BENCH_TRIALS])
+{
+  if (ops == 0)
+    ops = 1;
+  qsort (cycles, BENCH_TRIALS, sizeof *cycles, compare_cycles);
+  printf ("BENCH %s ops=%u min=%"PRIu64" median=%"PRIu64" max=%"PRIu64"\n",
+          name, ops, cycles[0] / ops, cycles[BENCH_TRIALS / 2] / ops,
+          cycles[BENCH_TRIALS - 1] / ops);
+}
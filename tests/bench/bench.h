@@ -0,0 +1,27 @@
+#ifndef TESTS_BENCH_BENCH_H
+#define TESTS_BENCH_BENCH_H
+
+#include <stdint.h>
+
+/* Timed trials per benchmark, after one untimed warm-up run. */
+#define BENCH_TRIALS 5
+
+/* Runs OPS operations of a benchmark.  AUX is as passed to
+   bench_run(). */
+typedef void bench_func (unsigned ops, void *aux);
+
+void bench_run (const char *name, bench_func *, unsigned ops, void *aux);
+void bench_report (const char *name, unsigned ops,
+                   uint64_t cycles[BENCH_TRIALS]);
+
+/* Returns the time stamp counter.  Works in user mode too. */
+static inline uint64_t
+bench_tsc (void)
+{
+  uint32_t lo, hi;
+
+  asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
+}
+
+#endif /* tests/bench/bench.h */
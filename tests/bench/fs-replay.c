@@ -0,0 +1,422 @@
+/* Replays a file system trace recorded by "pintos --fstrace FILE"
+   and reports the throughput and latency of the calls replayed.
+
+   Usage: fs-replay TRACE [original|max]
+
+   Each process in the trace becomes a thread, made with clone(),
+   that issues that process's calls in order on its own descriptors.
+   The files stand in for the traced ones by the hash of their paths,
+   as r<hash>; those the trace opens without creating are created
+   first, long enough for the reads made of them.  In "original"
+   mode, the default, each call waits for its time in the trace, so
+   the replay has the recorded think time; in "max" mode the calls
+   go back to back.  Seeks are replayed too, but reads and writes
+   use the offsets recorded, so a lost seek changes nothing. */
+
+#include <fstrace.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include <time.h>
+
+/* Records replayed, at most. */
+#define REPLAY_MAX 16384
+
+/* Processes, files and descriptors in the trace, at most. */
+#define STREAM_MAX 8
+#define FILE_MAX 64
+#define FD_MAX 128
+
+/* Bytes moved per pread() or pwrite(), at most. */
+#define XFER_MAX 16384
+
+static struct fstrace_header header;
+static struct fstrace_record records[REPLAY_MAX];
+static uint64_t latencies[REPLAY_MAX];  /* Replayed, by record; 0 if not. */
+static size_t record_cnt;
+
+/* A file of the trace. */
+struct replay_file
+  {
+    int64_t hash;               /* Hash of its path in the trace. */
+    int64_t extent;             /* Bytes the trace reaches. */
+    bool created;               /* First met as a create()? */
+    char name[12];              /* "r" and the hash in hex. */
+  };
+
+static struct replay_file files[FILE_MAX];
+static int file_cnt;
+
+/* The calls of one traced process. */
+struct stream
+  {
+    int32_t pid;                /* Traced process. */
+    int fds[FD_MAX];            /* Traced descriptor to our own, or -1. */
+    uint64_t bytes;             /* Bytes read and written. */
+    unsigned op_cnt;            /* Calls issued. */
+    uint8_t buf[XFER_MAX];
+  };
+
+static struct stream streams[STREAM_MAX];
+static int stream_cnt;
+static char stacks[STREAM_MAX][4096] __attribute__ ((aligned (16)));
+static unsigned running;
+
+static bool paced;              /* Keep to the trace's timing? */
+static uint64_t start_ns;       /* When the replay began. */
+
+/* Returns the file whose path hashes to HASH, adding it if new. */
+static struct replay_file *
+lookup_file (int64_t hash, bool create)
+{
+  struct replay_file *f;
+  int i;
+
+  for (i = 0; i < file_cnt; i++)
+    if (files[i].hash == hash)
+      return &files[i];
+  if (file_cnt == FILE_MAX)
+    return NULL;
+  f = &files[file_cnt++];
+  f->hash = hash;
+  f->extent = 0;
+  f->created = create;
+  snprintf (f->name, sizeof f->name, "r%08x", (unsigned) hash);
+  return f;
+}
+
+/* Returns the stream for process PID, adding it if new. */
+static struct stream *
+lookup_stream (int32_t pid)
+{
+  struct stream *s;
+  int i;
+
+  for (i = 0; i < stream_cnt; i++)
+    if (streams[i].pid == pid)
+      return &streams[i];
+  if (stream_cnt == STREAM_MAX)
+    return NULL;
+  s = &streams[stream_cnt++];
+  s->pid = pid;
+  for (i = 0; i < FD_MAX; i++)
+    s->fds[i] = -1;
+  return s;
+}
+
+/* Reads the trace from PATH.  Returns false, saying why, if it
+   cannot be used. */
+static bool
+load_trace (const char *path)
+{
+  int fd = open (path);
+  size_t bytes;
+
+  if (fd < 0)
+    {
+      printf ("fs-replay: cannot open %s\n", path);
+      return false;
+    }
+  if (pread (fd, &header, sizeof header, 0) != sizeof header
+      || memcmp (header.magic, "FST", 4)
+      || header.record_size != sizeof (struct fstrace_record))
+    {
+      printf ("fs-replay: %s is not a file system trace\n", path);
+      close (fd);
+      return false;
+    }
+  record_cnt = header.record_cnt < REPLAY_MAX ? header.record_cnt : REPLAY_MAX;
+  bytes = record_cnt * sizeof *records;
+  if (pread (fd, records, bytes, 512) != (int) bytes)
+    {
+      printf ("fs-replay: %s is truncated\n", path);
+      close (fd);
+      return false;
+    }
+  close (fd);
+  if (header.record_cnt > record_cnt)
+    printf ("fs-replay: replaying the first %zu of %llu calls\n",
+            record_cnt, (unsigned long long) header.record_cnt);
+  return true;
+}
+
+/* Finds the processes and files of the trace, and the extent of
+   each file, following the descriptors each process opens.  Returns
+   false if there are too many. */
+static bool
+scan_trace (void)
+{
+  int16_t fds[STREAM_MAX][FD_MAX];
+  size_t i;
+
+  memset (fds, 0xff, sizeof fds);
+  for (i = 0; i < record_cnt; i++)
+    {
+      const struct fstrace_record *r = &records[i];
+      struct stream *s = lookup_stream (r->pid);
+      struct replay_file *f = NULL;
+      int16_t *map;
+      int64_t end = 0;
+
+      if (s == NULL)
+        {
+          printf ("fs-replay: more than %d processes\n", STREAM_MAX);
+          return false;
+        }
+      map = fds[s - streams];
+      if (r->op == FSTRACE_CREATE || r->op == FSTRACE_REMOVE
+          || r->op == FSTRACE_OPEN)
+        {
+          f = lookup_file (r->offset, r->op == FSTRACE_CREATE);
+          if (f == NULL)
+            {
+              printf ("fs-replay: more than %d files\n", FILE_MAX);
+              return false;
+            }
+          if (r->op == FSTRACE_OPEN && r->result >= 0 && r->result < FD_MAX)
+            map[r->result] = f - files;
+          end = r->op != FSTRACE_REMOVE ? (int64_t) r->size : 0;
+        }
+      else if (r->fd >= 0 && r->fd < FD_MAX && map[r->fd] >= 0)
+        {
+          f = &files[map[r->fd]];
+          if (r->op == FSTRACE_CLOSE)
+            map[r->fd] = -1;
+          end = r->op == FSTRACE_READ || r->op == FSTRACE_WRITE
+                || r->op == FSTRACE_FALLOCATE ? r->offset + r->size : 0;
+        }
+      if (f != NULL && end > f->extent)
+        f->extent = end;
+    }
+  return true;
+}
+
+/* Creates the files that the trace opens without creating them, and
+   removes any left over from a run before. */
+static bool
+make_files (void)
+{
+  int i;
+
+  for (i = 0; i < file_cnt; i++)
+    {
+      struct replay_file *f = &files[i];
+
+      remove (f->name);
+      if (!f->created && !create (f->name, f->extent))
+        {
+          printf ("fs-replay: cannot create %s, %lld bytes\n",
+                  f->name, (long long) f->extent);
+          return false;
+        }
+    }
+  return true;
+}
+
+/* Waits until TIME nanoseconds into the replay, sleeping while that
+   is more than a couple of milliseconds away. */
+static void
+pace (uint64_t time)
+{
+  for (;;)
+    {
+      uint64_t now = time_ns () - start_ns;
+
+      if (now >= time)
+        return;
+      if (time - now > 2000000)
+        poll (NULL, 0, (time - now) / 1000000 - 1);
+    }
+}
+
+/* Moves SIZE bytes at OFS in FD through S's buffer. */
+static int
+transfer (struct stream *s, int fd, bool read, uint32_t size, int64_t ofs)
+{
+  uint32_t done = 0;
+
+  while (done < size)
+    {
+      uint32_t chunk = size - done < XFER_MAX ? size - done : XFER_MAX;
+      int moved = read ? pread (fd, s->buf, chunk, ofs + done)
+                       : pwrite (fd, s->buf, chunk, ofs + done);
+
+      if (moved <= 0)
+        break;
+      done += moved;
+      if ((uint32_t) moved < chunk)
+        break;
+    }
+  s->bytes += done;
+  return done;
+}
+
+/* Issues record R of stream S. */
+static void
+issue (struct stream *s, const struct fstrace_record *r)
+{
+  struct replay_file *f = NULL;
+  int fd = -1;
+
+  if (r->fd < 0)
+    f = lookup_file (r->offset, false);
+  else if (r->fd < FD_MAX)
+    fd = s->fds[r->fd];
+
+  switch (r->op)
+    {
+    case FSTRACE_CREATE:
+      create (f->name, r->size);
+      break;
+    case FSTRACE_REMOVE:
+      remove (f->name);
+      break;
+    case FSTRACE_OPEN:
+      fd = open (f->name);
+      if (r->result >= 0 && r->result < FD_MAX)
+        {
+          if (s->fds[r->result] >= 0)
+            close (s->fds[r->result]);
+          s->fds[r->result] = fd;
+        }
+      else if (fd >= 0)
+        close (fd);
+      break;
+    case FSTRACE_CLOSE:
+      if (fd >= 0)
+        {
+          close (fd);
+          s->fds[r->fd] = -1;
+        }
+      break;
+    case FSTRACE_READ:
+    case FSTRACE_WRITE:
+      if (fd >= 0)
+        transfer (s, fd, r->op == FSTRACE_READ, r->size, r->offset);
+      break;
+    case FSTRACE_SEEK:
+      if (fd >= 0)
+        seek (fd, r->offset);
+      break;
+    case FSTRACE_FSYNC:
+      if (fd >= 0)
+        fsync (fd);
+      break;
+    case FSTRACE_FALLOCATE:
+      if (fd >= 0)
+        fallocate (fd, r->offset, r->size);
+      break;
+    }
+}
+
+/* Replays the calls of stream AUX. */
+static void
+replay (void *aux)
+{
+  struct stream *s = aux;
+  size_t i;
+  int fd;
+
+  for (i = 0; i < record_cnt; i++)
+    if (records[i].pid == s->pid && records[i].op < FSTRACE_OP_CNT)
+      {
+        uint64_t begin;
+
+        if (paced)
+          pace (records[i].time);
+        begin = time_ns ();
+        issue (s, &records[i]);
+        latencies[i] = time_ns () - begin + 1;
+        s->op_cnt++;
+      }
+  for (fd = 0; fd < FD_MAX; fd++)
+    if (s->fds[fd] >= 0)
+      close (s->fds[fd]);
+
+  if (__atomic_sub_fetch (&running, 1, __ATOMIC_RELEASE) == 0)
+    futex_wake (&running, 1);
+}
+
+static int
+order_latency (const void *a_, const void *b_)
+{
+  uint64_t a = *(const uint64_t *) a_, b = *(const uint64_t *) b_;
+
+  return a < b ? -1 : a > b;
+}
+
+/* Sorts the CNT latencies in TIMES and prints their percentiles, in
+   microseconds, as WHAT. */
+static void
+report_latency (const char *what, uint64_t *times, size_t cnt)
+{
+  if (cnt == 0)
+    return;
+  qsort (times, cnt, sizeof *times, order_latency);
+  printf ("fs-replay: %s latency p50 %llu us, p90 %llu us, "
+          "p99 %llu us, max %llu us\n", what,
+          (unsigned long long) times[cnt / 2] / 1000,
+          (unsigned long long) times[cnt * 9 / 10] / 1000,
+          (unsigned long long) times[cnt * 99 / 100] / 1000,
+          (unsigned long long) times[cnt - 1] / 1000);
+}
+
+int
+main (int argc, char *argv[])
+{
+  uint64_t elapsed, bytes = 0;
+  unsigned op_cnt = 0, r;
+  size_t i, cnt;
+  int j;
+
+  if (argc < 2 || argc > 3
+      || (argc == 3 && strcmp (argv[2], "original")
+          && strcmp (argv[2], "max")))
+    {
+      printf ("usage: fs-replay TRACE [original|max]\n");
+      return EXIT_FAILURE;
+    }
+  paced = argc < 3 || !strcmp (argv[2], "original");
+  if (!load_trace (argv[1]) || !scan_trace () || !make_files ())
+    return EXIT_FAILURE;
+
+  running = stream_cnt;
+  start_ns = time_ns ();
+  for (j = 0; j < stream_cnt; j++)
+    if (clone (replay, stacks[j] + sizeof stacks[j], &streams[j]) < 0)
+      {
+        printf ("fs-replay: cannot start thread %d\n", j);
+        exit (EXIT_FAILURE);
+      }
+  while ((r = __atomic_load_n (&running, __ATOMIC_ACQUIRE)) != 0)
+    futex_wait (&running, r);
+  elapsed = time_ns () - start_ns;
+  if (elapsed == 0)
+    elapsed = 1;
+
+  for (j = 0; j < stream_cnt; j++)
+    {
+      op_cnt += streams[j].op_cnt;
+      bytes += streams[j].bytes;
+    }
+  printf ("fs-replay: %u calls from %d processes on %d files, %s timing\n",
+          op_cnt, stream_cnt, file_cnt, paced ? "original" : "max");
+  printf ("fs-replay: %llu ms, %llu calls/s, %llu kB/s\n",
+          (unsigned long long) elapsed / 1000000,
+          (unsigned long long) op_cnt * 1000000000 / elapsed,
+          (unsigned long long) (bytes * 1000000000 / elapsed) >> 10);
+
+  /* Replayed latencies, then the recorded ones in their place. */
+  for (i = cnt = 0; i < record_cnt; i++)
+    if (latencies[i] != 0)
+      latencies[cnt++] = latencies[i] - 1;
+  report_latency ("replayed", latencies, cnt);
+  for (i = 0; i < record_cnt; i++)
+    latencies[i] = records[i].latency;
+  report_latency ("recorded", latencies, record_cnt);
+
+  for (j = 0; j < file_cnt; j++)
+    remove (files[j].name);
+  return EXIT_SUCCESS;
+}
@@ -58,6 +58,29 @@ static unsigned long crctab[] = {
   0xa2f33668, 0xbcb4666d, 0xb8757bda, 0xb5365d03, 0xb1f740b4
 };
 
+/* crcslice[K][I] is the CRC of byte I followed by K zero bytes,
+   for processing eight bytes per step ("slicing-by-8").  The POSIX
+   checksum shifts most significant bit first, unlike CRC32C, so the
+   crc32 instruction does not apply. */
+static uint32_t crcslice[8][256];
+static int crcslice_ready;
+
+static void
+crcslice_init (void)
+{
+  int i, k;
+
+  for (i = 0; i < 256; i++)
+    crcslice[0][i] = crctab[i];
+  for (k = 1; k < 8; k++)
+    for (i = 0; i < 256; i++)
+      {
+        uint32_t prev = crcslice[k - 1][i];
+        crcslice[k][i] = (prev << 8) ^ crctab[prev >> 24];
+      }
+  crcslice_ready = 1;
+}
+
 /* This is the algorithm used by the Posix `cksum' utility. */
 unsigned long
 cksum (const void *b_, size_t n)
@@ -65,7 +88,22 @@ cksum (const void *b_, size_t n)
   const unsigned char *b = b_;
   uint32_t s = 0;
   size_t i;
-  for (i = n; i > 0; --i)
+
+  if (!crcslice_ready)
+    crcslice_init ();
+  for (i = n; i >= 8; i -= 8)
+    {
+      uint32_t one = s ^ ((uint32_t) b[0] << 24 | (uint32_t) b[1] << 16
+                          | (uint32_t) b[2] << 8 | b[3]);
+      uint32_t two = (uint32_t) b[4] << 24 | (uint32_t) b[5] << 16
+                     | (uint32_t) b[6] << 8 | b[7];
+      s = (crcslice[7][one >> 24] ^ crcslice[6][(one >> 16) & 0xff]
+           ^ crcslice[5][(one >> 8) & 0xff] ^ crcslice[4][one & 0xff]
+           ^ crcslice[3][two >> 24] ^ crcslice[2][(two >> 16) & 0xff]
+           ^ crcslice[1][(two >> 8) & 0xff] ^ crcslice[0][two & 0xff]);
+      b += 8;
+    }
+  for (; i > 0; --i)
     {
       unsigned char c = *b++;
       s = (s << 8) ^ crctab[(s >> 24) ^ c];
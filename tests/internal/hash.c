@@ -0,0 +1,125 @@
+/* Test program for lib/kernel/hash.c.
+
+   Checks that lookups, deletions and iteration see every element
+   exactly once while the table is being resized, which happens
+   incrementally, a few buckets per insertion or deletion.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <hash.h>
+#include <stdio.h>
+#include "threads/test.h"
+
+/* Number of elements to insert. */
+#define MAX_SIZE 1024
+
+/* A hash table element. */
+struct value
+  {
+    struct hash_elem elem;      /* Hash element. */
+    int value;                  /* Item value. */
+  };
+
+static struct value values[MAX_SIZE];
+
+static uint64_t value_hash (const struct hash_elem *, void *);
+static bool value_less (const struct hash_elem *, const struct hash_elem *,
+                        void *);
+static void verify (struct hash *, int lo, int hi);
+
+/* Test the hash table implementation. */
+void
+test (void)
+{
+  struct hash h;
+  int i;
+
+  printf ("testing hash table resizing:");
+  ASSERT (hash_init (&h, value_hash, value_less, NULL));
+
+  /* Grow, checking the contents after every insertion so that
+     every stage of each migration is covered. */
+  for (i = 0; i < MAX_SIZE; i++)
+    {
+      values[i].value = i;
+      ASSERT (hash_insert (&h, &values[i].elem) == NULL);
+      ASSERT (hash_insert (&h, &values[i].elem) == &values[i].elem);
+      if (i % 64 == 0 || i < 64)
+        verify (&h, 0, i + 1);
+    }
+  verify (&h, 0, MAX_SIZE);
+  printf (" grow");
+
+  /* Shrink. */
+  for (i = 0; i < MAX_SIZE - 1; i++)
+    {
+      struct value key;
+
+      key.value = i;
+      ASSERT (hash_delete (&h, &key.elem) == &values[i].elem);
+      ASSERT (hash_find (&h, &key.elem) == NULL);
+      if (i % 64 == 0 || i > MAX_SIZE - 64)
+        verify (&h, i + 1, MAX_SIZE);
+    }
+  printf (" shrink");
+
+  hash_clear (&h, NULL);
+  ASSERT (hash_empty (&h));
+  hash_destroy (&h, NULL);
+  printf (" done\n");
+  printf ("hash table okay\n");
+}
+
+/* Returns the hash of the value in E. */
+static uint64_t
+value_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct value, elem)->value);
+}
+
+/* Orders values. */
+static bool
+value_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct value *a = hash_entry (a_, struct value, elem);
+  const struct value *b = hash_entry (b_, struct value, elem);
+
+  return a->value < b->value;
+}
+
+/* Verifies that H holds exactly the values in [LO, HI), by
+   lookup and by iteration. */
+static void
+verify (struct hash *h, int lo, int hi)
+{
+  static bool seen[MAX_SIZE];
+  struct hash_iterator it;
+  int i, cnt = 0;
+
+  ASSERT (hash_size (h) == (size_t) (hi - lo));
+  for (i = lo; i < hi; i++)
+    {
+      struct value key;
+
+      key.value = i;
+      ASSERT (hash_find (h, &key.elem) == &values[i].elem);
+      seen[i] = false;
+    }
+
+  hash_first (&it, h);
+  while (hash_next (&it))
+    {
+      struct value *v = hash_entry (hash_cur (&it), struct value, elem);
+
+      ASSERT (v->value >= lo && v->value < hi);
+      ASSERT (!seen[v->value]);
+      seen[v->value] = true;
+      cnt++;
+    }
+  ASSERT (cnt == hi - lo);
+}
@@ -0,0 +1,157 @@
+/* Test program for lib/kernel/heap.c.
+
+   Pushes, pops, removes and re-ranks values in random order,
+   checking after each step that the heap is in heap order and
+   holds the right values, and that heap_top() returns a greatest
+   one.  Values are re-ranked both upward, through
+   heap_increase(), and in either direction, through
+   heap_update().
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <heap.h>
+#include <stdio.h>
+#include "threads/test.h"
+
+/* Number of values. */
+#define MAX_SIZE 256
+
+/* A heap element. */
+struct value
+  {
+    struct heap_elem elem;      /* Heap element. */
+    int value;                  /* Item value. */
+    bool in_heap;               /* Currently in the heap? */
+  };
+
+static struct value values[MAX_SIZE];
+
+static bool value_less (const struct heap_elem *, const struct heap_elem *,
+                        void *);
+static size_t check_subtree (struct heap *, const struct heap_elem *);
+static void verify (struct heap *);
+
+/* Random number generator state. */
+static unsigned long rand_state = 1;
+
+/* Returns a pseudo-random number less than N. */
+static int
+next_rand (int n)
+{
+  rand_state = rand_state * 1103515245 + 12345;
+  return (rand_state >> 16) % n;
+}
+
+void
+test (void)
+{
+  struct heap h;
+  int i;
+
+  heap_init (&h, value_less, NULL);
+  for (i = 0; i < 50000; i++)
+    {
+      struct value *v = &values[next_rand (MAX_SIZE)];
+
+      if (!v->in_heap)
+        {
+          v->value = next_rand (1000);
+          heap_push (&h, &v->elem);
+          v->in_heap = true;
+        }
+      else
+        switch (next_rand (4))
+          {
+          case 0:
+            v = heap_entry (heap_pop (&h), struct value, elem);
+            ASSERT (v->in_heap);
+            v->in_heap = false;
+            break;
+          case 1:
+            heap_remove (&h, &v->elem);
+            v->in_heap = false;
+            break;
+          case 2:
+            v->value += next_rand (100);
+            heap_increase (&h, &v->elem);
+            break;
+          default:
+            v->value = next_rand (1000);
+            heap_update (&h, &v->elem);
+            break;
+          }
+      if (i % 16 == 0)
+        verify (&h);
+    }
+  verify (&h);
+
+  while (!heap_empty (&h))
+    {
+      struct value *v = heap_entry (heap_pop (&h), struct value, elem);
+
+      ASSERT (heap_empty (&h)
+              || heap_entry (heap_top (&h), struct value, elem)->value
+                 <= v->value);
+      v->in_heap = false;
+    }
+  ASSERT (heap_size (&h) == 0);
+  printf ("heap okay\n");
+}
+
+/* Orders values. */
+static bool
+value_less (const struct heap_elem *a, const struct heap_elem *b,
+            void *aux UNUSED)
+{
+  return heap_entry (a, struct value, elem)->value
+         < heap_entry (b, struct value, elem)->value;
+}
+
+/* Checks the links and heap order of the subtree rooted at E and
+   returns the number of elements in it. */
+static size_t
+check_subtree (struct heap *h, const struct heap_elem *e)
+{
+  const struct heap_elem *c, *prev = e;
+  size_t cnt = 1;
+
+  ASSERT (heap_entry (e, struct value, elem)->in_heap);
+  for (c = e->child; c != NULL; prev = c, c = c->next)
+    {
+      ASSERT (c->prev == prev);
+      ASSERT (!value_less (e, c, h->aux));
+      cnt += check_subtree (h, c);
+    }
+  return cnt;
+}
+
+/* Verifies that H is in heap order and holds exactly the values
+   marked in_heap, with a greatest one on top. */
+static void
+verify (struct heap *h)
+{
+  size_t cnt = 0;
+  int max = -1;
+  int i;
+
+  for (i = 0; i < MAX_SIZE; i++)
+    if (values[i].in_heap)
+      {
+        cnt++;
+        if (values[i].value > max)
+          max = values[i].value;
+      }
+  ASSERT (heap_size (h) == cnt);
+  if (cnt == 0)
+    {
+      ASSERT (heap_empty (h) && heap_top (h) == NULL);
+      return;
+    }
+  ASSERT (h->root->prev == NULL && h->root->next == NULL);
+  ASSERT (check_subtree (h, h->root) == cnt);
+  ASSERT (heap_entry (heap_top (h), struct value, elem)->value == max);
+}
@@ -85,6 +85,15 @@ test (void)
                                  value_less, NULL);
           verify_list_fwd (&list, size);
 
+          /* Same again, searching from the back with
+             list_insert_ordered_back(). */
+          shuffle (values, size);
+          list_init (&list);
+          for (i = 0; i < size; i++)
+            list_insert_ordered_back (&list, &values[i].elem,
+                                      value_less, NULL);
+          verify_list_fwd (&list, size);
+
           /* Duplicate some items, uniquify, and verify. */
           ofs = size;
           for (e = list_begin (&list); e != list_end (&list);
@@ -0,0 +1,198 @@
+/* Test program and microbenchmark for lib/kernel/ohash.c.
+
+   Checks the open-addressing table against the chained table in
+   lib/kernel/hash.c through a long run of random insertions,
+   deletions and lookups, then times lookups in both with 1k, 10k
+   and 100k elements keyed like supplemental page table entries.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <hash.h>
+#include <intrinsic.h>
+#include <ohash.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/malloc.h"
+#include "threads/test.h"
+
+/* Largest number of elements. */
+#define MAX_SIZE 100000
+
+/* Lookups per timed run. */
+#define LOOKUPS 200000
+
+/* An element, keyed like a page by a page-aligned address. */
+struct value
+  {
+    struct hash_elem elem;      /* Chained hash element. */
+    uint64_t key;               /* Key. */
+  };
+
+static uint64_t value_hash (const struct hash_elem *, void *);
+static bool value_less (const struct hash_elem *, const struct hash_elem *,
+                        void *);
+static void verify (struct value *);
+static void bench (struct value *, size_t cnt);
+
+/* Random number generator state. */
+static uint64_t rand_state = 1;
+
+/* Returns a pseudo-random number. */
+static uint64_t
+next_rand (void)
+{
+  rand_state = rand_state * 6364136223846793005ULL + 1442695040888963407ULL;
+  return rand_state >> 33;
+}
+
+/* Returns the key of element I. */
+static uint64_t
+key_of (size_t i)
+{
+  return 0x400000 + (uint64_t) i * 4096;
+}
+
+void
+test (void)
+{
+  struct value *values = malloc (MAX_SIZE * sizeof *values);
+  size_t cnt;
+
+  ASSERT (values != NULL);
+  verify (values);
+  printf ("%8s %14s %14s %14s %14s\n", "elems",
+          "chained hit", "open hit", "chained miss", "open miss");
+  for (cnt = 1000; cnt <= MAX_SIZE; cnt *= 10)
+    bench (values, cnt);
+  free (values);
+}
+
+/* Checks the open-addressing table against the chained one. */
+static void
+verify (struct value *values)
+{
+  enum { KEYS = 4096 };
+  struct hash h;
+  struct ohash o;
+  int i;
+
+  printf ("verifying open-addressing hash table...");
+  ASSERT (hash_init (&h, value_hash, value_less, NULL));
+  ASSERT (ohash_init (&o, 0));
+  for (i = 0; i < KEYS; i++)
+    values[i].key = key_of (i);
+
+  for (i = 0; i < 200000; i++)
+    {
+      struct value *v = &values[next_rand () % KEYS];
+      struct hash_elem *e;
+
+      switch (next_rand () % 3)
+        {
+        case 0:
+          e = hash_insert (&h, &v->elem);
+          ASSERT (ohash_insert (&o, v->key, v) == (e == NULL));
+          break;
+        case 1:
+          e = hash_delete (&h, &v->elem);
+          ASSERT (ohash_delete (&o, v->key) == (e != NULL ? v : NULL));
+          break;
+        default:
+          e = hash_find (&h, &v->elem);
+          ASSERT (ohash_find (&o, v->key) == (e != NULL ? v : NULL));
+          break;
+        }
+      ASSERT (ohash_size (&o) == hash_size (&h));
+    }
+
+  hash_destroy (&h, NULL);
+  ohash_destroy (&o);
+  printf (" done.\n");
+}
+
+/* Times lookups of present and absent keys in tables of CNT
+   elements. */
+static void
+bench (struct value *values, size_t cnt)
+{
+  struct hash h;
+  struct ohash o;
+  uint64_t t[5];
+  size_t i, found = 0;
+
+  ASSERT (hash_init (&h, value_hash, value_less, NULL));
+  if (!ohash_init (&o, 0))
+    {
+      printf ("%8zu: out of memory\n", cnt);
+      return;
+    }
+  for (i = 0; i < cnt; i++)
+    {
+      values[i].key = key_of (i);
+      ASSERT (hash_insert (&h, &values[i].elem) == NULL);
+      if (!ohash_insert (&o, values[i].key, &values[i]))
+        {
+          printf ("%8zu: out of memory\n", cnt);
+          hash_destroy (&h, NULL);
+          ohash_destroy (&o);
+          return;
+        }
+    }
+
+  rand_state = cnt;
+  t[0] = rdtsc ();
+  for (i = 0; i < LOOKUPS; i++)
+    {
+      struct value key;
+
+      key.key = key_of (next_rand () % cnt);
+      found += hash_find (&h, &key.elem) != NULL;
+    }
+  t[1] = rdtsc ();
+  rand_state = cnt;
+  for (i = 0; i < LOOKUPS; i++)
+    found += ohash_find (&o, key_of (next_rand () % cnt)) != NULL;
+  t[2] = rdtsc ();
+  for (i = 0; i < LOOKUPS; i++)
+    {
+      struct value key;
+
+      key.key = key_of (cnt + next_rand () % cnt);
+      found += hash_find (&h, &key.elem) != NULL;
+    }
+  t[3] = rdtsc ();
+  for (i = 0; i < LOOKUPS; i++)
+    found += ohash_find (&o, key_of (cnt + next_rand () % cnt)) != NULL;
+  t[4] = rdtsc ();
+  ASSERT (found == 2 * LOOKUPS);
+
+  printf ("%8zu %14llu %14llu %14llu %14llu\n", cnt,
+          (t[1] - t[0]) / LOOKUPS, (t[2] - t[1]) / LOOKUPS,
+          (t[3] - t[2]) / LOOKUPS, (t[4] - t[3]) / LOOKUPS);
+  hash_destroy (&h, NULL);
+  ohash_destroy (&o);
+}
+
+/* Returns the hash of the key of E. */
+static uint64_t
+value_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct value *v = hash_entry (e, struct value, elem);
+
+  return hash_bytes (&v->key, sizeof v->key);
+}
+
+/* Orders values by key. */
+static bool
+value_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct value *a = hash_entry (a_, struct value, elem);
+  const struct value *b = hash_entry (b_, struct value, elem);
+
+  return a->key < b->key;
+}
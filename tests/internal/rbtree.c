@@ -0,0 +1,247 @@
+/* Test program for lib/kernel/rbtree.c and lib/kernel/itree.c.
+
+   Inserts and removes values in random order, checking after
+   each step that the tree holds the right values in order, that
+   it still satisfies the red-black rules, and that rb_floor()
+   agrees with a linear search.  Then does the same for an
+   interval tree, checking each node's cached subtree end and
+   comparing overlap queries against a brute-force scan.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <itree.h>
+#include <rbtree.h>
+#include <stdio.h>
+#include "threads/test.h"
+
+/* Number of values. */
+#define MAX_SIZE 512
+
+/* A tree element. */
+struct value
+  {
+    struct rb_node elem;        /* Tree node. */
+    int value;                  /* Item value. */
+    bool in_tree;               /* Currently in the tree? */
+  };
+
+/* An interval tree element. */
+struct range
+  {
+    struct itree_node node;     /* Tree node. */
+    bool in_tree;               /* Currently in the tree? */
+  };
+
+static struct value values[MAX_SIZE];
+static struct range ranges[MAX_SIZE];
+
+static bool value_less (const struct rb_node *, const struct rb_node *,
+                        void *);
+static int check_node (const struct rb_node *);
+static void verify (struct rb_tree *);
+static void test_rbtree (void);
+static void test_itree (void);
+
+/* Random number generator state. */
+static unsigned long rand_state = 1;
+
+/* Returns a pseudo-random number less than N. */
+static int
+next_rand (int n)
+{
+  rand_state = rand_state * 1103515245 + 12345;
+  return (rand_state >> 16) % n;
+}
+
+void
+test (void)
+{
+  test_rbtree ();
+  test_itree ();
+  printf ("red-black trees okay\n");
+}
+
+/* Inserts and removes values at random, verifying the tree. */
+static void
+test_rbtree (void)
+{
+  struct rb_tree t;
+  int i;
+
+  printf ("testing red-black tree...");
+  rb_init (&t, value_less, NULL);
+  for (i = 0; i < MAX_SIZE; i++)
+    values[i].value = i * 2;
+
+  for (i = 0; i < 20000; i++)
+    {
+      struct value *v = &values[next_rand (MAX_SIZE)];
+
+      if (v->in_tree)
+        rb_remove (&t, &v->elem);
+      else
+        ASSERT (rb_insert (&t, &v->elem) == NULL);
+      v->in_tree = !v->in_tree;
+      if (i % 16 == 0)
+        verify (&t);
+    }
+  verify (&t);
+  printf (" done.\n");
+}
+
+/* Orders values. */
+static bool
+value_less (const struct rb_node *a, const struct rb_node *b,
+            void *aux UNUSED)
+{
+  return rb_entry (a, struct value, elem)->value
+         < rb_entry (b, struct value, elem)->value;
+}
+
+/* Checks the red-black rules below N and returns its black
+   height. */
+static int
+check_node (const struct rb_node *n)
+{
+  int left, right;
+
+  if (n == NULL)
+    return 1;
+  ASSERT (!n->red || ((n->left == NULL || !n->left->red)
+                       && (n->right == NULL || !n->right->red)));
+  ASSERT (n->left == NULL || n->left->parent == n);
+  ASSERT (n->right == NULL || n->right->parent == n);
+  left = check_node (n->left);
+  right = check_node (n->right);
+  ASSERT (left == right);
+  return left + !n->red;
+}
+
+/* Verifies that T holds exactly the values marked in_tree, in
+   order, that it is balanced, and that rb_floor() works. */
+static void
+verify (struct rb_tree *t)
+{
+  struct rb_node *n = rb_first (t);
+  size_t cnt = 0;
+  int i;
+
+  ASSERT (t->root == NULL || (!t->root->red && t->root->parent == NULL));
+  check_node (t->root);
+  for (i = 0; i < MAX_SIZE; i++)
+    if (values[i].in_tree)
+      {
+        ASSERT (n == &values[i].elem);
+        n = rb_next (n);
+        cnt++;
+      }
+  ASSERT (n == NULL);
+  ASSERT (rb_size (t) == cnt);
+
+  for (i = -1; i < MAX_SIZE * 2; i += 3)
+    {
+      struct value key;
+      struct value *floor = NULL;
+      int j;
+
+      key.value = i;
+      for (j = 0; j < MAX_SIZE && values[j].value <= i; j++)
+        if (values[j].in_tree)
+          floor = &values[j];
+      ASSERT (rb_floor (t, &key.elem)
+              == (floor != NULL ? &floor->elem : NULL));
+    }
+}
+
+/* Checks the cached subtree ends below N and returns the
+   greatest end under it. */
+static uint64_t
+check_max_end (const struct rb_node *n)
+{
+  const struct itree_node *node;
+  uint64_t max, left, right;
+
+  if (n == NULL)
+    return 0;
+  node = rb_entry (n, struct itree_node, rb);
+  left = check_max_end (n->left);
+  right = check_max_end (n->right);
+  max = node->end;
+  if (left > max)
+    max = left;
+  if (right > max)
+    max = right;
+  ASSERT (node->max_end == max);
+  return max;
+}
+
+/* Checks that the overlap query for [START, END) in T returns
+   exactly the intervals in the tree that overlap it, in order of
+   start. */
+static void
+check_query (struct itree *t, uint64_t start, uint64_t end)
+{
+  static bool seen[MAX_SIZE];
+  struct itree_node *n;
+  uint64_t last_start = 0;
+  int i, cnt = 0, found = 0;
+
+  for (i = 0; i < MAX_SIZE; i++)
+    seen[i] = false;
+  for (n = itree_first (t, start, end); n != NULL;
+       n = itree_next (n, start, end))
+    {
+      struct range *r = itree_entry (n, struct range, node);
+
+      ASSERT (r->in_tree && !seen[r - ranges]);
+      ASSERT (n->start < end && n->end > start);
+      ASSERT (n->start >= last_start);
+      last_start = n->start;
+      seen[r - ranges] = true;
+      found++;
+    }
+  for (i = 0; i < MAX_SIZE; i++)
+    if (ranges[i].in_tree && ranges[i].node.start < end
+        && ranges[i].node.end > start)
+      cnt++;
+  ASSERT (found == cnt);
+}
+
+/* Inserts and removes random intervals, verifying the cached
+   subtree ends and overlap queries. */
+static void
+test_itree (void)
+{
+  struct itree t;
+  int i;
+
+  printf ("testing interval tree...");
+  itree_init (&t);
+  for (i = 0; i < 20000; i++)
+    {
+      struct range *r = &ranges[next_rand (MAX_SIZE)];
+
+      if (r->in_tree)
+        itree_remove (&t, &r->node);
+      else
+        {
+          uint64_t start = next_rand (1000);
+
+          itree_insert (&t, &r->node, start, start + 1 + next_rand (50));
+        }
+      r->in_tree = !r->in_tree;
+      if (i % 16 == 0)
+        {
+          uint64_t start = next_rand (1100);
+
+          check_node (t.tree.root);
+          check_max_end (t.tree.root);
+          check_query (&t, start, start + 1 + next_rand (100));
+        }
+    }
+  printf (" done.\n");
+}
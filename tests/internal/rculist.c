@@ -0,0 +1,112 @@
+/* Test program for lib/kernel/rculist.c.
+
+   Builds lists by pushing and inserting, removes elements from the
+   front, middle and back, and checks after each step that walking
+   the list with rculist_first() and rculist_next() finds exactly the
+   expected elements in order.  Also checks that a reader standing
+   on an element that is removed still reaches the rest of the list.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <rculist.h>
+#include <stdio.h>
+#include "threads/test.h"
+
+/* Number of elements. */
+#define SIZE 16
+
+/* An element. */
+struct value
+  {
+    struct rculist_elem elem;   /* List element. */
+    int value;                  /* Item value. */
+  };
+
+static void verify (struct rculist *, const int *expect, size_t cnt);
+
+void
+test (void)
+{
+  struct value values[SIZE];
+  int expect[SIZE];
+  struct rculist list;
+  struct rculist_elem *reader;
+  size_t cnt;
+  int i;
+
+  for (i = 0; i < SIZE; i++)
+    values[i].value = i;
+
+  /* Push in reverse order, so the list runs 0...SIZE-1. */
+  rculist_init (&list);
+  ASSERT (rculist_empty (&list));
+  verify (&list, expect, 0);
+  for (i = SIZE - 1; i >= 0; i--)
+    rculist_push_front (&list, &values[i].elem);
+  for (i = 0; i < SIZE; i++)
+    expect[i] = i;
+  verify (&list, expect, SIZE);
+
+  /* A reader stops on element 5, which is then removed. */
+  reader = rculist_first (&list);
+  while (rculist_entry (reader, struct value, elem)->value != 5)
+    reader = rculist_next (reader);
+  rculist_remove (&values[5].elem);
+  for (i = 6; i < SIZE; i++)
+    {
+      reader = rculist_next (reader);
+      ASSERT (rculist_entry (reader, struct value, elem)->value == i);
+    }
+  ASSERT (rculist_next (reader) == NULL);
+
+  /* Remove the front, the back and every third element. */
+  rculist_remove (&values[0].elem);
+  rculist_remove (&values[SIZE - 1].elem);
+  cnt = 0;
+  for (i = 1; i < SIZE - 1; i++)
+    if (i == 5)
+      continue;
+    else if (i % 3 == 0)
+      rculist_remove (&values[i].elem);
+    else
+      expect[cnt++] = i;
+  verify (&list, expect, cnt);
+
+  /* Put the removed multiples of 3 back after their predecessors. */
+  for (i = 3; i < SIZE - 1; i += 3)
+    rculist_insert_after (&values[i == 6 ? 4 : i - 1].elem, &values[i].elem);
+  cnt = 0;
+  for (i = 1; i < SIZE - 1; i++)
+    if (i != 5)
+      expect[cnt++] = i;
+  verify (&list, expect, cnt);
+
+  /* Empty the list. */
+  for (i = 1; i < SIZE - 1; i++)
+    if (i != 5)
+      rculist_remove (&values[i].elem);
+  ASSERT (rculist_empty (&list));
+  verify (&list, expect, 0);
+
+  printf ("rculist: PASS\n");
+}
+
+/* Checks that LIST holds the CNT values in EXPECT, in order. */
+static void
+verify (struct rculist *list, const int *expect, size_t cnt)
+{
+  struct rculist_elem *e;
+  size_t i = 0;
+
+  for (e = rculist_first (list); e != NULL; e = rculist_next (e))
+    {
+      ASSERT (i < cnt);
+      ASSERT (rculist_entry (e, struct value, elem)->value == expect[i]);
+      i++;
+    }
+  ASSERT (i == cnt);
+}
@@ -22,6 +22,7 @@ static void shuffle (int[], size_t);
 static int compare_ints (const void *, const void *);
 static void verify_order (const int[], size_t);
 static void verify_bsearch (const int[], size_t);
+static void test_records (size_t);
 
 /* Test sorting and searching implementations. */
 void
@@ -40,16 +41,19 @@ test (void)
           static int values[MAX_CNT];
           int i;
 
-          /* Put values 0...CNT in random order in VALUES. */
+          /* Put values 0...CNT in VALUES: in order, in reverse
+             order, then in random order. */
           for (i = 0; i < cnt; i++)
-            values[i] = i;
-          shuffle (values, cnt);
+            values[i] = repeat == 1 ? cnt - 1 - i : i;
+          if (repeat > 1)
+            shuffle (values, cnt);
   
           /* Sort VALUES, then verify ordering. */
           qsort (values, cnt, sizeof *values, compare_ints);
           verify_order (values, cnt);
           verify_bsearch (values, cnt);
         }
+      test_records (cnt);
     }
   
   printf (" done\n");
@@ -112,3 +116,53 @@ verify_bsearch (const int *array, size_t cnt)
     ASSERT (bsearch (&not_in_array[i], array, cnt, sizeof *array, compare_ints)
             == NULL);
 }
+
+/* An odd-sized array element, with many duplicate keys. */
+struct record
+  {
+    unsigned char key;
+    unsigned char tag[2];
+  };
+
+/* Compares the keys of records A and B, counting comparisons in
+   the unsigned long that AUX points to. */
+static int
+compare_records (const void *a_, const void *b_, void *aux) 
+{
+  const struct record *a = a_;
+  const struct record *b = b_;
+  unsigned long *cmp_cnt = aux;
+
+  ++*cmp_cnt;
+  return a->key < b->key ? -1 : a->key > b->key;
+}
+
+/* Sorts CNT records with random keys in a small range through
+   sort(), and checks that the result is in order and keeps every
+   record intact. */
+static void
+test_records (size_t cnt) 
+{
+  static struct record records[MAX_CNT];
+  unsigned long cmp_cnt = 0;
+  unsigned sum = 0;
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      records[i].key = random_ulong () % 8;
+      records[i].tag[0] = records[i].key ^ 0x5a;
+      records[i].tag[1] = ~records[i].key;
+      sum += records[i].key;
+    }
+  sort (records, cnt, sizeof *records, compare_records, &cmp_cnt);
+  for (i = 0; i < cnt; i++)
+    {
+      ASSERT (i == 0 || records[i - 1].key <= records[i].key);
+      ASSERT (records[i].tag[0] == (records[i].key ^ 0x5a));
+      ASSERT (records[i].tag[1] == (unsigned char) ~records[i].key);
+      sum -= records[i].key;
+    }
+  ASSERT (sum == 0);
+  ASSERT (cnt < 2 || cmp_cnt >= cnt - 1);
+}
@@ -0,0 +1,182 @@
+/* Test program and microbenchmark for the block operations in
+   lib/string.c.
+
+   Checks memcpy(), memmove() and memset() against simple
+   byte-at-a-time reference versions for every alignment of
+   source and destination, checks the word-at-a-time string
+   scanners at every alignment, then times the block operations
+   on blocks from 1 byte to 64 kB.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <intrinsic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/test.h"
+
+/* Largest block size that we will test. */
+#define MAX_SIZE 65536
+
+/* Number of times each timed operation is repeated. */
+#define REPEAT 64
+
+static uint8_t buf_a[MAX_SIZE + 64];
+static uint8_t buf_b[MAX_SIZE + 64];
+static uint8_t buf_c[MAX_SIZE + 64];
+
+/* Reference byte-at-a-time memcpy(). */
+static void *
+byte_memcpy (void *dst_, const void *src_, size_t size)
+{
+  uint8_t *dst = dst_;
+  const uint8_t *src = src_;
+
+  while (size-- > 0)
+    *dst++ = *src++;
+  return dst_;
+}
+
+/* Reference byte-at-a-time memset(). */
+static void *
+byte_memset (void *dst_, int value, size_t size)
+{
+  uint8_t *dst = dst_;
+
+  while (size-- > 0)
+    *dst++ = value;
+  return dst_;
+}
+
+static void fill (uint8_t *, size_t);
+static void verify (void);
+static void verify_scan (void);
+static void bench (void);
+
+void
+test (void)
+{
+  verify ();
+  verify_scan ();
+  bench ();
+}
+
+/* Fills the SIZE bytes at P with a recognizable pattern. */
+static void
+fill (uint8_t *p, size_t size)
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    p[i] = i * 7 + 3;
+}
+
+/* Compares the library versions against the references for
+   every alignment of source and destination. */
+static void
+verify (void)
+{
+  size_t size, d, s;
+
+  printf ("verifying memcpy, memmove and memset...");
+  for (size = 0; size <= 300; size++)
+    for (d = 0; d < 16; d++)
+      for (s = 0; s < 16; s++)
+        {
+          fill (buf_a, sizeof buf_a);
+          memset (buf_b, 0, sizeof buf_b);
+          memset (buf_c, 0, sizeof buf_c);
+          ASSERT (memcpy (buf_b + d, buf_a + s, size) == buf_b + d);
+          byte_memcpy (buf_c + d, buf_a + s, size);
+          ASSERT (!memcmp (buf_b, buf_c, sizeof buf_b));
+
+          ASSERT (memset (buf_b + d, s, size) == buf_b + d);
+          byte_memset (buf_c + d, s, size);
+          ASSERT (!memcmp (buf_b, buf_c, sizeof buf_b));
+
+          /* Overlapping moves in both directions. */
+          fill (buf_b, sizeof buf_b);
+          fill (buf_c, sizeof buf_c);
+          ASSERT (memmove (buf_b + d, buf_b + s, size) == buf_b + d);
+          byte_memcpy (buf_a, buf_c + s, size);
+          byte_memcpy (buf_c + d, buf_a, size);
+          ASSERT (!memcmp (buf_b, buf_c, sizeof buf_b));
+        }
+  printf (" done.\n");
+}
+
+/* Checks strlen(), strnlen(), strcmp(), memchr() and memcmp()
+   for every string length and alignment up to a few words. */
+static void
+verify_scan (void)
+{
+  size_t len, d, s;
+
+  printf ("verifying strlen, strnlen, strcmp, memchr and memcmp...");
+  for (len = 0; len < 40; len++)
+    for (d = 0; d < 16; d++)
+      for (s = 0; s < 16; s++)
+        {
+          char *a = (char *) buf_a + d;
+          char *b = (char *) buf_b + s;
+          size_t i;
+
+          for (i = 0; i < len; i++)
+            a[i] = b[i] = 'a' + i % 26;
+          a[len] = b[len] = '\0';
+
+          ASSERT (strlen (a) == len);
+          ASSERT (strnlen (a, len / 2) == len / 2);
+          ASSERT (strnlen (a, len + 5) == len);
+          ASSERT (strcmp (a, b) == 0);
+          ASSERT (memcmp (a, b, len) == 0);
+          ASSERT (memchr (a, '\0', len + 1) == a + len);
+          ASSERT (memchr (a, '\0', len) == NULL);
+          if (len > 0)
+            {
+              b[len - 1]++;
+              ASSERT (strcmp (a, b) < 0 && strcmp (b, a) > 0);
+              ASSERT (memcmp (a, b, len) < 0 && memcmp (b, a, len) > 0);
+              ASSERT (memchr (a, b[len - 1], len) == NULL
+                      || memchr (a, b[len - 1], len) < a + len - 1);
+            }
+        }
+  printf (" done.\n");
+}
+
+/* Times the references against the library versions. */
+static void
+bench (void)
+{
+  size_t size;
+
+  printf ("%8s %12s %12s %12s %12s\n", "bytes",
+          "byte cpy", "memcpy", "byte set", "memset");
+  for (size = 1; size <= MAX_SIZE; size *= 2)
+    {
+      uint64_t t[5];
+      int i;
+
+      t[0] = rdtsc ();
+      for (i = 0; i < REPEAT; i++)
+        byte_memcpy (buf_b, buf_a, size);
+      t[1] = rdtsc ();
+      for (i = 0; i < REPEAT; i++)
+        memcpy (buf_b, buf_a, size);
+      t[2] = rdtsc ();
+      for (i = 0; i < REPEAT; i++)
+        byte_memset (buf_b, i, size);
+      t[3] = rdtsc ();
+      for (i = 0; i < REPEAT; i++)
+        memset (buf_b, i, size);
+      t[4] = rdtsc ();
+
+      printf ("%8zu %12llu %12llu %12llu %12llu\n", size,
+              (t[1] - t[0]) / REPEAT, (t[2] - t[1]) / REPEAT,
+              (t[3] - t[2]) / REPEAT, (t[4] - t[3]) / REPEAT);
+    }
+}
@@ -0,0 +1,58 @@
+/* The main thread holds a readers-writer lock for reading.  A
+   higher-priority writer then blocks waiting for the lock,
+   followed by an even higher-priority reader, which must wait
+   behind the writer rather than join the main thread, and which
+   donates its priority to the writer.  When the main thread
+   releases its read lock, the writer must get the lock before
+   the reader. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+static thread_func writer_thread_func;
+static thread_func reader_thread_func;
+
+void
+test_rwlock_writer (void) 
+{
+  struct rwlock rw;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  rwlock_init (&rw);
+  rw_read_acquire (&rw);
+  thread_create ("writer", PRI_DEFAULT + 1, writer_thread_func, &rw);
+  msg ("main: writer is waiting.");
+  thread_create ("reader", PRI_DEFAULT + 2, reader_thread_func, &rw);
+  msg ("main: releasing read lock.");
+  rw_read_release (&rw);
+  msg ("main: done.");
+}
+
+static void
+writer_thread_func (void *rw_) 
+{
+  struct rwlock *rw = rw_;
+
+  rw_write_acquire (rw);
+  msg ("writer: got write lock, priority %d.", thread_get_priority ());
+  rw_write_release (rw);
+  msg ("writer: done.");
+}
+
+static void
+reader_thread_func (void *rw_) 
+{
+  struct rwlock *rw = rw_;
+
+  rw_read_acquire (rw);
+  msg ("reader: got read lock.");
+  rw_read_release (rw);
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(rwlock-writer) begin
+(rwlock-writer) main: writer is waiting.
+(rwlock-writer) main: releasing read lock.
+(rwlock-writer) writer: got write lock, priority 33.
+(rwlock-writer) reader: got read lock.
+(rwlock-writer) writer: done.
+(rwlock-writer) main: done.
+(rwlock-writer) end
+EOF
+pass;
@@ -0,0 +1,68 @@
+/* Allocates enough objects from a slab cache with a constructor
+   and 64-byte alignment to fill several slabs, and checks that
+   every object is aligned, in constructed state, and
+   distinct.  Then frees them all and allocates them again,
+   checking that freed objects come back in constructed state. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/slab.h"
+
+#define OBJ_CNT 200
+#define OBJ_MAGIC 0x0bb1ec75
+
+struct obj
+  {
+    unsigned magic;
+    int id;
+    char payload[40];
+  };
+
+static int ctor_cnt;
+
+static void
+obj_ctor (void *obj_)
+{
+  struct obj *obj = obj_;
+
+  obj->magic = OBJ_MAGIC;
+  obj->id = -1;
+  ctor_cnt++;
+}
+
+void
+test_slab_cache (void) 
+{
+  static struct obj *objs[OBJ_CNT];
+  struct kmem_cache *cache;
+  int pass, i, j;
+
+  cache = kmem_cache_create ("slab-cache", sizeof (struct obj), 64, obj_ctor);
+  for (pass = 0; pass < 2; pass++)
+    {
+      for (i = 0; i < OBJ_CNT; i++)
+        {
+          objs[i] = kmem_cache_alloc (cache);
+          ASSERT (objs[i] != NULL);
+          if ((uintptr_t) objs[i] % 64 != 0)
+            fail ("object %d misaligned at %p", i, objs[i]);
+          if (objs[i]->magic != OBJ_MAGIC || objs[i]->id != -1)
+            fail ("object %d not in constructed state", i);
+          objs[i]->id = i;
+        }
+      for (i = 0; i < OBJ_CNT; i++)
+        for (j = i + 1; j < OBJ_CNT; j++)
+          if (objs[i] == objs[j])
+            fail ("objects %d and %d are the same", i, j);
+      if (ctor_cnt < OBJ_CNT)
+        fail ("only %d constructor calls for %d objects", ctor_cnt, OBJ_CNT);
+      for (i = 0; i < OBJ_CNT; i++)
+        {
+          objs[i]->id = -1;
+          kmem_cache_free (cache, objs[i]);
+        }
+      msg ("pass %d done.", pass);
+    }
+}
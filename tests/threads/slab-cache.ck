@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(slab-cache) begin
+(slab-cache) pass 0 done.
+(slab-cache) pass 1 done.
+(slab-cache) end
+EOF
+pass;
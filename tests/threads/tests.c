@@ -29,6 +29,8 @@ static const struct test tests[] =
     {"priority-preempt", test_priority_preempt},
     {"priority-sema", test_priority_sema},
     {"priority-condvar", test_priority_condvar},
+    {"rwlock-writer", test_rwlock_writer},
+    {"slab-cache", test_slab_cache},
     {"mlfqs-load-1", test_mlfqs_load_1},
     {"mlfqs-load-60", test_mlfqs_load_60},
     {"mlfqs-load-avg", test_mlfqs_load_avg},
@@ -38,6 +40,10 @@ static const struct test tests[] =
     {"mlfqs-nice-2", test_mlfqs_nice_2},
     {"mlfqs-nice-10", test_mlfqs_nice_10},
     {"mlfqs-block", test_mlfqs_block},
+    {"bench-yield", test_bench_yield},
+    {"bench-sema", test_bench_sema},
+    {"bench-malloc", test_bench_malloc},
+    {"bench-palloc", test_bench_palloc},
   };
 
 static const char *test_name;
@@ -23,6 +23,8 @@ extern test_func test_priority_fifo;
 extern test_func test_priority_preempt;
 extern test_func test_priority_sema;
 extern test_func test_priority_condvar;
+extern test_func test_rwlock_writer;
+extern test_func test_slab_cache;
 extern test_func test_mlfqs_load_1;
 extern test_func test_mlfqs_load_60;
 extern test_func test_mlfqs_load_avg;
@@ -32,6 +34,10 @@ extern test_func test_mlfqs_fair_20;
 extern test_func test_mlfqs_nice_2;
 extern test_func test_mlfqs_nice_10;
 extern test_func test_mlfqs_block;
+extern test_func test_bench_yield;
+extern test_func test_bench_sema;
+extern test_func test_bench_malloc;
+extern test_func test_bench_palloc;
 
 void msg (const char *, ...);
 void fail (const char *, ...);
@@ -0,0 +1,25 @@
+/* Spawns a child with more arguments than fit in one page of
+   stack along with their argv[] array, and checks that it sees
+   every one of them. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ARG_CNT 1000
+
+void
+test_main (void) 
+{
+  static char *argv[ARG_CNT + 2];
+  pid_t child;
+  int i;
+
+  argv[0] = "child-argc";
+  for (i = 1; i <= ARG_CNT; i++)
+    argv[i] = "x";
+  argv[ARG_CNT + 1] = NULL;
+
+  CHECK ((child = spawn ("child-argc", argv)) > 0, "spawn child-argc");
+  msg ("wait(spawn()) = %d", wait (child));
+}
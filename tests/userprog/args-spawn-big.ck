@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(args-spawn-big) begin
+(args-spawn-big) spawn child-argc
+(child-argc) argc = 1001
+child-argc: exit(233)
+(args-spawn-big) wait(spawn()) = 233
+(args-spawn-big) end
+args-spawn-big: exit(0)
+EOF
+pass;
@@ -0,0 +1,26 @@
+/* Child process run by the args-spawn-big test.
+   Checks that every argument after argv[0] is "x", that argv[] is
+   null-terminated and aligned as a call would leave it, and exits
+   with the number of arguments, modulo 256. */
+
+#include <string.h>
+#include "tests/lib.h"
+
+extern const char *test_name;
+
+int
+main (int argc, char *argv[]) 
+{
+  int i;
+
+  test_name = "child-argc";
+  if (((unsigned long long) argv & 15) != 0)
+    fail ("argv must be 16-byte aligned, actually %p", argv);
+  for (i = 1; i < argc; i++)
+    if (strcmp (argv[i], "x"))
+      fail ("argv[%d] = '%s'", i, argv[i]);
+  if (argv[argc] != NULL)
+    fail ("argv[%d] is not null", argc);
+  msg ("argc = %d", argc);
+  return argc & 0xff;
+}
@@ -0,0 +1,55 @@
+/* Starts several threads with clone() that share a counter under a
+   mutex and yield to each other while they hold it, then waits on
+   a futex for the last of them to finish. */
+
+#include <mutex.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define THREAD_CNT 4
+#define ITER_CNT 200
+
+static struct mutex mutex = MUTEX_INITIALIZER;
+static long counter;
+static unsigned running = THREAD_CNT;
+static char stacks[THREAD_CNT][4096] __attribute__ ((aligned (16)));
+
+static void
+worker (void *aux UNUSED)
+{
+  int i;
+
+  for (i = 0; i < ITER_CNT; i++)
+    {
+      long c;
+
+      mutex_lock (&mutex);
+      c = counter;
+      if (i % 16 == 0)
+        futex_wait (&running, ~0u);     /* Enters the kernel, and may be preempted. */
+      counter = c + 1;
+      mutex_unlock (&mutex);
+    }
+
+  if (__atomic_sub_fetch (&running, 1, __ATOMIC_RELEASE) == 0)
+    futex_wake (&running, 1);
+}
+
+void
+test_main (void) 
+{
+  unsigned r;
+  int i;
+
+  for (i = 0; i < THREAD_CNT; i++)
+    CHECK (clone (worker, stacks[i] + sizeof stacks[i], NULL) > 0,
+           "clone thread %d", i);
+
+  while ((r = __atomic_load_n (&running, __ATOMIC_ACQUIRE)) != 0)
+    futex_wait (&running, r);
+
+  if (counter != THREAD_CNT * ITER_CNT)
+    fail ("counter is %ld, not %d", counter, THREAD_CNT * ITER_CNT);
+  msg ("counter is %d", THREAD_CNT * ITER_CNT);
+}
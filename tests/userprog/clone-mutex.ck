@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(clone-mutex) begin
+(clone-mutex) clone thread 0
+(clone-mutex) clone thread 1
+(clone-mutex) clone thread 2
+(clone-mutex) clone thread 3
+(clone-mutex) counter is 800
+(clone-mutex) end
+clone-mutex: exit(0)
+EOF
+pass;
@@ -0,0 +1,27 @@
+/* Checks the futex calls that do not sleep, and that a mutex with
+   no contention never needs them. */
+
+#include <mutex.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  static unsigned word = 5;
+  static struct mutex m = MUTEX_INITIALIZER;
+
+  CHECK (futex_wait (&word, 4) == -1, "futex_wait on a changed word");
+  CHECK (futex_wake (&word, 1) == 0, "futex_wake with no waiters");
+  CHECK (futex_wait ((unsigned *) ((char *) &word + 1), 5) == -1,
+         "futex_wait on a misaligned word");
+
+  mutex_lock (&m);
+  CHECK (!mutex_trylock (&m), "mutex_trylock on a held mutex");
+  mutex_unlock (&m);
+  CHECK (mutex_trylock (&m), "mutex_trylock on a free mutex");
+  mutex_unlock (&m);
+  if (m.state != 0)
+    fail ("mutex left in state %u", m.state);
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(futex-basic) begin
+(futex-basic) futex_wait on a changed word
+(futex-basic) futex_wake with no waiters
+(futex-basic) futex_wait on a misaligned word
+(futex-basic) mutex_trylock on a held mutex
+(futex-basic) mutex_trylock on a free mutex
+(futex-basic) end
+futex-basic: exit(0)
+EOF
+pass;
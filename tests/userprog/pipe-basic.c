@@ -0,0 +1,60 @@
+/* Sends a short message through a pipe, then has a cloned thread
+   write several pages through it, more than the pipe holds, while
+   the main thread reads them back.  Closing the write end must give
+   the reader end of file. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BIG_SIZE (3 * 4096 + 123)
+#define CHUNK 1000
+
+static int fds[2];
+static char stack[4096] __attribute__ ((aligned (16)));
+
+static void
+writer (void *aux UNUSED)
+{
+  static char buf[CHUNK];
+  int ofs, i;
+
+  for (ofs = 0; ofs < BIG_SIZE; ofs += CHUNK)
+    {
+      int n = BIG_SIZE - ofs < CHUNK ? BIG_SIZE - ofs : CHUNK;
+
+      for (i = 0; i < n; i++)
+        buf[i] = (ofs + i) % 251;
+      if (write (fds[1], buf, n) != n)
+        exit (1);
+    }
+  close (fds[1]);
+}
+
+void
+test_main (void) 
+{
+  static char buf[CHUNK];
+  int total = 0, n, i;
+
+  CHECK (pipe (fds) == 0, "pipe");
+  CHECK (write (fds[1], "hello", 5) == 5, "write \"hello\"");
+  n = read (fds[0], buf, sizeof buf);
+  if (n != 5 || memcmp (buf, "hello", 5))
+    fail ("read back %d bytes", n);
+  msg ("read \"hello\"");
+
+  CHECK (clone (writer, stack + sizeof stack, NULL) > 0, "clone writer");
+  while ((n = read (fds[0], buf, sizeof buf)) > 0)
+    {
+      for (i = 0; i < n; i++)
+        if (buf[i] != (char) ((total + i) % 251))
+          fail ("byte %d is wrong", total + i);
+      total += n;
+    }
+  if (n < 0 || total != BIG_SIZE)
+    fail ("read %d bytes, then %d", total, n);
+  msg ("read %d bytes, then end of file", BIG_SIZE);
+  close (fds[0]);
+}
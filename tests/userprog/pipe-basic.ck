@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(pipe-basic) begin
+(pipe-basic) pipe
+(pipe-basic) write "hello"
+(pipe-basic) read "hello"
+(pipe-basic) clone writer
+(pipe-basic) read 12411 bytes, then end of file
+(pipe-basic) end
+pipe-basic: exit(0)
+EOF
+pass;
@@ -0,0 +1,46 @@
+/* Polls a pipe before and after data arrives, reads it with
+   O_NONBLOCK set, and has a cloned thread write while the main
+   thread sleeps in poll() with no timeout.  Closing the write end
+   must show up as POLLHUP. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static int fds[2];
+static char stack[4096] __attribute__ ((aligned (16)));
+
+static void
+writer (void *aux UNUSED)
+{
+  if (write (fds[1], "x", 1) != 1)
+    exit (1);
+}
+
+void
+test_main (void) 
+{
+  struct pollfd pfd;
+  char c;
+
+  CHECK (pipe (fds) == 0, "pipe");
+  pfd.fd = fds[0];
+  pfd.events = POLLIN;
+  CHECK (poll (&pfd, 1, 0) == 0, "poll empty pipe, no wait");
+  CHECK (poll (&pfd, 1, 20) == 0, "poll empty pipe, 20 ms");
+
+  CHECK (fcntl (fds[0], F_SETFL, O_NONBLOCK) == 0, "set O_NONBLOCK");
+  CHECK (fcntl (fds[0], F_GETFL, 0) == O_NONBLOCK, "get O_NONBLOCK");
+  CHECK (read (fds[0], &c, 1) == -1, "read empty pipe fails");
+
+  CHECK (clone (writer, stack + sizeof stack, NULL) > 0, "clone writer");
+  CHECK (poll (&pfd, 1, -1) == 1 && pfd.revents == POLLIN,
+         "poll until written");
+  CHECK (read (fds[0], &c, 1) == 1 && c == 'x', "read \"x\"");
+
+  close (fds[1]);
+  CHECK (poll (&pfd, 1, -1) == 1 && pfd.revents == POLLHUP,
+         "poll after close");
+  CHECK (read (fds[0], &c, 1) == 0, "read end of file");
+  close (fds[0]);
+}
@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(poll-pipe) begin
+(poll-pipe) pipe
+(poll-pipe) poll empty pipe, no wait
+(poll-pipe) poll empty pipe, 20 ms
+(poll-pipe) set O_NONBLOCK
+(poll-pipe) get O_NONBLOCK
+(poll-pipe) read empty pipe fails
+(poll-pipe) clone writer
+(poll-pipe) poll until written
+(poll-pipe) read "x"
+(poll-pipe) poll after close
+(poll-pipe) read end of file
+(poll-pipe) end
+poll-pipe: exit(0)
+EOF
+pass;
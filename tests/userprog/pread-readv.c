@@ -0,0 +1,29 @@
+/* Reads sample.txt at an offset with pread(), then from the start
+   into two buffers with readv(), which shows that pread() left the
+   file position alone. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  char head[16], tail[32], mid[40];
+  struct iovec iov[] = { { head, sizeof head }, { tail, sizeof tail } };
+  int handle;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+
+  CHECK (pread (handle, mid, sizeof mid, 100) == (int) sizeof mid,
+         "pread 40 bytes at offset 100");
+  compare_bytes (mid, sample + 100, sizeof mid, 100, "sample.txt");
+
+  CHECK (readv (handle, iov, 2) == (int) (sizeof head + sizeof tail),
+         "readv 48 bytes into 2 buffers");
+  compare_bytes (head, sample, sizeof head, 0, "sample.txt");
+  compare_bytes (tail, sample + sizeof head, sizeof tail, sizeof head,
+                 "sample.txt");
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(pread-readv) begin
+(pread-readv) open "sample.txt"
+(pread-readv) pread 40 bytes at offset 100
+(pread-readv) readv 48 bytes into 2 buffers
+(pread-readv) end
+pread-readv: exit(0)
+EOF
+pass;
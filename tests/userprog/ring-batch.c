@@ -0,0 +1,52 @@
+/* Queues three preads of sample.txt and an exit, which may not be
+   queued, on a submission ring and runs them with one system
+   call. */
+
+#include <string.h>
+#include <syscall.h>
+#include <syscall-nr.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static struct io_ring ring;
+static char buf[3][32];
+
+static void
+queue (uint32_t op, uint64_t a0, uint64_t a1, uint64_t a2, uint64_t a3)
+{
+  struct ioring_sqe *sqe = &ring.sq[ring.sq_tail++ % IORING_ENTRIES];
+
+  memset (sqe, 0, sizeof *sqe);
+  sqe->op = op;
+  sqe->args[0] = a0;
+  sqe->args[1] = a1;
+  sqe->args[2] = a2;
+  sqe->args[3] = a3;
+  sqe->user_data = ring.sq_tail;
+}
+
+void
+test_main (void) 
+{
+  int handle, i;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  for (i = 0; i < 3; i++)
+    queue (SYS_PREAD, handle, (uint64_t) buf[i], sizeof buf[i], 64 * i);
+  queue (SYS_EXIT, 1, 0, 0, 0);
+
+  CHECK (enter_ring (&ring) == 4, "enter_ring ran 4 entries");
+  if (ring.sq_head != 4 || ring.cq_tail != 4)
+    fail ("ring indices not advanced");
+  for (i = 0; i < 3; i++)
+    {
+      struct ioring_cqe *cqe = &ring.cq[i];
+
+      if (cqe->user_data != (uint64_t) i + 1 || cqe->res != sizeof buf[i])
+        fail ("bad completion %d", i);
+      compare_bytes (buf[i], sample + 64 * i, sizeof buf[i], 64 * i,
+                     "sample.txt");
+    }
+  CHECK (ring.cq[3].res == -1, "exit was refused");
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(ring-batch) begin
+(ring-batch) open "sample.txt"
+(ring-batch) enter_ring ran 4 entries
+(ring-batch) exit was refused
+(ring-batch) end
+ring-batch: exit(0)
+EOF
+pass;
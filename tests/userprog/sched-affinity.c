@@ -0,0 +1,62 @@
+/* Pins the process to CPU 0, checks that bad masks and threads of
+   other processes are refused, then has a cloned thread, which
+   starts with the same mask, play ping-pong with the main thread
+   through a pair of pipes.  Neither may move to another CPU. */
+
+#include <rusage.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ROUND_CNT 100
+
+static int ping[2], pong[2];
+static char stack[4096] __attribute__ ((aligned (16)));
+
+static void
+ponger (void *aux UNUSED)
+{
+  char c;
+  int i;
+
+  if (sched_getaffinity (0) != 1)
+    exit (1);
+  for (i = 0; i < ROUND_CNT; i++)
+    if (read (ping[0], &c, 1) != 1 || write (pong[1], &c, 1) != 1)
+      exit (1);
+}
+
+void
+test_main (void) 
+{
+  struct rusage before, after;
+  pid_t tid;
+  char c;
+  int i;
+
+  CHECK ((sched_getaffinity (0) & 1) != 0, "may run on CPU 0");
+  CHECK (sched_setaffinity (0, 1) == 0, "pin to CPU 0");
+  CHECK (sched_getaffinity (0) == 1, "mask is 1");
+  CHECK (sched_setaffinity (0, 0) == -1, "empty mask refused");
+  CHECK (sched_getaffinity (0) == 1, "mask is still 1");
+  CHECK (sched_setaffinity (1, 1) == -1, "other process refused");
+
+  CHECK (pipe (ping) == 0 && pipe (pong) == 0, "pipes");
+  CHECK (getrusage (RUSAGE_SELF, &before) == 0, "getrusage");
+  tid = clone (ponger, stack + sizeof stack, NULL);
+  CHECK (tid > 0, "clone ponger");
+  CHECK (sched_setaffinity (tid, 1) == 0, "pin ponger");
+  for (i = 0; i < ROUND_CNT; i++)
+    {
+      c = i;
+      if (write (ping[1], &c, 1) != 1 || read (pong[0], &c, 1) != 1
+          || c != (char) i)
+        fail ("round %d failed", i);
+    }
+  msg ("%d rounds", ROUND_CNT);
+
+  CHECK (getrusage (RUSAGE_SELF, &after) == 0, "getrusage");
+  if (after.nmigrate != before.nmigrate)
+    fail ("%lld migrations", after.nmigrate - before.nmigrate);
+  msg ("no migrations");
+}
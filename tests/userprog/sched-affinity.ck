@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(sched-affinity) begin
+(sched-affinity) may run on CPU 0
+(sched-affinity) pin to CPU 0
+(sched-affinity) mask is 1
+(sched-affinity) empty mask refused
+(sched-affinity) mask is still 1
+(sched-affinity) other process refused
+(sched-affinity) pipes
+(sched-affinity) getrusage
+(sched-affinity) clone ponger
+(sched-affinity) pin ponger
+(sched-affinity) 100 rounds
+(sched-affinity) getrusage
+(sched-affinity) no migrations
+(sched-affinity) end
+sched-affinity: exit(0)
+EOF
+pass;
@@ -0,0 +1,14 @@
+/* Tries to spawn a nonexistent program.
+   The spawn system call must return -1 once the load has failed. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  char *argv[] = { "no-such-file", "arg", NULL };
+
+  msg ("spawn(\"no-such-file\"): %d", spawn ("no-such-file", argv));
+}
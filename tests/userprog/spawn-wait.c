@@ -0,0 +1,20 @@
+/* Spawns a child and waits for it twice.  The first wait must
+   return the child's exit code once it has run; the second must
+   return -1 immediately, as must a wait for a process that is not a
+   child. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  char *argv[] = { "child-simple", NULL };
+  pid_t child;
+
+  CHECK ((child = spawn ("child-simple", argv)) > 0, "spawn child-simple");
+  msg ("wait(spawn()) = %d", wait (child));
+  msg ("wait(spawn()) = %d", wait (child));
+  msg ("wait(12345) = %d", wait (12345));
+}
@@ -0,0 +1,29 @@
+/* Reads the time page, which must tick forward without a system
+   call, then tries to write it, which must kill the process. */
+
+#include <syscall.h>
+#include <time.h>
+#include <timepage.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  int64_t start = time_ticks ();
+  uint64_t prev = time_ns (), now;
+  int i;
+
+  for (i = 0; i < 1000; i++)
+    {
+      now = time_ns ();
+      if (now < prev)
+        fail ("time went backward");
+      prev = now;
+    }
+  CHECK (time_ticks () >= start, "ticks do not go backward");
+
+  msg ("write time page");
+  *(volatile int64_t *) TIMEPAGE_ADDR = 0;
+  fail ("should have exited with -1");
+}
@@ -0,0 +1,29 @@
+/* Child process of shm-share.
+   Maps the parent's segment at another address, checks the parent's
+   writes to its first page and writes the second. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+extern const char *test_name;
+
+#define PAGE 4096
+static char *const shared = (char *) 0x20000000;
+
+int
+main (void)
+{
+  int shm, i;
+
+  test_name = "child-shm";
+  shm = shm_open ("shm-share", 0);
+  if (shm < 0 || shm_map (shm, shared) != shared)
+    fail ("cannot map the segment");
+  for (i = 0; i < PAGE; i++)
+    if (shared[i] != (char) (i % 253))
+      fail ("byte %d of the first page is wrong", i);
+  for (i = 0; i < PAGE; i++)
+    shared[PAGE + i] = ~(i % 253);
+  return 0;
+}
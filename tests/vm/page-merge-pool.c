@@ -0,0 +1,87 @@
+/* Generates about 1 MB of random data and sorts it with
+   parallel_sort() on a thread pool, one thread per CPU, within the
+   process rather than in subprocesses as page-merge-par does.
+   Checks parallel_for() on the same pool first, then verifies the
+   sorted data against a histogram taken before. */
+
+#include <pool.h>
+#include <syscall.h>
+#include "tests/arc4.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define DATA_SIZE (1024 * 1024)         /* Buffer size. */
+#define FOR_CNT 100000                  /* Indexes for parallel_for(). */
+
+static unsigned char buf[DATA_SIZE];
+static size_t histogram[256];
+static unsigned char visits[FOR_CNT];
+
+/* Counts a visit to each index from BEGIN up to END. */
+static void
+visit (long begin, long end, void *aux)
+{
+  long *sum = aux;
+  long i, part = 0;
+
+  for (i = begin; i < end; i++)
+    {
+      visits[i]++;
+      part += i;
+    }
+  __atomic_add_fetch (sum, part, __ATOMIC_RELAXED);
+}
+
+/* Orders bytes for parallel_sort(). */
+static int
+order_bytes (const void *a_, const void *b_)
+{
+  const unsigned char *a = a_;
+  const unsigned char *b = b_;
+
+  return *a < *b ? -1 : *a > *b;
+}
+
+void
+test_main (void)
+{
+  struct arc4 arc4;
+  struct pool *pool;
+  size_t buf_idx, hist_idx;
+  long sum = 0;
+  long i;
+
+  pool = pool_create (0);
+  CHECK (pool != NULL, "create pool");
+
+  parallel_for (pool, 0, FOR_CNT, 1000, visit, &sum);
+  for (i = 0; i < FOR_CNT; i++)
+    if (visits[i] != 1)
+      fail ("index %ld visited %d times", i, visits[i]);
+  if (sum != (long) FOR_CNT * (FOR_CNT - 1) / 2)
+    fail ("sum is %ld", sum);
+  msg ("parallel_for visited each index once");
+
+  msg ("init");
+  arc4_init (&arc4, "foobar", 6);
+  arc4_crypt (&arc4, buf, sizeof buf);
+  for (i = 0; i < DATA_SIZE; i++)
+    histogram[buf[i]]++;
+
+  msg ("sort");
+  CHECK (parallel_sort (pool, buf, DATA_SIZE, 1, order_bytes),
+         "parallel_sort");
+  pool_destroy (pool);
+
+  msg ("verify");
+  buf_idx = 0;
+  for (hist_idx = 0; hist_idx < sizeof histogram / sizeof *histogram;
+       hist_idx++)
+    while (histogram[hist_idx]-- > 0)
+      {
+        if (buf[buf_idx] != hist_idx)
+          fail ("bad value %d in byte %zu", buf[buf_idx], buf_idx);
+        buf_idx++;
+      }
+  msg ("success, buf_idx=%'zu", buf_idx);
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(page-merge-pool) begin
+(page-merge-pool) create pool
+(page-merge-pool) parallel_for visited each index once
+(page-merge-pool) init
+(page-merge-pool) sort
+(page-merge-pool) parallel_sort
+(page-merge-pool) verify
+(page-merge-pool) success, buf_idx=1,048,576
+(page-merge-pool) end
+page-merge-pool: exit(0)
+EOF
+pass;
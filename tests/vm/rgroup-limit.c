@@ -0,0 +1,51 @@
+/* Checks that a resource group keeps its members' resident frames
+   within its cap by evicting their own pages, that a child starts
+   in its parent's group, and that a group goes away with its last
+   member. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 128
+#define FRAME_CAP 32
+
+static char buf[PAGE_CNT * PAGE_SIZE];
+
+void
+test_main (void)
+{
+	struct rgroup_limits limits = { .frame_max = FRAME_CAP };
+	struct rgroup_stat st;
+	pid_t child;
+	size_t i;
+	int id;
+
+	id = rgroup_create (&limits);
+	CHECK (id > 0, "rgroup_create");
+
+	for (i = 0; i < PAGE_CNT; i++)
+		buf[i * PAGE_SIZE] = i;
+	CHECK (rgroup_stat (0, &st) == 0 && st.id == id, "rgroup_stat");
+	CHECK (st.frames <= FRAME_CAP, "frames within the cap");
+	CHECK (st.reclaim_cnt > 0, "frames reclaimed within the group");
+	for (i = 0; i < PAGE_CNT; i++)
+		if (buf[i * PAGE_SIZE] != (char) i)
+			fail ("page %zu corrupted", i);
+	msg ("contents intact");
+
+	child = fork ("child");
+	if (child == 0)
+		exit (rgroup_stat (0, &st) == 0 && st.id == id && st.member_cnt == 2
+				? 0 : 1);
+	if (child < 0)
+		fail ("fork");
+	CHECK (wait (child) == 0, "child in the parent's group");
+	CHECK (rgroup_stat (id, &st) == 0 && st.member_cnt == 1,
+			"child gone from the group");
+
+	CHECK (rgroup_join (0) == 0, "leave the group");
+	CHECK (rgroup_stat (id, &st) == -1, "group gone with its last member");
+	CHECK (rgroup_join (id) == -1, "joining it fails");
+}
@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(rgroup-limit) begin
+(rgroup-limit) rgroup_create
+(rgroup-limit) rgroup_stat
+(rgroup-limit) frames within the cap
+(rgroup-limit) frames reclaimed within the group
+(rgroup-limit) contents intact
+child: exit(0)
+(rgroup-limit) child in the parent's group
+(rgroup-limit) child gone from the group
+(rgroup-limit) leave the group
+(rgroup-limit) group gone with its last member
+(rgroup-limit) joining it fails
+(rgroup-limit) end
+rgroup-limit: exit(0)
+EOF
+pass;
@@ -0,0 +1,59 @@
+/* Checks that getrusage() counts the page faults and CPU time of
+   the calling process, and those of a child once it has been
+   waited for. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 16
+
+static char buf[PAGE_CNT * PAGE_SIZE];
+
+/* Writes to every page of BUF, each for the first time. */
+static void
+touch_pages (void)
+{
+	size_t i;
+
+	for (i = 0; i < PAGE_CNT; i++)
+		buf[i * PAGE_SIZE] = i;
+}
+
+void
+test_main (void)
+{
+	struct rusage before, after, children;
+	pid_t child;
+
+	CHECK (getrusage (RUSAGE_SELF, &before) == 0, "getrusage (self)");
+	touch_pages ();
+	CHECK (getrusage (RUSAGE_SELF, &after) == 0, "getrusage (self)");
+	CHECK (after.minflt + after.majflt > before.minflt + before.majflt,
+			"touching pages counts faults");
+
+	/* Spin until a timer tick lands in user mode. */
+	while (after.utime == 0)
+		getrusage (RUSAGE_SELF, &after);
+	msg ("user time counted");
+
+	CHECK (getrusage (RUSAGE_CHILDREN, &children) == 0,
+			"getrusage (children)");
+	CHECK (children.minflt + children.majflt == 0, "no children yet");
+	child = fork ("child");
+	if (child == 0) {
+		/* The pages are shared copy-on-write, so each write faults. */
+		touch_pages ();
+		exit (0);
+	}
+	if (child < 0)
+		fail ("fork");
+	CHECK (wait (child) == 0, "wait for child");
+	CHECK (getrusage (RUSAGE_CHILDREN, &children) == 0,
+			"getrusage (children)");
+	CHECK (children.minflt + children.majflt >= PAGE_CNT,
+			"child's faults counted");
+
+	CHECK (getrusage (12, &after) == -1, "getrusage (12) fails");
+}
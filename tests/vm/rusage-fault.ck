@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(rusage-fault) begin
+(rusage-fault) getrusage (self)
+(rusage-fault) getrusage (self)
+(rusage-fault) touching pages counts faults
+(rusage-fault) user time counted
+(rusage-fault) getrusage (children)
+(rusage-fault) no children yet
+child: exit(0)
+(rusage-fault) wait for child
+(rusage-fault) getrusage (children)
+(rusage-fault) child's faults counted
+(rusage-fault) getrusage (12) fails
+(rusage-fault) end
+rusage-fault: exit(0)
+EOF
+pass;
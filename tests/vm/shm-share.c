@@ -0,0 +1,39 @@
+/* Shares a two-page memory segment with a child process, which maps
+   it at another address, checks what the parent wrote in the first
+   page and writes the second.  The parent waits for the child by
+   reading end of file from a pipe whose write end only the child
+   still holds. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE 4096
+static char *const shared = (char *) 0x10000000;
+
+void
+test_main (void)
+{
+  char *argv[] = { "child-shm", NULL };
+  int fds[2], shm, i;
+  char c;
+
+  CHECK (pipe (fds) == 0, "pipe");
+  CHECK ((shm = shm_open ("shm-share", 2 * PAGE)) > 2, "shm_open");
+  CHECK (shm_map (shm, shared) == shared, "shm_map");
+  for (i = 0; i < PAGE; i++)
+    shared[i] = i % 253;
+
+  CHECK (spawn ("child-shm", argv) > 0, "spawn child-shm");
+  close (fds[1]);
+  if (read (fds[0], &c, 1) != 0)
+    fail ("pipe still has a writer");
+  msg ("child exited");
+
+  for (i = 0; i < PAGE; i++)
+    if (shared[PAGE + i] != (char) ~(i % 253))
+      fail ("byte %d of the second page is wrong", i);
+  msg ("child's writes are visible");
+  munmap (shared);
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(shm-share) begin
+(shm-share) pipe
+(shm-share) shm_open
+(shm-share) shm_map
+(shm-share) spawn child-shm
+(shm-share) child exited
+(shm-share) child's writes are visible
+(shm-share) end
+EOF
+pass;
@@ -0,0 +1,146 @@
+#include "threads/cpu.h"
+#include <debug.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/lapic.h"
+#include "threads/fpu.h"
+#include "threads/mmu.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "devices/timer.h"
+#include "intrinsic.h"
+#ifdef USERPROG
+#include "userprog/gdt.h"
+#include "userprog/syscall.h"
+#include "userprog/tss.h"
+#endif
+
+/* All CPUs.  cpus[0] is the boot processor. */
+struct cpu cpus[CPU_MAX];
+
+/* Number of CPUs online, that is, running threads.  Changes only
+   under the interrupt lock. */
+int cpu_cnt = 1;
+
+/* Start the other CPUs?  Set by the -smp kernel option. */
+bool cpu_smp;
+
+/* How long cpu_start_aps() waits for CPUs to come online. */
+#define AP_WAIT_MS 100
+
+/* Idle thread pages of the other CPUs: page I - 1 belongs to
+   cpus[I], which starts out on the stack at the top of it.  These
+   and the two variables below are used by ap-start.S. */
+uint8_t ap_pages[CPU_MAX - 1][PGSIZE] __attribute__ ((aligned (PGSIZE)));
+
+/* Physical address of base_pml4, for starting CPUs to load. */
+uint64_t ap_cr3;
+
+/* Index in cpus[] of the next CPU to start. */
+int ap_next_id = 1;
+
+/* Startup code, copied to AP_START_PA. */
+extern const char ap_start[], ap_start_end[];
+
+/* Makes the GS base point to C on the running CPU, and zeroes
+   the base that user code will get. */
+static void
+load_gs_base (struct cpu *c) {
+	write_msr (MSR_GS_BASE, (uint64_t) c);
+	write_msr (MSR_KERNEL_GS_BASE, 0);
+}
+
+/* Sets up the boot processor's struct cpu, so that cpu_current()
+   works.  Must be called before anything else that uses per-CPU
+   state. */
+void
+cpu_init (void) {
+	struct cpu *c = &cpus[0];
+
+	ASSERT (offsetof (struct cpu, self) == CPU_SELF);
+	ASSERT (offsetof (struct cpu, scratch) == CPU_SCRATCH);
+	ASSERT (offsetof (struct cpu, tss) == CPU_TSS);
+	ASSERT (offsetof (struct cpu, id) == CPU_ID);
+
+	c->self = c;
+	c->id = 0;
+	c->online = true;
+	load_gs_base (c);
+}
+
+/* If -smp was given, wakes the other CPUs and waits for them to
+   come online.  Each sets up its own GDT, TSS and idle thread,
+   then schedules threads from its own run queue.
+
+   From here on the interrupt lock is in use, page table changes
+   are shot down on the other CPUs (see mmu.c), and the timer ticks even while a CPU idles, since the boot
+   processor's tick keeps the time page and the other CPUs' ticks
+   drive load balancing. */
+void
+cpu_start_aps (void) {
+	char name[16];
+	int i;
+
+	ASSERT (intr_get_level () == INTR_ON);
+
+	if (!cpu_smp)
+		return;
+	if (!lapic_init ()) {
+		printf ("No local APIC, not starting other CPUs.\n");
+		return;
+	}
+	cpus[0].apic_id = lapic_id ();
+
+	for (i = 1; i < CPU_MAX; i++) {
+		struct cpu *c = &cpus[i];
+
+		c->self = c;
+		c->id = i;
+		snprintf (name, sizeof name, "idle%d", i);
+		c->idle_thread = thread_init_idle (ap_pages[i - 1], name);
+		c->curr = c->idle_thread;
+	}
+
+	intr_lock_init ();
+	timer_tickless = false;
+
+	memcpy (ptov (AP_START_PA), ap_start, ap_start_end - ap_start);
+	ap_cr3 = vtop (base_pml4);
+	lapic_start_aps (AP_START_PA);
+
+	for (i = 0; i < AP_WAIT_MS / 10 && cpu_cnt < CPU_MAX; i++)
+		timer_msleep (10);
+	printf ("%d CPUs online.\n", cpu_cnt);
+}
+
+/* Called by ap-start.S on each other CPU, with interrupts off,
+   once it runs in long mode on base_pml4.  ID is its index in
+   cpus[]. */
+void
+cpu_ap_main (int id) {
+	struct cpu *c = &cpus[id];
+
+	load_gs_base (c);
+#ifdef USERPROG
+	tss_init ();
+	gdt_init ();
+	syscall_init_cpu ();
+#endif
+	intr_init_ap ();
+	pml4_init_ap ();
+	fpu_init ();
+	lapic_init ();
+	c->apic_id = lapic_id ();
+	timer_init_ap ();
+
+	/* Come online under the interrupt lock, which intr_disable()
+	   takes only when interrupts were on. */
+	intr_enable ();
+	intr_disable ();
+	c->online = true;
+	cpu_cnt++;
+	thread_start_ap ();
+}
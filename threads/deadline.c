@@ -0,0 +1,196 @@
+#include "threads/sched.h"
+#include <debug.h>
+#include "threads/interrupt.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Earliest-deadline-first scheduling, above every class.
+
+   A thread that called thread_set_deadline() is promised RUNTIME
+   ticks of CPU time in every PERIOD ticks, within DEADLINE ticks of
+   the start of the period.  While it has budget left it is a
+   deadline thread: it goes on its CPU's deadline tree, ordered by
+   absolute deadline, which pick_next drains before asking the
+   selected class, and it preempts any thread of the normal classes
+   or any deadline thread with a later deadline.
+
+   A deadline thread that uses up its budget is throttled: until
+   its next period starts it is queued and run by the selected
+   class like any other thread, so a runaway worker can take no
+   more than its reserved share from the normal classes.  Budgets
+   are refilled lazily, when the thread is next queued or charged.
+
+   Admission control keeps the total reserved bandwidth, the sum
+   of RUNTIME / PERIOD over the deadline threads, under
+   DL_BW_MAX.  The limit is that of a single CPU, which keeps the
+   reservations sound however threads are spread across CPUs. */
+
+/* Bandwidths are fractions of one CPU, in units of 1 / DL_BW_ONE. */
+#define DL_BW_ONE (1 << 20)
+#define DL_BW_MAX (DL_BW_ONE * 95 / 100)
+
+/* Bandwidth reserved by all deadline threads.  Protected by
+   disabling interrupts. */
+static int64_t dl_bw;
+
+static inline struct thread *
+dl_entry (const struct rb_node *n) {
+	return rb_entry (n, struct thread, dl_elem);
+}
+
+/* Orders threads by absolute deadline, then by tid, since the tree
+   holds only one node of each rank. */
+static bool
+dl_less (const struct rb_node *a_, const struct rb_node *b_,
+		void *aux UNUSED) {
+	const struct thread *a = dl_entry (a_);
+	const struct thread *b = dl_entry (b_);
+
+	if (a->dl_abs_deadline != b->dl_abs_deadline)
+		return a->dl_abs_deadline < b->dl_abs_deadline;
+	return a->tid < b->tid;
+}
+
+/* Initializes RQ's deadline tree. */
+void
+dl_runqueue_init (struct runqueue *rq) {
+	rb_init (&rq->dl_tree, dl_less, NULL);
+}
+
+/* Starts a new period of T at NOW, with a full budget. */
+static void
+dl_replenish (struct thread *t, int64_t now) {
+	t->dl_period_start = now;
+	t->dl_abs_deadline = now + t->dl_deadline;
+	t->dl_budget = t->dl_runtime;
+}
+
+/* Returns true if T is a deadline thread with budget left in its
+   current period, starting a new period first if one is due. */
+static bool
+dl_active (struct thread *t) {
+	int64_t now;
+
+	if (t->dl_runtime == 0)
+		return false;
+	now = timer_ticks ();
+	if (now >= t->dl_period_start + t->dl_period
+			|| (t->dl_budget > 0 && now >= t->dl_abs_deadline))
+		dl_replenish (t, now);
+	return t->dl_budget > 0;
+}
+
+/* Puts T on RQ's deadline tree and returns true if it is an active
+   deadline thread, otherwise returns false. */
+bool
+dl_enqueue (struct runqueue *rq, struct thread *t) {
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (!dl_active (t))
+		return false;
+	rb_insert (&rq->dl_tree, &t->dl_elem);
+	t->dl_queued = true;
+	return true;
+}
+
+/* Removes T from RQ's deadline tree and returns true if it is on
+   it, otherwise returns false. */
+bool
+dl_dequeue (struct runqueue *rq, struct thread *t) {
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (!t->dl_queued)
+		return false;
+	rb_remove (&rq->dl_tree, &t->dl_elem);
+	t->dl_queued = false;
+	return true;
+}
+
+/* Removes and returns the thread with the earliest deadline on RQ,
+   or returns a null pointer if there is none. */
+struct thread *
+dl_pick_next (struct runqueue *rq) {
+	struct rb_node *n = rb_first (&rq->dl_tree);
+	struct thread *t;
+
+	if (n == NULL)
+		return NULL;
+	t = dl_entry (n);
+	rb_remove (&rq->dl_tree, n);
+	t->dl_queued = false;
+	return t;
+}
+
+/* Returns true if a deadline thread on RQ should replace CURR, and
+   sets *DECIDED to whether the deadline class had a say at all, that
+   is, whether either is a deadline thread. */
+bool
+dl_preempts (const struct runqueue *rq, const struct thread *curr,
+		bool *decided) {
+	struct rb_node *n = rb_first (&rq->dl_tree);
+	bool curr_dl = curr->dl_runtime != 0 && curr->dl_budget > 0;
+
+	*decided = n != NULL || curr_dl;
+	if (n == NULL)
+		return false;
+	return !curr_dl || dl_entry (n)->dl_abs_deadline < curr->dl_abs_deadline;
+}
+
+/* Charges T, if it is running as a deadline thread, for the
+   ELAPSED ticks it ran, and throttles it once its budget is gone. */
+void
+dl_tick (struct thread *t, int64_t elapsed) {
+	if (t->dl_runtime == 0 || t->dl_budget <= 0)
+		return;
+	t->dl_budget -= elapsed;
+	if (t->dl_budget <= 0)
+		intr_yield_on_return ();
+}
+
+/* Makes the running thread a deadline thread that needs RUNTIME
+   ticks of CPU time within DEADLINE ticks of the start of every
+   PERIOD ticks, or, if RUNTIME is 0, an ordinary thread again.
+   Returns true if successful, false if the parameters do not
+   satisfy 0 < RUNTIME <= DEADLINE <= PERIOD or the reservation
+   would exceed the bandwidth left. */
+bool
+thread_set_deadline (int64_t runtime, int64_t deadline, int64_t period) {
+	struct thread *t = thread_current ();
+	enum intr_level old_level;
+	int64_t bw = 0;
+	bool ok = true;
+
+	ASSERT (!intr_context ());
+
+	if (runtime == 0 && t->dl_runtime == 0)
+		return true;
+	if (runtime != 0) {
+		if (runtime < 0 || runtime > deadline || deadline > period)
+			return false;
+		bw = runtime * DL_BW_ONE / period;
+	}
+
+	old_level = intr_disable ();
+	if (t->dl_runtime != 0)
+		dl_bw -= t->dl_runtime * DL_BW_ONE / t->dl_period;
+	if (dl_bw + bw > DL_BW_MAX) {
+		/* Keep the old reservation. */
+		if (t->dl_runtime != 0)
+			dl_bw += t->dl_runtime * DL_BW_ONE / t->dl_period;
+		ok = false;
+	} else {
+		dl_bw += bw;
+		t->dl_runtime = runtime;
+		t->dl_deadline = deadline;
+		t->dl_period = period;
+		if (runtime != 0)
+			dl_replenish (t, timer_ticks ());
+		else
+			t->dl_budget = 0;
+	}
+	intr_set_level (old_level);
+
+	if (ok)
+		thread_yield ();
+	return ok;
+}
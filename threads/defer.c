@@ -0,0 +1,131 @@
+#include "threads/defer.h"
+#include <debug.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "threads/cpu.h"
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Each CPU queues work on its own list, CPU->defer_head, newest
+   first.  Pushing is a compare-and-swap on the head, so it needs
+   no lock, from a handler or from a thread that an interrupt may
+   preempt mid-push; the worker takes a whole list at once with an
+   exchange, and runs it oldest first. */
+
+/* Thread that runs the work, or a null pointer until defer_start(). */
+static struct thread *worker;
+
+/* Upped whenever work is queued once the worker exists. */
+static struct semaphore work_sema;
+
+/* Statistics. */
+static long long defer_cnt;     /* # of pieces of work run. */
+static long long defer_wakeups; /* # of times the worker ran some. */
+
+static thread_func defer_thread;
+
+/* Starts the thread that runs deferred work.  Work queued before
+   then runs as soon as the thread does. */
+void
+defer_start (void) {
+	struct semaphore started;
+
+	sema_init (&work_sema, 0);
+	sema_init (&started, 0);
+	if (thread_create ("defer", PRI_MAX, defer_thread, &started) == TID_ERROR)
+		PANIC ("cannot start deferred work thread");
+	sema_down (&started);
+}
+
+/* Initializes D to run FUNC (AUX) each time it is queued. */
+void
+defer_init (struct defer *d, defer_func *func, void *aux) {
+	d->next = NULL;
+	d->func = func;
+	d->aux = aux;
+	d->queued = 0;
+}
+
+/* Queues D to run on the worker thread, and returns true, unless
+   it is already queued, in which case it returns false.  May be
+   called from an interrupt handler. */
+bool
+defer_schedule (struct defer *d) {
+	struct defer *volatile *head;
+	struct defer *old;
+
+	if (__atomic_exchange_n (&d->queued, 1, __ATOMIC_ACQUIRE))
+		return false;
+
+	head = &cpu_current ()->defer_head;
+	old = *head;
+	do
+		d->next = old;
+	while (!__atomic_compare_exchange_n (head, &old, d, false,
+				__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	if (worker != NULL)
+		sema_up (&work_sema);
+	return true;
+}
+
+/* Takes the work queued on every CPU and runs it, oldest first on
+   each.  Returns true if there was any. */
+static bool
+run_work (void) {
+	bool any = false;
+	int i;
+
+	for (i = 0; i < CPU_MAX; i++) {
+		struct defer *list = __atomic_exchange_n (&cpus[i].defer_head, NULL,
+				__ATOMIC_ACQUIRE);
+		struct defer *fifo = NULL;
+
+		/* Reverse the list into queuing order. */
+		while (list != NULL) {
+			struct defer *next = list->next;
+
+			list->next = fifo;
+			fifo = list;
+			list = next;
+		}
+
+		while (fifo != NULL) {
+			struct defer *d = fifo;
+
+			/* Clear the flag first, so that D can queue itself
+			   again while it runs. */
+			fifo = d->next;
+			__atomic_store_n (&d->queued, 0, __ATOMIC_RELEASE);
+			d->func (d->aux);
+			defer_cnt++;
+			any = true;
+		}
+	}
+	return any;
+}
+
+/* Deferred work thread.  Runs queued work, then waits for more. */
+static void
+defer_thread (void *started_) {
+	struct semaphore *started = started_;
+
+	worker = thread_current ();
+	sema_up (started);
+
+	for (;;) {
+		ASSERT (intr_get_level () == INTR_ON);
+		if (run_work ())
+			defer_wakeups++;
+		sema_down (&work_sema);
+	}
+}
+
+/* Prints deferred work statistics. */
+void
+defer_print_stats (void) {
+	if (defer_cnt != 0)
+		printf ("Deferred work: %lld items in %lld runs\n",
+				defer_cnt, defer_wakeups);
+}
@@ -0,0 +1,135 @@
+#include "threads/sched.h"
+#include <debug.h>
+#include "threads/cpu.h"
+#include "threads/interrupt.h"
+#include "threads/thread.h"
+
+/* Fair-share scheduler: the "fair" class.
+
+   Each thread accumulates a virtual runtime, the timer ticks it
+   has run scaled by the inverse of its weight, which follows from
+   its nice value so that each step of nice is worth roughly 10% of
+   the CPU against a nice-0 thread.  A CPU's ready threads are kept
+   in a tree by virtual runtime, and the leftmost, the one that has
+   had least of its share, runs next.  Priorities are ignored.
+
+   A thread that slept falls behind the others, and left alone it
+   would then hog the CPU until it caught up.  Instead, a thread
+   made ready is placed no further back than SLEEPER_CREDIT behind
+   the least virtual runtime its queue has seen, which gives a
+   woken, interactive thread a head start over the CPU hogs
+   without letting it starve them.  A woken thread that is at least
+   WAKEUP_GRAN ahead of the running thread preempts it. */
+
+/* Virtual runtime a nice-0 thread accumulates per tick. */
+#define VRUNTIME_PER_TICK 1024
+
+/* Weight of a nice-0 thread. */
+#define WEIGHT_NICE_0 1024
+
+#define SLEEPER_CREDIT (2 * VRUNTIME_PER_TICK)
+#define WAKEUP_GRAN (1 * VRUNTIME_PER_TICK)
+
+/* Weights by nice value, from NICE_MIN to NICE_MAX: each step is
+   a factor of about 1.25. */
+static const unsigned weights[NICE_MAX - NICE_MIN + 1] = {
+	88761, 71755, 56483, 46273, 36291,      /* -20 ... -16 */
+	29154, 23254, 18705, 14949, 11916,      /* -15 ... -11 */
+	9548, 7620, 6100, 4904, 3906,           /* -10 ...  -6 */
+	3121, 2501, 1991, 1586, 1277,           /*  -5 ...  -1 */
+	1024, 820, 655, 526, 423,               /*   0 ...   4 */
+	335, 272, 215, 172, 137,                /*   5 ...   9 */
+	110, 87, 70, 56, 45,                    /*  10 ...  14 */
+	36, 29, 23, 18, 15,                     /*  15 ...  19 */
+	12,                                     /*  20 */
+};
+
+static inline struct thread *
+fair_entry (const struct rb_node *n) {
+	return rb_entry (n, struct thread, fair_elem);
+}
+
+/* Orders threads by virtual runtime, then by tid, since the tree
+   holds only one node of each rank. */
+static bool
+fair_less (const struct rb_node *a_, const struct rb_node *b_,
+		void *aux UNUSED) {
+	const struct thread *a = fair_entry (a_);
+	const struct thread *b = fair_entry (b_);
+
+	if (a->vruntime != b->vruntime)
+		return a->vruntime < b->vruntime;
+	return a->tid < b->tid;
+}
+
+/* Initializes RQ's tree. */
+void
+fair_runqueue_init (struct runqueue *rq) {
+	rb_init (&rq->tree, fair_less, NULL);
+	rq->min_vruntime = 0;
+}
+
+static void
+fair_enqueue (struct runqueue *rq, struct thread *t) {
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	/* Sleeper fairness.  This also places new threads, and threads
+	   migrated from another CPU's queue, near this queue's. */
+	if (rq->min_vruntime > SLEEPER_CREDIT
+			&& t->vruntime < rq->min_vruntime - SLEEPER_CREDIT)
+		t->vruntime = rq->min_vruntime - SLEEPER_CREDIT;
+
+	rb_insert (&rq->tree, &t->fair_elem);
+}
+
+static void
+fair_dequeue (struct runqueue *rq, struct thread *t) {
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	rb_remove (&rq->tree, &t->fair_elem);
+}
+
+static struct thread *
+fair_pick_next (struct runqueue *rq) {
+	struct rb_node *n;
+	struct thread *t;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	n = rb_first (&rq->tree);
+	if (n == NULL)
+		return NULL;
+	t = fair_entry (n);
+	rb_remove (&rq->tree, n);
+	if (t->vruntime > rq->min_vruntime)
+		rq->min_vruntime = t->vruntime;
+	return t;
+}
+
+static bool
+fair_preempts (const struct runqueue *rq, const struct thread *curr) {
+	struct rb_node *n = rb_first (&rq->tree);
+
+	return n != NULL && fair_entry (n)->vruntime + WAKEUP_GRAN < curr->vruntime;
+}
+
+/* Charges T for the ELAPSED ticks it ran, then hands the CPU to
+   a thread that is a tick behind it, if any. */
+static void
+fair_tick (struct thread *t, int64_t now UNUSED, int64_t elapsed) {
+	if (t == cpu_current ()->idle_thread)
+		return;
+	t->vruntime += (uint64_t) elapsed * VRUNTIME_PER_TICK * WEIGHT_NICE_0
+		/ weights[t->nice - NICE_MIN];
+	thread_preempt ();
+}
+
+const struct sched_class sched_fair = {
+	.name = "fair",
+	.enqueue = fair_enqueue,
+	.dequeue = fair_dequeue,
+	.pick_next = fair_pick_next,
+	.preempts = fair_preempts,
+	.yield = fair_enqueue,
+	.tick = fair_tick,
+};
@@ -0,0 +1,177 @@
+#include "threads/fpu.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/cpu.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "intrinsic.h"
+
+/* Lazy FPU context switching.
+
+   The x87/SSE registers are not saved or restored on a context
+   switch.  Instead, the CPU keeps the state of whichever thread
+   last used them, the "owner", and CR0.TS is set whenever any
+   other thread runs.  The first FPU or SSE instruction such a
+   thread executes raises #NM, and only then is the owner's state
+   saved and the new thread's state loaded.  Threads that never
+   touch the FPU pay nothing beyond the CR0 update, and the save
+   area is allocated on first use.
+
+   Each CPU has its own owner.  Once several CPUs run threads, a
+   thread may next run on a different CPU, so an owner's state is
+   saved as soon as it is switched out. */
+
+#define CR0_MP (1 << 1)         /* Monitor coprocessor. */
+#define CR0_EM (1 << 2)         /* x87 emulation. */
+#define CR0_TS (1 << 3)         /* Task switched. */
+#define CR4_OSFXSR (1 << 9)     /* OS supports FXSAVE/FXRSTOR. */
+#define CR4_OSXMMEXCPT (1 << 10)/* OS handles #XF. */
+
+/* MXCSR value at reset: all SIMD exceptions masked. */
+#define MXCSR_DEFAULT 0x1f80
+
+/* Statistics. */
+static long long fpu_loads;     /* # of #NM-triggered state loads. */
+static long long fpu_saves;     /* # of owner state saves. */
+
+static inline void
+set_ts (bool on) {
+	uint64_t cr0 = rcr0 ();
+
+	if (on && !(cr0 & CR0_TS))
+		lcr0 (cr0 | CR0_TS);
+	else if (!on && (cr0 & CR0_TS))
+		clts ();
+}
+
+static inline void
+fxsave (struct fpu_state *st) {
+	asm volatile ("fxsave %0" : "=m" (*st));
+}
+
+static inline void
+fxrstor (const struct fpu_state *st) {
+	asm volatile ("fxrstor %0" : : "m" (*st));
+}
+
+/* Enables FXSAVE and SSE, and arms the lazy-switch trap.  Must be
+   called before any thread can use the FPU. */
+void
+fpu_init (void) {
+	lcr4 (rcr4 () | CR4_OSFXSR | CR4_OSXMMEXCPT);
+	lcr0 ((rcr0 () & ~CR0_EM) | CR0_MP | CR0_TS);
+	cpu_current ()->fpu_owner = NULL;
+}
+
+/* Called by the scheduler, with interrupts off, when NEXT is
+   about to replace CURR.  Lets NEXT use the FPU directly if its
+   state is already live, and otherwise makes its first use trap. */
+void
+fpu_switch (struct thread *curr, struct thread *next) {
+	struct cpu *c = cpu_current ();
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (cpu_cnt > 1 && c->fpu_owner == curr && curr != next) {
+		clts ();
+		fxsave (curr->fpu);
+		fpu_saves++;
+		c->fpu_owner = NULL;
+	}
+	set_ts (next != c->fpu_owner);
+}
+
+/* #NM handler body: makes the FPU usable by the current thread,
+   saving the previous owner's state and loading the current
+   thread's, or a fresh state on its first use. */
+void
+fpu_handle_nm (void) {
+	struct thread *cur = thread_current ();
+	struct cpu *c;
+	enum intr_level old_level;
+	bool fresh = false;
+
+	if (cur->fpu == NULL) {
+		/* malloc() makes no promise of 16-byte alignment. */
+		cur->fpu_block = malloc_tagged (sizeof *cur->fpu + 15, TAG_FPU);
+		if (cur->fpu_block == NULL)
+			PANIC ("out of memory for FPU state of %s", cur->name);
+		cur->fpu = (struct fpu_state *) ROUND_UP ((uintptr_t) cur->fpu_block, 16);
+		fresh = true;
+	}
+
+	old_level = intr_disable ();
+	c = cpu_current ();
+	clts ();
+	if (c->fpu_owner != cur) {
+		if (c->fpu_owner != NULL) {
+			fxsave (c->fpu_owner->fpu);
+			fpu_saves++;
+		}
+		if (fresh) {
+			uint32_t mxcsr = MXCSR_DEFAULT;
+
+			asm volatile ("fninit; ldmxcsr %0" : : "m" (mxcsr));
+		} else
+			fxrstor (cur->fpu);
+		c->fpu_owner = cur;
+		fpu_loads++;
+	}
+	intr_set_level (old_level);
+}
+
+/* Gives CHILD a copy of PARENT's FPU state, if PARENT has used
+   the FPU.  Returns false if memory runs out. */
+bool
+fpu_fork (struct thread *child, struct thread *parent) {
+	enum intr_level old_level;
+	struct cpu *c;
+
+	if (parent->fpu == NULL)
+		return true;
+
+	child->fpu_block = malloc_tagged (sizeof *child->fpu + 15, TAG_FPU);
+	if (child->fpu_block == NULL)
+		return false;
+	child->fpu = (struct fpu_state *) ROUND_UP ((uintptr_t) child->fpu_block, 16);
+
+	/* If the parent's state is live, flush it to memory first. */
+	old_level = intr_disable ();
+	c = cpu_current ();
+	if (c->fpu_owner == parent) {
+		clts ();
+		fxsave (parent->fpu);
+		fpu_saves++;
+		set_ts (c->fpu_owner != thread_current ());
+	}
+	memcpy (child->fpu, parent->fpu, sizeof *child->fpu);
+	intr_set_level (old_level);
+	return true;
+}
+
+/* Discards T's FPU state, for exec or exit. */
+void
+fpu_release (struct thread *t) {
+	enum intr_level old_level = intr_disable ();
+	struct cpu *c = cpu_current ();
+	void *block = t->fpu_block;
+
+	if (c->fpu_owner == t) {
+		c->fpu_owner = NULL;
+		set_ts (true);
+	}
+	t->fpu = NULL;
+	t->fpu_block = NULL;
+	intr_set_level (old_level);
+	free (block);
+}
+
+/* Prints FPU statistics. */
+void
+fpu_print_stats (void) {
+	printf ("FPU: %lld lazy loads, %lld saves\n", fpu_loads, fpu_saves);
+}
@@ -1,6 +1,7 @@
 #include "threads/init.h"
 #include <console.h>
 #include <debug.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <random.h>
 #include <stddef.h>
@@ -8,22 +9,37 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <timepage.h>
 #include "devices/kbd.h"
 #include "devices/input.h"
 #include "devices/serial.h"
 #include "devices/timer.h"
 #include "devices/vga.h"
+#include "threads/cpu.h"
+#include "threads/defer.h"
+#include "threads/fpu.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
+#include "threads/kstack.h"
 #include "threads/loader.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
 #include "threads/mmu.h"
 #include "threads/palloc.h"
+#include "threads/profile.h"
+#include "threads/rcu.h"
+#include "threads/sched.h"
+#include "threads/trace.h"
 #include "threads/pte.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/vmalloc.h"
+#include "threads/workq.h"
+#include "intrinsic.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
+#include "userprog/fstrace.h"
 #include "userprog/gdt.h"
 #include "userprog/syscall.h"
 #include "userprog/tss.h"
@@ -34,8 +50,13 @@
 #endif
 #ifdef FILESYS
 #include "devices/disk.h"
+#include "filesys/dcache.h"
+#include "filesys/fat.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/journal.h"
+#include "filesys/page_cache.h"
+#include "filesys/tmpfs.h"
 #endif
 
 /* Page-map-level-4 with kernel mappings only. */
@@ -51,6 +72,23 @@ bool power_off_when_done;
 
 bool thread_tests;
 
+/* -boot-times: Print how long each boot stage and action took? */
+static bool boot_times;
+
+/* Boot stages timed so far, each with the time stamp counter when
+   it finished.  Stage 0 is the start of main(). */
+#define BOOT_STAGES_MAX 32
+struct boot_stage {
+	const char *name;           /* Stage name. */
+	uint64_t tsc;               /* Time stamp counter at its end. */
+};
+static struct boot_stage boot_stages[BOOT_STAGES_MAX];
+static int boot_stage_cnt;
+
+static void boot_mark (const char *name);
+static void print_boot_times (void);
+static uint64_t tsc_to_us (uint64_t cycles);
+
 static void bss_init (void);
 static void paging_init (uint64_t mem_end);
 
@@ -67,25 +105,36 @@ int main (void) NO_RETURN;
 /* Pintos main program. */
 int
 main (void) {
+	uint64_t start_tsc = rdtsc ();
 	uint64_t mem_end;
 	char **argv;
 
 	/* Clear BSS and get machine's RAM size. */
 	bss_init ();
+	boot_stages[boot_stage_cnt++] = (struct boot_stage) { "start", start_tsc };
+
+	/* Set up the boot processor's per-CPU data. */
+	cpu_init ();
 
 	/* Break command line into arguments and parse options. */
 	argv = read_command_line ();
 	argv = parse_options (argv);
+	boot_mark ("cmdline");
 
 	/* Initialize ourselves as a thread so we can use locks,
 	   then enable console locking. */
 	thread_init ();
 	console_init ();
+	boot_mark ("threads");
 
 	/* Initialize memory system. */
 	mem_end = palloc_init ();
 	malloc_init ();
+	slab_init ();
 	paging_init (mem_end);
+	kstack_init ();
+	vmalloc_init ();
+	boot_mark ("memory");
 
 #ifdef USERPROG
 	tss_init ();
@@ -94,29 +143,48 @@ main (void) {
 
 	/* Initialize interrupt handlers. */
 	intr_init ();
+	fpu_init ();
+	profile_init ();
 	timer_init ();
+	trace_init ();
+#ifdef USERPROG
+	fstrace_init ();
+#endif
 	kbd_init ();
 	input_init ();
 #ifdef USERPROG
 	exception_init ();
 	syscall_init ();
 #endif
+	boot_mark ("interrupts");
 	/* Start thread scheduler and enable interrupts. */
+	rcu_init ();
 	thread_start ();
+	defer_start ();
 	serial_init_queue ();
+	boot_mark ("scheduler");
 	timer_calibrate ();
+	boot_mark ("calibrate");
+	cpu_start_aps ();
+	workq_init ();
+	boot_mark ("smp");
 
 #ifdef FILESYS
 	/* Initialize file system. */
 	disk_init ();
+	boot_mark ("disk");
 	filesys_init (format_filesys);
+	boot_mark ("filesys");
 #endif
 
 #ifdef VM
 	vm_init ();
+	boot_mark ("vm");
 #endif
 
 	printf ("Boot complete.\n");
+	if (boot_times)
+		print_boot_times ();
 
 	/* Run actions specified on kernel command line. */
 	run_actions (argv);
@@ -127,6 +195,37 @@ main (void) {
 	thread_exit ();
 }
 
+/* Records that boot stage NAME just finished. */
+static void
+boot_mark (const char *name) {
+	if (boot_stage_cnt < BOOT_STAGES_MAX)
+		boot_stages[boot_stage_cnt++] = (struct boot_stage) { name, rdtsc () };
+}
+
+/* Converts CYCLES of the time stamp counter to microseconds, or
+   returns 0 if the timer has not been calibrated against it. */
+static uint64_t
+tsc_to_us (uint64_t cycles) {
+	const struct timepage *tp = timer_page ();
+	uint64_t per_sec = tp != NULL ? tp->tsc_per_tick * TIMER_FREQ : 0;
+
+	return per_sec != 0 ? cycles * 1000000 / per_sec : 0;
+}
+
+/* Prints the time each boot stage took and its end since main()
+   started. */
+static void
+print_boot_times (void) {
+	uint64_t start = boot_stages[0].tsc;
+	int i;
+
+	printf ("Boot times (us):\n");
+	for (i = 1; i < boot_stage_cnt; i++)
+		printf ("  %-12s %10"PRIu64" %10"PRIu64"\n", boot_stages[i].name,
+				tsc_to_us (boot_stages[i].tsc - boot_stages[i - 1].tsc),
+				tsc_to_us (boot_stages[i].tsc - start));
+}
+
 /* Clear BSS */
 static void
 bss_init (void) {
@@ -140,6 +239,19 @@ bss_init (void) {
 	memset (&_start_bss, 0, &_end_bss - &_start_bss);
 }
 
+/* Returns true if the CPU can map 1 GiB pages, as CPUID leaf
+   0x80000001 reports in EDX bit 26. */
+static bool
+huge_pages_supported (void) {
+	uint32_t regs[4];
+
+	cpuid (0x80000000, 0, regs);
+	if (regs[0] < 0x80000001)
+		return false;
+	cpuid (0x80000001, 0, regs);
+	return (regs[3] & (1u << 26)) != 0;
+}
+
 /* Populates the page table with the kernel virtual mapping,
  * and then sets up the CPU to use the new page directory.
  * Points base_pml4 to the pml4 it creates. */
@@ -150,11 +262,33 @@ paging_init (uint64_t mem_end) {
 	pml4 = base_pml4 = palloc_get_page (PAL_ASSERT | PAL_ZERO);
 
 	extern char start, _end_kernel_text;
+	bool huge = huge_pages_supported ();
 	// Maps physical address [0 ~ mem_end] to
 	//   [LOADER_KERN_BASE ~ LOADER_KERN_BASE + mem_end].
+	// Each 1 GiB or 2 MiB chunk that lies wholly below mem_end and
+	// clear of the read-only kernel text is mapped by one PDPE or
+	// PDE, which saves its page directory or page table and lets a
+	// single TLB entry cover it.
 	for (uint64_t pa = 0; pa < mem_end; pa += PGSIZE) {
 		uint64_t va = (uint64_t) ptov(pa);
 
+		if (huge && va % HUGE_PGSIZE == 0 && pa + HUGE_PGSIZE <= mem_end
+				&& (va + HUGE_PGSIZE <= (uint64_t) &start
+					|| va >= (uint64_t) &_end_kernel_text)
+				&& (pte = pml4_pdpe_walk (pml4, va, 1)) != NULL) {
+			*pte = pa | PTE_P | PTE_W | PTE_PS;
+			pa += HUGE_PGSIZE - PGSIZE;
+			continue;
+		}
+		if (va % LARGE_PGSIZE == 0 && pa + LARGE_PGSIZE <= mem_end
+				&& (va + LARGE_PGSIZE <= (uint64_t) &start
+					|| va >= (uint64_t) &_end_kernel_text)
+				&& (pte = pml4_pde_walk (pml4, va, 1)) != NULL) {
+			*pte = pa | PTE_P | PTE_W | PTE_PS;
+			pa += LARGE_PGSIZE - PGSIZE;
+			continue;
+		}
+
 		perm = PTE_P | PTE_W;
 		if ((uint64_t) &start <= va && va < (uint64_t) &_end_kernel_text)
 			perm &= ~PTE_W;
@@ -165,6 +299,7 @@ paging_init (uint64_t mem_end) {
 
 	// reload cr3
 	pml4_activate(0);
+	pml4_pcid_init ();
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -216,14 +351,61 @@ parse_options (char **argv) {
 #ifdef FILESYS
 		else if (!strcmp (name, "-f"))
 			format_filesys = true;
+#ifdef EFILESYS
+		else if (!strcmp (name, "-spc"))
+			fat_format_spc = atoi (value);
+#endif
 #endif
 		else if (!strcmp (name, "-rs"))
 			random_init (atoi (value));
 		else if (!strcmp (name, "-mlfqs"))
-			thread_mlfqs = true;
+			sched_select ("mlfqs");
+		else if (!strcmp (name, "-sched")) {
+			if (value == NULL || !sched_select (value))
+				PANIC ("unknown scheduler `%s'", value != NULL ? value : "");
+		}
+		else if (!strcmp (name, "-tickless"))
+			timer_tickless = true;
+		else if (!strcmp (name, "-smp"))
+			cpu_smp = true;
+		else if (!strcmp (name, "-poll-idle"))
+			idle_poll_us = atoi (value);
+		else if (!strcmp (name, "-profile")) {
+			profile_enabled = true;
+			if (value != NULL)
+				profile_depth = atoi (value);
+		}
+		else if (!strcmp (name, "-lockstat"))
+			lock_stats_enabled = true;
+		else if (!strcmp (name, "-boot-times"))
+			boot_times = true;
+		else if (!strcmp (name, "-trace"))
+			trace_enabled = true;
+		else if (!strcmp (name, "-console")) {
+			if (value == NULL || !console_select_sinks (value))
+				PANIC ("bad -console sinks `%s'", value != NULL ? value : "");
+		}
 #ifdef USERPROG
 		else if (!strcmp (name, "-ul"))
 			user_page_limit = atoi (value);
+		else if (!strcmp (name, "-rusage"))
+			process_report_rusage = true;
+		else if (!strcmp (name, "-fstrace"))
+			fstrace_enabled = true;
+#ifdef VM
+		else if (!strcmp (name, "-evict"))
+			vm_set_evict_policy (value);
+		else if (!strcmp (name, "-fault-around"))
+			vm_fault_around = atoi (value);
+		else if (!strcmp (name, "-stack-batch"))
+			vm_stack_batch = atoi (value);
+		else if (!strcmp (name, "-zswap"))
+			vm_zswap_percent = atoi (value);
+		else if (!strcmp (name, "-swap-ra"))
+			vm_swap_ra = atoi (value);
+		else if (!strcmp (name, "-ksm"))
+			vm_ksm = true;
+#endif
 		else if (!strcmp (name, "-threads-tests"))
 			thread_tests = true;
 #endif
@@ -272,6 +454,7 @@ run_actions (char **argv) {
 		{"rm", 2, fsutil_rm},
 		{"put", 2, fsutil_put},
 		{"get", 2, fsutil_get},
+		{"fsck", 1, fsutil_fsck},
 #endif
 		{NULL, 0, NULL},
 	};
@@ -293,7 +476,11 @@ run_actions (char **argv) {
 				PANIC ("action `%s' requires %d argument(s)", *argv, a->argc - 1);
 
 		/* Invoke action and advance. */
+		uint64_t start = rdtsc ();
 		a->function (argv);
+		if (boot_times)
+			printf ("Action `%s' took %"PRIu64" us.\n", a->name,
+					tsc_to_us (rdtsc () - start));
 		argv += a->argc;
 	}
 
@@ -316,6 +503,7 @@ usage (void) {
 			"  ls                 List files in the root directory.\n"
 			"  cat FILE           Print FILE to the console.\n"
 			"  rm FILE            Delete FILE.\n"
+			"  fsck               Check the file system, fixing the free map.\n"
 			"Use these actions indirectly via `pintos' -g and -p options:\n"
 			"  put FILE           Put FILE into file system from scratch disk.\n"
 			"  get FILE           Get FILE from file system into scratch disk.\n"
@@ -324,10 +512,33 @@ usage (void) {
 			"  -h                 Print this help message and power off.\n"
 			"  -q                 Power off VM after actions or on panic.\n"
 			"  -f                 Format file system disk during startup.\n"
+#ifdef EFILESYS
+			"  -spc=N             Format with N sectors per cluster.\n"
+#endif
 			"  -rs=SEED           Set random number seed to SEED.\n"
 			"  -mlfqs             Use multi-level feedback queue scheduler.\n"
+			"  -sched=POLICY      Schedule by priority, rr, mlfqs or fair.\n"
+			"  -tickless          Stop the periodic timer tick while idle.\n"
+			"  -smp               Start the other CPUs.\n"
+			"  -poll-idle=US      Spin for US microseconds before idling.\n"
+			"  -profile[=DEPTH]   Sample the kernel, with DEPTH callers.\n"
+			"  -lockstat          Report lock contention by call site.\n"
+			"  -boot-times        Print how long each boot stage and action took.\n"
+			"  -trace             Record tracepoints, saved to the scratch disk.\n"
+			"  -console=SINKS     Write output only to SINKS, e.g. serial\n"
+			"                     or debugcon (the emulator's 0xe9 port).\n"
 #ifdef USERPROG
 			"  -ul=COUNT          Limit user memory to COUNT pages.\n"
+			"  -rusage            Print each process's resource usage at exit.\n"
+			"  -fstrace           Record file system calls, saved to the scratch disk.\n"
+#endif
+#ifdef VM
+			"  -evict=POLICY      Evict frames by lru, clock, clock2 or fifo.\n"
+			"  -fault-around=N    Prefetch up to N pages after a fault.\n"
+			"  -stack-batch=N     Map N pages per stack-growth fault.\n"
+			"  -zswap=PERCENT     Cache swap compressed in PERCENT of user memory.\n"
+			"  -swap-ra=N         Read N adjacent swap slots per swap-in fault.\n"
+			"  -ksm               Merge identical anonymous pages in the background.\n"
 #endif
 			);
 	power_off ();
@@ -341,6 +552,10 @@ power_off (void) {
 #ifdef FILESYS
 	filesys_done ();
 #endif
+	trace_dump ();
+#ifdef USERPROG
+	fstrace_dump ();
+#endif
 
 	print_stats ();
 
@@ -353,13 +568,34 @@ power_off (void) {
 static void
 print_stats (void) {
 	timer_print_stats ();
+	intr_print_stats ();
 	thread_print_stats ();
+	palloc_print_stats ();
+	kstack_print_stats ();
+	vmalloc_print_stats ();
+	lock_print_stats ();
+	malloc_print_stats ();
+	slab_print_stats ();
+	fpu_print_stats ();
+	defer_print_stats ();
+	rcu_print_stats ();
+	workq_print_stats ();
+	pml4_print_stats ();
 #ifdef FILESYS
 	disk_print_stats ();
+	page_cache_print_stats ();
+	journal_print_stats ();
+	dcache_print_stats ();
+	tmpfs_print_stats ();
 #endif
 	console_print_stats ();
 	kbd_print_stats ();
 #ifdef USERPROG
 	exception_print_stats ();
+	syscall_print_stats ();
+#endif
+#ifdef VM
+	vm_print_stats ();
 #endif
+	profile_print ();
 }
@@ -3,9 +3,11 @@
 #include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
+#include "threads/cpu.h"
 #include "threads/flags.h"
 #include "threads/intr-stubs.h"
 #include "threads/io.h"
+#include "threads/lapic.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
 #include "threads/vaddr.h"
@@ -93,15 +95,56 @@ static intr_handler_func *intr_handlers[INTR_CNT];
 /* Names for each interrupt, for debugging purposes. */
 static const char *intr_names[INTR_CNT];
 
+/* Statistics for one interrupt vector.  Updated without a lock,
+   like the system call counts: external interrupts are serialized
+   by the interrupt lock, and a lost update to a fault's counts
+   costs only accuracy. */
+struct intr_stats {
+	long long cnt;              /* Times taken. */
+	uint64_t tsc;               /* Cycles spent in the handler. */
+	uint64_t max_tsc;           /* Longest single run of it. */
+};
+static struct intr_stats intr_stats[INTR_CNT];
+
+/* Latency of the local APIC timer, from the TSC it was set for to
+   the handler's entry, and of rescheduling, from an external
+   interrupt's assertion to the intr_yield_on_return() switch it
+   asked for.  An interrupt other than the timer's is taken to be
+   asserted when it enters, since nothing records the moment its
+   device raised it. */
+static long long timer_latency_cnt;
+static uint64_t timer_latency_tsc, timer_latency_max;
+static long long resched_cnt;
+static uint64_t resched_tsc, resched_max;
+
 /* External interrupts are those generated by devices outside the
    CPU, such as the timer.  External interrupts run with
    interrupts turned off, so they never nest, nor are they ever
    pre-empted.  Handlers for external interrupts also may not
    sleep, although they may invoke intr_yield_on_return() to
    request that a new process be scheduled just before the
-   interrupt returns. */
-static bool in_external_intr;   /* Are we processing an external interrupt? */
-static bool yield_on_return;    /* Should we yield on interrupt return? */
+   interrupt returns.  Each CPU keeps its own in_external_intr and
+   yield_on_return flags in its struct cpu. */
+
+/* The interrupt lock.
+
+   The kernel protects most of its data by turning interrupts off,
+   which excludes everything else only while one CPU runs.  Once
+   cpu_start_aps() calls intr_lock_init(), a CPU that turns
+   interrupts off, or takes an interrupt, also acquires this lock,
+   and releases it when interrupts come back on, so that code run
+   with interrupts off still excludes all other such code, on
+   every CPU.  The lock belongs to a CPU, not a thread: a thread
+   that switches away with interrupts off hands it to the thread
+   it switches to.
+
+   INTR_LOCK_OWNER is the id of the holding CPU, or -1.  do_iret()
+   also releases it, once off the stack of the thread it switched
+   from. */
+static bool intr_lock_enabled;  /* Set by intr_lock_init(). */
+volatile int intr_lock_owner = -1;
+
+static void intr_lock_acquire (void);
 
 /* Programmable Interrupt Controller helpers. */
 static void pic_init (void);
@@ -137,6 +180,8 @@ intr_enable (void) {
 	enum intr_level old_level = intr_get_level ();
 	ASSERT (!intr_context ());
 
+	intr_lock_release ();
+
 	/* Enable interrupts by setting the interrupt flag.
 
 	   See [IA32-v2b] "STI" and [IA32-v3a] 5.8.1 "Masking Maskable
@@ -156,9 +201,56 @@ intr_disable (void) {
 	   Hardware Interrupts". */
 	asm volatile ("cli" : : : "memory");
 
+	if (intr_lock_enabled && old_level == INTR_ON)
+		intr_lock_acquire ();
+
 	return old_level;
 }
 
+/* Makes intr_disable() and interrupts take the interrupt lock
+   from now on.  Called before other CPUs start. */
+void
+intr_lock_init (void) {
+	intr_lock_enabled = true;
+}
+
+/* Spins, with interrupts off, until the running CPU holds the
+   interrupt lock.  Does nothing if it already does. */
+static void
+intr_lock_acquire (void) {
+	int id = cpu_current ()->id;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	while (intr_lock_owner != id) {
+		int old = -1;
+
+		asm volatile ("lock cmpxchgl %2, %1"
+				: "+a" (old), "+m" (intr_lock_owner) : "r" (id) : "memory");
+		if (old == -1)
+			break;
+		while (intr_lock_owner != -1) {
+			/* The holder may be waiting on this CPU to answer a
+			   TLB shootdown, which it cannot take as an
+			   interrupt now. */
+			pml4_shootdown_poll ();
+			asm volatile ("pause");
+		}
+	}
+}
+
+/* Releases the interrupt lock if the running CPU holds it,
+   leaving interrupts off.  intr_enable() calls this; the idle
+   thread calls it directly, so that it can turn interrupts on and
+   halt in one step. */
+void
+intr_lock_release (void) {
+	if (intr_lock_enabled && intr_lock_owner == cpu_current ()->id) {
+		asm volatile ("" : : : "memory");
+		intr_lock_owner = -1;
+	}
+}
+
 /* Initializes the interrupt system. */
 void
 intr_init (void) {
@@ -174,8 +266,10 @@ intr_init (void) {
 	}
 
 #ifdef USERPROG
-	/* Load TSS. */
+	/* Load TSS, and take double faults on the stack it names in
+	   IST1, since a kernel stack overflow double faults. */
 	ltr (SEL_TSS);
+	idt[8].ist = 1;
 #endif
 
 	/* Load IDT register. */
@@ -203,6 +297,16 @@ intr_init (void) {
 	intr_names[19] = "#XF SIMD Floating-Point Exception";
 }
 
+/* Loads the TSS and the IDT built by intr_init() on a CPU other
+   than the boot processor. */
+void
+intr_init_ap (void) {
+#ifdef USERPROG
+	ltr (SEL_TSS);
+#endif
+	lidt (&idt_desc);
+}
+
 /* Registers interrupt VEC_NO to invoke HANDLER with descriptor
    privilege level DPL.  Names the interrupt NAME for debugging
    purposes.  The interrupt handler will be invoked with
@@ -252,11 +356,24 @@ intr_register_int (uint8_t vec_no, int dpl, enum intr_level level,
 	register_handler (vec_no, dpl, level, handler, name);
 }
 
+/* Registers local APIC interrupt VEC_NO, such as the timer or an
+   interprocessor interrupt, which must lie between LAPIC_VEC_MIN
+   and LAPIC_SPURIOUS_VEC, to invoke HANDLER,
+   which is named NAME for debugging purposes.  The handler runs
+   like an external interrupt's, with interrupts disabled and
+   intr_context() true, and is acknowledged on the local APIC. */
+void
+intr_register_lapic (uint8_t vec_no, intr_handler_func *handler,
+		const char *name) {
+	ASSERT (vec_no >= LAPIC_VEC_MIN && vec_no < LAPIC_SPURIOUS_VEC);
+	register_handler (vec_no, 0, INTR_OFF, handler, name);
+}
+
 /* Returns true during processing of an external interrupt
    and false at all other times. */
 bool
 intr_context (void) {
-	return in_external_intr;
+	return cpu_current ()->in_external_intr;
 }
 
 /* During processing of an external interrupt, directs the
@@ -266,7 +383,7 @@ intr_context (void) {
 void
 intr_yield_on_return (void) {
 	ASSERT (intr_context ());
-	yield_on_return = true;
+	cpu_current ()->yield_on_return = true;
 }
 
 /* 8259A Programmable Interrupt Controller. */
@@ -330,27 +447,60 @@ pic_end_of_interrupt (int irq) {
    interrupted thread's registers. */
 void
 intr_handler (struct intr_frame *frame) {
+	struct cpu *c = cpu_current ();
+	struct intr_stats *stats = &intr_stats[frame->vec_no];
+	uint64_t start = rdtsc (), asserted = start, elapsed;
 	bool external;
 	intr_handler_func *handler;
 
+	/* A TLB shootdown is answered without the interrupt lock,
+	   which the CPU that sent it holds until it is. */
+	if (frame->vec_no == IPI_TLB_SHOOTDOWN) {
+		pml4_shootdown_poll ();
+		lapic_eoi ();
+		return;
+	}
+
+	/* Running with interrupts off means holding the interrupt
+	   lock, unless the interrupted code already did. */
+	if (intr_lock_enabled && intr_get_level () == INTR_OFF)
+		intr_lock_acquire ();
+
 	/* External interrupts are special.
 	   We only handle one at a time (so interrupts must be off)
-	   and they need to be acknowledged on the PIC (see below).
+	   and they need to be acknowledged on the PIC or, for those
+	   the local APIC raises, on the local APIC (see below).
 	   An external interrupt handler cannot sleep. */
-	external = frame->vec_no >= 0x20 && frame->vec_no < 0x30;
+	external = (frame->vec_no >= 0x20 && frame->vec_no < 0x30)
+		|| (frame->vec_no >= LAPIC_VEC_MIN
+				&& frame->vec_no < LAPIC_SPURIOUS_VEC);
 	if (external) {
 		ASSERT (intr_get_level () == INTR_OFF);
 		ASSERT (!intr_context ());
 
-		in_external_intr = true;
-		yield_on_return = false;
+		c->in_external_intr = true;
+		c->yield_on_return = false;
+
+		/* The local APIC timer says when it was due. */
+		if (frame->vec_no == LAPIC_TIMER_VEC && c->timer_tsc <= start) {
+			uint64_t latency = start - c->timer_tsc;
+
+			asserted = c->timer_tsc;
+			timer_latency_cnt++;
+			timer_latency_tsc += latency;
+			if (latency > timer_latency_max)
+				timer_latency_max = latency;
+		}
 	}
 
-	/* Invoke the interrupt's handler. */
+	/* Invoke the interrupt's handler.  Counted first, since a fault
+	   that kills a process does not return. */
+	stats->cnt++;
 	handler = intr_handlers[frame->vec_no];
 	if (handler != NULL)
 		handler (frame);
-	else if (frame->vec_no == 0x27 || frame->vec_no == 0x2f) {
+	else if (frame->vec_no == 0x27 || frame->vec_no == 0x2f
+			|| frame->vec_no == LAPIC_SPURIOUS_VEC) {
 		/* There is no handler, but this interrupt can trigger
 		   spuriously due to a hardware fault or hardware race
 		   condition.  Ignore it. */
@@ -360,18 +510,59 @@ intr_handler (struct intr_frame *frame) {
 		intr_dump_frame (frame);
 		PANIC ("Unexpected interrupt");
 	}
+	elapsed = rdtsc () - start;
+	stats->tsc += elapsed;
+	if (elapsed > stats->max_tsc)
+		stats->max_tsc = elapsed;
 
 	/* Complete the processing of an external interrupt. */
 	if (external) {
 		ASSERT (intr_get_level () == INTR_OFF);
 		ASSERT (intr_context ());
 
-		in_external_intr = false;
-		pic_end_of_interrupt (frame->vec_no);
+		c->in_external_intr = false;
+		if (frame->vec_no < 0x30)
+			pic_end_of_interrupt (frame->vec_no);
+		else
+			lapic_eoi ();
+
+		if (c->yield_on_return) {
+			uint64_t latency = rdtsc () - asserted;
+
+			resched_cnt++;
+			resched_tsc += latency;
+			if (latency > resched_max)
+				resched_max = latency;
+			thread_yield_on_return ();
+		}
+	}
+
+	/* Returning to code that ran with interrupts on. */
+	if (intr_lock_enabled && (frame->eflags & FLAG_IF)
+			&& intr_get_level () == INTR_OFF)
+		intr_lock_release ();
+}
 
-		if (yield_on_return)
-			thread_yield ();
+/* Prints, for each vector taken, its count and the average and
+   longest cycles spent in its handler, then the timer and
+   rescheduling latencies. */
+void
+intr_print_stats (void) {
+	for (int i = 0; i < INTR_CNT; i++) {
+		const struct intr_stats *st = &intr_stats[i];
+
+		if (st->cnt > 0)
+			printf ("Interrupt: %#04x (%s) %lld times, %llu cycles average, "
+					"%llu max\n", i, intr_names[i],
+					st->cnt, st->tsc / st->cnt, st->max_tsc);
 	}
+	if (timer_latency_cnt > 0)
+		printf ("Interrupt: timer latency %llu cycles average, %llu max\n",
+				timer_latency_tsc / timer_latency_cnt, timer_latency_max);
+	if (resched_cnt > 0)
+		printf ("Interrupt: %lld reschedules, %llu cycles average "
+				"from IRQ, %llu max\n", resched_cnt,
+				resched_tsc / resched_cnt, resched_max);
 }
 
 /* Dumps interrupt frame F to the console, for debugging. */
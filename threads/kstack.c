@@ -0,0 +1,136 @@
+#include "threads/kstack.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+
+/* Kernel stacks.
+
+   Each stack gets a slot in a region of kernel virtual memory of
+   its own, above the mapping of physical memory: one unmapped
+   guard page followed by KSTACK_PAGES pages mapped to frames from
+   the kernel pool.  A stack that overflows runs into the guard page
+   and faults; the fault cannot push its frame there either, which
+   makes it a double fault, and that is handled on a stack of its
+   own (see tss.c).
+
+   The page tables covering the region are made once, by
+   kstack_init(), in base_pml4 under a PML4 entry that every page
+   table shares, so that mapping a stack allocates no page table
+   and the stack is seen by every address space.  Its pages are
+   global, so that unmapping them drops them from the TLB under
+   every PCID.
+
+   The mapping of physical memory does not cover the region, so
+   vtop() of a buffer on the stack is meaningless.  It comes out
+   above 4 GB, so disk.c does PIO for such a buffer instead of DMA;
+   drivers without PIO look up its page table entry instead (see
+   pci_dma_addr()). */
+
+/* Start of the region and number of slots in it. */
+#define KSTACK_BASE 0xff00000000ULL
+#define KSTACK_SLOTS 1024
+
+/* Bytes of virtual memory in each slot: guard page and stack. */
+#define SLOT_SIZE (PGSIZE + KSTACK_SIZE)
+
+/* Slots in use.  Protected by disabling interrupts, since stacks
+   are freed from the scheduler. */
+static struct bitmap *used_slots;
+
+/* Statistics. */
+static size_t kstack_cnt;       /* # of stacks in use. */
+static size_t kstack_peak;      /* Most stacks in use at once. */
+
+/* Makes the page tables for the kernel stack region.  Must be
+   called after paging_init() and malloc_init(), and before the
+   first thread_create(). */
+void
+kstack_init (void) {
+	uint64_t va;
+
+	used_slots = bitmap_create (KSTACK_SLOTS);
+	if (used_slots == NULL)
+		PANIC ("kstack: cannot allocate slot map");
+	for (va = KSTACK_BASE; va < KSTACK_BASE + KSTACK_SLOTS * SLOT_SIZE;
+			va += PGSIZE)
+		if (pml4e_walk (base_pml4, va, 1) == NULL)
+			PANIC ("kstack: cannot allocate page tables");
+}
+
+/* Allocates a kernel stack and returns its lowest address, or a
+   null pointer if memory or slots run out.  The stack is
+   KSTACK_SIZE bytes long and its contents are unspecified. */
+void *
+kstack_alloc (void) {
+	void *pages[KSTACK_PAGES];
+	enum intr_level old_level;
+	uint8_t *stack;
+	size_t slot;
+	int i;
+
+	for (i = 0; i < KSTACK_PAGES; i++) {
+		pages[i] = palloc_get_page (0);
+		if (pages[i] == NULL)
+			goto fail;
+	}
+
+	old_level = intr_disable ();
+	slot = bitmap_scan_and_flip (used_slots, 0, 1, false);
+	if (slot != BITMAP_ERROR && ++kstack_cnt > kstack_peak)
+		kstack_peak = kstack_cnt;
+	intr_set_level (old_level);
+	if (slot == BITMAP_ERROR)
+		goto fail;
+
+	stack = (uint8_t *) KSTACK_BASE + slot * SLOT_SIZE + PGSIZE;
+	for (i = 0; i < KSTACK_PAGES; i++)
+		pml4_set_kernel_page (stack + i * PGSIZE, pages[i]);
+	return stack;
+
+fail:
+	while (i-- > 0)
+		palloc_free_page (pages[i]);
+	return NULL;
+}
+
+/* Frees STACK, returned by kstack_alloc(), which must no longer be
+   in use.  May be called with interrupts off. */
+void
+kstack_free (void *stack) {
+	void *pages[KSTACK_PAGES];
+	uint64_t ofs = (uint64_t) stack - KSTACK_BASE;
+	enum intr_level old_level;
+	int i;
+
+	ASSERT (ofs % SLOT_SIZE == PGSIZE && ofs / SLOT_SIZE < KSTACK_SLOTS);
+
+	pml4_clear_kernel_pages (stack, KSTACK_PAGES, pages);
+	for (i = 0; i < KSTACK_PAGES; i++)
+		palloc_free_page (pages[i]);
+
+	old_level = intr_disable ();
+	ASSERT (bitmap_test (used_slots, ofs / SLOT_SIZE));
+	bitmap_reset (used_slots, ofs / SLOT_SIZE);
+	kstack_cnt--;
+	intr_set_level (old_level);
+}
+
+/* Returns true if VA lies in the kernel stack region, where
+   vtop() does not apply. */
+bool
+kstack_contains (const void *va) {
+	return (uint64_t) va >= KSTACK_BASE
+		&& (uint64_t) va < KSTACK_BASE + KSTACK_SLOTS * SLOT_SIZE;
+}
+
+/* Prints kernel stack statistics. */
+void
+kstack_print_stats (void) {
+	printf ("Kernel stacks: %zu in use, %zu at most, %d kB each\n",
+			kstack_cnt, kstack_peak, KSTACK_SIZE / 1024);
+}
@@ -0,0 +1,216 @@
+#include "threads/lapic.h"
+#include <debug.h>
+#include <stddef.h>
+#include "threads/init.h"
+#include "threads/mmu.h"
+#include "threads/pte.h"
+#include "threads/vaddr.h"
+#include "devices/timer.h"
+#include "intrinsic.h"
+
+/* Local APIC driver.  See [IA32-v3a] chapter 10 "Advanced
+   Programmable Interrupt Controller (APIC)". */
+
+#define CPUID_APIC (1 << 9)     /* CPUID.1:EDX, local APIC present. */
+#define CPUID_TSC_DEADLINE (1 << 24) /* CPUID.1:ECX, TSC-deadline timer. */
+
+/* IA32_TSC_DEADLINE MSR. */
+#define MSR_TSC_DEADLINE 0x6e0
+
+/* IA32_APIC_BASE MSR. */
+#define MSR_APIC_BASE 0x1b
+#define APIC_BASE_BSP (1 << 8)          /* This is the boot processor. */
+#define APIC_BASE_ENABLE (1 << 11)      /* Global enable. */
+#define APIC_BASE_ADDR 0x000ffffffffff000ULL
+
+/* Register offsets from the APIC base. */
+#define LAPIC_ID 0x020          /* Local APIC ID. */
+#define LAPIC_EOI 0x0b0         /* End of interrupt. */
+#define LAPIC_SVR 0x0f0         /* Spurious interrupt vector. */
+#define LAPIC_ICR_LO 0x300      /* Interrupt command, low half. */
+#define LAPIC_ICR_HI 0x310      /* Interrupt command, high half. */
+#define LAPIC_TIMER 0x320       /* Local vector table, timer. */
+#define LAPIC_LINT0 0x350       /* Local vector table, LINT0 pin. */
+#define LAPIC_LINT1 0x360       /* Local vector table, LINT1 pin. */
+#define LAPIC_TIMER_INIT 0x380  /* Timer initial count. */
+#define LAPIC_TIMER_CUR 0x390   /* Timer current count. */
+#define LAPIC_TIMER_DIV 0x3e0   /* Timer divide configuration. */
+
+#define SVR_ENABLE 0x100        /* Software enable. */
+
+/* Delivery modes, in the ICR and the local vector table. */
+#define DM_FIXED 0x000
+#define DM_NMI 0x400
+#define DM_INIT 0x500
+#define DM_STARTUP 0x600
+#define DM_EXTINT 0x700
+
+#define LVT_MASKED 0x10000      /* Local vector table entry masked. */
+#define TIMER_ONESHOT 0x00000   /* Timer mode: count down once. */
+#define TIMER_DEADLINE 0x40000  /* Timer mode: fire at a TSC value. */
+#define TIMER_DIV_1 0xb         /* Timer counts at the bus clock rate. */
+#define ICR_PENDING 0x1000      /* Delivery status: send pending. */
+#define ICR_ASSERT 0x4000       /* Level: assert. */
+#define ICR_ALL_BUT_SELF 0xc0000 /* Shorthand: every other CPU. */
+
+/* Mapped local APIC registers, or a null pointer before the first
+   lapic_init(). */
+static volatile uint32_t *lapic;
+
+static uint32_t
+lapic_read (unsigned reg) {
+	return lapic[reg / sizeof *lapic];
+}
+
+static void
+lapic_write (unsigned reg, uint32_t value) {
+	lapic[reg / sizeof *lapic] = value;
+	lapic_read (LAPIC_ID);          /* Wait for the write to finish. */
+}
+
+/* Enables the running CPU's local APIC, mapping the registers
+   into the kernel's address space on the first call, which must
+   come from the boot processor.  Returns false if the CPU has no
+   local APIC. */
+bool
+lapic_init (void) {
+	uint64_t base;
+
+	if (lapic == NULL) {
+		uint32_t regs[4];
+		uint64_t pa, *pte;
+
+		cpuid (1, 0, regs);
+		if (!(regs[3] & CPUID_APIC))
+			return false;
+
+		/* The registers must be mapped uncached. */
+		pa = read_msr (MSR_APIC_BASE) & APIC_BASE_ADDR;
+		pte = pml4e_walk (base_pml4, (uint64_t) ptov (pa), 1);
+		if (pte == NULL)
+			return false;
+		*pte = pa | PTE_P | PTE_W | PTE_PWT | PTE_PCD;
+		lapic = ptov (pa);
+	}
+
+	base = read_msr (MSR_APIC_BASE);
+	write_msr (MSR_APIC_BASE, base | APIC_BASE_ENABLE);
+	lapic_write (LAPIC_SVR, SVR_ENABLE | LAPIC_SPURIOUS_VEC);
+
+	/* The 8259 PIC stays wired to the boot processor's LINT0 pin,
+	   in "virtual wire" mode; the other processors ignore it. */
+	if (base & APIC_BASE_BSP) {
+		lapic_write (LAPIC_LINT0, DM_EXTINT);
+		lapic_write (LAPIC_LINT1, DM_NMI);
+	} else {
+		lapic_write (LAPIC_LINT0, LVT_MASKED);
+		lapic_write (LAPIC_LINT1, LVT_MASKED);
+	}
+	return true;
+}
+
+/* Returns the running CPU's local APIC ID. */
+uint8_t
+lapic_id (void) {
+	ASSERT (lapic != NULL);
+	return lapic_read (LAPIC_ID) >> 24;
+}
+
+/* Acknowledges the interrupt being handled. */
+void
+lapic_eoi (void) {
+	ASSERT (lapic != NULL);
+	lapic_write (LAPIC_EOI, 0);
+}
+
+/* Writes an interprocessor interrupt command, HI to the high half
+   of ICR and LO to the low half, and waits until it is sent. */
+static void
+send_icr (uint32_t hi, uint32_t lo) {
+	ASSERT (lapic != NULL);
+	lapic_write (LAPIC_ICR_HI, hi);
+	lapic_write (LAPIC_ICR_LO, lo);
+	while (lapic_read (LAPIC_ICR_LO) & ICR_PENDING)
+		asm volatile ("pause");
+}
+
+/* Sends interrupt VEC to the CPU whose local APIC ID is APIC_ID. */
+void
+lapic_send_ipi (uint8_t apic_id, uint8_t vec) {
+	send_icr ((uint32_t) apic_id << 24, DM_FIXED | vec);
+}
+
+/* Wakes every other CPU with the INIT-SIPI-SIPI sequence, so that
+   each starts executing in real mode at physical address
+   START_PA, which must be page-aligned and below 1 MB.  See
+   [IA32-v3a] 8.4.4.1 "Typical BSP Initialization Sequence".
+   Interrupts must be on, to sleep between the messages. */
+void
+lapic_start_aps (uint64_t start_pa) {
+	int i;
+
+	ASSERT (start_pa % PGSIZE == 0 && start_pa < 0x100000);
+
+	send_icr (0, ICR_ALL_BUT_SELF | ICR_ASSERT | DM_INIT);
+	timer_msleep (10);
+	for (i = 0; i < 2; i++) {
+		send_icr (0, ICR_ALL_BUT_SELF | ICR_ASSERT | DM_STARTUP
+				| start_pa >> 12);
+		timer_usleep (200);
+	}
+}
+
+/* Returns true if the local APIC timer can run in TSC-deadline
+   mode, firing when the time stamp counter reaches a given value. */
+bool
+lapic_timer_has_deadline (void) {
+	uint32_t regs[4];
+
+	cpuid (1, 0, regs);
+	return (regs[2] & CPUID_TSC_DEADLINE) != 0;
+}
+
+/* Runs the running CPU's local APIC timer, masked, for CYCLES
+   cycles of the time stamp counter and returns how far it counted
+   down, to calibrate one-shot mode. */
+uint32_t
+lapic_timer_measure (uint64_t cycles) {
+	uint64_t start;
+	uint32_t count;
+
+	lapic_write (LAPIC_TIMER, LVT_MASKED | TIMER_ONESHOT);
+	lapic_write (LAPIC_TIMER_DIV, TIMER_DIV_1);
+	lapic_write (LAPIC_TIMER_INIT, UINT32_MAX);
+	start = rdtsc ();
+	while (rdtsc () - start < cycles)
+		asm volatile ("pause");
+	count = UINT32_MAX - lapic_read (LAPIC_TIMER_CUR);
+	lapic_write (LAPIC_TIMER_INIT, 0);
+	return count;
+}
+
+/* Makes the running CPU's local APIC timer raise interrupt VEC,
+   in TSC-deadline mode if DEADLINE is true and otherwise in
+   one-shot mode.  The timer stays idle until armed with
+   lapic_timer_deadline() or lapic_timer_oneshot(), respectively. */
+void
+lapic_timer_init (uint8_t vec, bool deadline) {
+	ASSERT (lapic != NULL);
+	lapic_write (LAPIC_TIMER_DIV, TIMER_DIV_1);
+	lapic_write (LAPIC_TIMER, (deadline ? TIMER_DEADLINE : TIMER_ONESHOT) | vec);
+}
+
+/* Arms the running CPU's one-shot timer to fire after COUNT bus
+   clock cycles, replacing any earlier setting. */
+void
+lapic_timer_oneshot (uint32_t count) {
+	lapic_write (LAPIC_TIMER_INIT, count);
+}
+
+/* Arms the running CPU's TSC-deadline timer to fire once the time
+   stamp counter reaches TSC, which may already have passed,
+   replacing any earlier setting. */
+void
+lapic_timer_deadline (uint64_t tsc) {
+	write_msr (MSR_TSC_DEADLINE, tsc);
+}
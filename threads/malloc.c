@@ -5,9 +5,12 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "threads/vmalloc.h"
 
 /* A simple implementation of malloc().
 
@@ -32,14 +35,35 @@
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
    with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   the beginning of the allocated block's arena header.  Blocks of
+   VMALLOC_MIN_PAGES pages or more, and smaller ones when the page
+   allocator has no contiguous run for them, come from vmalloc()
+   instead, whose pages are contiguous only in virtual memory, so
+   that big tables do not fail for want of a physical run.
+
+   In front of the descriptors, each thread keeps a few free
+   blocks of each size in its own cache.  A free() pushes onto
+   the freeing thread's cache and a malloc() pops from it, with no
+   lock, so a thread that allocates and frees the same sizes in a
+   loop never touches the descriptor lock.  Only when its cache
+   for a size is empty (on malloc) or full (on free) does a thread
+   go to the descriptor.  The cache is flushed back when the
+   thread exits.  Blocks sitting in a cache still count as in use
+   for their arenas.
+
+   Every allocation carries an accounting tag naming the
+   subsystem that made it, so that live bytes, peak bytes and
+   allocation counts can be reported per subsystem.  Each arena
+   keeps one tag byte per block, just after the arena header;
+   big blocks keep their tag in the header itself. */
 
 /* Descriptor. */
 struct desc {
 	size_t block_size;          /* Size of each element in bytes. */
 	size_t blocks_per_arena;    /* Number of blocks in an arena. */
+	size_t first_ofs;           /* Offset of first block in an arena. */
 	struct list free_list;      /* List of free blocks. */
-	struct lock lock;           /* Lock. */
+	struct adaptive_lock lock;  /* Lock. */
 };
 
 /* Magic number for detecting arena corruption. */
@@ -48,6 +72,7 @@ struct desc {
 /* Arena. */
 struct arena {
 	unsigned magic;             /* Always set to ARENA_MAGIC. */
+	uint8_t tag;                /* Big block's accounting tag. */
 	struct desc *desc;          /* Owning descriptor, null for big block. */
 	size_t free_cnt;            /* Free blocks; pages in big block. */
 };
@@ -61,8 +86,27 @@ struct block {
 static struct desc descs[10];   /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
+/* Per-thread cache statistics, by descriptor. */
+static unsigned long long tcache_hits[MALLOC_TCACHE_CLASSES];
+static unsigned long long tcache_misses[MALLOC_TCACHE_CLASSES];
+
+/* Memory usage by tag. */
+static struct memstat tag_stats[TAG_CNT];
+
+/* Tag names, for statistics. */
+static const char *tag_names[TAG_CNT] = {
+	[TAG_MISC] = "misc",
+	[TAG_INODE] = "inode",
+	[TAG_DIR] = "dir",
+	[TAG_FAT] = "fat",
+	[TAG_PROCESS] = "process",
+	[TAG_VM] = "vm",
+	[TAG_FPU] = "fpu",
+};
+
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static uint8_t *block_tag (struct block *);
 
 /* Initializes the malloc() descriptors. */
 void
@@ -73,16 +117,48 @@ malloc_init (void) {
 		struct desc *d = &descs[desc_cnt++];
 		ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
 		d->block_size = block_size;
-		d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
+
+		/* Each block costs its size plus a tag byte, and blocks
+		   start 16-byte aligned after the tags. */
+		d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / (block_size + 1);
+		for (;;) {
+			d->first_ofs = ROUND_UP (sizeof (struct arena) + d->blocks_per_arena, 16);
+			if (d->first_ofs + d->blocks_per_arena * block_size <= PGSIZE)
+				break;
+			d->blocks_per_arena--;
+		}
 		list_init (&d->free_list);
-		lock_init (&d->lock);
+		adaptive_lock_init (&d->lock);
 	}
+	ASSERT (desc_cnt <= MALLOC_TCACHE_CLASSES);
+}
+
+/* Charges BYTES, negative for a free, to TAG. */
+static void
+account (enum memstat_tag tag, long long bytes) {
+	struct memstat *st = &tag_stats[tag];
+	enum intr_level old_level = intr_disable ();
+
+	st->live_bytes += bytes;
+	if (bytes > 0) {
+		st->alloc_cnt++;
+		if (st->live_bytes > st->peak_bytes)
+			st->peak_bytes = st->live_bytes;
+	} else
+		st->free_cnt++;
+	intr_set_level (old_level);
 }
 
 /* Obtains and returns a new block of at least SIZE bytes.
    Returns a null pointer if memory is not available. */
 void *
 malloc (size_t size) {
+	return malloc_tagged (size, TAG_MISC);
+}
+
+/* Like malloc(), but charges the block to TAG. */
+void *
+malloc_tagged (size_t size, enum memstat_tag tag) {
 	struct desc *d;
 	struct block *b;
 	struct arena *a;
@@ -100,19 +176,41 @@ malloc (size_t size) {
 		/* SIZE is too big for any descriptor.
 		   Allocate enough pages to hold SIZE plus an arena. */
 		size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
-		a = palloc_get_multiple (0, page_cnt);
+		a = NULL;
+		if (page_cnt < VMALLOC_MIN_PAGES)
+			a = palloc_get_multiple (0, page_cnt);
+		if (a == NULL)
+			a = vmalloc (page_cnt);
+		if (a == NULL && page_cnt >= VMALLOC_MIN_PAGES)
+			a = palloc_get_multiple (0, page_cnt);
 		if (a == NULL)
 			return NULL;
 
 		/* Initialize the arena to indicate a big block of PAGE_CNT
 		   pages, and return it. */
 		a->magic = ARENA_MAGIC;
+		a->tag = tag;
 		a->desc = NULL;
 		a->free_cnt = page_cnt;
+		account (tag, page_cnt * PGSIZE);
 		return a + 1;
 	}
 
-	lock_acquire (&d->lock);
+	/* Try the current thread's cache first. */
+	struct malloc_tcache *tc = &thread_current ()->tcache;
+	size_t class = d - descs;
+	if (tc->head[class] != NULL) {
+		b = tc->head[class];
+		tc->head[class] = *(void **) b;
+		tc->cnt[class]--;
+		tcache_hits[class]++;
+		*block_tag (b) = tag;
+		account (tag, d->block_size);
+		return b;
+	}
+	tcache_misses[class]++;
+
+	adaptive_lock_acquire (&d->lock);
 
 	/* If the free list is empty, create a new arena. */
 	if (list_empty (&d->free_list)) {
@@ -121,7 +219,7 @@ malloc (size_t size) {
 		/* Allocate a page. */
 		a = palloc_get_page (0);
 		if (a == NULL) {
-			lock_release (&d->lock);
+			adaptive_lock_release (&d->lock);
 			return NULL;
 		}
 
@@ -139,7 +237,9 @@ malloc (size_t size) {
 	b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
 	a = block_to_arena (b);
 	a->free_cnt--;
-	lock_release (&d->lock);
+	adaptive_lock_release (&d->lock);
+	*block_tag (b) = tag;
+	account (tag, d->block_size);
 	return b;
 }
 
@@ -147,6 +247,12 @@ malloc (size_t size) {
    Returns a null pointer if memory is not available. */
 void *
 calloc (size_t a, size_t b) {
+	return calloc_tagged (a, b, TAG_MISC);
+}
+
+/* Like calloc(), but charges the block to TAG. */
+void *
+calloc_tagged (size_t a, size_t b, enum memstat_tag tag) {
 	void *p;
 	size_t size;
 
@@ -156,13 +262,38 @@ calloc (size_t a, size_t b) {
 		return NULL;
 
 	/* Allocate and zero memory. */
-	p = malloc (size);
+	p = malloc_tagged (size, tag);
 	if (p != NULL)
 		memset (p, 0, size);
 
 	return p;
 }
 
+/* Returns block B, whose descriptor is D and arena A, to D's
+   free list, and the arena to the page allocator if it is now
+   entirely unused. */
+static void
+desc_free (struct desc *d, struct arena *a, struct block *b) {
+	adaptive_lock_acquire (&d->lock);
+
+	/* Add block to free list. */
+	list_push_front (&d->free_list, &b->free_elem);
+
+	/* If the arena is now entirely unused, free it. */
+	if (++a->free_cnt >= d->blocks_per_arena) {
+		size_t i;
+
+		ASSERT (a->free_cnt == d->blocks_per_arena);
+		for (i = 0; i < d->blocks_per_arena; i++) {
+			struct block *b = arena_to_block (a, i);
+			list_remove (&b->free_elem);
+		}
+		palloc_free_page (a);
+	}
+
+	adaptive_lock_release (&d->lock);
+}
+
 /* Returns the number of bytes allocated for BLOCK. */
 static size_t
 block_size (void *block) {
@@ -185,7 +316,8 @@ realloc (void *old_block, size_t new_size) {
 		free (old_block);
 		return NULL;
 	} else {
-		void *new_block = malloc (new_size);
+		void *new_block = malloc_tagged (new_size, old_block != NULL
+				? *block_tag (old_block) : TAG_MISC);
 		if (old_block != NULL && new_block != NULL) {
 			size_t old_size = block_size (old_block);
 			size_t min_size = new_size < old_size ? new_size : old_size;
@@ -207,38 +339,95 @@ free (void *p) {
 
 		if (d != NULL) {
 			/* It's a normal block.  We handle it here. */
+			account (*block_tag (b), -(long long) d->block_size);
 
 #ifndef NDEBUG
 			/* Clear the block to help detect use-after-free bugs. */
 			memset (b, 0xcc, d->block_size);
 #endif
 
-			lock_acquire (&d->lock);
-
-			/* Add block to free list. */
-			list_push_front (&d->free_list, &b->free_elem);
-
-			/* If the arena is now entirely unused, free it. */
-			if (++a->free_cnt >= d->blocks_per_arena) {
-				size_t i;
-
-				ASSERT (a->free_cnt == d->blocks_per_arena);
-				for (i = 0; i < d->blocks_per_arena; i++) {
-					struct block *b = arena_to_block (a, i);
-					list_remove (&b->free_elem);
-				}
-				palloc_free_page (a);
+			/* Keep it in the current thread's cache if there is room. */
+			struct malloc_tcache *tc = &thread_current ()->tcache;
+			size_t class = d - descs;
+			if (tc->cnt[class] < MALLOC_TCACHE_DEPTH) {
+				*(void **) b = tc->head[class];
+				tc->head[class] = b;
+				tc->cnt[class]++;
+				return;
 			}
 
-			lock_release (&d->lock);
+			desc_free (d, a, b);
 		} else {
 			/* It's a big block.  Free its pages. */
-			palloc_free_multiple (a, a->free_cnt);
+			account (a->tag, -(long long) (a->free_cnt * PGSIZE));
+			if (vmalloc_contains (a))
+				vfree (a);
+			else
+				palloc_free_multiple (a, a->free_cnt);
 			return;
 		}
 	}
 }
 
+/* Returns every block in the current thread's cache to its
+   descriptor.  Called when the thread exits. */
+void
+malloc_flush_tcache (void) {
+	struct malloc_tcache *tc = &thread_current ()->tcache;
+	size_t class;
+
+	for (class = 0; class < desc_cnt; class++) {
+		while (tc->head[class] != NULL) {
+			struct block *b = tc->head[class];
+			tc->head[class] = *(void **) b;
+			desc_free (&descs[class], block_to_arena (b), b);
+		}
+		tc->cnt[class] = 0;
+	}
+}
+
+/* Copies the memory usage for TAG into *ST.  Returns false if
+   TAG is not a valid tag. */
+bool
+malloc_get_stats (int tag, struct memstat *st) {
+	enum intr_level old_level;
+
+	if (tag < 0 || tag >= TAG_CNT)
+		return false;
+	old_level = intr_disable ();
+	*st = tag_stats[tag];
+	intr_set_level (old_level);
+	return true;
+}
+
+/* Prints memory usage by tag and per-size-class thread cache
+   hit rates. */
+void
+malloc_print_stats (void) {
+	size_t class;
+	int tag;
+
+	for (tag = 0; tag < TAG_CNT; tag++) {
+		struct memstat *st = &tag_stats[tag];
+
+		if (st->alloc_cnt == 0)
+			continue;
+		printf ("Malloc: tag %-7s %lld bytes live, %lld peak, "
+				"%lld allocs, %lld frees\n", tag_names[tag], st->live_bytes,
+				st->peak_bytes, st->alloc_cnt, st->free_cnt);
+	}
+
+	for (class = 0; class < desc_cnt; class++) {
+		unsigned long long total = tcache_hits[class] + tcache_misses[class];
+
+		if (total == 0)
+			continue;
+		printf ("Malloc: %4zu-byte blocks: %llu cache hits, %llu misses (%llu%%)\n",
+				descs[class].block_size, tcache_hits[class], tcache_misses[class],
+				tcache_hits[class] * 100 / total);
+	}
+}
+
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b) {
@@ -250,7 +439,8 @@ block_to_arena (struct block *b) {
 
 	/* Check that the block is properly aligned for the arena. */
 	ASSERT (a->desc == NULL
-			|| (pg_ofs (b) - sizeof *a) % a->desc->block_size == 0);
+			|| (pg_ofs (b) >= a->desc->first_ofs
+				&& (pg_ofs (b) - a->desc->first_ofs) % a->desc->block_size == 0));
 	ASSERT (a->desc != NULL || pg_ofs (b) == sizeof *a);
 
 	return a;
@@ -263,6 +453,17 @@ arena_to_block (struct arena *a, size_t idx) {
 	ASSERT (a->magic == ARENA_MAGIC);
 	ASSERT (idx < a->desc->blocks_per_arena);
 	return (struct block *) ((uint8_t *) a
-			+ sizeof *a
+			+ a->desc->first_ofs
 			+ idx * a->desc->block_size);
 }
+
+/* Returns a pointer to the accounting tag for block B. */
+static uint8_t *
+block_tag (struct block *b) {
+	struct arena *a = block_to_arena (b);
+	struct desc *d = a->desc;
+
+	if (d == NULL)
+		return &a->tag;
+	return (uint8_t *) (a + 1) + (pg_ofs (b) - d->first_ofs) / d->block_size;
+}
@@ -0,0 +1,121 @@
+#include "threads/sched.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include "threads/cpu.h"
+#include "threads/fixed-point.h"
+#include "threads/interrupt.h"
+#include "devices/timer.h"
+#include "intrinsic.h"
+
+/* Multi-level feedback queue scheduler: the "mlfqs" class's
+   priority computation.  Every thread's priority follows from its
+   recent_cpu, which grows while it runs and decays once a second
+   by a factor that depends on the load average, and its nice
+   value.  Selected by -mlfqs or -sched=mlfqs, which also sets
+   thread_mlfqs, so that priority donation and thread_set_priority()
+   are disabled. */
+
+/* System load average. */
+static fixed_t load_avg;
+
+/* Statistics. */
+static long long mlfqs_recomputes;        /* # of priority updates. */
+static uint64_t mlfqs_recompute_cycles;   /* TSC cycles spent in them. */
+
+/* Recomputes T's MLFQS priority from its recent_cpu and nice,
+   moving it to its new run queue if it is ready. */
+void
+mlfqs_update_priority (struct thread *t) {
+	int priority = PRI_MAX - FP_TO_INT (FP_DIV_INT (t->recent_cpu, 4))
+		- t->nice * 2;
+
+	if (priority < PRI_MIN)
+		priority = PRI_MIN;
+	else if (priority > PRI_MAX)
+		priority = PRI_MAX;
+
+	mlfqs_recomputes++;
+	t->base_priority = priority;
+	thread_update_priority (t, priority);
+}
+
+/* What decay_recent_cpu() needs besides the thread. */
+struct decay {
+	fixed_t coef;               /* Decay factor. */
+	struct thread *running;     /* Thread running on this CPU. */
+	struct thread *idle;        /* This CPU's idle thread. */
+};
+
+/* Decays T's recent_cpu by the factor in DECAY_ and recomputes
+   its priority if that moved it, or if T is running. */
+static void
+decay_recent_cpu (struct thread *t, void *decay_) {
+	const struct decay *d = decay_;
+	fixed_t recent;
+
+	if (t == d->idle)
+		return;
+	recent = FP_ADD_INT (FP_MUL (d->coef, t->recent_cpu), t->nice);
+	if (recent != t->recent_cpu || t == d->running) {
+		t->recent_cpu = recent;
+		mlfqs_update_priority (t);
+	}
+}
+
+/* MLFQS bookkeeping for a timer interrupt that advanced the clock
+   by ELAPSED ticks to NOW while T was running.
+
+   Only the running thread's recent_cpu grows between seconds, so
+   the 4-tick priority refresh touches just that thread.  Once a
+   second, recent_cpu decays for every thread, and a thread's
+   priority is recomputed only if its recent_cpu actually moved. */
+void
+mlfqs_tick (struct thread *t, int64_t now, int64_t elapsed) {
+	uint64_t start = rdtsc ();
+	int64_t prev = now - elapsed;
+	struct thread *idle = cpu_current ()->idle_thread;
+
+	if (t != idle)
+		t->recent_cpu = FP_ADD_INT (t->recent_cpu, elapsed);
+
+	/* The boot processor does the once-a-second work. */
+	if (cpu_current ()->id == 0 && now / TIMER_FREQ != prev / TIMER_FREQ) {
+		int load = thread_ready_cnt ();
+		struct decay d;
+		int i;
+
+		for (i = 0; i < CPU_MAX; i++)
+			if (cpus[i].online && cpus[i].curr != cpus[i].idle_thread)
+				load++;
+
+		load_avg = FP_ADD (FP_DIV_INT (FP_MUL_INT (load_avg, 59), 60),
+				FP_DIV_INT (FP_FROM_INT (load), 60));
+		d.coef = FP_DIV (FP_MUL_INT (load_avg, 2),
+				FP_ADD_INT (FP_MUL_INT (load_avg, 2), 1));
+		d.running = t;
+		d.idle = idle;
+		thread_foreach (decay_recent_cpu, &d);
+	} else if (now / 4 != prev / 4 && t != idle)
+		mlfqs_update_priority (t);
+
+	mlfqs_recompute_cycles += rdtsc () - start;
+	thread_preempt ();
+}
+
+/* Returns 100 times the system load average. */
+int
+mlfqs_get_load_avg (void) {
+	enum intr_level old_level = intr_disable ();
+	int load = FP_ROUND (FP_MUL_INT (load_avg, 100));
+
+	intr_set_level (old_level);
+	return load;
+}
+
+/* Prints MLFQS statistics. */
+void
+mlfqs_print_stats (void) {
+	printf ("MLFQS: %lld priority updates in %"PRIu64" cycles\n",
+			mlfqs_recomputes, mlfqs_recompute_cycles);
+}
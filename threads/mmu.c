@@ -1,21 +1,313 @@
 #include <stdbool.h>                 // Define boolean data type
 #include <stddef.h>                  // Define size_t and NULL
 #include <string.h>                  // Provide string manipulation functions
+#include <stdio.h>                   // Provide printf for statistics
+#include "threads/cpu.h"             // Number of CPUs online
 #include "threads/init.h"            // Thread initialization functions
+#include "threads/interrupt.h"       // Interrupt level control
+#include "threads/lapic.h"           // Interprocessor interrupts
 #include "threads/pte.h"             // Page Table Entry definitions
 #include "threads/palloc.h"          // Physical memory allocation functions
+#include "threads/synch.h"           // Optimization barrier
 #include "threads/thread.h"          // Thread management functions
 #include "threads/mmu.h"             // Memory Management Unit definitions
+#include "threads/vaddr.h"           // Virtual address helpers
 #include "intrinsic.h"               // Intrinsic functions
 
+/* Process-context identifiers.
+ *
+ * When the CPU supports PCIDs, the TLB tags each translation with the ID held in the low 12 bits of CR3, so an
+ * address space's entries survive while other address spaces run.  Every PML4 that gets activated is given one
+ * of the 4095 nonzero IDs (0 belongs to base_pml4) and keeps it across switches, which then set CR3_NOFLUSH.
+ * When every ID is taken, the least recently activated PML4 loses its own.  An ID is installed without
+ * CR3_NOFLUSH the first time it is used by a new owner, dropping whatever its previous owner left behind.
+ *
+ * The ID of a PML4 is stored in a PML4 slot that is never present, which the CPU ignores.
+ *
+ * Each CPU has its own TLB, so with other CPUs running a PML4's entries may be cached under its ID on any
+ * of them.  Rather than interrupting the CPUs that do not run it when it changes, a second such slot holds a
+ * mask of the CPUs whose entries for it are stale, and each CPU loads the ID without CR3_NOFLUSH the next time
+ * it activates the PML4 with its bit set.  A new owner of an ID starts out stale on every CPU. */
+#define CR4_PCIDE (1 << 17)                                                  // CR4 bit that enables PCIDs
+#define CR4_PGE (1 << 7)                                                     // CR4 bit that enables global pages
+#define CR3_NOFLUSH (1ULL << 63)                                             // Keep the TLB entries of the new PCID
+#define PCID_CNT 4096                                                        // Number of IDs, including ID 0
+#define PCID_SLOT 511                                                        // PML4 index that stores the ID
+#define STALE_SLOT 510                                                       // PML4 index that stores the stale mask
+#define ALL_CPUS ((1u << CPU_MAX) - 1)                                       // Mask of every CPU
+
+static bool pcid_enabled;                                                    // Are PCIDs in use?
+static bool invpcid_enabled;                                                 // Is INVPCID available?
+static uint64_t *pcid_owner[PCID_CNT];                                       // PML4 that owns each ID, or NULL
+static uint64_t pcid_stamp[PCID_CNT];                                        // Last activation of each ID
+static uint64_t pcid_clock;                                                  // Activation counter
+static long long pcid_hits, pcid_flushes;                                    // Statistics
+
+/* TLB shootdown.
+ *
+ * Once other CPUs run, a change to a PTE that a CPU may have cached has to reach that CPU's TLB too.  The
+ * CPUs running the PML4, according to their struct cpu, are sent IPI_TLB_SHOOTDOWN and invalidate the pages
+ * listed in a struct tlb_batch, while the sender waits with the interrupt lock held, so that there is only
+ * ever one shootdown in flight.  A CPU waiting for the lock cannot take the interrupt, so it answers from
+ * its spin loop instead, and the interrupt itself is answered before intr_handler() takes the lock.
+ * CPUs not running the PML4 have nothing cached for it without PCIDs, and are marked stale with them.
+ *
+ * Between pml4_batch_begin() and pml4_batch_end() a thread's invalidations queue up in its batch, which is
+ * sent when it fills up and when the batch ends, so that unmapping a run of pages costs one interrupt per
+ * CPU instead of one per page.  The batch must end before the frames it unmapped are reused or the page
+ * tables it names are destroyed. */
+static const struct tlb_batch *shootdown;                                    // Batch being shot down, if any
+static long long shootdown_cnt, shootdown_pages, shootdown_ipis;             // Statistics
+
+/* Enables PCIDs if the CPU advertises them, and global pages, which pml4_set_kernel_page() maps.  Must be
+ * called once base_pml4 is active. */
+void
+pml4_pcid_init (void) {
+	uint32_t regs[4];
+
+	lcr4 (rcr4 () | CR4_PGE);                                                // Every x86-64 CPU has them
+	cpuid (1, 0, regs);                                                      // Feature flags
+	if (!(regs[2] & (1 << 17)))                                              // ECX bit 17: PCID
+		return;
+	lcr4 (rcr4 () | CR4_PCIDE);                                              // CR3 holds ID 0 already
+	pcid_enabled = true;
+
+	cpuid (0, 0, regs);                                                      // Highest basic leaf
+	if (regs[0] >= 7) {
+		cpuid (7, 0, regs);                                                  // Structured extended features
+		invpcid_enabled = (regs[1] & (1 << 10)) != 0;                        // EBX bit 10: INVPCID
+	}
+}
+
+/* Sets up the running CPU, one of the others, to use PCIDs if the boot processor does.  It starts on
+ * base_pml4. */
+void
+pml4_init_ap (void) {
+	lcr4 (rcr4 () | CR4_PGE);
+	if (pcid_enabled)
+		lcr4 (rcr4 () | CR4_PCIDE);                                          // CR3 holds ID 0 already
+	cpu_current ()->pml4 = base_pml4;
+}
+
+/* Returns the ID that PML4 owns, or 0 if it has none. */
+static unsigned
+pcid_lookup (uint64_t *pml4) {
+	unsigned id = pml4[PCID_SLOT] >> PGBITS;                                 // Get the stored ID
+	return id != 0 && pcid_owner[id] == pml4 ? id : 0;                       // Valid only if PML4 still owns it
+}
+
+/* Returns the mask of CPUs whose TLB entries under PML4's ID are stale. */
+static unsigned
+pcid_stale (uint64_t *pml4) {
+	return pml4[STALE_SLOT] >> PGBITS;
+}
+
+/* Sets the mask of CPUs whose TLB entries under PML4's ID are stale to MASK. */
+static void
+pcid_set_stale (uint64_t *pml4, unsigned mask) {
+	pml4[STALE_SLOT] = (uint64_t) mask << PGBITS;                            // Keep the present bit clear
+}
+
+/* Gives PML4 the free ID or, failing that, the least recently activated one, and returns it. */
+static unsigned
+pcid_alloc (uint64_t *pml4) {
+	unsigned id, victim = 1;
+
+	for (id = 1; id < PCID_CNT; id++) {                                      // Look for a free ID, tracking the LRU one
+		if (pcid_owner[id] == NULL) {
+			victim = id;
+			break;
+		}
+		if (pcid_stamp[id] < pcid_stamp[victim])
+			victim = id;
+	}
+	if (pcid_owner[victim] != NULL)                                          // Take the ID away from its owner
+		pcid_owner[victim][PCID_SLOT] = 0;
+	pcid_owner[victim] = pml4;
+	pml4[PCID_SLOT] = (uint64_t) victim << PGBITS;                           // Record it with the present bit clear
+	pcid_set_stale (pml4, ALL_CPUS);                                         // Any CPU may hold entries under it
+	return victim;
+}
+
+/* Takes away PML4's ID, if any, so that its next activation starts with a clean TLB. */
+static void
+pcid_release (uint64_t *pml4) {
+	enum intr_level old_level = intr_disable ();
+	unsigned id = pcid_lookup (pml4);
+
+	if (id != 0)
+		pcid_owner[id] = NULL;                                               // Free the ID
+	pml4[PCID_SLOT] = 0;
+	intr_set_level (old_level);
+}
+
+/* Returns true if PML4 is the active page table. */
+static bool
+pml4_is_active (uint64_t *pml4) {
+	return PTE_ADDR (rcr3 ()) == vtop (pml4);                                // Compare without the PCID bits
+}
+
+/* Invalidates the pages in batch B on CPU C, the running one, or marks their PML4s stale on C.  A page with
+ * a null PML4 is a global kernel page, invalidated whatever C runs. */
+static void
+shootdown_apply (const struct tlb_batch *b, struct cpu *c) {
+	for (size_t i = 0; i < b->cnt; i++) {
+		if (b->pml4[i] == NULL || b->pml4[i] == c->pml4)                     // Global, or still running the page's PML4
+			invlpg ((uint64_t) b->va[i]);
+		else if (pcid_enabled && pcid_lookup (b->pml4[i]) != 0)              // Switched away, keeping its entries
+			pcid_set_stale (b->pml4[i], pcid_stale (b->pml4[i]) | 1u << c->id);
+	}
+}
+
+/* Applies the shootdown sent to the running CPU, if any.  Called on IPI_TLB_SHOOTDOWN and while waiting for
+ * the interrupt lock, with interrupts off. */
+void
+pml4_shootdown_poll (void) {
+	struct cpu *c = cpu_current ();
+
+	if (c->tlb_pending) {
+		shootdown_apply (shootdown, c);
+		barrier ();
+		c->tlb_pending = false;                                              // Let the sender go on
+	}
+}
+
+/* Sends batch B to the CPUs it names and waits for them to apply it, then empties it.  Interrupts must be
+ * off, so that the running CPU holds the interrupt lock. */
+static void
+shootdown_flush (struct tlb_batch *b) {
+	struct cpu *c = cpu_current ();
+	int i;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	if (b->cpus & 1u << c->id)                                               // The batch's thread moved here
+		shootdown_apply (b, c);
+	b->cpus &= ~(1u << c->id);
+	if (b->cpus != 0) {
+		shootdown = b;
+		for (i = 0; i < CPU_MAX; i++)
+			if (b->cpus & 1u << i)
+				cpus[i].tlb_pending = true;
+		asm volatile ("mfence" : : : "memory");                              // Before the interrupts go out
+		for (i = 0; i < CPU_MAX; i++)
+			if (b->cpus & 1u << i) {
+				lapic_send_ipi (cpus[i].apic_id, IPI_TLB_SHOOTDOWN);
+				shootdown_ipis++;
+			}
+		for (i = 0; i < CPU_MAX; i++)
+			while (cpus[i].tlb_pending)
+				asm volatile ("pause");
+		shootdown = NULL;
+		shootdown_cnt++;
+		shootdown_pages += b->cnt;
+	}
+	b->cnt = 0;
+	b->cpus = 0;
+}
+
+/* Makes the other CPUs drop their TLB entries for user virtual page VA in PML4: queues VA for those running
+ * it, in the running thread's batch or in one sent at once, and marks PML4 stale for the rest.  Interrupts
+ * must be off. */
+static void
+shootdown_queue (uint64_t *pml4, const void *va) {
+	struct cpu *c = cpu_current ();
+	struct tlb_batch one, *b = thread_current ()->tlb_batch;
+	unsigned running = 0, stale = 0;
+
+	for (int i = 0; i < CPU_MAX; i++) {
+		if (i == c->id || !cpus[i].online)
+			continue;
+		if (cpus[i].pml4 == pml4)
+			running |= 1u << i;
+		else
+			stale |= 1u << i;
+	}
+	if (pcid_enabled && pcid_lookup (pml4) != 0)
+		pcid_set_stale (pml4, pcid_stale (pml4) | stale);
+	if (running == 0)
+		return;
+
+	if (b == NULL) {                                                         // No batch open
+		b = &one;
+		b->cnt = 0;
+		b->cpus = 0;
+	} else if (b->cnt == TLB_BATCH_MAX)
+		shootdown_flush (b);
+	b->pml4[b->cnt] = pml4;
+	b->va[b->cnt++] = va;
+	b->cpus |= running;
+	if (b == &one)
+		shootdown_flush (b);
+}
+
+/* Drops any TLB entry for user virtual page VA in PML4 after its PTE has changed.
+ * Without PCIDs, an inactive PML4 has nothing cached; with them, its ID is invalidated for VA if INVPCID
+ * exists and is otherwise taken away, or marked stale once other CPUs run.  Those that run PML4 too are
+ * shot down.
+ */
+static void
+pml4_invalidate (uint64_t *pml4, const void *va) {
+	enum intr_level old_level;
+	struct cpu *c;
+
+	if (cpu_cnt == 1) {
+		if (pml4_is_active (pml4))                                           // If the current page directory is active
+			invlpg ((uint64_t) va);                                          // Invalidate the page in TLB
+		else if (pcid_enabled) {
+			unsigned id = pcid_lookup (pml4);
+			if (id != 0 && invpcid_enabled)
+				invpcid (0, id, (uint64_t) va);                              // Individual-address invalidation
+			else if (id != 0)
+				pcid_release (pml4);
+		}
+		return;
+	}
+
+	old_level = intr_disable ();                                             // Excludes activations on every CPU
+	c = cpu_current ();
+	if (c->pml4 == pml4)
+		invlpg ((uint64_t) va);
+	else if (pcid_enabled && pcid_lookup (pml4) != 0)
+		pcid_set_stale (pml4, pcid_stale (pml4) | 1u << c->id);
+	shootdown_queue (pml4, va);
+	intr_set_level (old_level);
+}
+
+/* Starts batching the running thread's TLB shootdowns in B, until pml4_batch_end(). */
+void
+pml4_batch_begin (struct tlb_batch *b) {
+	struct thread *t = thread_current ();
+
+	ASSERT (t->tlb_batch == NULL);
+	b->cnt = 0;
+	b->cpus = 0;
+	t->tlb_batch = b;
+}
+
+/* Sends what is left in B, begun with pml4_batch_begin(), and stops batching. */
+void
+pml4_batch_end (struct tlb_batch *b) {
+	struct thread *t = thread_current ();
+	enum intr_level old_level;
+
+	ASSERT (t->tlb_batch == b);
+	old_level = intr_disable ();
+	shootdown_flush (b);
+	t->tlb_batch = NULL;
+	intr_set_level (old_level);
+}
+
 /* Walks through the page directory pointed to by pdp to return the page table entry 
  * corresponding to the virtual address va. If create is true, missing page table pages are created.
+ * A va that a 2 MiB page maps has no page table entry, so a null pointer is returned for it.
  */
 static uint64_t *
 pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 	int idx = PDX (va);                                                      // Get directory index from virtual address
 	if (pdp) {                                                               // If page directory is not NULL
 		uint64_t *pte = (uint64_t *) pdp[idx];                               // Get the page table entry
+		if ((uint64_t) pte & PTE_PS)                                         // If the entry maps a 2 MiB page
+			return NULL;                                                     // There is no page table below it
 		if (!((uint64_t) pte & PTE_P)) {                                     // If the page table entry is not present
 			if (create) {                                                    // If create flag is true
 				uint64_t *new_page = palloc_get_page (PAL_ZERO);             // Allocate a new page frame with zeroed contents
@@ -33,6 +325,7 @@ pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 
 /* Walks through the page directory pointer table pointed to by pdpe to return the page table entry
  * corresponding to the virtual address va. If create is true, missing directory pages are created.
+ * A va that a 1 GiB page maps has no page table entry, so a null pointer is returned for it.
  */
 static uint64_t *
 pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
@@ -41,6 +334,8 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
 	int allocated = 0;                                                       // Track if a new page was allocated
 	if (pdpe) {                                                              // If page directory pointer is not NULL
 		uint64_t *pde = (uint64_t *) pdpe[idx];                              // Get the page directory entry
+		if ((uint64_t) pde & PTE_PS)                                         // If the entry maps a 1 GiB page
+			return NULL;                                                     // There is no directory below it
 		if (!((uint64_t) pde & PTE_P)) {                                     // If the page directory entry is not present
 			if (create) {                                                    // If create flag is true
 				uint64_t *new_page = palloc_get_page (PAL_ZERO);             // Allocate a new zeroed page frame
@@ -93,6 +388,52 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	return pte;                                                              // Return the page table entry
 }
 
+/* Returns the address of the entry for virtual address va at the level of PML4 whose entries map LEVEL_SHIFT
+ * bits of address, that is, the PDPE for PDPESHIFT, which may map a 1 GiB page, or the PDE for PDXSHIFT, which
+ * may map a 2 MiB page.  If create is true, missing tables are created on the way.  Otherwise, or if memory is
+ * short, a null pointer is returned for a va whose table does not exist, as for one that a larger page maps.
+ */
+static uint64_t *
+table_walk (uint64_t *pml4, const uint64_t va, unsigned level_shift, int create) {
+	uint64_t *table = pml4;                                                  // Start from the PML4
+	unsigned shift;
+
+	for (shift = PML4SHIFT; shift > level_shift; shift -= PDPESHIFT - PDXSHIFT) {  // For the levels above it
+		uint64_t *e = &table[(va >> shift) & 0x1FF];                         // Get the entry for va at this level
+		if (*e & PTE_PS)                                                     // If the entry maps a larger page
+			return NULL;                                                     // There is no table below it
+		if (!(*e & PTE_P)) {                                                 // If the entry is not present
+			uint64_t *new_page;
+			if (!create)
+				return NULL;                                                 // Return NULL if not creating
+			new_page = palloc_get_page (PAL_ZERO);                           // Allocate a new zeroed table
+			if (new_page == NULL)
+				return NULL;                                                 // Return NULL if allocation fails
+			*e = vtop (new_page) | PTE_U | PTE_W | PTE_P;                    // Link in the new table
+		}
+		table = ptov (PTE_ADDR (*e));                                        // Descend to the next level
+	}
+	return &table[(va >> level_shift) & 0x1FF];                              // Return the entry at the level
+}
+
+/* Returns the address of the page directory entry for virtual address va in PML4, which may map a 2 MiB page.
+ * If create is true, missing directory pointer tables and page directories are created on the way.
+ * Otherwise, or if memory is short, a null pointer is returned for a va whose directory does not exist.
+ */
+uint64_t *
+pml4_pde_walk (uint64_t *pml4, const uint64_t va, int create) {
+	return table_walk (pml4, va, PDXSHIFT, create);
+}
+
+/* Returns the address of the page directory pointer entry for virtual address va in PML4, which may map a
+ * 1 GiB page.  If create is true, a missing directory pointer table is created.  Otherwise, or if memory is
+ * short, a null pointer is returned for a va whose directory pointer table does not exist.
+ */
+uint64_t *
+pml4_pdpe_walk (uint64_t *pml4, const uint64_t va, int create) {
+	return table_walk (pml4, va, PDPESHIFT, create);
+}
+
 /* Creates and returns a new page map level 4 (PML4) with mappings for kernel virtual addresses,
  * but none for user virtual addresses. Returns the new page directory, or a null pointer if memory allocation fails.
  */
@@ -128,6 +469,7 @@ pt_for_each (uint64_t *pt, pte_for_each_func *func, void *aux,
 
 /* Applies the function func to each available page table entry within a page directory.
  * Traverses using indices associated with the PD, applying provided auxiliary data.
+ * A PDE that maps a 2 MiB page is passed to func itself, with the va of the start of the page.
  */
 
 static bool
@@ -135,16 +477,24 @@ pgdir_for_each (uint64_t *pdp, pte_for_each_func *func, void *aux,
 		unsigned pml4_index, unsigned pdp_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {             // Iterate through all entries in the PD
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);                           // Get the page directory entry
-		if (((uint64_t) pte) & PTE_P)                                        // If the entry is present
-			if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,        // Apply function to its corresponding page table
+		if (!(((uint64_t) pte) & PTE_P))                                     // If the entry is not present
+			continue;
+		if (pdp[i] & PTE_PS) {                                               // If the entry maps a 2 MiB page
+			void *va = (void *) (((uint64_t) pml4_index << PML4SHIFT) |      // Compute virtual address from indices
+								 ((uint64_t) pdp_index << PDPESHIFT) |
+								 ((uint64_t) i << PDXSHIFT));
+			if (!func (&pdp[i], va, aux))                                    // Apply the function to the PDE
+				return false;
+		} else if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,     // Apply function to its corresponding page table
 					pml4_index, pdp_index, i))
-				return false;                                                // Return false if function application fails
+			return false;                                                    // Return false if function application fails
 	}
 	return true;                                                             // Return true if all entries processed successfully
 }
 
 /* Applies the function func to each available page table entry within a page directory pointer table.
  * Traverses using indices associated with the PDP, applying provided auxiliary data.
+ * A PDPE that maps a 1 GiB page is passed to func itself, with the va of the start of the page.
  */
 
 static bool
@@ -152,10 +502,16 @@ pdp_for_each (uint64_t *pdp,
 		pte_for_each_func *func, void *aux, unsigned pml4_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {             // Iterate through all entries in the PDP
 		uint64_t *pde = ptov((uint64_t *) pdp[i]);                           // Get the page directory pointer entry
-		if (((uint64_t) pde) & PTE_P)                                        // If the entry is present
-			if (!pgdir_for_each ((uint64_t *) PTE_ADDR (pde), func,          // Apply function to its corresponding page directory
+		if (!(((uint64_t) pde) & PTE_P))                                     // If the entry is not present
+			continue;
+		if (pdp[i] & PTE_PS) {                                               // If the entry maps a 1 GiB page
+			void *va = (void *) (((uint64_t) pml4_index << PML4SHIFT) |      // Compute virtual address from indices
+								 ((uint64_t) i << PDPESHIFT));
+			if (!func (&pdp[i], va, aux))                                    // Apply the function to the PDPE
+				return false;
+		} else if (!pgdir_for_each ((uint64_t *) PTE_ADDR (pde), func,       // Apply function to its corresponding page directory
 					 aux, pml4_index, i))
-				return false;                                                // Return false if function application fails
+			return false;                                                    // Return false if function application fails
 	}
 	return true;                                                             // Return true if all entries processed successfully
 }
@@ -173,37 +529,98 @@ pml4_for_each (uint64_t *pml4, pte_for_each_func *func, void *aux) {
 	return true;                                                             // Return true if all entries processed successfully
 }
 
+/* Applies func to each present PTE that maps a page in [start, end), and to each PDE or PDPE that maps a
+ * 2 MiB or 1 GiB page overlapping it, in ascending order of va, stopping early and returning false if func does.
+ * Walks the tree once: a non-present entry at any level skips the whole range below it.
+ * func gets the entry itself, so it can read or change the accessed and dirty bits without another walk.
+ * Whoever changes an entry must also flush any TLB entry for it.
+ */
+bool
+pml4_for_each_range (uint64_t *pml4, const void *start, const void *end,
+		pte_for_each_func *func, void *aux) {
+	uint64_t va = (uint64_t) pg_round_down (start);                          // First page to visit
+	uint64_t limit = (uint64_t) end;                                         // End of the range, exclusive
+
+	while (va < limit) {
+		uint64_t *table = pml4;                                              // Start each descent at the PML4
+		uint64_t base = va;                                                  // Where this descent started
+		uint64_t next;                                                       // Start of the next subtree to visit
+		unsigned shift;
+
+		for (shift = PML4SHIFT; shift > PTXSHIFT; shift -= PDPESHIFT - PDXSHIFT) {  // Descend to the page table
+			uint64_t *e = &table[(va >> shift) & 0x1FF];                     // Get the entry for va at this level
+			next = (va | ((1ULL << shift) - 1)) + 1;                         // End of what the entry maps
+			if (!(*e & PTE_P))                                               // If nothing is mapped below it
+				break;                                                       // Skip the entry's whole range
+			if (*e & PTE_PS) {                                               // If the entry maps a 2 MiB or 1 GiB page
+				if (!func (e, (void *) (va & ~((1ULL << shift) - 1)), aux))  // Apply the function to the entry
+					return false;
+				break;
+			}
+			table = ptov (PTE_ADDR (*e));                                    // Descend to the next level
+		}
+		if (shift == PTXSHIFT) {                                             // If a page table was reached
+			for (unsigned i = PTX (va); i < PGSIZE / sizeof (uint64_t) && va < limit; i++, va += PGSIZE)
+				if ((table[i] & PTE_P) && !func (&table[i], (void *) va, aux))  // Apply the function to each present PTE
+					return false;
+			next = va;                                                       // Continue after the page table
+		}
+		if (next <= base)                                                    // If the end of the address space wrapped
+			break;
+		va = next;
+	}
+	return true;
+}
+
+/* Pages collected by a teardown, to be returned to palloc together. */
+#define FREE_BATCH_CNT 32
+
+struct free_batch {
+	size_t cnt;                                                              // Number of collected pages
+	void *pages[FREE_BATCH_CNT];                                             // Collected pages
+};
+
+/* Adds PAGE to BATCH, handing the batch to palloc first if it is full. */
+static void
+free_batch_add (struct free_batch *batch, void *page) {
+	if (batch->cnt == FREE_BATCH_CNT) {                                      // If the batch is full
+		palloc_free_pages (batch->pages, batch->cnt);                        // Free all of it at once
+		batch->cnt = 0;
+	}
+	batch->pages[batch->cnt++] = page;
+}
+
 /* Destroys a page table by freeing all pages it references. */
 static void
-pt_destroy (uint64_t *pt) {
+pt_destroy (uint64_t *pt, struct free_batch *batch) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {             // Iterate through all entries in the page table
 		uint64_t *pte = ptov((uint64_t *) pt[i]);                            // Get the page table entry
-		if (((uint64_t) pte) & PTE_P)                                        // If the entry is present
-			palloc_free_page ((void *) PTE_ADDR (pte));                      // Free the allocated page frame
+		if ((((uint64_t) pte) & (PTE_P | PTE_NOFREE)) == PTE_P)              // If the entry is present and owns its frame
+			free_batch_add (batch, (void *) PTE_ADDR (pte));                 // Free the allocated page frame
 	}
-	palloc_free_page ((void *) pt);                                          // Free the page table itself
+	free_batch_add (batch, (void *) pt);                                     // Free the page table itself
 }
 
 /* Destroys a page directory by freeing all pages it references. */
 static void
-pgdir_destroy (uint64_t *pdp) {
+pgdir_destroy (uint64_t *pdp, struct free_batch *batch) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {             // Iterate through all entries in the page directory
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);                           // Get the page directory entry
 		if (((uint64_t) pte) & PTE_P)                                        // If the entry is present
-			pt_destroy (PTE_ADDR (pte));                                     // Destroy its corresponding page table
+			pt_destroy (PTE_ADDR (pte), batch);                              // Destroy its corresponding page table
 	}
-	palloc_free_page ((void *) pdp);                                         // Free the page directory itself
+	free_batch_add (batch, (void *) pdp);                                    // Free the page directory itself
 }
 
 /* Destroys a page directory pointer table by freeing all pages it references. */
 static void
-pdpe_destroy (uint64_t *pdpe) {
+pdpe_destroy (uint64_t *pdpe, struct free_batch *batch) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {             // Iterate through all entries in the PDP
 		uint64_t *pde = ptov((uint64_t *) pdpe[i]);                          // Get the page directory pointer entry
 		if (((uint64_t) pde) & PTE_P)                                        // If the entry is present
-			pgdir_destroy ((void *) PTE_ADDR (pde));                        // Destroy its corresponding page directory
+			pgdir_destroy ((void *) PTE_ADDR (pde), batch);                  // Destroy its corresponding page directory
 	}
-	palloc_free_page ((void *) pdpe);                                        // Free the page directory pointer itself
+	free_batch_add (batch, (void *) pdpe);                                   // Free the page directory pointer itself
 }
 
 /* Destroys a PML4, freeing all the pages it references. */
@@ -213,17 +630,69 @@ pml4_destroy (uint64_t *pml4) {
 		return;
 	ASSERT (pml4 != base_pml4);                                              // Assert that it is not the base PML4
 
+	if (pcid_enabled)
+		pcid_release (pml4);                                                 // Free its PCID
 	/* if PML4 (vaddr) >= 1, it's kernel space by define. */
+	struct free_batch batch = { .cnt = 0 };                                  // Pages to free, in batches
 	uint64_t *pdpe = ptov ((uint64_t *) pml4[0]);                            // Get the kernel space directory pointer entry
 	if (((uint64_t) pdpe) & PTE_P)
-		pdpe_destroy ((void *) PTE_ADDR (pdpe));                            // Destroy its corresponding directory pointer
-	palloc_free_page ((void *) pml4);                                        // Free the PML4 itself
+		pdpe_destroy ((void *) PTE_ADDR (pdpe), &batch);                     // Destroy its corresponding directory pointer
+	free_batch_add (&batch, (void *) pml4);                                  // Free the PML4 itself
+	palloc_free_pages (batch.pages, batch.cnt);                              // Free whatever is left in the batch
 }
 
-/* Loads the page directory PD into the CPU's page directory base register. */
+/* Loads the page directory PD into the CPU's page directory base register.
+ * With PCIDs, translations cached for PD under its ID are kept unless they are stale on this CPU.
+ * Does nothing if PD is already loaded, so switching between threads of one process keeps the TLB;
+ * other CPUs that change PD meanwhile shoot this one down.
+ */
 void
 pml4_activate (uint64_t *pml4) {
-	lcr3 (vtop (pml4 ? pml4 : base_pml4));                                   // Load the page directory base register with the physical address
+	enum intr_level old_level;
+	struct cpu *c;
+	unsigned id, self;
+
+	if (pml4 == NULL)
+		pml4 = base_pml4;
+
+	old_level = intr_disable ();                                             // Excludes shootdown_queue() on every CPU
+	c = cpu_current ();
+	if (c->pml4 == pml4) {                                                   // Already loaded, as when switching threads of one process
+		intr_set_level (old_level);
+		return;
+	}
+	c->pml4 = pml4;                                                          // Shootdowns of PML4 reach this CPU from here on
+	if (!pcid_enabled)
+		lcr3 (vtop (pml4));                                                  // Load the page directory base register with the physical address
+	else if (pml4 == base_pml4)
+		lcr3 (vtop (pml4) | CR3_NOFLUSH);                                    // ID 0; kernel mappings never change
+	else {
+		self = 1u << c->id;
+		id = pcid_lookup (pml4);
+		if (id != 0 && !(pcid_stale (pml4) & self)) {
+			pcid_hits++;
+			lcr3 (vtop (pml4) | id | CR3_NOFLUSH);                           // Keep the entries tagged with ID
+		} else {
+			pcid_flushes++;
+			if (id == 0)
+				id = pcid_alloc (pml4);
+			lcr3 (vtop (pml4) | id);                                         // Flush what is stale or the previous owner left
+			pcid_set_stale (pml4, pcid_stale (pml4) & ~self);
+		}
+		pcid_stamp[id] = ++pcid_clock;
+	}
+	intr_set_level (old_level);
+}
+
+/* Prints PCID statistics. */
+void
+pml4_print_stats (void) {
+	if (pcid_enabled)
+		printf ("PCID: %lld switches kept the TLB, %lld flushed it\n",
+				pcid_hits, pcid_flushes);
+	if (shootdown_cnt != 0)
+		printf ("TLB: %lld shootdowns of %lld pages, %lld IPIs\n",
+				shootdown_cnt, shootdown_pages, shootdown_ipis);
 }
 
 /* Looks up the physical address that corresponds to user virtual address UADDR in pml4.
@@ -237,6 +706,15 @@ pml4_get_page (uint64_t *pml4, const void *uaddr) {
 
 	if (pte && (*pte & PTE_P))                                               // If the page table entry is present
 		return ptov (PTE_ADDR (*pte)) + pg_ofs (uaddr);                      // Return the kernel virtual address corresponding to the physical address
+
+	pte = pml4_pde_walk (pml4, (uint64_t) uaddr, 0);                         // Otherwise a 2 MiB page may map it
+	if (pte && (*pte & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS))                // If the directory entry maps a large page
+		return ptov (PTE_ADDR (*pte))                                        // Return the kernel virtual address within it
+			+ ((uint64_t) uaddr & (LARGE_PGSIZE - 1));
+	pte = pml4_pdpe_walk (pml4, (uint64_t) uaddr, 0);                        // Or a 1 GiB page
+	if (pte && (*pte & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS))                // If the pointer entry maps a huge page
+		return ptov (PTE_ADDR (*pte))                                        // Return the kernel virtual address within it
+			+ ((uint64_t) uaddr & (HUGE_PGSIZE - 1));
 	return NULL;                                                             // Return NULL if the page is not mapped
 }
 
@@ -254,11 +732,80 @@ pml4_set_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
 
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) upage, 1);                  // Get or create the page table entry for the virtual address
 
-	if (pte)
+	if (pte) {
+		bool was_present = (*pte & PTE_P) != 0;
 		*pte = vtop (kpage) | PTE_P | (rw ? PTE_W : 0) | PTE_U;              // Set the page table entry with frame address and flags
+		if (was_present)                                                     // If an old translation may be cached
+			pml4_invalidate (pml4, upage);
+	}
 	return pte != NULL;                                                      // Return true if the mapping was successful
 }
 
+/* Maps user virtual page UPAGE in PML4 read-only to the frame at kernel virtual address KPAGE,
+ * which other page tables may map too.  The frame is not freed with PML4, and fork() does not copy it.
+ * UPAGE must not already be mapped.  Returns true if successful, false if memory allocation failed.
+ */
+bool
+pml4_share_page (uint64_t *pml4, void *upage, void *kpage) {
+	uint64_t *pte;
+
+	ASSERT (pg_ofs (upage) == 0);                                            // Assert that upage is page-aligned
+	ASSERT (pg_ofs (kpage) == 0);                                            // Assert that kpage is page-aligned
+	ASSERT (is_user_vaddr (upage));                                          // Assert that upage is a user virtual address
+
+	pte = pml4e_walk (pml4, (uint64_t) upage, 1);                            // Get or create the page table entry
+	if (pte == NULL || (*pte & PTE_P))                                       // If out of memory or already mapped
+		return false;
+	*pte = vtop (kpage) | PTE_P | PTE_U | PTE_NOFREE;                        // Map it read-only and not owned
+	return true;
+}
+
+/* Maps kernel virtual page VA, which lies outside the mapping of physical memory, to the frame at kernel
+ * virtual address KPAGE in base_pml4, and so in every page table, as a global page.  The page table that
+ * covers VA must exist already, so that no page table has to be allocated here, and VA must be unmapped.
+ */
+void
+pml4_set_kernel_page (void *va, void *kpage) {
+	uint64_t *pte = pml4e_walk (base_pml4, (uint64_t) va, 0);                // Existing page table entry
+
+	ASSERT (pg_ofs (va) == 0 && pg_ofs (kpage) == 0);
+	ASSERT (pte != NULL && !(*pte & PTE_P));
+	*pte = vtop (kpage) | PTE_P | PTE_W | PTE_G;                             // Nothing cached yet, nothing to flush
+}
+
+/* Unmaps the CNT kernel virtual pages from VA that pml4_set_kernel_page() mapped, storing the frames they
+ * mapped in KPAGES, and drops them from the TLB of every CPU.  Being global, an entry is dropped by INVLPG
+ * whatever PCID it was cached under.  May be called with interrupts off. */
+void
+pml4_clear_kernel_pages (void *va, size_t cnt, void **kpages) {
+	struct tlb_batch b;
+	enum intr_level old_level;
+
+	ASSERT (cnt <= TLB_BATCH_MAX);
+
+	b.cnt = 0;
+	b.cpus = 0;
+	old_level = intr_disable ();                                             // Excludes the other CPUs
+	for (size_t i = 0; i < cnt; i++) {
+		void *page = (uint8_t *) va + i * PGSIZE;
+		uint64_t *pte = pml4e_walk (base_pml4, (uint64_t) page, 0);
+
+		ASSERT (pte != NULL && (*pte & PTE_P));
+		kpages[i] = ptov (PTE_ADDR (*pte));
+		*pte = 0;
+		invlpg ((uint64_t) page);
+		b.pml4[b.cnt] = NULL;
+		b.va[b.cnt++] = page;
+	}
+	if (cpu_cnt > 1) {
+		for (int i = 0; i < CPU_MAX; i++)
+			if (cpus[i].online && &cpus[i] != cpu_current ())
+				b.cpus |= 1u << i;
+		shootdown_flush (&b);
+	}
+	intr_set_level (old_level);
+}
+
 /* Marks user virtual page UPAGE "not present" in page directory PD.
  * Later accesses to the page will fault. Other bits in the page table entry are preserved.
  */
@@ -272,8 +819,7 @@ pml4_clear_page (uint64_t *pml4, void *upage) {
 
 	if (pte != NULL && (*pte & PTE_P) != 0) {                                // If the entry is present
 		*pte &= ~PTE_P;                                                      // Clear the present bit
-		if (rcr3 () == vtop (pml4))                                          // If the current page directory is active
-			invlpg ((uint64_t) upage);                                       // Invalidate the page in TLB
+		pml4_invalidate (pml4, upage);                                       // Invalidate the page in TLB
 	}
 }
 
@@ -297,8 +843,7 @@ pml4_set_dirty (uint64_t *pml4, const void *vpage, bool dirty) {
 		else
 			*pte &= ~(uint32_t) PTE_D;                                       // Clear the dirty bit if dirty is false
 
-		if (rcr3 () == vtop (pml4))                                          // If the current page directory is active
-			invlpg ((uint64_t) vpage);                                       // Invalidate the page in TLB
+		pml4_invalidate (pml4, vpage);                                       // A cached entry would not set it again
 	}
 }
 
@@ -322,7 +867,9 @@ pml4_set_accessed (uint64_t *pml4, const void *vpage, bool accessed) {
 		else
 			*pte &= ~(uint32_t) PTE_A;                                       // Clear the accessed bit if accessed is false
 
-		if (rcr3 () == vtop (pml4))                                          // If the current page directory is active
+		/* A stale entry in an inactive PML4 only delays the accessed bit being set again, which costs
+		 * the page-replacement scan some precision but is not worth the PML4's PCID. */
+		if (pml4_is_active (pml4))                                           // If the current page directory is active
 			invlpg ((uint64_t) vpage);                                       // Invalidate the page in TLB
 	}
 }
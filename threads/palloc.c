@@ -2,12 +2,14 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -24,13 +26,77 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Within a pool, pages are managed by a binary buddy allocator.
+   Free memory is kept as blocks of 2**ORDER pages, for ORDER
+   from 0 to PALLOC_MAX_ORDER, each aligned (relative to the pool
+   base) on its own size and kept on the free list for its order.
+   An allocation takes the smallest block that fits, splitting it
+   in halves as needed, and returns any pages beyond the request
+   to the free lists.  Freeing a block merges it with its
+   "buddy", the other half of the block it was split from,
+   whenever the buddy is also free.  Both take O(log n) time.
+
+   The free list links live in the free pages themselves, and a
+   byte per page records which pages head a free block and of
+   what order.  In debug builds, the bitmap of used pages is
+   still maintained as a cross-check.
+
+   Single pages do not usually reach the buddy allocator at all.
+   Each CPU has a "magazine" of free pages for each pool,
+   accessed with interrupts off instead of under the pool lock.
+   An empty magazine is refilled, and a full one drained, in
+   batches of PAGE_MAG_BATCH pages, so the pool lock is taken
+   once per batch rather than once per page.  Pintos runs on a
+   single CPU, so for now there is one magazine per pool.
+
+   The idle thread also moves free user pages into a stash of
+   pre-zeroed pages, which palloc_get_page(PAL_USER | PAL_ZERO)
+   takes from before anything else, so that page faults and stack
+   setup do not have to clear a page themselves. */
+
+/* Largest block order: 2**10 pages, or 4 MB. */
+#define PALLOC_MAX_ORDER 10
+
+/* Capacity of a page magazine and size of its refills and
+   drains. */
+#define PAGE_MAG_SIZE 64
+#define PAGE_MAG_BATCH 32
+
+/* Maximum number of pre-zeroed pages kept per pool. */
+#define PAGE_ZEROED_MAX 128
+
+/* Number of CPUs with their own magazines. */
+#define PALLOC_CPU_CNT 1
+
+/* Per-CPU cache of free pages taken from a pool. */
+struct page_magazine {
+	size_t cnt;                     /* Number of cached pages. */
+	void *pages[PAGE_MAG_SIZE];     /* Cached pages, top at cnt - 1. */
+};
 
 /* A memory pool. */
 struct pool {
-	struct lock lock;               /* Mutual exclusion. */
+	struct adaptive_lock lock;      /* Mutual exclusion. */
 	struct bitmap *used_map;        /* Bitmap of free pages. */
 	uint8_t *base;                  /* Base of pool. */
+	size_t page_cnt;                /* Number of pages in the pool. */
+	size_t usable_cnt;              /* Number of them backed by RAM. */
+	uint8_t *order_map;             /* Per page: 0, or 1 + order of the
+	                                   free block that it heads. */
+	struct list free_lists[PALLOC_MAX_ORDER + 1];
+	                                /* Free blocks of each order. */
+	struct page_magazine mags[PALLOC_CPU_CNT];
+	                                /* Per-CPU free page caches. */
+	size_t zeroed_cnt;              /* Number of pre-zeroed pages. */
+	void *zeroed[PAGE_ZEROED_MAX];  /* Pre-zeroed pages. */
+
+	/* Statistics. */
+	unsigned long long lock_cnt;    /* Pool lock acquisitions. */
+	unsigned long long mag_hits;    /* Pages served from a magazine. */
+	unsigned long long zero_hits;   /* PAL_ZERO pages already zeroed. */
+	unsigned long long zero_misses; /* PAL_ZERO pages zeroed on demand. */
 };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -42,6 +108,7 @@ static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end);
 
 static bool page_from_pool (const struct pool *, void *page);
+static void free_range (struct pool *, size_t page_idx, size_t page_cnt);
 
 /* multiboot info */
 struct multiboot_info {
@@ -219,16 +286,20 @@ split:
 			else
 				NOT_REACHED ();
 
-			pool_end = pool->base + bitmap_size (pool->used_map) * PGSIZE;
+			pool_end = pool->base + pool->page_cnt * PGSIZE;
 			page_idx = pg_no (start) - pg_no (pool->base);
 			if ((uint64_t) pool_end < end) {
 				page_cnt = ((uint64_t) pool_end - start) / PGSIZE;
 				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+				free_range (pool, page_idx, page_cnt);
+				pool->usable_cnt += page_cnt;
 				start = (uint64_t) pool_end;
 				goto split;
 			} else {
 				page_cnt = ((uint64_t) end - start) / PGSIZE;
 				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+				free_range (pool, page_idx, page_cnt);
+				pool->usable_cnt += page_cnt;
 			}
 		}
 	}
@@ -253,6 +324,299 @@ palloc_init (void) {
 	return ext_mem.end;
 }
 
+/* Returns the number of pages in a block of the given ORDER. */
+static inline size_t
+order_pages (int order) {
+	return (size_t) 1 << order;
+}
+
+/* Returns the free list node stored in the first page of the
+   block at PAGE_IDX in POOL. */
+static inline struct list_elem *
+block_elem (struct pool *pool, size_t page_idx) {
+	return (struct list_elem *) (pool->base + PGSIZE * page_idx);
+}
+
+/* Returns the page index of the block whose free list node is E. */
+static inline size_t
+elem_block (struct pool *pool, struct list_elem *e) {
+	return ((uint8_t *) e - pool->base) / PGSIZE;
+}
+
+/* Adds the block of the given ORDER at PAGE_IDX to POOL's free
+   lists, first merging it with its buddy for as long as the buddy
+   is free too.  POOL's lock must be held, or we must still be
+   initializing. */
+static void
+free_block (struct pool *pool, size_t page_idx, int order) {
+	while (order < PALLOC_MAX_ORDER) {
+		size_t buddy = page_idx ^ order_pages (order);
+
+		if (buddy + order_pages (order) > pool->page_cnt
+				|| pool->order_map[buddy] != order + 1)
+			break;
+		list_remove (block_elem (pool, buddy));
+		pool->order_map[buddy] = 0;
+		if (buddy < page_idx)
+			page_idx = buddy;
+		order++;
+	}
+	pool->order_map[page_idx] = order + 1;
+	list_push_front (&pool->free_lists[order], block_elem (pool, page_idx));
+}
+
+/* Frees the PAGE_CNT pages at PAGE_IDX in POOL, which need not
+   form a single block, by splitting them into the largest
+   aligned blocks that they contain. */
+static void
+free_range (struct pool *pool, size_t page_idx, size_t page_cnt) {
+	while (page_cnt > 0) {
+		int order = PALLOC_MAX_ORDER;
+
+		while (order > 0 && ((page_idx & (order_pages (order) - 1)) != 0
+					|| order_pages (order) > page_cnt))
+			order--;
+		free_block (pool, page_idx, order);
+		page_idx += order_pages (order);
+		page_cnt -= order_pages (order);
+	}
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL, whose lock must
+   be held, and returns the index of the first, or SIZE_MAX if
+   no free block is large enough. */
+static size_t
+alloc_block (struct pool *pool, size_t page_cnt) {
+	int want = 0, order;
+	size_t page_idx;
+
+	while (order_pages (want) < page_cnt)
+		want++;
+	for (order = want; order <= PALLOC_MAX_ORDER; order++)
+		if (!list_empty (&pool->free_lists[order]))
+			break;
+	if (order > PALLOC_MAX_ORDER)
+		return SIZE_MAX;
+
+	page_idx = elem_block (pool, list_pop_front (&pool->free_lists[order]));
+	pool->order_map[page_idx] = 0;
+
+	/* Split down to the wanted order, freeing the upper halves. */
+	while (order > want) {
+		order--;
+		pool->order_map[page_idx + order_pages (order)] = order + 1;
+		list_push_front (&pool->free_lists[order],
+				block_elem (pool, page_idx + order_pages (order)));
+	}
+
+	/* Give back the pages past PAGE_CNT. */
+	free_range (pool, page_idx + page_cnt, order_pages (want) - page_cnt);
+	return page_idx;
+}
+
+/* Allocates PAGE_CNT pages from POOL under its lock.  Returns
+   the index of the first page, or SIZE_MAX on failure. */
+static size_t
+pool_alloc (struct pool *pool, size_t page_cnt) {
+	size_t page_idx;
+
+	adaptive_lock_acquire (&pool->lock);
+	pool->lock_cnt++;
+	page_idx = alloc_block (pool, page_cnt);
+#ifndef NDEBUG
+	if (page_idx != SIZE_MAX) {
+		ASSERT (bitmap_none (pool->used_map, page_idx, page_cnt));
+		bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+	}
+#endif
+	adaptive_lock_release (&pool->lock);
+	return page_idx;
+}
+
+/* Returns the CNT single pages in PAGES to POOL under its lock. */
+static void
+pool_free_pages (struct pool *pool, void **pages, size_t cnt) {
+	size_t i;
+
+	adaptive_lock_acquire (&pool->lock);
+	pool->lock_cnt++;
+	for (i = 0; i < cnt; i++) {
+		size_t page_idx = pg_no (pages[i]) - pg_no (pool->base);
+#ifndef NDEBUG
+		ASSERT (bitmap_test (pool->used_map, page_idx));
+		bitmap_reset (pool->used_map, page_idx);
+#endif
+		free_range (pool, page_idx, 1);
+	}
+	adaptive_lock_release (&pool->lock);
+}
+
+/* Returns this CPU's magazine for POOL. */
+static struct page_magazine *
+pool_magazine (struct pool *pool) {
+	return &pool->mags[0];
+}
+
+/* Takes a page from this CPU's magazine for POOL, refilling the
+   magazine from POOL if it is empty.  Returns a null pointer if
+   POOL has no free pages. */
+static void *
+mag_get (struct pool *pool) {
+	struct page_magazine *mag;
+	void *batch[PAGE_MAG_BATCH];
+	enum intr_level old_level;
+	size_t cnt;
+	void *page;
+
+	old_level = intr_disable ();
+	mag = pool_magazine (pool);
+	if (mag->cnt > 0) {
+		page = mag->pages[--mag->cnt];
+		pool->mag_hits++;
+		intr_set_level (old_level);
+		return page;
+	}
+	intr_set_level (old_level);
+
+	/* Refill with a batch of single pages.  The pool lock may
+	   sleep, so it is taken with interrupts at their old level. */
+	adaptive_lock_acquire (&pool->lock);
+	pool->lock_cnt++;
+	for (cnt = 0; cnt < PAGE_MAG_BATCH; cnt++) {
+		size_t page_idx = alloc_block (pool, 1);
+		if (page_idx == SIZE_MAX)
+			break;
+#ifndef NDEBUG
+		ASSERT (!bitmap_test (pool->used_map, page_idx));
+		bitmap_mark (pool->used_map, page_idx);
+#endif
+		batch[cnt] = pool->base + PGSIZE * page_idx;
+	}
+	adaptive_lock_release (&pool->lock);
+	if (cnt == 0)
+		return NULL;
+
+	/* Keep one page for the caller and stash the rest.  Another
+	   thread may have refilled the magazine meanwhile, so return
+	   whatever no longer fits. */
+	page = batch[--cnt];
+	old_level = intr_disable ();
+	mag = pool_magazine (pool);
+	for (; cnt > 0 && mag->cnt < PAGE_MAG_SIZE; cnt--)
+		mag->pages[mag->cnt++] = batch[cnt - 1];
+	intr_set_level (old_level);
+	if (cnt > 0)
+		pool_free_pages (pool, batch, cnt);
+	return page;
+}
+
+/* Puts PAGE into this CPU's magazine for POOL, first draining
+   a batch back to POOL if the magazine is full. */
+static void
+mag_put (struct pool *pool, void *page) {
+	struct page_magazine *mag;
+	void *batch[PAGE_MAG_BATCH];
+	enum intr_level old_level;
+	size_t cnt = 0;
+
+	old_level = intr_disable ();
+	mag = pool_magazine (pool);
+	if (mag->cnt >= PAGE_MAG_SIZE) {
+		/* Drain the oldest pages, at the bottom. */
+		for (cnt = 0; cnt < PAGE_MAG_BATCH; cnt++)
+			batch[cnt] = mag->pages[cnt];
+		memmove (mag->pages, mag->pages + PAGE_MAG_BATCH,
+				sizeof *mag->pages * (mag->cnt - PAGE_MAG_BATCH));
+		mag->cnt -= PAGE_MAG_BATCH;
+	}
+	mag->pages[mag->cnt++] = page;
+	intr_set_level (old_level);
+
+	if (cnt > 0)
+		pool_free_pages (pool, batch, cnt);
+}
+
+/* Takes a page from POOL's pre-zeroed stash, or returns a null
+   pointer if it is empty. */
+static void *
+zeroed_get (struct pool *pool) {
+	enum intr_level old_level = intr_disable ();
+	void *page = pool->zeroed_cnt > 0 ? pool->zeroed[--pool->zeroed_cnt] : NULL;
+	intr_set_level (old_level);
+	return page;
+}
+
+/* Zeroes one free user page and adds it to the pre-zeroed stash.
+   Called repeatedly by the idle thread, with interrupts on, until
+   it returns false because the stash is full or no page could be
+   had without sleeping. */
+bool
+palloc_zero_idle (void) {
+	struct pool *pool = &user_pool;
+	struct page_magazine *mag;
+	enum intr_level old_level;
+	void *page = NULL;
+
+	if (pool->zeroed_cnt >= PAGE_ZEROED_MAX)
+		return false;
+
+	/* The idle thread must never block, so take a page from the
+	   magazine, or from the buddy lists only if the lock is free. */
+	old_level = intr_disable ();
+	mag = pool_magazine (pool);
+	if (mag->cnt > 0)
+		page = mag->pages[--mag->cnt];
+	intr_set_level (old_level);
+	if (page == NULL && adaptive_lock_try_acquire (&pool->lock)) {
+		size_t page_idx = alloc_block (pool, 1);
+		if (page_idx != SIZE_MAX) {
+#ifndef NDEBUG
+			ASSERT (!bitmap_test (pool->used_map, page_idx));
+			bitmap_mark (pool->used_map, page_idx);
+#endif
+			page = pool->base + PGSIZE * page_idx;
+		}
+		adaptive_lock_release (&pool->lock);
+	}
+	if (page == NULL)
+		return false;
+
+	memset (page, 0, PGSIZE);
+
+	/* Only the idle thread adds to the stash, so there is room. */
+	old_level = intr_disable ();
+	ASSERT (pool->zeroed_cnt < PAGE_ZEROED_MAX);
+	pool->zeroed[pool->zeroed_cnt++] = page;
+	intr_set_level (old_level);
+	return true;
+}
+
+/* Returns every page in POOL's magazines and pre-zeroed stash to
+   POOL, so that they can coalesce into larger blocks. */
+static void
+mag_flush (struct pool *pool) {
+	void *batch[PAGE_MAG_BATCH];
+	enum intr_level old_level;
+
+	for (;;) {
+		struct page_magazine *mag;
+		size_t cnt = 0;
+		int cpu;
+
+		old_level = intr_disable ();
+		for (cpu = 0; cpu < PALLOC_CPU_CNT; cpu++)
+			for (mag = &pool->mags[cpu]; mag->cnt > 0 && cnt < PAGE_MAG_BATCH; )
+				batch[cnt++] = mag->pages[--mag->cnt];
+		while (pool->zeroed_cnt > 0 && cnt < PAGE_MAG_BATCH)
+			batch[cnt++] = pool->zeroed[--pool->zeroed_cnt];
+		intr_set_level (old_level);
+
+		if (cnt == 0)
+			break;
+		pool_free_pages (pool, batch, cnt);
+	}
+}
+
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
    If PAL_USER is set, the pages are obtained from the user pool,
    otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
@@ -262,16 +626,34 @@ palloc_init (void) {
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
-
-	lock_acquire (&pool->lock);
-	size_t page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-	lock_release (&pool->lock);
-	void *pages;
-
-	if (page_idx != BITMAP_ERROR)
-		pages = pool->base + PGSIZE * page_idx;
-	else
-		pages = NULL;
+	void *pages = NULL;
+
+	if (page_cnt == 1) {
+		if (flags & PAL_ZERO) {
+			pages = zeroed_get (pool);
+			if (pages != NULL) {
+				pool->zero_hits++;
+				return pages;
+			}
+			pool->zero_misses++;
+		}
+		pages = mag_get (pool);
+
+		/* When nothing else is left, pre-zeroed pages will do. */
+		if (pages == NULL)
+			pages = zeroed_get (pool);
+	} else if (page_cnt > 0 && page_cnt <= order_pages (PALLOC_MAX_ORDER)) {
+		size_t page_idx = pool_alloc (pool, page_cnt);
+
+		/* Pages parked in magazines may be what keeps a large
+		   enough block from forming. */
+		if (page_idx == SIZE_MAX) {
+			mag_flush (pool);
+			page_idx = pool_alloc (pool, page_cnt);
+		}
+		if (page_idx != SIZE_MAX)
+			pages = pool->base + PGSIZE * page_idx;
+	}
 
 	if (pages) {
 		if (flags & PAL_ZERO)
@@ -318,8 +700,19 @@ palloc_free_multiple (void *pages, size_t page_cnt) {
 #ifndef NDEBUG
 	memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
+	if (page_cnt == 1) {
+		mag_put (pool, pages);
+		return;
+	}
+
+	adaptive_lock_acquire (&pool->lock);
+	pool->lock_cnt++;
+#ifndef NDEBUG
 	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
 	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+#endif
+	free_range (pool, page_idx, page_cnt);
+	adaptive_lock_release (&pool->lock);
 }
 
 /* Frees the page at PAGE. */
@@ -328,6 +721,65 @@ palloc_free_page (void *page) {
 	palloc_free_multiple (page, 1);
 }
 
+/* Frees the CNT single pages in PAGES, which may come from
+   either pool.  Interrupts are turned off once per batch to put
+   as many pages as fit into this CPU's magazines, and the rest
+   return to their pool under a single acquisition of its lock,
+   instead of a round trip through palloc_free_page() for each. */
+void
+palloc_free_pages (void **pages, size_t cnt) {
+	while (cnt > 0) {
+		void *spill[2][PAGE_MAG_BATCH];
+		size_t spill_cnt[2] = { 0, 0 };
+		size_t n = cnt < PAGE_MAG_BATCH ? cnt : PAGE_MAG_BATCH;
+		enum intr_level old_level;
+		size_t i;
+
+#ifndef NDEBUG
+		for (i = 0; i < n; i++)
+			memset (pages[i], 0xcc, PGSIZE);
+#endif
+		old_level = intr_disable ();
+		for (i = 0; i < n; i++) {
+			bool user = !page_from_pool (&kernel_pool, pages[i]);
+			struct page_magazine *mag =
+				pool_magazine (user ? &user_pool : &kernel_pool);
+
+			ASSERT (pg_ofs (pages[i]) == 0);
+			ASSERT (!user || page_from_pool (&user_pool, pages[i]));
+			if (mag->cnt < PAGE_MAG_SIZE)
+				mag->pages[mag->cnt++] = pages[i];
+			else
+				spill[user][spill_cnt[user]++] = pages[i];
+		}
+		intr_set_level (old_level);
+
+		if (spill_cnt[0] > 0)
+			pool_free_pages (&kernel_pool, spill[0], spill_cnt[0]);
+		if (spill_cnt[1] > 0)
+			pool_free_pages (&user_pool, spill[1], spill_cnt[1]);
+		pages += n;
+		cnt -= n;
+	}
+}
+
+/* Returns the number of pages the user pool can hand out. */
+size_t
+palloc_user_page_cnt (void) {
+	return user_pool.usable_cnt;
+}
+
+/* Prints page allocator statistics. */
+void
+palloc_print_stats (void) {
+	printf ("Palloc: kernel pool %llu lock acquisitions, %llu magazine hits\n",
+			kernel_pool.lock_cnt, kernel_pool.mag_hits);
+	printf ("Palloc: user pool %llu lock acquisitions, %llu magazine hits\n",
+			user_pool.lock_cnt, user_pool.mag_hits);
+	printf ("Palloc: user pool %llu pre-zeroed hits, %llu misses\n",
+			user_pool.zero_hits, user_pool.zero_misses);
+}
+
 /* Initializes pool P as starting at START and ending at END */
 static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
@@ -336,15 +788,29 @@ init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
      and subtract it from the pool's size. */
 	uint64_t pgcnt = (end - start) / PGSIZE;
 	size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (pgcnt), PGSIZE) * PGSIZE;
+	size_t om_pages = DIV_ROUND_UP (pgcnt, PGSIZE) * PGSIZE;
+	int order;
 
-	lock_init(&p->lock);
+	adaptive_lock_init (&p->lock);
 	p->used_map = bitmap_create_in_buf (pgcnt, *bm_base, bm_pages);
 	p->base = (void *) start;
+	p->page_cnt = pgcnt;
+	p->usable_cnt = 0;
 
 	// Mark all to unusable.
 	bitmap_set_all(p->used_map, true);
 
-	*bm_base += bm_pages;
+	// No free blocks until populate_pools() releases usable pages.
+	p->order_map = (uint8_t *) *bm_base + bm_pages;
+	memset (p->order_map, 0, pgcnt);
+	for (order = 0; order <= PALLOC_MAX_ORDER; order++)
+		list_init (&p->free_lists[order]);
+	memset (p->mags, 0, sizeof p->mags);
+	p->zeroed_cnt = 0;
+	p->lock_cnt = p->mag_hits = 0;
+	p->zero_hits = p->zero_misses = 0;
+
+	*bm_base += bm_pages + om_pages;
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -353,6 +819,6 @@ static bool
 page_from_pool (const struct pool *pool, void *page) {
 	size_t page_no = pg_no (page);
 	size_t start_page = pg_no (pool->base);
-	size_t end_page = start_page + bitmap_size (pool->used_map);
+	size_t end_page = start_page + pool->page_cnt;
 	return page_no >= start_page && page_no < end_page;
 }
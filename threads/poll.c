@@ -0,0 +1,106 @@
+#include "threads/poll.h"
+#include <debug.h>
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Poll wait queues.
+
+   A poll() call arms its table, then checks each object, adding a
+   waiter to its queue on the first pass, then sleeps unless
+   something is ready.  An object that changes wakes its queue after
+   making the change visible.  A wakeup that comes between the
+   checks and the sleep sets the table's WOKEN flag, which
+   poll_sleep() tests with interrupts off before it blocks, so it is
+   not lost.
+
+   The queues and tables are touched only with interrupts off, which
+   on more than one CPU also takes the global interrupt lock. */
+
+/* Initializes Q as a queue with no waiters. */
+void
+poll_queue_init (struct poll_queue *q) {
+	list_init (&q->waiters);
+}
+
+/* Wakes every thread with a waiter on Q.  The check for an empty
+   queue comes first, so an object no one polls pays little. */
+void
+poll_queue_wake (struct poll_queue *q) {
+	enum intr_level old_level;
+	struct list_elem *e;
+
+	barrier ();
+	if (list_empty (&q->waiters))
+		return;
+	old_level = intr_disable ();
+	for (e = list_begin (&q->waiters); e != list_end (&q->waiters);
+			e = list_next (e)) {
+		struct poll_table *pt = list_entry (e, struct poll_waiter, elem)->table;
+
+		pt->woken = true;
+		if (pt->sleeping) {
+			pt->sleeping = false;
+			thread_wake (pt->thread);
+		}
+	}
+	intr_set_level (old_level);
+}
+
+/* Initializes PT for the running thread. */
+void
+poll_table_init (struct poll_table *pt) {
+	pt->thread = thread_current ();
+	pt->woken = false;
+	pt->sleeping = false;
+}
+
+/* Adds W, which belongs to PT, to Q. */
+void
+poll_add (struct poll_table *pt, struct poll_queue *q,
+		struct poll_waiter *w) {
+	enum intr_level old_level = intr_disable ();
+
+	w->table = pt;
+	w->queue = q;
+	list_push_back (&q->waiters, &w->elem);
+	intr_set_level (old_level);
+}
+
+/* Takes W off the queue it is on, if any. */
+void
+poll_remove (struct poll_waiter *w) {
+	enum intr_level old_level;
+
+	if (w->queue == NULL)
+		return;
+	old_level = intr_disable ();
+	list_remove (&w->elem);
+	w->queue = NULL;
+	intr_set_level (old_level);
+}
+
+/* Forgets earlier wakeups of PT, before its objects are checked. */
+void
+poll_arm (struct poll_table *pt) {
+	enum intr_level old_level = intr_disable ();
+
+	pt->woken = false;
+	intr_set_level (old_level);
+}
+
+/* Sleeps until one of PT's queues is woken or timer_clock() reaches
+   DEADLINE, INT64_MAX for never.  Returns at once if a queue was
+   woken since poll_arm(). */
+void
+poll_sleep (struct poll_table *pt, int64_t deadline) {
+	enum intr_level old_level = intr_disable ();
+
+	ASSERT (pt->thread == thread_current ());
+	if (!pt->woken) {
+		pt->sleeping = true;
+		thread_block_until (deadline);
+		pt->sleeping = false;
+	}
+	intr_set_level (old_level);
+}
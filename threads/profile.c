@@ -0,0 +1,129 @@
+#include "threads/profile.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "threads/cpu.h"
+#include "threads/interrupt.h"
+#include "threads/loader.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Sampling profiler.
+
+   With the kernel command-line option "-profile", every timer
+   interrupt that lands in the kernel records the interrupted
+   instruction, and with "-profile=N" also up to N of its callers,
+   found by walking the frame pointers.  Samples go into a ring
+   buffer that keeps the latest PROFILE_SAMPLES of them.  At power
+   off, identical call stacks are merged and printed one per line,
+   as "Profile stack: COUNT PC CALLER...", for `backtrace --profile'
+   to turn into flat and hierarchical profiles. */
+
+/* Pages of samples. */
+#define PROFILE_PAGES 64
+
+/* One sample: the interrupted PC, then its callers, innermost
+   first, ending early at a null entry. */
+struct sample {
+	uintptr_t pcs[PROFILE_DEPTH_MAX + 1];
+};
+
+#define PROFILE_SAMPLES (PROFILE_PAGES * PGSIZE / sizeof (struct sample))
+
+bool profile_enabled;           /* Set by "-profile". */
+int profile_depth;              /* Callers per sample, set by "-profile=N". */
+
+static struct sample *samples;  /* Ring buffer, or null if off. */
+static uint64_t sample_cnt;     /* Kernel samples taken. */
+static uint64_t user_cnt;       /* Ticks that landed in user mode. */
+
+/* Allocates the sample buffer, if profiling was asked for. */
+void
+profile_init (void) {
+	if (!profile_enabled)
+		return;
+	if (profile_depth < 0)
+		profile_depth = 0;
+	else if (profile_depth > PROFILE_DEPTH_MAX)
+		profile_depth = PROFILE_DEPTH_MAX;
+	samples = palloc_get_multiple (PAL_ZERO, PROFILE_PAGES);
+	if (samples == NULL)
+		printf ("profile: no memory for samples, profiling disabled\n");
+}
+
+/* Records the code interrupted by the timer interrupt frame F.
+   Runs in an external interrupt context. */
+void
+profile_sample (const struct intr_frame *f) {
+	struct sample *s;
+	uintptr_t stack, top, *frame;
+	int i;
+
+	if (samples == NULL)
+		return;
+	if (f->cs == SEL_UCSEG) {
+		user_cnt++;
+		return;
+	}
+
+	s = &samples[sample_cnt++ % PROFILE_SAMPLES];
+	memset (s, 0, sizeof *s);
+	s->pcs[0] = f->rip;
+
+	/* Follow the saved frame pointers up the interrupted stack, as long
+	   as they stay between its pointer and its top and keep climbing. */
+	stack = f->rsp;
+	top = cpu_current ()->curr->stack_top;
+	frame = (uintptr_t *) f->R.rbp;
+	for (i = 1; i <= profile_depth; i++) {
+		uintptr_t fp = (uintptr_t) frame;
+
+		if (fp < stack || fp + 2 * sizeof *frame > top
+				|| fp % sizeof *frame != 0 || frame[1] == 0)
+			break;
+		s->pcs[i] = frame[1];
+		if (frame[0] <= fp)
+			break;
+		frame = (uintptr_t *) frame[0];
+	}
+}
+
+/* Orders samples by call stack. */
+static int
+compare_samples (const void *a, const void *b) {
+	return memcmp (a, b, sizeof (struct sample));
+}
+
+/* Prints the samples, one line per distinct call stack.  Stops
+   sampling first. */
+void
+profile_print (void) {
+	enum intr_level old_level = intr_disable ();
+	struct sample *s = samples;
+	size_t cnt, i, j;
+	int k;
+
+	samples = NULL;
+	intr_set_level (old_level);
+	if (s == NULL)
+		return;
+
+	cnt = sample_cnt < PROFILE_SAMPLES ? sample_cnt : PROFILE_SAMPLES;
+	printf ("Profile: %"PRIu64" kernel samples, %"PRIu64" user, "
+			"%"PRIu64" overwritten\n", sample_cnt, user_cnt,
+			sample_cnt - cnt);
+	qsort (s, cnt, sizeof *s, compare_samples);
+	for (i = 0; i < cnt; i = j) {
+		for (j = i + 1; j < cnt && !compare_samples (&s[i], &s[j]); j++)
+			continue;
+		printf ("Profile stack: %zu", j - i);
+		for (k = 0; k <= PROFILE_DEPTH_MAX && s[i].pcs[k] != 0; k++)
+			printf (" %p", (void *) s[i].pcs[k]);
+		printf ("\n");
+	}
+	palloc_free_multiple (s, PROFILE_PAGES);
+}
@@ -0,0 +1,204 @@
+#include "threads/rcu.h"
+#include <debug.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "threads/cpu.h"
+#include "threads/defer.h"
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Grace periods.
+
+   At most one grace period is in progress.  Callbacks queued while
+   one is wait for the next, which starts as soon as the current
+   one ends.  All of this state is protected by turning interrupts
+   off, which also excludes the other CPUs (see interrupt.c), and
+   quiescent states are noted with interrupts off too. */
+
+/* A batch of callbacks, in queuing order. */
+struct rcu_batch {
+	struct rcu_head *head;      /* First callback, or null. */
+	struct rcu_head **tail;     /* Null pointer that ends the batch. */
+};
+
+static bool gp_active;          /* Grace period in progress? */
+static unsigned gp_pending;     /* CPUs yet to pass a quiescent state. */
+static struct rcu_batch next_batch;    /* Waiting for the next period. */
+static struct rcu_batch wait_batch;    /* Waiting for the current one. */
+static struct rcu_batch done_batch;    /* Ready to run. */
+
+/* Runs DONE_BATCH with interrupts on. */
+static struct defer done_work;
+
+/* Statistics. */
+static long long gp_cnt;        /* # of grace periods completed. */
+static long long cb_cnt;        /* # of callbacks run. */
+
+static defer_func run_done;
+
+static void
+batch_init (struct rcu_batch *b) {
+	b->head = NULL;
+	b->tail = &b->head;
+}
+
+/* Moves the callbacks in FROM to the end of TO. */
+static void
+batch_splice (struct rcu_batch *to, struct rcu_batch *from) {
+	if (from->head != NULL) {
+		*to->tail = from->head;
+		to->tail = from->tail;
+		batch_init (from);
+	}
+}
+
+/* Initializes RCU. */
+void
+rcu_init (void) {
+	batch_init (&next_batch);
+	batch_init (&wait_batch);
+	batch_init (&done_batch);
+	defer_init (&done_work, run_done, NULL);
+}
+
+/* Starts a grace period for the callbacks in NEXT_BATCH, which
+   ends once every CPU online now has passed a quiescent state. */
+static void
+gp_start (void) {
+	int i;
+
+	ASSERT (!gp_active);
+	batch_splice (&wait_batch, &next_batch);
+	gp_pending = 0;
+	for (i = 0; i < CPU_MAX; i++)
+		if (cpus[i].online)
+			gp_pending |= 1u << i;
+	gp_active = true;
+}
+
+/* Ends the current grace period, hands its callbacks to the
+   deferred work thread, and starts the next one, if needed. */
+static void
+gp_end (void) {
+	gp_active = false;
+	gp_cnt++;
+	batch_splice (&done_batch, &wait_batch);
+	defer_schedule (&done_work);
+	if (next_batch.head != NULL)
+		gp_start ();
+}
+
+/* Notes that the running CPU is in a quiescent state: it runs no
+   reader, so it is done with any data that a grace period in
+   progress protects.  Called by the scheduler on every context
+   switch and on timer ticks outside readers, with interrupts off. */
+void
+rcu_note_qs (void) {
+	unsigned self = 1u << cpu_current ()->id;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	if (gp_active && (gp_pending & self)) {
+		gp_pending &= ~self;
+		if (gp_pending == 0)
+			gp_end ();
+	}
+}
+
+/* Begins a read-side critical section, which may nest.  Until the
+   matching rcu_read_unlock(), the running thread must not sleep,
+   and is not preempted. */
+void
+rcu_read_lock (void) {
+	ASSERT (!intr_context ());
+	thread_current ()->rcu_nesting++;
+	barrier ();
+}
+
+/* Ends a read-side critical section, yielding if the thread was
+   due to be preempted in it. */
+void
+rcu_read_unlock (void) {
+	struct thread *t = thread_current ();
+
+	ASSERT (t->rcu_nesting > 0);
+	barrier ();
+	if (--t->rcu_nesting == 0 && t->rcu_yield) {
+		t->rcu_yield = false;
+		thread_yield_on_return ();
+	}
+}
+
+/* Arranges for FUNC (HEAD) to run once every reader that is now in
+   a read-side critical section has left it.  May be called with
+   interrupts off, but not from an interrupt handler.  FUNC runs on
+   the deferred work thread, with interrupts on, and may free the
+   object that embeds HEAD. */
+void
+call_rcu (struct rcu_head *head, rcu_func *func) {
+	enum intr_level old_level;
+
+	head->next = NULL;
+	head->func = func;
+
+	old_level = intr_disable ();
+	*next_batch.tail = head;
+	next_batch.tail = &head->next;
+	if (!gp_active)
+		gp_start ();
+	intr_set_level (old_level);
+}
+
+/* Runs the callbacks of the grace periods that have ended. */
+static void
+run_done (void *aux UNUSED) {
+	struct rcu_head *head;
+	enum intr_level old_level;
+
+	old_level = intr_disable ();
+	head = done_batch.head;
+	batch_init (&done_batch);
+	intr_set_level (old_level);
+
+	while (head != NULL) {
+		struct rcu_head *next = head->next;
+
+		head->func (head);
+		cb_cnt++;
+		head = next;
+	}
+}
+
+/* A synchronize_rcu() in progress. */
+struct rcu_sync {
+	struct rcu_head head;
+	struct semaphore done;
+};
+
+static void
+sync_done (struct rcu_head *head) {
+	struct rcu_sync *s = (struct rcu_sync *) head;
+
+	sema_up (&s->done);
+}
+
+/* Waits until every reader that is now in a read-side critical
+   section has left it. */
+void
+synchronize_rcu (void) {
+	struct rcu_sync s;
+
+	ASSERT (!intr_context ());
+	ASSERT (thread_current ()->rcu_nesting == 0);
+
+	sema_init (&s.done, 0);
+	call_rcu (&s.head, sync_done);
+	sema_down (&s.done);
+}
+
+/* Prints RCU statistics. */
+void
+rcu_print_stats (void) {
+	if (gp_cnt != 0)
+		printf ("RCU: %lld grace periods, %lld callbacks\n", gp_cnt, cb_cnt);
+}
@@ -0,0 +1,228 @@
+#include "threads/sched.h"
+#include <debug.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "intrinsic.h"
+
+/* Scheduling classes.
+
+   Every ready thread is on a level of its CPU's run queue, and
+   each class picks the oldest thread on the highest nonempty
+   level.  The classes differ in how they assign levels:
+
+   - "priority", the default, queues a thread at its effective
+     priority, so a thread runs only while no thread of higher
+     priority is ready, and threads of equal priority take turns.
+
+   - "rr" queues every thread on one level, ignoring priorities:
+     plain round robin, in which a woken thread waits its turn
+     instead of preempting the running one.
+
+   - "mlfqs" queues by priority like "priority", but computes the
+     priorities itself from each thread's recent CPU use and nice
+     value.  See mlfqs.c.
+
+   - "fair" ignores priorities and levels alike, and runs the
+     thread that has had the least CPU time, weighted by nice.
+     See fair.c.
+
+   thread.c calls the selected class through the sched_*()
+   functions, which give deadline threads (see deadline.c) first
+   call on every CPU. */
+
+/* Selected with -sched=NAME, or -mlfqs. */
+const struct sched_class *sched = &sched_priority;
+
+static const struct sched_class *const classes[] = {
+	&sched_priority, &sched_rr, &sched_mlfqs, &sched_fair,
+};
+
+/* Selects the class named NAME.  Returns true if successful, false
+   if there is no such class.  Must be called before threads are
+   created. */
+bool
+sched_select (const char *name) {
+	size_t i;
+
+	for (i = 0; i < sizeof classes / sizeof *classes; i++)
+		if (!strcmp (name, classes[i]->name)) {
+			sched = classes[i];
+			thread_mlfqs = sched == &sched_mlfqs;
+			return true;
+		}
+	return false;
+}
+
+/* Initializes RQ as empty, for any class. */
+void
+runqueue_init (struct runqueue *rq) {
+	int level;
+
+	for (level = PRI_MIN; level <= PRI_MAX; level++)
+		list_init (&rq->queues[level]);
+	rq->mask = 0;
+	rq->cnt = 0;
+	fair_runqueue_init (rq);
+	dl_runqueue_init (rq);
+}
+
+/* Adds ready thread T to RQ. */
+void
+sched_enqueue (struct runqueue *rq, struct thread *t) {
+	if (!dl_enqueue (rq, t))
+		sched->enqueue (rq, t);
+}
+
+/* Removes ready thread T, which is on RQ, from it. */
+void
+sched_dequeue (struct runqueue *rq, struct thread *t) {
+	if (!dl_dequeue (rq, t))
+		sched->dequeue (rq, t);
+}
+
+/* Removes and returns the thread to run next from RQ, or returns
+   a null pointer if RQ is empty. */
+struct thread *
+sched_pick_next (struct runqueue *rq) {
+	struct thread *t = dl_pick_next (rq);
+
+	return t != NULL ? t : sched->pick_next (rq);
+}
+
+/* Returns true if a thread on RQ should replace CURR, the thread
+   running on RQ's CPU, right away. */
+bool
+sched_preempts (const struct runqueue *rq, const struct thread *curr) {
+	bool decided;
+	bool preempts = dl_preempts (rq, curr, &decided);
+
+	return decided ? preempts : sched->preempts (rq, curr);
+}
+
+/* Puts the running thread T back on RQ as it yields. */
+void
+sched_yield (struct runqueue *rq, struct thread *t) {
+	if (!dl_enqueue (rq, t))
+		sched->yield (rq, t);
+}
+
+/* Called at each timer interrupt, which advanced the clock by
+   ELAPSED ticks to NOW while T ran.  The selected class sees every
+   tick, deadline thread or not, so that its own accounting, such as
+   the MLFQS load average, stays whole. */
+void
+sched_tick (struct thread *t, int64_t now, int64_t elapsed) {
+	dl_tick (t, elapsed);
+	if (sched->tick != NULL)
+		sched->tick (t, now, elapsed);
+}
+
+/* Appends T to level LEVEL of RQ. */
+void
+runqueue_push (struct runqueue *rq, struct thread *t, int level) {
+	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (PRI_MIN <= level && level <= PRI_MAX);
+
+	list_push_back (&rq->queues[level], &t->elem);
+	rq->mask |= 1ULL << level;
+}
+
+/* Removes T from level LEVEL of RQ, where it must be. */
+void
+runqueue_remove (struct runqueue *rq, struct thread *t, int level) {
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	list_remove (&t->elem);
+	if (list_empty (&rq->queues[level]))
+		rq->mask &= ~(1ULL << level);
+}
+
+/* Removes and returns the oldest thread on the highest nonempty
+   level of RQ, or returns a null pointer if RQ is empty. */
+struct thread *
+runqueue_pop (struct runqueue *rq) {
+	struct thread *t;
+	int level;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (rq->mask == 0)
+		return NULL;
+	level = bsrq (rq->mask);
+	t = list_entry (list_pop_front (&rq->queues[level]), struct thread, elem);
+	if (list_empty (&rq->queues[level]))
+		rq->mask &= ~(1ULL << level);
+	return t;
+}
+
+/* Returns the highest nonempty level of RQ, or -1 if RQ is
+   empty. */
+int
+runqueue_top (const struct runqueue *rq) {
+	return rq->mask != 0 ? (int) bsrq (rq->mask) : -1;
+}
+
+/* Priority scheduling, also used by the MLFQS. */
+
+static void
+prio_enqueue (struct runqueue *rq, struct thread *t) {
+	runqueue_push (rq, t, t->priority);
+}
+
+static void
+prio_dequeue (struct runqueue *rq, struct thread *t) {
+	runqueue_remove (rq, t, t->priority);
+}
+
+static bool
+prio_preempts (const struct runqueue *rq, const struct thread *curr) {
+	return runqueue_top (rq) > curr->priority;
+}
+
+const struct sched_class sched_priority = {
+	.name = "priority",
+	.enqueue = prio_enqueue,
+	.dequeue = prio_dequeue,
+	.pick_next = runqueue_pop,
+	.preempts = prio_preempts,
+	.yield = prio_enqueue,
+};
+
+/* Round robin, on level 0 alone. */
+
+static void
+rr_enqueue (struct runqueue *rq, struct thread *t) {
+	runqueue_push (rq, t, 0);
+}
+
+static void
+rr_dequeue (struct runqueue *rq, struct thread *t) {
+	runqueue_remove (rq, t, 0);
+}
+
+static bool
+rr_preempts (const struct runqueue *rq UNUSED,
+		const struct thread *curr UNUSED) {
+	return false;
+}
+
+const struct sched_class sched_rr = {
+	.name = "rr",
+	.enqueue = rr_enqueue,
+	.dequeue = rr_dequeue,
+	.pick_next = runqueue_pop,
+	.preempts = rr_preempts,
+	.yield = rr_enqueue,
+};
+
+/* The MLFQS's queueing, with mlfqs_tick() from mlfqs.c. */
+
+const struct sched_class sched_mlfqs = {
+	.name = "mlfqs",
+	.enqueue = prio_enqueue,
+	.dequeue = prio_dequeue,
+	.pick_next = runqueue_pop,
+	.preempts = prio_preempts,
+	.yield = prio_enqueue,
+	.tick = mlfqs_tick,
+};
@@ -0,0 +1,246 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A slab allocator, after Bonwick.
+
+   Each cache manages objects of a single size.  It takes whole
+   pages from the page allocator, called "slabs", and divides
+   each one into a header followed by as many object slots as
+   fit.  Free slots within a slab are chained through a link word
+   stored in the slot itself, so allocation and freeing are O(1)
+   and need no per-object bookkeeping elsewhere.
+
+   A cache keeps its slabs on three lists: partial, full and
+   empty.  Allocation takes from a partial slab if there is one,
+   so that memory stays packed into as few slabs as possible.
+   One empty slab is kept around to absorb alloc/free churn; any
+   further slab that becomes empty goes back to the page
+   allocator.
+
+   Unlike malloc(), object sizes are not rounded to a power of 2,
+   so a 72-byte object costs 72 bytes (plus alignment) and not
+   128. */
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Slab header, at the start of each slab page. */
+struct slab {
+	unsigned magic;             /* Always set to SLAB_MAGIC. */
+	struct kmem_cache *cache;   /* Owning cache. */
+	struct list_elem elem;      /* Element in one of the cache's lists. */
+	void *free;                 /* First free slot, or null. */
+	size_t in_use;              /* Number of allocated slots. */
+};
+
+/* Cache of caches, from which kmem_cache_create() allocates. */
+static struct kmem_cache cache_cache;
+
+/* All caches, for statistics. */
+static struct list all_caches;
+
+static void cache_setup (struct kmem_cache *, const char *, size_t, size_t,
+		kmem_ctor_func *);
+static struct slab *slab_create (struct kmem_cache *);
+static struct slab *obj_to_slab (struct kmem_cache *, void *);
+
+/* Returns a pointer to the free-list link in slot OBJ. */
+static inline void **
+link_of (struct kmem_cache *c, void *obj) {
+	return (void **) ((uint8_t *) obj + c->link_ofs);
+}
+
+/* Initializes the slab allocator. */
+void
+slab_init (void) {
+	list_init (&all_caches);
+	cache_setup (&cache_cache, "kmem_cache", sizeof (struct kmem_cache),
+			sizeof (void *), NULL);
+}
+
+/* Creates and returns a cache of SIZE-byte objects, each aligned
+   on an ALIGN-byte boundary (a power of 2, or 0 for pointer
+   alignment).  If CTOR is nonnull, it is run on each object when
+   its slab is created.  Panics if memory is not available,
+   since caches are created at initialization time. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, size_t align,
+		kmem_ctor_func *ctor) {
+	struct kmem_cache *c = kmem_cache_alloc (&cache_cache);
+
+	if (c == NULL)
+		PANIC ("kmem_cache_create: out of memory for %s", name);
+	cache_setup (c, name, size, align, ctor);
+	return c;
+}
+
+/* Initializes cache C.  See kmem_cache_create(). */
+static void
+cache_setup (struct kmem_cache *c, const char *name, size_t size,
+		size_t align, kmem_ctor_func *ctor) {
+	ASSERT (size > 0);
+	if (align < sizeof (void *))
+		align = sizeof (void *);
+	ASSERT ((align & (align - 1)) == 0);
+
+	c->name = name;
+	c->obj_size = size;
+	c->ctor = ctor;
+
+	/* Without a constructor the link can overlay the object.
+	   Otherwise it needs a word of its own past the end, so that
+	   freeing does not disturb the constructed state. */
+	if (ctor == NULL) {
+		c->link_ofs = 0;
+		c->slot_size = ROUND_UP (size < sizeof (void *) ? sizeof (void *) : size,
+				align);
+	} else {
+		c->link_ofs = ROUND_UP (size, sizeof (void *));
+		c->slot_size = ROUND_UP (c->link_ofs + sizeof (void *), align);
+	}
+	c->first_ofs = ROUND_UP (sizeof (struct slab), align);
+	ASSERT (c->first_ofs + c->slot_size <= PGSIZE);
+	c->objs_per_slab = (PGSIZE - c->first_ofs) / c->slot_size;
+
+	adaptive_lock_init (&c->lock);
+	list_init (&c->partial);
+	list_init (&c->full);
+	list_init (&c->empty);
+	c->slab_cnt = 0;
+	c->in_use = 0;
+	c->allocs = 0;
+	list_push_back (&all_caches, &c->elem);
+}
+
+/* Obtains a page from the page allocator and makes it a slab of
+   cache C with every slot free.  Returns a null pointer if no
+   page is available.  C's lock must be held. */
+static struct slab *
+slab_create (struct kmem_cache *c) {
+	struct slab *s = palloc_get_page (0);
+	size_t i;
+
+	if (s == NULL)
+		return NULL;
+
+	s->magic = SLAB_MAGIC;
+	s->cache = c;
+	s->in_use = 0;
+	s->free = NULL;
+	for (i = c->objs_per_slab; i-- > 0; ) {
+		void *obj = (uint8_t *) s + c->first_ofs + i * c->slot_size;
+		if (c->ctor != NULL)
+			c->ctor (obj);
+		*link_of (c, obj) = s->free;
+		s->free = obj;
+	}
+	c->slab_cnt++;
+	return s;
+}
+
+/* Allocates and returns an object from cache C, or a null
+   pointer if memory is not available. */
+void *
+kmem_cache_alloc (struct kmem_cache *c) {
+	struct slab *s;
+	void *obj;
+
+	adaptive_lock_acquire (&c->lock);
+	if (!list_empty (&c->partial))
+		s = list_entry (list_pop_front (&c->partial), struct slab, elem);
+	else if (!list_empty (&c->empty))
+		s = list_entry (list_pop_front (&c->empty), struct slab, elem);
+	else {
+		s = slab_create (c);
+		if (s == NULL) {
+			adaptive_lock_release (&c->lock);
+			return NULL;
+		}
+	}
+
+	obj = s->free;
+	s->free = *link_of (c, obj);
+	s->in_use++;
+	list_push_front (s->free != NULL ? &c->partial : &c->full, &s->elem);
+	c->in_use++;
+	c->allocs++;
+	adaptive_lock_release (&c->lock);
+	return obj;
+}
+
+/* Returns OBJ, which must have been allocated from cache C, to
+   C.  A null OBJ is ignored. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj) {
+	struct slab *s;
+
+	if (obj == NULL)
+		return;
+	s = obj_to_slab (c, obj);
+
+#ifndef NDEBUG
+	/* Clear the object to help detect use-after-free bugs.
+	   Constructed objects must keep their contents. */
+	if (c->ctor == NULL)
+		memset (obj, 0xcc, c->obj_size);
+#endif
+
+	adaptive_lock_acquire (&c->lock);
+	ASSERT (s->in_use > 0);
+	list_remove (&s->elem);
+	*link_of (c, obj) = s->free;
+	s->free = obj;
+	c->in_use--;
+	if (--s->in_use > 0)
+		list_push_front (&c->partial, &s->elem);
+	else if (list_empty (&c->empty))
+		list_push_front (&c->empty, &s->elem);
+	else {
+		c->slab_cnt--;
+		palloc_free_page (s);
+	}
+	adaptive_lock_release (&c->lock);
+}
+
+/* Returns the slab that OBJ, an object of cache C, is inside. */
+static struct slab *
+obj_to_slab (struct kmem_cache *c, void *obj) {
+	struct slab *s = pg_round_down (obj);
+
+	/* Check that the slab is valid and belongs to C. */
+	ASSERT (s->magic == SLAB_MAGIC);
+	ASSERT (s->cache == c);
+
+	/* Check that the object is properly aligned for the slab. */
+	ASSERT (pg_ofs (obj) >= c->first_ofs);
+	ASSERT ((pg_ofs (obj) - c->first_ofs) % c->slot_size == 0);
+
+	return s;
+}
+
+/* Prints per-cache statistics: objects in use, slabs held, the
+   fraction of slab memory holding live object bytes, and how
+   often the cache lock was contended. */
+void
+slab_print_stats (void) {
+	struct list_elem *e;
+
+	printf ("Slab: %-12s %7s %7s %9s %6s %7s %7s\n", "cache",
+			"objsize", "in use", "allocs", "slabs", "util%", "blocked");
+	for (e = list_begin (&all_caches); e != list_end (&all_caches);
+			e = list_next (e)) {
+		struct kmem_cache *c = list_entry (e, struct kmem_cache, elem);
+		size_t bytes = c->slab_cnt * PGSIZE;
+
+		printf ("Slab: %-12s %7zu %7zu %9llu %6zu %7zu %7u\n", c->name,
+				c->obj_size, c->in_use, c->allocs, c->slab_cnt,
+				bytes > 0 ? c->in_use * c->obj_size * 100 / bytes : 0,
+				c->lock.sleeps);
+	}
+}
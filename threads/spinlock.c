@@ -0,0 +1,76 @@
+#include "threads/spinlock.h"
+#include <debug.h>
+#include "threads/cpu.h"
+
+/* Atomically stores 1 in *LOCKED and returns its old value.
+   `xchg' with a memory operand is locked implicitly, and also
+   keeps the compiler from moving memory accesses across it. */
+static inline int
+test_and_set (volatile int *locked) {
+	int old = 1;
+
+	asm volatile ("xchgl %0, %1"
+			: "+r" (old), "+m" (*locked) : : "memory");
+	return old;
+}
+
+/* Initializes LOCK as free. */
+void
+spin_init (struct spinlock *lock) {
+	lock->locked = 0;
+	lock->cpu = -1;
+	lock->old_level = INTR_OFF;
+}
+
+/* Acquires LOCK, spinning until it is free, and disables
+   interrupts until the matching spin_unlock(). */
+void
+spin_lock (struct spinlock *lock) {
+	enum intr_level old_level = intr_disable ();
+
+	ASSERT (!spin_held (lock));
+	while (test_and_set (&lock->locked))
+		/* Spin on plain reads, which leave the cache line shared,
+		   until the lock looks free. */
+		while (lock->locked)
+			asm volatile ("pause");
+	lock->cpu = cpu_current ()->id;
+	lock->old_level = old_level;
+}
+
+/* Tries to acquire LOCK without spinning.  Returns true, with
+   interrupts disabled, if successful; otherwise returns false and
+   leaves the interrupt level alone. */
+bool
+spin_try_lock (struct spinlock *lock) {
+	enum intr_level old_level = intr_disable ();
+
+	ASSERT (!spin_held (lock));
+	if (test_and_set (&lock->locked)) {
+		intr_set_level (old_level);
+		return false;
+	}
+	lock->cpu = cpu_current ()->id;
+	lock->old_level = old_level;
+	return true;
+}
+
+/* Releases LOCK, which the running CPU must hold, and restores
+   the interrupt level from before it was acquired. */
+void
+spin_unlock (struct spinlock *lock) {
+	enum intr_level old_level = lock->old_level;
+
+	ASSERT (spin_held (lock));
+	lock->cpu = -1;
+	asm volatile ("" : : : "memory");
+	lock->locked = 0;
+	intr_set_level (old_level);
+}
+
+/* Returns true if the running CPU holds LOCK.  Interrupts must be
+   off, or the answer could be stale by the time it is used. */
+bool
+spin_held (const struct spinlock *lock) {
+	return lock->locked && lock->cpu == cpu_current ()->id;
+}
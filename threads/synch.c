@@ -28,9 +28,35 @@
 
 #include "threads/synch.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include "threads/atomic.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "intrinsic.h"
+
+/* Maximum length of a lock holder chain that a priority donation
+   is propagated along. */
+#define DONATION_DEPTH_MAX 8
+
+/* A semaphore's COUNT: its value, and one sleeper. */
+#define SEMA_VALUE(COUNT) ((uint32_t) (COUNT))
+#define SEMA_SLEEPER ((uint64_t) 1 << 32)
+
+/* Set in a lock's OWNER once the lock is in its holder's
+   held_locks. */
+#define LOCK_SLOW ((uintptr_t) 1)
+
+/* Ticket handed to each new semaphore waiter, so that waiters of
+   equal priority are woken in FIFO order. */
+static unsigned next_wait_seq;
+
+static heap_less_func waiter_less;
+static void sema_wait (struct semaphore *);
+static bool sema_take (struct semaphore *, uint64_t sleeper);
+static void sema_wake (struct semaphore *, bool sync);
+static void lock_acquire_since (struct lock *, uint64_t start);
+static bool lock_try_acquire_since (struct lock *, uint64_t start);
 
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
@@ -45,8 +71,67 @@ void
 sema_init (struct semaphore *sema, unsigned value) {
 	ASSERT (sema != NULL);
 
-	sema->value = value;
-	list_init (&sema->waiters);
+	sema->count = value;
+	heap_init (&sema->waiters, waiter_less, NULL);
+}
+
+/* Orders semaphore waiters by priority, and by arrival among
+   waiters of equal priority, so that the top of the heap is the
+   thread to wake next. */
+static bool
+waiter_less (const struct heap_elem *a_, const struct heap_elem *b_,
+		void *aux UNUSED) {
+	const struct thread *a = heap_entry (a_, struct thread, wait_elem);
+	const struct thread *b = heap_entry (b_, struct thread, wait_elem);
+
+	if (a->priority != b->priority)
+		return a->priority < b->priority;
+	return (int) (a->wait_seq - b->wait_seq) > 0;
+}
+
+/* Adds the current thread to SEMA's waiters and blocks it.
+   Must be called with interrupts off. */
+static void
+sema_wait (struct semaphore *sema) {
+	struct thread *cur = thread_current ();
+
+	cur->wait_seq = next_wait_seq++;
+	cur->waiting_sema = sema;
+	heap_push (&sema->waiters, &cur->wait_elem);
+	thread_block ();
+}
+
+/* Decrements SEMA's value if it is positive, and returns true if
+   it did.  A sleeper leaving the slow path passes SEMA_SLEEPER as
+   SLEEPER, to give up its sleeper count in the same exchange, after
+   which it must not touch SEMA again if it is to be freed. */
+static bool
+sema_take (struct semaphore *sema, uint64_t sleeper) {
+	uint64_t count = atomic_load (&sema->count);
+
+	while (SEMA_VALUE (count) > 0)
+		if (atomic_cmpxchg (&sema->count, &count, count - 1 - sleeper))
+			return true;
+	return false;
+}
+
+/* Wakes the highest-priority thread waiting on SEMA, if any, as a
+   sync wakeup if SYNC (see thread_unblock_sync()).  Must be called
+   with interrupts off. */
+static void
+sema_wake (struct semaphore *sema, bool sync) {
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (!heap_empty (&sema->waiters)) {
+		struct thread *t = heap_entry (heap_pop (&sema->waiters),
+				struct thread, wait_elem);
+
+		t->waiting_sema = NULL;
+		if (sync)
+			thread_unblock_sync (t);
+		else
+			thread_unblock (t);
+	}
 }
 
 /* Down or "P" operation on a semaphore.  Waits for SEMA's value
@@ -64,12 +149,16 @@ sema_down (struct semaphore *sema) {
 	ASSERT (sema != NULL);
 	ASSERT (!intr_context ());
 
+	if (sema_take (sema, 0))
+		return;
+
+	/* Count ourselves as a sleeper before looking at the value
+	   again, so that an up either sees us or its increment is seen
+	   here.  The exchange is a full barrier. */
 	old_level = intr_disable ();
-	while (sema->value == 0) {
-		list_push_back (&sema->waiters, &thread_current ()->elem);
-		thread_block ();
-	}
-	sema->value--;
+	atomic_fetch_add (&sema->count, SEMA_SLEEPER);
+	while (!sema_take (sema, SEMA_SLEEPER))
+		sema_wait (sema);
 	intr_set_level (old_level);
 }
 
@@ -80,40 +169,72 @@ sema_down (struct semaphore *sema) {
    This function may be called from an interrupt handler. */
 bool
 sema_try_down (struct semaphore *sema) {
+	ASSERT (sema != NULL);
+
+	return sema_take (sema, 0);
+}
+
+/* Increments SEMA's value and wakes a waiter, as a sync wakeup if
+   SYNC.  The common part of sema_up() and sema_up_sync(). */
+static void
+sema_post (struct semaphore *sema, bool sync) {
 	enum intr_level old_level;
-	bool success;
+	uint64_t count;
 
 	ASSERT (sema != NULL);
 
+	count = atomic_load (&sema->count);
+	while (count < SEMA_SLEEPER)
+		if (atomic_cmpxchg (&sema->count, &count, count + 1))
+			return;
+
 	old_level = intr_disable ();
-	if (sema->value > 0)
-	{
-		sema->value--;
-		success = true;
-	}
-	else
-		success = false;
+	atomic_fetch_add (&sema->count, 1);
+	sema_wake (sema, sync);
+	thread_preempt ();
 	intr_set_level (old_level);
-
-	return success;
 }
 
 /* Up or "V" operation on a semaphore.  Increments SEMA's value
-   and wakes up one thread of those waiting for SEMA, if any.
+   and wakes up the highest-priority thread of those waiting for
+   SEMA, if any, preempting the caller if that thread outranks it.
+
+   With no sleepers this is a single exchange, the last access to
+   SEMA, so the thread downing it may free it as soon as it has.
+   Otherwise the increment and the wakeup happen with interrupts
+   off, which a sleeper also needs to leave sema_down().
 
    This function may be called from an interrupt handler. */
 void
 sema_up (struct semaphore *sema) {
-	enum intr_level old_level;
+	sema_post (sema, false);
+}
 
-	ASSERT (sema != NULL);
+/* Like sema_up(), for a caller that is about to block itself, as
+   one side of a pipe does after waking the other: the woken thread
+   may be placed on the caller's CPU, to find there the data the
+   caller left in its cache.  Must not be called from an interrupt
+   handler. */
+void
+sema_up_sync (struct semaphore *sema) {
+	ASSERT (!intr_context ());
 
-	old_level = intr_disable ();
-	if (!list_empty (&sema->waiters))
-		thread_unblock (list_entry (list_pop_front (&sema->waiters),
-					struct thread, elem));
-	sema->value++;
-	intr_set_level (old_level);
+	sema_post (sema, true);
+}
+
+/* Restores the wakeup order of SEMA's waiters after the priority
+   of T, one of them, has changed from OLD_PRIORITY.  A raised
+   priority, the common case under donation, takes O(1) time.
+   Must be called with interrupts off. */
+void
+sema_reorder (struct semaphore *sema, struct thread *t, int old_priority) {
+	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (t->waiting_sema == sema);
+
+	if (t->priority >= old_priority)
+		heap_increase (&sema->waiters, &t->wait_elem);
+	else
+		heap_update (&sema->waiters, &t->wait_elem);
 }
 
 static void sema_test_helper (void *sema_);
@@ -151,6 +272,80 @@ sema_test_helper (void *sema_) {
 	}
 }
 
+/* Maximum number of lock classes.  Locks initialized once the
+   table is full go uncounted. */
+#define LOCK_CLASS_MAX 256
+
+/* Contention statistics for the locks initialized at one source
+   line. */
+struct lock_class {
+	const char *file;           /* Source file, or null if unused. */
+	int line;                   /* Line within FILE. */
+	long long acquire_cnt;      /* # of acquires. */
+	long long contended_cnt;    /* # of acquires that had to wait. */
+	uint64_t wait_tsc;          /* Total cycles spent waiting. */
+	uint64_t max_hold_tsc;      /* Longest hold, in cycles. */
+};
+
+/* Collect lock contention statistics? */
+bool lock_stats_enabled;
+
+/* Lock classes, open-addressed by call site. */
+static struct lock_class lock_classes[LOCK_CLASS_MAX];
+static size_t lock_class_cnt;
+
+/* Returns the class of locks initialized at line LINE of FILE,
+   creating it if needed, or a null pointer if statistics are
+   off or the table is full. */
+static struct lock_class *
+lock_class_get (const char *file, int line) {
+	struct lock_class *c = NULL;
+	enum intr_level old_level;
+	size_t i, n;
+
+	if (!lock_stats_enabled)
+		return NULL;
+
+	old_level = intr_disable ();
+	i = ((uintptr_t) file * 31 + line) % LOCK_CLASS_MAX;
+	for (n = 0; n < LOCK_CLASS_MAX; n++, i = (i + 1) % LOCK_CLASS_MAX) {
+		struct lock_class *try = &lock_classes[i];
+
+		if (try->file == file && try->line == line) {
+			c = try;
+			break;
+		}
+		if (try->file == NULL) {
+			try->file = file;
+			try->line = line;
+			lock_class_cnt++;
+			c = try;
+			break;
+		}
+	}
+	intr_set_level (old_level);
+	return c;
+}
+
+/* Counts an acquire of LOCK, which the current thread has just
+   taken.  START is the time stamp at which it began to wait, or 0
+   if the lock was free. */
+static void
+lock_class_acquired (struct lock *lock, uint64_t start) {
+	struct lock_class *c = lock->class;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (c == NULL)
+		return;
+	lock->acquire_tsc = rdtsc ();
+	c->acquire_cnt++;
+	if (start != 0) {
+		c->contended_cnt++;
+		c->wait_tsc += lock->acquire_tsc - start;
+	}
+}
+
 /* Initializes LOCK.  A lock can be held by at most a single
    thread at any given time.  Our locks are not "recursive", that
    is, it is an error for the thread currently holding a lock to
@@ -165,31 +360,162 @@ sema_test_helper (void *sema_) {
    another one "up" it, but with a lock the same thread must both
    acquire and release it.  When these restrictions prove
    onerous, it's a good sign that a semaphore should be used,
-   instead of a lock. */
+   instead of a lock.
+
+   FILE and LINE name the call site, which is the lock's class
+   for contention statistics; lock_init() supplies them. */
 void
-lock_init (struct lock *lock) {
+lock_init_at (struct lock *lock, const char *file, int line) {
 	ASSERT (lock != NULL);
 
-	lock->holder = NULL;
-	sema_init (&lock->semaphore, 1);
+	lock->owner = 0;
+	lock->priority = PRI_MIN - 1;
+	lock->class = lock_class_get (file, line);
+	lock->acquire_tsc = 0;
+	sema_init (&lock->semaphore, 0);
+}
+
+/* Returns the thread holding LOCK, or a null pointer if it is
+   free. */
+static struct thread *
+lock_holder (const struct lock *lock) {
+	return (struct thread *) (atomic_load (&lock->owner) & ~LOCK_SLOW);
+}
+
+/* Sets LOCK_SLOW in LOCK's owner, so that its holder releases it
+   on the slow path, and puts LOCK in the holder's held_locks if it
+   was taken on the fast path.  Returns the holder, or a null
+   pointer if LOCK is free.  Must be called with interrupts off. */
+static struct thread *
+lock_mark_slow (struct lock *lock) {
+	uintptr_t owner = atomic_load (&lock->owner);
+	struct thread *holder;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	do {
+		if (owner == 0)
+			return NULL;
+		if (owner & LOCK_SLOW)
+			return (struct thread *) (owner & ~LOCK_SLOW);
+	} while (!atomic_cmpxchg (&lock->owner, &owner, owner | LOCK_SLOW));
+
+	holder = (struct thread *) owner;
+	lock->priority = PRI_MIN - 1;
+	heap_push (&holder->held_locks, &lock->elem);
+	return holder;
+}
+
+/* Donates priority PRI through LOCK, which the current thread is
+   about to wait on, to its holder and onward along the chain of
+   locks the holders are themselves waiting on.  Each lock's
+   position in its holder's held_locks heap is fixed up on the
+   way.  Stops as soon as a link's priority would not increase,
+   or after DONATION_DEPTH_MAX links. */
+static void
+donate_priority (struct lock *lock, int pri) {
+	int depth;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	for (depth = 0; depth < DONATION_DEPTH_MAX; depth++) {
+		struct thread *holder;
+
+		if (lock == NULL || (holder = lock_mark_slow (lock)) == NULL
+				|| pri <= lock->priority)
+			break;
+		lock->priority = pri;
+		heap_increase (&holder->held_locks, &lock->elem);
+
+		if (pri <= holder->priority)
+			break;
+		thread_update_priority (holder, pri);
+		lock = holder->waiting_lock;
+	}
+}
+
+/* Takes LOCK for the current thread on the slow path, if it is
+   free, putting it in the thread's held_locks with the priority
+   of its waiters.  Returns true if successful.  Must be called
+   with interrupts off. */
+static bool
+lock_take (struct lock *lock) {
+	struct thread *cur = thread_current ();
+	uintptr_t owner = 0;
+	struct heap_elem *top;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (!atomic_cmpxchg (&lock->owner, &owner, (uintptr_t) cur | LOCK_SLOW))
+		return false;
+	top = heap_top (&lock->semaphore.waiters);
+	lock->priority = top != NULL
+		? heap_entry (top, struct thread, wait_elem)->priority
+		: PRI_MIN - 1;
+	heap_push (&cur->held_locks, &lock->elem);
+	if (!thread_mlfqs)
+		thread_refresh_priority (cur);
+	return true;
+}
+
+/* Takes LOCK for the current thread with a single exchange, if it
+   is free and its statistics, which need interrupts off, are not
+   kept.  Returns true if successful. */
+static bool
+lock_take_fast (struct lock *lock) {
+	uintptr_t owner = 0;
+
+	return lock->class == NULL
+		&& atomic_cmpxchg (&lock->owner, &owner, (uintptr_t) thread_current ());
 }
 
 /* Acquires LOCK, sleeping until it becomes available if
    necessary.  The lock must not already be held by the current
    thread.
 
+   While waiting, the current thread donates its priority to the
+   holder (unless the MLFQS is in use), so that the holder cannot
+   be starved by threads of intermediate priority.
+
    This function may sleep, so it must not be called within an
    interrupt handler.  This function may be called with
    interrupts disabled, but interrupts will be turned back on if
    we need to sleep. */
 void
 lock_acquire (struct lock *lock) {
+	lock_acquire_since (lock, 0);
+}
+
+/* Acquires LOCK as lock_acquire() does.  START is the time stamp
+   at which the caller began to wait for LOCK, or 0 if it has not
+   waited yet. */
+static void
+lock_acquire_since (struct lock *lock, uint64_t start) {
+	struct thread *cur = thread_current ();
+	enum intr_level old_level;
+
 	ASSERT (lock != NULL);
 	ASSERT (!intr_context ());
 	ASSERT (!lock_held_by_current_thread (lock));
 
-	sema_down (&lock->semaphore);
-	lock->holder = thread_current ();
+	if (lock_take_fast (lock))
+		return;
+
+	/* Once the lock is marked slow, its release wakes us. */
+	old_level = intr_disable ();
+	while (!lock_take (lock)) {
+		if (lock_mark_slow (lock) == NULL)
+			continue;
+		if (start == 0)
+			start = rdtsc ();
+		cur->waiting_lock = lock;
+		if (!thread_mlfqs)
+			donate_priority (lock, cur->priority);
+		sema_wait (&lock->semaphore);
+	}
+	cur->waiting_lock = NULL;
+	lock_class_acquired (lock, start);
+	intr_set_level (old_level);
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -200,30 +526,67 @@ lock_acquire (struct lock *lock) {
    interrupt handler. */
 bool
 lock_try_acquire (struct lock *lock) {
+	return lock_try_acquire_since (lock, 0);
+}
+
+/* Tries to acquire LOCK as lock_try_acquire() does.  START is the
+   time stamp at which the caller began to wait for LOCK, or 0 if
+   it has not waited; a failed try is not counted. */
+static bool
+lock_try_acquire_since (struct lock *lock, uint64_t start) {
+	enum intr_level old_level;
 	bool success;
 
 	ASSERT (lock != NULL);
 	ASSERT (!lock_held_by_current_thread (lock));
 
-	success = sema_try_down (&lock->semaphore);
+	if (lock_take_fast (lock))
+		return true;
+	if (lock->class == NULL)
+		return false;
+
+	old_level = intr_disable ();
+	success = lock_take (lock);
 	if (success)
-		lock->holder = thread_current ();
+		lock_class_acquired (lock, start);
+	intr_set_level (old_level);
 	return success;
 }
 
 /* Releases LOCK, which must be owned by the current thread.
-   This is lock_release function.
+   Gives up whatever priority was donated through LOCK; the
+   donations made through other held locks remain.
 
    An interrupt handler cannot acquire a lock, so it does not
    make sense to try to release a lock within an interrupt
    handler. */
 void
 lock_release (struct lock *lock) {
+	struct thread *cur = thread_current ();
+	uintptr_t owner = (uintptr_t) cur;
+	enum intr_level old_level;
+
 	ASSERT (lock != NULL);
 	ASSERT (lock_held_by_current_thread (lock));
 
-	lock->holder = NULL;
-	sema_up (&lock->semaphore);
+	/* Taken on the fast path, and nobody has come to wait. */
+	if (atomic_cmpxchg (&lock->owner, &owner, 0))
+		return;
+
+	old_level = intr_disable ();
+	if (lock->class != NULL) {
+		uint64_t hold = rdtsc () - lock->acquire_tsc;
+
+		if (hold > lock->class->max_hold_tsc)
+			lock->class->max_hold_tsc = hold;
+	}
+	heap_remove (&cur->held_locks, &lock->elem);
+	atomic_store_release (&lock->owner, 0);
+	if (!thread_mlfqs)
+		thread_refresh_priority (cur);
+	sema_wake (&lock->semaphore, false);
+	thread_preempt ();
+	intr_set_level (old_level);
 }
 
 /* Returns true if the current thread holds LOCK, false
@@ -233,15 +596,255 @@ bool
 lock_held_by_current_thread (const struct lock *lock) {
 	ASSERT (lock != NULL);
 
-	return lock->holder == thread_current ();
+	return lock_holder (lock) == thread_current ();
 }
 
+/* Maximum number of times adaptive_lock_acquire() polls a
+   running holder before blocking. */
+#define ADAPTIVE_SPIN_MAX 1000
+
+/* Totals across all adaptive locks. */
+static long long adaptive_spins;    /* # of acquires won by spinning. */
+static long long adaptive_sleeps;   /* # of acquires that had to block. */
+
+/* Initializes adaptive lock ALOCK, whose statistics are kept
+   under call site FILE:LINE; adaptive_lock_init() supplies it. */
+void
+adaptive_lock_init_at (struct adaptive_lock *alock, const char *file,
+		int line) {
+	ASSERT (alock != NULL);
+
+	lock_init_at (&alock->lock, file, line);
+	alock->spins = 0;
+	alock->sleeps = 0;
+}
+
+/* Acquires ALOCK.  If it is held, spins while the holder is
+   running, up to ADAPTIVE_SPIN_MAX polls, and then sleeps as
+   lock_acquire() would, donating priority to the holder.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+adaptive_lock_acquire (struct adaptive_lock *alock) {
+	uint64_t start;
+	int spin;
+
+	ASSERT (alock != NULL);
+	ASSERT (!intr_context ());
+
+	if (lock_try_acquire (&alock->lock))
+		return;
+
+	start = rdtsc ();
+	for (spin = 0; spin < ADAPTIVE_SPIN_MAX; spin++) {
+		struct thread *holder = lock_holder (&alock->lock);
+
+		if (holder == NULL || holder->status != THREAD_RUNNING)
+			break;
+		asm volatile ("pause" : : : "memory");
+		if (lock_try_acquire_since (&alock->lock, start)) {
+			alock->spins++;
+			adaptive_spins++;
+			return;
+		}
+	}
+
+	lock_acquire_since (&alock->lock, start);
+	alock->sleeps++;
+	adaptive_sleeps++;
+}
+
+/* Tries to acquire ALOCK without spinning or sleeping and
+   returns true if successful.  May be called within an
+   interrupt handler. */
+bool
+adaptive_lock_try_acquire (struct adaptive_lock *alock) {
+	ASSERT (alock != NULL);
+
+	return lock_try_acquire (&alock->lock);
+}
+
+/* Releases ALOCK, which must be held by the current thread. */
+void
+adaptive_lock_release (struct adaptive_lock *alock) {
+	ASSERT (alock != NULL);
+
+	lock_release (&alock->lock);
+}
+
+/* Returns true if the current thread holds ALOCK. */
+bool
+adaptive_lock_held_by_current_thread (const struct adaptive_lock *alock) {
+	ASSERT (alock != NULL);
+
+	return lock_held_by_current_thread (&alock->lock);
+}
+
+/* Orders lock classes by descending total wait time. */
+static int
+compare_lock_classes (const void *a_, const void *b_) {
+	const struct lock_class *a = *(const struct lock_class **) a_;
+	const struct lock_class *b = *(const struct lock_class **) b_;
+
+	return a->wait_tsc < b->wait_tsc ? 1 : a->wait_tsc > b->wait_tsc ? -1 : 0;
+}
+
+/* Prints lock statistics and, if enabled, one line per lock class
+   that was ever acquired, the most waited-on first.  Times are in
+   CPU cycles. */
+void
+lock_print_stats (void) {
+	static struct lock_class *sorted[LOCK_CLASS_MAX];
+	size_t cnt = 0, i;
+
+	printf ("Locks: %lld adaptive spins, %lld adaptive sleeps\n",
+			adaptive_spins, adaptive_sleeps);
+	if (!lock_stats_enabled)
+		return;
+
+	for (i = 0; i < LOCK_CLASS_MAX; i++)
+		if (lock_classes[i].acquire_cnt > 0)
+			sorted[cnt++] = &lock_classes[i];
+	qsort (sorted, cnt, sizeof *sorted, compare_lock_classes);
+
+	printf ("Lock classes: %zu in use, %zu acquired\n", lock_class_cnt, cnt);
+	for (i = 0; i < cnt; i++) {
+		const struct lock_class *c = sorted[i];
+		const char *file = c->file;
+
+		while (!memcmp (file, "../", 3))
+			file += 3;
+		printf ("Lock %s:%d: %lld acquires, %lld contended, "
+				"%llu wait cycles, %llu max hold\n", file, c->line,
+				c->acquire_cnt, c->contended_cnt,
+				(unsigned long long) c->wait_tsc,
+				(unsigned long long) c->max_hold_tsc);
+	}
+}
+
+/* Initializes readers-writer lock RW, whose statistics are kept
+   under call site FILE:LINE; rwlock_init() supplies it. */
+void
+rwlock_init_at (struct rwlock *rw, const char *file, int line) {
+	ASSERT (rw != NULL);
+
+	lock_init_at (&rw->lock, file, line);
+	sema_init (&rw->drained, 0);
+	rw->readers = 0;
+	rw->writer_waiting = false;
+}
+
+/* Acquires RW for reading, sleeping while a writer holds it or
+   is waiting for it.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rw_read_acquire (struct rwlock *rw) {
+	enum intr_level old_level;
+
+	ASSERT (rw != NULL);
+	ASSERT (!intr_context ());
+
+	lock_acquire (&rw->lock);
+	old_level = intr_disable ();
+	rw->readers++;
+	intr_set_level (old_level);
+	lock_release (&rw->lock);
+}
+
+/* Releases RW, which the current thread holds for reading.  The
+   last reader out lets a waiting writer proceed. */
+void
+rw_read_release (struct rwlock *rw) {
+	enum intr_level old_level;
+
+	ASSERT (rw != NULL);
+
+	old_level = intr_disable ();
+	ASSERT (rw->readers > 0);
+	if (--rw->readers == 0 && rw->writer_waiting) {
+		rw->writer_waiting = false;
+		sema_up (&rw->drained);
+	}
+	intr_set_level (old_level);
+}
+
+/* Acquires RW for writing, sleeping until every other reader and
+   writer is gone.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rw_write_acquire (struct rwlock *rw) {
+	enum intr_level old_level;
+
+	ASSERT (rw != NULL);
+	ASSERT (!intr_context ());
+
+	lock_acquire (&rw->lock);
+	old_level = intr_disable ();
+	while (rw->readers > 0) {
+		rw->writer_waiting = true;
+		sema_down (&rw->drained);
+	}
+	intr_set_level (old_level);
+}
+
+/* Tries to acquire RW for writing without sleeping, and returns
+   true if successful, false if another thread holds it or reads
+   under it. */
+bool
+rw_write_try_acquire (struct rwlock *rw) {
+	enum intr_level old_level;
+	bool success;
+
+	ASSERT (rw != NULL);
+
+	if (!lock_try_acquire (&rw->lock))
+		return false;
+	old_level = intr_disable ();
+	success = rw->readers == 0;
+	intr_set_level (old_level);
+	if (!success)
+		lock_release (&rw->lock);
+	return success;
+}
+
+/* Releases RW, which the current thread holds for writing. */
+void
+rw_write_release (struct rwlock *rw) {
+	ASSERT (rw != NULL);
+
+	lock_release (&rw->lock);
+}
+
+/* Returns true if the current thread holds RW for writing. */
+bool
+rw_write_held_by_current_thread (const struct rwlock *rw) {
+	ASSERT (rw != NULL);
+
+	return lock_held_by_current_thread (&rw->lock);
+}
+
 /* One semaphore in a list. */
 struct semaphore_elem {
 	struct list_elem elem;              /* List element. */
 	struct semaphore semaphore;         /* This semaphore. */
+	struct thread *thread;              /* Thread waiting on it. */
 };
 
+/* Orders condition variable waiters by their thread's priority. */
+static bool
+cond_waiter_less (const struct list_elem *a_, const struct list_elem *b_,
+		void *aux UNUSED) {
+	const struct semaphore_elem *a = list_entry (a_, struct semaphore_elem, elem);
+	const struct semaphore_elem *b = list_entry (b_, struct semaphore_elem, elem);
+
+	return a->thread->priority < b->thread->priority;
+}
+
 /* Initializes condition variable COND.  A condition variable
    allows one piece of code to signal a condition and cooperating
    code to receive the signal and act upon it. */
@@ -282,6 +885,7 @@ cond_wait (struct condition *cond, struct lock *lock) {
 	ASSERT (lock_held_by_current_thread (lock));
 
 	sema_init (&waiter.semaphore, 0);
+	waiter.thread = thread_current ();
 	list_push_back (&cond->waiters, &waiter.elem);
 	lock_release (lock);
 	sema_down (&waiter.semaphore);
@@ -289,8 +893,8 @@ cond_wait (struct condition *cond, struct lock *lock) {
 }
 
 /* If any threads are waiting on COND (protected by LOCK), then
-   this function signals one of them to wake up from its wait.
-   LOCK must be held before calling this function.
+   this function signals the highest-priority one to wake up from
+   its wait.  LOCK must be held before calling this function.
 
    An interrupt handler cannot acquire a lock, so it does not
    make sense to try to signal a condition variable within an
@@ -302,9 +906,12 @@ cond_signal (struct condition *cond, struct lock *lock UNUSED) {
 	ASSERT (!intr_context ());
 	ASSERT (lock_held_by_current_thread (lock));
 
-	if (!list_empty (&cond->waiters))
-		sema_up (&list_entry (list_pop_front (&cond->waiters),
-					struct semaphore_elem, elem)->semaphore);
+	if (!list_empty (&cond->waiters)) {
+		struct list_elem *e = list_max (&cond->waiters, cond_waiter_less, NULL);
+
+		list_remove (e);
+		sema_up (&list_entry (e, struct semaphore_elem, elem)->semaphore);
+	}
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
@@ -1,9 +1,27 @@
 threads_SRC  = threads/init.c		# Main program.
 threads_SRC += threads/thread.c		# Thread management core.
+threads_SRC += threads/sched.c		# Scheduling classes.
+threads_SRC += threads/mlfqs.c		# Multi-level feedback queue scheduler.
+threads_SRC += threads/fair.c		# Fair-share scheduler.
+threads_SRC += threads/deadline.c	# Earliest-deadline-first scheduling.
 threads_SRC += threads/interrupt.c	# Interrupt core.
 threads_SRC += threads/intr-stubs.S	# Interrupt stubs.
 threads_SRC += threads/synch.c		# Synchronization.
+threads_SRC += threads/poll.c		# Wait queues for poll().
+threads_SRC += threads/spinlock.c	# Spinlocks.
+threads_SRC += threads/defer.c		# Deferred interrupt work.
+threads_SRC += threads/rcu.c		# Read-copy-update.
+threads_SRC += threads/workq.c		# Kernel worker pool.
+threads_SRC += threads/cpu.c		# Per-CPU state and AP startup.
+threads_SRC += threads/lapic.c		# Local APIC.
+threads_SRC += threads/ap-start.S	# AP startup code.
+threads_SRC += threads/fpu.c		# Lazy FPU context switching.
+threads_SRC += threads/kstack.c		# Kernel stacks.
+threads_SRC += threads/vmalloc.c	# Virtually contiguous allocations.
 threads_SRC += threads/palloc.c		# Page allocator.
 threads_SRC += threads/malloc.c		# Subpage allocator.
+threads_SRC += threads/slab.c		# Object caches.
+threads_SRC += threads/profile.c	# Sampling profiler.
+threads_SRC += threads/trace.c		# Static tracepoints.
 threads_SRC += threads/start.S		# Startup code.
 threads_SRC += threads/mmu.c		    # Memory management unit related things.
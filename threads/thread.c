@@ -1,15 +1,25 @@
 #include "threads/thread.h"
 #include <debug.h>
+#include <inttypes.h>
+#include <lfstack.h>
+#include <pcounter.h>
 #include <stddef.h>
 #include <random.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/cpu.h"
 #include "threads/flags.h"
+#include "threads/fpu.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
+#include "threads/kstack.h"
+#include "threads/lapic.h"
 #include "threads/palloc.h"
+#include "threads/rcu.h"
+#include "threads/sched.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#include "threads/trace.h"
 #include "intrinsic.h"
 #include "devices/timer.h"
 
@@ -26,16 +36,31 @@
    Do not modify this value. */
 #define THREAD_BASIC 0xd42df210
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
-
-/* List of processes in THREAD_SLEEP state, that is processes
-   that are blocked.*/
-static struct list sleep_list;
-
-/* Idle thread. */
-static struct thread *idle_thread;
+/* Run queues, one per CPU, of processes in THREAD_READY state,
+   that is, processes that are ready to run but not actually
+   running.  A ready thread is on the queue of the CPU in its `cpu'
+   member, which is where it last ran or where thread_create() put
+   it.  The scheduling class in `sched' (see sched.c) orders each
+   queue.
+
+   A thread runs only on the CPUs in its `affinity' mask.  A waking
+   thread goes back to the CPU it last ran on, whose cache may still
+   hold its data, unless that CPU is busier than another it may use
+   (see select_cpu()).  A CPU whose queue runs dry steals half of
+   the fullest queue, and thread_tick() evens out the CPUs' loads
+   every BALANCE_TICKS, moving only threads allowed on the CPU they
+   move to.  Each move to another CPU counts in the thread's
+   `migrate_cnt'. */
+static struct runqueue runqueues[CPU_MAX];
+
+/* Sleeping threads, kept as a pairing heap ordered by
+   wakeup_time.  The root is always the thread with the
+   earliest deadline, so the timer interrupt can tell whether any
+   work is due with a single comparison. */
+static struct thread *sleep_heap;
+
+/* List of all live threads, for the MLFQS per-second update. */
+static struct list all_list;
 
 /* Initial thread, the thread running init.c:main(). */
 static struct thread *initial_thread;
@@ -43,41 +68,90 @@ static struct thread *initial_thread;
 /* Lock used by allocate_tid(). */
 static struct lock tid_lock;
 
-/* Thread destruction requests */
-static struct list destruction_req;
+/* Thread destruction requests: dying threads, pushed by the CPU
+   that switched away from them. */
+static struct lfstack destruction_req;
+
+/* Pages of destroyed threads, with their kernel stacks still
+   mapped, kept for reuse by thread_create() so that creating a
+   thread needs no trip through the page allocator, no mapping of a
+   stack and no zeroing: init_thread_fields() clears the struct
+   thread, and the stack needs no initial contents.  At most
+   THREAD_CACHE_MAX are kept.  Protected by disabling interrupts. */
+#define THREAD_CACHE_MAX 16
+static struct list thread_cache;
+static size_t thread_cache_cnt;
 
 /* Statistics. */
-static long long idle_ticks;    /* # of timer ticks spent idle. */
-static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
-static long long user_ticks;    /* # of timer ticks in user programs. */
+static struct pcounter idle_ticks;   /* # of timer ticks spent idle. */
+static struct pcounter kernel_ticks; /* # of timer ticks in kernel threads. */
+static struct pcounter user_ticks;   /* # of timer ticks in user programs. */
+static long long sched_cnt;       /* # of switches by exited threads. */
+static long long voluntary_cnt;   /* # of blocks and yields by them. */
+static long long involuntary_cnt; /* # of preemptions of them. */
+static long long migrate_cnt;     /* # of moves of them to another CPU. */
+static uint64_t ready_wait_tsc;   /* TSC cycles they spent ready. */
+static uint64_t max_wakeup_tsc;   /* Worst wakeup latency of any thread. */
+static long long thread_page_reuses;      /* # of thread pages reused. */
+static long long idle_write_wakes;        /* # of IPIs saved by IDLE_WAKE. */
+static long long idle_poll_wakes;         /* # of them found while polling. */
+static long long sync_wakes;              /* # of sync wakeups put on the
+                                             waker's CPU. */
 
 /* Scheduling. */
 #define TIME_SLICE 4            /* # of timer ticks to give each thread. */
-static unsigned thread_ticks;   /* # of timer ticks since last yield. */
+#define BALANCE_TICKS 10        /* # of timer ticks between balancing. */
 
-/* If false (default), use round-robin scheduler.
-   If true, use multi-level feedback queue scheduler.
-   Controlled by kernel command-line option "-o mlfqs". */
+/* True if the multi-level feedback queue scheduler is selected,
+   by kernel command-line option "-mlfqs" or "-sched=mlfqs". */
 bool thread_mlfqs;
 
+/* Idling.  An idle CPU that watches its IDLE_WAKE word, by spinning
+   for up to idle_poll_us microseconds and then with MONITOR/MWAIT if
+   the CPU has it, sets IDLE_POLLING, and a CPU that hands it a thread
+   writes the word rather than send an interrupt: the idle thread runs
+   the new thread as soon as it sees the write, without taking an
+   interrupt or a reschedule on its way out.  Without MWAIT, an idle
+   CPU halts once it is done polling, and is woken by an IPI. */
+unsigned idle_poll_us;
+static bool idle_mwait;
+
+/* Number of threads on all run queues. */
+static int ready_threads;
+
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
+static void idle_loop (void) NO_RETURN;
+static void idle_wait (struct cpu *);
+static bool idle_wake (struct cpu *);
+static bool mwait_supported (void);
 static struct thread *next_thread_to_run (void);
+static int select_cpu (struct thread *, bool sync);
+static void unblock (struct thread *, bool sync);
 static void init_thread (struct thread *, const char *name, int priority);
+static void init_thread_fields (struct thread *, const char *name,
+		int priority);
 static void do_schedule(int status);
 static void schedule (void);
 static tid_t allocate_tid (void);
+static void ready_push (struct thread *);
+static void ready_yield (struct thread *);
+static struct thread *ready_pop (struct runqueue *);
+static void ready_remove (struct thread *);
+static void migrate (int from, int to, int cnt);
+static void ipi_reschedule (struct intr_frame *);
+static bool held_lock_less (const struct heap_elem *,
+		const struct heap_elem *, void *aux);
 
 /* Returns true if T appears to point to a valid thread. */
 #define is_thread(t) ((t) != NULL && (t)->magic == THREAD_MAGIC)
 
-/* Returns the running thread.
- * Read the CPU's stack pointer `rsp', and then round that
- * down to the start of a page.  Since `struct thread' is
- * always at the beginning of a page and the stack pointer is
- * somewhere in the middle, this locates the curent thread. */
-#define running_thread() ((struct thread *) (pg_round_down (rrsp ())))
+/* Returns the running thread, the running CPU's current one.
+ * Threads made by thread_create() run on stacks apart from their
+ * struct thread, so it cannot be found from the stack pointer.
+ * schedule() changes it just before switching stacks. */
+#define running_thread() (cpu_current ()->curr)
 
 
 // Global descriptor table for the thread_start.
@@ -85,6 +159,16 @@ static tid_t allocate_tid (void);
 // setup temporal gdt first.
 static uint64_t gdt[3] = { 0, 0x00af9a000000ffff, 0x00cf92000000ffff };
 
+/* Returns true if the CPU has MONITOR and MWAIT, as CPUID leaf 1
+   reports in ECX bit 3. */
+static bool
+mwait_supported (void) {
+	uint32_t regs[4];
+
+	cpuid (1, 0, regs);
+	return (regs[2] & (1u << 3)) != 0;
+}
+
 /* Initializes the threading system by transforming the code
    that's currently running into a thread.  This can't work in
    general and it is possible in this case only because loader.S
@@ -113,15 +197,24 @@ thread_init (void) {
 
 	/* Init the globla thread context */
 	lock_init (&tid_lock);
-	list_init (&ready_list);
-	list_init (&sleep_list);
-	list_init (&destruction_req);
-
-	/* Set up a thread structure for the running thread. */
-	initial_thread = running_thread ();
+	for (int cpu = 0; cpu < CPU_MAX; cpu++)
+		runqueue_init (&runqueues[cpu]);
+	sleep_heap = NULL;
+	list_init (&all_list);
+	lfstack_init (&destruction_req);
+	pcounter_init (&idle_ticks);
+	pcounter_init (&kernel_ticks);
+	pcounter_init (&user_ticks);
+	list_init (&thread_cache);
+	idle_mwait = mwait_supported ();
+
+	/* Set up a thread structure for the running thread, whose
+	   stack is in the page that holds it. */
+	initial_thread = pg_round_down (rrsp ());
 	init_thread (initial_thread, "main", PRI_DEFAULT);
 	initial_thread->status = THREAD_RUNNING;
 	initial_thread->tid = allocate_tid ();
+	cpu_current ()->curr = initial_thread;
 }
 
 /* Starts preemptive thread scheduling by enabling interrupts.
@@ -133,6 +226,9 @@ thread_start (void) {
 	sema_init (&idle_started, 0);
 	thread_create ("idle", PRI_MIN, idle, &idle_started);
 
+	/* Interprocessor interrupt, used once other CPUs run. */
+	intr_register_lapic (IPI_RESCHEDULE, ipi_reschedule, "IPI reschedule");
+
 	/* Start preemptive thread scheduling. */
 	intr_enable ();
 
@@ -140,6 +236,39 @@ thread_start (void) {
 	sema_down (&idle_started);
 }
 
+/* Initializes PAGE as the idle thread, named NAME, of a CPU other
+   than the boot processor, which will run on the stack at the top
+   of PAGE, and returns it.  It is kept off all_list, like every
+   idle thread but the boot processor's, so that the MLFQS and the
+   statistics see a single one. */
+struct thread *
+thread_init_idle (void *page, const char *name) {
+	struct thread *t = page;
+
+	ASSERT (pg_ofs (page) == 0);
+
+	init_thread_fields (t, name, PRI_MIN);
+	t->status = THREAD_RUNNING;
+	t->tid = allocate_tid ();
+	return t;
+}
+
+/* Starts scheduling threads on the running CPU, other than the
+   boot processor, which must hold the interrupt lock.  The CPU
+   starts out in its idle thread, which takes work from the other
+   CPUs' run queues.  Never returns. */
+void
+thread_start_ap (void) {
+	struct cpu *c = cpu_current ();
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	c->idle_thread->cpu = c->id;
+	c->curr = c->idle_thread;
+	c->last_tick = timer_ticks ();
+	idle_loop ();
+}
+
 //
 // CPU -> A
 //
@@ -149,56 +278,376 @@ thread_start (void) {
 //
 //
 
-/* find any thread which needs to be woken up.
-   This function called every timer interrupts occur. */
-void check_thread_woken_up(struct list* sleep_list) {
-    struct list_elem *e = list_begin(sleep_list);
-    int64_t current_tick = timer_ticks(); // Get the current tick count.
+/* Links the sleep heaps rooted at A and B, either of which may
+   be null, and returns the new root. */
+static struct thread *
+sleep_heap_meld (struct thread *a, struct thread *b) {
+	if (a == NULL)
+		return b;
+	if (b == NULL)
+		return a;
+	if (b->wakeup_time < a->wakeup_time) {
+		struct thread *tmp = a;
+		a = b;
+		b = tmp;
+	}
+	b->sleep_sibling = a->sleep_child;
+	if (a->sleep_child != NULL)
+		a->sleep_child->sleep_prev = b;
+	b->sleep_prev = a;
+	a->sleep_child = b;
+	return a;
+}
 
-    while (e != list_end(sleep_list)) {
-        struct thread *t = list_entry(e, struct thread, elem);
-        struct list_elem *next = list_next(e); // Save the next element.
+/* Combines the sibling list starting at FIRST into one heap
+   using the standard two-pass pairing and returns its root. */
+static struct thread *
+sleep_heap_merge_pairs (struct thread *first) {
+	struct thread *pairs = NULL;
+	struct thread *root = NULL;
+
+	/* Left to right: meld adjacent siblings, stacking each pair. */
+	while (first != NULL) {
+		struct thread *a = first;
+		struct thread *b = a->sleep_sibling;
+
+		first = b != NULL ? b->sleep_sibling : NULL;
+		a->sleep_sibling = NULL;
+		if (b != NULL)
+			b->sleep_sibling = NULL;
+
+		a = sleep_heap_meld (a, b);
+		a->sleep_sibling = pairs;
+		pairs = a;
+	}
+
+	/* Right to left: fold the stacked pairs into a single heap. */
+	while (pairs != NULL) {
+		struct thread *next = pairs->sleep_sibling;
 
-        if (t->wakeup_this_tick <= current_tick) {
-            // Remove from sleep_list and unblock the thread.
-            e = list_remove(e);
-            thread_unblock(t);
-        } else {
-            e = next;
-        }
-    }
+		pairs->sleep_sibling = NULL;
+		root = sleep_heap_meld (root, pairs);
+		pairs = next;
+	}
+	if (root != NULL)
+		root->sleep_prev = NULL;
+	return root;
 }
 
-/* Called by the timer interrupt handler at each timer tick.
-   Thus, this function runs in an external interrupt context. */
+/* Is T in the sleep heap?  Only the root has no SLEEP_PREV. */
+static bool
+sleep_heap_contains (struct thread *t) {
+	return t == sleep_heap || t->sleep_prev != NULL;
+}
+
+/* Inserts T, whose wakeup_time is set, into the sleep heap. */
+static void
+sleep_heap_insert (struct thread *t) {
+	t->sleep_child = NULL;
+	t->sleep_sibling = NULL;
+	t->sleep_prev = NULL;
+	sleep_heap = sleep_heap_meld (sleep_heap, t);
+	sleep_heap->sleep_prev = NULL;
+}
+
+/* Removes T from the sleep heap, wherever it is: it is cut out of
+   its parent's child list and its own children are paired up and
+   melded back in at the root. */
+static void
+sleep_heap_remove (struct thread *t) {
+	struct thread *children = sleep_heap_merge_pairs (t->sleep_child);
+
+	if (t == sleep_heap)
+		sleep_heap = children;
+	else {
+		if (t->sleep_prev->sleep_child == t)
+			t->sleep_prev->sleep_child = t->sleep_sibling;
+		else
+			t->sleep_prev->sleep_sibling = t->sleep_sibling;
+		if (t->sleep_sibling != NULL)
+			t->sleep_sibling->sleep_prev = t->sleep_prev;
+		sleep_heap = sleep_heap_meld (sleep_heap, children);
+	}
+	t->sleep_child = t->sleep_sibling = t->sleep_prev = NULL;
+}
+
+/* Wakes up every sleeping thread whose deadline is at or before
+   NOW, a reading of timer_clock().  Called on every timer
+   interrupt, so the common case of nothing being due costs one
+   comparison. */
 void
-thread_tick (void) {
+check_thread_woken_up (int64_t now) {
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	while (sleep_heap != NULL && sleep_heap->wakeup_time <= now) {
+		struct thread *t = sleep_heap;
+
+		sleep_heap = sleep_heap_merge_pairs (t->sleep_child);
+		t->sleep_child = NULL;
+		t->sleep_prev = NULL;
+		t->sleep_woken = true;
+		thread_unblock (t);
+	}
+}
+
+/* Returns the earliest wakeup_time of any sleeping thread, or
+   INT64_MAX if none sleeps.  Interrupts must be off. */
+int64_t
+thread_next_wakeup (void) {
+	ASSERT (intr_get_level () == INTR_OFF);
+	return sleep_heap != NULL ? sleep_heap->wakeup_time : INT64_MAX;
+}
+
+/* Returns the number of threads that CPU C runs or has queued. */
+static int
+cpu_load (const struct cpu *c) {
+	return runqueues[c->id].cnt + (c->curr != c->idle_thread);
+}
+
+/* Returns true if thread T may run on CPU ID, which is online. */
+static bool
+cpu_allowed (const struct thread *t, int id) {
+	return cpus[id].online && (t->affinity & (1u << id)) != 0;
+}
+
+/* Returns the id of the online CPU in MASK with the least load, or
+   -1 if MASK holds no online CPU. */
+static int
+least_loaded_cpu (unsigned mask) {
+	int best = -1, i;
+
+	for (i = 0; i < CPU_MAX; i++)
+		if (cpus[i].online && (mask & (1u << i)) != 0
+				&& (best < 0 || cpu_load (&cpus[i]) < cpu_load (&cpus[best])))
+			best = i;
+	return best;
+}
+
+/* Sets the CPU whose run queue T, which is on none, is to use to ID,
+   counting a migration if T last ran elsewhere. */
+static void
+set_cpu (struct thread *t, int id) {
+	if (t->cpu != id) {
+		t->cpu = id;
+		t->migrate_cnt++;
+	}
+}
+
+/* Returns the CPU that T, which is being made ready, should queue
+   on.  That is the CPU it last ran on, whose cache may still hold
+   its data, if T may run there and no allowed CPU has a lighter load
+   than it.  Under SYNC, the waking thread is about to block, so if
+   nothing else waits on its CPU, T goes there to run next, sharing
+   the cache with the thread that woke it. */
+static int
+select_cpu (struct thread *t, bool sync) {
+	int prev = t->cpu, best;
+
+	if (sync) {
+		int self = cpu_current ()->id;
+
+		if (self != prev && cpu_allowed (t, self)
+				&& runqueues[self].cnt == 0) {
+			sync_wakes++;
+			return self;
+		}
+	}
+	if (cpu_allowed (t, prev) && cpu_load (&cpus[prev]) == 0)
+		return prev;
+	best = least_loaded_cpu (t->affinity);
+	if (best < 0 || (cpu_allowed (t, prev)
+				&& cpu_load (&cpus[prev]) <= cpu_load (&cpus[best])))
+		return prev;
+	return best;
+}
+
+/* Writes the IDLE_WAKE word of idle CPU C, which may be the running
+   one.  Returns true if C is watching the word, and so needs no
+   interrupt.  The fences pair with those in idle_wait(): either this
+   CPU sees C watching, or C sees the write before it halts. */
+static bool
+idle_wake (struct cpu *c) {
+	c->idle_wake = 1;
+	asm volatile ("mfence" : : : "memory");
+	if (!c->idle_polling)
+		return false;
+	idle_write_wakes++;
+	return true;
+}
+
+/* Asks CPU C, if it is another CPU, to look at its run queue
+   right away, if that now holds a thread that should replace the
+   one running. */
+static void
+cpu_kick (struct cpu *c) {
+	if (!c->online)
+		return;
+	if (c->curr == c->idle_thread && idle_wake (c))
+		return;
+	if (c == cpu_current ())
+		return;
+	if (c->curr == c->idle_thread
+			|| sched_preempts (&runqueues[c->id], c->curr))
+		lapic_send_ipi (c->apic_id, IPI_RESCHEDULE);
+}
+
+/* Moves threads from the most loaded CPU's run queue to the least
+   loaded CPU's, until their loads differ by at most one. */
+static void
+balance (void) {
+	int busiest = 0, idlest = 0, diff, i;
+
+	for (i = 1; i < CPU_MAX; i++) {
+		if (!cpus[i].online)
+			continue;
+		if (cpu_load (&cpus[i]) > cpu_load (&cpus[busiest]))
+			busiest = i;
+		if (cpu_load (&cpus[i]) < cpu_load (&cpus[idlest]))
+			idlest = i;
+	}
+	diff = cpu_load (&cpus[busiest]) - cpu_load (&cpus[idlest]);
+	if (diff >= 2) {
+		migrate (busiest, idlest, diff / 2);
+		cpu_kick (&cpus[idlest]);
+	}
+}
+
+/* Interprocessor interrupt sent by cpu_kick(), and by
+   thread_set_affinity() to move a thread off a CPU it may no longer
+   run on. */
+static void
+ipi_reschedule (struct intr_frame *f UNUSED) {
 	struct thread *t = thread_current ();
 
-	/* find threads which need to woken up. */
-	/* Update statistics. */
-	if (t == idle_thread)
-		idle_ticks++;
+	if (t != cpu_current ()->idle_thread
+			&& !cpu_allowed (t, cpu_current ()->id))
+		intr_yield_on_return ();
+	else
+		thread_preempt ();
+}
+
+/* Called by the timer interrupt handler at each timer tick, which
+   interrupted user code if USER is true, on each CPU.
+   Thus, this function runs in an external interrupt context. */
+void
+thread_tick (bool user) {
+	struct thread *t = thread_current ();
+	struct cpu *c = cpu_current ();
+	int64_t now = timer_ticks ();
+	int64_t elapsed = now - c->last_tick;
+
+	/* Update statistics.  A single interrupt may cover several
+	   ticks when the idle thread ran tickless. */
+	c->last_tick = now;
+	if (t == c->idle_thread)
+		pcounter_add (&idle_ticks, elapsed);
 #ifdef USERPROG
 	else if (t->pml4 != NULL)
-		user_ticks++;
+		pcounter_add (&user_ticks, elapsed);
 #endif
 	else
-		kernel_ticks++;
+		pcounter_add (&kernel_ticks, elapsed);
+	if (t != c->idle_thread) {
+		if (user)
+			t->ru.utime += elapsed;
+		else
+			t->ru.stime += elapsed;
+	}
 
-	/* check if any thread needs to be woken up */
-	check_thread_woken_up(&sleep_list);
+	/* The boot processor balances the CPUs' loads. */
+	if (c->id == 0 && cpu_cnt > 1
+			&& now / BALANCE_TICKS != (now - elapsed) / BALANCE_TICKS)
+		balance ();
+
+	sched_tick (t, now, elapsed);
+
+	/* Outside a reader, this CPU holds nothing that RCU protects. */
+	if (t->rcu_nesting == 0)
+		rcu_note_qs ();
 
 	/* Enforce preemption. */
-	if (++thread_ticks >= TIME_SLICE)
+	if (++c->thread_ticks >= TIME_SLICE)
 		intr_yield_on_return ();
 }
 
-/* Prints thread statistics. */
+/* Prints thread statistics: the global tick counts, scheduler
+   totals over all threads, and a line per live thread. */
 void
 thread_print_stats (void) {
+	long long sched = sched_cnt, vol = voluntary_cnt, invol = involuntary_cnt;
+	long long migrate = migrate_cnt;
+	uint64_t wait = ready_wait_tsc;
+	struct list_elem *e;
+	enum intr_level old_level;
+
 	printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
-			idle_ticks, kernel_ticks, user_ticks);
+			(long long) pcounter_read (&idle_ticks),
+			(long long) pcounter_read (&kernel_ticks),
+			(long long) pcounter_read (&user_ticks));
+	printf ("Thread pages: %lld reused, %zu cached\n",
+			thread_page_reuses, thread_cache_cnt);
+	printf ("Idle: %s, %u us polling; %lld wakeups by write, "
+			"%lld while polling\n", idle_mwait ? "mwait" : "hlt",
+			idle_poll_us, idle_write_wakes, idle_poll_wakes);
+	if (thread_mlfqs)
+		mlfqs_print_stats ();
+
+	old_level = intr_disable ();
+	for (e = list_begin (&all_list); e != list_end (&all_list);
+			e = list_next (e)) {
+		struct thread *t = list_entry (e, struct thread, all_elem);
+
+		sched += t->sched_cnt;
+		vol += t->voluntary_cnt;
+		invol += t->involuntary_cnt;
+		wait += t->ready_wait_tsc;
+		migrate += t->migrate_cnt;
+	}
+	intr_set_level (old_level);
+	printf ("Scheduler: %lld switches in, %lld voluntary, %lld involuntary, "
+			"%"PRIu64" cycles ready, %"PRIu64" max wakeup cycles\n",
+			sched, vol, invol, wait, max_wakeup_tsc);
+	printf ("Placement: %lld migrations, %lld sync wakeups on the "
+			"waker's CPU\n", migrate, sync_wakes);
+
+	for (e = list_begin (&all_list); e != list_end (&all_list);
+			e = list_next (e)) {
+		struct thread *t = list_entry (e, struct thread, all_elem);
+
+		printf ("  %s (tid %d): %lld switches in, %lld voluntary, "
+				"%lld involuntary, %"PRIu64" cycles ready, "
+				"%"PRIu64" max wakeup cycles, %lld migrations\n",
+				t->name, t->tid, t->sched_cnt, t->voluntary_cnt,
+				t->involuntary_cnt, t->ready_wait_tsc, t->max_wakeup_tsc,
+				t->migrate_cnt);
+	}
+}
+
+/* Invokes function ACTION on all threads, passing along AUX.
+   This function must be called with interrupts off. */
+void
+thread_foreach (thread_action_func *func, void *aux) {
+	struct list_elem *e;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	for (e = list_begin (&all_list); e != list_end (&all_list);
+			e = list_next (e)) {
+		struct thread *t = list_entry (e, struct thread, all_elem);
+		func (t, aux);
+	}
+}
+
+/* Stores thread T's resource usage so far in *RU. */
+void
+thread_get_rusage (const struct thread *t, struct rusage *ru) {
+	enum intr_level old_level = intr_disable ();
+
+	*ru = t->ru;
+	ru->nvcsw = t->voluntary_cnt;
+	ru->nivcsw = t->involuntary_cnt;
+	ru->nmigrate = t->migrate_cnt;
+	intr_set_level (old_level);
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -219,22 +668,58 @@ thread_print_stats (void) {
 tid_t
 thread_create (const char *name, int priority,
 		thread_func *function, void *aux) {
-	struct thread *t;
+	struct thread *t = NULL;
+	void *kstack = NULL;
+	enum intr_level old_level;
 	tid_t tid;
 
 	ASSERT (function != NULL);
 
-	/* Allocate thread. */
-	t = palloc_get_page (PAL_ZERO);
-	if (t == NULL)
-		return TID_ERROR;
+	/* Allocate thread, preferably from the cache. */
+	old_level = intr_disable ();
+	if (!list_empty (&thread_cache)) {
+		t = list_entry (list_pop_front (&thread_cache), struct thread, elem);
+		kstack = t->kstack;
+		thread_cache_cnt--;
+		thread_page_reuses++;
+	}
+	intr_set_level (old_level);
+	if (t == NULL) {
+		t = palloc_get_page (0);
+		if (t == NULL)
+			return TID_ERROR;
+		kstack = kstack_alloc ();
+		if (kstack == NULL) {
+			palloc_free_page (t);
+			return TID_ERROR;
+		}
+	}
 
-	/* Initialize thread. */
+	/* Initialize thread.  Under the MLFQS, PRIORITY is ignored and
+	   the new thread starts from its creator's nice and recent_cpu;
+	   the idle thread, created before idle_thread is set, keeps
+	   PRI_MIN. */
 	init_thread (t, name, priority);
+	t->kstack = kstack;
+	t->stack_top = (uintptr_t) kstack + KSTACK_SIZE;
 	tid = t->tid = allocate_tid ();
+	if (cpu_current ()->idle_thread != NULL) {
+		old_level = intr_disable ();
+
+		t->nice = thread_current ()->nice;
+		t->vruntime = thread_current ()->vruntime;
+		t->io_class = thread_current ()->io_class;
+		t->affinity = thread_current ()->affinity;
+		if (thread_mlfqs) {
+			t->recent_cpu = thread_current ()->recent_cpu;
+			mlfqs_update_priority (t);
+		}
+		intr_set_level (old_level);
+	}
 
 	/* Call the kernel_thread if it scheduled.
 	 * Note) rdi is 1st argument, and rsi is 2nd argument. */
+	t->tf.rsp = t->stack_top - sizeof (void *);
 	t->tf.rip = (uintptr_t) kernel_thread;
 	t->tf.R.rdi = (uint64_t) function;
 	t->tf.R.rsi = (uint64_t) aux;
@@ -244,9 +729,11 @@ thread_create (const char *name, int priority,
 	t->tf.cs = SEL_KCSEG;
 	t->tf.eflags = FLAG_IF;
 
-
-	/* Add to run queue. */
+	/* Add to the run queue of the least loaded CPU it may use. */
+	t->cpu = least_loaded_cpu (t->affinity);
+	ASSERT (t->cpu >= 0);
 	thread_unblock (t);
+	thread_preempt ();
 
 	return tid;
 }
@@ -272,17 +759,36 @@ thread_block (void) {
    This function does not preempt the running thread.  This can
    be important: if the caller had disabled interrupts itself,
    it may expect that it can atomically unblock a thread and
-   update other data. */
+   update other data.  T goes back to the CPU it last ran on,
+   unless another is less loaded (see select_cpu()), and that CPU
+   is interrupted if T should preempt its thread. */
 void
 thread_unblock (struct thread *t) {
+	unblock (t, false);
+}
+
+/* Like thread_unblock(), for a caller that is about to block, as
+   in a hand-off between two threads that take turns: T may be put
+   on the caller's CPU rather than the one it last ran on, to run
+   there next. */
+void
+thread_unblock_sync (struct thread *t) {
+	unblock (t, true);
+}
+
+/* Makes blocked thread T ready, as a sync wakeup if SYNC. */
+static void
+unblock (struct thread *t, bool sync) {
 	enum intr_level old_level;
 
 	ASSERT (is_thread (t));
 
 	old_level = intr_disable ();
 	ASSERT (t->status == THREAD_BLOCKED);
-	list_push_back (&ready_list, &t->elem);
+	set_cpu (t, select_cpu (t, sync));
+	ready_push (t);
 	t->status = THREAD_READY;
+	cpu_kick (&cpus[t->cpu]);
 	intr_set_level (old_level);
 }
 
@@ -310,9 +816,9 @@ thread_current (void) {
 
 	/* Make sure T is really a thread.
 	   If either of these assertions fire, then your thread may
-	   have overflowed its stack.  Each thread has less than 4 kB
-	   of stack, so a few big automatic arrays or moderate
-	   recursion can cause stack overflow. */
+	   have overflowed its stack.  The initial and idle threads
+	   have less than 4 kB of stack, so a few big automatic arrays
+	   or moderate recursion can cause stack overflow there. */
 	ASSERT (is_thread (t));
 	ASSERT (t->status == THREAD_RUNNING);
 
@@ -334,10 +840,19 @@ thread_exit (void) {
 #ifdef USERPROG
 	process_exit ();
 #endif
+	fpu_release (thread_current ());
+	malloc_flush_tcache ();
+	thread_set_deadline (0, 0, 0);
 
 	/* Just set our status to dying and schedule another process.
 	   We will be destroyed during the call to schedule_tail(). */
 	intr_disable ();
+	list_remove (&thread_current ()->all_elem);
+	sched_cnt += thread_current ()->sched_cnt;
+	voluntary_cnt += thread_current ()->voluntary_cnt;
+	involuntary_cnt += thread_current ()->involuntary_cnt;
+	ready_wait_tsc += thread_current ()->ready_wait_tsc;
+	migrate_cnt += thread_current ()->migrate_cnt;
 	do_schedule (THREAD_DYING);
 	NOT_REACHED ();
 }
@@ -352,16 +867,105 @@ thread_yield (void) {
 	ASSERT (!intr_context ());
 
 	old_level = intr_disable ();
-	if (curr != idle_thread)
-		list_push_back (&ready_list, &curr->elem);
+	if (curr != cpu_current ()->idle_thread)
+		ready_yield (curr);
 	do_schedule (THREAD_READY);
 	intr_set_level (old_level);
 }
 
-/* Sets the current thread's priority to NEW_PRIORITY. */
+/* Yields the CPU on behalf of an external interrupt handler that
+   called intr_yield_on_return().  Like thread_yield(), but the
+   switch is counted as involuntary. */
+void
+thread_yield_on_return (void) {
+	struct thread *curr = thread_current ();
+
+	/* An RCU reader is not preempted; it yields as it leaves. */
+	if (curr->rcu_nesting > 0) {
+		curr->rcu_yield = true;
+		return;
+	}
+	cpu_current ()->yield_preempted = true;
+	thread_yield ();
+}
+
+/* Yields the CPU if the scheduling class says a thread on its run
+   queue should replace the running thread, as under priority
+   scheduling when one has a higher priority.  From an interrupt
+   handler, the yield is deferred until the handler returns. */
+void
+thread_preempt (void) {
+	enum intr_level old_level = intr_disable ();
+	bool yield = sched_preempts (&runqueues[cpu_current ()->id],
+			thread_current ());
+
+	intr_set_level (old_level);
+	if (!yield)
+		return;
+	if (intr_context ())
+		intr_yield_on_return ();
+	else
+		thread_yield ();
+}
+
+/* Sets T's effective priority to PRIORITY, moving T to the
+   matching run queue if it is ready, or repositioning it among
+   the waiters of the semaphore it is blocked on.  Does not
+   preempt.  Must be called with interrupts off. */
+void
+thread_update_priority (struct thread *t, int priority) {
+	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (PRI_MIN <= priority && priority <= PRI_MAX);
+
+	if (priority == t->priority)
+		return;
+	if (t->status == THREAD_READY) {
+		ready_remove (t);
+		t->priority = priority;
+		ready_push (t);
+	} else {
+		int old_priority = t->priority;
+
+		t->priority = priority;
+		if (t->status == THREAD_BLOCKED && t->waiting_sema != NULL)
+			sema_reorder (t->waiting_sema, t, old_priority);
+	}
+}
+
+/* Recomputes T's effective priority as the greater of its base
+   priority and the highest priority donated through any lock it
+   holds.  Must be called with interrupts off. */
+void
+thread_refresh_priority (struct thread *t) {
+	int priority = t->base_priority;
+
+	if (!heap_empty (&t->held_locks)) {
+		struct lock *top = heap_entry (heap_top (&t->held_locks),
+				struct lock, elem);
+
+		if (top->priority > priority)
+			priority = top->priority;
+	}
+	thread_update_priority (t, priority);
+}
+
+/* Sets the current thread's base priority to NEW_PRIORITY.  Its
+   effective priority stays raised while a donation exceeds it. */
 void
 thread_set_priority (int new_priority) {
-	thread_current ()->priority = new_priority;
+	enum intr_level old_level;
+
+	ASSERT (PRI_MIN <= new_priority && new_priority <= PRI_MAX);
+
+	/* The MLFQS computes priorities itself. */
+	if (thread_mlfqs)
+		return;
+
+	old_level = intr_disable ();
+	thread_current ()->base_priority = new_priority;
+	thread_refresh_priority (thread_current ());
+	intr_set_level (old_level);
+	thread_preempt ();
 }
 
 /* Returns the current thread's priority. */
@@ -370,31 +974,129 @@ thread_get_priority (void) {
 	return thread_current ()->priority;
 }
 
-/* Sets the current thread's nice value to NICE. */
+/* Sets the current thread's nice value to NICE and recomputes
+   its priority, yielding if it no longer has the highest. */
 void
-thread_set_nice (int nice UNUSED) {
-	/* TODO: Your implementation goes here */
+thread_set_nice (int nice) {
+	enum intr_level old_level;
+
+	ASSERT (NICE_MIN <= nice && nice <= NICE_MAX);
+
+	old_level = intr_disable ();
+	thread_current ()->nice = nice;
+	if (thread_mlfqs)
+		mlfqs_update_priority (thread_current ());
+	intr_set_level (old_level);
+	thread_preempt ();
 }
 
 /* Returns the current thread's nice value. */
 int
 thread_get_nice (void) {
-	/* TODO: Your implementation goes here */
-	return 0;
+	return thread_current ()->nice;
 }
 
 /* Returns 100 times the system load average. */
 int
 thread_get_load_avg (void) {
-	/* TODO: Your implementation goes here */
-	return 0;
+	return mlfqs_get_load_avg ();
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
 int
 thread_get_recent_cpu (void) {
-	/* TODO: Your implementation goes here */
-	return 0;
+	enum intr_level old_level = intr_disable ();
+	int recent = FP_ROUND (FP_MUL_INT (thread_current ()->recent_cpu, 100));
+
+	intr_set_level (old_level);
+	return recent;
+}
+
+/* Returns the thread whose tid is TID, or the running thread if TID
+   is 0, or a null pointer if there is no such thread that the
+   running thread may change: one in its own process, when that is a
+   user process, and never an idle thread.  Interrupts must be off. */
+static struct thread *
+affinity_target (tid_t tid) {
+	struct thread *curr = thread_current ();
+	struct list_elem *e;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (tid == 0)
+		return curr;
+	for (e = list_begin (&all_list); e != list_end (&all_list);
+			e = list_next (e)) {
+		struct thread *t = list_entry (e, struct thread, all_elem);
+
+		if (t->tid != tid)
+			continue;
+		if (t == cpus[t->cpu].idle_thread)
+			return NULL;
+#ifdef USERPROG
+		if (curr->pml4 != NULL && t->leader != curr->leader)
+			return NULL;
+#endif
+		return t;
+	}
+	return NULL;
+}
+
+/* Restricts the thread whose tid is TID, or the running thread if
+   TID is 0, to the CPUs whose bits are set in MASK.  A ready thread
+   on a CPU it may no longer use moves at once, and one running on
+   such a CPU moves as soon as it is interrupted there.  Returns
+   false, changing nothing, if there is no such thread (see
+   affinity_target()) or MASK holds no online CPU. */
+bool
+thread_set_affinity (tid_t tid, unsigned mask) {
+	enum intr_level old_level = intr_disable ();
+	struct thread *t = affinity_target (tid);
+	bool moved = false;
+
+	mask &= (1u << CPU_MAX) - 1;
+	if (t == NULL || least_loaded_cpu (mask) < 0) {
+		intr_set_level (old_level);
+		return false;
+	}
+	t->affinity = mask;
+	if (!cpu_allowed (t, t->cpu)) {
+		if (t == thread_current ())
+			moved = true;
+		else if (t->status == THREAD_READY) {
+			ready_remove (t);
+			set_cpu (t, select_cpu (t, false));
+			ready_push (t);
+			cpu_kick (&cpus[t->cpu]);
+		} else if (t->status == THREAD_RUNNING)
+			lapic_send_ipi (cpus[t->cpu].apic_id, IPI_RESCHEDULE);
+	}
+	intr_set_level (old_level);
+
+	/* Yielding puts the running thread on a CPU it may use. */
+	if (moved)
+		thread_yield ();
+	return true;
+}
+
+/* Returns the online CPUs in the affinity mask of the thread whose
+   tid is TID, or of the running thread if TID is 0, so that the
+   bits set count the CPUs it can use.  Returns -1 if there is no
+   such thread (see affinity_target()). */
+int
+thread_get_affinity (tid_t tid) {
+	enum intr_level old_level = intr_disable ();
+	struct thread *t = affinity_target (tid);
+	int mask = -1, i;
+
+	if (t != NULL) {
+		mask = 0;
+		for (i = 0; i < CPU_MAX; i++)
+			if (cpu_allowed (t, i))
+				mask |= 1 << i;
+	}
+	intr_set_level (old_level);
+	return mask;
 }
 
 /* Idle thread.  Executes when no other thread is ready to run.
@@ -405,33 +1107,85 @@ thread_get_recent_cpu (void) {
    to it to enable thread_start() to continue, and immediately
    blocks.  After that, the idle thread never appears in the
    ready list.  It is returned by next_thread_to_run() as a
-   special case when the ready list is empty. */
+   special case when the ready list is empty.
+
+   The other CPUs' idle threads are made by thread_init_idle()
+   instead, and enter idle_loop() from thread_start_ap(). */
 static void
 idle (void *idle_started_ UNUSED) {
 	struct semaphore *idle_started = idle_started_;
 
-	idle_thread = thread_current ();
+	cpu_current ()->idle_thread = thread_current ();
 	sema_up (idle_started);
+	idle_loop ();
+}
 
+/* Body of each CPU's idle thread. */
+static void
+idle_loop (void) {
 	for (;;) {
 		/* Let someone else run. */
 		intr_disable ();
 		thread_block ();
 
-		/* Re-enable interrupts and wait for the next one.
+		/* Spend otherwise idle time clearing free user pages, so
+		   PAL_ZERO allocations find them ready.  Any thread woken
+		   meanwhile preempts us. */
+		intr_enable ();
+		while (palloc_zero_idle ())
+			continue;
+		intr_disable ();
+
+		/* Wait for the next interrupt, or for a thread. */
+		timer_idle_enter (thread_next_wakeup ());
+		intr_lock_release ();
+		idle_wait (cpu_current ());
+	}
+}
 
-		   The `sti' instruction disables interrupts until the
-		   completion of the next instruction, so these two
-		   instructions are executed atomically.  This atomicity is
-		   important; otherwise, an interrupt could be handled
-		   between re-enabling interrupts and waiting for the next
-		   one to occur, wasting as much as one clock tick worth of
-		   time.
+/* Waits, with interrupts off and the interrupt lock released, for an
+   interrupt or for another CPU to write C's IDLE_WAKE word, and
+   returns with interrupts on.
 
-		   See [IA32-v2a] "HLT", [IA32-v2b] "STI", and [IA32-v3a]
-		   7.11.1 "HLT Instruction". */
-		asm volatile ("sti; hlt" : : : "memory");
+   The `sti' instruction disables interrupts until the completion
+   of the next instruction, so `sti; hlt' and `sti; mwait' are
+   executed atomically.  This atomicity is important; otherwise, an
+   interrupt could be handled between re-enabling interrupts and
+   waiting for the next one to occur, wasting as much as one clock
+   tick worth of time.
+
+   See [IA32-v2a] "HLT", [IA32-v2b] "MWAIT", [IA32-v2b] "STI", and
+   [IA32-v3a] 7.11.1 "HLT Instruction". */
+static void
+idle_wait (struct cpu *c) {
+	c->idle_wake = 0;
+	c->idle_polling = idle_mwait || idle_poll_us > 0;
+	asm volatile ("mfence" : : : "memory");
+
+	if (idle_poll_us > 0 && !c->idle_wake) {
+		int64_t deadline = timer_ns () + idle_poll_us * 1000LL;
+
+		asm volatile ("sti" : : : "memory");
+		while (!c->idle_wake && timer_ns () < deadline)
+			asm volatile ("pause" : : : "memory");
+		asm volatile ("cli" : : : "memory");
+		if (c->idle_wake)
+			idle_poll_wakes++;
 	}
+	if (idle_mwait) {
+		monitor (&c->idle_wake);
+		if (!c->idle_wake)
+			asm volatile ("sti; mwait" : : "a" (0), "c" (0) : "memory");
+	} else if (c->idle_polling) {
+		/* Halting: have the next kick send an interrupt. */
+		c->idle_polling = false;
+		asm volatile ("mfence" : : : "memory");
+		if (!c->idle_wake)
+			asm volatile ("sti; hlt" : : : "memory");
+	} else
+		asm volatile ("sti; hlt" : : : "memory");
+	asm volatile ("sti" : : : "memory");
+	c->idle_polling = false;
 }
 
 /* Function used as the basis for a kernel thread. */
@@ -446,9 +1200,21 @@ kernel_thread (thread_func *function, void *aux) {
 
 
 /* Does basic initialization of T as a blocked thread named
-   NAME. */
+   NAME, and adds it to all_list. */
 static void
 init_thread (struct thread *t, const char *name, int priority) {
+	enum intr_level old_level;
+
+	init_thread_fields (t, name, priority);
+
+	old_level = intr_disable ();
+	list_push_back (&all_list, &t->all_elem);
+	intr_set_level (old_level);
+}
+
+/* Initializes the members of T as a blocked thread named NAME. */
+static void
+init_thread_fields (struct thread *t, const char *name, int priority) {
 	ASSERT (t != NULL);
 	ASSERT (PRI_MIN <= priority && priority <= PRI_MAX);
 	ASSERT (name != NULL);
@@ -456,31 +1222,186 @@ init_thread (struct thread *t, const char *name, int priority) {
 	memset (t, 0, sizeof *t);
 	t->status = THREAD_BLOCKED;
 	strlcpy (t->name, name, sizeof t->name);
-	t->tf.rsp = (uint64_t) t + PGSIZE - sizeof (void *);
-	t->priority = priority;
+	t->stack_top = (uintptr_t) t + PGSIZE;
+	t->tf.rsp = t->stack_top - sizeof (void *);
+	t->priority = t->base_priority = priority;
+	heap_init (&t->held_locks, held_lock_less, NULL);
+	t->nice = NICE_DEFAULT;
+	t->recent_cpu = 0;
+	t->affinity = (1u << CPU_MAX) - 1;
 	t->magic = THREAD_MAGIC;
+#ifdef USERPROG
+	t->leader = t;
+	sema_init (&t->clones_done, 0);
+	fd_table_init (&t->fds);
+	lock_init (&t->children_lock);
+#endif
+}
+
+/* Orders locks by the priority donated through them, for a
+   thread's held_locks heap. */
+static bool
+held_lock_less (const struct heap_elem *a_, const struct heap_elem *b_,
+		void *aux UNUSED) {
+	const struct lock *a = heap_entry (a_, struct lock, elem);
+	const struct lock *b = heap_entry (b_, struct lock, elem);
+
+	return a->priority < b->priority;
+}
+
+/* Puts T on the run queue of CPU T->cpu. */
+static void
+ready_push (struct thread *t) {
+	struct runqueue *rq = &runqueues[t->cpu];
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	sched_enqueue (rq, t);
+	rq->cnt++;
+	ready_threads++;
+	t->ready_tsc = rdtsc ();
+}
+
+/* Puts T, the running thread, back on its CPU's run queue as it
+   yields, or on another CPU's if its affinity no longer allows its
+   own. */
+static void
+ready_yield (struct thread *t) {
+	struct runqueue *rq;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (!cpu_allowed (t, t->cpu)) {
+		set_cpu (t, select_cpu (t, false));
+		ready_push (t);
+		cpu_kick (&cpus[t->cpu]);
+		return;
+	}
+	rq = &runqueues[t->cpu];
+	sched_yield (rq, t);
+	rq->cnt++;
+	ready_threads++;
+	t->ready_tsc = rdtsc ();
+}
+
+/* Removes ready thread T from its run queue. */
+static void
+ready_remove (struct thread *t) {
+	struct runqueue *rq = &runqueues[t->cpu];
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (t->status == THREAD_READY);
+
+	sched_dequeue (rq, t);
+	rq->cnt--;
+	ready_threads--;
+}
+
+/* Removes and returns the thread RQ should run next, or returns a
+   null pointer if RQ is empty. */
+static struct thread *
+ready_pop (struct runqueue *rq) {
+	struct thread *t;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	t = sched_pick_next (rq);
+	if (t != NULL) {
+		rq->cnt--;
+		ready_threads--;
+	}
+	return t;
+}
+
+/* Returns the number of threads on all run queues. */
+int
+thread_ready_cnt (void) {
+	return ready_threads;
+}
+
+/* Moves up to CNT threads that may run on CPU TO, in the order the
+   scheduling class would run them, from the run queue of CPU FROM to
+   that of CPU TO. */
+static void
+migrate (int from, int to, int cnt) {
+	struct list pinned;
+	struct thread *t;
+
+	list_init (&pinned);
+	while (cnt > 0 && (t = ready_pop (&runqueues[from])) != NULL) {
+		if (cpu_allowed (t, to)) {
+			uint64_t ready_tsc = t->ready_tsc;
+
+			set_cpu (t, to);
+			ready_push (t);
+			t->ready_tsc = ready_tsc;
+			cnt--;
+		} else
+			list_push_back (&pinned, &t->elem);
+	}
+
+	/* Put back the threads that must stay. */
+	while (!list_empty (&pinned)) {
+		uint64_t ready_tsc;
+
+		t = list_entry (list_pop_front (&pinned), struct thread, elem);
+		ready_tsc = t->ready_tsc;
+		ready_push (t);
+		t->ready_tsc = ready_tsc;
+	}
+}
+
+/* Refills the empty run queue of CPU ID with half of the threads
+   on the fullest other run queue, if any. */
+static void
+steal (int id) {
+	int victim = -1, i;
+
+	for (i = 0; i < CPU_MAX; i++)
+		if (i != id && cpus[i].online && runqueues[i].cnt > 0
+				&& (victim < 0 || runqueues[i].cnt > runqueues[victim].cnt))
+			victim = i;
+	if (victim >= 0)
+		migrate (victim, id, (runqueues[victim].cnt + 1) / 2);
 }
 
 /* Chooses and returns the next thread to be scheduled.  Should
    return a thread from the run queue, unless the run queue is
    empty.  (If the running thread can continue running, then it
-   will be in the run queue.)  If the run queue is empty, return
-   idle_thread. */
+   will be in the run queue.)  If the run queue is empty, and
+   another CPU's has nothing to spare, return idle_thread. */
 static struct thread *
 next_thread_to_run (void) {
-	if (list_empty (&ready_list))
-		return idle_thread;
-	else
-		return list_entry (list_pop_front (&ready_list), struct thread, elem);
+	struct cpu *c = cpu_current ();
+	struct runqueue *rq = &runqueues[c->id];
+	struct thread *t;
+
+	if (rq->cnt == 0 && cpu_cnt > 1)
+		steal (c->id);
+	t = ready_pop (rq);
+	return t != NULL ? t : c->idle_thread;
 }
 
 /* Use iretq to launch the thread */
 void do_iret(struct intr_frame *tf) {
 	/* Function to safely return from an interrupt or system call using inline assembly. */
     __asm __volatile(
+        /* Keep interrupts off until iretq restores the saved flags, so that none
+           arrives after the swapgs below with the user's GS base loaded. */
+        "cli\n"
         /* Move the address contained in tf (pointer to struct intr_frame) into the stack pointer (rsp).
            This sets up the stack to point to the interrupt frame structure. */
         "movq %0, %%rsp\n" //%0 means tf
+        /* If the frame turns interrupts on, release the interrupt lock (see
+           interrupt.c) if this CPU holds it.  This waits until here, off the
+           stack of the thread switched from, which may be dying. */
+        "testl %1, 168(%%rsp)\n"
+        "jz 2f\n"
+        "movl %%gs:%c2, %%eax\n"
+        "cmpl intr_lock_owner(%%rip), %%eax\n"
+        "jne 2f\n"
+        "movl $-1, intr_lock_owner(%%rip)\n"
+        "2:\n"
         /* Restore the values of general-purpose registers from the stack.
            The offset from rsp indicates each register's value position within struct intr_frame. */
         "movq 0(%%rsp),%%r15\n"
@@ -505,82 +1426,65 @@ void do_iret(struct intr_frame *tf) {
         "movw (%%rsp),%%es\n"
         /* Further adjust the stack pointer for the iretq instruction, aligning the stack correctly. */
         "addq $32, %%rsp\n"
+        /* When returning to user mode, swap the kernel's GS base (see threads/cpu.h)
+           for the user's. */
+        "testb $3, 8(%%rsp)\n"
+        "jz 1f\n"
+        "swapgs\n"
+        "1:\n"
         /* Execute the iretq instruction to return from the interrupt or system call.
            This pops the IP, CS selector, and flags register values from the stack, resuming execution. */
         "iretq"
         : /* No output operands */
-        : "g" ((uint64_t) tf) /* Input operand: pointer to struct intr_frame */
+        : "g" ((uint64_t) tf), /* Input operand: pointer to struct intr_frame */
+          "i" (FLAG_IF), "i" (CPU_ID)
         : "memory" /* Clobbers memory to prevent optimizations */
     );
 }
 
-/* Switching the thread by activating the new thread's page
-   tables, and, if the previous thread is dying, destroying it.
+/* Switches from thread CURR, the running thread, to TH.
 
-   At this function's invocation, we just switched from thread
-   PREV, the new thread is already running, and interrupts are
-   still disabled.
+   A thread that has run before was switched out here too, so only
+   what C code expects a call to preserve needs saving: the
+   callee-saved registers go on CURR's own stack, and the stack
+   pointer into CURR->switch_rsp.  Switching back pops them from
+   TH's stack and returns into TH's own call of this function.  A
+   new thread has no such stack yet, so it starts from its TF with
+   do_iret(), which also releases the interrupt lock as the thread
+   turns interrupts on.
 
-   It's not safe to call printf() until the thread switch is
-   complete.  In practice that means that printf()s should be
-   added at the end of the function. */
+   At this function's invocation interrupts are disabled.  It's not
+   safe to call printf() until the thread switch is complete. */
 static void
-thread_launch (struct thread *th) {
-	uint64_t tf_cur = (uint64_t) &running_thread ()->tf;
-	uint64_t tf = (uint64_t) &th->tf;
+thread_launch (struct thread *curr, struct thread *th) {
 	ASSERT (intr_get_level () == INTR_OFF);
 
-	/* The main switching logic.
-	 * We first restore the whole execution context into the intr_frame
-	 * and then switching to the next thread by calling do_iret.
-	 * Note that, we SHOULD NOT use any stack from here
-	 * until switching is done. */
 	__asm __volatile (
-			/* Store registers that will be used. */
-			"push %%rax\n"
+			"push %%rbp\n"
 			"push %%rbx\n"
-			"push %%rcx\n"
-			/* Fetch input once */
-			"movq %0, %%rax\n"
-			"movq %1, %%rcx\n"
-			"movq %%r15, 0(%%rax)\n"
-			"movq %%r14, 8(%%rax)\n"
-			"movq %%r13, 16(%%rax)\n"
-			"movq %%r12, 24(%%rax)\n"
-			"movq %%r11, 32(%%rax)\n"
-			"movq %%r10, 40(%%rax)\n"
-			"movq %%r9, 48(%%rax)\n"
-			"movq %%r8, 56(%%rax)\n"
-			"movq %%rsi, 64(%%rax)\n"
-			"movq %%rdi, 72(%%rax)\n"
-			"movq %%rbp, 80(%%rax)\n"
-			"movq %%rdx, 88(%%rax)\n"
-			"pop %%rbx\n"              // Saved rcx
-			"movq %%rbx, 96(%%rax)\n"
-			"pop %%rbx\n"              // Saved rbx
-			"movq %%rbx, 104(%%rax)\n"
-			"pop %%rbx\n"              // Saved rax
-			"movq %%rbx, 112(%%rax)\n"
-			"addq $120, %%rax\n"
-			"movw %%es, (%%rax)\n"
-			"movw %%ds, 8(%%rax)\n"
-			"addq $32, %%rax\n"
-			"call __next\n"         // read the current rip.
-			"__next:\n"
+			"push %%r12\n"
+			"push %%r13\n"
+			"push %%r14\n"
+			"push %%r15\n"
+			"movq %%rsp, (%0)\n"      // Save our stack pointer
+			"movq (%1), %%rax\n"
+			"testq %%rax, %%rax\n"
+			"jz 1f\n"                  // TH has never run
+			"movq %%rax, %%rsp\n"      // Switch to TH's stack
+			"pop %%r15\n"
+			"pop %%r14\n"
+			"pop %%r13\n"
+			"pop %%r12\n"
 			"pop %%rbx\n"
-			"addq $(out_iret -  __next), %%rbx\n"
-			"movq %%rbx, 0(%%rax)\n" // rip
-			"movw %%cs, 8(%%rax)\n"  // cs
-			"pushfq\n"
-			"popq %%rbx\n"
-			"mov %%rbx, 16(%%rax)\n" // eflags
-			"mov %%rsp, 24(%%rax)\n" // rsp
-			"movw %%ss, 32(%%rax)\n"
-			"mov %%rcx, %%rdi\n"
-			"call do_iret\n"
-			"out_iret:\n"
-			: : "g"(tf_cur), "g" (tf) : "memory"
-			);
+			"pop %%rbp\n"
+			"jmp 2f\n"
+			"1:\n"
+			"movq %2, %%rdi\n"
+			"call do_iret\n"           // Does not return
+			"2:\n"
+			: : "r" (&curr->switch_rsp), "r" (&th->switch_rsp), "r" (&th->tf)
+			: "rax", "rcx", "rdx", "rsi", "rdi", "r8", "r9", "r10", "r11",
+			  "cc", "memory");
 }
 
 /* Schedules a new process. At entry, interrupts must be off.
@@ -589,12 +1493,21 @@ thread_launch (struct thread *th) {
  * It's not safe to call printf() in the schedule(). */
 static void
 do_schedule(int status) {
+	struct lfstack_elem *e;
+
 	ASSERT (intr_get_level () == INTR_OFF);
 	ASSERT (thread_current()->status == THREAD_RUNNING);
-	while (!list_empty (&destruction_req)) {
-		struct thread *victim =
-			list_entry (list_pop_front (&destruction_req), struct thread, elem);
-		palloc_free_page(victim);
+	for (e = lfstack_pop_all (&destruction_req); e != NULL; ) {
+		struct thread *victim = lfstack_entry (e, struct thread, dead_elem);
+
+		e = e->next;
+		if (thread_cache_cnt < THREAD_CACHE_MAX) {
+			list_push_front (&thread_cache, &victim->elem);
+			thread_cache_cnt++;
+		} else {
+			kstack_free (victim->kstack);
+			palloc_free_page (victim);
+		}
 	}
 	thread_current ()->status = status;
 	schedule ();
@@ -602,17 +1515,60 @@ do_schedule(int status) {
 
 static void
 schedule (void) {
+	struct cpu *c = cpu_current ();
 	struct thread *curr = running_thread ();
 	struct thread *next = next_thread_to_run ();
+	bool preempted = c->yield_preempted;
 
 	ASSERT (intr_get_level () == INTR_OFF);
 	ASSERT (curr->status != THREAD_RUNNING);
 	ASSERT (is_thread (next));
+	ASSERT (curr->rcu_nesting == 0);
+
+	c->yield_preempted = false;
+	rcu_note_qs ();
+
+	/* Leaving the idle thread: restore the periodic tick and
+	   charge any ticks it slept through to idle time. */
+	if (curr == c->idle_thread) {
+		int64_t now;
+
+		timer_idle_exit ();
+		now = timer_ticks ();
+		pcounter_add (&idle_ticks, now - c->last_tick);
+		c->last_tick = now;
+	}
+
+	/* Update scheduling statistics. */
+	if (next != curr) {
+		if (curr->status == THREAD_READY && preempted)
+			curr->involuntary_cnt++;
+		else if (curr->status != THREAD_DYING)
+			curr->voluntary_cnt++;
+
+		next->sched_cnt++;
+		if (next->ready_tsc != 0) {
+			uint64_t wait = rdtsc () - next->ready_tsc;
+
+			next->ready_wait_tsc += wait;
+			if (next->sleep_woken && wait > next->max_wakeup_tsc) {
+				next->max_wakeup_tsc = wait;
+				if (wait > max_wakeup_tsc)
+					max_wakeup_tsc = wait;
+			}
+		}
+	}
+	next->ready_tsc = 0;
+	next->sleep_woken = false;
+
 	/* Mark us as running. */
 	next->status = THREAD_RUNNING;
+	next->cpu = c->id;
+	c->curr = next;
+	fpu_switch (curr, next);
 
 	/* Start new time slice. */
-	thread_ticks = 0;
+	c->thread_ticks = 0;
 
 #ifdef USERPROG
 	/* Activate the new address space. */
@@ -629,23 +1585,61 @@ schedule (void) {
 		   schedule(). */
 		if (curr && curr->status == THREAD_DYING && curr != initial_thread) {
 			ASSERT (curr != next);
-			list_push_back (&destruction_req, &curr->elem);
+			lfstack_push (&destruction_req, &curr->dead_elem);
 		}
 
 		/* Before switching the thread, we first save the information
 		 * of current running. */
-		thread_launch (next);
+		TRACE (SWITCH, curr->tid, next->tid, curr->status);
+		thread_launch (curr, next);
 	}
 }
 
+/* Blocks TARGET, which must be the running thread, until
+   timer_clock() reaches its wakeup_time. */
 void thread_sleep(struct thread* target){
 	enum intr_level curr_intr_levl;
+
+	ASSERT (target == thread_current ());
 	curr_intr_levl = intr_disable(); //disable interrupts.
-	list_push_back(&sleep_list, &target -> elem);
+	sleep_heap_insert (target);
+	timer_arm (target->wakeup_time);
 	thread_block();
 	intr_set_level(curr_intr_levl); //enable interrupts.
 }
 
+/* Blocks the running thread until thread_wake() is called on it or
+   timer_clock() reaches DEADLINE, whichever comes first.  A DEADLINE
+   of INT64_MAX never comes.  Interrupts must be off, so that the
+   caller can check the condition it waits for and go to sleep
+   without a wakeup slipping in between. */
+void
+thread_block_until (int64_t deadline) {
+	struct thread *curr = thread_current ();
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	if (deadline != INT64_MAX) {
+		curr->wakeup_time = deadline;
+		sleep_heap_insert (curr);
+		timer_arm (deadline);
+	}
+	thread_block ();
+}
+
+/* Wakes T if it is still blocked in thread_block_until(), taking it
+   off the sleep queue if it has a deadline.  Does nothing if it has
+   already been woken, by its deadline or otherwise.  Interrupts must
+   be off. */
+void
+thread_wake (struct thread *t) {
+	ASSERT (intr_get_level () == INTR_OFF);
+	if (t->status != THREAD_BLOCKED)
+		return;
+	if (sleep_heap_contains (t))
+		sleep_heap_remove (t);
+	thread_unblock (t);
+}
+
 /* Returns a tid to use for a new thread. */
 static tid_t
 allocate_tid (void) {
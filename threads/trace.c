@@ -0,0 +1,178 @@
+#include "threads/trace.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/cpu.h"
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "devices/disk.h"
+#include "devices/timer.h"
+#include "intrinsic.h"
+
+/* Tracing.
+
+   Each TRACE() in a kernel built with -DTRACING, run with
+   "-trace", stores a record in a ring buffer that keeps the latest
+   TRACE_RECORDS of them.  A writer claims its slot with a single
+   atomic add, so tracepoints take no lock and may fire in
+   interrupt handlers; the machine has one CPU, so one ring serves
+   as the per-CPU buffer.  At power off the records, oldest first,
+   are written to the end of the scratch disk (hd1:0), for
+   `pintos --trace FILE' to copy out and utils/tracedump to turn
+   into a timeline.
+
+   The last sector of the scratch disk receives a struct
+   trace_header and the records fill the sectors just before it. */
+
+bool trace_enabled;             /* Set by "-trace". */
+
+#ifdef TRACING
+/* Pages of records. */
+#define TRACE_PAGES 128
+
+#define TRACE_RECORDS (TRACE_PAGES * PGSIZE / sizeof (struct trace_record))
+
+/* Written to the last sector of the scratch disk. */
+struct trace_header {
+	char magic[4];              /* "TRC\0". */
+	uint32_t record_size;       /* sizeof (struct trace_record). */
+	uint64_t record_cnt;        /* Records that follow. */
+	uint64_t lost_cnt;          /* Older records overwritten or cut. */
+	uint64_t tsc_hz;            /* Time stamp counter frequency. */
+};
+
+static struct trace_record *records;   /* Ring buffer, or null if off. */
+static uint64_t next_record;    /* Records ever claimed. */
+static uint64_t start_tsc;      /* Time stamp at trace_init(). */
+static int64_t start_ticks;     /* Timer ticks at trace_init(). */
+
+/* Allocates the ring buffer, if tracing was asked for.  Must run
+   after the timer is started, which it uses to calibrate the time
+   stamp counter. */
+void
+trace_init (void) {
+	if (!trace_enabled)
+		return;
+	records = palloc_get_multiple (PAL_ZERO, TRACE_PAGES);
+	if (records == NULL) {
+		printf ("trace: no memory for records, tracing disabled\n");
+		trace_enabled = false;
+		return;
+	}
+	start_tsc = rdtsc ();
+	start_ticks = timer_ticks ();
+}
+
+/* Records EVENT with arguments A, B and C. */
+void
+trace_emit (enum trace_event event, uint64_t a, uint64_t b, uint64_t c) {
+	struct trace_record *r;
+	uint64_t idx;
+
+	if (!trace_enabled || records == NULL)
+		return;
+
+	idx = __atomic_fetch_add (&next_record, 1, __ATOMIC_RELAXED);
+	r = &records[idx % TRACE_RECORDS];
+	r->tsc = rdtsc ();
+	r->event = event;
+	/* Not thread_current(), which insists that the thread be
+	   running: schedule() traces once it has switched to the next
+	   one. */
+	r->tid = cpu_current ()->curr->tid;
+	r->args[0] = a;
+	r->args[1] = b;
+	r->args[2] = c;
+}
+
+/* Appends the SIZE bytes at DATA to the sector in BUF, of which
+   *FILL bytes are used, writing each sector to D at *SEC as it
+   fills up. */
+static void
+dump_bytes (struct disk *d, disk_sector_t *sec, uint8_t *buf, size_t *fill,
+		const void *data, size_t size) {
+	const uint8_t *p = data;
+
+	while (size > 0) {
+		size_t chunk = DISK_SECTOR_SIZE - *fill;
+
+		if (chunk > size)
+			chunk = size;
+		memcpy (buf + *fill, p, chunk);
+		*fill += chunk;
+		p += chunk;
+		size -= chunk;
+		if (*fill == DISK_SECTOR_SIZE) {
+			disk_write (d, (*sec)++, buf);
+			*fill = 0;
+		}
+	}
+}
+
+/* Stops tracing and writes the records to the scratch disk, if
+   there is one.  Records that do not fit in front of the header
+   sector are dropped, oldest first. */
+void
+trace_dump (void) {
+	static uint8_t buf[DISK_SECTOR_SIZE];
+	struct trace_header *h = (struct trace_header *) buf;
+	uint64_t cnt, lost, max, i, hz = 0;
+	int64_t ticks;
+	struct disk *d;
+	disk_sector_t cap, sec;
+	size_t fill = 0;
+
+	if (records == NULL)
+		return;
+	trace_enabled = false;
+
+	d = disk_get (1, 0);
+	if (d == NULL || intr_context () || intr_get_level () == INTR_OFF) {
+		printf ("Trace: %"PRIu64" records not saved\n", next_record);
+		return;
+	}
+
+	cnt = next_record < TRACE_RECORDS ? next_record : TRACE_RECORDS;
+	cap = disk_size (d);
+	max = cap > 1
+		? (uint64_t) (cap - 1) * DISK_SECTOR_SIZE / sizeof *records : 0;
+	if (cnt > max)
+		cnt = max;
+	lost = next_record - cnt;
+
+	/* Records go right before the header, in the last sector. */
+	sec = cap - 1 - DIV_ROUND_UP (cnt * sizeof *records, DISK_SECTOR_SIZE);
+	for (i = 0; i < cnt; i++)
+		dump_bytes (d, &sec, buf, &fill, &records[(lost + i) % TRACE_RECORDS],
+				sizeof *records);
+	if (fill > 0) {
+		memset (buf + fill, 0, DISK_SECTOR_SIZE - fill);
+		disk_write (d, sec++, buf);
+	}
+	ASSERT (sec == cap - 1);
+
+	ticks = timer_ticks () - start_ticks;
+	if (ticks > 0)
+		hz = (rdtsc () - start_tsc) / ticks * TIMER_FREQ;
+	memset (buf, 0, sizeof buf);
+	memcpy (h->magic, "TRC", 4);
+	h->record_size = sizeof *records;
+	h->record_cnt = cnt;
+	h->lost_cnt = lost;
+	h->tsc_hz = hz;
+	disk_write (d, sec, buf);
+
+	printf ("Trace: %"PRIu64" records saved, %"PRIu64" lost\n", cnt, lost);
+}
+#else /* !TRACING */
+/* Warns that "-trace" has no effect on this kernel. */
+void
+trace_init (void) {
+	if (trace_enabled)
+		printf ("trace: kernel built without TRACING, -trace ignored\n");
+}
+#endif /* TRACING */
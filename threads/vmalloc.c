@@ -0,0 +1,159 @@
+#include "threads/vmalloc.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/init.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Virtually contiguous allocations.
+
+   The page allocator hands out runs of physically contiguous
+   pages, which grow scarce as memory fragments long before it
+   runs out.  vmalloc() instead takes single pages from the kernel
+   pool, wherever they are, and maps them one after another in a
+   region of kernel virtual memory of its own, above the mapping of
+   physical memory and below the kernel stacks (see kstack.c).
+
+   The region lies under the same PML4 entry as the rest of the
+   kernel, which every page table shares, so a page table made for
+   it here is seen by every address space.  Page tables are made as
+   the region is first used and never freed.  The pages are global,
+   so that unmapping them drops them from the TLB under every PCID.
+
+   Each allocation is followed by an unmapped guard page, which
+   catches overruns and marks the end of the allocation for
+   vfree().  As with kernel stacks, vtop() does not apply in the
+   region; pci_dma_addr() looks up its page tables. */
+
+/* Start of the region and number of pages in it. */
+#define VMALLOC_BASE 0xc000000000ULL
+#define VMALLOC_PAGES 65536
+
+/* Pages of the region in use, guard pages included. */
+static struct bitmap *used_pages;
+static struct lock vmalloc_lock;
+
+/* Statistics. */
+static size_t vmalloc_cnt;      /* # of pages mapped. */
+static size_t vmalloc_peak;     /* Most pages mapped at once. */
+static long long vmalloc_fail_cnt;  /* Allocations that failed. */
+
+/* Sets up the region.  Must be called after paging_init() and
+   malloc_init().  Until it is, vmalloc() fails. */
+void
+vmalloc_init (void) {
+	lock_init (&vmalloc_lock);
+	used_pages = bitmap_create (VMALLOC_PAGES);
+	if (used_pages == NULL)
+		PANIC ("vmalloc: cannot allocate page map");
+}
+
+/* Returns the address of page IDX of the region. */
+static uint8_t *
+page_va (size_t idx) {
+	return (uint8_t *) VMALLOC_BASE + idx * PGSIZE;
+}
+
+/* Unmaps the CNT pages from VA and frees their frames. */
+static void
+unmap_pages (uint8_t *va, size_t cnt) {
+	void *kpages[TLB_BATCH_MAX];
+
+	while (cnt > 0) {
+		size_t chunk = cnt < TLB_BATCH_MAX ? cnt : TLB_BATCH_MAX;
+		size_t i;
+
+		pml4_clear_kernel_pages (va, chunk, kpages);
+		for (i = 0; i < chunk; i++)
+			palloc_free_page (kpages[i]);
+		va += chunk * PGSIZE;
+		cnt -= chunk;
+	}
+}
+
+/* Allocates PAGE_CNT pages of kernel memory that are contiguous in
+   virtual memory, but not necessarily in physical memory, and
+   returns the first, or a null pointer if memory or the region run
+   short.  Their contents are unspecified.  Must not be called with
+   interrupts off. */
+void *
+vmalloc (size_t page_cnt) {
+	size_t start, i;
+
+	if (used_pages == NULL || page_cnt == 0)
+		return NULL;
+
+	lock_acquire (&vmalloc_lock);
+	start = bitmap_scan_and_flip (used_pages, 0, page_cnt + 1, false);
+	if (start == BITMAP_ERROR)
+		goto fail;
+	for (i = 0; i < page_cnt; i++) {
+		uint8_t *va = page_va (start + i);
+		void *kpage = palloc_get_page (0);
+
+		if (kpage == NULL
+				|| pml4e_walk (base_pml4, (uint64_t) va, 1) == NULL) {
+			if (kpage != NULL)
+				palloc_free_page (kpage);
+			unmap_pages (page_va (start), i);
+			bitmap_set_multiple (used_pages, start, page_cnt + 1, false);
+			goto fail;
+		}
+		pml4_set_kernel_page (va, kpage);
+	}
+	vmalloc_cnt += page_cnt;
+	if (vmalloc_cnt > vmalloc_peak)
+		vmalloc_peak = vmalloc_cnt;
+	lock_release (&vmalloc_lock);
+	return page_va (start);
+
+fail:
+	vmalloc_fail_cnt++;
+	lock_release (&vmalloc_lock);
+	return NULL;
+}
+
+/* Frees the pages at VA, which vmalloc() returned. */
+void
+vfree (void *va) {
+	size_t start = ((uint64_t) va - VMALLOC_BASE) / PGSIZE;
+	size_t cnt = 0;
+
+	ASSERT (vmalloc_contains (va) && pg_ofs (va) == 0);
+
+	/* The allocation runs up to its guard page. */
+	lock_acquire (&vmalloc_lock);
+	for (;;) {
+		uint64_t *pte = pml4e_walk (base_pml4,
+				(uint64_t) page_va (start + cnt), 0);
+
+		if (pte == NULL || !(*pte & PTE_P))
+			break;
+		cnt++;
+	}
+	ASSERT (cnt > 0);
+	unmap_pages (va, cnt);
+	bitmap_set_multiple (used_pages, start, cnt + 1, false);
+	vmalloc_cnt -= cnt;
+	lock_release (&vmalloc_lock);
+}
+
+/* Returns true if VA lies in the vmalloc() region, where vtop()
+   does not apply. */
+bool
+vmalloc_contains (const void *va) {
+	return (uint64_t) va >= VMALLOC_BASE
+		&& (uint64_t) va < VMALLOC_BASE + (uint64_t) VMALLOC_PAGES * PGSIZE;
+}
+
+/* Prints vmalloc() statistics. */
+void
+vmalloc_print_stats (void) {
+	if (vmalloc_peak > 0 || vmalloc_fail_cnt > 0)
+		printf ("Vmalloc: %zu pages mapped, %zu at most, %lld failures\n",
+				vmalloc_cnt, vmalloc_peak, vmalloc_fail_cnt);
+}
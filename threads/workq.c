@@ -0,0 +1,189 @@
+#include "threads/workq.h"
+#include <debug.h>
+#include <heap.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/cpu.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* A submitted job. */
+struct work {
+	struct work *next;          /* Next in a CPU's list. */
+	struct heap_elem elem;      /* Element in PENDING. */
+	workq_func *func;           /* Function to run. */
+	void *aux;                  /* Its argument. */
+	int priority;               /* Priority to run it at. */
+	unsigned seq;               /* Submission order, among equals. */
+};
+
+/* Job slots, and a bitmap of the ones taken.  A slot is claimed by
+   atomically setting its bit, so there is no list to corrupt when a
+   handler submits in the middle of a thread's submission. */
+#define POOL_WORDS ((WORKQ_JOBS + 63) / 64)
+static struct work pool[WORKQ_JOBS];
+static uint64_t pool_used[POOL_WORDS];
+
+/* Each CPU pushes jobs onto its own list, CPU->work_head, newest
+   first; workers move them into PENDING, under PENDING_LOCK, to pick
+   the next one.  WORK_SEMA counts the jobs in both. */
+static struct heap pending;
+static struct lock pending_lock;
+static struct semaphore work_sema;
+static unsigned next_seq;
+
+/* Statistics. */
+static int worker_cnt;          /* # of workers. */
+static long long job_cnt;       /* # of jobs run. */
+static long long full_cnt;      /* # of submissions refused. */
+
+static thread_func worker;
+
+/* Orders jobs by priority, then oldest first. */
+static bool
+work_less (const struct heap_elem *a_, const struct heap_elem *b_,
+		void *aux UNUSED) {
+	const struct work *a = heap_entry (a_, struct work, elem);
+	const struct work *b = heap_entry (b_, struct work, elem);
+
+	if (a->priority != b->priority)
+		return a->priority < b->priority;
+	return (int) (a->seq - b->seq) > 0;
+}
+
+/* Starts WORKQ_PER_CPU workers for each CPU online.  Jobs submitted
+   before then wait for the workers. */
+void
+workq_init (void) {
+	int i;
+
+	heap_init (&pending, work_less, NULL);
+	lock_init (&pending_lock);
+	sema_init (&work_sema, 0);
+
+	for (i = 0; i < cpu_cnt * WORKQ_PER_CPU; i++) {
+		char name[20];
+
+		snprintf (name, sizeof name, "kworker/%d", i);
+		if (thread_create (name, PRI_DEFAULT, worker, NULL) == TID_ERROR)
+			PANIC ("cannot start worker threads");
+		worker_cnt++;
+	}
+}
+
+/* Claims a free job slot and returns it, or a null pointer if all
+   are taken. */
+static struct work *
+slot_get (void) {
+	int i;
+
+	for (i = 0; i < POOL_WORDS; i++) {
+		uint64_t used = __atomic_load_n (&pool_used[i], __ATOMIC_RELAXED);
+
+		while (~used != 0) {
+			int bit = __builtin_ctzll (~used);
+			uint64_t mask = 1ULL << bit;
+
+			if (i * 64 + bit >= WORKQ_JOBS)
+				break;
+			used = __atomic_fetch_or (&pool_used[i], mask, __ATOMIC_ACQUIRE);
+			if (!(used & mask))
+				return &pool[i * 64 + bit];
+		}
+	}
+	return NULL;
+}
+
+/* Frees job slot W. */
+static void
+slot_put (struct work *w) {
+	size_t idx = w - pool;
+
+	__atomic_fetch_and (&pool_used[idx / 64], ~(1ULL << idx % 64),
+			__ATOMIC_RELEASE);
+}
+
+/* Submits FUNC (AUX) to run on a worker at PRIORITY.  Returns true
+   if successful, false if too many jobs are waiting.  May be called
+   from an interrupt handler. */
+bool
+workq_submit (workq_func *func, void *aux, int priority) {
+	struct work *volatile *head;
+	struct work *w, *old;
+
+	ASSERT (func != NULL);
+	ASSERT (PRI_MIN <= priority && priority <= PRI_MAX);
+
+	w = slot_get ();
+	if (w == NULL) {
+		full_cnt++;
+		return false;
+	}
+	w->func = func;
+	w->aux = aux;
+	w->priority = priority;
+	w->seq = __atomic_fetch_add (&next_seq, 1, __ATOMIC_RELAXED);
+
+	head = &cpu_current ()->work_head;
+	old = *head;
+	do
+		w->next = old;
+	while (!__atomic_compare_exchange_n (head, &old, w, false,
+				__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	sema_up (&work_sema);
+	return true;
+}
+
+/* Moves the jobs on every CPU's list into PENDING.  PENDING_LOCK
+   must be held. */
+static void
+collect (void) {
+	int i;
+
+	for (i = 0; i < CPU_MAX; i++) {
+		struct work *w = __atomic_exchange_n (&cpus[i].work_head, NULL,
+				__ATOMIC_ACQUIRE);
+
+		while (w != NULL) {
+			struct work *next = w->next;
+
+			heap_push (&pending, &w->elem);
+			w = next;
+		}
+	}
+}
+
+/* Worker thread.  Runs the most urgent job, then waits for another. */
+static void
+worker (void *aux UNUSED) {
+	for (;;) {
+		struct work *w;
+		workq_func *func;
+		void *func_aux;
+		int priority;
+
+		sema_down (&work_sema);
+		lock_acquire (&pending_lock);
+		collect ();
+		ASSERT (!heap_empty (&pending));
+		w = heap_entry (heap_pop (&pending), struct work, elem);
+		lock_release (&pending_lock);
+
+		func = w->func;
+		func_aux = w->aux;
+		priority = w->priority;
+		slot_put (w);
+
+		thread_set_priority (priority);
+		func (func_aux);
+		job_cnt++;
+	}
+}
+
+/* Prints worker pool statistics. */
+void
+workq_print_stats (void) {
+	if (worker_cnt != 0)
+		printf ("Work pool: %d workers, %lld jobs run, %lld refused\n",
+				worker_cnt, job_cnt, full_cnt);
+}
@@ -2,8 +2,12 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include "userprog/gdt.h"
+#include "userprog/usercopy.h"
+#include "threads/fpu.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
+#include "threads/vaddr.h"
 #include "intrinsic.h"
 
 /* Number of page faults processed. */
@@ -11,6 +15,7 @@ static long long page_fault_cnt;
 
 static void kill (struct intr_frame *);
 static void page_fault (struct intr_frame *);
+static void device_not_available (struct intr_frame *);
 
 /* Registers handlers for interrupts that can be caused by user
    programs.
@@ -45,7 +50,7 @@ exception_init (void) {
 	intr_register_int (0, 0, INTR_ON, kill, "#DE Divide Error");
 	intr_register_int (1, 0, INTR_ON, kill, "#DB Debug Exception");
 	intr_register_int (6, 0, INTR_ON, kill, "#UD Invalid Opcode Exception");
-	intr_register_int (7, 0, INTR_ON, kill,
+	intr_register_int (7, 0, INTR_ON, device_not_available,
 			"#NM Device Not Available Exception");
 	intr_register_int (11, 0, INTR_ON, kill, "#NP Segment Not Present");
 	intr_register_int (12, 0, INTR_ON, kill, "#SS Stack Fault Exception");
@@ -105,6 +110,14 @@ kill (struct intr_frame *f) {
 	}
 }
 
+/* #NM handler.  Raised by the first x87 or SSE instruction a
+   thread executes while CR0.TS is set; see threads/fpu.c.  Loads
+   that thread's FPU state and returns to retry the instruction. */
+static void
+device_not_available (struct intr_frame *f UNUSED) {
+	fpu_handle_nm ();
+}
+
 /* Page fault handler.  This is a skeleton that must be filled in
    to implement virtual memory.  Some solutions to project 2 may
    also require modifying this code.
@@ -139,21 +152,31 @@ page_fault (struct intr_frame *f) {
 	not_present = (f->error_code & PF_P) == 0;
 	write = (f->error_code & PF_W) != 0;
 	user = (f->error_code & PF_U) != 0;
-
-
-	if (not_present){
-	    f->rip = f->R.rax; // next instruction point to rax (which contains the address of $done_get)
-		f->R.rax = -1; // return value
-		do_iret(f); // return to $done_get label
-	}
+	TRACE (FAULT, fault_addr, f->error_code, f->rip);
 
 
 #ifdef VM
-	/* For project 3 and later. */
+	/* For project 3 and later.  Demand paging comes first, so that
+	   user copies fault pages in rather than fail. */
 	if (vm_try_handle_fault (f, fault_addr, user, write, not_present))
 		return;
 #endif
 
+	/* copy_from_user() and friends recover from faulting on unmapped
+	   user memory and, since the kernel respects write protection
+	   under VM, from writing to read-only user memory. */
+	if (!user && usercopy_fixup (f))
+		return;
+
+
+#ifdef VM
+	/* A process the OOM killer chose exits quietly at its next fault. */
+	if (user && vm_oom_killed ()) {
+		thread_current ()->exit_code = -1;
+		thread_exit ();
+	}
+#endif
+
 	/* Count page faults. */
 	page_fault_cnt++;
 
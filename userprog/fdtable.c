@@ -0,0 +1,393 @@
+#include "userprog/fdtable.h"
+#include <debug.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "userprog/pipe.h"
+#ifdef VM
+#include "vm/shm.h"
+#endif
+
+/* File descriptor tables.
+
+   Descriptor FD is slot FD of an array of pointers to shared open
+   files, and bit FD of a bitmap of 64-bit words is set while it is in
+   use.  The lowest free descriptor is found by skipping full words,
+   starting from the lowest word that may still have a free bit, and
+   taking the lowest clear bit of the first one left.  Since that hint
+   only moves down when a lower descriptor is freed, allocations take
+   a word test or two rather than a scan of every slot.  A full table
+   doubles in size.
+
+   Each table has a lock, for the threads of one process.  An open
+   file's reference count is shared between processes after fork(),
+   so it is changed with interrupts off instead.  A lookup takes a
+   reference under the lock, so a file stays open while a system call
+   uses it even if another thread closes its descriptor. */
+
+#define WORD_BITS 64
+
+/* Grows TABLE so that it holds descriptors below at least CAP, which
+   must not exceed FD_MAX.  Returns false if memory is short. */
+static bool
+grow (struct fd_table *table, size_t cap) {
+	size_t new_cap = table->cap > 0 ? table->cap : WORD_BITS;
+	struct open_file **files;
+	uint64_t *used;
+
+	ASSERT (cap <= FD_MAX);
+	while (new_cap < cap)
+		new_cap *= 2;
+	if (new_cap == table->cap)
+		return true;
+
+	files = realloc (table->files, new_cap * sizeof *files);
+	if (files == NULL)
+		return false;
+	table->files = files;
+	used = realloc (table->used, new_cap / WORD_BITS * sizeof *used);
+	if (used == NULL)
+		return false;
+	table->used = used;
+
+	memset (files + table->cap, 0, (new_cap - table->cap) * sizeof *files);
+	memset (used + table->cap / WORD_BITS, 0,
+			(new_cap - table->cap) / WORD_BITS * sizeof *used);
+	if (table->cap == 0)
+		used[0] = (1ULL << FD_FIRST) - 1;       /* The console. */
+	table->cap = new_cap;
+	return true;
+}
+
+/* Installs OF as descriptor FD of TABLE, which must be free and
+   allocated. */
+static void
+install (struct fd_table *table, int fd, struct open_file *of) {
+	ASSERT (table->files[fd] == NULL);
+	table->files[fd] = of;
+	table->used[fd / WORD_BITS] |= 1ULL << (fd % WORD_BITS);
+}
+
+/* Returns the lowest free descriptor of TABLE, growing it if it is
+   full, or -1 if FD_MAX are open or memory is short. */
+static int
+lowest_free (struct fd_table *table) {
+	size_t w;
+
+	for (w = table->free_word; w < table->cap / WORD_BITS; w++)
+		if (~table->used[w] != 0) {
+			table->free_word = w;
+			return w * WORD_BITS + __builtin_ctzll (~table->used[w]);
+		}
+	if (table->cap >= FD_MAX || !grow (table, table->cap + 1))
+		return -1;
+	table->free_word = w;
+	return w * WORD_BITS + __builtin_ctzll (~table->used[w]);
+}
+
+/* Returns the open file behind descriptor FD of TABLE, or a null
+   pointer if FD is not open. */
+static struct open_file *
+lookup (struct fd_table *table, int fd) {
+	if (fd < FD_FIRST || (size_t) fd >= table->cap)
+		return NULL;
+	return table->files[fd];
+}
+
+/* Takes another reference to OF. */
+static void
+open_file_get (struct open_file *of) {
+	enum intr_level old_level = intr_disable ();
+
+	of->ref_cnt++;
+	intr_set_level (old_level);
+}
+
+/* Drops one reference to OF, closing what it refers to with the
+   last. */
+static void
+open_file_put (struct open_file *of) {
+	enum intr_level old_level = intr_disable ();
+	bool last = --of->ref_cnt == 0;
+
+	intr_set_level (old_level);
+	if (last) {
+		if (of->pipe != NULL)
+			pipe_close (of->pipe, of->pipe_writer);
+#ifdef VM
+		else if (of->shm != NULL)
+			shm_put (of->shm);
+#endif
+		else
+			file_close (of->file);
+		free (of);
+	}
+}
+
+/* Initializes TABLE as an empty table. */
+void
+fd_table_init (struct fd_table *table) {
+	memset (table, 0, sizeof *table);
+	lock_init (&table->lock);
+}
+
+/* Unlinks descriptor FD of TABLE, whose lock is held, and returns the
+   open file it referred to, or a null pointer if it was not open. */
+static struct open_file *
+unlink_fd (struct fd_table *table, int fd) {
+	struct open_file *of = lookup (table, fd);
+
+	if (of != NULL) {
+		table->files[fd] = NULL;
+		table->used[fd / WORD_BITS] &= ~(1ULL << (fd % WORD_BITS));
+		if ((size_t) fd / WORD_BITS < table->free_word)
+			table->free_word = fd / WORD_BITS;
+	}
+	return of;
+}
+
+/* Opens a copy of TMPL, whose reference count is set, as the lowest
+   free descriptor of TABLE and returns it.  Returns -1 if no
+   descriptor is free or memory is short. */
+static int
+open_fd (struct fd_table *table, const struct open_file *tmpl) {
+	struct open_file *of = malloc (sizeof *of);
+	int fd;
+
+	if (of == NULL)
+		return -1;
+	*of = *tmpl;
+	of->ref_cnt = 1;
+	lock_acquire (&table->lock);
+	fd = lowest_free (table);
+	if (fd >= 0)
+		install (table, fd, of);
+	lock_release (&table->lock);
+	if (fd < 0)
+		free (of);
+	return fd;
+}
+
+/* Opens FILE as the lowest free descriptor of TABLE and returns it.
+   Returns -1, leaving FILE to the caller, if no descriptor is free or
+   memory is short. */
+int
+fd_open (struct fd_table *table, struct file *file) {
+	return open_fd (table, &(struct open_file) { .file = file });
+}
+
+/* Opens the write end of PIPE if WRITER, otherwise its read end, as
+   the lowest free descriptor of TABLE and returns it.  Returns -1,
+   leaving the end to the caller, if no descriptor is free or memory
+   is short. */
+int
+fd_open_pipe (struct fd_table *table, struct pipe *pipe, bool writer) {
+	return open_fd (table, &(struct open_file) {
+			.pipe = pipe, .pipe_writer = writer });
+}
+
+/* Opens shared memory segment SHM as the lowest free descriptor of
+   TABLE and returns it.  Returns -1, leaving the reference to SHM to
+   the caller, if no descriptor is free or memory is short. */
+int
+fd_open_shm (struct fd_table *table, struct shm *shm) {
+	return open_fd (table, &(struct open_file) { .shm = shm });
+}
+
+/* Returns the open file behind descriptor FD of TABLE with a
+   reference taken, if MATCH accepts it, or a null pointer. */
+static struct open_file *
+ref_if (struct fd_table *table, int fd,
+		bool (*match) (const struct open_file *, bool), bool aux) {
+	struct open_file *of;
+
+	lock_acquire (&table->lock);
+	of = lookup (table, fd);
+	if (of != NULL && match (of, aux))
+		open_file_get (of);
+	else
+		of = NULL;
+	lock_release (&table->lock);
+	return of;
+}
+
+static bool
+is_file (const struct open_file *of, bool aux UNUSED) {
+	return of->file != NULL;
+}
+
+static bool
+is_pipe_end (const struct open_file *of, bool writer) {
+	return of->pipe != NULL && of->pipe_writer == writer;
+}
+
+static bool
+is_shm (const struct open_file *of, bool aux UNUSED) {
+	return of->shm != NULL;
+}
+
+/* Returns the file open as descriptor FD of TABLE, or a null pointer
+   if FD is not open on a file.  A reference to the open file is taken
+   and stored in *REF, or null there if there is no file, so that the
+   file stays open even if FD is closed meanwhile; the caller drops it
+   with fd_unref(). */
+struct file *
+fd_get (struct fd_table *table, int fd, struct open_file **ref) {
+	*ref = ref_if (table, fd, is_file, false);
+	return *ref != NULL ? (*ref)->file : NULL;
+}
+
+/* Returns the pipe whose write end, if WRITER, or else read end is
+   open as descriptor FD of TABLE, or a null pointer if FD is not
+   open on that end of a pipe.  A reference is taken in *REF, as by
+   fd_get(). */
+struct pipe *
+fd_get_pipe (struct fd_table *table, int fd, bool writer,
+		struct open_file **ref) {
+	*ref = ref_if (table, fd, is_pipe_end, writer);
+	return *ref != NULL ? (*ref)->pipe : NULL;
+}
+
+/* Returns the shared memory segment open as descriptor FD of TABLE,
+   or a null pointer if FD is not open on one.  A reference is taken
+   in *REF, as by fd_get(). */
+struct shm *
+fd_get_shm (struct fd_table *table, int fd, struct open_file **ref) {
+	*ref = ref_if (table, fd, is_shm, false);
+	return *ref != NULL ? (*ref)->shm : NULL;
+}
+
+/* Returns the open file behind descriptor FD of TABLE with a
+   reference taken, which keeps it open even if FD is closed, or a
+   null pointer if FD is not open.  The caller drops the reference
+   with fd_unref(). */
+struct open_file *
+fd_ref (struct fd_table *table, int fd) {
+	struct open_file *of;
+
+	lock_acquire (&table->lock);
+	of = lookup (table, fd);
+	if (of != NULL)
+		open_file_get (of);
+	lock_release (&table->lock);
+	return of;
+}
+
+/* Drops a reference to OF taken by fd_ref() or one of the fd_get
+   functions, closing what it refers to if its descriptors have all
+   been closed meanwhile.  OF may be null. */
+void
+fd_unref (struct open_file *of) {
+	if (of != NULL)
+		open_file_put (of);
+}
+
+/* Returns the flags of descriptor FD of TABLE, or -1 if FD is not
+   open.  Descriptors that share an open file share its flags. */
+int
+fd_get_flags (struct fd_table *table, int fd) {
+	struct open_file *of;
+	int flags;
+
+	lock_acquire (&table->lock);
+	of = lookup (table, fd);
+	flags = of != NULL ? of->flags : -1;
+	lock_release (&table->lock);
+	return flags;
+}
+
+/* Sets the flags of descriptor FD of TABLE to FLAGS.  Returns false
+   if FD is not open. */
+bool
+fd_set_flags (struct fd_table *table, int fd, int flags) {
+	struct open_file *of;
+
+	lock_acquire (&table->lock);
+	of = lookup (table, fd);
+	if (of != NULL)
+		of->flags = flags;
+	lock_release (&table->lock);
+	return of != NULL;
+}
+
+/* Closes descriptor FD of TABLE.  Returns false if it was not open. */
+bool
+fd_close (struct fd_table *table, int fd) {
+	struct open_file *of;
+
+	lock_acquire (&table->lock);
+	of = unlink_fd (table, fd);
+	lock_release (&table->lock);
+	if (of == NULL)
+		return false;
+	open_file_put (of);
+	return true;
+}
+
+/* Makes NEWFD of TABLE refer to the file open as OLDFD, closing what
+   NEWFD had open first.  Returns NEWFD, or -1 if OLDFD is not open,
+   NEWFD is out of range, or memory is short. */
+int
+fd_dup2 (struct fd_table *table, int oldfd, int newfd) {
+	struct open_file *of, *old = NULL;
+	int ret = newfd;
+
+	lock_acquire (&table->lock);
+	of = lookup (table, oldfd);
+	if (of == NULL || newfd < FD_FIRST || newfd >= FD_MAX
+			|| !grow (table, newfd + 1))
+		ret = -1;
+	else if (oldfd != newfd) {
+		old = unlink_fd (table, newfd);
+		open_file_get (of);
+		install (table, newfd, of);
+	}
+	lock_release (&table->lock);
+	if (old != NULL)
+		open_file_put (old);
+	return ret;
+}
+
+/* Makes DST, which must be empty, a copy of SRC whose descriptors
+   share SRC's open files, as fork() does.  Returns false if memory is
+   short, leaving DST empty. */
+bool
+fd_table_copy (struct fd_table *dst, struct fd_table *src) {
+	size_t fd;
+
+	bool ok = true;
+
+	ASSERT (dst->cap == 0);
+	lock_acquire (&src->lock);
+	if (src->cap > 0 && !grow (dst, src->cap))
+		ok = false;
+	else
+		for (fd = FD_FIRST; fd < src->cap; fd++)
+			if (src->files[fd] != NULL) {
+				open_file_get (src->files[fd]);
+				install (dst, fd, src->files[fd]);
+			}
+	dst->free_word = src->free_word;
+	lock_release (&src->lock);
+	if (!ok)
+		fd_table_destroy (dst);
+	return ok;
+}
+
+/* Closes every descriptor of TABLE and frees it, leaving it empty. */
+void
+fd_table_destroy (struct fd_table *table) {
+	size_t fd;
+
+	lock_acquire (&table->lock);
+	for (fd = FD_FIRST; fd < table->cap; fd++)
+		if (table->files[fd] != NULL)
+			open_file_put (table->files[fd]);
+	free (table->files);
+	free (table->used);
+	table->files = NULL;
+	table->used = NULL;
+	table->cap = table->free_word = 0;
+	lock_release (&table->lock);
+}
@@ -0,0 +1,169 @@
+#include "userprog/fstrace.h"
+#include <debug.h>
+#include <hash.h>
+#include <inttypes.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/trace.h"
+#include "threads/vaddr.h"
+#include "devices/disk.h"
+#include "devices/timer.h"
+
+/* File system call tracing.
+
+   A kernel run with "-fstrace" records each file system call that
+   user processes make, with its arguments, result and latency, for
+   tests/bench/fs-replay to issue again (see lib/fstrace.h).  A call
+   claims its record with a single atomic add as it returns.  The
+   buffer keeps the first FSTRACE_RECORDS calls, since a replay wants
+   a workload from its start, and counts the rest as lost.
+
+   At power off the records are written to the end of the scratch
+   disk (hd1:0), as with "-trace": the last sector receives a struct
+   fstrace_header and the records fill the sectors just before it.
+   The two options share that space, so "-trace" wins. */
+
+bool fstrace_enabled;           /* Set by "-fstrace". */
+
+/* Pages of records. */
+#define FSTRACE_PAGES 256
+
+#define FSTRACE_RECORDS \
+	(FSTRACE_PAGES * PGSIZE / sizeof (struct fstrace_record))
+
+static struct fstrace_record *records;  /* Buffer, or null if off. */
+static uint64_t next_record;    /* Records ever claimed. */
+static int64_t start_ns;        /* timer_ns() at fstrace_init(). */
+
+/* Allocates the buffer, if tracing was asked for.  Must run after
+   the timer is started. */
+void
+fstrace_init (void) {
+	if (!fstrace_enabled)
+		return;
+	if (trace_enabled) {
+		printf ("fstrace: -trace uses the scratch disk, -fstrace ignored\n");
+		fstrace_enabled = false;
+		return;
+	}
+	records = palloc_get_multiple (PAL_ZERO, FSTRACE_PAGES);
+	if (records == NULL) {
+		printf ("fstrace: no memory for records, tracing disabled\n");
+		fstrace_enabled = false;
+		return;
+	}
+	start_ns = timer_ns ();
+}
+
+/* Returns the time at which a call that may be recorded starts, to
+   pass to fstrace_fd() or fstrace_path() as it returns. */
+int64_t
+fstrace_begin (void) {
+	return records != NULL ? timer_ns () : 0;
+}
+
+/* Claims a record for a call of OP that started at START and
+   returned RESULT, and fills in all but its file. */
+static struct fstrace_record *
+claim (int64_t start, enum fstrace_op op, size_t size, int result) {
+	struct fstrace_record *buf = records, *r;
+	uint64_t idx;
+
+	if (buf == NULL)
+		return NULL;
+	idx = __atomic_fetch_add (&next_record, 1, __ATOMIC_RELAXED);
+	if (idx >= FSTRACE_RECORDS)
+		return NULL;
+	r = &buf[idx];
+	r->time = start - start_ns;
+	r->latency = timer_ns () - start;
+	r->size = size;
+	r->result = result;
+	r->pid = thread_current ()->leader->tid;
+	r->op = op;
+	return r;
+}
+
+/* Records a call of OP on descriptor FD at OFFSET, for SIZE bytes,
+   that started at START and returned RESULT. */
+void
+fstrace_fd (int64_t start, enum fstrace_op op, int fd, off_t offset,
+		size_t size, int result) {
+	struct fstrace_record *r = claim (start, op, size, result);
+
+	if (r != NULL) {
+		r->fd = fd;
+		r->offset = offset;
+	}
+}
+
+/* Records a call of OP on PATH, with SIZE, that started at START
+   and returned RESULT. */
+void
+fstrace_path (int64_t start, enum fstrace_op op, const char *path,
+		size_t size, int result) {
+	struct fstrace_record *r = claim (start, op, size, result);
+
+	if (r != NULL) {
+		r->fd = -1;
+		r->offset = hash_string (path) & INT64_MAX;
+	}
+}
+
+/* Stops tracing and writes the records to the scratch disk, if
+   there is one.  Records that do not fit in front of the header
+   sector are dropped, latest first. */
+void
+fstrace_dump (void) {
+	static uint8_t buf[DISK_SECTOR_SIZE];
+	struct fstrace_header *h = (struct fstrace_header *) buf;
+	const uint8_t *p = (const uint8_t *) records;
+	uint64_t cnt, max;
+	size_t bytes;
+	struct disk *d;
+	disk_sector_t cap, sec;
+
+	if (records == NULL)
+		return;
+	cnt = next_record < FSTRACE_RECORDS ? next_record : FSTRACE_RECORDS;
+	records = NULL;
+
+	d = disk_get (1, 0);
+	if (d == NULL || intr_context () || intr_get_level () == INTR_OFF) {
+		printf ("Fstrace: %"PRIu64" records not saved\n", cnt);
+		return;
+	}
+
+	cap = disk_size (d);
+	max = cap > 1 ? (uint64_t) (cap - 1) * DISK_SECTOR_SIZE
+		/ sizeof (struct fstrace_record) : 0;
+	if (cnt > max)
+		cnt = max;
+
+	/* Records go right before the header, in the last sector. */
+	bytes = cnt * sizeof (struct fstrace_record);
+	sec = cap - 1 - DIV_ROUND_UP (bytes, DISK_SECTOR_SIZE);
+	for (; bytes > 0; p += DISK_SECTOR_SIZE) {
+		size_t chunk = bytes < DISK_SECTOR_SIZE ? bytes : DISK_SECTOR_SIZE;
+
+		memcpy (buf, p, chunk);
+		memset (buf + chunk, 0, DISK_SECTOR_SIZE - chunk);
+		disk_write (d, sec++, buf);
+		bytes -= chunk;
+	}
+	ASSERT (sec == cap - 1);
+
+	memset (buf, 0, sizeof buf);
+	memcpy (h->magic, "FST", 4);
+	h->record_size = sizeof (struct fstrace_record);
+	h->record_cnt = cnt;
+	h->lost_cnt = next_record - cnt;
+	disk_write (d, sec, buf);
+
+	printf ("Fstrace: %"PRIu64" records saved, %"PRIu64" lost\n",
+			cnt, next_record - cnt);
+}
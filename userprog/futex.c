@@ -0,0 +1,126 @@
+#include "userprog/futex.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/syscall.h"
+#include "userprog/usercopy.h"
+
+/* Fast user-space mutexes.
+
+   A user lock lives in a 32-bit word of user memory and is taken
+   and released with atomic instructions in user space.  Only a
+   thread that finds it contended enters the kernel, to sleep in
+   futex_wait() until the holder calls futex_wake() on the same
+   word.
+
+   Sleepers wait on a list in one of a fixed number of buckets,
+   chosen by hashing the word's address space and user address.
+   futex_wait() rechecks the word under its bucket's lock before
+   sleeping and futex_wake() takes the same lock, so a wake that
+   follows the user's store of the new value cannot slip in between
+   the check and the sleep and be lost. */
+
+#define FUTEX_BUCKETS 64
+
+/* A thread asleep in futex_wait(). */
+struct futex_waiter {
+	uint64_t *pml4;             /* Address space of the word... */
+	uint32_t *uaddr;            /* ...and its user address. */
+	struct semaphore sema;      /* Upped to wake the thread. */
+	struct list_elem elem;      /* Element in the bucket's list. */
+};
+
+struct futex_bucket {
+	struct lock lock;           /* Protects WAITERS. */
+	struct list waiters;        /* Sleepers, in arrival order. */
+};
+
+static struct futex_bucket buckets[FUTEX_BUCKETS];
+
+/* Initializes the futex buckets. */
+void
+futex_init (void) {
+	for (size_t i = 0; i < FUTEX_BUCKETS; i++) {
+		lock_init (&buckets[i].lock);
+		list_init (&buckets[i].waiters);
+	}
+}
+
+/* Returns the bucket for the word at UADDR in address space PML4. */
+static struct futex_bucket *
+bucket_for (const uint64_t *pml4, const uint32_t *uaddr) {
+	return &buckets[hash_u64 (hash_ptr (uaddr) ^ (uintptr_t) pml4)
+		% FUTEX_BUCKETS];
+}
+
+/* Returns true if UADDR can name a futex word. */
+static bool
+futex_addr_ok (const uint32_t *uaddr) {
+	return is_user_vaddr (uaddr) && ((uintptr_t) uaddr & 3) == 0;
+}
+
+/* Sleeps until a futex_wake() on UADDR, provided the word there
+   still holds VAL.  Returns 0 after being woken, or -1 at once if
+   the word holds another value or UADDR is misaligned.  Kills the
+   process if UADDR is unmapped. */
+int
+futex_wait (uint32_t *uaddr, uint32_t val) {
+	struct futex_waiter w;
+	struct futex_bucket *b;
+	uint32_t cur;
+
+	if (!futex_addr_ok (uaddr))
+		return -1;
+	w.pml4 = thread_current ()->pml4;
+	w.uaddr = uaddr;
+	sema_init (&w.sema, 0);
+	b = bucket_for (w.pml4, uaddr);
+
+	lock_acquire (&b->lock);
+	if (!copy_from_user (&cur, uaddr, sizeof cur)) {
+		lock_release (&b->lock);
+		sys_exit (-1);
+	}
+	if (cur != val) {
+		lock_release (&b->lock);
+		return -1;
+	}
+	list_push_back (&b->waiters, &w.elem);
+	lock_release (&b->lock);
+
+	sema_down (&w.sema);
+	return 0;
+}
+
+/* Wakes up to CNT threads asleep on UADDR in the current address
+   space, oldest first.  Returns the number woken, or -1 if UADDR is
+   misaligned. */
+int
+futex_wake (uint32_t *uaddr, int cnt) {
+	uint64_t *pml4 = thread_current ()->pml4;
+	struct futex_bucket *b;
+	struct list_elem *e;
+	int woken = 0;
+
+	if (!futex_addr_ok (uaddr))
+		return -1;
+	b = bucket_for (pml4, uaddr);
+
+	lock_acquire (&b->lock);
+	for (e = list_begin (&b->waiters);
+			e != list_end (&b->waiters) && woken < cnt; ) {
+		struct futex_waiter *w = list_entry (e, struct futex_waiter, elem);
+
+		e = list_next (e);
+		if (w->pml4 == pml4 && w->uaddr == uaddr) {
+			list_remove (&w->elem);
+			sema_up (&w->sema);
+			woken++;
+		}
+	}
+	lock_release (&b->lock);
+	return woken;
+}
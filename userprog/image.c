@@ -0,0 +1,334 @@
+#include "userprog/image.h"
+#include <debug.h>
+#include <round.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Executable image cache.
+
+   Programs are executed over and over, and each load() used to read
+   and check the ELF header and every program header before mapping
+   a single page.  The result of that work depends only on the
+   file's contents, so it is kept here, keyed on the inode, for the
+   IMAGE_CACHE_MAX most recently loaded executables.
+
+   An entry holds the file open, so its inode, and with it the inode's
+   version, stays put.  Each write to the inode changes the version;
+   an entry whose version no longer matches, or whose file has been
+   removed, is dropped the next time the cache is searched.  The text
+   pages themselves need no cache of their own: read-only segments are
+   file-backed, so the frame file cache already shares them between
+   the processes running an executable. */
+
+#define IMAGE_CACHE_MAX 16
+
+static struct list images;      /* Most recently used first. */
+static size_t image_cnt;        /* Number of cached images. */
+static struct lock image_lock;  /* Protects the above and ref counts. */
+
+/* We load ELF binaries.  The following definitions are taken
+ * from the ELF specification, [ELF1], more-or-less verbatim.  */
+
+/* ELF types.  See [ELF1] 1-2. */
+#define EI_NIDENT 16
+
+#define PT_NULL    0            /* Ignore. */
+#define PT_LOAD    1            /* Loadable segment. */
+#define PT_DYNAMIC 2            /* Dynamic linking info. */
+#define PT_INTERP  3            /* Name of dynamic loader. */
+#define PT_NOTE    4            /* Auxiliary info. */
+#define PT_SHLIB   5            /* Reserved. */
+#define PT_PHDR    6            /* Program header table. */
+#define PT_STACK   0x6474e551   /* Stack segment. */
+
+#define PF_X 1          /* Executable. */
+#define PF_W 2          /* Writable. */
+#define PF_R 4          /* Readable. */
+
+/* Executable header.  See [ELF1] 1-4 to 1-8.
+ * This appears at the very beginning of an ELF binary. */
+struct ELF64_hdr {
+	unsigned char e_ident[EI_NIDENT];
+	uint16_t e_type;
+	uint16_t e_machine;
+	uint32_t e_version;
+	uint64_t e_entry;
+	uint64_t e_phoff;
+	uint64_t e_shoff;
+	uint32_t e_flags;
+	uint16_t e_ehsize;
+	uint16_t e_phentsize;
+	uint16_t e_phnum;
+	uint16_t e_shentsize;
+	uint16_t e_shnum;
+	uint16_t e_shstrndx;
+};
+
+struct ELF64_PHDR {
+	uint32_t p_type;
+	uint32_t p_flags;
+	uint64_t p_offset;
+	uint64_t p_vaddr;
+	uint64_t p_paddr;
+	uint64_t p_filesz;
+	uint64_t p_memsz;
+	uint64_t p_align;
+};
+
+/* Abbreviations */
+#define ELF ELF64_hdr
+#define Phdr ELF64_PHDR
+
+/* Initializes the image cache. */
+void
+image_init (void) {
+	list_init (&images);
+	lock_init (&image_lock);
+}
+
+/* Drops a reference to IMG, freeing it if that was the last.  Called
+ * with the image lock held. */
+static void
+image_unref (struct image *img) {
+	ASSERT (lock_held_by_current_thread (&image_lock));
+
+	if (--img->ref_cnt == 0) {
+		file_close (img->file);
+		free (img);
+	}
+}
+
+/* Removes IMG from the cache.  Called with the image lock held. */
+static void
+image_evict (struct image *img) {
+	list_remove (&img->elem);
+	image_cnt--;
+	image_unref (img);
+}
+
+/* Returns a new reference to the cached image of INODE at VERSION,
+ * or a null pointer if there is none.  Drops stale entries on the
+ * way.  Called with the image lock held. */
+static struct image *
+image_lookup (struct inode *inode, uint64_t version) {
+	struct list_elem *e, *next;
+
+	ASSERT (lock_held_by_current_thread (&image_lock));
+
+	for (e = list_begin (&images); e != list_end (&images); e = next) {
+		struct image *img = list_entry (e, struct image, elem);
+
+		next = list_next (e);
+		if (img->inode == inode && img->version == version) {
+			list_remove (&img->elem);
+			list_push_front (&images, &img->elem);
+			img->ref_cnt++;
+			return img;
+		}
+		if (img->version != inode_version (img->inode)
+				|| inode_is_removed (img->inode))
+			image_evict (img);
+	}
+	return NULL;
+}
+
+/* Checks whether PHDR describes a valid, loadable segment in
+ * FILE and returns true if so, false otherwise. */
+static bool
+validate_segment (const struct Phdr *phdr, struct file *file) {
+	/* p_offset and p_vaddr must have the same page offset. */
+	if ((phdr->p_offset & PGMASK) != (phdr->p_vaddr & PGMASK))
+		return false;
+
+	/* p_offset must point within FILE. */
+	if (phdr->p_offset > (uint64_t) file_length (file))
+		return false;
+
+	/* p_memsz must be at least as big as p_filesz. */
+	if (phdr->p_memsz < phdr->p_filesz)
+		return false;
+
+	/* The segment must not be empty. */
+	if (phdr->p_memsz == 0)
+		return false;
+
+	/* The virtual memory region must both start and end within the
+	   user address space range. */
+	if (!is_user_vaddr ((void *) phdr->p_vaddr))
+		return false;
+	if (!is_user_vaddr ((void *) (phdr->p_vaddr + phdr->p_memsz)))
+		return false;
+
+	/* The region cannot "wrap around" across the kernel virtual
+	   address space. */
+	if (phdr->p_vaddr + phdr->p_memsz < phdr->p_vaddr)
+		return false;
+
+	/* Disallow mapping page 0.
+	   Not only is it a bad idea to map page 0, but if we allowed
+	   it then user code that passed a null pointer to system calls
+	   could quite likely panic the kernel by way of null pointer
+	   assertions in memcpy(), etc. */
+	if (phdr->p_vaddr < PGSIZE)
+		return false;
+
+	/* It's okay. */
+	return true;
+}
+
+/* Fills in SEG from PHDR, a valid loadable segment. */
+static void
+segment_init (struct image_segment *seg, const struct Phdr *phdr) {
+	uint64_t page_offset = phdr->p_vaddr & PGMASK;
+
+	seg->ofs = phdr->p_offset & ~PGMASK;
+	seg->upage = phdr->p_vaddr & ~PGMASK;
+	seg->writable = (phdr->p_flags & PF_W) != 0;
+	if (phdr->p_filesz > 0) {
+		/* Normal segment.
+		 * Read initial part from disk and zero the rest. */
+		seg->read_bytes = page_offset + phdr->p_filesz;
+		seg->zero_bytes = (ROUND_UP (page_offset + phdr->p_memsz, PGSIZE)
+				- seg->read_bytes);
+	} else {
+		/* Entirely zero.
+		 * Don't read anything from disk. */
+		seg->read_bytes = 0;
+		seg->zero_bytes = ROUND_UP (page_offset + phdr->p_memsz, PGSIZE);
+	}
+}
+
+/* Reads and checks the headers of executable FILE, whose inode is at
+ * VERSION, and returns them as an image with one reference, not yet
+ * cached.  Returns a null pointer if FILE is not a loadable executable
+ * or memory is short. */
+static struct image *
+image_parse (struct file *file, uint64_t version) {
+	struct ELF ehdr;
+	struct Phdr *phdrs;
+	struct image *img = NULL;
+	size_t phdrs_size, seg_cnt = 0;
+	int i;
+
+	/* Read and verify executable header. */
+	if (file_read_at (file, &ehdr, sizeof ehdr, 0) != sizeof ehdr
+			|| memcmp (ehdr.e_ident, "\177ELF\2\1\1", 7)
+			|| ehdr.e_type != 2
+			|| ehdr.e_machine != 0x3E // amd64
+			|| ehdr.e_version != 1
+			|| ehdr.e_phentsize != sizeof (struct Phdr)
+			|| ehdr.e_phnum > 1024
+			|| ehdr.e_phoff > (uint64_t) file_length (file))
+		return NULL;
+
+	/* Read all the program headers at once. */
+	phdrs_size = ehdr.e_phnum * sizeof *phdrs;
+	phdrs = malloc (phdrs_size > 0 ? phdrs_size : 1);
+	if (phdrs == NULL)
+		return NULL;
+	if (file_read_at (file, phdrs, phdrs_size, ehdr.e_phoff)
+			!= (off_t) phdrs_size)
+		goto done;
+
+	for (i = 0; i < ehdr.e_phnum; i++) {
+		switch (phdrs[i].p_type) {
+			case PT_NULL:
+			case PT_NOTE:
+			case PT_PHDR:
+			case PT_STACK:
+			default:
+				/* Ignore this segment. */
+				break;
+			case PT_DYNAMIC:
+			case PT_INTERP:
+			case PT_SHLIB:
+				goto done;
+			case PT_LOAD:
+				if (!validate_segment (&phdrs[i], file))
+					goto done;
+				seg_cnt++;
+				break;
+		}
+	}
+
+	img = malloc (sizeof *img + seg_cnt * sizeof *img->segs);
+	if (img == NULL)
+		goto done;
+	img->ref_cnt = 1;
+	img->file = NULL;
+	img->inode = file_get_inode (file);
+	img->version = version;
+	img->entry = ehdr.e_entry;
+	img->seg_cnt = 0;
+	for (i = 0; i < ehdr.e_phnum; i++)
+		if (phdrs[i].p_type == PT_LOAD)
+			segment_init (&img->segs[img->seg_cnt++], &phdrs[i]);
+
+done:
+	free (phdrs);
+	return img;
+}
+
+/* Enters IMG, just parsed, into the cache, unless its file is gone or
+ * another loader has entered the same image meanwhile.  Called with
+ * the image lock held. */
+static void
+image_insert (struct image *img) {
+	struct image *dup;
+
+	if (inode_is_removed (img->inode))
+		return;
+	dup = image_lookup (img->inode, img->version);
+	if (dup != NULL) {
+		image_unref (dup);
+		return;
+	}
+	list_push_front (&images, &img->elem);
+	img->ref_cnt++;
+	if (++image_cnt > IMAGE_CACHE_MAX)
+		image_evict (list_entry (list_back (&images), struct image, elem));
+}
+
+/* Returns the image of executable FILE, which the caller must release
+ * with image_put(), or a null pointer if FILE cannot be loaded.  The
+ * headers are read only if the cache has no current image of FILE. */
+struct image *
+image_get (struct file *file) {
+	struct inode *inode = file_get_inode (file);
+	uint64_t version = inode_version (inode);
+	struct image *img;
+
+	lock_acquire (&image_lock);
+	img = image_lookup (inode, version);
+	lock_release (&image_lock);
+	if (img != NULL)
+		return img;
+
+	/* The version is taken before the headers are read, so a write
+	 * that races with the reading leaves the entry stale. */
+	img = image_parse (file, version);
+	if (img == NULL)
+		return NULL;
+
+	img->file = file_reopen (file);
+	if (img->file != NULL) {
+		lock_acquire (&image_lock);
+		image_insert (img);
+		lock_release (&image_lock);
+	}
+	return img;
+}
+
+/* Releases IMG, got from image_get(). */
+void
+image_put (struct image *img) {
+	if (img == NULL)
+		return;
+	lock_acquire (&image_lock);
+	image_unref (img);
+	lock_release (&image_lock);
+}
@@ -0,0 +1,256 @@
+#include "userprog/pipe.h"
+#include <debug.h>
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/poll.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include <poll.h>
+#include "userprog/usercopy.h"
+
+/* Pipes.
+
+   A pipe is a one-page ring buffer between a read end and a write
+   end, a generalization of devices/intq.c to large transfers.  HEAD
+   and TAIL run freely and are taken modulo PIPE_SIZE.  Only the
+   writer advances HEAD and only the reader advances TAIL, each after
+   it has copied the data, so a reader and a writer never lock each
+   other out.  A transfer copies straight between user memory and the
+   ring, as many bytes at a time as fit.
+
+   Sleeping is needed only when the ring is empty or full.  A thread
+   that finds it so marks itself waiting with interrupts off, and
+   rechecks the ring before it sleeps.  The other side, having moved
+   its index, wakes it if the mark is set.  With one CPU, turning
+   interrupts off makes the check and the sleep atomic, so no wakeup
+   is lost.
+
+   Threads in poll() wait on the pipe's poll queue instead, which
+   every move of an index and every close wakes.
+
+   Each end has a lock, which only matters when several threads or
+   processes share that end and would otherwise move its index
+   together.  It never blocks when one thread reads and one writes. */
+
+#define PIPE_SIZE PGSIZE
+
+struct pipe {
+	uint8_t *buf;               /* Ring of PIPE_SIZE bytes. */
+	size_t head;                /* Bytes written so far. */
+	size_t tail;                /* Bytes read so far. */
+
+	int readers, writers;       /* Open ends, 0 or 1 each. */
+	struct lock read_lock;      /* Serializes readers. */
+	struct lock write_lock;     /* Serializes writers. */
+	struct semaphore readable;  /* Upped for a waiting reader. */
+	struct semaphore writable;  /* Upped for a waiting writer. */
+	bool reader_waiting;        /* Is a reader asleep on READABLE? */
+	bool writer_waiting;        /* Is a writer asleep on WRITABLE? */
+	struct poll_queue pollq;    /* Threads polling either end. */
+};
+
+/* Creates a pipe with both ends open.  Returns a null pointer if
+   memory is short. */
+struct pipe *
+pipe_create (void) {
+	struct pipe *p = malloc (sizeof *p);
+
+	if (p == NULL)
+		return NULL;
+	p->buf = palloc_get_page (0);
+	if (p->buf == NULL) {
+		free (p);
+		return NULL;
+	}
+	p->head = p->tail = 0;
+	p->readers = p->writers = 1;
+	lock_init (&p->read_lock);
+	lock_init (&p->write_lock);
+	sema_init (&p->readable, 0);
+	sema_init (&p->writable, 0);
+	p->reader_waiting = p->writer_waiting = false;
+	poll_queue_init (&p->pollq);
+	return p;
+}
+
+/* Wakes the other side of P if it sleeps on SEMA, flagged by
+   *WAITING.  The two sides of a pipe mostly take turns, so the wakeup
+   is a sync one, which lets the sleeper run on this CPU, where the
+   data it is to read or the room it is to fill was just touched. */
+static void
+wake (struct semaphore *sema, bool *waiting) {
+	enum intr_level old_level;
+
+	barrier ();
+	if (!*waiting)
+		return;
+	old_level = intr_disable ();
+	if (*waiting) {
+		*waiting = false;
+		sema_up_sync (sema);
+	}
+	intr_set_level (old_level);
+}
+
+/* Reads up to SIZE bytes from P into user buffer UBUF, sleeping
+   until at least one is there, or returning -1 at once if NONBLOCK.
+   Returns the number read, which is 0 at end of file, once the write
+   end is closed and the ring empty.  Returns PIPE_FAULT, taking
+   nothing from the ring, if UBUF is bad. */
+int64_t
+pipe_read (struct pipe *p, void *ubuf, size_t size, bool nonblock) {
+	size_t avail, ofs, chunk;
+
+	if (size == 0)
+		return 0;
+	lock_acquire (&p->read_lock);
+	while ((avail = p->head - p->tail) == 0) {
+		enum intr_level old_level;
+
+		if (nonblock && p->writers > 0) {
+			lock_release (&p->read_lock);
+			return -1;
+		}
+		old_level = intr_disable ();
+
+		if (p->head == p->tail && p->writers > 0) {
+			p->reader_waiting = true;
+			sema_down (&p->readable);
+		}
+		intr_set_level (old_level);
+		if (p->head == p->tail && p->writers == 0) {
+			lock_release (&p->read_lock);
+			return 0;
+		}
+	}
+	barrier ();
+
+	/* Copy out of the ring, in two pieces if the data wraps. */
+	if (size > avail)
+		size = avail;
+	for (size_t done = 0; done < size; done += chunk) {
+		ofs = (p->tail + done) % PIPE_SIZE;
+		chunk = size - done < PIPE_SIZE - ofs ? size - done : PIPE_SIZE - ofs;
+		if (!copy_to_user ((uint8_t *) ubuf + done, p->buf + ofs, chunk)) {
+			lock_release (&p->read_lock);
+			return PIPE_FAULT;
+		}
+	}
+	barrier ();
+	p->tail += size;
+	wake (&p->writable, &p->writer_waiting);
+	poll_queue_wake (&p->pollq);
+	lock_release (&p->read_lock);
+	return size;
+}
+
+/* Writes SIZE bytes from user buffer UBUF into P, sleeping whenever
+   the ring is full, or stopping there if NONBLOCK.  Returns SIZE, or
+   the bytes written before the read end was closed or the ring
+   filled, or -1 if none were.  Returns PIPE_FAULT if UBUF is bad. */
+int64_t
+pipe_write (struct pipe *p, const void *ubuf, size_t size, bool nonblock) {
+	size_t done = 0;
+
+	lock_acquire (&p->write_lock);
+	while (done < size) {
+		size_t room, ofs, chunk;
+
+		if (p->readers == 0)
+			break;
+		room = PIPE_SIZE - (p->head - p->tail);
+		if (room == 0) {
+			enum intr_level old_level;
+
+			if (nonblock)
+				break;
+			old_level = intr_disable ();
+
+			if (p->head - p->tail == PIPE_SIZE && p->readers > 0) {
+				p->writer_waiting = true;
+				sema_down (&p->writable);
+			}
+			intr_set_level (old_level);
+			continue;
+		}
+		barrier ();
+
+		/* Copy in up to the end of the ring; the rest goes next time. */
+		ofs = p->head % PIPE_SIZE;
+		chunk = size - done;
+		if (chunk > room)
+			chunk = room;
+		if (chunk > PIPE_SIZE - ofs)
+			chunk = PIPE_SIZE - ofs;
+		if (!copy_from_user (p->buf + ofs, (const uint8_t *) ubuf + done,
+					chunk)) {
+			lock_release (&p->write_lock);
+			return PIPE_FAULT;
+		}
+		barrier ();
+		p->head += chunk;
+		done += chunk;
+		wake (&p->readable, &p->reader_waiting);
+		poll_queue_wake (&p->pollq);
+	}
+	lock_release (&p->write_lock);
+	return done > 0 || size == 0 ? (int64_t) done : -1;
+}
+
+/* Closes the write end of P if WRITER, otherwise its read end,
+   waking any thread asleep on the other end.  Frees P once both
+   ends are closed. */
+void
+pipe_close (struct pipe *p, bool writer) {
+	enum intr_level old_level = intr_disable ();
+	bool last;
+
+	if (writer) {
+		p->writers--;
+		if (p->reader_waiting) {
+			p->reader_waiting = false;
+			sema_up (&p->readable);
+		}
+	} else {
+		p->readers--;
+		if (p->writer_waiting) {
+			p->writer_waiting = false;
+			sema_up (&p->writable);
+		}
+	}
+	poll_queue_wake (&p->pollq);
+	last = p->readers == 0 && p->writers == 0;
+	intr_set_level (old_level);
+
+	if (last) {
+		palloc_free_page (p->buf);
+		free (p);
+	}
+}
+
+/* Returns the poll() events that are pending on the write end of P
+   if WRITER, otherwise its read end.  If PT is not null, also adds W
+   to P's poll queue for it. */
+int
+pipe_poll (struct pipe *p, bool writer, struct poll_table *pt,
+		struct poll_waiter *w) {
+	int revents = 0;
+
+	if (pt != NULL)
+		poll_add (pt, &p->pollq, w);
+	barrier ();
+	if (writer) {
+		if (p->readers == 0)
+			revents |= POLLERR;
+		else if (p->head - p->tail < PIPE_SIZE)
+			revents |= POLLOUT;
+	} else {
+		if (p->head != p->tail)
+			revents |= POLLIN;
+		if (p->writers == 0)
+			revents |= POLLHUP;
+	}
+	return revents;
+}
@@ -5,14 +5,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <timepage.h>
 #include "userprog/gdt.h"
+#include "userprog/image.h"
+#include "userprog/rgroup.h"
 #include "userprog/tss.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "threads/flags.h"
+#include "threads/fpu.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
@@ -20,7 +25,6 @@
 #include "intrinsic.h"
 #include "devices/timer.h"
 
-#define MAX_ARG_SIZE 64 
 #ifdef VM
 #include "vm/vm.h"
 #endif
@@ -29,6 +33,180 @@ static void process_cleanup (void);
 static bool load (const char *file_name, struct intr_frame *if_);
 static void initd (void *f_name);
 static void __do_fork (void *);
+static void clone_start (void *);
+static void spawn_start (void *);
+
+/* A child process's record, which carries its exit status to wait()
+ * in its parent.  It is apart from the child's thread, whose page is
+ * freed as soon as the child exits, and is found by tid in a hash
+ * table of the parent's.  The parent and the child each hold a
+ * reference; the record goes with the second to let go. */
+struct child {
+	tid_t tid;                  /* The child's thread. */
+	int exit_code;              /* Exit status, once EXITED is upped. */
+	struct rusage ru;           /* Usage, with the child's children's. */
+	struct semaphore exited;    /* Upped as the child exits. */
+	int ref_cnt;                /* References, 2 at first. */
+	struct hash_elem elem;      /* Element in the parent's CHILDREN. */
+
+	thread_func *function;      /* What the child runs, given AUX. */
+	void *aux;
+	struct rgroup *rgroup;      /* Resource group the child starts in. */
+};
+
+/* Print each process's resource usage as it exits?  Controlled by
+ * kernel command-line option "-rusage". */
+bool process_report_rusage;
+
+/* Adds the counts in SRC to DST. */
+static void
+rusage_add (struct rusage *dst, const struct rusage *src) {
+	dst->utime += src->utime;
+	dst->stime += src->stime;
+	dst->minflt += src->minflt;
+	dst->majflt += src->majflt;
+	dst->nswapin += src->nswapin;
+	dst->nswapout += src->nswapout;
+	dst->inblock += src->inblock;
+	dst->oublock += src->oublock;
+	dst->nvcsw += src->nvcsw;
+	dst->nivcsw += src->nivcsw;
+	dst->nmigrate += src->nmigrate;
+}
+
+/* A process's usage, as it is being summed over its threads. */
+struct rusage_sum {
+	struct thread *leader;      /* The process. */
+	struct rusage ru;           /* Sum so far. */
+};
+
+/* Adds the usage of thread T to SUM_, if T is one of its process's
+ * threads that have not exited.  A clone that has exited has let go
+ * of the address space and added its usage to the leader's. */
+static void
+rusage_sum_thread (struct thread *t, void *sum_) {
+	struct rusage_sum *sum = sum_;
+	struct rusage ru;
+
+	if (t->leader == sum->leader && (t->pml4 != NULL || t == sum->leader)) {
+		thread_get_rusage (t, &ru);
+		rusage_add (&sum->ru, &ru);
+	}
+}
+
+/* Stores in *RU the resource usage of the process led by LEADER. */
+static void
+process_rusage (struct thread *leader, struct rusage *ru) {
+	struct rusage_sum sum = { .leader = leader, .ru = leader->ru_exited };
+	enum intr_level old_level = intr_disable ();
+
+	thread_foreach (rusage_sum_thread, &sum);
+	intr_set_level (old_level);
+	*ru = sum.ru;
+}
+
+/* Stores in *RU the resource usage of the current process, if WHO is
+ * RUSAGE_SELF, or of its children that it has waited for, if WHO is
+ * RUSAGE_CHILDREN.  Returns false if WHO is neither. */
+bool
+process_get_rusage (int who, struct rusage *ru) {
+	struct thread *leader = thread_current ()->leader;
+	enum intr_level old_level;
+
+	switch (who) {
+		case RUSAGE_SELF:
+			process_rusage (leader, ru);
+			return true;
+		case RUSAGE_CHILDREN:
+			old_level = intr_disable ();
+			*ru = leader->ru_children;
+			intr_set_level (old_level);
+			return true;
+		default:
+			return false;
+	}
+}
+
+/* Returns a hash of the tid of child record E. */
+static uint64_t
+child_hash (const struct hash_elem *e, void *aux UNUSED) {
+	return hash_int (hash_entry (e, struct child, elem)->tid);
+}
+
+/* Orders child records by tid. */
+static bool
+child_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct child, elem)->tid
+		< hash_entry (b, struct child, elem)->tid;
+}
+
+/* Drops a reference to child record C, freeing it with the last. */
+static void
+child_put (struct child *c) {
+	enum intr_level old_level = intr_disable ();
+	bool last = --c->ref_cnt == 0;
+
+	intr_set_level (old_level);
+	if (last)
+		free (c);
+}
+
+/* Drops the parent's reference to child record E, for a parent that
+ * exits without waiting. */
+static void
+child_orphan (struct hash_elem *e, void *aux UNUSED) {
+	child_put (hash_entry (e, struct child, elem));
+}
+
+/* Where a child process starts: it takes its record, then runs what
+ * its parent asked. */
+static void
+child_start (void *c_) {
+	struct child *c = c_;
+
+	thread_current ()->child = c;
+	rgroup_adopt (thread_current (), c->rgroup);
+	c->function (c->aux);
+}
+
+/* Creates a thread named NAME that runs FUNCTION (AUX) as a child
+ * process of the current process, which may wait() for it.  Returns
+ * its tid, or TID_ERROR if it cannot be created. */
+static tid_t
+child_create (const char *name, thread_func *function, void *aux) {
+	struct thread *parent = thread_current ()->leader;
+	struct child *c = malloc (sizeof *c);
+	tid_t tid;
+
+	if (c == NULL)
+		return TID_ERROR;
+	lock_acquire (&parent->children_lock);
+	if (parent->children.buckets == NULL
+			&& !hash_init (&parent->children, child_hash, child_less, NULL)) {
+		lock_release (&parent->children_lock);
+		free (c);
+		return TID_ERROR;
+	}
+	lock_release (&parent->children_lock);
+
+	sema_init (&c->exited, 0);
+	c->exit_code = -1;
+	c->ref_cnt = 2;
+	c->function = function;
+	c->aux = aux;
+	c->rgroup = rgroup_get (parent->rgroup);
+	tid = c->tid = thread_create (name, PRI_DEFAULT, child_start, c);
+	if (tid == TID_ERROR) {
+		rgroup_put (c->rgroup);
+		free (c);
+		return TID_ERROR;
+	}
+	lock_acquire (&parent->children_lock);
+	hash_insert (&parent->children, &c->elem);
+	lock_release (&parent->children_lock);
+	return tid;
+}
 
 /* General process initializer for initd and other process. */
 static void
@@ -54,7 +232,7 @@ process_create_initd (const char *file_name) {
 	strlcpy (fn_copy, file_name, PGSIZE);
 
 	/* Create a new thread to execute FILE_NAME. */
-	tid = thread_create (file_name, PRI_DEFAULT, initd, fn_copy);
+	tid = child_create (file_name, initd, fn_copy);
 	if (tid == TID_ERROR)
 		palloc_free_page (fn_copy);
 	return tid;
@@ -79,29 +257,106 @@ initd (void *f_name) {
 tid_t
 process_fork (const char *name, struct intr_frame *if_ UNUSED) {
 	/* Clone current thread to new thread.*/
-	return thread_create (name,
-			PRI_DEFAULT, __do_fork, thread_current ());
+	return child_create (name, __do_fork, thread_current ());
+}
+
+/* Where a clone starts, handed from process_clone() to clone_start(). */
+struct clone_args {
+	struct thread *leader;      /* Leader of the cloning process. */
+	void *entry;                /* User code to run. */
+	void *stack;                /* Top of its user stack. */
+	uint64_t arg;               /* Passed in RDI. */
+	struct semaphore started;   /* Upped once the clone has read this. */
+};
+
+/* Starts a thread in the current process that shares its address
+ * space and file descriptors and runs user code at ENTRY, on the
+ * stack whose top is STACK, with ARG as its first argument.  The
+ * 8 bytes below the first 16-byte boundary under STACK are left for
+ * a return address, as on entry to a called function.  Returns the
+ * new thread's id, or TID_ERROR if it cannot be created.
+ *
+ * Unlike fork(), nothing is copied and the new thread switches to it
+ * without reloading CR3.  A clone's exit() ends only that thread; the
+ * process ends, and its leader reports the exit status, once every
+ * thread in it has exited. */
+tid_t
+process_clone (void *entry, void *stack, uint64_t arg) {
+	struct thread *leader = thread_current ()->leader;
+	struct clone_args ca = {
+		.leader = leader,
+		.entry = entry,
+		.stack = (void *) (((uintptr_t) stack & ~(uintptr_t) 15) - 8),
+		.arg = arg,
+	};
+	enum intr_level old_level;
+	tid_t tid;
+
+	if (!is_user_vaddr (entry) || !is_user_vaddr (ca.stack)
+			|| (uintptr_t) stack < 16)
+		return TID_ERROR;
+	sema_init (&ca.started, 0);
+
+	/* Counted first, so that the leader cannot finish exiting before
+	 * the clone is running. */
+	old_level = intr_disable ();
+	leader->clone_cnt++;
+	intr_set_level (old_level);
+
+	tid = thread_create (leader->name, thread_get_priority (), clone_start,
+			&ca);
+	if (tid == TID_ERROR) {
+		old_level = intr_disable ();
+		leader->clone_cnt--;
+		intr_set_level (old_level);
+	} else
+		sema_down (&ca.started);
+	return tid;
+}
+
+/* A thread function that enters user code in a cloned thread. */
+static void
+clone_start (void *aux) {
+	struct clone_args *ca = aux;
+	struct thread *curr = thread_current ();
+	struct intr_frame if_;
+
+	memset (&if_, 0, sizeof if_);
+	if_.ds = if_.es = if_.ss = SEL_UDSEG;
+	if_.cs = SEL_UCSEG;
+	if_.eflags = FLAG_IF | FLAG_MBS;
+	if_.rip = (uintptr_t) ca->entry;
+	if_.rsp = (uintptr_t) ca->stack;
+	if_.R.rdi = ca->arg;
+
+	curr->leader = ca->leader;
+	curr->pml4 = ca->leader->pml4;
+	curr->io_share = ca->leader->io_share;
+	sema_up (&ca->started);
+
+	process_activate (curr);
+	do_iret (&if_);
+	NOT_REACHED ();
 }
 
 #ifndef VM
 /* Duplicate the parent's address space by passing this function to the
- * pml4_for_each. This is only for the project 2. */
+ * pml4_for_each_range. This is only for the project 2. */
 static bool
-duplicate_pte (uint64_t *pte, void *va, void *aux) {
+duplicate_pte (uint64_t *pte, void *va, void *aux UNUSED) {
 	struct thread *current = thread_current ();
-	struct thread *parent = (struct thread *) aux;
 	void *parent_page;
 	void *newpage;
 	/* 1. If the parent_page is kernel page, then return immediately. */
 	if (is_kern_pte(pte)){
 		return true; //go to next page
 	}
-	/* 2. Resolve VA from the parent's page map level 4. */
+	/* Shared pages, such as the time page, are mapped separately. */
+	if (*pte & PTE_NOFREE)
+		return true;
+	/* 2. Resolve VA from the parent's PTE, which the walk hands us. */
 	/* &parrent_page == kernel virtual address */
-	parent_page = pml4_get_page (parent->pml4, va);
-	if (parent_page == NULL) {
-        return false;  // If the parent's page is not found, return false.
-    }
+	parent_page = ptov (PTE_ADDR (*pte));
 
 	/* 3. Allocate new PAL_USER page for the child and set result to
 	 *    NEWPAGE. */
@@ -119,7 +374,7 @@ duplicate_pte (uint64_t *pte, void *va, void *aux) {
 	/* 5. Add new page to child's page table at address VA with WRITABLE
 	 *    permission. */
 	/* 6. if fail to insert page, do error handling. */
-	 if (!pml4_set_page(current->pml4, va, newpage, true)) {
+	 if (!pml4_set_page(current->pml4, va, newpage, is_writable (pte))) {
         palloc_free_page(newpage);  // Free the allocated page if insertion fails.
         return false;
     }
@@ -150,12 +405,17 @@ __do_fork (void *aux) {
 		goto error;
 
 	process_activate (current);
+	if (!fpu_fork (current, parent))
+		goto error;
+	if (!pml4_share_page (current->pml4, TIMEPAGE_ADDR, timer_page ()))
+		goto error;
 #ifdef VM
 	supplemental_page_table_init (&current->spt);
 	if (!supplemental_page_table_copy (&current->spt, &parent->spt))
 		goto error;
 #else
-	if (!pml4_for_each (parent->pml4, duplicate_pte, parent))
+	if (!pml4_for_each_range (parent->pml4, NULL, (void *) KERN_BASE,
+				duplicate_pte, parent))
 		goto error;
 #endif
 
@@ -165,8 +425,10 @@ __do_fork (void *aux) {
 	 * from the fork() until this function successfully duplicates
 	 * the resources of parent.
 	 */
-	
-	
+	/* The child's descriptors share the parent's open files, and with
+	 * them the file positions, as after a POSIX fork(). */
+	if (!fd_table_copy (&current->fds, &parent->fds))
+		goto error;
 
 	process_init ();
 
@@ -177,33 +439,40 @@ error:
 	thread_exit ();
 }
 
-/* Switch the current execution context to the f_name.
- * Returns -1 on fail. */
-int
-process_exec (void *f_name) {
-	char *file_name = f_name;
+/* Replaces the current address space with the program named by the
+ * command line FILE_NAME, a page that this frees, and sets up _IF to
+ * enter it.  Returns false if the program could not be loaded. */
+static bool
+exec_load (char *file_name, struct intr_frame *_if) {
 	bool success;
 
-	/* We cannot use the intr_frame in the thread structure.
-	 * This is because when current thread rescheduled,
-	 * it stores the execution information to the member. */
 	/* SEL_UDESG, SEL_UCSEG ...
 	 * GDT selectors defined by loader.
   	 * More selectors are defined by userprog/gdt.h. */
-	struct intr_frame _if;
-	_if.ds = _if.es = _if.ss = SEL_UDSEG;
-	_if.cs = SEL_UCSEG;
-	_if.eflags = FLAG_IF | FLAG_MBS;
+	_if->ds = _if->es = _if->ss = SEL_UDSEG;
+	_if->cs = SEL_UCSEG;
+	_if->eflags = FLAG_IF | FLAG_MBS;
 
 	/* We first kill the current context */
 	process_cleanup ();
 
 	/* And then load the binary */
-	success = load (file_name, &_if);
+	success = load (file_name, _if);
+	palloc_free_page (file_name);
+	return success;
+}
+
+/* Switch the current execution context to the f_name.
+ * Returns -1 on fail. */
+int
+process_exec (void *f_name) {
+	/* We cannot use the intr_frame in the thread structure.
+	 * This is because when current thread rescheduled,
+	 * it stores the execution information to the member. */
+	struct intr_frame _if;
 
 	/* If load failed, quit. */
-	palloc_free_page (file_name);
-	if (!success)
+	if (!exec_load (f_name, &_if))
 		return -1;
 
 	/* Start switched process. */
@@ -211,6 +480,76 @@ process_exec (void *f_name) {
 	NOT_REACHED ();
 }
 
+/* A spawned child's start-up, handed from process_spawn() to
+ * spawn_start(). */
+struct spawn_args {
+	struct thread *parent;      /* Process that called spawn(). */
+	char *cmd_line;             /* Page holding the command line. */
+	struct semaphore loaded;    /* Upped once the load is decided. */
+	bool success;               /* Did the program load? */
+};
+
+/* Starts a new process running the command line CMD_LINE, a page
+ * that the new process takes over, with a copy of the current
+ * process's file descriptors.  CMD_LINE is loaded in the child
+ * straight into a fresh address space, so there is no copy of the
+ * caller's memory to make and then throw away, as fork() followed by
+ * exec() does.  Returns the new process's thread id once its program
+ * has loaded, or TID_ERROR if it could not be created or loaded. */
+tid_t
+process_spawn (char *cmd_line) {
+	struct spawn_args sa = {
+		.parent = thread_current ()->leader,
+		.cmd_line = cmd_line,
+	};
+	char name[sizeof sa.parent->name];
+	tid_t tid;
+
+	sema_init (&sa.loaded, 0);
+	strlcpy (name, cmd_line, sizeof name);
+	name[strcspn (name, " ")] = '\0';
+	tid = child_create (name, spawn_start, &sa);
+	if (tid == TID_ERROR) {
+		palloc_free_page (cmd_line);
+		return TID_ERROR;
+	}
+	sema_down (&sa.loaded);
+	if (!sa.success) {
+		process_wait (tid);
+		return TID_ERROR;
+	}
+	return tid;
+}
+
+/* A thread function that loads a spawned process's program. */
+static void
+spawn_start (void *aux) {
+	struct spawn_args *sa = aux;
+	struct thread *curr = thread_current ();
+	struct intr_frame if_;
+
+#ifdef VM
+	supplemental_page_table_init (&curr->spt);
+#endif
+	process_init ();
+	if (fd_table_copy (&curr->fds, &sa->parent->fds))
+		sa->success = exec_load (sa->cmd_line, &if_);
+	else {
+		palloc_free_page (sa->cmd_line);
+		sa->success = false;
+	}
+
+	/* SA is gone once the parent runs again. */
+	if (!sa->success) {
+		sema_up (&sa->loaded);
+		curr->exit_code = -1;
+		thread_exit ();
+	}
+	sema_up (&sa->loaded);
+	do_iret (&if_);
+	NOT_REACHED ();
+}
+
 
 /* Waits for thread TID to die and returns its exit status.  If
  * it was terminated by the kernel (i.e. killed due to an
@@ -219,23 +558,86 @@ process_exec (void *f_name) {
  * been successfully called for the given TID, returns -1
  * immediately, without waiting.
  *
- * This function will be implemented in problem 2-2.  For now, it
- * does nothing. */
+ * The child's record is looked up by tid and taken out of the table,
+ * so that a second wait finds nothing. */
 int
-process_wait (tid_t child_tid UNUSED) {
-
-	 /* auxilary implement*/
-	timer_sleep(100);
+process_wait (tid_t child_tid) {
+	struct thread *parent = thread_current ()->leader;
+	struct hash_elem *e = NULL;
+	struct child key, *c;
+	enum intr_level old_level;
+	int exit_code;
+
+	key.tid = child_tid;
+	lock_acquire (&parent->children_lock);
+	if (parent->children.buckets != NULL)
+		e = hash_delete (&parent->children, &key.elem);
+	lock_release (&parent->children_lock);
+	if (e == NULL)
+		return -1;
 
-	return -1;
+	c = hash_entry (e, struct child, elem);
+	sema_down (&c->exited);
+	exit_code = c->exit_code;
+	old_level = intr_disable ();
+	rusage_add (&parent->ru_children, &c->ru);
+	intr_set_level (old_level);
+	child_put (c);
+	return exit_code;
 }
 
 /* Exit the process. This function is called by thread_exit (). */
 void
 process_exit (void) {
 	struct thread *curr = thread_current ();
+	struct thread *leader = curr->leader;
+	enum intr_level old_level;
+	struct rusage ru;
+
+	if (leader != curr) {
+		/* A clone leaves the address space to its leader, letting go
+		 * of it before the leader can tear it down. */
+		fpu_release (curr);
+		curr->pml4 = NULL;
+		pml4_activate (NULL);
+		old_level = intr_disable ();
+		thread_get_rusage (curr, &ru);
+		rusage_add (&leader->ru_exited, &ru);
+		if (--leader->clone_cnt == 0)
+			sema_up (&leader->clones_done);
+		intr_set_level (old_level);
+		return;
+	}
+
+	/* The process lives on in its clones until they exit too. */
+	while (curr->clone_cnt > 0)
+		sema_down (&curr->clones_done);
+
 	printf ("%s: exit(%d)\n", curr->name, curr->exit_code);
+	fd_table_destroy (&curr->fds);
 	process_cleanup ();
+	rgroup_exit ();
+
+	process_rusage (curr, &ru);
+	if (process_report_rusage)
+		printf ("%s: rusage: utime %lld stime %lld minflt %lld majflt %lld "
+				"swapin %lld swapout %lld inblock %lld oublock %lld "
+				"nvcsw %lld nivcsw %lld nmigrate %lld\n", curr->name,
+				ru.utime, ru.stime, ru.minflt, ru.majflt, ru.nswapin,
+				ru.nswapout, ru.inblock, ru.oublock, ru.nvcsw, ru.nivcsw,
+				ru.nmigrate);
+
+	/* Children still running keep their records to themselves. */
+	if (curr->children.buckets != NULL)
+		hash_destroy (&curr->children, child_orphan);
+	if (curr->child != NULL) {
+		curr->child->exit_code = curr->exit_code;
+		curr->child->ru = ru;
+		rusage_add (&curr->child->ru, &curr->ru_children);
+		sema_up (&curr->child->exited);
+		child_put (curr->child);
+		curr->child = NULL;
+	}
 }
 
 /* Free the current process's resources. */
@@ -243,6 +645,8 @@ static void
 process_cleanup (void) {
 	struct thread *curr = thread_current ();
 
+	fpu_release (curr);
+
 #ifdef VM
 	supplemental_page_table_kill (&curr->spt);
 #endif
@@ -279,64 +683,83 @@ process_activate (struct thread *next) {
 	tss_update (next);
 }
 
-/* We load ELF binaries.  The following definitions are taken
- * from the ELF specification, [ELF1], more-or-less verbatim.  */
-
-/* ELF types.  See [ELF1] 1-2. */
-#define EI_NIDENT 16
-
-#define PT_NULL    0            /* Ignore. */
-#define PT_LOAD    1            /* Loadable segment. */
-#define PT_DYNAMIC 2            /* Dynamic linking info. */
-#define PT_INTERP  3            /* Name of dynamic loader. */
-#define PT_NOTE    4            /* Auxiliary info. */
-#define PT_SHLIB   5            /* Reserved. */
-#define PT_PHDR    6            /* Program header table. */
-#define PT_STACK   0x6474e551   /* Stack segment. */
-
-#define PF_X 1          /* Executable. */
-#define PF_W 2          /* Writable. */
-#define PF_R 4          /* Readable. */
-
-/* Executable header.  See [ELF1] 1-4 to 1-8.
- * This appears at the very beginning of an ELF binary. */
-struct ELF64_hdr {
-	unsigned char e_ident[EI_NIDENT];
-	uint16_t e_type;
-	uint16_t e_machine;
-	uint32_t e_version;
-	uint64_t e_entry;
-	uint64_t e_phoff;
-	uint64_t e_shoff;
-	uint32_t e_flags;
-	uint16_t e_ehsize;
-	uint16_t e_phentsize;
-	uint16_t e_phnum;
-	uint16_t e_shentsize;
-	uint16_t e_shnum;
-	uint16_t e_shstrndx;
-};
+static bool setup_stack (struct intr_frame *if_, size_t size);
+static bool load_segment (struct file *file, off_t ofs, uint8_t *upage,
+		uint32_t read_bytes, uint32_t zero_bytes,
+		bool writable);
 
-struct ELF64_PHDR {
-	uint32_t p_type;
-	uint32_t p_flags;
-	uint64_t p_offset;
-	uint64_t p_vaddr;
-	uint64_t p_paddr;
-	uint64_t p_filesz;
-	uint64_t p_memsz;
-	uint64_t p_align;
+/* A command line split into words: ARGC null-terminated words, packed
+ * one after another into the first BYTES bytes of WORDS. */
+struct args {
+	char *words;                /* The words, in the command line's page. */
+	int argc;                   /* Number of words. */
+	size_t bytes;               /* Bytes they take, with terminators. */
 };
 
-/* Abbreviations */
-#define ELF ELF64_hdr
-#define Phdr ELF64_PHDR
+/* Splits CMD_LINE, in place, into words separated by spaces, and
+ * packs them at its start, so that they can be copied to the user
+ * stack in one go.  Returns false if there is no word. */
+static bool
+args_parse (char *cmd_line, struct args *args) {
+	char *token, *save_ptr;
+	char *dst = cmd_line;
+
+	args->argc = 0;
+	for (token = strtok_r (cmd_line, " ", &save_ptr); token != NULL;
+			token = strtok_r (NULL, " ", &save_ptr)) {
+		size_t len = strlen (token) + 1;
+
+		/* DST never passes TOKEN, nor the end of it, where SAVE_PTR
+		 * points. */
+		memmove (dst, token, len);
+		dst += len;
+		args->argc++;
+	}
+	args->words = cmd_line;
+	args->bytes = dst - cmd_line;
+	return args->argc > 0;
+}
 
-static bool setup_stack (struct intr_frame *if_);
-static bool validate_segment (const struct Phdr *, struct file *);
-static bool load_segment (struct file *file, off_t ofs, uint8_t *upage,
-		uint32_t read_bytes, uint32_t zero_bytes,
-		bool writable);
+/* Returns where ARGS place argv[] on a stack whose top is USER_STACK:
+ * below the words, aligned to 16 bytes, so that with the return
+ * address pushed below it the stack is as a function call leaves it. */
+static char **
+args_argv (const struct args *args) {
+	uintptr_t words = USER_STACK - args->bytes;
+
+	return (char **) ((words - (args->argc + 1) * sizeof (char *))
+			& ~(uintptr_t) 15);
+}
+
+/* Returns the bytes of user stack that args_push() fills with ARGS. */
+static size_t
+args_stack_size (const struct args *args) {
+	return USER_STACK - ((uintptr_t) args_argv (args) - sizeof (void *));
+}
+
+/* Lays out ARGS on the current process's user stack, which must have
+ * args_stack_size() bytes mapped, and points IF_ at them: the words
+ * are copied with one memcpy(), then argv[] is filled in below them,
+ * and a null return address goes below that. */
+static void
+args_push (const struct args *args, struct intr_frame *if_) {
+	char *words = (char *) USER_STACK - args->bytes;
+	char **argv = args_argv (args);
+	size_t ofs = 0;
+	int i;
+
+	memcpy (words, args->words, args->bytes);
+	for (i = 0; i < args->argc; i++) {
+		argv[i] = words + ofs;
+		ofs += strlen (words + ofs) + 1;
+	}
+	argv[args->argc] = NULL;
+
+	if_->rsp = (uintptr_t) argv - sizeof (void *);
+	*(uint64_t *) if_->rsp = 0;
+	if_->R.rdi = args->argc;
+	if_->R.rsi = (uintptr_t) argv;
+}
 
 /* Loads an ELF executable from FILE_NAME into the current thread.
  * Stores the executable's entry point into *RIP
@@ -345,40 +768,17 @@ static bool load_segment (struct file *file, off_t ofs, uint8_t *upage,
 static bool
 load (const char *file_name, struct intr_frame *if_) {
 	struct thread *t = thread_current ();
-	struct ELF ehdr;
 	struct file *file = NULL;
-	off_t file_ofs;
+	struct image *image = NULL;
 	bool success = false;
-	int i;
-	char *token;
-	char *save_ptr;
-	int args_num = 0;
-	int nums;
-	int args_size;
-	char* args[MAX_ARG_SIZE];
-	char* args_address[MAX_ARG_SIZE];
-	char* file_name_cpy;
-
-
-	for (token = strtok_r ((char *)file_name, " ", &save_ptr); token != NULL;
-	     token = strtok_r (NULL, " ", &save_ptr)){
-		if (args_num >= MAX_ARG_SIZE){
-			success = false;
-			goto done;
-		}
-		args[args_num] = token;
-		args_num ++;
-	}
+	size_t i;
+	struct args args;
+	char *file_name_cpy;
 
-	args[args_num] = 0;
-
-	/* Example:
-	*	args-many a b c d e
-	*	args_num = 6
-	*	args[args_num] --> [*args-many][*a][*b][*c][*d][*e][NULL]
-	*/
+	if (!args_parse ((char *) file_name, &args))
+		goto done;
+	file_name_cpy = args.words;
 
-	file_name_cpy = args[0];
 	/* Allocate and activate page directory. */
 	t->pml4 = pml4_create ();
 	if (t->pml4 == NULL)
@@ -388,12 +788,8 @@ load (const char *file_name, struct intr_frame *if_) {
 	change_thread_name(file_name_cpy);
 
 
-	/* Initialization of file descriptor table entry */
-	for (i = 3 ; i < MAX_FILEDES_ENTRY ; i++){
-		t->filedes_table[i].use = false;
-		t->filedes_table[i].file_p = NULL;
-	}
-
+	/* Open file descriptors survive exec; a new thread starts with
+	 * an empty table. */
 
 	process_activate (thread_current ());
 
@@ -404,173 +800,61 @@ load (const char *file_name, struct intr_frame *if_) {
 		goto done;
 	}
 
-	/* Read and verify executable header. */
-	if (file_read (file, &ehdr, sizeof ehdr) != sizeof ehdr
-			|| memcmp (ehdr.e_ident, "\177ELF\2\1\1", 7)
-			|| ehdr.e_type != 2
-			|| ehdr.e_machine != 0x3E // amd64
-			|| ehdr.e_version != 1
-			|| ehdr.e_phentsize != sizeof (struct Phdr)
-			|| ehdr.e_phnum > 1024) {
+	/* Parse the headers, or find them parsed by an earlier load. */
+	image = image_get (file);
+	if (image == NULL) {
 		printf ("load: %s: error loading executable\n", file_name_cpy);
 		goto done;
 	}
+	for (i = 0; i < image->seg_cnt; i++) {
+		const struct image_segment *seg = &image->segs[i];
 
-	/* Read program headers. */
-	file_ofs = ehdr.e_phoff;
-	for (i = 0; i < ehdr.e_phnum; i++) {
-		struct Phdr phdr;
-
-		if (file_ofs < 0 || file_ofs > file_length (file))
+		if (!load_segment (file, seg->ofs, (void *) seg->upage,
+					seg->read_bytes, seg->zero_bytes, seg->writable))
 			goto done;
-		file_seek (file, file_ofs);
-
-		if (file_read (file, &phdr, sizeof phdr) != sizeof phdr)
-			goto done;
-		file_ofs += sizeof phdr;
-		switch (phdr.p_type) {
-			case PT_NULL:
-			case PT_NOTE:
-			case PT_PHDR:
-			case PT_STACK:
-			default:
-				/* Ignore this segment. */
-				break;
-			case PT_DYNAMIC:
-			case PT_INTERP:
-			case PT_SHLIB:
-				goto done;
-			case PT_LOAD:
-				if (validate_segment (&phdr, file)) {
-					bool writable = (phdr.p_flags & PF_W) != 0;
-					uint64_t file_page = phdr.p_offset & ~PGMASK;
-					uint64_t mem_page = phdr.p_vaddr & ~PGMASK;
-					uint64_t page_offset = phdr.p_vaddr & PGMASK;
-					uint32_t read_bytes, zero_bytes;
-					if (phdr.p_filesz > 0) {
-						/* Normal segment.
-						 * Read initial part from disk and zero the rest. */
-						read_bytes = page_offset + phdr.p_filesz;
-						zero_bytes = (ROUND_UP (page_offset + phdr.p_memsz, PGSIZE)
-								- read_bytes);
-					} else {
-						/* Entirely zero.
-						 * Don't read anything from disk. */
-						read_bytes = 0;
-						zero_bytes = ROUND_UP (page_offset + phdr.p_memsz, PGSIZE);
-					}
-					if (!load_segment (file, file_page, (void *) mem_page,
-								read_bytes, zero_bytes, writable))
-						goto done;
-				}
-				else
-					goto done;
-				break;
-		}
 	}
-
-	/* Set up stack. */
-	if (!setup_stack (if_))
-		goto done;
-
-	/* Start address. */
-	if_->rip = ehdr.e_entry;
-
-	/* Example:
-	*	args-many a b c d e
-	*	args_num = 6
-	*	args[args_num] --> [*args-many][*a][*b][*c][*d][*e][NULL]
-	*/
-
-	/* Make Arguments stack --> Arguments Setting */
-	nums = args_num - 1;
-
-	while (nums >= 0){
-		args_size = strlen(args[nums]) + 1;
-		if_ -> rsp -= args_size;
-		memcpy((void *) if_ -> rsp, args[nums], args_size);
-		args_address[nums] = (char *)if_ -> rsp;
-		nums --;
+#ifdef VM
+	/* The heap starts empty, at the first page past the segments. */
+	t->spt.heap_start = NULL;
+	for (i = 0; i < image->seg_cnt; i++) {
+		const struct image_segment *seg = &image->segs[i];
+		uint8_t *end = (uint8_t *) seg->upage + seg->read_bytes
+			+ seg->zero_bytes;
+
+		if (end > t->spt.heap_start)
+			t->spt.heap_start = end;
 	}
+	t->spt.brk = t->spt.heap_start;
+#endif
 
-	/* Word - align */
-
-	if_ -> rsp &= ~(7ULL);
-
-	nums = args_num - 1;
-	if_ -> rsp -= 8;
-	*(uint64_t *)(if_->rsp) = (uint64_t) 0;
-
-
-	while (nums >= 0){
-		if_ -> rsp -= 8;
-		*(uint64_t *)(if_->rsp) = (uint64_t) args_address[nums];
-		nums --;
-	}
-	/* fake return address */
-	if_ -> rsp -= 8;
-	*(uint64_t *)if_ -> rsp = 0;
+	/* Set up stack, with room for the arguments. */
+	if (!setup_stack (if_, args_stack_size (&args)))
+		goto done;
 
-	/* For debugging purpose */
-	/*hex_dump(if_ -> rsp, (void *) if_ -> rsp, USER_STACK - (if_ -> rsp) , true);*/
+	/* Map the time page, unless the executable is in its way. */
+	if (!pml4_share_page (t->pml4, TIMEPAGE_ADDR, timer_page ()))
+		goto done;
 
-	/* argc and argv*/
-	if_->R.rdi  = args_num;
-	if_->R.rsi = if_-> rsp + 8;
+	/* Start address. */
+	if_->rip = image->entry;
+#ifdef VM
+	/* Every segment is paged in on demand.  The page holding the entry
+	 * point is needed first of all, so it is read in now; if that
+	 * fails, the first instruction fault will try again. */
+	vm_claim_page (pg_round_down ((void *) image->entry));
+#endif
 
+	args_push (&args, if_);
 	success = true;
 
 done:
 	/* We arrive here whether the load is successful or not. */
+	image_put (image);
 	file_close (file);
 	return success;
 }
 
 
-/* Checks whether PHDR describes a valid, loadable segment in
- * FILE and returns true if so, false otherwise. */
-static bool
-validate_segment (const struct Phdr *phdr, struct file *file) {
-	/* p_offset and p_vaddr must have the same page offset. */
-	if ((phdr->p_offset & PGMASK) != (phdr->p_vaddr & PGMASK))
-		return false;
-
-	/* p_offset must point within FILE. */
-	if (phdr->p_offset > (uint64_t) file_length (file))
-		return false;
-
-	/* p_memsz must be at least as big as p_filesz. */
-	if (phdr->p_memsz < phdr->p_filesz)
-		return false;
-
-	/* The segment must not be empty. */
-	if (phdr->p_memsz == 0)
-		return false;
-
-	/* The virtual memory region must both start and end within the
-	   user address space range. */
-	if (!is_user_vaddr ((void *) phdr->p_vaddr))
-		return false;
-	if (!is_user_vaddr ((void *) (phdr->p_vaddr + phdr->p_memsz)))
-		return false;
-
-	/* The region cannot "wrap around" across the kernel virtual
-	   address space. */
-	if (phdr->p_vaddr + phdr->p_memsz < phdr->p_vaddr)
-		return false;
-
-	/* Disallow mapping page 0.
-	   Not only is it a bad idea to map page 0, but if we allowed
-	   it then user code that passed a null pointer to system calls
-	   could quite likely panic the kernel by way of null pointer
-	   assertions in memcpy(), etc. */
-	if (phdr->p_vaddr < PGSIZE)
-		return false;
-
-	/* It's okay. */
-	return true;
-}
-
 #ifndef VM
 /* Codes of this block will be ONLY USED DURING project 2.
  * If you want to implement the function for whole project 2, implement it
@@ -635,21 +919,26 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 	return true;
 }
 
-/* Create a minimal stack by mapping a zeroed page at the USER_STACK */
+/* Create a minimal stack by mapping zeroed pages below the USER_STACK,
+ * enough for SIZE bytes and at least one page. */
 static bool
-setup_stack (struct intr_frame *if_) {
-	uint8_t *kpage;
-	bool success = false;
+setup_stack (struct intr_frame *if_, size_t size) {
+	size_t page_cnt = size > PGSIZE ? DIV_ROUND_UP (size, PGSIZE) : 1;
+	size_t i;
 
-	kpage = palloc_get_page (PAL_USER | PAL_ZERO);
-	if (kpage != NULL) {
-		success = install_page (((uint8_t *) USER_STACK) - PGSIZE, kpage, true);
-		if (success)
-			if_->rsp = USER_STACK;
-		else
+	for (i = 1; i <= page_cnt; i++) {
+		uint8_t *kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+
+		if (kpage == NULL)
+			return false;
+		if (!install_page (((uint8_t *) USER_STACK) - i * PGSIZE, kpage,
+					true)) {
 			palloc_free_page (kpage);
+			return false;
+		}
 	}
-	return success;
+	if_->rsp = USER_STACK;
+	return true;
 }
 
 /* Adds a mapping from user virtual address UPAGE to kernel
@@ -675,11 +964,11 @@ install_page (void *upage, void *kpage, bool writable) {
  * If you want to implement the function for only project 2, implement it on the
  * upper block. */
 
+/* Fills PAGE from its segment on the first fault.  The segment's
+ * region records where in the executable each page comes from. */
 static bool
-lazy_load_segment (struct page *page, void *aux) {
-	/* TODO: Load the segment from the file */
-	/* TODO: This called when the first page fault occurs on address VA. */
-	/* TODO: VA is available when calling this function. */
+lazy_load_segment (struct page *page, void *aux UNUSED) {
+	return vma_read_page (page->vma, page->va, page->frame->kva);
 }
 
 /* Loads a segment starting at offset OFS in FILE at address
@@ -694,47 +983,59 @@ lazy_load_segment (struct page *page, void *aux) {
  * The pages initialized by this function must be writable by the
  * user process if WRITABLE is true, read-only otherwise.
  *
+ * The segment becomes a single region holding its own handle on
+ * FILE; each page is read on its first fault.  A read-only segment
+ * is file-backed, marked with VM_MARKER_1: its pages are never
+ * dirty, so they are dropped rather than swapped when evicted, and
+ * processes running the same executable share their frames.
+ *
  * Return true if successful, false if a memory allocation error
  * or disk read error occurs. */
 static bool
 load_segment (struct file *file, off_t ofs, uint8_t *upage,
 		uint32_t read_bytes, uint32_t zero_bytes, bool writable) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct vma *vma;
+
 	ASSERT ((read_bytes + zero_bytes) % PGSIZE == 0);
 	ASSERT (pg_ofs (upage) == 0);
 	ASSERT (ofs % PGSIZE == 0);
 
-	while (read_bytes > 0 || zero_bytes > 0) {
-		/* Do calculate how to fill this page.
-		 * We will read PAGE_READ_BYTES bytes from FILE
-		 * and zero the final PAGE_ZERO_BYTES bytes. */
-		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-		size_t page_zero_bytes = PGSIZE - page_read_bytes;
-
-		/* TODO: Set up aux to pass information to the lazy_load_segment. */
-		void *aux = NULL;
-		if (!vm_alloc_page_with_initializer (VM_ANON, upage,
-					writable, lazy_load_segment, aux))
+	vma = vma_create (spt, upage, read_bytes + zero_bytes,
+			writable ? VM_ANON : VM_FILE | VM_MARKER_1, writable);
+	if (vma == NULL)
+		return false;
+	if (read_bytes > 0) {
+		vma->file = file_reopen (file);
+		if (vma->file == NULL) {
+			vma_destroy (spt, vma);
 			return false;
-
-		/* Advance. */
-		read_bytes -= page_read_bytes;
-		zero_bytes -= page_zero_bytes;
-		upage += PGSIZE;
+		}
+		vma->offset = ofs;
+		vma->read_bytes = read_bytes;
+		if (writable)
+			vma->init = lazy_load_segment;
 	}
 	return true;
 }
 
-/* Create a PAGE of stack at the USER_STACK. Return true on success. */
+/* Create the stack at the USER_STACK, with its top SIZE bytes, and at
+ * least one page, brought in.  Return true on success. */
 static bool
-setup_stack (struct intr_frame *if_) {
-	bool success = false;
-	void *stack_bottom = (void *) (((uint8_t *) USER_STACK) - PGSIZE);
-
-	/* TODO: Map the stack on stack_bottom and claim the page immediately.
-	 * TODO: If success, set the rsp accordingly.
-	 * TODO: You should mark the page is stack. */
-	/* TODO: Your code goes here */
-
-	return success;
+setup_stack (struct intr_frame *if_, size_t size) {
+	size_t page_cnt = size > PGSIZE ? DIV_ROUND_UP (size, PGSIZE) : 1;
+	uint8_t *stack_bottom = (uint8_t *) USER_STACK - page_cnt * PGSIZE;
+	size_t i;
+
+	/* VM_MARKER_0 marks the stack's pages. */
+	if (page_cnt * PGSIZE > STACK_MAX
+			|| vma_create (&thread_current ()->spt, stack_bottom,
+				page_cnt * PGSIZE, VM_ANON | VM_MARKER_0, true) == NULL)
+		return false;
+	for (i = 0; i < page_cnt; i++)
+		if (!vm_claim_page (stack_bottom + i * PGSIZE))
+			return false;
+	if_->rsp = USER_STACK;
+	return true;
 }
 #endif /* VM */
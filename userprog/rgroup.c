@@ -0,0 +1,212 @@
+#include "userprog/rgroup.h"
+#include <debug.h>
+#include <list.h>
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#ifdef VM
+#include "vm/vm.h"
+#endif
+
+/* Resource groups.
+
+   A resource group holds processes whose memory and disk use are
+   limited together, so that one batch of processes cannot crowd
+   out another.  A process starts in its parent's group, or in none,
+   and moves into a new group with rgroup_create() or into another
+   with rgroup_join().  A group lives as long as it has members: it
+   goes when the last one leaves or exits, and its id is not used
+   again.
+
+   Frames and pages in swap are charged to the process that maps a
+   page, as in its own footprint, and through it to its group.  A
+   member that needs a frame while the group holds its cap of frames
+   evicts one of the group's own (see vm_get_frame()), so a group
+   over its cap pages against itself rather than against other
+   processes.  It goes beyond the cap only if none of its frames can
+   be evicted.  While a group holds its cap of swap, the anonymous
+   pages of its members stay resident, and so count against the
+   frame cap instead.
+
+   The members' disk requests draw on the group's share of disk
+   time, whose weight sets how the disk is divided between groups
+   with requests waiting (see devices/disk.c).
+
+   Each thread keeps a pointer to its process's share of disk time,
+   so a process moves only while it has no threads made by clone(). */
+
+static struct list groups;      /* All groups, in creation order. */
+static struct lock groups_lock; /* Protects GROUPS and member counts. */
+static int next_id;             /* Id of the next group created. */
+
+/* Initializes resource groups. */
+void
+rgroup_init (void) {
+	list_init (&groups);
+	lock_init (&groups_lock);
+	next_id = 1;
+}
+
+/* Returns the group with the given ID, or a null pointer if there is
+   none.  GROUPS_LOCK must be held. */
+static struct rgroup *
+lookup (int id) {
+	struct list_elem *e;
+
+	for (e = list_begin (&groups); e != list_end (&groups); e = list_next (e)) {
+		struct rgroup *g = list_entry (e, struct rgroup, elem);
+		if (g->id == id)
+			return g;
+	}
+	return NULL;
+}
+
+/* Adds a member to group G, which may be null, and returns G. */
+struct rgroup *
+rgroup_get (struct rgroup *g) {
+	if (g != NULL) {
+		lock_acquire (&groups_lock);
+		g->member_cnt++;
+		lock_release (&groups_lock);
+	}
+	return g;
+}
+
+/* Drops a member from group G, which may be null, freeing G with the
+   last. */
+void
+rgroup_put (struct rgroup *g) {
+	bool last = false;
+
+	if (g == NULL)
+		return;
+	lock_acquire (&groups_lock);
+	ASSERT (g->member_cnt > 0);
+	if (--g->member_cnt == 0) {
+		list_remove (&g->elem);
+		last = true;
+	}
+	lock_release (&groups_lock);
+	if (last) {
+		ASSERT (g->frames == 0 && g->swap == 0);
+		free (g);
+	}
+}
+
+/* Puts T, a new process that has no pages yet, into group G, for
+   which a member has been added. */
+void
+rgroup_adopt (struct thread *t, struct rgroup *g) {
+	t->rgroup = g;
+	t->io_share = g != NULL ? &g->io : NULL;
+}
+
+/* Moves the current process into group G, which may be null, for
+   which a member has been added, and drops it from the group it was
+   in, with whatever is charged to it.  Returns false, changing
+   nothing, if the process has clones. */
+static bool
+move (struct rgroup *g) {
+	struct thread *leader = thread_current ()->leader;
+	struct rgroup *old = leader->rgroup;
+
+	if (leader->clone_cnt > 0)
+		return false;
+	if (g == old) {
+		rgroup_put (g);
+		return true;
+	}
+#ifdef VM
+	vm_rgroup_move (leader, g);
+#else
+	leader->rgroup = g;
+#endif
+	leader->io_share = g != NULL ? &g->io : NULL;
+	rgroup_put (old);
+	return true;
+}
+
+/* Creates a resource group with LIMITS and moves the current
+   process into it.  Returns the group's id, or -1 if LIMITS are
+   invalid, memory is short, or the process has clones. */
+int
+rgroup_create (const struct rgroup_limits *limits) {
+	struct rgroup *g;
+	int id;
+
+	if (limits->io_weight > RGROUP_IO_WEIGHT_MAX)
+		return -1;
+	g = calloc (1, sizeof *g);
+	if (g == NULL)
+		return -1;
+	g->limits = *limits;
+	if (g->limits.io_weight == 0)
+		g->limits.io_weight = RGROUP_IO_WEIGHT_DEFAULT;
+	g->io.weight = g->limits.io_weight;
+	g->member_cnt = 1;
+
+	lock_acquire (&groups_lock);
+	id = g->id = next_id++;
+	list_push_back (&groups, &g->elem);
+	lock_release (&groups_lock);
+
+	if (!move (g)) {
+		rgroup_put (g);
+		return -1;
+	}
+	return id;
+}
+
+/* Moves the current process into the group with the given ID, or
+   out of any group if ID is 0.  Returns 0 if successful, or -1 if
+   there is no such group or the process has clones. */
+int
+rgroup_join (int id) {
+	struct rgroup *g = NULL;
+
+	if (id != 0) {
+		lock_acquire (&groups_lock);
+		g = lookup (id);
+		if (g != NULL)
+			g->member_cnt++;
+		lock_release (&groups_lock);
+		if (g == NULL)
+			return -1;
+	}
+	if (!move (g)) {
+		rgroup_put (g);
+		return -1;
+	}
+	return 0;
+}
+
+/* Stores the usage of the group with the given ID, or of the current
+   process's group if ID is 0, in *ST.  Returns false if there is no
+   such group. */
+bool
+rgroup_stat (int id, struct rgroup_stat *st) {
+	struct rgroup *g;
+
+	lock_acquire (&groups_lock);
+	g = id != 0 ? lookup (id) : thread_current ()->leader->rgroup;
+	if (g != NULL)
+		*st = (struct rgroup_stat) {
+			.id = g->id,
+			.member_cnt = g->member_cnt,
+			.frames = g->frames,
+			.swap = g->swap,
+			.reclaim_cnt = g->reclaim_cnt,
+			.over_cnt = g->over_cnt,
+			.inblock = g->io.read_cnt,
+			.oublock = g->io.write_cnt,
+		};
+	lock_release (&groups_lock);
+	return g != NULL;
+}
+
+/* Takes the current process, which is exiting and has given up its
+   pages, out of its group. */
+void
+rgroup_exit (void) {
+	move (NULL);
+}
@@ -1,61 +1,49 @@
 #include "userprog/syscall.h"
 #include <stdint.h>
 #include <stdio.h>
+#include <console.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <ioring.h>
+#include <iovec.h>
+#include <mman.h>
+#include <poll.h>
 #include <syscall-nr.h>
 #include "include/lib/syscall-nr.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "threads/loader.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/poll.h"
+#include "threads/trace.h"
+#include "threads/vaddr.h"
+#include "userprog/fstrace.h"
+#include "userprog/futex.h"
 #include "userprog/gdt.h"
+#include "userprog/image.h"
+#include "userprog/pipe.h"
+#include "userprog/process.h"
+#include "userprog/rgroup.h"
+#include "userprog/usercopy.h"
 #include "threads/flags.h"
 #include "intrinsic.h"
+#include "filesys/directory.h"
 #include "filesys/filesys.h"
+#include "filesys/file.h"
+#include "filesys/inode.h"
+#include "filesys/tmpfs.h"
+#include "devices/input.h"
 #include "devices/serial.h"
+#include "devices/timer.h"
+#ifdef VM
+#include "vm/vm.h"
+#endif
 
 void syscall_entry (void);
 void syscall_handler (struct intr_frame *);
 
-/* Reads a byte at user virtual address UADDR.
- * UADDR must be below KERN_BASE.
- * Returns the byte value if successful, -1 if a segfault
- * occurred. */
-
-static int64_t get_user(const uint8_t *uaddr) {
-    int64_t result;
-    // Inline assembly to attempt reading a byte from user space memory at address uaddr.
-    __asm __volatile (
-        "movabsq $done_get, %0\n"  // Move the address of the label 'done_get' into result.
-        "movzbq %1, %0\n"          // Attempt to move the byte at address uaddr to result, zero-extending it to 64 bits.
-        "done_get:\n"              // Label indicating the end of the memory access attempt.
-        : "=&a" (result)           // Output operand: 'result' will be stored in the 'a' register. (RAX register)
-        : "m" (*uaddr)             // Input operand: the memory address to read from.
-    );
-
-    return result;
-}
-
-/* Writes BYTE to user address UDST.
- * UDST must be below KERN_BASE.
- * Returns true if successful, false if a segfault occurred. */
-static bool
-put_user (uint8_t *udst, uint8_t byte) {
-    int64_t error_code;
-    __asm __volatile (
-    "movabsq $done_put, %0\n"
-    "movb %b2, %1\n"
-    "done_put:\n"
-    : "=&a" (error_code), "=m" (*udst) : "q" (byte));
-    return error_code != -1;
-}
-
-/* Memory check Routine */
-
-int
-memory_check(void *mem){
-	return get_user((const uint8_t *) mem);
-}
-
 /* System call.
  *
  * Previously system call services was handled by the interrupt handler
@@ -72,6 +60,13 @@ memory_check(void *mem){
 
 /* System Call function implementation */
 
+/* Returns the descriptor table of the current process, which its
+ * threads share. */
+static struct fd_table *
+current_fds(void){
+	return &thread_current()->leader->fds;
+}
+
 /* exit() System call */
 void
 sys_exit(int status){
@@ -86,74 +81,900 @@ sys_halt(void){
 	power_off();
 }
 
+/* Returns true if descriptor FD has O_NONBLOCK set. */
+static bool
+nonblocking(int fd){
+	int flags = fd_get_flags(current_fds(), fd);
+
+	return flags >= 0 && (flags & O_NONBLOCK);
+}
+
+/* Reads up to SIZE keys from the console into user buffer UBUF,
+ * waiting for the first but taking only those already typed after
+ * it. */
+static int
+console_read(void *ubuf, size_t size){
+	uint8_t kbuf[64];
+	size_t done = 0;
+
+	while (done < size){
+		size_t n = 0;
+
+		do
+			kbuf[n++] = input_getc();
+		while (n < sizeof kbuf && done + n < size && input_poll(NULL, NULL));
+		if (!copy_to_user((uint8_t *) ubuf + done, kbuf, n))
+			sys_exit(-1);
+		done += n;
+		if (!input_poll(NULL, NULL))
+			break;
+	}
+	return done;
+}
+
+/* read() System call */
+int
+sys_read(int fd, void *buf, size_t size){
+	struct open_file *of;
+	struct pipe *pipe;
+	int64_t n;
+
+	if (fd == 0)
+		return console_read(buf, size);
+	pipe = fd_get_pipe(current_fds(), fd, false, &of);
+	if (pipe == NULL)
+		return -1;
+	n = pipe_read(pipe, buf, size, nonblocking(fd));
+	fd_unref(of);
+	if (n == PIPE_FAULT)
+		sys_exit(-1);
+	return n;
+}
+
 /* write() System call */
 size_t
 sys_write(int fildes, const void *buf, size_t nbyte){
-	if (fildes == 1)
-		printf("%s", (char *) buf);
+	char *kbuf;
+	bool ok = true;
+
+	if (fildes != 1){
+		struct open_file *of;
+		struct pipe *pipe = fd_get_pipe(current_fds(), fildes, true, &of);
+		int64_t n;
+
+		if (pipe == NULL)
+			return nbyte;
+		n = pipe_write(pipe, buf, nbyte, nonblocking(fildes));
+		fd_unref(of);
+		if (n == PIPE_FAULT)
+			sys_exit(-1);
+		return n;
+	}
+
+	/* Copy in and putbuf() a page at a time, holding the console
+	 * throughout so that the write is not interleaved with other
+	 * output.  It is let go before a bad pointer kills us. */
+	kbuf = palloc_get_page(0);
+	if (kbuf == NULL)
+		return -1;
+	acquire_console();
+	for (size_t done = 0; done < nbyte; ){
+		size_t chunk = nbyte - done < PGSIZE ? nbyte - done : PGSIZE;
+
+		if (!copy_from_user(kbuf, (const uint8_t *) buf + done, chunk)){
+			ok = false;
+			break;
+		}
+		putbuf(kbuf, chunk);
+		done += chunk;
+	}
+	release_console();
+	palloc_free_page(kbuf);
+	if (!ok)
+		sys_exit(-1);
 	return nbyte;
 }
 
-/* open() System call */
-int
-sys_open(const char* path){	
-	struct thread *curr;
-	struct file *file_p;
+/* Copies the user string PATH into a new page and returns it, for
+ * the caller to free, or a null pointer if PATH is null or does not
+ * fit or memory is short.  A bad pointer kills the process. */
+static char *
+path_from_user(const char *path){
+	char *kpath;
+	int64_t len;
 
 	/* check if path is not NULL */
 	if (path == NULL){
-	    return -1;
-	}
-	/* check if path pointer is below KERN_BASE */
-	if (is_user_vaddr(path) == 0){
-	    return -1;
+	    return NULL;
 	}
-	/* check if path pointer is valid */
-	if (memory_check((void *) path) == -1){
+	/* Copy the whole path in; a bad pointer kills the process. */
+	kpath = palloc_get_page(0);
+	if (kpath == NULL)
+	    return NULL;
+	len = strncpy_from_user(kpath, path, PGSIZE);
+	if (len < 0){
+	    palloc_free_page(kpath);
 	    sys_exit(-1);
 	}
-	/* We are now safe to deference pointer provided by user process */
-	curr = thread_current();
-	file_p = filesys_open(path);
+	if (len == PGSIZE){
+	    palloc_free_page(kpath);
+	    return NULL;
+	}
+	return kpath;
+}
 
-	/* check if file does not exists in our file system */
-	if (file_p == NULL){
+/* create() System call */
+bool
+sys_create(const char *path, off_t initial_size){
+	int64_t start = fstrace_begin();
+	char *kpath;
+	bool success;
+
+	if (initial_size < 0)
+		return false;
+	kpath = path_from_user(path);
+	if (kpath == NULL)
+		return false;
+	success = filesys_create(kpath, initial_size);
+	fstrace_path(start, FSTRACE_CREATE, kpath, initial_size, success ? 0 : -1);
+	palloc_free_page(kpath);
+	return success;
+}
+
+/* remove() System call */
+bool
+sys_remove(const char *path){
+	int64_t start = fstrace_begin();
+	char *kpath = path_from_user(path);
+	bool success;
+
+	if (kpath == NULL)
+		return false;
+	success = filesys_remove(kpath);
+	fstrace_path(start, FSTRACE_REMOVE, kpath, 0, success ? 0 : -1);
+	palloc_free_page(kpath);
+	return success;
+}
+
+/* open() System call */
+int
+sys_open(const char* path){	
+	int64_t start = fstrace_begin();
+	struct file *file_p;
+	char *kpath;
+	off_t length = 0;
+	int fd = -1;
+
+	kpath = path_from_user(path);
+	if (kpath == NULL)
 	    return -1;
+	file_p = filesys_open(kpath);
+
+	/* check if file does not exists in our file system */
+	if (file_p != NULL){
+	    length = file_length(file_p);
+	    fd = fd_open(current_fds(), file_p);
+	    if (fd < 0)
+	        file_close(file_p);
 	}
+	fstrace_path(start, FSTRACE_OPEN, kpath, length, fd);
+	palloc_free_page(kpath);
+	return fd;
 
-	for (int i = 3 ; i < MAX_FILEDES_ENTRY ; i ++){
-		if (curr->filedes_table[i].use == false){
-			curr->filedes_table[i].use = true;
-			curr->filedes_table[i].file_p = file_p;
-			return i;
-		}
+}
+
+/* mount() System call.  Only memory-backed file systems can be
+ * mounted, which is asked for with a negative CHAN_NO; there is no
+ * second file system disk to mount. */
+int
+sys_mount(const char *path, int chan_no, int dev_no UNUSED){
+	char *kpath;
+	bool success;
+
+	if (chan_no >= 0)
+		return -1;
+	kpath = path_from_user(path);
+	if (kpath == NULL)
+		return -1;
+	success = filesys_mount(kpath, &tmpfs_fs_ops);
+	palloc_free_page(kpath);
+	return success ? 0 : -1;
+}
+
+/* umount() System call */
+int
+sys_umount(const char *path){
+	char *kpath = path_from_user(path);
+	bool success;
+
+	if (kpath == NULL)
+		return -1;
+	success = filesys_umount(kpath);
+	palloc_free_page(kpath);
+	return success ? 0 : -1;
+}
+
+/* symlink() System call */
+int
+sys_symlink(const char *target, const char *linkpath){
+	char *ktarget, *klinkpath;
+	bool success = false;
+
+	ktarget = path_from_user(target);
+	if (ktarget == NULL)
+		return -1;
+	klinkpath = path_from_user(linkpath);
+	if (klinkpath != NULL){
+		success = filesys_symlink(ktarget, klinkpath);
+		palloc_free_page(klinkpath);
 	}
+	palloc_free_page(ktarget);
+	return success ? 0 : -1;
+}
 
-	return -1;
+/* spawn() System call */
+int
+sys_spawn(const char *path, char *const argv[]){
+	char *cmd_line;
+	int64_t len;
+	size_t used;
 
+	if (path == NULL)
+		return TID_ERROR;
+	cmd_line = palloc_get_page(0);
+	if (cmd_line == NULL)
+		return TID_ERROR;
+
+	/* Build the command line that load() splits up again: PATH, which
+	 * names the program as argv[0] would, then the other arguments. */
+	len = strncpy_from_user(cmd_line, path, PGSIZE);
+	if (len < 0)
+		goto bad_ptr;
+	if (len == 0 || len == PGSIZE)
+		goto fail;
+	used = len;
+	for (size_t i = 1; argv != NULL; i++){
+		const char *arg;
+
+		if (!copy_from_user(&arg, &argv[i], sizeof arg))
+			goto bad_ptr;
+		if (arg == NULL)
+			break;
+		if (used + 1 >= PGSIZE)
+			goto fail;
+		cmd_line[used++] = ' ';
+		len = strncpy_from_user(cmd_line + used, arg, PGSIZE - used);
+		if (len < 0)
+			goto bad_ptr;
+		if ((size_t) len == PGSIZE - used)
+			goto fail;
+		used += len;
+	}
+	return process_spawn(cmd_line);
+
+fail:
+	palloc_free_page(cmd_line);
+	return TID_ERROR;
+bad_ptr:
+	palloc_free_page(cmd_line);
+	sys_exit(-1);
+	NOT_REACHED();
+}
+
+/* wait() System call */
+int
+sys_wait(int pid){
+	return process_wait(pid);
 }
 
 /* close() System call */
 int
 sys_close(int fd){
-    struct thread *curr = thread_current();
-	
-	/* If fd and filedes_entry not matches, return -1 */
-	if (curr->filedes_table[fd].use == false)
+	int64_t start = fstrace_begin();
+	struct open_file *of = fd_ref(current_fds(), fd);
+	bool is_file = of != NULL && of->file != NULL;
+
+	fd_unref(of);
+
+	/* If fd is not open, return -1 */
+	if (!fd_close(current_fds(), fd))
 		return -1;
-	
-	curr->filedes_table[fd].use = false;
-	curr->filedes_table[fd].file_p = NULL;
+	if (is_file)
+		fstrace_fd(start, FSTRACE_CLOSE, fd, 0, 0, 0);
 
 	/* Close success */
 	return 0;
 }
 
+/* pipe() System call */
+int
+sys_pipe(int *fds){
+	struct fd_table *table = current_fds();
+	struct pipe *pipe = pipe_create();
+	int kfds[2];
+
+	if (pipe == NULL)
+		return -1;
+	kfds[0] = fd_open_pipe(table, pipe, false);
+	if (kfds[0] < 0){
+		pipe_close(pipe, false);
+		pipe_close(pipe, true);
+		return -1;
+	}
+	kfds[1] = fd_open_pipe(table, pipe, true);
+	if (kfds[1] < 0){
+		pipe_close(pipe, true);
+		fd_close(table, kfds[0]);
+		return -1;
+	}
+	if (!copy_to_user(fds, kfds, sizeof kfds)){
+		fd_close(table, kfds[0]);
+		fd_close(table, kfds[1]);
+		sys_exit(-1);
+	}
+	return 0;
+}
+
+/* dup2() System call */
+int
+sys_dup2(int oldfd, int newfd){
+	return fd_dup2(current_fds(), oldfd, newfd);
+}
+
+/* Returns the events pending on descriptor FD, whose open file is OF
+ * or null, out of EVENTS and those always reported.  If PT is not
+ * null, also adds W to the poll queue of what FD refers to.  The
+ * console's output and files never block. */
+static short
+poll_fd(int fd, struct open_file *of, short events,
+		struct poll_table *pt, struct poll_waiter *w){
+	int revents;
+
+	if (fd == 0)
+		revents = input_poll(pt, w) ? POLLIN : 0;
+	else if (fd == 1 || fd == 2)
+		revents = POLLOUT;
+	else if (of == NULL)
+		revents = POLLNVAL;
+	else if (of->pipe != NULL)
+		revents = pipe_poll(of->pipe, of->pipe_writer, pt, w);
+	else
+		revents = POLLIN | POLLOUT;
+	return revents & (events | POLLERR | POLLHUP | POLLNVAL);
+}
+
+/* poll() System call.  Waits until one of the NFDS descriptors in
+ * UFDS has an event it asks for, or TIMEOUT milliseconds pass, or
+ * forever if TIMEOUT is negative.  Returns how many have events, 0
+ * on a timeout. */
+int
+sys_poll(struct pollfd *ufds, unsigned nfds, int timeout){
+	struct pollfd *fds;
+	struct open_file **files;
+	struct poll_waiter *waiters;
+	struct poll_table pt;
+	int64_t deadline;
+	int ready;
+
+	if (nfds > FD_MAX)
+		return -1;
+	fds = malloc(nfds * sizeof *fds);
+	files = malloc(nfds * sizeof *files);
+	waiters = malloc(nfds * sizeof *waiters);
+	if (nfds > 0 && (fds == NULL || files == NULL || waiters == NULL)){
+		free(fds);
+		free(files);
+		free(waiters);
+		return -1;
+	}
+	if (!copy_from_user(fds, ufds, nfds * sizeof *fds)){
+		free(fds);
+		free(files);
+		free(waiters);
+		sys_exit(-1);
+	}
+
+	/* Hold each open file so that a pipe cannot go away while we
+	 * sit on its queue, even if another thread closes FD. */
+	for (unsigned i = 0; i < nfds; i++){
+		files[i] = fds[i].fd >= 0 ? fd_ref(current_fds(), fds[i].fd) : NULL;
+		waiters[i].queue = NULL;
+	}
+
+	/* Check every descriptor, joining their queues on the first
+	 * pass, and sleep until a queue is woken or time runs out. */
+	deadline = timeout < 0 ? INT64_MAX : timer_deadline(timeout);
+	poll_table_init(&pt);
+	for (bool first = true; ; first = false){
+		poll_arm(&pt);
+		ready = 0;
+		for (unsigned i = 0; i < nfds; i++){
+			fds[i].revents = 0;
+			if (fds[i].fd >= 0)
+				fds[i].revents = poll_fd(fds[i].fd, files[i], fds[i].events,
+						first ? &pt : NULL, &waiters[i]);
+			if (fds[i].revents != 0)
+				ready++;
+		}
+		if (ready > 0 || timeout == 0 || timer_clock() >= deadline)
+			break;
+		poll_sleep(&pt, deadline);
+	}
+
+	for (unsigned i = 0; i < nfds; i++){
+		poll_remove(&waiters[i]);
+		if (files[i] != NULL)
+			fd_unref(files[i]);
+	}
+	free(files);
+	free(waiters);
+	if (!copy_to_user(ufds, fds, nfds * sizeof *fds)){
+		free(fds);
+		sys_exit(-1);
+	}
+	free(fds);
+	return ready;
+}
+
+/* fcntl() System call.  Only F_GETFL and F_SETFL, and only for
+ * descriptors above the console's, which has no flags to set. */
+int
+sys_fcntl(int fd, int cmd, int arg){
+	struct fd_table *table = current_fds();
+
+	if (fd >= 0 && fd < FD_FIRST)
+		return cmd == F_GETFL ? 0 : -1;
+	switch (cmd){
+		case F_GETFL:
+			return fd_get_flags(table, fd);
+		case F_SETFL:
+			return fd_set_flags(table, fd, arg & O_NONBLOCK) ? 0 : -1;
+		default:
+			return -1;
+	}
+}
+
+/* filesize() System call */
+off_t
+sys_filesize(int fd){
+	struct open_file *of;
+	struct file *file = fd_get(current_fds(), fd, &of);
+	off_t length = file != NULL ? file_length(file) : -1;
+
+	fd_unref(of);
+	return length;
+}
+
+/* seek() System call.  A negative position is ignored. */
+void
+sys_seek(int fd, off_t position){
+	int64_t start = fstrace_begin();
+	struct open_file *of;
+	struct file *file = fd_get(current_fds(), fd, &of);
+
+	if (file != NULL && position >= 0){
+		file_seek(file, position);
+		fstrace_fd(start, FSTRACE_SEEK, fd, position, 0, 0);
+	}
+	fd_unref(of);
+}
+
+/* tell() System call */
+off_t
+sys_tell(int fd){
+	struct open_file *of;
+	struct file *file = fd_get(current_fds(), fd, &of);
+	off_t pos = file != NULL ? file_tell(file) : -1;
+
+	fd_unref(of);
+	return pos;
+}
+
+/* fsync() System call */
+int
+sys_fsync(int fd){
+	int64_t start = fstrace_begin();
+	struct open_file *of;
+	struct file *file = fd_get(current_fds(), fd, &of);
+
+	if (file == NULL)
+		return -1;
+
+	inode_flush(file_get_inode(file));
+	fd_unref(of);
+	fstrace_fd(start, FSTRACE_FSYNC, fd, 0, 0, 0);
+	return 0;
+}
+
+/* fallocate() System call */
+int
+sys_fallocate(int fd, off_t offset, off_t length){
+	int64_t start = fstrace_begin();
+	struct open_file *of;
+	struct file *file = fd_get(current_fds(), fd, &of);
+	int result;
+
+	if (file == NULL || offset < 0 || length <= 0
+			|| length > OFF_T_MAX - offset){
+		fd_unref(of);
+		return -1;
+	}
+	result = file_allocate(file, offset, length) ? 0 : -1;
+	fd_unref(of);
+	fstrace_fd(start, FSTRACE_FALLOCATE, fd, offset, length, result);
+	return result;
+}
+
+/* readdir_batch() System call.  Goes on from FD's file position,
+ * which it leaves after the entries returned. */
+int
+sys_readdir_batch(int fd, void *buf, size_t size){
+	struct open_file *of;
+	struct file *file = fd_get(current_fds(), fd, &of);
+	struct dir *dir = NULL;
+	void *kbuf = NULL;
+	size_t done;
+
+	if (file != NULL && inode_is_dir(file_get_inode(file))
+			&& size >= DIRENT_RECLEN(NAME_MAX))
+		kbuf = palloc_get_page(0);
+	if (kbuf != NULL)
+		dir = dir_open(inode_reopen(file_get_inode(file)));
+	if (dir == NULL){
+		if (kbuf != NULL)
+			palloc_free_page(kbuf);
+		fd_unref(of);
+		return -1;
+	}
+	if (size > PGSIZE)
+		size = PGSIZE;
+	dir_seek(dir, file_tell(file));
+	done = dir_readdir_batch(dir, kbuf, size);
+	file_seek(file, dir_tell(dir));
+	dir_close(dir);
+	fd_unref(of);
+	if (!copy_to_user(buf, kbuf, done)){
+		palloc_free_page(kbuf);
+		sys_exit(-1);
+	}
+	palloc_free_page(kbuf);
+	return done;
+}
+
+/* Moves SIZE bytes between user buffer UBUF and FILE at offset OFS,
+ * a page at a time through KBUF: into UBUF if READ, out of it
+ * otherwise.  Returns the bytes moved, which are fewer than SIZE at
+ * end of file, or -1 if UBUF is bad. */
+static int64_t
+file_xfer(struct file *file, void *ubuf, size_t size, off_t ofs,
+		bool read, void *kbuf){
+	size_t done = 0;
+
+	while (done < size){
+		size_t chunk = size - done < PGSIZE ? size - done : PGSIZE;
+		off_t moved;
+
+		if (read){
+			moved = file_read_at(file, kbuf, chunk, ofs + done);
+			if (!copy_to_user((uint8_t *) ubuf + done, kbuf, moved))
+				return -1;
+		} else {
+			if (!copy_from_user(kbuf, (const uint8_t *) ubuf + done, chunk))
+				return -1;
+			moved = file_write_at(file, kbuf, chunk, ofs + done);
+		}
+		done += moved;
+		if ((size_t) moved < chunk)
+			break;
+	}
+	return done;
+}
+
+/* pread() and pwrite(): SIZE bytes at OFS in FD, leaving the file
+ * position alone. */
+static int
+positional_io(int fd, void *buf, size_t size, off_t ofs, bool read){
+	int64_t start = fstrace_begin();
+	struct open_file *of;
+	struct file *file = fd_get(current_fds(), fd, &of);
+	void *kbuf = NULL;
+	int64_t done;
+
+	if (file != NULL && ofs >= 0 && size <= (size_t) (OFF_T_MAX - ofs))
+		kbuf = palloc_get_page(0);
+	if (kbuf == NULL){
+		fd_unref(of);
+		return -1;
+	}
+	done = file_xfer(file, buf, size, ofs, read, kbuf);
+	palloc_free_page(kbuf);
+	fd_unref(of);
+	if (done < 0)
+		sys_exit(-1);
+	fstrace_fd(start, read ? FSTRACE_READ : FSTRACE_WRITE, fd, ofs, size,
+			done);
+	return done;
+}
+
+/* pread() System call */
+int
+sys_pread(int fd, void *buf, size_t size, off_t ofs){
+	return positional_io(fd, buf, size, ofs, true);
+}
+
+/* pwrite() System call */
+int
+sys_pwrite(int fd, const void *buf, size_t size, off_t ofs){
+	return positional_io(fd, (void *) buf, size, ofs, false);
+}
+
+/* readv() and writev(): the IOVCNT buffers of UIOV in turn, at FD's
+ * file position, which advances past them.  A short transfer ends the
+ * call, so the bytes moved are always one contiguous run of the
+ * file. */
+static int
+vectored_io(int fd, const struct iovec *uiov, int iovcnt, bool read){
+	int64_t start = fstrace_begin();
+	struct iovec iov[IOV_MAX];
+	struct open_file *of;
+	struct file *file;
+	void *kbuf;
+	int64_t total = 0, want;
+	off_t pos;
+
+	if (iovcnt < 0 || iovcnt > IOV_MAX)
+		return -1;
+	if (!copy_from_user(iov, uiov, iovcnt * sizeof *iov))
+		sys_exit(-1);
+
+	/* The console takes plain writes. */
+	if (fd == 1 && !read){
+		for (int i = 0; i < iovcnt; i++)
+			total += sys_write(fd, iov[i].iov_base, iov[i].iov_len);
+		return total;
+	}
+
+	for (int i = 0; i < iovcnt; i++)
+		if (iov[i].iov_len > (size_t) (INT32_MAX - total))
+			return -1;
+		else
+			total += iov[i].iov_len;
+
+	file = fd_get(current_fds(), fd, &of);
+	if (file == NULL)
+		return -1;
+	kbuf = palloc_get_page(0);
+	if (kbuf == NULL){
+		fd_unref(of);
+		return -1;
+	}
+	pos = file_tell(file);
+	want = total;
+	total = 0;
+	for (int i = 0; i < iovcnt; i++){
+		int64_t done = file_xfer(file, iov[i].iov_base, iov[i].iov_len,
+				pos + total, read, kbuf);
+
+		if (done < 0){
+			palloc_free_page(kbuf);
+			fd_unref(of);
+			sys_exit(-1);
+		}
+		total += done;
+		if ((size_t) done < iov[i].iov_len)
+			break;
+	}
+	palloc_free_page(kbuf);
+	file_seek(file, pos + total);
+	fd_unref(of);
+	fstrace_fd(start, read ? FSTRACE_READ : FSTRACE_WRITE, fd, pos, want,
+			total);
+	return total;
+}
+
+/* readv() System call */
+int
+sys_readv(int fd, const struct iovec *iov, int iovcnt){
+	return vectored_io(fd, iov, iovcnt, true);
+}
+
+/* writev() System call */
+int
+sys_writev(int fd, const struct iovec *iov, int iovcnt){
+	return vectored_io(fd, iov, iovcnt, false);
+}
+
+/* copy_file_range() System call */
+int
+sys_copy_file_range(int fd_in, off_t off_in, int fd_out, off_t off_out,
+		size_t size){
+	struct fd_table *fds = current_fds();
+	struct open_file *in_of, *out_of;
+	struct file *in = fd_get(fds, fd_in, &in_of);
+	struct file *out = fd_get(fds, fd_out, &out_of);
+	int result = -1;
+
+	/* A copy within one file must not read what it has written. */
+	if (in != NULL && out != NULL && off_in >= 0 && off_out >= 0
+			&& size <= (size_t) (OFF_T_MAX - off_in)
+			&& size <= (size_t) (OFF_T_MAX - off_out)
+			&& !(file_get_inode(in) == file_get_inode(out)
+				&& off_in < off_out + (off_t) size
+				&& off_out < off_in + (off_t) size))
+		result = file_copy_range(in, off_in, out, off_out, size);
+	fd_unref(in_of);
+	fd_unref(out_of);
+	return result;
+}
+
+/* memstat() System call */
+bool
+sys_memstat(int tag, struct memstat *ust){
+	struct memstat st;
+
+	if (!malloc_get_stats(tag, &st))
+		return false;
+
+	/* Copy out, killing the process on a bad pointer. */
+	if (!copy_to_user(ust, &st, sizeof st))
+		sys_exit(-1);
+	return true;
+}
+
+/* getrusage() System call */
+int
+sys_getrusage(int who, struct rusage *ru){
+	struct rusage kru;
+
+	if (!process_get_rusage(who, &kru))
+		return -1;
+
+	/* Copy out, killing the process on a bad pointer. */
+	if (!copy_to_user(ru, &kru, sizeof kru))
+		sys_exit(-1);
+	return 0;
+}
+
+/* rgroup_create() System call */
+int
+sys_rgroup_create(const struct rgroup_limits *ulimits){
+	struct rgroup_limits limits;
+
+	/* Copy in, killing the process on a bad pointer. */
+	if (!copy_from_user(&limits, ulimits, sizeof limits))
+		sys_exit(-1);
+	return rgroup_create(&limits);
+}
+
+/* rgroup_join() System call */
+int
+sys_rgroup_join(int id){
+	return rgroup_join(id);
+}
+
+/* sched_setaffinity() System call */
+int
+sys_sched_setaffinity(int tid, unsigned mask){
+	return thread_set_affinity(tid, mask) ? 0 : -1;
+}
+
+/* sched_getaffinity() System call */
+int
+sys_sched_getaffinity(int tid){
+	return thread_get_affinity(tid);
+}
+
+/* rgroup_stat() System call */
+int
+sys_rgroup_stat(int id, struct rgroup_stat *ust){
+	struct rgroup_stat st;
+
+	if (!rgroup_stat(id, &st))
+		return -1;
+
+	/* Copy out, killing the process on a bad pointer. */
+	if (!copy_to_user(ust, &st, sizeof st))
+		sys_exit(-1);
+	return 0;
+}
+
+#ifdef VM
+/* mmap() System call.  WRITABLE may carry MAP_POPULATE. */
+void *
+sys_mmap(void *addr, size_t length, int writable, int fd, off_t offset){
+	struct open_file *of;
+	struct file *file = fd_get(current_fds(), fd, &of);
+	void *mapped;
+
+	if (file == NULL)
+		return NULL;
+	mapped = do_mmap(addr, length, writable & ~MAP_POPULATE, file, offset);
+	fd_unref(of);
+	if (mapped != NULL && (writable & MAP_POPULATE))
+		vm_populate(mapped);
+	return mapped;
+}
+
+/* munmap() System call */
+void
+sys_munmap(void *addr){
+	do_munmap(addr);
+}
+
+/* shm_open() System call */
+int
+sys_shm_open(const char *name, size_t size){
+	char kname[SHM_NAME_MAX + 2];
+	struct shm *shm;
+	int64_t len;
+	int fd;
+
+	len = strncpy_from_user(kname, name, sizeof kname);
+	if (len < 0)
+		sys_exit(-1);
+	if (len == sizeof kname)
+		return -1;
+	shm = shm_open(kname, size);
+	if (shm == NULL)
+		return -1;
+	fd = fd_open_shm(current_fds(), shm);
+	if (fd < 0)
+		shm_put(shm);
+	return fd;
+}
+
+/* shm_map() System call */
+void *
+sys_shm_map(int fd, void *addr){
+	struct open_file *of;
+	struct shm *shm = fd_get_shm(current_fds(), fd, &of);
+	void *mapped;
+
+	if (shm == NULL)
+		return NULL;
+	mapped = shm_map(shm, addr);
+	fd_unref(of);
+	return mapped;
+}
+
+/* madvise() System call */
+int
+sys_madvise(void *addr, size_t length, int advice){
+	return vm_madvise(addr, length, advice) ? 0 : -1;
+}
+
+/* msync() System call */
+int
+sys_msync(void *addr, size_t length, int flags){
+	return vm_msync(addr, length, flags) ? 0 : -1;
+}
+
+/* sbrk() System call */
+void *
+sys_sbrk(intptr_t increment){
+	return vm_sbrk(increment);
+}
+#endif
+
 /* End of Implementation of System call */
 
 /* Initialization of System call */
 void
 syscall_init (void) {
+	/* syscall-entry.S gives this call the full frame. */
+	ASSERT (SYS_FORK == 2);
+
+	syscall_init_cpu ();
+	futex_init();
+	image_init();
+	rgroup_init();
+}
+
+/* Points the running CPU's `syscall' instruction at
+   syscall_entry.  syscall_init() does this for the boot processor;
+   the others call it as they start. */
+void
+syscall_init_cpu (void) {
 	write_msr(MSR_STAR, ((uint64_t)SEL_UCSEG - 0x10) << 48  |
 			((uint64_t)SEL_KCSEG) << 32);
 	write_msr(MSR_LSTAR, (uint64_t) syscall_entry);
@@ -166,49 +987,486 @@ syscall_init (void) {
 }
 
 
+/* System call dispatch.
+ *
+ * Each system call number indexes a descriptor giving its name, how
+ * many arguments it takes, the handler that runs it, and which return
+ * value reports failure.  Handlers get the arguments in the order the
+ * user library passes them: RDI, RSI, RDX, R10, R8, R9.  Calls known to
+ * the user library but not implemented here have no handler and
+ * return -1; numbers outside the table kill the process.
+ *
+ * Every call is counted per number, with the cycles spent in it and
+ * how many of them failed, to show where system call time goes. */
+
+typedef uint64_t syscall_func (const uint64_t args[]);
+
+/* Which return value of a system call reports failure. */
+enum syscall_error {
+	SCE_NONE,                   /* Cannot fail, or returns nothing. */
+	SCE_NEGATIVE,               /* Fails with a negative value. */
+	SCE_ZERO,                   /* Fails with zero, false or NULL. */
+};
+
+struct syscall_desc {
+	const char *name;           /* Name, for statistics. */
+	int argc;                   /* Number of arguments. */
+	syscall_func *func;         /* Handler, or null if unimplemented. */
+	enum syscall_error error;   /* How failure is reported. */
+};
+
+struct syscall_stats {
+	long long calls;            /* Times made. */
+	long long errors;           /* ...that failed. */
+	uint64_t tsc;               /* Cycles spent in them. */
+};
+
+static uint64_t
+sc_halt (const uint64_t args[] UNUSED) {
+	sys_halt ();
+	NOT_REACHED ();
+}
+
+static uint64_t
+sc_exit (const uint64_t args[]) {
+	sys_exit ((int) args[0]);
+	NOT_REACHED ();
+}
+
+static uint64_t
+sc_open (const uint64_t args[]) {
+	return sys_open ((const char *) args[0]);
+}
+
+static uint64_t
+sc_create (const uint64_t args[]) {
+	return sys_create ((const char *) args[0], (off_t) args[1]);
+}
+
+static uint64_t
+sc_remove (const uint64_t args[]) {
+	return sys_remove ((const char *) args[0]);
+}
+
+static uint64_t
+sc_mount (const uint64_t args[]) {
+	return sys_mount ((const char *) args[0], (int) args[1], (int) args[2]);
+}
+
+static uint64_t
+sc_umount (const uint64_t args[]) {
+	return sys_umount ((const char *) args[0]);
+}
+
+static uint64_t
+sc_symlink (const uint64_t args[]) {
+	return sys_symlink ((const char *) args[0], (const char *) args[1]);
+}
+
+static uint64_t
+sc_filesize (const uint64_t args[]) {
+	return sys_filesize ((int) args[0]);
+}
+
+static uint64_t
+sc_seek (const uint64_t args[]) {
+	sys_seek ((int) args[0], (off_t) args[1]);
+	return 0;
+}
+
+static uint64_t
+sc_tell (const uint64_t args[]) {
+	return sys_tell ((int) args[0]);
+}
+
+static uint64_t
+sc_read (const uint64_t args[]) {
+	return sys_read ((int) args[0], (void *) args[1], args[2]);
+}
+
+static uint64_t
+sc_write (const uint64_t args[]) {
+	return sys_write ((int) args[0], (const void *) args[1], args[2]);
+}
+
+static uint64_t
+sc_spawn (const uint64_t args[]) {
+	return sys_spawn ((const char *) args[0], (char *const *) args[1]);
+}
+
+static uint64_t
+sc_wait (const uint64_t args[]) {
+	return sys_wait ((int) args[0]);
+}
+
+static uint64_t
+sc_pipe (const uint64_t args[]) {
+	return sys_pipe ((int *) args[0]);
+}
+
+static uint64_t
+sc_poll (const uint64_t args[]) {
+	return sys_poll ((struct pollfd *) args[0], args[1], (int) args[2]);
+}
+
+static uint64_t
+sc_fcntl (const uint64_t args[]) {
+	return sys_fcntl ((int) args[0], (int) args[1], (int) args[2]);
+}
+
+static uint64_t
+sc_close (const uint64_t args[]) {
+	return sys_close ((int) args[0]);
+}
+
+static uint64_t
+sc_dup2 (const uint64_t args[]) {
+	return sys_dup2 ((int) args[0], (int) args[1]);
+}
+
+static uint64_t
+sc_fsync (const uint64_t args[]) {
+	return sys_fsync ((int) args[0]);
+}
+
+static uint64_t
+sc_fallocate (const uint64_t args[]) {
+	return sys_fallocate ((int) args[0], (off_t) args[1], (off_t) args[2]);
+}
+
+static uint64_t
+sc_readdir_batch (const uint64_t args[]) {
+	return sys_readdir_batch ((int) args[0], (void *) args[1], args[2]);
+}
+
+static uint64_t
+sc_memstat (const uint64_t args[]) {
+	return sys_memstat ((int) args[0], (struct memstat *) args[1]);
+}
+
+static uint64_t
+sc_getrusage (const uint64_t args[]) {
+	return sys_getrusage ((int) args[0], (struct rusage *) args[1]);
+}
+
+static uint64_t
+sc_rgroup_create (const uint64_t args[]) {
+	return sys_rgroup_create ((const struct rgroup_limits *) args[0]);
+}
+
+static uint64_t
+sc_rgroup_join (const uint64_t args[]) {
+	return sys_rgroup_join ((int) args[0]);
+}
+
+static uint64_t
+sc_rgroup_stat (const uint64_t args[]) {
+	return sys_rgroup_stat ((int) args[0], (struct rgroup_stat *) args[1]);
+}
+
+static uint64_t
+sc_sched_setaffinity (const uint64_t args[]) {
+	return sys_sched_setaffinity ((int) args[0], (unsigned) args[1]);
+}
+
+static uint64_t
+sc_sched_getaffinity (const uint64_t args[]) {
+	return sys_sched_getaffinity ((int) args[0]);
+}
+
+static uint64_t
+sc_pread (const uint64_t args[]) {
+	return sys_pread ((int) args[0], (void *) args[1], args[2],
+			(off_t) args[3]);
+}
+
+static uint64_t
+sc_pwrite (const uint64_t args[]) {
+	return sys_pwrite ((int) args[0], (const void *) args[1], args[2],
+			(off_t) args[3]);
+}
+
+static uint64_t
+sc_readv (const uint64_t args[]) {
+	return sys_readv ((int) args[0], (const struct iovec *) args[1],
+			(int) args[2]);
+}
+
+static uint64_t
+sc_writev (const uint64_t args[]) {
+	return sys_writev ((int) args[0], (const struct iovec *) args[1],
+			(int) args[2]);
+}
+
+static uint64_t
+sc_copy_file_range (const uint64_t args[]) {
+	return sys_copy_file_range ((int) args[0], (off_t) args[1],
+			(int) args[2], (off_t) args[3], args[4]);
+}
+
+static uint64_t
+sc_futex_wait (const uint64_t args[]) {
+	return futex_wait ((uint32_t *) args[0], (uint32_t) args[1]);
+}
+
+static uint64_t
+sc_futex_wake (const uint64_t args[]) {
+	return futex_wake ((uint32_t *) args[0], (int) args[1]);
+}
+
+static uint64_t
+sc_clone (const uint64_t args[]) {
+	return process_clone ((void *) args[0], (void *) args[1], args[2]);
+}
+
+static uint64_t sc_enter_ring (const uint64_t args[]);
+
+#ifdef VM
+static uint64_t
+sc_mmap (const uint64_t args[]) {
+	return (uint64_t) sys_mmap ((void *) args[0], args[1], (int) args[2],
+			(int) args[3], (off_t) args[4]);
+}
+
+static uint64_t
+sc_munmap (const uint64_t args[]) {
+	sys_munmap ((void *) args[0]);
+	return 0;
+}
+
+static uint64_t
+sc_shm_open (const uint64_t args[]) {
+	return sys_shm_open ((const char *) args[0], args[1]);
+}
+
+static uint64_t
+sc_shm_map (const uint64_t args[]) {
+	return (uint64_t) sys_shm_map ((int) args[0], (void *) args[1]);
+}
+
+static uint64_t
+sc_madvise (const uint64_t args[]) {
+	return sys_madvise ((void *) args[0], args[1], (int) args[2]);
+}
+
+static uint64_t
+sc_msync (const uint64_t args[]) {
+	return sys_msync ((void *) args[0], args[1], (int) args[2]);
+}
+
+static uint64_t
+sc_sbrk (const uint64_t args[]) {
+	return (uint64_t) sys_sbrk ((intptr_t) args[0]);
+}
+#else
+#define sc_mmap NULL
+#define sc_munmap NULL
+#define sc_shm_open NULL
+#define sc_shm_map NULL
+#define sc_madvise NULL
+#define sc_msync NULL
+#define sc_sbrk NULL
+#endif
+
+#define SYSCALL_CNT (SYS_SCHED_GETAFFINITY + 1)
+
+static const struct syscall_desc syscall_table[SYSCALL_CNT] = {
+	[SYS_HALT]     = { "halt",     0, sc_halt,    SCE_NONE },
+	[SYS_EXIT]     = { "exit",     1, sc_exit,    SCE_NONE },
+	[SYS_FORK]     = { "fork",     1, NULL,       SCE_NEGATIVE },
+	[SYS_EXEC]     = { "exec",     1, NULL,       SCE_NEGATIVE },
+	[SYS_WAIT]     = { "wait",     1, sc_wait,    SCE_NEGATIVE },
+	[SYS_CREATE]   = { "create",   2, sc_create,  SCE_ZERO },
+	[SYS_REMOVE]   = { "remove",   1, sc_remove,  SCE_ZERO },
+	[SYS_OPEN]     = { "open",     1, sc_open,    SCE_NEGATIVE },
+	[SYS_FILESIZE] = { "filesize", 1, sc_filesize, SCE_NEGATIVE },
+	[SYS_READ]     = { "read",     3, sc_read,    SCE_NEGATIVE },
+	[SYS_WRITE]    = { "write",    3, sc_write,   SCE_NEGATIVE },
+	[SYS_SEEK]     = { "seek",     2, sc_seek,    SCE_NONE },
+	[SYS_TELL]     = { "tell",     1, sc_tell,    SCE_NEGATIVE },
+	[SYS_CLOSE]    = { "close",    1, sc_close,   SCE_NEGATIVE },
+	[SYS_MMAP]     = { "mmap",     5, sc_mmap,    SCE_ZERO },
+	[SYS_MUNMAP]   = { "munmap",   1, sc_munmap,  SCE_NONE },
+	[SYS_CHDIR]    = { "chdir",    1, NULL,       SCE_ZERO },
+	[SYS_MKDIR]    = { "mkdir",    1, NULL,       SCE_ZERO },
+	[SYS_READDIR]  = { "readdir",  2, NULL,       SCE_ZERO },
+	[SYS_ISDIR]    = { "isdir",    1, NULL,       SCE_NONE },
+	[SYS_INUMBER]  = { "inumber",  1, NULL,       SCE_NEGATIVE },
+	[SYS_SYMLINK]  = { "symlink",  2, sc_symlink, SCE_NEGATIVE },
+	[SYS_DUP2]     = { "dup2",     2, sc_dup2,    SCE_NEGATIVE },
+	[SYS_MOUNT]    = { "mount",    3, sc_mount,   SCE_NEGATIVE },
+	[SYS_UMOUNT]   = { "umount",   1, sc_umount,  SCE_NEGATIVE },
+	[SYS_MEMSTAT]  = { "memstat",  2, sc_memstat, SCE_ZERO },
+	[SYS_FSYNC]    = { "fsync",    1, sc_fsync,   SCE_NEGATIVE },
+	[SYS_PREAD]    = { "pread",    4, sc_pread,   SCE_NEGATIVE },
+	[SYS_PWRITE]   = { "pwrite",   4, sc_pwrite,  SCE_NEGATIVE },
+	[SYS_READV]    = { "readv",    3, sc_readv,   SCE_NEGATIVE },
+	[SYS_WRITEV]   = { "writev",   3, sc_writev,  SCE_NEGATIVE },
+	[SYS_COPY_FILE_RANGE] = { "copy_file_range", 5, sc_copy_file_range,
+		SCE_NEGATIVE },
+	[SYS_ENTER_RING] = { "enter_ring", 1, sc_enter_ring, SCE_NEGATIVE },
+	[SYS_FUTEX_WAIT] = { "futex_wait", 2, sc_futex_wait, SCE_NEGATIVE },
+	[SYS_FUTEX_WAKE] = { "futex_wake", 2, sc_futex_wake, SCE_NEGATIVE },
+	[SYS_CLONE]    = { "clone",    3, sc_clone,   SCE_NEGATIVE },
+	[SYS_SPAWN]    = { "spawn",    2, sc_spawn,   SCE_NEGATIVE },
+	[SYS_PIPE]     = { "pipe",     1, sc_pipe,    SCE_NEGATIVE },
+	[SYS_SHM_OPEN] = { "shm_open", 2, sc_shm_open, SCE_NEGATIVE },
+	[SYS_SHM_MAP]  = { "shm_map",  2, sc_shm_map, SCE_ZERO },
+	[SYS_GETRUSAGE] = { "getrusage", 2, sc_getrusage, SCE_NEGATIVE },
+	[SYS_FALLOCATE] = { "fallocate", 3, sc_fallocate, SCE_NEGATIVE },
+	[SYS_READDIR_BATCH] = { "readdir_batch", 3, sc_readdir_batch,
+		SCE_NEGATIVE },
+	[SYS_MADVISE]  = { "madvise",  3, sc_madvise, SCE_NEGATIVE },
+	[SYS_MSYNC]    = { "msync",    3, sc_msync,   SCE_NEGATIVE },
+	[SYS_SBRK]     = { "sbrk",     1, sc_sbrk,    SCE_NEGATIVE },
+	[SYS_POLL]     = { "poll",     3, sc_poll,    SCE_NEGATIVE },
+	[SYS_FCNTL]    = { "fcntl",    3, sc_fcntl,   SCE_NEGATIVE },
+	[SYS_RGROUP_CREATE] = { "rgroup_create", 1, sc_rgroup_create,
+		SCE_NEGATIVE },
+	[SYS_RGROUP_JOIN] = { "rgroup_join", 1, sc_rgroup_join, SCE_NEGATIVE },
+	[SYS_RGROUP_STAT] = { "rgroup_stat", 2, sc_rgroup_stat, SCE_NEGATIVE },
+	[SYS_SCHED_SETAFFINITY] = { "sched_setaffinity", 2,
+		sc_sched_setaffinity, SCE_NEGATIVE },
+	[SYS_SCHED_GETAFFINITY] = { "sched_getaffinity", 1,
+		sc_sched_getaffinity, SCE_NEGATIVE },
+};
+
+static struct syscall_stats syscall_stats[SYSCALL_CNT];
+
+/* Returns true if RET, returned by a call described by DESC, reports
+ * failure. */
+static bool
+syscall_failed (const struct syscall_desc *desc, uint64_t ret) {
+	switch (desc->error) {
+		case SCE_NEGATIVE:
+			return (int64_t) ret < 0;
+		case SCE_ZERO:
+			return ret == 0;
+		default:
+			return false;
+	}
+}
+
+/* Runs system call NUM, which must be in the table, on ARGS, and
+ * accounts for it. */
+static uint64_t
+syscall_run (uint64_t num, const uint64_t args[]) {
+	const struct syscall_desc *desc = &syscall_table[num];
+	struct syscall_stats *stats = &syscall_stats[num];
+	uint64_t start, ret;
+
+	/* Counted first, so that exit and halt, which do not return, are. */
+	stats->calls++;
+	TRACE (SYSCALL_ENTER, num, args[0], args[1]);
+	start = rdtsc ();
+	ret = desc->func != NULL ? desc->func (args) : (uint64_t) -1;
+	stats->tsc += rdtsc () - start;
+	TRACE (SYSCALL_EXIT, num, ret, rdtsc () - start);
+	if (desc->func == NULL || syscall_failed (desc, ret))
+		stats->errors++;
+	return ret;
+}
+
 /* The main system call interface */
 void
 syscall_handler (struct intr_frame *f) {
-	uint64_t syscall_num;
-	syscall_num = f -> R.rax;
+	const uint64_t args[6] = {
+		f->R.rdi, f->R.rsi, f->R.rdx, f->R.r10, f->R.r8, f->R.r9
+	};
+	uint64_t syscall_num = f->R.rax;
 
-	switch (syscall_num){
-	    case SYS_HALT:
-			sys_halt();
-			break;
-	    case SYS_EXIT:
-			sys_exit(f->R.rdi);
-			break;
-	    case SYS_FORK:
-			break;
-	    case SYS_EXEC:
-			break;
-	    case SYS_WAIT:
-			break;
-	    case SYS_CREATE:
-			break;
-	    case SYS_REMOVE:
-			break;
-	    case SYS_OPEN:
-			f->R.rax = sys_open((const char *)f->R.rdi);
-	    case SYS_FILESIZE:
-			break;
-	    case SYS_READ:
-			break;
-	    case SYS_WRITE:
-			f->R.rax = sys_write(f->R.rdi, (void *)f->R.rsi, f->R.rdx);
-			break;
-	    case SYS_SEEK:
-			break;
-	    case SYS_TELL:
-			break;
-	    case SYS_CLOSE:
-			f->R.rax = sys_close(f->R.rdi);
-			break;
+#ifdef VM
+	/* A fault on the user stack in the kernel is checked against this. */
+	thread_current ()->user_rsp = f->rsp;
+#endif
+
+	if (syscall_num >= SYSCALL_CNT || syscall_table[syscall_num].name == NULL)
+		sys_exit (-1);
+#ifdef VM
+	/* A process the OOM killer chose exits at its next system call, or
+	 * once the one that was running returns. */
+	if (vm_oom_killed ())
+		sys_exit (-1);
+#endif
+	f->R.rax = syscall_run (syscall_num, args);
+#ifdef VM
+	if (vm_oom_killed ())
+		sys_exit (-1);
+#endif
+}
+
+/* Returns true if system call NUM may be queued on a submission
+ * ring: it returns to its caller with the process intact. */
+static bool
+ring_allowed (uint32_t num) {
+	switch (num) {
+		case SYS_OPEN:
+		case SYS_CLOSE:
+		case SYS_WRITE:
+		case SYS_FSYNC:
+		case SYS_PREAD:
+		case SYS_PWRITE:
+		case SYS_READV:
+		case SYS_WRITEV:
+		case SYS_COPY_FILE_RANGE:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/* enter_ring(): runs the submissions queued on the user's ring, in
+ * order, each through the table like a call of its own, and posts
+ * their completions.  Returns how many ran. */
+static uint64_t
+sc_enter_ring (const uint64_t args[]) {
+	struct io_ring *ring = (struct io_ring *) args[0];
+	uint32_t sq_head, sq_tail, cq_head, cq_tail;
+	int64_t done = 0;
+
+	if (!copy_from_user (&sq_head, &ring->sq_head, sizeof sq_head)
+			|| !copy_from_user (&sq_tail, &ring->sq_tail, sizeof sq_tail)
+			|| !copy_from_user (&cq_head, &ring->cq_head, sizeof cq_head)
+			|| !copy_from_user (&cq_tail, &ring->cq_tail, sizeof cq_tail))
+		sys_exit (-1);
+	if (sq_tail - sq_head > IORING_ENTRIES
+			|| cq_tail - cq_head > IORING_ENTRIES)
+		return -1;
 
-	    default :
-			sys_halt();
-		    break;
+	while (sq_head != sq_tail && cq_tail - cq_head < IORING_ENTRIES) {
+		struct ioring_sqe sqe;
+		struct ioring_cqe cqe;
+
+		if (!copy_from_user (&sqe, &ring->sq[sq_head % IORING_ENTRIES],
+					sizeof sqe))
+			sys_exit (-1);
+		cqe.user_data = sqe.user_data;
+		cqe.res = ring_allowed (sqe.op) && sqe.reserved == 0
+			? (int64_t) syscall_run (sqe.op, sqe.args) : -1;
+		if (!copy_to_user (&ring->cq[cq_tail % IORING_ENTRIES], &cqe,
+					sizeof cqe))
+			sys_exit (-1);
+		sq_head++;
+		cq_tail++;
+		done++;
 	}
 
+	if (!copy_to_user (&ring->sq_head, &sq_head, sizeof sq_head)
+			|| !copy_to_user (&ring->cq_tail, &cq_tail, sizeof cq_tail))
+		sys_exit (-1);
+	return done;
+}
+
+/* Prints the count, failures and average cost of each system call
+ * that has been made. */
+void
+syscall_print_stats (void) {
+	for (int i = 0; i < SYSCALL_CNT; i++) {
+		const struct syscall_stats *st = &syscall_stats[i];
+
+		if (st->calls > 0)
+			printf ("Syscall: %s %lld calls, %lld failed, "
+					"%llu cycles average\n", syscall_table[i].name,
+					st->calls, st->errors, st->tsc / st->calls);
+	}
 }
@@ -2,5 +2,13 @@ userprog_SRC  = userprog/process.c	# Process loading.
 userprog_SRC += userprog/exception.c	# User exception handler.
 userprog_SRC += userprog/syscall-entry.S # System call entry.
 userprog_SRC += userprog/syscall.c	# System call handler.
+userprog_SRC += userprog/fdtable.c	# File descriptor tables.
+userprog_SRC += userprog/futex.c	# User-space lock sleep queues.
+userprog_SRC += userprog/pipe.c		# Pipes.
+userprog_SRC += userprog/rgroup.c	# Resource groups.
+userprog_SRC += userprog/fstrace.c	# File system call tracing.
+userprog_SRC += userprog/image.c	# Executable image cache.
 userprog_SRC += userprog/gdt.c		# GDT initialization.
 userprog_SRC += userprog/tss.c		# TSS management.
+userprog_SRC += userprog/usercopy.c	# Copying to and from user memory.
+userprog_SRC += userprog/usercopy-movs.S # Fault-recovering copy loop.
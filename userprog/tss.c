@@ -2,6 +2,7 @@
 #include <debug.h>
 #include <stddef.h>
 #include "userprog/gdt.h"
+#include "threads/cpu.h"
 #include "threads/thread.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
@@ -43,32 +44,48 @@
  *      not in use, so we can always use that.  Thus, when the
  *      scheduler switches threads, it also changes the TSS's
  *      stack pointer to point to the new thread's kernel stack.
- *      (The call is in schedule in thread.c.) */
+ *      (The call is in schedule in thread.c.)
+ *
+ *  Each CPU runs a different thread, so each has its own TSS,
+ *  reached through its struct cpu.
+ *
+ *  The TSS also names the stack for the double fault handler,
+ *  through IST1 (see intr_init()).  A kernel stack overflow faults
+ *  on the guard page below the stack (see kstack.c), and since the
+ *  processor cannot push the page fault's frame there either, that
+ *  becomes a double fault, which needs a stack of its own. */
+
+/* Kernel TSSes, one per CPU. */
+static struct task_state tsses[CPU_MAX];
 
-/* Kernel TSS. */
-struct task_state *tss;
+/* Double fault stacks, one per CPU. */
+static uint8_t df_stacks[CPU_MAX][PGSIZE] __attribute__ ((aligned (16)));
 
-/* Initializes the kernel TSS. */
+/* Initializes the running CPU's TSS. */
 void
 tss_init (void) {
 	/* Our TSS is never used in a call gate or task gate, so only a
 	 * few fields of it are ever referenced, and those are the only
 	 * ones we initialize. */
-	tss = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+	struct cpu *c = cpu_current ();
+
+	c->tss = &tsses[c->id];
+	c->tss->ist1 = (uint64_t) df_stacks[c->id] + sizeof df_stacks[c->id];
 	tss_update (thread_current ());
 }
 
-/* Returns the kernel TSS. */
+/* Returns the running CPU's TSS. */
 struct task_state *
 tss_get (void) {
+	struct task_state *tss = cpu_current ()->tss;
+
 	ASSERT (tss != NULL);
 	return tss;
 }
 
-/* Sets the ring 0 stack pointer in the TSS to point to the end
- * of the thread stack. */
+/* Sets the ring 0 stack pointer in the running CPU's TSS to point
+ * to the end of the thread stack. */
 void
 tss_update (struct thread *next) {
-	ASSERT (tss != NULL);
-	tss->rsp0 = (uint64_t) next + PGSIZE;
+	tss_get ()->rsp0 = next->stack_top;
 }
@@ -0,0 +1,104 @@
+#include "userprog/usercopy.h"
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/mmu.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Copying between the kernel and user memory.
+
+   System calls used to touch user memory through get_user() and
+   put_user(), a byte at a time.  These routines instead move whole
+   runs with rep movsb, in usercopy-movs.S, checking only that the
+   range lies in user space.  Unmapped or read-only user memory is
+   caught by the MMU: the copy faults, the page fault handler pages
+   the memory in if it can, and otherwise resumes the copy at its
+   fixup label, which makes it return early.  Pages are thus checked
+   as they are touched, a page at a time, at no cost to the bytes in
+   them. */
+
+size_t usercopy_movs (void *dst, const void *src, size_t n);
+extern const char usercopy_insn[], usercopy_fault[];
+
+/* Returns true if [UADDR, UADDR + SIZE) lies in user space. */
+static bool
+is_user_range (const void *uaddr, size_t size) {
+	return (uintptr_t) uaddr < KERN_BASE
+		&& size <= KERN_BASE - (uintptr_t) uaddr;
+}
+
+#ifndef VM
+/* Returns true if every page of [UADDR, UADDR + SIZE) in the current
+   process is mapped writable.  Without VM, CR0.WP is clear and the
+   kernel could write to a read-only page without faulting. */
+static bool
+is_user_writable (void *uaddr, size_t size) {
+	uint8_t *page = pg_round_down (uaddr);
+	uint8_t *end = (uint8_t *) uaddr + size;
+
+	for (; page < end; page += PGSIZE) {
+		uint64_t *pte = pml4e_walk (thread_current ()->pml4,
+				(uint64_t) page, false);
+		if (pte == NULL || (*pte & (PTE_P | PTE_W)) != (PTE_P | PTE_W))
+			return false;
+	}
+	return true;
+}
+#endif
+
+/* Copies SIZE bytes from user address USRC to DST.  Returns false if
+   any of the user bytes cannot be read. */
+bool
+copy_from_user (void *dst, const void *usrc, size_t size) {
+	return is_user_range (usrc, size)
+		&& usercopy_movs (dst, usrc, size) == 0;
+}
+
+/* Copies SIZE bytes from SRC to user address UDST.  Returns false if
+   any of the user bytes cannot be written; some may have been. */
+bool
+copy_to_user (void *udst, const void *src, size_t size) {
+	if (!is_user_range (udst, size))
+		return false;
+#ifndef VM
+	if (!is_user_writable (udst, size))
+		return false;
+#endif
+	return usercopy_movs (udst, src, size) == 0;
+}
+
+/* Copies the null-terminated string at user address USRC into DST,
+   which has room for SIZE bytes, a page at a time.  Returns the
+   string's length, SIZE if it does not fit (DST is then not
+   terminated), or -1 if the user memory cannot be read. */
+int64_t
+strncpy_from_user (char *dst, const char *usrc, size_t size) {
+	size_t copied = 0;
+
+	while (copied < size) {
+		const char *src = usrc + copied;
+		size_t chunk = PGSIZE - pg_ofs (src);
+		const char *nul;
+
+		if (chunk > size - copied)
+			chunk = size - copied;
+		if (!copy_from_user (dst + copied, src, chunk))
+			return -1;
+		nul = memchr (dst + copied, '\0', chunk);
+		if (nul != NULL)
+			return nul - dst;
+		copied += chunk;
+	}
+	return size;
+}
+
+/* Called by the page fault handler for a kernel fault that it could
+   not resolve.  If F faulted in a user copy, makes the copy return
+   early and returns true; otherwise returns false. */
+bool
+usercopy_fixup (struct intr_frame *f) {
+	if (f->rip != (uintptr_t) usercopy_insn)
+		return false;
+	f->rip = (uintptr_t) usercopy_fault;
+	return true;
+}
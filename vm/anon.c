@@ -1,7 +1,18 @@
 /* anon.c: Implementation of page for non-disk image (a.k.a. anonymous page). */
 
 #include "vm/vm.h"
+#include <bitmap.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 #include "devices/disk.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/spinlock.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "userprog/rgroup.h"
+#include "vm/zswap.h"
 
 /* DO NOT MODIFY BELOW LINE */
 static struct disk *swap_disk;
@@ -17,36 +28,546 @@ static const struct page_operations anon_ops = {
 	.type = VM_ANON,
 };
 
+/* The swap disk is divided into page-sized slots, whose use is
+ * tracked by SWAP_MAP.  Slots are handed out next-fit from
+ * SWAP_CURSOR, which keeps a burst of evictions in ascending, mostly
+ * contiguous slots, so the disk sees one sequential write.  A page
+ * swapped out while shared copy-on-write leaves every sharer holding
+ * the same slot, so slots are reference counted.
+ *
+ * In front of the disk sits the compressed cache of zswap.c: a page
+ * that it takes is never written to a slot.
+ *
+ * Swap read-ahead.  Pages swapped out in one run sit in adjacent
+ * slots, and are usually neighbors in some address space, so a fault
+ * on one of them reads the in-use slots that follow it as well, up to
+ * vm_swap_ra slots in all, in requests the disk driver merges into one
+ * transfer.  The extra slots go to the swap cache, a few kernel pages
+ * indexed by slot, and are mapped only when their pages fault, which
+ * then copy them from the cache without waiting on the disk.  A cache
+ * entry is dropped when its slot is freed, before the slot can be
+ * written again.  Entries are replaced round robin. */
+#define SECTORS_PER_SLOT (PGSIZE / DISK_SECTOR_SIZE)
+#define SWAP_CACHE_SLOTS 32
+
+static struct bitmap *swap_map;         /* Slots in use. */
+static uint16_t *swap_refs;             /* Pages holding each slot. */
+static struct lock swap_lock;           /* Protects the swap map. */
+static size_t swap_cursor;              /* Where the next search starts. */
+static size_t swap_used;                /* Slots in use. */
+static size_t swap_high;                /* High-water mark of SWAP_USED. */
+static struct spinlock charge_lock;     /* Protects swap charges. */
+
+/* A swap slot's contents, read ahead of a fault on it. */
+struct swap_cache_entry {
+	size_t slot;                /* Slot held, or BITMAP_ERROR if none. */
+	void *kva;                  /* Its contents. */
+	bool busy;                  /* Being read in? */
+	bool ready;                 /* KVA holds SLOT's contents? */
+};
+
+unsigned vm_swap_ra = 8;
+static struct swap_cache_entry swap_cache[SWAP_CACHE_SLOTS];
+static size_t swap_cache_cnt;           /* Entries with a page. */
+static size_t swap_cache_hand;          /* Next entry to replace. */
+
+/* Statistics. */
+static long long swap_out_cnt;          /* Pages written to swap. */
+static long long swap_run_cnt;          /* Runs they were written in. */
+static long long swap_in_cnt;           /* Pages read from swap. */
+static long long swap_ra_cnt;           /* Slots read ahead. */
+static long long swap_ra_hit_cnt;       /* Swap-ins served by the cache. */
+
 /* Initialize the data for anonymous pages */
 void
 vm_anon_init (void) {
-	/* TODO: Set up the swap_disk. */
-	swap_disk = NULL;
+	/* The swap disk is hd1:1, on the other channel from the file
+	 * system (hd0:1), so swap and file I/O proceed in parallel. */
+	swap_disk = disk_get (1, 1);
+	spin_init (&charge_lock);
+	size_t slot_cnt = swap_disk != NULL
+		? disk_size (swap_disk) / SECTORS_PER_SLOT : 0;
+
+	swap_map = bitmap_create (slot_cnt);
+	swap_refs = calloc (slot_cnt, sizeof *swap_refs);
+	if (swap_map == NULL || (slot_cnt > 0 && swap_refs == NULL))
+		PANIC ("swap map creation failed");
+	lock_init (&swap_lock);
+	zswap_init ();
+
+	if (vm_swap_ra > SWAP_RA_MAX)
+		vm_swap_ra = SWAP_RA_MAX;
+	if (swap_disk == NULL)
+		vm_swap_ra = 0;
+	for (swap_cache_cnt = 0; vm_swap_ra > 1
+			&& swap_cache_cnt < SWAP_CACHE_SLOTS; swap_cache_cnt++) {
+		struct swap_cache_entry *e = &swap_cache[swap_cache_cnt];
+
+		e->kva = palloc_get_page (0);
+		if (e->kva == NULL)
+			break;
+		e->slot = BITMAP_ERROR;
+	}
+}
+
+/* Returns the swap cache entry that holds SLOT, read in, or a null
+ * pointer.  SWAP_LOCK must be held. */
+static struct swap_cache_entry *
+swap_cache_find (size_t slot) {
+	size_t i;
+
+	ASSERT (lock_held_by_current_thread (&swap_lock));
+	for (i = 0; i < swap_cache_cnt; i++)
+		if (swap_cache[i].slot == slot && swap_cache[i].ready)
+			return &swap_cache[i];
+	return NULL;
+}
+
+/* Drops SLOT, which is being freed, from the swap cache.  An entry
+ * still being read in is left busy, for its reader to release.
+ * SWAP_LOCK must be held. */
+static void
+swap_cache_drop (size_t slot) {
+	size_t i;
+
+	for (i = 0; i < swap_cache_cnt; i++)
+		if (swap_cache[i].slot == slot) {
+			swap_cache[i].slot = BITMAP_ERROR;
+			swap_cache[i].ready = false;
+		}
+}
+
+/* Copies SLOT into KVA from the swap cache, if it is there.  Returns
+ * true if it was. */
+static bool
+swap_cache_read (size_t slot, void *kva) {
+	struct swap_cache_entry *e;
+
+	if (swap_cache_cnt == 0)
+		return false;
+	lock_acquire (&swap_lock);
+	e = swap_cache_find (slot);
+	if (e != NULL) {
+		memcpy (kva, e->kva, PGSIZE);
+		swap_ra_hit_cnt++;
+	}
+	lock_release (&swap_lock);
+	return e != NULL;
+}
+
+/* Allocates CNT adjacent swap slots and returns the first, or
+ * BITMAP_ERROR if there is no such run. */
+static size_t
+swap_alloc (size_t cnt) {
+	size_t slot;
+
+	lock_acquire (&swap_lock);
+	slot = bitmap_scan_wrap (swap_map, swap_cursor, cnt, false);
+	if (slot != BITMAP_ERROR) {
+		size_t i;
+
+		bitmap_set_multiple (swap_map, slot, cnt, true);
+		for (i = 0; i < cnt; i++)
+			swap_refs[slot + i] = 1;
+		swap_cursor = slot + cnt;
+		swap_used += cnt;
+		if (swap_used > swap_high)
+			swap_high = swap_used;
+	}
+	lock_release (&swap_lock);
+	return slot;
+}
+
+/* Drops a reference to swap slot SLOT, freeing it with the last. */
+static void
+swap_free (size_t slot) {
+	lock_acquire (&swap_lock);
+	ASSERT (bitmap_test (swap_map, slot));
+	ASSERT (swap_refs[slot] > 0);
+	if (--swap_refs[slot] == 0) {
+		bitmap_reset (swap_map, slot);
+		swap_used--;
+		swap_cache_drop (slot);
+	}
+	lock_release (&swap_lock);
+}
+
+/* Adds a reference to swap slot SLOT. */
+static void
+swap_dup (size_t slot) {
+	lock_acquire (&swap_lock);
+	ASSERT (bitmap_test (swap_map, slot));
+	ASSERT (swap_refs[slot] < UINT16_MAX);
+	swap_refs[slot]++;
+	lock_release (&swap_lock);
+}
+
+/* Writes the page at KVA to a free swap slot, for a page that has no
+ * struct anon_page to record it, and returns the slot, or BITMAP_ERROR
+ * if swap is full. */
+size_t
+swap_write_page (const void *kva) {
+	size_t slot = swap_alloc (1);
+
+	if (slot == BITMAP_ERROR)
+		return BITMAP_ERROR;
+	disk_write_tagged (swap_disk, slot * SECTORS_PER_SLOT, SECTORS_PER_SLOT,
+			kva, DISK_SRC_SWAP_OUT);
+	swap_out_cnt++;
+	swap_run_cnt++;
+	thread_current ()->ru.nswapout++;
+	return slot;
+}
+
+/* Reads swap slot SLOT, written by swap_write_page(), into KVA and
+ * frees it. */
+void
+swap_read_page (size_t slot, void *kva) {
+	disk_read_tagged (swap_disk, slot * SECTORS_PER_SLOT, SECTORS_PER_SLOT,
+			kva, DISK_SRC_SWAP_IN);
+	swap_free (slot);
+	swap_in_cnt++;
+	thread_current ()->ru.nswapin++;
+}
+
+/* Frees swap slot SLOT, written by swap_write_page(), unread. */
+void
+swap_discard (size_t slot) {
+	swap_free (slot);
+}
+
+/* Prints swap statistics.  Fragmentation shows as free space split
+ * into many runs, none of them long. */
+void
+swap_print_stats (void) {
+	size_t slot_cnt = bitmap_size (swap_map);
+	size_t run_cnt = 0, longest = 0, run = 0, i;
+
+	lock_acquire (&swap_lock);
+	for (i = 0; i < slot_cnt; i++) {
+		if (bitmap_test (swap_map, i)) {
+			run = 0;
+			continue;
+		}
+		if (run++ == 0)
+			run_cnt++;
+		if (run > longest)
+			longest = run;
+	}
+	printf ("Swap: %zu of %zu slots used, high-water %zu, "
+			"%zu free runs (longest %zu)\n",
+			swap_used, slot_cnt, swap_high, run_cnt, longest);
+	printf ("Swap: %lld pages out in %lld runs, %lld pages in\n",
+			swap_out_cnt, swap_run_cnt, swap_in_cnt);
+	if (swap_ra_cnt > 0)
+		printf ("Swap: %lld slots read ahead, %lld swap-ins from the cache\n",
+				swap_ra_cnt, swap_ra_hit_cnt);
+	lock_release (&swap_lock);
+	zswap_print_stats ();
+}
+
+/* Charges a page in swap or the compressed cache to, or credits one
+ * back from, the process that maps PAGE, and its resource group. */
+static void
+swap_charge (struct page *page, int delta) {
+	struct thread *owner = page->owner;
+
+	spin_lock (&charge_lock);
+	owner->spt.swap_cnt += delta;
+	if (owner->rgroup != NULL)
+		owner->rgroup->swap += delta;
+	spin_unlock (&charge_lock);
+}
+
+/* Moves the swap charged to process LEADER from its resource group to
+ * TO, which may be null, and puts it in TO.  Called by
+ * vm_rgroup_move(). */
+void
+anon_rgroup_move (struct thread *leader, struct rgroup *to) {
+	spin_lock (&charge_lock);
+	if (leader->rgroup != NULL)
+		leader->rgroup->swap -= leader->spt.swap_cnt;
+	if (to != NULL)
+		to->swap += leader->spt.swap_cnt;
+	leader->rgroup = to;
+	spin_unlock (&charge_lock);
 }
 
 /* Initialize the file mapping */
 bool
-anon_initializer (struct page *page, enum vm_type type, void *kva) {
+anon_initializer (struct page *page, enum vm_type type UNUSED, void *kva) {
 	/* Set up the handler */
 	page->operations = &anon_ops;
 
-	struct anon_page *anon_page = &page->anon;
+	page->anon.slot = BITMAP_ERROR;
+	page->anon.zentry = NULL;
+	memset (kva, 0, PGSIZE);
+	return true;
+}
+
+/* Restores PAGE, which is in the compressed cache, into KVA, and
+ * drops its entry. */
+static void
+zswap_swap_in (struct page *page, void *kva) {
+	zswap_load (page->anon.zentry, kva);
+	zswap_free (page->anon.zentry);
+	page->anon.zentry = NULL;
+	swap_charge (page, -1);
+	thread_current ()->ru.nswapin++;
 }
 
-/* Swap in the page by read contents from the swap disk. */
+/* Reads SLOT into KVA, and with it the in-use slots that follow it,
+ * up to vm_swap_ra slots in all, into swap cache entries that are not
+ * in use.  The requests are queued together, so the disk driver
+ * merges them into one transfer. */
+static void
+swap_read_ahead (size_t slot, void *kva) {
+	struct disk_req reqs[SWAP_RA_MAX];
+	struct swap_cache_entry *ents[SWAP_RA_MAX];
+	size_t cnt = 0, i;
+
+	lock_acquire (&swap_lock);
+	for (i = 1; i < vm_swap_ra && slot + i < bitmap_size (swap_map)
+			&& bitmap_test (swap_map, slot + i); i++) {
+		struct swap_cache_entry *e = NULL;
+		size_t tries;
+
+		if (swap_cache_find (slot + i) != NULL)
+			break;
+		for (tries = 0; tries < swap_cache_cnt && e == NULL; tries++) {
+			e = &swap_cache[swap_cache_hand];
+			swap_cache_hand = (swap_cache_hand + 1) % swap_cache_cnt;
+			if (e->busy)
+				e = NULL;
+		}
+		if (e == NULL)
+			break;
+		e->slot = slot + i;
+		e->busy = true;
+		e->ready = false;
+		ents[cnt++] = e;
+	}
+	lock_release (&swap_lock);
+
+	for (i = 0; i <= cnt; i++) {
+		reqs[i] = (struct disk_req) {
+			.disk = swap_disk,
+			.sec_no = (slot + i) * SECTORS_PER_SLOT,
+			.cnt = SECTORS_PER_SLOT,
+			.buffer = i == 0 ? kva : ents[i - 1]->kva,
+			.write = false,
+			.src = DISK_SRC_SWAP_IN,
+		};
+		disk_submit (&reqs[i]);
+	}
+	for (i = 0; i <= cnt; i++)
+		disk_wait (&reqs[i]);
+
+	/* An entry whose slot was freed meanwhile was dropped. */
+	lock_acquire (&swap_lock);
+	for (i = 0; i < cnt; i++) {
+		ents[i]->busy = false;
+		ents[i]->ready = ents[i]->slot == slot + i + 1;
+	}
+	swap_ra_cnt += cnt;
+	lock_release (&swap_lock);
+}
+
+/* Swap in the page by read contents from the compressed cache, the
+ * swap cache or the swap disk. */
 static bool
 anon_swap_in (struct page *page, void *kva) {
 	struct anon_page *anon_page = &page->anon;
+
+	if (anon_page->zentry != NULL) {
+		zswap_swap_in (page, kva);
+		return true;
+	}
+	if (anon_page->slot == BITMAP_ERROR)
+		return false;
+	if (!swap_cache_read (anon_page->slot, kva)) {
+		if (swap_cache_cnt > 0)
+			swap_read_ahead (anon_page->slot, kva);
+		else
+			disk_read_tagged (swap_disk, anon_page->slot * SECTORS_PER_SLOT,
+					SECTORS_PER_SLOT, kva, DISK_SRC_SWAP_IN);
+	}
+	swap_free (anon_page->slot);
+	anon_page->slot = BITMAP_ERROR;
+	swap_charge (page, -1);
+	swap_in_cnt++;
+	thread_current ()->ru.nswapin++;
+	return true;
+}
+
+/* Is PAGE an anonymous page whose contents are in swap? */
+bool
+anon_swapped (const struct page *page) {
+	return page->operations == &anon_ops
+		&& (page->anon.slot != BITMAP_ERROR || page->anon.zentry != NULL);
+}
+
+/* Is PAGE an anonymous page whose contents are in swap, read ahead
+ * into the swap cache, so that bringing it in needs no disk read? */
+bool
+anon_swap_cached (const struct page *page) {
+	bool cached;
+
+	if (page->operations != &anon_ops || page->anon.slot == BITMAP_ERROR
+			|| swap_cache_cnt == 0)
+		return false;
+	lock_acquire (&swap_lock);
+	cached = swap_cache_find (page->anon.slot) != NULL;
+	lock_release (&swap_lock);
+	return cached;
+}
+
+/* Makes anonymous page DST share SRC's swap slot or compressed copy,
+ * if SRC has one, as a fork's copy of SRC. */
+void
+anon_share_swap (struct page *dst, const struct page *src) {
+	dst->anon.slot = src->anon.slot;
+	if (dst->anon.slot != BITMAP_ERROR)
+		swap_dup (dst->anon.slot);
+	dst->anon.zentry = src->anon.zentry;
+	if (dst->anon.zentry != NULL)
+		zswap_dup (dst->anon.zentry);
+	if (dst->anon.slot != BITMAP_ERROR || dst->anon.zentry != NULL)
+		swap_charge (dst, 1);
+}
+
+/* Reads the CNT swapped-out anonymous PAGES into the frames they have
+ * been given, and frees their slots.  Pages in the compressed cache
+ * are restored first, and pages read ahead are copied from the swap
+ * cache.  The disk reads are queued together, so pages that were
+ * swapped out in one run come back in one sequential transfer.  Short
+ * of memory for the requests, the pages are read one at a time. */
+void
+anon_swap_in_run (struct page **pages, size_t cnt) {
+	struct disk_req *reqs = malloc_tagged (cnt * sizeof *reqs, TAG_VM);
+	size_t in_cnt = 0, i;
+
+	for (i = 0; i < cnt; i++) {
+		ASSERT (anon_swapped (pages[i]));
+		ASSERT (pages[i]->frame != NULL);
+		if (pages[i]->anon.zentry != NULL)
+			zswap_swap_in (pages[i], pages[i]->frame->kva);
+	}
+	for (i = 0; i < cnt; i++) {
+		if (pages[i]->anon.slot == BITMAP_ERROR)
+			continue;
+		if (reqs == NULL) {
+			anon_swap_in (pages[i], pages[i]->frame->kva);
+			continue;
+		}
+		in_cnt++;
+		if (swap_cache_read (pages[i]->anon.slot, pages[i]->frame->kva)) {
+			reqs[i].disk = NULL;
+			continue;
+		}
+		reqs[i] = (struct disk_req) {
+			.disk = swap_disk,
+			.sec_no = pages[i]->anon.slot * SECTORS_PER_SLOT,
+			.cnt = SECTORS_PER_SLOT,
+			.buffer = pages[i]->frame->kva,
+			.write = false,
+			.src = DISK_SRC_SWAP_IN,
+		};
+		disk_submit (&reqs[i]);
+	}
+	if (reqs == NULL)
+		return;
+	for (i = 0; i < cnt; i++) {
+		if (pages[i]->anon.slot == BITMAP_ERROR)
+			continue;
+		if (reqs[i].disk != NULL)
+			disk_wait (&reqs[i]);
+		swap_free (pages[i]->anon.slot);
+		pages[i]->anon.slot = BITMAP_ERROR;
+		swap_charge (pages[i], -1);
+	}
+	free (reqs);
+	swap_in_cnt += in_cnt;
+	thread_current ()->ru.nswapin += in_cnt;
+}
+
+/* Saves the CNT anonymous PAGES, which are resident but unmapped.
+ * Those the compressed cache takes are stored there.  The rest are
+ * written to adjacent swap slots, in order, and the slot of each is
+ * recorded.  The writes are queued together, so the disk driver
+ * merges them into one sequential transfer.  Returns false, saving
+ * nothing, if there is no free run of slots for the rest. */
+bool
+anon_swap_out_run (struct page **pages, size_t cnt) {
+	struct disk_req *reqs;
+	size_t disk_cnt = 0, slot = 0, i, j;
+
+	ASSERT (cnt > 0);
+
+	reqs = malloc_tagged (cnt * sizeof *reqs, TAG_VM);
+	if (reqs == NULL)
+		return false;
+	for (i = 0; i < cnt; i++) {
+		ASSERT (pages[i]->frame != NULL);
+		pages[i]->anon.zentry = zswap_store (pages[i]->frame->kva);
+		if (pages[i]->anon.zentry == NULL)
+			disk_cnt++;
+	}
+	if (disk_cnt > 0 && (slot = swap_alloc (disk_cnt)) == BITMAP_ERROR) {
+		for (i = 0; i < cnt; i++)
+			if (pages[i]->anon.zentry != NULL) {
+				zswap_free (pages[i]->anon.zentry);
+				pages[i]->anon.zentry = NULL;
+			}
+		free (reqs);
+		return false;
+	}
+
+	for (i = j = 0; i < cnt; i++) {
+		if (pages[i]->anon.zentry != NULL)
+			continue;
+		reqs[j] = (struct disk_req) {
+			.disk = swap_disk,
+			.sec_no = (slot + j) * SECTORS_PER_SLOT,
+			.cnt = SECTORS_PER_SLOT,
+			.buffer = pages[i]->frame->kva,
+			.write = true,
+			.src = DISK_SRC_SWAP_OUT,
+		};
+		disk_submit (&reqs[j++]);
+	}
+	for (i = j = 0; i < cnt; i++) {
+		if (pages[i]->anon.zentry != NULL)
+			continue;
+		disk_wait (&reqs[j]);
+		pages[i]->anon.slot = slot + j++;
+	}
+	free (reqs);
+	for (i = 0; i < cnt; i++)
+		swap_charge (pages[i], 1);
+
+	if (disk_cnt > 0) {
+		swap_out_cnt += disk_cnt;
+		swap_run_cnt++;
+	}
+	thread_current ()->ru.nswapout += cnt;
+	return true;
 }
 
 /* Swap out the page by writing contents to the swap disk. */
 static bool
 anon_swap_out (struct page *page) {
-	struct anon_page *anon_page = &page->anon;
+	return anon_swap_out_run (&page, 1);
 }
 
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void
 anon_destroy (struct page *page) {
-	struct anon_page *anon_page = &page->anon;
+	vm_free_frame (page);
+	if (page->anon.slot != BITMAP_ERROR || page->anon.zentry != NULL)
+		swap_charge (page, -1);
+	if (page->anon.slot != BITMAP_ERROR)
+		swap_free (page->anon.slot);
+	if (page->anon.zentry != NULL)
+		zswap_free (page->anon.zentry);
 }
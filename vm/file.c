@@ -1,11 +1,21 @@
 /* file.c: Implementation of memory backed file object (mmaped object). */
 
 #include "vm/vm.h"
+#include <stdio.h>
+#include "threads/mmu.h"
+#include "threads/pte.h"
+#include "threads/vaddr.h"
+
+/* Dirty pages one step of file_backed_writeback() collects. */
+#define WRITEBACK_BATCH 16
 
 static bool file_backed_swap_in (struct page *page, void *kva);
 static bool file_backed_swap_out (struct page *page);
 static void file_backed_destroy (struct page *page);
 
+/* Statistics. */
+static long long write_cnt;     /* Pages written back to their files. */
+
 /* DO NOT MODIFY this struct */
 static const struct page_operations file_ops = {
 	.swap_in = file_backed_swap_in,
@@ -25,34 +35,180 @@ file_backed_initializer (struct page *page, enum vm_type type, void *kva) {
 	/* Set up the handler */
 	page->operations = &file_ops;
 
-	struct file_page *file_page = &page->file;
+	return file_backed_swap_in (page, kva);
+}
+
+/* Makes PAGE, which may not have been loaded yet, a file-backed page
+ * whose contents are already in its frame, which another mapping of the
+ * same file page filled. */
+void
+file_backed_share (struct page *page) {
+	page->operations = &file_ops;
 }
 
 /* Swap in the page by read contents from the file. */
 static bool
 file_backed_swap_in (struct page *page, void *kva) {
-	struct file_page *file_page UNUSED = &page->file;
+	return vma_read_page (page->vma, page->va, kva);
 }
 
-/* Swap out the page by writeback contents to the file. */
+/* Writes the contents of PAGE, in KVA, back to its file.  Only the
+ * bytes backed by the file are written, so the file never grows. */
+static void
+file_backed_write (struct page *page, const void *kva) {
+	size_t write_bytes;
+	off_t ofs;
+
+	write_bytes = vma_page_bytes (page->vma, page->va, &ofs);
+	if (write_bytes > 0) {
+		file_write_at (page->vma->file, kva, write_bytes, ofs);
+		write_cnt++;
+	}
+}
+
+/* Writes PAGE back to its file if it is resident and has been modified
+ * through any mapping of its frame, which other processes mapping the
+ * same file page may share.  However many have written it, the page is
+ * written once. */
+void
+file_backed_sync (struct page *page) {
+	struct frame *frame;
+	bool dirty;
+
+	frame = vm_frame_pin (page, &dirty);
+	if (frame == NULL)
+		return;
+	if (dirty)
+		file_backed_write (page, frame->kva);
+	vm_frame_unpin (frame);
+}
+
+/* Dirty pages found by one walk of a region's page table entries. */
+struct writeback_batch {
+	void *va[WRITEBACK_BATCH];  /* Their addresses, in ascending order. */
+	size_t cnt;                 /* Number of elements in VA. */
+	void *next;                 /* Where the next walk starts. */
+};
+
+/* pml4_for_each_range() function that collects the pages whose page
+ * table entries are dirty into the writeback_batch AUX, stopping when
+ * it is full. */
+static bool
+collect_dirty (uint64_t *pte, void *va, void *aux) {
+	struct writeback_batch *b = aux;
+
+	if (*pte & PTE_D)
+		b->va[b->cnt++] = va;
+	b->next = (uint8_t *) va + PGSIZE;
+	return b->cnt < WRITEBACK_BATCH;
+}
+
+/* Writes back the modified pages in [START, END) of VMA, a file-backed
+ * region of SPT, as unmapping or msync() does.  Rather than look up each
+ * of its pages, this walks the page table entries of the range once and
+ * writes only the pages they mark dirty, in ascending file offset order,
+ * so that the buffer cache sees whole adjacent pages in a row and writes
+ * them to disk as a few long runs of sectors.  Clean pages cost one look
+ * at their entries.  The dirty bits are cleared, so that the next
+ * writeback finds only pages written since. */
+void
+file_backed_writeback (struct supplemental_page_table *spt,
+		struct vma *vma, void *start, void *end) {
+	struct writeback_batch b;
+	uint64_t *pml4;
+	void *va = start;
+	bool done;
+
+	if (vma->file == NULL || !vma->writable || list_empty (&vma->pages))
+		return;
+	pml4 = list_entry (list_front (&vma->pages), struct page,
+			vma_elem)->owner->pml4;
+	do {
+		size_t i;
+
+		b.cnt = 0;
+		done = pml4_for_each_range (pml4, va, end, collect_dirty, &b);
+		for (i = 0; i < b.cnt; i++) {
+			struct page *page = spt_find_page (spt, b.va[i]);
+
+			if (page != NULL && page->operations == &file_ops)
+				file_backed_sync (page);
+		}
+		va = b.next;
+	} while (!done);
+}
+
+/* Prints statistics about file-backed pages. */
+void
+file_backed_print_stats (void) {
+	printf ("VM: %lld file pages written back\n", write_cnt);
+}
+
+/* Swap out the page by writeback contents to the file.  Eviction has
+ * unmapped the frame from every page sharing it and marked PAGE's own
+ * mapping dirty if any of them is. */
 static bool
 file_backed_swap_out (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	uint64_t *pml4 = page->owner->pml4;
+
+	if (pml4_is_dirty (pml4, page->va)) {
+		file_backed_write (page, page->frame->kva);
+		pml4_set_dirty (pml4, page->va, false);
+	}
+	return true;
 }
 
 /* Destory the file backed page. PAGE will be freed by the caller. */
 static void
 file_backed_destroy (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	file_backed_sync (page);
+	vm_free_frame (page);
 }
 
-/* Do the mmap */
+/* Do the mmap.  Maps LENGTH bytes of FILE, starting at OFFSET, at ADDR
+ * as one region; no page is read until it is touched.  Returns ADDR, or
+ * a null pointer if the arguments are invalid or the range is in use. */
 void *
 do_mmap (void *addr, size_t length, int writable,
 		struct file *file, off_t offset) {
+	struct supplemental_page_table *spt = &thread_current ()->leader->spt;
+	off_t file_len = file_length (file);
+	struct vma *vma;
+
+	if (addr == NULL || offset < 0 || pg_ofs (offset) != 0 || file_len == 0)
+		return NULL;
+
+	lock_acquire (&spt->lock);
+	vma = vma_create (spt, addr, length, VM_FILE, writable);
+	if (vma != NULL) {
+		vma->file = file_reopen (file);
+		if (vma->file == NULL) {
+			vma_destroy (spt, vma);
+			vma = NULL;
+		} else {
+			vma->offset = offset;
+			if (offset < file_len)
+				vma->read_bytes = (size_t) (file_len - offset) < length
+					? (size_t) (file_len - offset) : length;
+		}
+	}
+	lock_release (&spt->lock);
+	return vma != NULL ? addr : NULL;
 }
 
-/* Do the munmap */
+/* Do the munmap.  ADDR must be the address returned by the mmap, or
+ * by shm_map().  The read-only segments of the executable, which are
+ * file-backed regions marked with VM_MARKER_1, cannot be unmapped. */
 void
 do_munmap (void *addr) {
+	struct supplemental_page_table *spt = &thread_current ()->leader->spt;
+	struct vma *vma;
+
+	lock_acquire (&spt->lock);
+	vma = vma_find (spt, addr);
+	if (vma != NULL && vma->start == addr
+			&& ((VM_TYPE (vma->type) == VM_FILE && !(vma->type & VM_MARKER_1))
+				|| VM_TYPE (vma->type) == VM_SHM))
+		vma_destroy (spt, vma);
+	lock_release (&spt->lock);
 }
@@ -0,0 +1,212 @@
+/* shm.c: Shared memory segments.
+ *
+ * A segment is anonymous memory that any number of processes map,
+ * each at an address of its choosing, and all see the same.  It is
+ * found by name, so that unrelated processes can open it, and lives
+ * as long as a descriptor or a mapping refers to it.
+ *
+ * Each page of a segment has one frame, shared writable by all of its
+ * mappings (vm.c brings it in and publishes it in the segment), or one
+ * swap slot.  Eviction writes the page out once for all of them.  A
+ * page none of whose mappings is left keeps its frame, off the frame
+ * table, until the segment is mapped again or freed. */
+
+#include "vm/shm.h"
+#include <bitmap.h>
+#include <round.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/vm.h"
+
+static bool shm_swap_in (struct page *page, void *kva);
+static bool shm_swap_out (struct page *page);
+static void shm_destroy (struct page *page);
+
+static const struct page_operations shm_ops = {
+	.swap_in = shm_swap_in,
+	.swap_out = shm_swap_out,
+	.destroy = shm_destroy,
+	.type = VM_SHM,
+};
+
+/* Segments by name, and the lock that protects the list and their
+ * reference counts. */
+static struct list shm_list;
+static struct lock shm_lock;
+
+/* Initializes shared memory segments. */
+void
+vm_shm_init (void) {
+	list_init (&shm_list);
+	lock_init (&shm_lock);
+}
+
+/* Returns the segment named NAME, taking a reference to it, or a null
+ * pointer if there is none.  Called with SHM_LOCK held. */
+static struct shm *
+shm_lookup (const char *name) {
+	struct list_elem *e;
+
+	for (e = list_begin (&shm_list); e != list_end (&shm_list);
+			e = list_next (e)) {
+		struct shm *shm = list_entry (e, struct shm, elem);
+
+		if (!strcmp (shm->name, name)) {
+			shm->ref_cnt++;
+			return shm;
+		}
+	}
+	return NULL;
+}
+
+/* Opens the segment named NAME, creating it SIZE bytes long, rounded
+ * up to whole pages, if it does not exist and SIZE is not zero.  The
+ * size of an existing segment stays as it is.  Returns a reference to
+ * the segment, or a null pointer if NAME or SIZE is invalid or memory
+ * is short. */
+struct shm *
+shm_open (const char *name, size_t size) {
+	size_t page_cnt = DIV_ROUND_UP (size, PGSIZE);
+	struct shm *shm;
+	size_t i;
+
+	if (name[0] == '\0' || strlen (name) > SHM_NAME_MAX
+			|| page_cnt > SHM_PAGES_MAX)
+		return NULL;
+
+	lock_acquire (&shm_lock);
+	shm = shm_lookup (name);
+	if (shm == NULL && page_cnt > 0) {
+		shm = malloc_tagged (sizeof *shm + page_cnt * sizeof *shm->pages,
+				TAG_VM);
+		if (shm != NULL) {
+			strlcpy (shm->name, name, sizeof shm->name);
+			shm->ref_cnt = 1;
+			lock_init (&shm->lock);
+			shm->page_cnt = page_cnt;
+			for (i = 0; i < page_cnt; i++)
+				shm->pages[i] = (struct shm_slot) { NULL, BITMAP_ERROR };
+			list_push_back (&shm_list, &shm->elem);
+		}
+	}
+	lock_release (&shm_lock);
+	return shm;
+}
+
+/* Takes another reference to SHM and returns it. */
+struct shm *
+shm_dup (struct shm *shm) {
+	lock_acquire (&shm_lock);
+	shm->ref_cnt++;
+	lock_release (&shm_lock);
+	return shm;
+}
+
+/* Drops a reference to SHM, freeing it with the last.  By then no
+ * region maps it, so each page is in a frame off the frame table, in
+ * swap, or nowhere. */
+void
+shm_put (struct shm *shm) {
+	bool last;
+	size_t i;
+
+	lock_acquire (&shm_lock);
+	last = --shm->ref_cnt == 0;
+	if (last)
+		list_remove (&shm->elem);
+	lock_release (&shm_lock);
+	if (!last)
+		return;
+
+	for (i = 0; i < shm->page_cnt; i++) {
+		struct shm_slot *slot = &shm->pages[i];
+
+		if (slot->frame != NULL) {
+			ASSERT (list_empty (&slot->frame->pages));
+			palloc_free_page (slot->frame->kva);
+			free (slot->frame);
+		}
+		if (slot->slot != BITMAP_ERROR)
+			swap_discard (slot->slot);
+	}
+	free (shm);
+}
+
+/* Maps all of SHM, writable, at page-aligned ADDR in the current
+ * process.  No page is brought in until it is touched.  Returns ADDR,
+ * or a null pointer if ADDR is null or the range is in use. */
+void *
+shm_map (struct shm *shm, void *addr) {
+	struct supplemental_page_table *spt = &thread_current ()->leader->spt;
+	struct vma *vma;
+
+	if (addr == NULL)
+		return NULL;
+	lock_acquire (&spt->lock);
+	vma = vma_create (spt, addr, shm->page_cnt * PGSIZE, VM_SHM, true);
+	if (vma != NULL)
+		vma->shm = shm_dup (shm);
+	lock_release (&spt->lock);
+	return vma != NULL ? addr : NULL;
+}
+
+/* Returns the segment page that PAGE maps. */
+struct shm_slot *
+shm_slot (const struct page *page) {
+	struct vma *vma = page->vma;
+	size_t idx = ((uint8_t *) page->va - (uint8_t *) vma->start) / PGSIZE;
+
+	ASSERT (vma->shm != NULL && idx < vma->shm->page_cnt);
+	return &vma->shm->pages[idx];
+}
+
+/* The initializer of a page of a segment, which brings the page into
+ * memory for the first time since it was last written out. */
+bool
+shm_initializer (struct page *page, enum vm_type type UNUSED, void *kva) {
+	page->operations = &shm_ops;
+	return shm_swap_in (page, kva);
+}
+
+/* Makes PAGE, which may not have been loaded yet, a segment page whose
+ * contents are already in the frame another mapping brought in. */
+void
+shm_share (struct page *page) {
+	page->operations = &shm_ops;
+}
+
+/* Fills KVA with PAGE's contents, from swap if it has been written out
+ * and with zeros if it has never been. */
+static bool
+shm_swap_in (struct page *page, void *kva) {
+	struct shm_slot *slot = shm_slot (page);
+
+	if (slot->slot == BITMAP_ERROR)
+		memset (kva, 0, PGSIZE);
+	else {
+		swap_read_page (slot->slot, kva);
+		slot->slot = BITMAP_ERROR;
+	}
+	return true;
+}
+
+/* Writes PAGE out to swap, once for every mapping of it, which
+ * eviction has already unmapped. */
+static bool
+shm_swap_out (struct page *page) {
+	struct shm_slot *slot = shm_slot (page);
+
+	ASSERT (slot->slot == BITMAP_ERROR);
+	slot->slot = swap_write_page (page->frame->kva);
+	return slot->slot != BITMAP_ERROR;
+}
+
+/* Destroys a mapping of a segment page.  The page itself stays with
+ * the segment. */
+static void
+shm_destroy (struct page *page) {
+	vm_free_frame (page);
+}
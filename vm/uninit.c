@@ -62,7 +62,7 @@ uninit_initialize (struct page *page, void *kva) {
  * PAGE will be freed by the caller. */
 static void
 uninit_destroy (struct page *page) {
-	struct uninit_page *uninit UNUSED = &page->uninit;
-	/* TODO: Fill this function.
-	 * TODO: If you don't have anything to do, just return. */
+	/* The page's region owns AUX.  The page has no frame of its own
+	 * yet, but it may map the zero frame. */
+	vm_free_frame (page);
 }
@@ -1,13 +1,206 @@
 /* vm.c: Generic interface for virtual memory objects. */
 
+#include <stdio.h>
+#include <string.h>
+#include <intrinsic.h>
+#include <mman.h>
+#include <round.h>
+#include "devices/disk.h"
+#include "devices/timer.h"
+#include "filesys/file.h"
+#include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/synch.h"
+#include "threads/trace.h"
+#include "threads/vaddr.h"
+#include "threads/workq.h"
+#include "userprog/rgroup.h"
 #include "vm/vm.h"
 #include "vm/inspect.h"
 
+/* Makes the kernel, too, fault on writes to read-only pages, so that
+ * its writes to user memory shared copy-on-write break the sharing. */
+#define CR0_WP (1 << 16)
+
+/* Eviction policy, set by the kernel command line option -evict. */
+enum vm_evict_policy vm_evict_policy = EVICT_LRU;
+
+/* Fault-around window, set by the kernel command line option
+ * -fault-around. */
+unsigned vm_fault_around = 4;
+
+/* Pages mapped by a fault that grows the stack, set by the kernel
+ * command line option -stack-batch. */
+unsigned vm_stack_batch = 4;
+
+/* The frame table: every frame that holds a user page, in the order
+ * the clock hands sweep them.  FRAME_LOCK protects the table, the
+ * hands, and the links between frames and pages. */
+static struct list frame_list;
+static struct lock frame_lock;
+static size_t frame_cnt;
+static struct list_elem *clock_hand;    /* Next frame to consider. */
+static struct list_elem *clock_front;   /* Two-handed clock: clearing hand. */
+
+/* The front hand of the two-handed clock runs this fraction of the
+ * frame table ahead of the back hand. */
+#define CLOCK_SPREAD_DIV 4
+
+/* The LRU lists, for the lru policy.  Every frame in the frame table
+ * that holds a page is on one of them as well, whatever the policy.
+ * Frames of file pages start out inactive, and are promoted to the
+ * active list only if they are found accessed on two passes over the
+ * inactive list, so that a file read once, however large, streams
+ * through the inactive list without displacing anything.  Frames of
+ * anonymous pages start out active.  An active list is trimmed to the
+ * length of its inactive list by moving over the frames it holds that
+ * have not been accessed since the last trim.
+ *
+ * Which pair to reclaim from is decided by refaults, faults on pages
+ * evicted earlier: file pages are reclaimed first unless they have
+ * lately been refaulting more often than anonymous pages, which means
+ * the inactive file list is too short to hold their working set.  The
+ * counts of recent refaults halve every REFAULT_DECAY_DIV-th of the
+ * user pool evicted. */
+#define REFAULT_DECAY_DIV 2
+static struct list lru_lists[LRU_CNT];
+static size_t lru_cnt[LRU_CNT];
+static long long recent_refaults[2];    /* Anonymous, file. */
+static size_t refault_decay_evicts;     /* Evictions since the last decay. */
+
+/* Most anonymous pages swapped out together in one eviction. */
+#define SWAP_CLUSTER 8
+
+/* The page-out job, kswapd, is submitted to the worker pool when fewer
+ * than FREE_LOW user frames are free and evicts until FREE_HIGH are, so
+ * that faults seldom find the user pool empty and have to evict on their
+ * own.  Below FREE_MIN kswapd is not keeping up, and a fault reclaims a
+ * frame itself rather than take one of the last free ones.  The marks
+ * are fractions of the user pool, with a floor. */
+#define FREE_LOW_DIV 32
+#define FREE_HIGH_DIV 16
+static size_t user_frame_cnt;           /* Frames in the user pool. */
+static size_t free_min, free_low, free_high; /* Watermarks, in frames. */
+static size_t free_lowest;              /* Fewest free frames seen. */
+static bool kswapd_queued;              /* kswapd submitted, not done? */
+
+/* Frames being written out, with the frame lock dropped.  EVICT_COND
+ * is broadcast whenever an eviction finishes. */
+static size_t evicting_cnt;
+static struct condition evict_cond;
+
+/* Working sets, estimated from each process's page-fault frequency.
+ * A process that faults again within PFF_FAST_TICKS needs every frame
+ * it has and one more.  A process's estimate halves for every
+ * PFF_DECAY_TICKS it goes without a fault, so a process that has
+ * stopped faulting comes to hold frames beyond its working set, and
+ * eviction takes those first.  No estimate falls below WS_MIN. */
+#define PFF_FAST_TICKS 2
+#define PFF_DECAY_TICKS (TIMER_FREQ / 4)
+#define WS_MIN 8
+
+/* The zero frame: one page of zeros, mapped read-only for reads of
+ * anonymous pages that have never been written, so that memory that is
+ * only read costs no frame of its own.  A write gives the page a
+ * private frame through the copy-on-write path.  The zero frame is not
+ * in the frame table, is never evicted, and is charged to no one. */
+static struct frame zero_frame;
+
+/* The file cache: frames holding file pages, by inode, offset and
+ * length, so that every process mapping the same page of a file, such
+ * as the text of an executable they all run or a file they all mmap,
+ * shares one frame.  A shared frame is written back once, whichever
+ * mapping dirtied it.  Protected by the frame lock. */
+static struct hash file_cache;
+
+/* Same-page merging, enabled by the -ksm option.  A background
+ * thread, ksmd, wakes every KSM_SCAN_MS and hashes the next KSM_BATCH
+ * frames of the frame table that hold only anonymous pages.  A frame
+ * whose hash has not changed since its previous scan is stable, and is
+ * entered in KSM_TABLE by its hash.  If a frame with that hash is
+ * there already and their contents match byte for byte, the new one's
+ * pages are moved over to it, the two sets of pages share it
+ * copy-on-write, and the new frame is freed.  A write to a merged page
+ * splits it off again through vm_handle_wp(), as after a fork.  The
+ * table and the scan cursor are protected by the frame lock. */
+#define KSM_SCAN_MS 20
+#define KSM_BATCH 64
+bool vm_ksm;
+static struct hash ksm_table;
+static struct list_elem *ksm_cursor;    /* Next frame to scan, or null. */
+
+/* Processes with at least one resident frame, by spt->resident_elem. */
+static struct list resident_list;
+
+/* Which frames a victim scan may take. */
+enum victim_scope {
+	SCOPE_ALL,                  /* Any frame. */
+	SCOPE_WS_OVER,              /* Those of processes beyond their working set. */
+	SCOPE_GROUP,                /* Those of processes in RECLAIM_GROUP. */
+};
+static struct rgroup *reclaim_group;    /* Group a SCOPE_GROUP scan is for. */
+
+/* Statistics. */
+static long long fault_cnt;             /* Faults resolved. */
+static long long evict_cnt;             /* Frames evicted. */
+static long long evict_dirty_cnt;       /* ...of which had to be written. */
+static long long clock_step_cnt;        /* Frames examined by victim scans. */
+static long long ws_evict_cnt;          /* ...taken from over-limit processes. */
+static long long group_evict_cnt;       /* ...taken from groups at their cap. */
+static long long kswapd_wake_cnt;       /* Times kswapd was woken. */
+static long long direct_reclaim_cnt;    /* Faults that evicted below FREE_MIN. */
+static long long zero_fill_fault_cnt;   /* Faults on pages never touched. */
+static long long file_fault_cnt;        /* Faults that read a file page. */
+static long long swap_fault_cnt;        /* Faults that read a swapped page. */
+static long long minor_map_cnt;         /* Faults that mapped a resident frame. */
+static long long kswapd_evict_cnt;      /* Frames kswapd evicted. */
+static long long reclaim_cnt;           /* Faults that found no free frame. */
+static uint64_t fault_tsc;              /* Cycles spent resolving faults. */
+static uint64_t max_fault_tsc;          /* Slowest fault, in cycles. */
+static long long cow_share_cnt;         /* Frames shared by fork. */
+static long long cow_fault_cnt;         /* Writes to shared frames. */
+static long long cow_copy_cnt;          /* ...that copied the frame. */
+static long long zero_map_cnt;          /* Reads served by the zero frame. */
+static long long zero_copy_cnt;         /* ...whose pages were then written. */
+static long long file_share_cnt;        /* Faults served by the file cache. */
+static long long prefetch_cnt;          /* Pages brought in ahead of a fault. */
+static long long prefetch_used_cnt;     /* ...that were then accessed. */
+static long long prefetch_wasted_cnt;   /* ...that were freed untouched. */
+static long long stack_grow_cnt;        /* Faults that grew a stack. */
+static long long seq_drop_cnt;          /* Pages deactivated behind readers. */
+static long long anon_refault_cnt;      /* Faults on evicted anonymous pages. */
+static long long file_refault_cnt;      /* Faults on evicted file pages. */
+static long long activate_cnt;          /* Frames promoted to an active list. */
+static long long deactivate_cnt;        /* Frames moved to an inactive list. */
+static long long willneed_cnt;          /* Pages brought in by MADV_WILLNEED. */
+static long long dontneed_cnt;          /* Pages dropped by MADV_DONTNEED. */
+static long long oom_kill_cnt;          /* Processes killed for memory. */
+static long long populate_cnt;          /* Pages mapped by MAP_POPULATE. */
+static long long msync_cnt;             /* Regions written back by msync. */
+static long long ksm_scan_cnt;          /* Frames hashed by ksmd. */
+static long long ksm_pass_cnt;          /* Passes over the frame table. */
+static long long ksm_merge_cnt;         /* Frames freed by merging. */
+
+static void kswapd (void *aux);
+static void ksmd (void *aux);
+static void ksm_unlist (struct frame *);
+static uint64_t ksm_hash (const struct hash_elem *, void *);
+static bool ksm_less (const struct hash_elem *, const struct hash_elem *,
+		void *);
+static uint64_t file_cache_hash (const struct hash_elem *, void *);
+static bool file_cache_less (const struct hash_elem *,
+		const struct hash_elem *, void *);
+static size_t free_frame_cnt (void);
+static bool frame_accessed (struct frame *);
+static bool frame_dirty (struct frame *);
+
 /* Initializes the virtual memory subsystem by invoking each subsystem's
  * intialize codes. */
 void
 vm_init (void) {
+	int i;
+
 	vm_anon_init ();
 	vm_file_init ();
 #ifdef EFILESYS  /* For project 4 */
@@ -15,7 +208,137 @@ vm_init (void) {
 #endif
 	register_inspect_intr ();
 	/* DO NOT MODIFY UPPER LINES. */
-	/* TODO: Your code goes here. */
+	vm_shm_init ();
+	lcr0 (rcr0 () | CR0_WP);
+	zero_frame.kva = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+	zero_frame.pin_cnt = 1;
+	list_init (&zero_frame.pages);
+	if (!hash_init (&file_cache, file_cache_hash, file_cache_less, NULL))
+		PANIC ("file cache initialization failed");
+	list_init (&frame_list);
+	for (i = 0; i < LRU_CNT; i++)
+		list_init (&lru_lists[i]);
+	list_init (&resident_list);
+	lock_init (&frame_lock);
+	cond_init (&evict_cond);
+
+	user_frame_cnt = palloc_user_page_cnt ();
+	free_low = user_frame_cnt / FREE_LOW_DIV > 4
+		? user_frame_cnt / FREE_LOW_DIV : 4;
+	free_high = user_frame_cnt / FREE_HIGH_DIV > 2 * free_low
+		? user_frame_cnt / FREE_HIGH_DIV : 2 * free_low;
+	free_min = free_low / 2;
+	free_lowest = user_frame_cnt;
+	if (vm_fault_around > FAULT_AROUND_MAX)
+		vm_fault_around = FAULT_AROUND_MAX;
+	if (vm_stack_batch < 1)
+		vm_stack_batch = 1;
+	if (vm_stack_batch > STACK_BATCH_MAX)
+		vm_stack_batch = STACK_BATCH_MAX;
+
+	if (!hash_init (&ksm_table, ksm_hash, ksm_less, NULL))
+		PANIC ("same-page merging table initialization failed");
+	if (vm_ksm && thread_create ("ksmd", PRI_MIN, ksmd, NULL) == TID_ERROR)
+		PANIC ("cannot start ksmd");
+}
+
+/* Sets the eviction policy from NAME, one of "fifo", "clock",
+ * "clock2" or "lru", as given to the -evict option. */
+void
+vm_set_evict_policy (const char *name) {
+	if (name != NULL && !strcmp (name, "fifo"))
+		vm_evict_policy = EVICT_FIFO;
+	else if (name != NULL && !strcmp (name, "clock"))
+		vm_evict_policy = EVICT_CLOCK;
+	else if (name != NULL && !strcmp (name, "clock2"))
+		vm_evict_policy = EVICT_CLOCK2;
+	else if (name != NULL && !strcmp (name, "lru"))
+		vm_evict_policy = EVICT_LRU;
+	else
+		PANIC ("unknown eviction policy `%s'", name != NULL ? name : "");
+}
+
+/* Prints the state of the frame table: how many frames are free, how
+ * many are mapped and recently used (active) or not (inactive), and how
+ * many are dirty, against the watermarks. */
+static void
+frame_print_stats (void) {
+	size_t active = 0, inactive = 0, dirty = 0;
+	struct list_elem *e;
+
+	lock_acquire (&frame_lock);
+	for (e = list_begin (&frame_list); e != list_end (&frame_list);
+			e = list_next (e)) {
+		struct frame *frame = list_entry (e, struct frame, elem);
+
+		if (frame_accessed (frame))
+			active++;
+		else
+			inactive++;
+		if (frame_dirty (frame))
+			dirty++;
+	}
+	printf ("VM: frames: %zu in user pool, %zu free (%zu at least), "
+			"%zu active, %zu inactive, %zu dirty; "
+			"watermarks %zu/%zu/%zu\n",
+			user_frame_cnt, free_frame_cnt (), free_lowest, active, inactive,
+			dirty, free_min, free_low, free_high);
+	printf ("VM: lru: anon %zu active, %zu inactive; file %zu active, "
+			"%zu inactive; %lld promoted, %lld demoted\n",
+			lru_cnt[LRU_ANON_ACTIVE], lru_cnt[LRU_ANON_INACTIVE],
+			lru_cnt[LRU_FILE_ACTIVE], lru_cnt[LRU_FILE_INACTIVE],
+			activate_cnt, deactivate_cnt);
+	lock_release (&frame_lock);
+}
+
+/* Prints virtual memory statistics. */
+void
+vm_print_stats (void) {
+	static const char *policy_names[] = { "fifo", "clock", "clock2", "lru" };
+
+	printf ("VM: %lld faults, %lld evictions (%lld dirty, "
+			"%lld beyond working set, %lld at group caps), "
+			"%lld frames scanned (%s)\n",
+			fault_cnt, evict_cnt, evict_dirty_cnt, ws_evict_cnt, group_evict_cnt,
+			clock_step_cnt, policy_names[vm_evict_policy]);
+	printf ("VM: faults by type: %lld zero-fill, %lld file, %lld swap-in, "
+			"%lld copy-on-write\n", zero_fill_fault_cnt, file_fault_cnt,
+			swap_fault_cnt, cow_fault_cnt);
+	printf ("VM: refaults: %lld anonymous, %lld file\n",
+			anon_refault_cnt, file_refault_cnt);
+	printf ("VM: %lld minor faults, %lld of them mapped a resident frame; "
+			"%lld major\n", fault_cnt - file_fault_cnt - swap_fault_cnt,
+			minor_map_cnt, file_fault_cnt + swap_fault_cnt);
+	frame_print_stats ();
+	printf ("VM: kswapd woken %lld times, evicted %lld frames; "
+			"%lld faults found no free frame, %lld reclaimed below min\n",
+			kswapd_wake_cnt, kswapd_evict_cnt, reclaim_cnt, direct_reclaim_cnt);
+	printf ("VM: fault latency %llu cycles average, %llu maximum\n",
+			fault_cnt ? fault_tsc / fault_cnt : 0, max_fault_tsc);
+	printf ("VM: fork shared %lld frames; %lld copy-on-write faults, "
+			"%lld copies\n", cow_share_cnt, cow_fault_cnt, cow_copy_cnt);
+	printf ("VM: %lld reads mapped the zero frame, %lld of them written\n",
+			zero_map_cnt, zero_copy_cnt);
+	printf ("VM: %lld faults mapped a frame from the file cache\n",
+			file_share_cnt);
+	printf ("VM: fault-around of %u pages prefetched %lld, "
+			"%lld used, %lld wasted\n",
+			vm_fault_around, prefetch_cnt, prefetch_used_cnt,
+			prefetch_wasted_cnt);
+	printf ("VM: %lld faults grew the stack, %u pages at a time\n",
+			stack_grow_cnt, vm_stack_batch);
+	printf ("VM: madvise brought in %lld pages and dropped %lld; "
+			"%lld pages deactivated behind sequential readers\n",
+			willneed_cnt, dontneed_cnt, seq_drop_cnt);
+	printf ("VM: %lld processes killed out of memory\n", oom_kill_cnt);
+	printf ("VM: mmap populated %lld pages; msync wrote back %lld regions\n",
+			populate_cnt, msync_cnt);
+	file_backed_print_stats ();
+	if (vm_ksm)
+		printf ("VM: same-page merging freed %lld frames; "
+				"%lld frames scanned in %lld passes\n",
+				ksm_merge_cnt, ksm_scan_cnt, ksm_pass_cnt);
+	swap_print_stats ();
 }
 
 /* Get the type of the page. This function is useful if you want to know the
@@ -33,111 +356,1656 @@ page_get_type (struct page *page) {
 }
 
 /* Helpers */
-static struct frame *vm_get_victim (void);
+static struct frame *vm_get_victim (struct rgroup *);
 static bool vm_do_claim_page (struct page *page);
-static struct frame *vm_evict_frame (void);
+static struct frame *vm_evict_frame (struct rgroup *);
+
+/* Creates the pending page object for UPAGE in VMA, of TYPE and
+ * filled by INIT given AUX, and inserts it into SPT.  Returns the
+ * page, or a null pointer if memory is short. */
+static struct page *
+page_create (struct supplemental_page_table *spt, struct vma *vma,
+		void *upage, enum vm_type type, bool writable,
+		vm_initializer *init, void *aux) {
+	bool (*initializer) (struct page *, enum vm_type, void *);
+	struct page *page;
+
+	switch (VM_TYPE (type)) {
+		case VM_ANON:
+			initializer = anon_initializer;
+			break;
+		case VM_FILE:
+			initializer = file_backed_initializer;
+			break;
+		case VM_SHM:
+			initializer = shm_initializer;
+			break;
+		default:
+			NOT_REACHED ();
+	}
+
+	page = malloc_tagged (sizeof *page, TAG_VM);
+	if (page == NULL)
+		return NULL;
+	uninit_new (page, upage, init, type, aux, initializer);
+	page->owner = thread_current ()->leader;
+	page->vma = vma;
+	page->writable = writable;
+	if (!spt_insert_page (spt, page)) {
+		free (page);
+		return NULL;
+	}
+	list_push_back (&vma->pages, &page->vma_elem);
+	return page;
+}
 
 /* Create the pending page object with initializer. If you want to create a
  * page, do not create it directly and make it through this function or
- * `vm_alloc_page`. */
+ * `vm_alloc_page`.  A page outside every region gets a one-page region of
+ * its own; mapping many pages at once is cheaper through vma_create(). */
 bool
 vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 		vm_initializer *init, void *aux) {
 
 	ASSERT (VM_TYPE(type) != VM_UNINIT)
 
-	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct supplemental_page_table *spt = &thread_current ()->leader->spt;
+	struct vma *vma;
 
 	/* Check wheter the upage is already occupied or not. */
-	if (spt_find_page (spt, upage) == NULL) {
-		/* TODO: Create the page, fetch the initialier according to the VM type,
-		 * TODO: and then create "uninit" page struct by calling uninit_new. You
-		 * TODO: should modify the field after calling the uninit_new. */
+	if (spt_find_page (spt, upage) != NULL)
+		return false;
 
-		/* TODO: Insert the page into the spt. */
+	vma = vma_find (spt, upage);
+	if (vma == NULL) {
+		vma = vma_create (spt, upage, PGSIZE, type, writable);
+		if (vma == NULL)
+			return false;
+		if (page_create (spt, vma, upage, type, writable, init, aux) == NULL) {
+			vma_destroy (spt, vma);
+			return false;
+		}
+		return true;
 	}
-err:
-	return false;
+	return page_create (spt, vma, upage, type, writable, init, aux) != NULL;
+}
+
+/* Returns the page containing VA in SPT, materializing it from its
+ * region on first touch.  Returns a null pointer if VA is unmapped or
+ * memory is short. */
+static struct page *
+vm_find_page (struct supplemental_page_table *spt, void *va) {
+	struct page *page = spt_find_page (spt, va);
+	struct vma *vma;
+
+	if (page != NULL)
+		return page;
+	vma = vma_find (spt, va);
+	if (vma == NULL)
+		return NULL;
+	return page_create (spt, vma, pg_round_down (va), vma->type,
+			vma->writable, vma->init, vma->aux);
 }
 
 /* Find VA from spt and return page. On error, return NULL. */
 struct page *
-spt_find_page (struct supplemental_page_table *spt UNUSED, void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function. */
-
-	return page;
+spt_find_page (struct supplemental_page_table *spt, void *va) {
+	return ohash_find (&spt->pages, (uintptr_t) pg_round_down (va));
 }
 
 /* Insert PAGE into spt with validation. */
 bool
-spt_insert_page (struct supplemental_page_table *spt UNUSED,
-		struct page *page UNUSED) {
-	int succ = false;
-	/* TODO: Fill this function. */
-
-	return succ;
+spt_insert_page (struct supplemental_page_table *spt, struct page *page) {
+	ASSERT (pg_ofs (page->va) == 0);
+	return ohash_insert (&spt->pages, (uintptr_t) page->va, page);
 }
 
+/* Removes PAGE from SPT and frees it. */
 void
 spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
+	ohash_delete (&spt->pages, (uintptr_t) page->va);
+	list_remove (&page->vma_elem);
 	vm_dealloc_page (page);
+}
+
+/* Returns SPT's current working-set estimate, in frames, decayed for
+ * the time since its last fault. */
+static size_t
+ws_estimate (const struct supplemental_page_table *spt) {
+	int64_t shift = timer_elapsed (spt->last_fault) / PFF_DECAY_TICKS;
+	size_t ws = shift < 32 ? spt->ws_target >> shift : 0;
+
+	return ws > WS_MIN ? ws : WS_MIN;
+}
+
+/* Does SPT hold more frames than its working set? */
+static bool
+ws_over (const struct supplemental_page_table *spt) {
+	return spt->rss > ws_estimate (spt);
+}
+
+/* Updates the working-set estimate of SPT for a fault. */
+static void
+ws_fault (struct supplemental_page_table *spt) {
+	size_t ws = ws_estimate (spt);
+
+	if (timer_elapsed (spt->last_fault) <= PFF_FAST_TICKS && ws <= spt->rss)
+		ws = spt->rss + 1;
+	spt->ws_target = ws;
+	spt->last_fault = timer_ticks ();
+	spt->fault_cnt++;
+}
+
+/* Charges a resident frame to, or credits one back from, the process
+ * that maps PAGE, and its resource group. */
+static void
+rss_add (struct page *page) {
+	struct supplemental_page_table *spt = &page->owner->spt;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	if (spt->rss++ == 0)
+		list_push_back (&resident_list, &spt->resident_elem);
+	if (page->owner->rgroup != NULL)
+		page->owner->rgroup->frames++;
+}
+
+static void
+rss_sub (struct page *page) {
+	struct supplemental_page_table *spt = &page->owner->spt;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	ASSERT (spt->rss > 0);
+	if (--spt->rss == 0)
+		list_remove (&spt->resident_elem);
+	if (page->owner->rgroup != NULL)
+		page->owner->rgroup->frames--;
+}
+
+/* Moves process LEADER into resource group TO, which may be null,
+ * with the frames and swap charged to it.  The group pointer changes
+ * with the frame lock held, for rss_add() and rss_sub(), and with
+ * anon.c's charge lock held, for its swap charges. */
+void
+vm_rgroup_move (struct thread *leader, struct rgroup *to) {
+	struct rgroup *from = leader->rgroup;
+
+	lock_acquire (&frame_lock);
+	if (from != NULL)
+		from->frames -= leader->spt.rss;
+	if (to != NULL)
+		to->frames += leader->spt.rss;
+	anon_rgroup_move (leader, to);
+	lock_release (&frame_lock);
+}
+
+/* Does any process hold frames beyond its working set? */
+static bool
+any_ws_over (void) {
+	struct list_elem *e;
+
+	for (e = list_begin (&resident_list); e != list_end (&resident_list);
+			e = list_next (e))
+		if (ws_over (list_entry (e, struct supplemental_page_table,
+						resident_elem)))
+			return true;
+	return false;
+}
+
+/* Returns the frame after E in the frame table, wrapping around at
+ * the end. */
+static struct list_elem *
+clock_next (struct list_elem *e) {
+	e = list_next (e);
+	return e != list_end (&frame_list) ? e : list_begin (&frame_list);
+}
+
+/* Settles whether prefetched PAGE was used, before its accessed bit is
+ * lost.  A page that has not been accessed yet is judged wasted only if
+ * FINAL, when it is leaving memory. */
+static void
+prefetch_settle (struct page *page, bool final) {
+	if (!page->prefetched)
+		return;
+	if (pml4_is_accessed (page->owner->pml4, page->va))
+		prefetch_used_cnt++;
+	else if (final)
+		prefetch_wasted_cnt++;
+	else
+		return;
+	page->prefetched = false;
+}
+
+/* Is FRAME mapped by more than one page?  The zero frame always counts
+ * as shared, so that it is never mapped writable. */
+static bool
+frame_shared (struct frame *frame) {
+	return frame == &zero_frame || (!list_empty (&frame->pages)
+		&& list_front (&frame->pages) != list_back (&frame->pages));
+}
+
+/* Frame table accessors for the bits the MMU keeps on behalf of
+ * FRAME's pages, in the page tables of the processes that map it.  A
+ * shared frame is accessed or dirty if it is through any mapping. */
+static bool
+frame_accessed (struct frame *frame) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+
+		if (pml4_is_accessed (page->owner->pml4, page->va))
+			return true;
+	}
+	return false;
+}
+
+static void
+frame_clear_accessed (struct frame *frame) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+
+		prefetch_settle (page, false);
+		pml4_set_accessed (page->owner->pml4, page->va, false);
+	}
+}
+
+static bool
+frame_dirty (struct frame *frame) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+
+		if (pml4_is_dirty (page->owner->pml4, page->va))
+			return true;
+	}
+	return false;
+}
+
+/* Puts FRAME on list LRU, at the tail. */
+static void
+lru_put (struct frame *frame, enum frame_lru lru) {
+	list_push_back (&lru_lists[lru], &frame->lru_elem);
+	lru_cnt[lru]++;
+	frame->lru = lru;
+}
+
+/* Takes FRAME off its LRU list, if it is on one. */
+static void
+lru_del (struct frame *frame) {
+	if (frame->lru != LRU_NONE) {
+		list_remove (&frame->lru_elem);
+		lru_cnt[frame->lru]--;
+		frame->lru = LRU_NONE;
+	}
+}
+
+/* Moves FRAME to the tail of list LRU. */
+static void
+lru_move (struct frame *frame, enum frame_lru lru) {
+	lru_del (frame);
+	lru_put (frame, lru);
+}
+
+/* Does FRAME, which holds PAGE, belong on the file lists? */
+static bool
+lru_file (const struct frame *frame, struct page *page) {
+	return frame->inode != NULL || page_get_type (page) == VM_FILE;
+}
+
+/* Puts FRAME, just given its first page PAGE, on an LRU list. */
+static void
+lru_add (struct frame *frame, struct page *page) {
+	frame->referenced = false;
+	lru_put (frame, lru_file (frame, page)
+			? LRU_FILE_INACTIVE : LRU_ANON_ACTIVE);
+}
+
+/* Moves FRAME from an active list to the inactive one of its pair. */
+static void
+lru_deactivate (struct frame *frame) {
+	if (frame->lru == LRU_ANON_ACTIVE || frame->lru == LRU_FILE_ACTIVE) {
+		frame->referenced = false;
+		lru_move (frame, frame->lru - 1);
+		deactivate_cnt++;
+	}
+}
+
+/* Notes a fault on PAGE, which was evicted earlier. */
+static void
+lru_refault (struct page *page) {
+	bool file = page_get_type (page) == VM_FILE;
+
+	lock_acquire (&frame_lock);
+	if (file)
+		file_refault_cnt++;
+	else
+		anon_refault_cnt++;
+	recent_refaults[file]++;
+	lock_release (&frame_lock);
+	page->evicted = false;
+}
+
+/* Links PAGE to FRAME and charges the frame to PAGE's process. */
+static void
+frame_link (struct frame *frame, struct page *page) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	ASSERT (page->frame == NULL);
+
+	list_push_back (&frame->pages, &page->frame_elem);
+	if (frame->page == NULL)
+		frame->page = page;
+	page->frame = frame;
+	if (frame != &zero_frame) {
+		rss_add (page);
+		if (frame->lru == LRU_NONE)
+			lru_add (frame, page);
+	}
+}
+
+/* Unlinks PAGE from FRAME.  FRAME is left with no page once the last
+ * one is unlinked. */
+static void
+frame_unlink (struct frame *frame, struct page *page) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	ASSERT (page->frame == frame);
+
+	list_remove (&page->frame_elem);
+	page->frame = NULL;
+	if (frame != &zero_frame)
+		rss_sub (page);
+	frame->page = list_empty (&frame->pages) ? NULL
+		: list_entry (list_front (&frame->pages), struct page, frame_elem);
+}
+
+/* Must PAGE map FRAME read-only, although PAGE is writable, to keep
+ * the sharing copy-on-write?  So it must if FRAME is the zero frame or
+ * is shared by anonymous pages.  Mappings of a file page or of a
+ * shared memory segment share its frame as it is, and see one
+ * another's writes. */
+static bool
+frame_cow (struct frame *frame, struct page *page) {
+	enum vm_type type = page_get_type (page);
+
+	return frame == &zero_frame
+		|| (frame_shared (frame) && type != VM_FILE && type != VM_SHM);
+}
+
+/* Maps PAGE to FRAME in its owner's page table, writable if PAGE is
+ * writable and FRAME is not shared copy-on-write.  A fresh mapping starts with
+ * its accessed and dirty bits clear; with KEEP_BITS, those of the
+ * previous mapping of PAGE carry over. */
+static bool
+frame_map (struct frame *frame, struct page *page, bool keep_bits) {
+	uint64_t *pml4 = page->owner->pml4;
+	bool accessed = keep_bits && pml4_is_accessed (pml4, page->va);
+	bool dirty = keep_bits && pml4_is_dirty (pml4, page->va);
+
+	if (!pml4_set_page (pml4, page->va, frame->kva,
+				page->writable && !frame_cow (frame, page)))
+		return false;
+	if (accessed)
+		pml4_set_accessed (pml4, page->va, true);
+	if (dirty)
+		pml4_set_dirty (pml4, page->va, true);
+	return true;
+}
+
+/* May FRAME be evicted by a scan in SCOPE?  Frames being filled are
+ * pinned.  An anonymous page of a process whose resource group has
+ * used up its swap stays resident. */
+static bool
+frame_evictable (struct frame *frame, enum victim_scope scope) {
+	struct thread *owner;
+
+	if (frame->page == NULL || frame->pin_cnt > 0 || frame->evicting)
+		return false;
+	owner = frame->page->owner;
+	if (VM_TYPE (frame->page->operations->type) == VM_ANON
+			&& rgroup_swap_full (owner->rgroup))
+		return false;
+	switch (scope) {
+		case SCOPE_WS_OVER:
+			return ws_over (&owner->spt);
+		case SCOPE_GROUP:
+			return owner->rgroup == reclaim_group;
+		default:
+			return true;
+	}
+}
+
+/* Adds FRAME to the frame table, just behind the clock hand so that
+ * it is considered last. */
+static void
+frame_insert (struct frame *frame) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	if (clock_hand != NULL)
+		list_insert (clock_hand, &frame->elem);
+	else
+		list_push_back (&frame_list, &frame->elem);
+	frame_cnt++;
+}
+
+/* Removes FRAME from the frame table, moving any hand that points at
+ * it on to the next frame. */
+static void
+frame_remove (struct frame *frame) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	if (clock_hand == &frame->elem)
+		clock_hand = frame_cnt > 1 ? clock_next (clock_hand) : NULL;
+	if (clock_front == &frame->elem)
+		clock_front = frame_cnt > 1 ? clock_next (clock_front) : NULL;
+	if (ksm_cursor == &frame->elem) {
+		ksm_cursor = list_next (ksm_cursor);
+		if (ksm_cursor == list_end (&frame_list))
+			ksm_cursor = NULL;
+	}
+	ksm_unlist (frame);
+	lru_del (frame);
+	list_remove (&frame->elem);
+	frame_cnt--;
+	if (frame->inode != NULL) {
+		hash_delete (&file_cache, &frame->cache_elem);
+		frame->inode = NULL;
+	}
+}
+
+/* Removes FRAME, which no page maps, from the frame table and frees
+ * it. */
+static void
+frame_free (struct frame *frame) {
+	ASSERT (frame->page == NULL);
+
+	frame_remove (frame);
+	palloc_free_page (frame->kva);
+	free (frame);
+}
+
+/* Returns a hash of the file page that frame E holds. */
+static uint64_t
+file_cache_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct frame *f = hash_entry (e, struct frame, cache_elem);
+
+	return hash_u64 (hash_ptr (f->inode) ^ (uint64_t) f->ofs);
+}
+
+/* Orders the file pages that frames A and B hold. */
+static bool
+file_cache_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct frame *a = hash_entry (a_, struct frame, cache_elem);
+	const struct frame *b = hash_entry (b_, struct frame, cache_elem);
+
+	if (a->inode != b->inode)
+		return a->inode < b->inode;
+	if (a->ofs != b->ofs)
+		return a->ofs < b->ofs;
+	return a->bytes < b->bytes;
+}
+
+/* If PAGE is a page of a file-backed region with file contents, fills
+ * in the file cache key fields of KEY for it and returns true. */
+static bool
+file_cache_key (struct page *page, struct frame *key) {
+	struct vma *vma = page->vma;
+
+	if (vma == NULL || vma->file == NULL || VM_TYPE (vma->type) != VM_FILE)
+		return false;
+	key->inode = file_get_inode (vma->file);
+	key->bytes = vma_page_bytes (vma, page->va, &key->ofs);
+	return key->bytes > 0;
+}
+
+/* Maps PAGE to the frame in the file cache that holds its contents, if
+ * there is one.  Called with the frame lock held. */
+static bool
+file_cache_attach (struct page *page) {
+	struct frame key, *frame;
+	struct hash_elem *e;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	if (!file_cache_key (page, &key))
+		return false;
+	e = hash_find (&file_cache, &key.cache_elem);
+	if (e == NULL)
+		return false;
+	frame = hash_entry (e, struct frame, cache_elem);
+	if (frame->pin_cnt > 0 || frame->evicting)
+		return false;
+
+	file_backed_share (page);
+	frame_link (frame, page);
+	if (!frame_map (frame, page, false)) {
+		frame_unlink (frame, page);
+		return false;
+	}
+	file_share_cnt++;
 	return true;
 }
 
-/* Get the struct frame, that will be evicted. */
+/* Enters FRAME, just filled for PAGE, into the file cache, if PAGE is
+ * a file page and no other frame holds it already. */
+static void
+file_cache_insert (struct frame *frame, struct page *page) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	ASSERT (frame->inode == NULL);
+
+	if (file_cache_key (page, frame)
+			&& hash_insert (&file_cache, &frame->cache_elem) != NULL)
+		frame->inode = NULL;
+}
+
+/* FIFO: the frame that has held its page longest. */
+static struct frame *
+fifo_victim (enum victim_scope scope) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame_list); e != list_end (&frame_list);
+			e = list_next (e)) {
+		struct frame *frame = list_entry (e, struct frame, elem);
+
+		clock_step_cnt++;
+		if (frame_evictable (frame, scope))
+			return frame;
+	}
+	return NULL;
+}
+
+/* CLOCK with a preference for clean frames.  Even-numbered sweeps
+ * look for a frame that is neither accessed nor dirty and change
+ * nothing; odd-numbered sweeps take any frame that is not accessed,
+ * clearing the accessed bit of every frame they pass, which is the
+ * second chance.  Four sweeps always find a victim unless every frame
+ * is pinned or in constant use. */
+static struct frame *
+clock_victim (enum victim_scope scope) {
+	int pass;
+	size_t i;
+
+	if (clock_hand == NULL)
+		clock_hand = list_begin (&frame_list);
+	for (pass = 0; pass < 4; pass++)
+		for (i = 0; i < frame_cnt; i++) {
+			struct frame *frame = list_entry (clock_hand, struct frame, elem);
+
+			clock_hand = clock_next (clock_hand);
+			clock_step_cnt++;
+			if (!frame_evictable (frame, scope))
+				continue;
+			if (frame_accessed (frame)) {
+				if (pass % 2 == 1)
+					frame_clear_accessed (frame);
+				continue;
+			}
+			if (pass % 2 == 1 || !frame_dirty (frame))
+				return frame;
+		}
+	return NULL;
+}
+
+/* Two-handed CLOCK.  The front hand clears accessed bits; the back
+ * hand, trailing it by a fixed spread, takes a frame whose bit is
+ * still clear, so a page survives only if it was used within the
+ * time the hands take to cover the spread.  The back hand passes
+ * over dirty candidates for up to one revolution looking for a clean
+ * one. */
 static struct frame *
-vm_get_victim (void) {
-	struct frame *victim = NULL;
-	 /* TODO: The policy for eviction is up to you. */
+clock2_victim (enum victim_scope scope) {
+	struct frame *dirty_victim = NULL;
+	size_t i;
+
+	if (clock_hand == NULL)
+		clock_hand = list_begin (&frame_list);
+	if (clock_front == NULL) {
+		clock_front = clock_hand;
+		for (i = 0; i < frame_cnt / CLOCK_SPREAD_DIV; i++)
+			clock_front = clock_next (clock_front);
+	}
+
+	for (i = 0; i < 2 * frame_cnt; i++) {
+		struct frame *front = list_entry (clock_front, struct frame, elem);
+		struct frame *back = list_entry (clock_hand, struct frame, elem);
+
+		if (frame_evictable (front, scope))
+			frame_clear_accessed (front);
+		clock_front = clock_next (clock_front);
+		clock_hand = clock_next (clock_hand);
+		clock_step_cnt++;
 
-	return victim;
+		if (frame_evictable (back, scope) && !frame_accessed (back)) {
+			if (!frame_dirty (back))
+				return back;
+			if (dirty_victim == NULL)
+				dirty_victim = back;
+		}
+		if (dirty_victim != NULL && i >= frame_cnt)
+			break;
+	}
+	return dirty_victim;
+}
+
+/* Trims the active list of the pair whose inactive list is INACTIVE
+ * down to the length of the inactive list.  A frame accessed since it
+ * was last looked at goes round again, with its bit cleared. */
+static void
+lru_trim (enum frame_lru inactive) {
+	enum frame_lru active = inactive + 1;
+	size_t i, cnt = lru_cnt[active];
+
+	for (i = 0; i < cnt && lru_cnt[inactive] < lru_cnt[active]; i++) {
+		struct frame *frame = list_entry (list_front (&lru_lists[active]),
+				struct frame, lru_elem);
+
+		clock_step_cnt++;
+		if (frame->pin_cnt == 0 && !frame->evicting && frame_accessed (frame)) {
+			frame_clear_accessed (frame);
+			lru_move (frame, active);
+		} else
+			lru_deactivate (frame);
+	}
 }
 
-/* Evict one page and return the corresponding frame.
- * Return NULL on error.*/
+/* Takes a frame from inactive list INACTIVE, first trimming its active
+ * list.  A frame found accessed is promoted if it had been found
+ * accessed on the previous pass too, and otherwise given another pass
+ * with REFERENCED set. */
 static struct frame *
-vm_evict_frame (void) {
-	struct frame *victim UNUSED = vm_get_victim ();
-	/* TODO: swap out the victim and return the evicted frame. */
+lru_scan (enum frame_lru inactive, enum victim_scope scope) {
+	struct list *list = &lru_lists[inactive];
+	size_t i, cnt;
+
+	lru_trim (inactive);
+	cnt = lru_cnt[inactive];
+	for (i = 0; i < cnt; i++) {
+		struct frame *frame = list_entry (list_front (list), struct frame,
+				lru_elem);
 
+		lru_move (frame, inactive);
+		clock_step_cnt++;
+		if (!frame_evictable (frame, scope))
+			continue;
+		if (frame_accessed (frame)) {
+			frame_clear_accessed (frame);
+			if (frame->referenced) {
+				lru_move (frame, inactive + 1);
+				activate_cnt++;
+			}
+			frame->referenced = !frame->referenced;
+			continue;
+		}
+		return frame;
+	}
 	return NULL;
 }
 
+/* Active and inactive lists: reclaims from the file pair first, unless
+ * file pages have been refaulting more than anonymous ones, and from
+ * the other pair if the first has nothing to give. */
+static struct frame *
+lru_victim (enum victim_scope scope) {
+	enum frame_lru first = LRU_FILE_INACTIVE, second = LRU_ANON_INACTIVE;
+	struct frame *frame;
+
+	if (++refault_decay_evicts >= user_frame_cnt / REFAULT_DECAY_DIV) {
+		recent_refaults[0] /= 2;
+		recent_refaults[1] /= 2;
+		refault_decay_evicts = 0;
+	}
+	if (recent_refaults[1] > recent_refaults[0]) {
+		first = LRU_ANON_INACTIVE;
+		second = LRU_FILE_INACTIVE;
+	}
+	frame = lru_scan (first, scope);
+	if (frame == NULL)
+		frame = lru_scan (second, scope);
+	return frame;
+}
+
+/* Runs the eviction policy over the frames that qualify under
+ * SCOPE. */
+static struct frame *
+policy_victim (enum victim_scope scope) {
+	switch (vm_evict_policy) {
+		case EVICT_FIFO:
+			return fifo_victim (scope);
+		case EVICT_CLOCK:
+			return clock_victim (scope);
+		case EVICT_CLOCK2:
+			return clock2_victim (scope);
+		case EVICT_LRU:
+			return lru_victim (scope);
+		default:
+			NOT_REACHED ();
+	}
+}
+
+/* Get the struct frame, that will be evicted.  If GROUP is non-null,
+ * the frame is one of GROUP's, or there is none.  Otherwise,
+ * processes holding more than their working set give up frames
+ * first, so that one process thrashing cannot take frames that others
+ * are actively using. */
+static struct frame *
+vm_get_victim (struct rgroup *group) {
+	struct frame *victim;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	if (list_empty (&frame_list))
+		return NULL;
+	if (group != NULL) {
+		reclaim_group = group;
+		victim = policy_victim (SCOPE_GROUP);
+		reclaim_group = NULL;
+		return victim;
+	}
+	if (any_ws_over ()) {
+		victim = policy_victim (SCOPE_WS_OVER);
+		if (victim != NULL) {
+			ws_evict_cnt++;
+			return victim;
+		}
+	}
+	return policy_victim (SCOPE_ALL);
+}
+
+/* Can FRAME, which follows or precedes anonymous VICTIM in the frame
+ * table, be swapped out along with it as the page at VA?  Only pages
+ * of the same process that have not been used lately qualify. */
+static bool
+cluster_member (struct frame *frame, const struct page *victim,
+		const void *va) {
+	const struct page *page = frame->page;
+
+	return frame_evictable (frame, SCOPE_ALL) && !frame_shared (frame)
+		&& page->owner == victim->owner && page->va == va
+		&& VM_TYPE (page->operations->type) == VM_ANON
+		&& !frame_accessed (frame);
+}
+
+/* Collects into RUN the frames holding the anonymous pages at
+ * consecutive addresses around VICTIM's, in address order, and
+ * returns how many there are.  Pages faulted in one after another sit
+ * next to each other in the frame table, so only VICTIM's neighbors
+ * there need to be examined. */
+static size_t
+gather_cluster (struct frame *victim, struct frame **run) {
+	const struct page *vp = victim->page;
+	struct list_elem *e = &victim->elem;
+	size_t back, cnt;
+
+	for (back = 0; back < SWAP_CLUSTER - 1 && e != list_begin (&frame_list);
+			back++) {
+		struct list_elem *prev = list_prev (e);
+
+		if (!cluster_member (list_entry (prev, struct frame, elem), vp,
+					(uint8_t *) vp->va - (back + 1) * PGSIZE))
+			break;
+		e = prev;
+	}
+	for (cnt = 0; cnt < SWAP_CLUSTER && e != list_end (&frame_list);
+			cnt++, e = list_next (e)) {
+		struct frame *frame = list_entry (e, struct frame, elem);
+
+		if (cnt > back && !cluster_member (frame, vp,
+					(uint8_t *) vp->va + (cnt - back) * PGSIZE))
+			break;
+		run[cnt] = frame;
+	}
+	return cnt;
+}
+
+/* Evict one page, one of GROUP's if GROUP is non-null, and return the
+ * corresponding frame.
+ * Return NULL on error.  An anonymous victim takes its idle neighbors
+ * in the address space to swap with it, in one sequential write; their
+ * frames go back to the free pool.  Called with the frame lock held,
+ * which is dropped while the pages are written. */
+static struct frame *
+vm_evict_frame (struct rgroup *group) {
+	struct frame *victim = vm_get_victim (group);
+	struct frame *run[SWAP_CLUSTER];
+	struct page *pages[SWAP_CLUSTER];
+	bool dirty[SWAP_CLUSTER];
+	struct tlb_batch batch;
+	bool all_saved, victim_saved;
+	size_t cnt, i;
+
+	if (victim == NULL)
+		return NULL;
+	if (VM_TYPE (victim->page->operations->type) == VM_ANON
+			&& !frame_shared (victim))
+		cnt = gather_cluster (victim, run);
+	else {
+		run[0] = victim;
+		cnt = 1;
+	}
+
+	/* Unmap first, so that the owners fault rather than write the pages
+	 * while they are being saved; such faults wait for the eviction to
+	 * finish.  Accessed and dirty bits survive the unmapping.  The frame
+	 * lock is dropped for the writes, so faults that do not need these
+	 * pages are not held up behind them.  Other CPUs running the owners
+	 * drop the mappings from their TLBs in one shootdown, before the
+	 * writes start. */
+	pml4_batch_begin (&batch);
+	for (i = 0; i < cnt; i++) {
+		struct list_elem *e;
+
+		pages[i] = run[i]->page;
+		dirty[i] = frame_dirty (run[i]);
+
+		/* A page is saved through the first page that maps it, whose own
+		 * mapping then has to count as dirty if any of them is. */
+		if (dirty[i])
+			pml4_set_dirty (pages[i]->owner->pml4, pages[i]->va, true);
+		for (e = list_begin (&run[i]->pages); e != list_end (&run[i]->pages);
+				e = list_next (e)) {
+			struct page *page = list_entry (e, struct page, frame_elem);
+
+			pml4_clear_page (page->owner->pml4, page->va);
+		}
+		run[i]->evicting = true;
+	}
+	pml4_batch_end (&batch);
+	evicting_cnt += cnt;
+	lock_release (&frame_lock);
+
+	/* If there is no run of free slots long enough, save only the
+	 * victim.  The pages sharing a frame with one that is saved are
+	 * saved with it, since their contents are the same. */
+	all_saved = cnt > 1 && anon_swap_out_run (pages, cnt);
+	victim_saved = all_saved || swap_out (victim->page);
+
+	lock_acquire (&frame_lock);
+	for (i = 0; i < cnt; i++) {
+		struct list_elem *e;
+
+		run[i]->evicting = false;
+		if (!all_saved && (run[i] != victim || !victim_saved)) {
+			for (e = list_begin (&run[i]->pages);
+					e != list_end (&run[i]->pages); e = list_next (e))
+				frame_map (run[i], list_entry (e, struct page, frame_elem),
+						true);
+			continue;
+		}
+		evict_cnt++;
+		if (dirty[i])
+			evict_dirty_cnt++;
+		TRACE (EVICT, pages[i]->va, dirty[i], cnt);
+		while (!list_empty (&run[i]->pages)) {
+			struct page *page = list_entry (list_front (&run[i]->pages),
+					struct page, frame_elem);
+
+			if (page != pages[i]
+					&& VM_TYPE (page->operations->type) == VM_ANON)
+				anon_share_swap (page, pages[i]);
+			prefetch_settle (page, true);
+			page->evicted = true;
+			frame_unlink (run[i], page);
+		}
+		if (page_get_type (pages[i]) == VM_SHM)
+			shm_slot (pages[i])->frame = NULL;
+		if (run[i] != victim)
+			frame_free (run[i]);
+		else
+			frame_remove (run[i]);
+	}
+	evicting_cnt -= cnt;
+	cond_broadcast (&evict_cond, &frame_lock);
+	return victim_saved ? victim : NULL;
+}
+
+/* Returns the number of free frames in the user pool. */
+static size_t
+free_frame_cnt (void) {
+	return user_frame_cnt > frame_cnt ? user_frame_cnt - frame_cnt : 0;
+}
+
+/* The page-out job, run by a worker. */
+static void
+kswapd (void *aux UNUSED) {
+	lock_acquire (&frame_lock);
+	kswapd_wake_cnt++;
+	while (free_frame_cnt () < free_high) {
+		long long before = evict_cnt;
+		struct frame *frame = vm_evict_frame (NULL);
+
+		if (frame == NULL)
+			break;
+		palloc_free_page (frame->kva);
+		free (frame);
+		kswapd_evict_cnt += evict_cnt - before;
+	}
+	kswapd_queued = false;
+	lock_release (&frame_lock);
+}
+
+/* Returns the hash of stable frame E's contents. */
+static uint64_t
+ksm_hash (const struct hash_elem *e, void *aux UNUSED) {
+	return hash_entry (e, struct frame, ksm_elem)->ksm_sum;
+}
+
+/* Orders stable frames A and B by the hashes of their contents. */
+static bool
+ksm_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct frame, ksm_elem)->ksm_sum
+		< hash_entry (b, struct frame, ksm_elem)->ksm_sum;
+}
+
+/* Takes FRAME out of the table of stable frames, if it is in it. */
+static void
+ksm_unlist (struct frame *frame) {
+	if (frame->ksm_listed) {
+		hash_delete (&ksm_table, &frame->ksm_elem);
+		frame->ksm_listed = false;
+	}
+}
+
+/* May FRAME's pages be merged with others?  Only frames of anonymous
+ * pages qualify, and only while no one is filling or writing them. */
+static bool
+ksm_mergeable (struct frame *frame) {
+	struct list_elem *e;
+
+	if (frame->page == NULL || frame->pin_cnt > 0 || frame->evicting
+			|| frame->inode != NULL)
+		return false;
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e))
+		if (page_get_type (list_entry (e, struct page, frame_elem)) != VM_ANON)
+			return false;
+	return true;
+}
+
+/* Maps every page of FRAME read-only, keeping their accessed and
+ * dirty bits, so that FRAME's contents stay put while they are
+ * compared.  A write then faults, and vm_handle_wp() makes the mapping
+ * writable again if FRAME was not merged.  Returns false if memory
+ * ran short. */
+static bool
+ksm_protect (struct frame *frame) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		uint64_t *pml4 = page->owner->pml4;
+		bool accessed = pml4_is_accessed (pml4, page->va);
+		bool dirty = pml4_is_dirty (pml4, page->va);
+
+		if (!pml4_set_page (pml4, page->va, frame->kva, false))
+			return false;
+		pml4_set_accessed (pml4, page->va, accessed);
+		pml4_set_dirty (pml4, page->va, dirty);
+	}
+	return true;
+}
+
+/* Moves the pages of FROM onto KEEP, if their contents are the same,
+ * and frees FROM.  Returns true if successful. */
+static bool
+ksm_merge (struct frame *keep, struct frame *from) {
+	if (!ksm_protect (keep) || !ksm_protect (from)
+			|| memcmp (keep->kva, from->kva, PGSIZE))
+		return false;
+	while (!list_empty (&from->pages)) {
+		struct page *page = list_entry (list_front (&from->pages),
+				struct page, frame_elem);
+
+		frame_unlink (from, page);
+		frame_link (keep, page);
+		if (!frame_map (keep, page, true))
+			PANIC ("ksmd: remapping a page failed");
+	}
+	frame_free (from);
+	ksm_merge_cnt++;
+	return true;
+}
+
+/* Scans FRAME: hashes its contents, and merges it into a stable
+ * frame with the same contents or enters it in the table as one. */
+static void
+ksm_scan_frame (struct frame *frame) {
+	struct hash_elem *e;
+	uint64_t sum;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	if (!ksm_mergeable (frame)) {
+		ksm_unlist (frame);
+		frame->ksm_scanned = false;
+		return;
+	}
+	sum = hash_bytes (frame->kva, PGSIZE);
+	ksm_scan_cnt++;
+	if (frame->ksm_listed) {
+		if (sum == frame->ksm_sum)
+			return;
+		ksm_unlist (frame);
+	}
+	if (!frame->ksm_scanned || sum != frame->ksm_sum) {
+		/* Changed since the last scan: not stable yet. */
+		frame->ksm_sum = sum;
+		frame->ksm_scanned = true;
+		return;
+	}
+
+	e = hash_insert (&ksm_table, &frame->ksm_elem);
+	if (e == NULL) {
+		frame->ksm_listed = true;
+		return;
+	}
+	if (ksm_mergeable (hash_entry (e, struct frame, ksm_elem))
+			&& ksm_merge (hash_entry (e, struct frame, ksm_elem), frame))
+		return;
+
+	/* The listed frame has changed since it was listed, or is busy:
+	 * this one takes its place. */
+	ksm_unlist (hash_entry (e, struct frame, ksm_elem));
+	hash_insert (&ksm_table, &frame->ksm_elem);
+	frame->ksm_listed = true;
+}
+
+/* The same-page merging thread. */
+static void
+ksmd (void *aux UNUSED) {
+	for (;;) {
+		int i;
+
+		timer_msleep (KSM_SCAN_MS);
+		lock_acquire (&frame_lock);
+		for (i = 0; i < KSM_BATCH && frame_cnt > 0; i++) {
+			struct frame *frame;
+
+			if (ksm_cursor == NULL) {
+				ksm_cursor = list_begin (&frame_list);
+				ksm_pass_cnt++;
+			}
+			frame = list_entry (ksm_cursor, struct frame, elem);
+			ksm_cursor = list_next (ksm_cursor);
+			if (ksm_cursor == list_end (&frame_list))
+				ksm_cursor = NULL;
+			ksm_scan_frame (frame);
+		}
+		lock_release (&frame_lock);
+	}
+}
+
+/* Takes a page from the user pool and returns a frame for it, or a null
+ * pointer if the pool is empty or memory is short. */
+static struct frame *
+frame_alloc (void) {
+	struct frame *frame;
+	void *kva;
+
+	kva = palloc_get_page (PAL_USER);
+	if (kva == NULL)
+		return NULL;
+	frame = malloc_tagged (sizeof *frame, TAG_VM);
+	if (frame == NULL) {
+		palloc_free_page (kva);
+		return NULL;
+	}
+	frame->kva = kva;
+	frame->page = NULL;
+	frame->inode = NULL;
+	frame->lru = LRU_NONE;
+	frame->ksm_scanned = false;
+	frame->ksm_listed = false;
+	list_init (&frame->pages);
+	return frame;
+}
+
+/* Returns the process whose memory SPT is. */
+static struct thread *
+spt_owner (struct supplemental_page_table *spt) {
+	return (struct thread *) ((uint8_t *) spt
+			- offsetof (struct thread, spt));
+}
+
+/* Picks the process with the largest footprint, its resident frames
+ * plus its pages in swap, from those holding frames that have not been
+ * chosen already, and marks it to be killed.  Its threads exit at their
+ * next system call or user page fault; to make sure that one comes, the
+ * mappings of its anonymous pages are removed, which frees nothing by
+ * itself.  Returns false if there is no process left to choose.  Called
+ * with the frame lock held. */
+static bool
+oom_kill (void) {
+	struct supplemental_page_table *victim = NULL;
+	struct tlb_batch batch;
+	struct list_elem *e;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	for (e = list_begin (&resident_list); e != list_end (&resident_list);
+			e = list_next (e)) {
+		struct supplemental_page_table *spt = list_entry (e,
+				struct supplemental_page_table, resident_elem);
+
+		if (!spt->oom_killed && (victim == NULL
+					|| spt->rss + spt->swap_cnt > victim->rss + victim->swap_cnt))
+			victim = spt;
+	}
+	if (victim == NULL)
+		return false;
+
+	victim->oom_killed = true;
+	oom_kill_cnt++;
+	printf ("OOM: killing %s (pid %d): %zu frames resident, "
+			"%zu pages in swap\n", spt_owner (victim)->name,
+			spt_owner (victim)->tid, victim->rss, victim->swap_cnt);
+
+	pml4_batch_begin (&batch);
+	for (e = list_begin (&frame_list); e != list_end (&frame_list);
+			e = list_next (e)) {
+		struct frame *frame = list_entry (e, struct frame, elem);
+		struct list_elem *p;
+
+		if (frame->evicting)
+			continue;
+		for (p = list_begin (&frame->pages); p != list_end (&frame->pages);
+				p = list_next (p)) {
+			struct page *page = list_entry (p, struct page, frame_elem);
+
+			if (&page->owner->spt == victim
+					&& VM_TYPE (page->operations->type) == VM_ANON)
+				pml4_clear_page (page->owner->pml4, page->va);
+		}
+	}
+	pml4_batch_end (&batch);
+	return true;
+}
+
+/* Does a process chosen by the OOM killer still hold frames?  Called
+ * with the frame lock held. */
+static bool
+oom_pending (void) {
+	struct list_elem *e;
+
+	for (e = list_begin (&resident_list); e != list_end (&resident_list);
+			e = list_next (e))
+		if (list_entry (e, struct supplemental_page_table,
+					resident_elem)->oom_killed)
+			return true;
+	return false;
+}
+
+/* Has the current process been chosen by the OOM killer? */
+bool
+vm_oom_killed (void) {
+	struct thread *t = thread_current ();
+
+	return t->pml4 != NULL && t->leader->spt.oom_killed;
+}
+
 /* palloc() and get frame. If there is no available page, evict the page
- * and return it. This always return valid address. That is, if the user pool
- * memory is full, this function evicts the frame to get the available memory
- * space.*/
+ * and return it.  A process whose resource group holds its cap of
+ * frames evicts one of the group's instead, and goes beyond the cap
+ * only if none can be.  If nothing can be evicted, because swap is full, the
+ * process with the largest footprint is killed to make room, and its
+ * frames are waited for; if that process is the current one, returns a
+ * null pointer, and the fault or copy that needed the frame fails.  The
+ * frame is returned pinned, so that it is not chosen for eviction
+ * before its page is filled. */
 static struct frame *
 vm_get_frame (void) {
+	struct rgroup *group = thread_current ()->leader->rgroup;
 	struct frame *frame = NULL;
-	/* TODO: Fill this function. */
+
+	lock_acquire (&frame_lock);
+	if (rgroup_frames_full (group)) {
+		frame = vm_evict_frame (group);
+		if (frame != NULL) {
+			group->reclaim_cnt++;
+			group_evict_cnt++;
+		} else
+			group->over_cnt++;
+	}
+	if (frame == NULL && free_frame_cnt () < free_min) {
+		direct_reclaim_cnt++;
+		frame = vm_evict_frame (NULL);
+	}
+	while (frame == NULL) {
+		frame = frame_alloc ();
+		if (frame != NULL)
+			break;
+
+		/* Nothing free: evict on our own, or wait for an eviction in
+		 * progress, or failing that for an OOM victim's exit, to give up
+		 * a frame. */
+		reclaim_cnt++;
+		frame = vm_evict_frame (NULL);
+		if (frame != NULL)
+			break;
+		if (evicting_cnt == 0 && !oom_pending () && !oom_kill ())
+			PANIC ("out of user frames");
+		if (vm_oom_killed ()) {
+			lock_release (&frame_lock);
+			return NULL;
+		}
+		cond_wait (&evict_cond, &frame_lock);
+	}
+	frame->pin_cnt = 1;
+	frame->evicting = false;
+	frame_insert (frame);
+	if (free_frame_cnt () < free_lowest)
+		free_lowest = free_frame_cnt ();
+	if (free_frame_cnt () < free_low && !kswapd_queued)
+		kswapd_queued = workq_submit (kswapd, NULL, PRI_MAX - 1);
+	lock_release (&frame_lock);
 
 	ASSERT (frame != NULL);
 	ASSERT (frame->page == NULL);
 	return frame;
 }
 
-/* Growing the stack. */
+/* Returns a pinned frame for a prefetch, or a null pointer if free
+ * frames are down to the low watermark: a prefetch never evicts, and
+ * never leaves a fault to wait for kswapd. */
+static struct frame *
+vm_try_get_frame (void) {
+	struct frame *frame = NULL;
+
+	lock_acquire (&frame_lock);
+	if (free_frame_cnt () > free_low)
+		frame = frame_alloc ();
+	if (frame != NULL) {
+		frame->pin_cnt = 1;
+		frame->evicting = false;
+		frame_insert (frame);
+	}
+	lock_release (&frame_lock);
+	return frame;
+}
+
+/* Can the page at VA in VMA be prefetched, given its page object PAGE,
+ * which is null if it has not been materialized?  Only pages whose
+ * contents must be read are worth it: swapped-out anonymous pages, and
+ * pages with file contents that are not resident.  A zero-filled page
+ * costs nothing to fault in on demand. */
+static bool
+prefetchable (const struct vma *vma, const struct page *page, const void *va) {
+	off_t ofs;
+
+	if (page != NULL && page->frame != NULL)
+		return false;
+	if (page != NULL && anon_swapped (page))
+		return true;
+	if (page != NULL && VM_TYPE (page->operations->type) == VM_ANON)
+		return false;
+	return vma_page_bytes (vma, va, &ofs) > 0;
+}
+
+/* Brings in up to CNT pages of VMA in SPT ahead of their first access,
+ * starting at VA and moving by STEP bytes, one page up or down.  Stops
+ * at the edge of VMA, at the first page that is resident or not worth
+ * reading, and whenever free frames run short.  If FRESH, pages that
+ * have never been touched are worth it too, and are given zeroed
+ * frames.  A page whose contents another process already has in the
+ * file cache is just mapped.  Swapped-out pages are read together, in
+ * one sequential transfer when their slots are adjacent, as they are
+ * when they were swapped out in one run. */
+static void
+prefetch_run (struct supplemental_page_table *spt, struct vma *vma,
+		uint8_t *va, ptrdiff_t step, size_t cnt, bool fresh) {
+	struct page *swapped[PREFETCH_MAX];
+	struct page *filled[PREFETCH_MAX];
+	size_t swap_cnt = 0, fill_cnt = 0, i;
+
+	ASSERT (cnt <= PREFETCH_MAX);
+	for (; cnt > 0 && va >= (uint8_t *) vma->start && va < (uint8_t *) vma->end;
+			va += step, cnt--) {
+		struct page *p = spt_find_page (spt, va);
+		struct frame *frame;
+		bool attached;
+
+		if (!prefetchable (vma, p, va) && !(fresh && p == NULL))
+			break;
+		if (p == NULL) {
+			p = page_create (spt, vma, va, vma->type, vma->writable,
+					vma->init, vma->aux);
+			if (p == NULL)
+				break;
+		}
+
+		lock_acquire (&frame_lock);
+		attached = file_cache_attach (p);
+		lock_release (&frame_lock);
+		if (attached)
+			continue;
+		frame = vm_try_get_frame ();
+		if (frame == NULL)
+			break;
+
+		lock_acquire (&frame_lock);
+		frame_link (frame, p);
+		lock_release (&frame_lock);
+		if (anon_swapped (p))
+			swapped[swap_cnt++] = p;
+		else
+			filled[fill_cnt++] = p;
+	}
+
+	if (swap_cnt > 0)
+		anon_swap_in_run (swapped, swap_cnt);
+	for (i = 0; i < fill_cnt; i++)
+		if (!swap_in (filled[i], filled[i]->frame->kva)) {
+			vm_free_frame (filled[i]);
+			filled[i] = NULL;
+		}
+
+	/* Map the pages with their accessed bits clear, so that a later
+	 * access tells whether the prefetch paid off. */
+	for (i = 0; i < swap_cnt + fill_cnt; i++) {
+		struct page *p = i < swap_cnt ? swapped[i] : filled[i - swap_cnt];
+
+		if (p == NULL)
+			continue;
+		if (!frame_map (p->frame, p, false)) {
+			vm_free_frame (p);
+			continue;
+		}
+		p->prefetched = true;
+		prefetch_cnt++;
+		lock_acquire (&frame_lock);
+		p->frame->pin_cnt--;
+		file_cache_insert (p->frame, p);
+		lock_release (&frame_lock);
+	}
+}
+
+/* Fault-around: after the fault on PAGE, brings in the pages that
+ * follow it in its region, up to the fault-around window, so that a
+ * sequential scan takes one fault per window instead of one per page. */
+static void
+fault_around (struct supplemental_page_table *spt, struct page *page) {
+	prefetch_run (spt, page->vma, (uint8_t *) page->va + PGSIZE, PGSIZE,
+			vm_fault_around, false);
+}
+
+/* Sequential access.  A fault in a region advised MADV_SEQUENTIAL
+ * prefetches the most pages it may, and clears the accessed bits of the
+ * window of pages SEQ_BEHIND windows back, so that the clock takes
+ * those, which a sequential reader is done with, before anything
+ * else. */
+#define SEQ_BEHIND 2
+
 static void
-vm_stack_growth (void *addr UNUSED) {
+fault_sequential (struct supplemental_page_table *spt, struct page *page) {
+	uint8_t *behind = (uint8_t *) page->va - SEQ_BEHIND * FAULT_AROUND_MAX
+		* PGSIZE;
+	size_t i;
+
+	prefetch_run (spt, page->vma, (uint8_t *) page->va + PGSIZE, PGSIZE,
+			FAULT_AROUND_MAX, false);
+
+	lock_acquire (&frame_lock);
+	for (i = 0; i < FAULT_AROUND_MAX; i++, behind += PGSIZE) {
+		struct page *p;
+
+		if (behind < (uint8_t *) page->vma->start)
+			continue;
+		p = spt_find_page (spt, behind);
+		if (p != NULL && p->frame != NULL && p->frame != &zero_frame
+				&& !p->frame->evicting) {
+			frame_clear_accessed (p->frame);
+			lru_deactivate (p->frame);
+			seq_drop_cnt++;
+		}
+	}
+	lock_release (&frame_lock);
+}
+
+/* Is PAGE certain to read as zeros when it is first loaded?  That holds
+ * for an anonymous page not yet loaded whose region has no file
+ * contents for it, given that a region's initializer fills a page from
+ * the region's backing store. */
+static bool
+zero_fillable (struct page *page) {
+	off_t ofs;
+
+	return VM_TYPE (page->operations->type) == VM_UNINIT
+		&& VM_TYPE (page->uninit.type) == VM_ANON
+		&& page->uninit.init == page->vma->init
+		&& vma_page_bytes (page->vma, page->va, &ofs) == 0;
 }
 
-/* Handle the fault on write_protected page */
+/* The minor fault path: maps PAGE if its contents are in a frame
+ * already, without allocating or reading one.  They are if PAGE's own
+ * frame stayed resident while its mapping went away, or if PAGE is a
+ * file page that another mapping has in the file cache.  Returns false
+ * if the page has to be brought in. */
 static bool
-vm_handle_wp (struct page *page UNUSED) {
+fault_minor (struct page *page) {
+	bool mapped = false;
+
+	if (page_get_type (page) == VM_SHM)
+		return false;
+	lock_acquire (&frame_lock);
+	while (page->frame != NULL && page->frame->evicting)
+		cond_wait (&evict_cond, &frame_lock);
+	if (page->frame != NULL)
+		mapped = frame_map (page->frame, page, true);
+	else
+		mapped = file_cache_attach (page);
+	lock_release (&frame_lock);
+	return mapped;
+}
+
+/* Maps PAGE, which is zero-fillable, to the zero frame. */
+static bool
+vm_map_zero (struct page *page) {
+	bool success;
+
+	lock_acquire (&frame_lock);
+	frame_link (&zero_frame, page);
+	success = frame_map (&zero_frame, page, false);
+	if (!success)
+		frame_unlink (&zero_frame, page);
+	lock_release (&frame_lock);
+	if (success)
+		zero_map_cnt++;
+	return success;
+}
+
+/* Growing the stack.  Extends the stack's region in SPT down over ADDR,
+ * which lies below it but within STACK_MAX of USER_STACK, and over the
+ * vm_stack_batch - 1 pages below that, which the caller prefetches.  A
+ * guard page is kept unmapped between the stack and any region below;
+ * if a whole batch does not fit, only ADDR's page is added.  Returns
+ * false if ADDR cannot be made part of the stack. */
+static bool
+vm_stack_growth (struct supplemental_page_table *spt, void *addr) {
+	struct vma *stack = vma_find (spt, (uint8_t *) USER_STACK - PGSIZE);
+	uint8_t *limit = (uint8_t *) USER_STACK - STACK_MAX;
+	uint8_t *start = pg_round_down (addr);
+	uint8_t *batch_start;
+
+	if (stack == NULL || !(stack->type & VM_MARKER_0)
+			|| start < limit || start >= (uint8_t *) stack->start)
+		return false;
+	batch_start = (size_t) (start - limit) > (vm_stack_batch - 1) * PGSIZE
+		? start - (vm_stack_batch - 1) * PGSIZE : limit;
+	if (!vma_extend_down (spt, stack, batch_start, PGSIZE)
+			&& !vma_extend_down (spt, stack, start, PGSIZE))
+		return false;
+	spt->stack_grow_cnt++;
+	stack_grow_cnt++;
+	return true;
+}
+
+/* Is a fault at ADDR, with the user stack pointer at RSP, an access to
+ * the stack?  A push may write just below RSP before moving it. */
+static bool
+is_stack_access (const void *addr, uintptr_t rsp) {
+	return (uintptr_t) addr + 8 >= rsp && (uintptr_t) addr < USER_STACK;
+}
+
+/* Handle the fault on write_protected page: a write to writable PAGE
+ * while it shares its frame copy-on-write, or maps the zero frame.
+ * Gives PAGE a private copy of the frame, or, if the other sharers have
+ * gone, makes the mapping writable.  A page leaving the zero frame is
+ * filled by its initializer, as on a first fault.  If the frame was
+ * evicted in the meantime, the write is simply retried and faults the
+ * page back in. */
+static bool
+vm_handle_wp (struct page *page) {
+	struct frame *copy = NULL;
+	struct frame *frame, *fresh = NULL;
+	bool zero = false;
+	bool success;
+
+	lock_acquire (&frame_lock);
+	cow_fault_cnt++;
+	for (;;) {
+		while (page->frame != NULL && page->frame->evicting)
+			cond_wait (&evict_cond, &frame_lock);
+		frame = page->frame;
+		if (frame == NULL || !frame_cow (frame, page) || copy != NULL)
+			break;
+
+		/* Getting a frame may evict, so it is done unlocked, and then
+		 * everything is looked at again. */
+		lock_release (&frame_lock);
+		copy = vm_get_frame ();
+		if (copy == NULL)
+			return false;
+		lock_acquire (&frame_lock);
+	}
+
+	if (frame != NULL && frame_cow (frame, page)) {
+		zero = frame == &zero_frame;
+		if (zero)
+			zero_copy_cnt++;
+		else {
+			memcpy (copy->kva, frame->kva, PGSIZE);
+			cow_copy_cnt++;
+		}
+		frame_unlink (frame, page);
+		frame_link (copy, page);
+		frame = fresh = copy;
+		copy = NULL;
+	}
+	success = frame == NULL || frame_map (frame, page, true);
+	if (copy != NULL)
+		frame_free (copy);
+	lock_release (&frame_lock);
+
+	if (success && zero && !swap_in (page, frame->kva))
+		success = false;
+	if (!success) {
+		vm_free_frame (page);
+		return false;
+	}
+	if (fresh != NULL)
+		vm_frame_unpin (fresh);
+	return true;
+}
+
+/* Handles a fault at ADDR in SPT, the address space of the current
+ * thread T, whose lock is held.  Returns true if the access may be
+ * retried. */
+static bool
+handle_fault (struct thread *t, struct supplemental_page_table *spt,
+		struct intr_frame *f, void *addr, bool user, bool write,
+		bool not_present) {
+	struct page *page;
+	uint64_t start, elapsed;
+	bool grew = false;
+
+	page = vm_find_page (spt, addr);
+	if (page == NULL && is_stack_access (addr, user ? f->rsp : t->user_rsp)
+			&& vm_stack_growth (spt, addr)) {
+		grew = true;
+		page = vm_find_page (spt, addr);
+	}
+	if (page == NULL || (write && !page->writable))
+		return false;
+	if (!not_present)
+		return vm_handle_wp (page);
+	ws_fault (spt);
+	if (page->evicted)
+		lru_refault (page);
+	start = rdtsc ();
+	if (fault_minor (page))
+		minor_map_cnt++;
+	else if (!write && zero_fillable (page)) {
+		if (!vm_map_zero (page))
+			return false;
+	} else {
+		if (anon_swapped (page)) {
+			/* Read ahead into the swap cache, it is a minor fault. */
+			if (!anon_swap_cached (page))
+				swap_fault_cnt++;
+		} else if (page_get_type (page) == VM_FILE && page->frame == NULL)
+			file_fault_cnt++;
+		else if (page->frame == NULL)
+			zero_fill_fault_cnt++;
+		if (!vm_do_claim_page (page))
+			return false;
+		if (grew)
+			prefetch_run (spt, page->vma, (uint8_t *) page->va - PGSIZE,
+					-PGSIZE, vm_stack_batch - 1, true);
+		else if (page->vma != NULL && page->vma->advice == MADV_SEQUENTIAL)
+			fault_sequential (spt, page);
+		else if (vm_fault_around > 0 && page->vma != NULL)
+			fault_around (spt, page);
+	}
+	elapsed = rdtsc () - start;
+	fault_cnt++;
+	fault_tsc += elapsed;
+	if (elapsed > max_fault_tsc)
+		max_fault_tsc = elapsed;
+	return true;
 }
 
 /* Return true on success */
 bool
-vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
-		bool user UNUSED, bool write UNUSED, bool not_present UNUSED) {
-	struct supplemental_page_table *spt UNUSED = &thread_current ()->spt;
-	struct page *page = NULL;
-	/* TODO: Validate the fault */
-	/* TODO: Your code goes here */
+vm_try_handle_fault (struct intr_frame *f, void *addr,
+		bool user, bool write, bool not_present) {
+	struct thread *t = thread_current ();
+	struct supplemental_page_table *spt = &t->leader->spt;
+	long long inblock = t->ru.inblock;
+	enum disk_ioclass ioclass;
+	bool handled;
 
-	return vm_do_claim_page (page);
+	/* A missing user page is brought in, and an access just below the
+	 * stack grows it.  A fault on a present page is a protection
+	 * violation, unless it is a write to a writable page that is
+	 * shared copy-on-write.  Threads sharing the address space take
+	 * their faults one at a time, so that a page is claimed once. */
+	if (t->pml4 == NULL || addr == NULL || !is_user_vaddr (addr)
+			|| (!not_present && !write) || spt->oom_killed)
+		return false;
+
+	/* The faulting thread can do nothing until the fault is handled,
+	 * so its disk requests, swap-in and eviction alike, go ahead of
+	 * other threads'. */
+	ioclass = disk_set_ioclass (DISK_IOC_RT);
+	lock_acquire (&spt->lock);
+	handled = handle_fault (t, spt, f, addr, user, write, not_present);
+	lock_release (&spt->lock);
+	disk_set_ioclass (ioclass);
+
+	/* A fault is major if it had to wait for a read from disk. */
+	if (handled) {
+		if (t->ru.inblock != inblock)
+			t->ru.majflt++;
+		else
+			t->ru.minflt++;
+	}
+	return handled;
 }
 
 /* Free the page.
@@ -148,43 +2016,530 @@ vm_dealloc_page (struct page *page) {
 	free (page);
 }
 
+/* Unmaps PAGE and releases its frame, if it has one.  Page types call
+ * this from their destroy operation. */
+void
+vm_free_frame (struct page *page) {
+	struct frame *frame;
+
+	lock_acquire (&frame_lock);
+	while (page->frame != NULL && page->frame->evicting)
+		cond_wait (&evict_cond, &frame_lock);
+	frame = page->frame;
+	if (frame != NULL) {
+		prefetch_settle (page, true);
+		pml4_clear_page (page->owner->pml4, page->va);
+		frame_unlink (frame, page);
+		if (frame->page == NULL && frame != &zero_frame) {
+			/* A segment keeps its page's frame, off the frame table. */
+			if (page_get_type (page) == VM_SHM
+					&& shm_slot (page)->frame == frame)
+				frame_remove (frame);
+			else
+				frame_free (frame);
+		}
+	}
+	lock_release (&frame_lock);
+}
+
+/* Waits out any eviction of PAGE's frame and pins the frame, so that it
+ * can be written back while it is not locked.  Returns the frame, or a
+ * null pointer if PAGE is not resident.  Sets *DIRTY to whether the
+ * frame has been written through any of its mappings, and clears their
+ * dirty bits. */
+struct frame *
+vm_frame_pin (struct page *page, bool *dirty) {
+	struct frame *frame;
+
+	lock_acquire (&frame_lock);
+	while (page->frame != NULL && page->frame->evicting)
+		cond_wait (&evict_cond, &frame_lock);
+	frame = page->frame;
+	if (frame != NULL) {
+		struct list_elem *e;
+
+		frame->pin_cnt++;
+		*dirty = frame_dirty (frame);
+		for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+				e = list_next (e)) {
+			struct page *p = list_entry (e, struct page, frame_elem);
+
+			pml4_set_dirty (p->owner->pml4, p->va, false);
+		}
+	}
+	lock_release (&frame_lock);
+	return frame;
+}
+
+/* Releases a pin on FRAME. */
+void
+vm_frame_unpin (struct frame *frame) {
+	lock_acquire (&frame_lock);
+	ASSERT (frame->pin_cnt > 0);
+	frame->pin_cnt--;
+	lock_release (&frame_lock);
+}
+
+/* Brings in the pages of [VA, END) in VMA of SPT that have contents to
+ * read and are not resident, in prefetch batches, and returns how many
+ * it brought in.  If FRESH, pages never touched are given zeroed frames
+ * as well.  Stops once free frames run short, since a prefetch never
+ * evicts. */
+static long long
+prefetch_range (struct supplemental_page_table *spt, struct vma *vma,
+		uint8_t *va, uint8_t *end, bool fresh) {
+	long long before = prefetch_cnt;
+
+	for (; va < end; va += PGSIZE) {
+		struct page *p = spt_find_page (spt, va);
+		size_t cnt = (end - va) / PGSIZE;
+
+		if (!prefetchable (vma, p, va) && !(fresh && p == NULL))
+			continue;
+		prefetch_run (spt, vma, va, PGSIZE,
+				cnt < PREFETCH_MAX ? cnt : PREFETCH_MAX, fresh);
+		p = spt_find_page (spt, va);
+		if (p == NULL || p->frame == NULL)
+			break;
+	}
+	return prefetch_cnt - before;
+}
+
+/* Destroys the pages of [VA, END) in SPT, so that each is made afresh
+ * from its region when it is next touched. */
+static void
+madvise_dontneed (struct supplemental_page_table *spt, uint8_t *va,
+		uint8_t *end) {
+	for (; va < end; va += PGSIZE) {
+		struct page *p = spt_find_page (spt, va);
+
+		if (p != NULL) {
+			spt_remove_page (spt, p);
+			dontneed_cnt++;
+		}
+	}
+}
+
+/* Returns true if every page of [START, END) is in some region of SPT. */
+static bool
+range_mapped (struct supplemental_page_table *spt, uint8_t *start,
+		uint8_t *end) {
+	struct vma *vma;
+	uint8_t *va;
+
+	for (va = start; va < end; va = vma->end) {
+		vma = vma_find (spt, va);
+		if (vma == NULL)
+			return false;
+	}
+	return true;
+}
+
+/* Carries out ADVICE, one of the MADV_* values of <mman.h>, for the
+ * LENGTH bytes at page-aligned ADDR in the current process, all of which
+ * must be mapped.
+ *
+ * MADV_NORMAL and MADV_SEQUENTIAL are kept per region, and since
+ * regions are not split, they apply to the whole of every region the
+ * range touches.  MADV_WILLNEED reads in the range's pages whose
+ * contents are on disk, as fault-around does.  MADV_DONTNEED destroys
+ * the range's pages: modified file-backed ones are written back, and
+ * frames, swap slots and compressed copies are freed, so that an
+ * anonymous page reads as it did when first touched again.
+ *
+ * Returns false, doing nothing, if ADVICE is unknown or the range is
+ * not aligned or not mapped. */
+bool
+vm_madvise (void *addr, size_t length, int advice) {
+	struct supplemental_page_table *spt = &thread_current ()->leader->spt;
+	uint8_t *start = addr, *end, *va;
+	struct vma *vma;
+	bool ok = true;
+
+	if (advice != MADV_NORMAL && advice != MADV_SEQUENTIAL
+			&& advice != MADV_WILLNEED && advice != MADV_DONTNEED)
+		return false;
+	if (pg_ofs (addr) != 0 || !is_user_vaddr (addr)
+			|| length > (uintptr_t) KERN_BASE - (uintptr_t) addr)
+		return false;
+	end = start + ROUND_UP (length, PGSIZE);
+
+	lock_acquire (&spt->lock);
+	ok = range_mapped (spt, start, end);
+	for (va = start; ok && va < end; va = vma->end) {
+		uint8_t *stop;
+
+		vma = vma_find (spt, va);
+		stop = (uint8_t *) vma->end < end ? vma->end : end;
+
+		switch (advice) {
+			case MADV_NORMAL:
+			case MADV_SEQUENTIAL:
+				vma->advice = advice;
+				break;
+			case MADV_WILLNEED:
+				willneed_cnt += prefetch_range (spt, vma, va, stop, false);
+				break;
+			case MADV_DONTNEED:
+				madvise_dontneed (spt, va, stop);
+				break;
+		}
+	}
+	lock_release (&spt->lock);
+	return ok;
+}
+
+/* Writes the modified pages of the file-backed regions in the LENGTH
+ * bytes at page-aligned ADDR in the current process, all of which must
+ * be mapped, back to their files.  FLAGS is MS_ASYNC or MS_SYNC, from
+ * <mman.h>.  MS_ASYNC leaves the data in the buffer cache, whose
+ * writeback thread takes it to disk within a second; MS_SYNC also waits
+ * for the files to be written to disk, as fsync() does.  Pages not
+ * written since their last writeback are skipped.
+ *
+ * Returns false, doing nothing, if FLAGS is invalid or the range is not
+ * aligned or not mapped. */
+bool
+vm_msync (void *addr, size_t length, int flags) {
+	struct supplemental_page_table *spt = &thread_current ()->leader->spt;
+	uint8_t *start = addr, *end, *va;
+	struct vma *vma;
+	bool ok;
+
+	if (flags != MS_ASYNC && flags != MS_SYNC)
+		return false;
+	if (pg_ofs (addr) != 0 || !is_user_vaddr (addr)
+			|| length > (uintptr_t) KERN_BASE - (uintptr_t) addr)
+		return false;
+	end = start + ROUND_UP (length, PGSIZE);
+
+	lock_acquire (&spt->lock);
+	ok = range_mapped (spt, start, end);
+	for (va = start; ok && va < end; va = vma->end) {
+		vma = vma_find (spt, va);
+		if (VM_TYPE (vma->type) != VM_FILE || vma->file == NULL)
+			continue;
+		file_backed_writeback (spt, vma, va,
+				(uint8_t *) vma->end < end ? vma->end : end);
+		if (flags == MS_SYNC)
+			inode_flush (file_get_inode (vma->file));
+		msync_cnt++;
+	}
+	lock_release (&spt->lock);
+	return ok;
+}
+
+/* Moves the current process's program break by INCREMENT bytes, as
+ * sbrk() does, and returns the break's old value, or (void *) -1 if the
+ * heap cannot grow that far or would shrink below its start.  The heap
+ * is one anonymous region, whose pages are zero-filled on their first
+ * fault like any other; the pages a shrinking break uncovers are freed.
+ * The heap stops short of the room the stack may grow into. */
+void *
+vm_sbrk (intptr_t increment) {
+	struct supplemental_page_table *spt = &thread_current ()->leader->spt;
+	uint8_t *limit = (uint8_t *) USER_STACK - STACK_MAX;
+	uint8_t *old_brk, *new_brk, *old_end, *new_end;
+	struct vma *vma;
+	void *ret = (void *) -1;
+
+	lock_acquire (&spt->lock);
+	old_brk = spt->brk;
+	if (spt->heap_start == NULL
+			|| (increment < 0
+				? (uintptr_t) -increment > (uintptr_t) (old_brk - spt->heap_start)
+				: (uintptr_t) increment > (uintptr_t) (limit - old_brk)))
+		goto done;
+	new_brk = old_brk + increment;
+	old_end = pg_round_up (old_brk);
+	new_end = pg_round_up (new_brk);
+
+	vma = old_end > spt->heap_start ? vma_find (spt, spt->heap_start) : NULL;
+	if (new_end > old_end) {
+		if (vma == NULL)
+			vma = vma_create (spt, spt->heap_start,
+					new_end - spt->heap_start, VM_ANON, true);
+		else if (!vma_extend_up (spt, vma, new_end, 0))
+			vma = NULL;
+		if (vma == NULL)
+			goto done;
+	} else if (new_end < old_end && vma != NULL) {
+		if (new_end == spt->heap_start)
+			vma_destroy (spt, vma);
+		else
+			vma_truncate (spt, vma, new_end);
+	}
+	spt->brk = new_brk;
+	ret = old_brk;
+
+done:
+	lock_release (&spt->lock);
+	return ret;
+}
+
+/* Reads in the whole of the region mapped at ADDR in the current
+ * process and maps every page of it, so that touching it never faults,
+ * as mmap() does for MAP_POPULATE.  The file sectors behind the region
+ * are handed to the buffer cache's read-ahead all at once first, so that
+ * they stream in while earlier pages are being copied.  Pages that fit
+ * in no free frame are left to be faulted in as usual. */
+void
+vm_populate (void *addr) {
+	struct supplemental_page_table *spt = &thread_current ()->leader->spt;
+	struct vma *vma;
+
+	lock_acquire (&spt->lock);
+	vma = vma_find (spt, addr);
+	if (vma != NULL && vma->start == addr) {
+		if (vma->file != NULL && vma->read_bytes > 0)
+			inode_readahead (file_get_inode (vma->file), vma->offset,
+					vma->read_bytes);
+		populate_cnt += prefetch_range (spt, vma, vma->start, vma->end, true);
+	}
+	lock_release (&spt->lock);
+}
+
 /* Claim the page that allocate on VA. */
 bool
-vm_claim_page (void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function */
+vm_claim_page (void *va) {
+	struct page *page = vm_find_page (&thread_current ()->leader->spt, va);
 
+	if (page == NULL)
+		return false;
 	return vm_do_claim_page (page);
 }
 
+/* Claims PAGE, a page of a shared memory segment.  Faults on one
+ * segment are taken one at a time, under its lock, so that each page
+ * of it is brought in once: the first fault fills a frame, from swap
+ * or with zeros, and publishes it in the segment, and the others map
+ * the same frame, writable.  A frame the segment kept since its last
+ * mapping went away goes back into the frame table. */
+static bool
+shm_claim (struct page *page) {
+	struct shm *shm = page->vma->shm;
+	struct shm_slot *slot = shm_slot (page);
+	struct frame *frame;
+	bool success = true;
+
+	lock_acquire (&shm->lock);
+	lock_acquire (&frame_lock);
+	while (slot->frame != NULL && slot->frame->evicting)
+		cond_wait (&evict_cond, &frame_lock);
+	frame = slot->frame;
+	if (page->frame != NULL) {
+		/* Stayed resident through an eviction attempt. */
+		lock_release (&frame_lock);
+		lock_release (&shm->lock);
+		return true;
+	}
+	if (frame != NULL) {
+		if (list_empty (&frame->pages))
+			frame_insert (frame);
+		shm_share (page);
+		frame_link (frame, page);
+		if (!frame_map (frame, page, false)) {
+			frame_unlink (frame, page);
+			if (list_empty (&frame->pages))
+				frame_remove (frame);
+			success = false;
+		}
+		lock_release (&frame_lock);
+		lock_release (&shm->lock);
+		return success;
+	}
+	lock_release (&frame_lock);
+
+	frame = vm_get_frame ();
+	if (frame == NULL) {
+		lock_release (&shm->lock);
+		return false;
+	}
+	lock_acquire (&frame_lock);
+	frame_link (frame, page);
+	lock_release (&frame_lock);
+	if (!frame_map (frame, page, false) || !swap_in (page, frame->kva)) {
+		vm_free_frame (page);
+		lock_release (&shm->lock);
+		return false;
+	}
+	lock_acquire (&frame_lock);
+	slot->frame = frame;
+	frame->pin_cnt--;
+	lock_release (&frame_lock);
+	lock_release (&shm->lock);
+	return true;
+}
+
 /* Claim the PAGE and set up the mmu. */
 static bool
 vm_do_claim_page (struct page *page) {
-	struct frame *frame = vm_get_frame ();
+	struct frame *frame;
 
-	/* Set links */
-	frame->page = page;
-	page->frame = frame;
+	if (page_get_type (page) == VM_SHM)
+		return shm_claim (page);
+
+	/* Wait out an eviction of PAGE.  If PAGE stayed resident, it has been
+	 * mapped again, and there is nothing left to do. */
+	lock_acquire (&frame_lock);
+	while (page->frame != NULL && page->frame->evicting)
+		cond_wait (&evict_cond, &frame_lock);
+	if (page->frame != NULL || file_cache_attach (page)) {
+		lock_release (&frame_lock);
+		return true;
+	}
+	lock_release (&frame_lock);
 
-	/* TODO: Insert page table entry to map page's VA to frame's PA. */
+	frame = vm_get_frame ();
+	if (frame == NULL)
+		return false;
 
-	return swap_in (page, frame->kva);
+	/* Set links */
+	lock_acquire (&frame_lock);
+	frame_link (frame, page);
+	lock_release (&frame_lock);
+
+	if (!frame_map (frame, page, false) || !swap_in (page, frame->kva)) {
+		vm_free_frame (page);
+		return false;
+	}
+	lock_acquire (&frame_lock);
+	frame->pin_cnt--;
+	file_cache_insert (frame, page);
+	lock_release (&frame_lock);
+	return true;
 }
 
 /* Initialize new supplemental page table */
 void
-supplemental_page_table_init (struct supplemental_page_table *spt UNUSED) {
+supplemental_page_table_init (struct supplemental_page_table *spt) {
+	lock_init (&spt->lock);
+	vma_table_init (spt);
+	spt->rss = 0;
+	spt->swap_cnt = 0;
+	spt->oom_killed = false;
+	spt->ws_target = WS_MIN;
+	spt->last_fault = timer_ticks ();
+	spt->fault_cnt = 0;
+	spt->stack_grow_cnt = 0;
+	spt->heap_start = spt->brk = NULL;
+	if (!ohash_init (&spt->pages, 0))
+		PANIC ("supplemental page table initialization failed");
+}
+
+/* Copies SRC's page PAGE into DST's region VMA, for fork, which calls
+ * this in the child.  An anonymous page is shared copy-on-write: the
+ * copy maps the same frame, or holds the same swap slot, and the frame
+ * is mapped read-only in both until one of them writes to it.  Pages
+ * not yet loaded are recreated as they are.  A file-backed page is not
+ * copied; it is written back, so the child's own faults read the
+ * current contents. */
+static bool
+page_copy (struct supplemental_page_table *dst, struct vma *vma,
+		struct page *page) {
+	struct frame *frame;
+	struct page *copy;
+
+	switch (VM_TYPE (page->operations->type)) {
+		case VM_UNINIT:
+			return page_create (dst, vma, page->va, page->uninit.type,
+					page->writable, page->uninit.init, page->uninit.aux) != NULL;
+		case VM_ANON:
+			break;
+		case VM_SHM:
+			/* The child maps the segment's frame on its own faults. */
+			return true;
+		default:
+			file_backed_sync (page);
+			return true;
+	}
+
+	copy = malloc_tagged (sizeof *copy, TAG_VM);
+	if (copy == NULL)
+		return false;
+	*copy = (struct page) {
+		.operations = page->operations,
+		.va = page->va,
+		.owner = thread_current ()->leader,
+		.vma = vma,
+		.writable = page->writable,
+	};
+	if (!spt_insert_page (dst, copy)) {
+		free (copy);
+		return false;
+	}
+	list_push_back (&vma->pages, &copy->vma_elem);
+
+	lock_acquire (&frame_lock);
+	while (page->frame != NULL && page->frame->evicting)
+		cond_wait (&evict_cond, &frame_lock);
+	frame = page->frame;
+	anon_share_swap (copy, page);
+	if (frame != NULL) {
+		frame_link (frame, copy);
+		cow_share_cnt++;
+		if (!frame_map (frame, page, true) || !frame_map (frame, copy, false)) {
+			/* The child's destroy undoes the link. */
+			lock_release (&frame_lock);
+			return false;
+		}
+	}
+	lock_release (&frame_lock);
+	return true;
 }
 
 /* Copy supplemental page table from src to dst */
 bool
-supplemental_page_table_copy (struct supplemental_page_table *dst UNUSED,
-		struct supplemental_page_table *src UNUSED) {
+supplemental_page_table_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src) {
+	struct rb_node *n;
+
+	dst->heap_start = src->heap_start;
+	dst->brk = src->brk;
+	for (n = rb_first (&src->vmas); n != NULL; n = rb_next (n)) {
+		struct vma *svma = rb_entry (n, struct vma, elem);
+		struct vma *vma;
+		struct list_elem *e;
+
+		vma = vma_create (dst, svma->start,
+				(uint8_t *) svma->end - (uint8_t *) svma->start,
+				svma->type, svma->writable);
+		if (vma == NULL)
+			return false;
+		if (svma->file != NULL) {
+			vma->file = file_reopen (svma->file);
+			if (vma->file == NULL)
+				return false;
+		}
+		vma->offset = svma->offset;
+		vma->read_bytes = svma->read_bytes;
+		vma->init = svma->init;
+		vma->aux = svma->aux;
+		vma->advice = svma->advice;
+		if (svma->shm != NULL)
+			vma->shm = shm_dup (svma->shm);
+
+		for (e = list_begin (&svma->pages); e != list_end (&svma->pages);
+				e = list_next (e))
+			if (!page_copy (dst, vma, list_entry (e, struct page, vma_elem)))
+				return false;
+	}
+	return true;
 }
 
 /* Free the resource hold by the supplemental page table */
 void
-supplemental_page_table_kill (struct supplemental_page_table *spt UNUSED) {
-	/* TODO: Destroy all the supplemental_page_table hold by thread and
-	 * TODO: writeback all the modified contents to the storage. */
+supplemental_page_table_kill (struct supplemental_page_table *spt) {
+	/* Every page belongs to a region, and unmapping a region destroys
+	 * its pages, which writes back their modified contents.  The table
+	 * stays usable, since exec reloads into the same one. */
+	vma_destroy_all (spt);
+	ASSERT (ohash_empty (&spt->pages));
+
+	/* Let those waiting for an OOM victim's frames look again. */
+	if (spt->oom_killed) {
+		lock_acquire (&frame_lock);
+		cond_broadcast (&evict_cond, &frame_lock);
+		lock_release (&frame_lock);
+	}
 }
@@ -0,0 +1,215 @@
+/* vma.c: Virtual memory areas.
+ *
+ * A process's address space is a set of disjoint regions, kept in
+ * a red-black tree ordered by start address.  Mapping a region,
+ * however large, costs one descriptor and O(log n) time: the
+ * pages in it are not created until they are first faulted on,
+ * so a sparse address space pays only for the pages it touches. */
+
+#include "vm/vma.h"
+#include <round.h>
+#include <string.h>
+#include <timepage.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/vaddr.h"
+
+/* Orders regions by start address. */
+static bool
+vma_less (const struct rb_node *a, const struct rb_node *b,
+		void *aux UNUSED) {
+	return rb_entry (a, struct vma, elem)->start
+		< rb_entry (b, struct vma, elem)->start;
+}
+
+/* Initializes the region tree of SPT. */
+void
+vma_table_init (struct supplemental_page_table *spt) {
+	rb_init (&spt->vmas, vma_less, NULL);
+}
+
+/* Returns the region of SPT with the greatest start address not
+ * above ADDR, or a null pointer if there is none. */
+static struct vma *
+vma_floor (struct supplemental_page_table *spt, const void *addr) {
+	struct vma key = { .start = (void *) addr };
+	struct rb_node *n;
+
+	n = rb_floor (&spt->vmas, &key.elem);
+	return n != NULL ? rb_entry (n, struct vma, elem) : NULL;
+}
+
+/* Maps a region of LENGTH bytes, rounded up to whole pages, at
+ * page-aligned START in SPT.  Its pages are of TYPE, writable if
+ * WRITABLE, and zero-filled; the caller may set the region's
+ * backing store and initializer before any of them is touched.
+ * Returns the new region, or a null pointer if the range is not
+ * in user space, overlaps an existing region or the time page, or
+ * memory is short. */
+struct vma *
+vma_create (struct supplemental_page_table *spt, void *start,
+		size_t length, enum vm_type type, bool writable) {
+	struct vma *vma, *prev;
+	uint8_t *end;
+
+	if (pg_ofs (start) != 0 || length == 0 || !is_user_vaddr (start)
+			|| length > (uintptr_t) KERN_BASE - (uintptr_t) start)
+		return NULL;
+	end = (uint8_t *) start + ROUND_UP (length, PGSIZE);
+	if ((uint8_t *) start <= (uint8_t *) TIMEPAGE_ADDR
+			&& end > (uint8_t *) TIMEPAGE_ADDR)
+		return NULL;
+
+	/* Only the last region starting below END can overlap. */
+	prev = vma_floor (spt, end - 1);
+	if (prev != NULL && prev->end > start)
+		return NULL;
+
+	vma = malloc_tagged (sizeof *vma, TAG_VM);
+	if (vma == NULL)
+		return NULL;
+	*vma = (struct vma) {
+		.start = start,
+		.end = end,
+		.type = type,
+		.writable = writable,
+	};
+	list_init (&vma->pages);
+	rb_insert (&spt->vmas, &vma->elem);
+	return vma;
+}
+
+/* Returns the region of SPT that contains ADDR, or a null pointer
+ * if ADDR is unmapped. */
+struct vma *
+vma_find (struct supplemental_page_table *spt, const void *addr) {
+	struct vma *vma = vma_floor (spt, addr);
+
+	return vma != NULL && (const void *) vma->end > addr ? vma : NULL;
+}
+
+/* Unmaps VMA from SPT.  Writes back the modified pages of a
+ * file-backed region, destroys each page materialized in the region,
+ * then closes the backing file or segment and frees VMA. */
+void
+vma_destroy (struct supplemental_page_table *spt, struct vma *vma) {
+	if (VM_TYPE (vma->type) == VM_FILE)
+		file_backed_writeback (spt, vma, vma->start, vma->end);
+	while (!list_empty (&vma->pages)) {
+		struct page *page = list_entry (list_front (&vma->pages),
+				struct page, vma_elem);
+		spt_remove_page (spt, page);
+	}
+	rb_remove (&spt->vmas, &vma->elem);
+	file_close (vma->file);
+	if (vma->shm != NULL)
+		shm_put (vma->shm);
+	free (vma);
+}
+
+/* Unmaps every region of SPT. */
+void
+vma_destroy_all (struct supplemental_page_table *spt) {
+	while (!rb_empty (&spt->vmas))
+		vma_destroy (spt, rb_entry (rb_first (&spt->vmas),
+					struct vma, elem));
+}
+
+/* Extends anonymous VMA in SPT down to page-aligned START, leaving at
+ * least GAP bytes unmapped between it and the region below.  Returns
+ * false, changing nothing, if that room is not there. */
+bool
+vma_extend_down (struct supplemental_page_table *spt UNUSED, struct vma *vma,
+		void *start, size_t gap) {
+	struct rb_node *n = rb_prev (&vma->elem);
+
+	ASSERT (pg_ofs (start) == 0);
+	ASSERT (vma->file == NULL);
+
+	if (start >= vma->start)
+		return true;
+	if ((uintptr_t) start < gap || (n != NULL
+				&& (uint8_t *) rb_entry (n, struct vma, elem)->end + gap
+				> (uint8_t *) start))
+		return false;
+
+	/* No region lies in between, so the tree stays in order. */
+	vma->start = start;
+	return true;
+}
+
+/* Extends anonymous VMA in SPT up to page-aligned END, leaving at
+ * least GAP bytes unmapped between it and the region above.  Returns
+ * false, changing nothing, if that room is not there. */
+bool
+vma_extend_up (struct supplemental_page_table *spt UNUSED, struct vma *vma,
+		void *end, size_t gap) {
+	struct rb_node *n = rb_next (&vma->elem);
+
+	ASSERT (pg_ofs (end) == 0);
+	ASSERT (vma->file == NULL);
+
+	if (end <= vma->end)
+		return true;
+	if (!is_user_vaddr ((uint8_t *) end - 1)
+			|| ((uint8_t *) vma->end <= (uint8_t *) TIMEPAGE_ADDR
+				&& (uint8_t *) end > (uint8_t *) TIMEPAGE_ADDR)
+			|| (n != NULL && (uint8_t *) end + gap
+				> (uint8_t *) rb_entry (n, struct vma, elem)->start))
+		return false;
+
+	vma->end = end;
+	return true;
+}
+
+/* Shrinks anonymous VMA in SPT to end at page-aligned END, above its
+ * start, destroying the pages it no longer covers. */
+void
+vma_truncate (struct supplemental_page_table *spt, struct vma *vma,
+		void *end) {
+	struct list_elem *e;
+
+	ASSERT (pg_ofs (end) == 0);
+	ASSERT (vma->file == NULL);
+	ASSERT (end > vma->start && end <= vma->end);
+
+	for (e = list_begin (&vma->pages); e != list_end (&vma->pages); ) {
+		struct page *page = list_entry (e, struct page, vma_elem);
+
+		e = list_next (e);
+		if (page->va >= end)
+			spt_remove_page (spt, page);
+	}
+	vma->end = end;
+}
+
+/* Returns the number of bytes of the page at VA in VMA that come
+ * from the backing file, and stores their file offset in *OFS. */
+size_t
+vma_page_bytes (const struct vma *vma, const void *va, off_t *ofs) {
+	size_t pos = (const uint8_t *) va - (const uint8_t *) vma->start;
+
+	ASSERT (pg_ofs (va) == 0);
+	ASSERT (va >= vma->start && va < vma->end);
+
+	*ofs = vma->offset + pos;
+	if (vma->file == NULL || pos >= vma->read_bytes)
+		return 0;
+	return vma->read_bytes - pos < PGSIZE ? vma->read_bytes - pos : PGSIZE;
+}
+
+/* Fills KVA with the contents of the page at VA in VMA: its
+ * backed bytes are read from the file and the rest is zeroed.
+ * Returns false if the file is shorter than expected. */
+bool
+vma_read_page (const struct vma *vma, const void *va, void *kva) {
+	off_t ofs;
+	size_t read_bytes = vma_page_bytes (vma, va, &ofs);
+
+	if (read_bytes > 0
+			&& file_read_at (vma->file, kva, read_bytes, ofs)
+			!= (off_t) read_bytes)
+		return false;
+	memset ((uint8_t *) kva + read_bytes, 0, PGSIZE - read_bytes);
+	return true;
+}
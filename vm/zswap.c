@@ -0,0 +1,299 @@
+/* zswap.c: Compressed in-memory cache in front of the swap disk. */
+
+#include "vm/zswap.h"
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/vm.h"
+
+/* An evicted anonymous page is first offered to the pool here,
+ * which keeps it compressed in kernel memory, so that faulting it
+ * back costs a decompression instead of a disk read.  Only pages
+ * that do not fit, because the pool is full or because they do not
+ * compress to ZSWAP_SIZE_MAX bytes, go to the swap disk.  A page of
+ * one repeated byte, zeros above all, is stored as just that byte.
+ *
+ * The pool may hold vm_zswap_percent percent of the user pool's size
+ * in compressed bytes, set by the -zswap option; zero, the default,
+ * disables it.  Entries are never written back to disk: once the
+ * pool is full, later evictions go to disk directly.
+ *
+ * Like swap slots, entries are reference counted, since a page
+ * swapped out while shared copy-on-write leaves every sharer holding
+ * the same entry.
+ *
+ * Pages are compressed with a byte-oriented LZ77 in the format of
+ * LZ4 blocks: a sequence of tokens, each a count of literal bytes
+ * that follow it and the length and distance of an earlier run of
+ * bytes to copy after them. */
+
+/* Percentage of the user pool, set by the -zswap option. */
+unsigned vm_zswap_percent;
+
+/* Largest compressed page worth keeping. */
+#define ZSWAP_SIZE_MAX (PGSIZE * 3 / 4)
+
+/* A stored page. */
+struct zswap_entry {
+	unsigned refs;              /* Pages holding it. */
+	uint16_t size;              /* Bytes in DATA, or 0 if same-filled. */
+	uint8_t fill;               /* The byte, if same-filled. */
+	uint8_t data[];             /* Compressed contents. */
+};
+
+static struct lock zswap_lock;  /* Protects the pool and the buffers. */
+static size_t pool_max;         /* Most bytes the pool may use. */
+static size_t pool_used;        /* Bytes used by entries. */
+
+/* Statistics. */
+static long long store_cnt;     /* Pages stored compressed. */
+static long long same_cnt;      /* Pages stored as one byte. */
+static long long reject_cnt;    /* Pages that did not compress enough. */
+static long long full_cnt;      /* Pages turned away by a full pool. */
+static long long load_cnt;      /* Pages loaded back. */
+static size_t pool_high;        /* High-water mark of POOL_USED. */
+
+/* Compressor state, used under ZSWAP_LOCK. */
+#define HASH_BITS 10
+#define MIN_MATCH 4
+static uint16_t hash_tab[1 << HASH_BITS];  /* Positions + 1, or 0. */
+static uint8_t zbuf[ZSWAP_SIZE_MAX];       /* Compressed output. */
+
+/* Sets up the pool, after the kernel options are parsed. */
+void
+zswap_init (void) {
+	lock_init (&zswap_lock);
+	if (vm_zswap_percent > 100)
+		vm_zswap_percent = 100;
+	pool_max = palloc_user_page_cnt () * PGSIZE / 100 * vm_zswap_percent;
+}
+
+static inline uint32_t
+load32 (const uint8_t *p) {
+	uint32_t v;
+
+	memcpy (&v, p, sizeof v);
+	return v;
+}
+
+static inline unsigned
+hash32 (uint32_t v) {
+	return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/* Appends LEN, less the BASE already in a token nibble, to DST at
+ * *OP in 255-byte steps.  Returns false if that would pass LIMIT. */
+static bool
+put_length (uint8_t *dst, size_t *op, size_t limit, size_t len) {
+	for (; len >= 255; len -= 255) {
+		if (*op >= limit)
+			return false;
+		dst[(*op)++] = 255;
+	}
+	if (*op >= limit)
+		return false;
+	dst[(*op)++] = len;
+	return true;
+}
+
+/* Appends to DST at *OP a sequence of the LIT_CNT bytes at LIT and,
+ * if MATCH_LEN is nonzero, a copy of MATCH_LEN bytes from OFFSET
+ * bytes back.  Returns false if that would pass LIMIT. */
+static bool
+put_sequence (uint8_t *dst, size_t *op, size_t limit, const uint8_t *lit,
+		size_t lit_cnt, size_t offset, size_t match_len) {
+	size_t match_code = match_len != 0 ? match_len - MIN_MATCH : 0;
+
+	if (*op >= limit)
+		return false;
+	dst[(*op)++] = (lit_cnt < 15 ? lit_cnt : 15) << 4
+		| (match_code < 15 ? match_code : 15);
+	if (lit_cnt >= 15 && !put_length (dst, op, limit, lit_cnt - 15))
+		return false;
+	if (lit_cnt > limit - *op)
+		return false;
+	memcpy (dst + *op, lit, lit_cnt);
+	*op += lit_cnt;
+	if (match_len == 0)
+		return true;
+	if (limit - *op < 2)
+		return false;
+	dst[(*op)++] = offset & 0xff;
+	dst[(*op)++] = offset >> 8;
+	return match_code < 15 || put_length (dst, op, limit, match_code - 15);
+}
+
+/* Compresses the page at SRC into DST.  Returns the compressed size,
+ * or 0 if it would be more than LIMIT bytes. */
+static size_t
+lz_compress (const uint8_t *src, uint8_t *dst, size_t limit) {
+	size_t ip = 0, anchor = 0, op = 0;
+
+	memset (hash_tab, 0, sizeof hash_tab);
+	while (ip + MIN_MATCH <= PGSIZE) {
+		uint32_t seq = load32 (src + ip);
+		unsigned h = hash32 (seq);
+		size_t ref, len;
+
+		ref = hash_tab[h];
+		hash_tab[h] = ip + 1;
+		if (ref-- == 0 || load32 (src + ref) != seq) {
+			ip++;
+			continue;
+		}
+		for (len = MIN_MATCH; ip + len < PGSIZE && src[ref + len] == src[ip + len];
+				len++)
+			continue;
+		if (!put_sequence (dst, &op, limit, src + anchor, ip - anchor,
+					ip - ref, len))
+			return 0;
+		ip += len;
+		anchor = ip;
+	}
+	if (anchor < PGSIZE
+			&& !put_sequence (dst, &op, limit, src + anchor, PGSIZE - anchor,
+				0, 0))
+		return 0;
+	return op;
+}
+
+/* Reads a length continued in 255-byte steps from SRC at *IP. */
+static size_t
+get_length (const uint8_t *src, size_t *ip) {
+	size_t len = 0;
+	uint8_t b;
+
+	do
+		len += b = src[(*ip)++];
+	while (b == 255);
+	return len;
+}
+
+/* Decompresses SIZE bytes at SRC, made by lz_compress(), into the
+ * page at DST. */
+static void
+lz_decompress (const uint8_t *src, size_t size, uint8_t *dst) {
+	size_t ip = 0, op = 0;
+
+	while (op < PGSIZE) {
+		uint8_t token = src[ip++];
+		size_t lit_cnt = token >> 4, len = token & 15, offset;
+
+		if (lit_cnt == 15)
+			lit_cnt += get_length (src, &ip);
+		ASSERT (lit_cnt <= PGSIZE - op);
+		memcpy (dst + op, src + ip, lit_cnt);
+		ip += lit_cnt;
+		op += lit_cnt;
+		if (op == PGSIZE)
+			break;
+
+		offset = src[ip] | src[ip + 1] << 8;
+		ip += 2;
+		if (len == 15)
+			len += get_length (src, &ip);
+		len += MIN_MATCH;
+		ASSERT (offset > 0 && offset <= op && len <= PGSIZE - op);
+
+		/* Byte by byte: the copy may overlap its own output. */
+		for (; len > 0; len--, op++)
+			dst[op] = dst[op - offset];
+	}
+	ASSERT (ip == size);
+}
+
+/* Compresses the page at KVA into a new entry and returns it, or
+ * returns a null pointer if the pool is disabled or full or the
+ * page does not compress well enough. */
+struct zswap_entry *
+zswap_store (const void *kva) {
+	const uint8_t *src = kva;
+	struct zswap_entry *e = NULL;
+	size_t size;
+
+	if (pool_max == 0)
+		return NULL;
+
+	if (!memcmp (src, src + 1, PGSIZE - 1)) {
+		e = malloc_tagged (sizeof *e, TAG_VM);
+		if (e == NULL)
+			return NULL;
+		e->refs = 1;
+		e->size = 0;
+		e->fill = src[0];
+		lock_acquire (&zswap_lock);
+		same_cnt++;
+		lock_release (&zswap_lock);
+		return e;
+	}
+
+	lock_acquire (&zswap_lock);
+	size = lz_compress (src, zbuf, sizeof zbuf);
+	if (size == 0)
+		reject_cnt++;
+	else if (pool_used + sizeof *e + size > pool_max)
+		full_cnt++;
+	else if ((e = malloc_tagged (sizeof *e + size, TAG_VM)) != NULL) {
+		e->refs = 1;
+		e->size = size;
+		e->fill = 0;
+		memcpy (e->data, zbuf, size);
+		pool_used += sizeof *e + size;
+		if (pool_used > pool_high)
+			pool_high = pool_used;
+		store_cnt++;
+	}
+	lock_release (&zswap_lock);
+	return e;
+}
+
+/* Restores the page stored in E into the page at KVA. */
+void
+zswap_load (const struct zswap_entry *e, void *kva) {
+	if (e->size == 0)
+		memset (kva, e->fill, PGSIZE);
+	else
+		lz_decompress (e->data, e->size, kva);
+	__atomic_add_fetch (&load_cnt, 1, __ATOMIC_RELAXED);
+}
+
+/* Adds a reference to E. */
+void
+zswap_dup (struct zswap_entry *e) {
+	lock_acquire (&zswap_lock);
+	ASSERT (e->refs > 0);
+	e->refs++;
+	lock_release (&zswap_lock);
+}
+
+/* Drops a reference to E, freeing it with the last. */
+void
+zswap_free (struct zswap_entry *e) {
+	bool last;
+
+	lock_acquire (&zswap_lock);
+	ASSERT (e->refs > 0);
+	last = --e->refs == 0;
+	if (last && e->size != 0)
+		pool_used -= sizeof *e + e->size;
+	lock_release (&zswap_lock);
+	if (last)
+		free (e);
+}
+
+/* Prints zswap statistics. */
+void
+zswap_print_stats (void) {
+	if (pool_max == 0)
+		return;
+	printf ("zswap: %lld pages stored, %lld same-filled, %lld loaded; "
+			"%lld incompressible, %lld turned away full\n",
+			store_cnt, same_cnt, load_cnt, reject_cnt, full_cnt);
+	printf ("zswap: %zu of %zu bytes used, high-water %zu\n",
+			pool_used, pool_max, pool_high);
+}